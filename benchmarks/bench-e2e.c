@@ -0,0 +1,1020 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+/* End-to-end benchmark: a host TupContext talks to a simulated device over a
+ * pty, the device side of the pty being paced at the benchmarked baudrate.
+ * The host is a plain libsmp context which opens and configures the slave
+ * side of the pty like a serial device.
+ *
+ * A pty forwards bytes as fast as they are written whatever its termios
+ * speed, so the device end serializes them itself: a received byte is only
+ * handed to the device once it would have been received on a UART, and a
+ * byte written by the device is only written to the pty once it would have
+ * been sent. Transmission and reception overlap like on a real UART.
+ *
+ * With -l, the host talks to the device over an in-process TupSimLink
+ * instead, which delivers each frame once it would have been received and
+ * doesn't depend on the scheduling of the pty. */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <time.h>
+#include <unistd.h>
+#include <libtup.h>
+#include <libtupsim.h>
+
+#define N_ELEMENTS(arr) (sizeof((arr)) / sizeof((arr)[0]))
+
+#define E2E_DEFAULT_COUNT 500
+#define E2E_DEFAULT_WINDOW 8
+#define E2E_DEFAULT_BATCH 16
+
+/* response timeout, generous for the slowest baudrates */
+#define E2E_TIMEOUT_MS 2000
+
+/* slot loaded on the device before measuring */
+#define E2E_SLOT 1
+
+/* bytes handed to the device at once, so a frame is processed as soon as
+ * its last byte is received rather than with the whole pty buffer */
+#define E2E_RX_CHUNK 16
+
+/* bytes written by the device waiting for their transmission time */
+#define E2E_TX_CHUNK 64
+#define E2E_TX_QUEUE 256
+
+/* write combining buffer of the batched mode, bigger than any batch */
+#define E2E_COMBINE_SIZE (64 * 1024)
+
+#define E2E_MAX_MIXES 8
+#define E2E_MAX_BAUDRATES 8
+#define E2E_MAX_MIX_ENTRIES 32
+
+/* Paced line */
+
+typedef struct
+{
+    uint8_t data[E2E_TX_CHUNK];
+    size_t size;
+    uint64_t due_ns;
+} E2eChunk;
+
+/* device end of the pty */
+typedef struct
+{
+    int fd;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    /* time to serialize a byte at the current baudrate */
+    uint64_t byte_ns;
+
+    /* time at which the last received byte is fully received */
+    uint64_t rx_busy_ns;
+
+    /* bytes waiting for their transmission time, sent by tx_thread */
+    E2eChunk chunks[E2E_TX_QUEUE];
+    size_t head;
+    size_t len;
+    uint64_t tx_busy_ns;
+    pthread_t tx_thread;
+    int quit;
+} E2eLine;
+
+static uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t deadline_ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = deadline_ns / 1000000000;
+    ts.tv_nsec = deadline_ns % 1000000000;
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+static int write_all(int fd, const uint8_t *data, size_t size)
+{
+    struct pollfd pfd;
+    ssize_t ret;
+
+    while (size > 0) {
+        ret = write(fd, data, size);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return SMP_ERROR_IO;
+
+            pfd.fd = fd;
+            pfd.events = POLLOUT;
+            poll(&pfd, 1, -1);
+            continue;
+        }
+
+        data += ret;
+        size -= ret;
+    }
+
+    return 0;
+}
+
+static void *e2e_line_tx_thread(void *userdata)
+{
+    E2eLine *line = userdata;
+    E2eChunk *chunk;
+
+    /* wake up on time, bytes last a few microseconds at high baudrates */
+    prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+
+    pthread_mutex_lock(&line->lock);
+    while (!line->quit) {
+        if (line->len == 0) {
+            pthread_cond_wait(&line->cond, &line->lock);
+            continue;
+        }
+
+        /* the slot is not reused until len is decremented */
+        chunk = &line->chunks[line->head];
+        pthread_mutex_unlock(&line->lock);
+
+        sleep_until(chunk->due_ns);
+        write_all(line->fd, chunk->data, chunk->size);
+
+        pthread_mutex_lock(&line->lock);
+        line->head = (line->head + 1) % E2E_TX_QUEUE;
+        line->len--;
+        pthread_cond_broadcast(&line->cond);
+    }
+    pthread_mutex_unlock(&line->lock);
+
+    return NULL;
+}
+
+static int e2e_line_read(void *priv, uint8_t *buf, size_t size)
+{
+    E2eLine *line = priv;
+    uint64_t now;
+    ssize_t ret;
+
+    if (size > E2E_RX_CHUNK)
+        size = E2E_RX_CHUNK;
+
+    do {
+        ret = read(line->fd, buf, size);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : SMP_ERROR_IO;
+
+    /* bytes are received one after the other from the first time they are
+     * seen */
+    now = get_time_ns();
+    pthread_mutex_lock(&line->lock);
+    if (line->rx_busy_ns < now)
+        line->rx_busy_ns = now;
+
+    line->rx_busy_ns += ret * line->byte_ns;
+    now = line->rx_busy_ns;
+    pthread_mutex_unlock(&line->lock);
+
+    sleep_until(now);
+    return (int) ret;
+}
+
+static int e2e_line_write(void *priv, const uint8_t *data, size_t size)
+{
+    E2eLine *line = priv;
+    E2eChunk *chunk;
+    uint64_t now;
+    size_t n;
+
+    pthread_mutex_lock(&line->lock);
+    while (size > 0) {
+        while (line->len == E2E_TX_QUEUE && !line->quit)
+            pthread_cond_wait(&line->cond, &line->lock);
+
+        if (line->quit)
+            break;
+
+        n = size < E2E_TX_CHUNK ? size : E2E_TX_CHUNK;
+
+        now = get_time_ns();
+        if (line->tx_busy_ns < now)
+            line->tx_busy_ns = now;
+
+        line->tx_busy_ns += n * line->byte_ns;
+
+        chunk = &line->chunks[(line->head + line->len) % E2E_TX_QUEUE];
+        memcpy(chunk->data, data, n);
+        chunk->size = n;
+        chunk->due_ns = line->tx_busy_ns;
+        line->len++;
+        pthread_cond_broadcast(&line->cond);
+
+        data += n;
+        size -= n;
+    }
+    pthread_mutex_unlock(&line->lock);
+
+    return 0;
+}
+
+static int e2e_line_poll(void *priv, int timeout_ms)
+{
+    E2eLine *line = priv;
+    struct pollfd pfd;
+    int ret;
+
+    pfd.fd = line->fd;
+    pfd.events = POLLIN;
+
+    ret = poll(&pfd, 1, timeout_ms);
+    if (ret < 0)
+        return SMP_ERROR_IO;
+
+    return ret > 0;
+}
+
+static intptr_t e2e_line_get_fd(void *priv)
+{
+    E2eLine *line = priv;
+
+    return line->fd;
+}
+
+static const TupTransportOps e2e_line_ops = {
+    .read = e2e_line_read,
+    .write = e2e_line_write,
+    .poll = e2e_line_poll,
+    .get_fd = e2e_line_get_fd,
+};
+
+static void e2e_line_set_baudrate(E2eLine *line, unsigned long baudrate)
+{
+    pthread_mutex_lock(&line->lock);
+    /* start bit, 8 data bits and stop bit */
+    line->byte_ns = 10 * 1000000000ULL / baudrate;
+    pthread_mutex_unlock(&line->lock);
+}
+
+/* open a pty whose master side is the device end of the line, name is set to
+ * the slave side */
+static E2eLine *e2e_line_new(char *name, size_t size)
+{
+    E2eLine *line;
+
+    line = calloc(1, sizeof(*line));
+    if (line == NULL)
+        return NULL;
+
+    line->fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (line->fd < 0)
+        goto error;
+
+    if (grantpt(line->fd) < 0 || unlockpt(line->fd) < 0
+            || ptsname_r(line->fd, name, size) != 0)
+        goto close_fd;
+
+    pthread_mutex_init(&line->lock, NULL);
+    pthread_cond_init(&line->cond, NULL);
+
+    if (pthread_create(&line->tx_thread, NULL, e2e_line_tx_thread,
+                line) != 0) {
+        pthread_cond_destroy(&line->cond);
+        pthread_mutex_destroy(&line->lock);
+        goto close_fd;
+    }
+
+    return line;
+
+close_fd:
+    close(line->fd);
+error:
+    free(line);
+    return NULL;
+}
+
+static void e2e_line_free(E2eLine *line)
+{
+    pthread_mutex_lock(&line->lock);
+    line->quit = 1;
+    pthread_cond_broadcast(&line->cond);
+    pthread_mutex_unlock(&line->lock);
+    pthread_join(line->tx_thread, NULL);
+
+    close(line->fd);
+    pthread_cond_destroy(&line->cond);
+    pthread_mutex_destroy(&line->lock);
+    free(line);
+}
+
+/* Message mixes */
+
+typedef void (*E2eInitFunc)(TupMessage *msg, unsigned long i);
+
+typedef struct
+{
+    const char *name;
+    TupMessageType type;
+    E2eInitFunc init;
+} E2eCommand;
+
+typedef struct
+{
+    const char *name;
+    const E2eCommand *entries[E2E_MAX_MIX_ENTRIES];
+    size_t n_entries;
+} E2eMix;
+
+static void init_set_input(TupMessage *msg, unsigned long i)
+{
+    /* a scroll wheel streaming its position */
+    tup_message_init_set_input_value_simple(msg, E2E_SLOT, i % 4, i);
+}
+
+static void init_get_input(TupMessage *msg, unsigned long i)
+{
+    tup_message_init_get_input_value_simple(msg, E2E_SLOT, i % 4);
+}
+
+static void init_get_parameter(TupMessage *msg, unsigned long i)
+{
+    tup_message_init_get_parameter_simple(msg, E2E_SLOT, i % 32);
+}
+
+static void init_set_parameter(TupMessage *msg, unsigned long i)
+{
+    tup_message_init_set_parameter_simple(msg, E2E_SLOT, i % 32, i);
+}
+
+static void init_play(TupMessage *msg, unsigned long i)
+{
+    tup_message_init_play(msg, E2E_SLOT);
+}
+
+static void init_stop(TupMessage *msg, unsigned long i)
+{
+    tup_message_init_stop(msg, E2E_SLOT);
+}
+
+static const E2eCommand e2e_commands[] = {
+    { "set_input", TUP_MESSAGE_CMD_SET_INPUT_VALUE, init_set_input },
+    { "get_input", TUP_MESSAGE_CMD_GET_INPUT_VALUE, init_get_input },
+    { "get_parameter", TUP_MESSAGE_CMD_GET_PARAMETER, init_get_parameter },
+    { "set_parameter", TUP_MESSAGE_CMD_SET_PARAMETER, init_set_parameter },
+    { "play", TUP_MESSAGE_CMD_PLAY, init_play },
+    { "stop", TUP_MESSAGE_CMD_STOP, init_stop },
+};
+
+static const struct
+{
+    const char *name;
+    const char *spec;
+} e2e_builtin_mixes[] = {
+    { "scroll", "set_input" },
+    { "sweep", "get_parameter" },
+    { "mixed", "set_input:4,get_parameter:2,set_parameter,play,stop" },
+};
+
+static const E2eCommand *e2e_find_command(const char *name, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < N_ELEMENTS(e2e_commands); i++) {
+        if (strlen(e2e_commands[i].name) == len
+                && strncmp(e2e_commands[i].name, name, len) == 0)
+            return &e2e_commands[i];
+    }
+
+    return NULL;
+}
+
+/* parse a builtin mix name or a list of command[:weight] */
+static int e2e_mix_parse(E2eMix *mix, const char *name)
+{
+    const E2eCommand *cmd;
+    const char *spec = name;
+    const char *end;
+    const char *colon;
+    unsigned long weight;
+    size_t i;
+
+    for (i = 0; i < N_ELEMENTS(e2e_builtin_mixes); i++) {
+        if (strcmp(e2e_builtin_mixes[i].name, name) == 0) {
+            spec = e2e_builtin_mixes[i].spec;
+            break;
+        }
+    }
+
+    mix->name = name;
+    mix->n_entries = 0;
+
+    while (*spec != '\0') {
+        end = strchr(spec, ',');
+        if (end == NULL)
+            end = spec + strlen(spec);
+
+        colon = memchr(spec, ':', end - spec);
+        weight = (colon != NULL) ? strtoul(colon + 1, NULL, 0) : 1;
+
+        cmd = e2e_find_command(spec, (colon != NULL ? colon : end) - spec);
+        if (cmd == NULL || weight == 0
+                || mix->n_entries + weight > E2E_MAX_MIX_ENTRIES)
+            return -1;
+
+        while (weight-- > 0)
+            mix->entries[mix->n_entries++] = cmd;
+
+        spec = (*end == ',') ? end + 1 : end;
+    }
+
+    return mix->n_entries > 0 ? 0 : -1;
+}
+
+/* Benchmark */
+
+typedef enum
+{
+    E2E_MODE_STOP_AND_WAIT = 0,
+    E2E_MODE_PIPELINED,
+    E2E_MODE_BATCHED,
+} E2eMode;
+
+static const char *e2e_mode_names[] = {
+    "stop-and-wait",
+    "pipelined",
+    "batched",
+};
+
+typedef struct
+{
+    TupMessageType type;
+    uint64_t sent_ns;
+    uint64_t done_ns;
+    TupRequestStatus status;
+} E2eSample;
+
+typedef struct
+{
+    TupContext *ctx;
+    TupMessage *msg;
+
+    /* one of the pty line and the simulated link is set */
+    E2eLine *line;
+    TupSimLink *link;
+
+    unsigned long count;
+    unsigned int window;
+    unsigned int batch;
+
+    E2eSample *samples;
+    uint64_t *latencies;
+} E2e;
+
+static void e2e_on_response(TupContext *ctx, TupMessageType cmd,
+        TupRequestStatus status, TupMessage *response, void *userdata)
+{
+    E2eSample *sample = userdata;
+
+    sample->done_ns = get_time_ns();
+    sample->status = status;
+}
+
+static void e2e_on_message(TupContext *ctx, TupMessage *message,
+        void *userdata)
+{
+}
+
+static int e2e_send(E2e *e2e, const E2eMix *mix, unsigned long i)
+{
+    const E2eCommand *cmd = mix->entries[i % mix->n_entries];
+    E2eSample *sample = &e2e->samples[i];
+
+    tup_message_clear(e2e->msg);
+    cmd->init(e2e->msg, i);
+
+    sample->type = cmd->type;
+    sample->status = TUP_REQUEST_STATUS_TIMEOUT;
+    sample->sent_ns = get_time_ns();
+
+    return tup_context_send_request(e2e->ctx, e2e->msg, e2e_on_response,
+            sample);
+}
+
+static int e2e_configure(E2e *e2e, E2eMode mode)
+{
+    unsigned int window;
+    int ret;
+
+    switch (mode) {
+        case E2E_MODE_STOP_AND_WAIT:
+            window = 1;
+            break;
+        case E2E_MODE_PIPELINED:
+            window = e2e->window;
+            break;
+        case E2E_MODE_BATCHED:
+        default:
+            window = e2e->batch;
+            break;
+    }
+
+    ret = tup_context_set_request_window(e2e->ctx, window);
+    if (ret < 0)
+        return ret;
+
+    return tup_context_set_write_combining(e2e->ctx,
+            mode == E2E_MODE_BATCHED ? E2E_COMBINE_SIZE : 0);
+}
+
+/* send count commands of mix, return the elapsed time in ns or a SmpError */
+static int64_t e2e_run(E2e *e2e, E2eMode mode, const E2eMix *mix)
+{
+    uint64_t start;
+    unsigned long i;
+    int ret;
+
+    ret = e2e_configure(e2e, mode);
+    if (ret < 0)
+        return ret;
+
+    start = get_time_ns();
+
+    for (i = 0; i < e2e->count; i++) {
+        switch (mode) {
+            case E2E_MODE_STOP_AND_WAIT:
+                ret = e2e_send(e2e, mix, i);
+                if (ret == 0)
+                    ret = tup_context_wait_requests(e2e->ctx, 0,
+                            E2E_TIMEOUT_MS);
+                break;
+            case E2E_MODE_PIPELINED:
+                /* keep the window full */
+                ret = tup_context_wait_requests(e2e->ctx, e2e->window - 1,
+                        E2E_TIMEOUT_MS);
+                if (ret == 0)
+                    ret = e2e_send(e2e, mix, i);
+                break;
+            case E2E_MODE_BATCHED:
+            default:
+                /* a batch is written at once, then fully answered */
+                ret = e2e_send(e2e, mix, i);
+                if (ret == 0 && ((i + 1) % e2e->batch == 0
+                            || i + 1 == e2e->count)) {
+                    ret = tup_context_flush(e2e->ctx);
+                    if (ret == 0)
+                        ret = tup_context_wait_requests(e2e->ctx, 0,
+                                E2E_TIMEOUT_MS);
+                }
+                break;
+        }
+
+        if (ret < 0)
+            return ret;
+    }
+
+    ret = tup_context_wait_requests(e2e->ctx, 0, E2E_TIMEOUT_MS);
+    if (ret < 0)
+        return ret;
+
+    return get_time_ns() - start;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t va = *(const uint64_t *) a;
+    uint64_t vb = *(const uint64_t *) b;
+
+    return (va > vb) - (va < vb);
+}
+
+static void e2e_report(E2e *e2e, unsigned long baudrate, E2eMode mode,
+        const E2eMix *mix, int64_t elapsed_ns)
+{
+    const E2eCommand *cmd;
+    unsigned long n_errors;
+    size_t n;
+    size_t i;
+    size_t j;
+    int first = 1;
+
+    for (i = 0; i < mix->n_entries; i++) {
+        cmd = mix->entries[i];
+
+        /* report each command once */
+        for (j = 0; j < i && mix->entries[j] != cmd; j++)
+            ;
+        if (j < i)
+            continue;
+
+        n = 0;
+        n_errors = 0;
+        for (j = 0; j < e2e->count; j++) {
+            if (e2e->samples[j].type != cmd->type)
+                continue;
+
+            if (e2e->samples[j].status != TUP_REQUEST_STATUS_OK)
+                n_errors++;
+
+            e2e->latencies[n++] = e2e->samples[j].done_ns
+                - e2e->samples[j].sent_ns;
+        }
+
+        if (n == 0)
+            continue;
+
+        qsort(e2e->latencies, n, sizeof(uint64_t), compare_u64);
+
+        if (first) {
+            printf("%-8lu %-13s %-10.10s %9.0f ", baudrate,
+                    e2e_mode_names[mode], mix->name,
+                    e2e->count * 1e9 / elapsed_ns);
+            first = 0;
+        } else {
+            printf("%-8s %-13s %-10s %9s ", "", "", "", "");
+        }
+
+        printf("%-14s %9.1f %9.1f %6lu\n", cmd->name,
+                e2e->latencies[(n - 1) * 50 / 100] / 1e3,
+                e2e->latencies[(n - 1) * 99 / 100] / 1e3, n_errors);
+    }
+}
+
+/* Setup */
+
+typedef struct
+{
+    TupSimulator *sim;
+    TupSimDevice *dev;
+    pthread_t thread;
+} E2eDevice;
+
+static void *e2e_device_thread(void *userdata)
+{
+    E2eDevice *device = userdata;
+
+    prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+    tup_simulator_run(device->sim);
+    return NULL;
+}
+
+static int e2e_device_start(E2eDevice *device, TupTransport *transport)
+{
+    TupSimConfig config;
+
+    device->sim = tup_simulator_new();
+    if (device->sim == NULL) {
+        tup_transport_free(transport);
+        return -1;
+    }
+
+    tup_sim_config_init(&config);
+    device->dev = tup_sim_device_new(transport, &config);
+    if (device->dev == NULL) {
+        tup_transport_free(transport);
+        goto error;
+    }
+
+    if (tup_sim_device_open(device->dev, NULL) < 0
+            || tup_simulator_add_device(device->sim, device->dev) < 0) {
+        tup_sim_device_free(device->dev);
+        goto error;
+    }
+
+    if (pthread_create(&device->thread, NULL, e2e_device_thread,
+                device) != 0)
+        goto error_remove;
+
+    return 0;
+
+error_remove:
+    tup_simulator_remove_device(device->sim, device->dev);
+    tup_sim_device_free(device->dev);
+error:
+    tup_simulator_free(device->sim);
+    return -1;
+}
+
+static void e2e_device_stop(E2eDevice *device)
+{
+    tup_simulator_quit(device->sim);
+    pthread_join(device->thread, NULL);
+
+    tup_simulator_remove_device(device->sim, device->dev);
+    tup_sim_device_free(device->dev);
+    tup_simulator_free(device->sim);
+}
+
+/* create the host and the device end of the link, either over the paced pty
+ * or over a simulated link */
+static int e2e_open(E2e *e2e, TupCallbacks *cbs, unsigned long baudrate,
+        int use_link, TupTransport **device_transport)
+{
+    TupSimLinkConfig link_config;
+    TupTransport *transport;
+    char pty_name[64];
+
+    if (use_link) {
+        tup_sim_link_config_init(&link_config);
+        link_config.bitrate = baudrate;
+
+        e2e->link = tup_sim_link_new(&link_config, &transport,
+                device_transport);
+        if (e2e->link == NULL) {
+            printf("failed to create the simulated link\n");
+            return -1;
+        }
+
+        e2e->ctx = tup_context_new_with_transport(transport, cbs, NULL);
+        if (e2e->ctx == NULL) {
+            tup_transport_free(transport);
+            tup_transport_free(*device_transport);
+            return -1;
+        }
+
+        if (tup_context_open(e2e->ctx, NULL) < 0) {
+            tup_transport_free(*device_transport);
+            tup_context_free(e2e->ctx);
+            return -1;
+        }
+
+        return 0;
+    }
+
+    e2e->line = e2e_line_new(pty_name, sizeof(pty_name));
+    if (e2e->line == NULL) {
+        printf("failed to create a pty\n");
+        return -1;
+    }
+
+    e2e_line_set_baudrate(e2e->line, baudrate);
+
+    e2e->ctx = tup_context_new(cbs, NULL);
+    if (e2e->ctx == NULL)
+        goto close_line;
+
+    /* the host opens the slave side before the device reads the master one,
+     * which would hang up otherwise. The device end paces the bytes, the
+     * termios speed only has to be valid */
+    if (tup_context_open(e2e->ctx, pty_name) < 0
+            || tup_context_set_config(e2e->ctx, SMP_SERIAL_BAUDRATE_115200,
+                SMP_SERIAL_PARITY_NONE, 0) < 0) {
+        printf("failed to open %s\n", pty_name);
+        goto free_ctx;
+    }
+
+    /* the line is owned by the benchmark, the transport doesn't free it */
+    *device_transport = tup_transport_new(&e2e_line_ops, e2e->line);
+    if (*device_transport == NULL)
+        goto free_ctx;
+
+    return 0;
+
+free_ctx:
+    tup_context_free(e2e->ctx);
+close_line:
+    e2e_line_free(e2e->line);
+    return -1;
+}
+
+static void e2e_close(E2e *e2e)
+{
+    tup_context_free(e2e->ctx);
+
+    if (e2e->line != NULL)
+        e2e_line_free(e2e->line);
+}
+
+static void e2e_set_baudrate(E2e *e2e, unsigned long baudrate)
+{
+    if (e2e->link != NULL)
+        tup_sim_link_set_bitrate(e2e->link, baudrate);
+    else
+        e2e_line_set_baudrate(e2e->line, baudrate);
+}
+
+/* the device needs an effect in the slot the commands use */
+static int e2e_load_slot(E2e *e2e)
+{
+    E2eSample sample;
+    int ret;
+
+    ret = tup_context_set_request_window(e2e->ctx, 1);
+    if (ret < 0)
+        return ret;
+
+    tup_message_clear(e2e->msg);
+    tup_message_init_load(e2e->msg, E2E_SLOT, 0);
+
+    sample.status = TUP_REQUEST_STATUS_TIMEOUT;
+    ret = tup_context_send_request(e2e->ctx, e2e->msg, e2e_on_response,
+            &sample);
+    if (ret == 0)
+        ret = tup_context_wait_requests(e2e->ctx, 0, E2E_TIMEOUT_MS);
+
+    if (ret == 0 && sample.status != TUP_REQUEST_STATUS_OK)
+        ret = SMP_ERROR_OTHER;
+
+    return ret;
+}
+
+static int parse_baudrates(unsigned long *baudrates, size_t *n,
+        const char *list)
+{
+    char *end;
+
+    *n = 0;
+    while (*list != '\0') {
+        if (*n == E2E_MAX_BAUDRATES)
+            return -1;
+
+        baudrates[*n] = strtoul(list, &end, 0);
+        if (end == list || baudrates[*n] == 0)
+            return -1;
+
+        (*n)++;
+        list = (*end == ',') ? end + 1 : end;
+    }
+
+    return *n > 0 ? 0 : -1;
+}
+
+static void usage(const char *pname)
+{
+    size_t i;
+
+    printf("Usage: %s [--help] [-l] [-n count] [-b baudrate,...] "
+            "[-m mix]... [-w window]\n          [-B batch]\n", pname);
+    printf("\nMeasure the commands per second and the latency of each command "
+            "of a host\ntalking to a simulated device over a pty, in "
+            "stop-and-wait, pipelined and\nbatched modes.\n");
+    printf("\nOptions:\n"
+            "  -l              run over an in-process simulated link instead "
+            "of a pty\n"
+            "  -n count        commands per run (default %d)\n"
+            "  -b baudrates    comma separated baudrates (default "
+            "115200,921600,3000000)\n"
+            "  -m mix          builtin mix or command[:weight],... (can be "
+            "repeated)\n"
+            "  -w window       requests in flight in pipelined mode "
+            "(default %d)\n"
+            "  -B batch        commands written at once in batched mode "
+            "(default %d)\n", E2E_DEFAULT_COUNT, E2E_DEFAULT_WINDOW,
+            E2E_DEFAULT_BATCH);
+
+    printf("\nBuiltin mixes:\n");
+    for (i = 0; i < N_ELEMENTS(e2e_builtin_mixes); i++)
+        printf("  %-15s %s\n", e2e_builtin_mixes[i].name,
+                e2e_builtin_mixes[i].spec);
+
+    printf("\nCommands:");
+    for (i = 0; i < N_ELEMENTS(e2e_commands); i++)
+        printf(" %s", e2e_commands[i].name);
+
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    TupCallbacks cbs = {
+        .new_message_cb = e2e_on_message,
+        .error_cb = NULL,
+    };
+    TupTransport *device_transport;
+    E2eDevice device;
+    E2eMix mixes[E2E_MAX_MIXES];
+    size_t n_mixes = 0;
+    unsigned long baudrates[E2E_MAX_BAUDRATES];
+    size_t n_baudrates;
+    int use_link = 0;
+    E2e e2e;
+    int64_t elapsed;
+    size_t b;
+    size_t m;
+    int mode;
+    int ret = 1;
+    int i;
+
+    memset(&e2e, 0, sizeof(e2e));
+    e2e.count = E2E_DEFAULT_COUNT;
+    e2e.window = E2E_DEFAULT_WINDOW;
+    e2e.batch = E2E_DEFAULT_BATCH;
+    parse_baudrates(baudrates, &n_baudrates, "115200,921600,3000000");
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            usage(argv[0]);
+            return 0;
+        } else if (strcmp(argv[i], "-l") == 0) {
+            use_link = 1;
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            e2e.count = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            if (parse_baudrates(baudrates, &n_baudrates, argv[++i]) < 0) {
+                printf("invalid baudrates: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            if (n_mixes == E2E_MAX_MIXES
+                    || e2e_mix_parse(&mixes[n_mixes], argv[++i]) < 0) {
+                printf("invalid mix: %s\n", argv[i]);
+                return 1;
+            }
+
+            n_mixes++;
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            e2e.window = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-B") == 0 && i + 1 < argc) {
+            e2e.batch = strtoul(argv[++i], NULL, 0);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (e2e.count == 0 || e2e.window == 0 || e2e.batch == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (n_mixes == 0) {
+        for (m = 0; m < N_ELEMENTS(e2e_builtin_mixes); m++)
+            e2e_mix_parse(&mixes[n_mixes++], e2e_builtin_mixes[m].name);
+    }
+
+    e2e.samples = calloc(e2e.count, sizeof(E2eSample));
+    e2e.latencies = calloc(e2e.count, sizeof(uint64_t));
+    e2e.msg = tup_message_new();
+    if (e2e.samples == NULL || e2e.latencies == NULL || e2e.msg == NULL)
+        goto done;
+
+    if (e2e_open(&e2e, &cbs, baudrates[0], use_link, &device_transport) < 0)
+        goto done;
+
+    if (e2e_device_start(&device, device_transport) < 0) {
+        printf("failed to start the simulated device\n");
+        goto close_e2e;
+    }
+
+    if (e2e_load_slot(&e2e) < 0) {
+        printf("the simulated device doesn't answer\n");
+        goto stop_device;
+    }
+
+    printf("%-8s %-13s %-10s %9s %-14s %9s %9s %6s\n", "baudrate", "mode",
+            "mix", "cmds/s", "command", "p50 (us)", "p99 (us)", "errors");
+
+    ret = 0;
+    for (b = 0; b < n_baudrates; b++) {
+        e2e_set_baudrate(&e2e, baudrates[b]);
+
+        for (m = 0; m < n_mixes; m++) {
+            for (mode = 0; mode < (int) N_ELEMENTS(e2e_mode_names); mode++) {
+                elapsed = e2e_run(&e2e, mode, &mixes[m]);
+                if (elapsed < 0) {
+                    printf("%-8lu %-13s %-10.10s failed: %d\n", baudrates[b],
+                            e2e_mode_names[mode], mixes[m].name,
+                            (int) elapsed);
+                    ret = 1;
+                    continue;
+                }
+
+                e2e_report(&e2e, baudrates[b], mode, &mixes[m], elapsed);
+            }
+        }
+    }
+
+stop_device:
+    e2e_device_stop(&device);
+close_e2e:
+    e2e_close(&e2e);
+done:
+    if (e2e.msg != NULL)
+        tup_message_free(e2e.msg);
+
+    free(e2e.latencies);
+    free(e2e.samples);
+    return ret;
+}
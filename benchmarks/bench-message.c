@@ -0,0 +1,1031 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <libtup.h>
+
+#define N_ELEMENTS(arr) (sizeof((arr)) / sizeof((arr)[0]))
+
+/* biggest argument count measured */
+#define BENCH_MAX_ARGS 32
+
+#define BENCH_DEFAULT_ITERATIONS 200000
+
+#ifndef TUP_VERSION
+#define TUP_VERSION "unknown"
+#endif
+
+typedef struct
+{
+    TupMessage *msg;
+    size_t n_args;
+
+    /* arguments, filled once */
+    uint8_t ids[BENCH_MAX_ARGS];
+    TupParameterArgs params[BENCH_MAX_ARGS];
+    TupSensorValueArgs sensors[BENCH_MAX_ARGS];
+    TupInputValueArgs inputs[BENCH_MAX_ARGS];
+    TupDebugTaskStatus tasks[BENCH_MAX_ARGS];
+    TupDebugSystemStatus status;
+    float a[5];
+    float b[5];
+
+    /* frame buffer of the encoders */
+    uint8_t frame[TUP_ENCODE_MAX_SIZE];
+} Bench;
+
+typedef void (*BenchFunc)(Bench *bench);
+
+typedef struct
+{
+    const char *name;
+    BenchFunc init;
+    BenchFunc parse;
+    BenchFunc encode;
+    /* set if the message has repeated arguments */
+    int counted;
+} BenchCase;
+
+/* Allocation counting */
+
+static unsigned long n_allocs;
+
+static void *bench_malloc(size_t size, void *userdata)
+{
+    n_allocs++;
+    return malloc(size);
+}
+
+static void *bench_realloc(void *ptr, size_t size, void *userdata)
+{
+    n_allocs++;
+    return realloc(ptr, size);
+}
+
+static void bench_free(void *ptr, void *userdata)
+{
+    free(ptr);
+}
+
+static double get_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Message benchmarks */
+
+static void init_ack(Bench *b)
+{
+    tup_message_init_ack_full(b->msg, TUP_MESSAGE_CMD_PLAY, 1);
+}
+
+static void parse_ack(Bench *b)
+{
+    TupMessageType cmd;
+    uint32_t arg1;
+
+    tup_message_parse_ack_full(b->msg, &cmd, &arg1);
+}
+
+static void encode_ack(Bench *b)
+{
+    tup_encode_ack_full(b->frame, sizeof(b->frame), TUP_MESSAGE_CMD_PLAY, 1);
+}
+
+static void init_error(Bench *b)
+{
+    tup_message_init_error_full(b->msg, TUP_MESSAGE_CMD_PLAY, 2, 1);
+}
+
+static void parse_error(Bench *b)
+{
+    TupMessageType cmd;
+    uint32_t error;
+    uint32_t arg1;
+
+    tup_message_parse_error_full(b->msg, &cmd, &error, &arg1);
+}
+
+static void encode_error(Bench *b)
+{
+    tup_encode_error_full(b->frame, sizeof(b->frame), TUP_MESSAGE_CMD_PLAY,
+            2, 1);
+}
+
+static void init_load(Bench *b)
+{
+    tup_message_init_load(b->msg, 1, 2);
+}
+
+static void parse_load(Bench *b)
+{
+    uint16_t bank_id;
+    uint8_t effect_id;
+
+    tup_message_parse_load(b->msg, &effect_id, &bank_id);
+}
+
+static void encode_load(Bench *b)
+{
+    tup_encode_load(b->frame, sizeof(b->frame), 1, 2);
+}
+
+static void init_play(Bench *b)
+{
+    tup_message_init_play(b->msg, 1);
+}
+
+static void parse_play(Bench *b)
+{
+    uint8_t effect_id;
+
+    tup_message_parse_play(b->msg, &effect_id);
+}
+
+static void encode_play(Bench *b)
+{
+    tup_encode_play(b->frame, sizeof(b->frame), 1);
+}
+
+static void init_stop(Bench *b)
+{
+    tup_message_init_stop(b->msg, 1);
+}
+
+static void parse_stop(Bench *b)
+{
+    uint8_t effect_id;
+
+    tup_message_parse_stop(b->msg, &effect_id);
+}
+
+static void encode_stop(Bench *b)
+{
+    tup_encode_stop(b->frame, sizeof(b->frame), 1);
+}
+
+static void init_get_version(Bench *b)
+{
+    tup_message_init_get_version(b->msg);
+}
+
+static void encode_get_version(Bench *b)
+{
+    tup_encode_get_version(b->frame, sizeof(b->frame));
+}
+
+static void init_get_parameter(Bench *b)
+{
+    tup_message_init_get_parameter_array(b->msg, 1, b->ids, b->n_args);
+}
+
+static void parse_get_parameter(Bench *b)
+{
+    uint8_t ids[BENCH_MAX_ARGS];
+    uint8_t effect_id;
+
+    tup_message_parse_get_parameter(b->msg, &effect_id, ids, N_ELEMENTS(ids));
+}
+
+static void encode_get_parameter(Bench *b)
+{
+    tup_encode_get_parameter(b->frame, sizeof(b->frame), 1, b->ids,
+            b->n_args);
+}
+
+static void init_set_parameter(Bench *b)
+{
+    tup_message_init_set_parameter_array(b->msg, 1, b->params, b->n_args);
+}
+
+static void parse_set_parameter(Bench *b)
+{
+    TupParameterArgs params[BENCH_MAX_ARGS];
+    uint8_t effect_id;
+
+    tup_message_parse_set_parameter(b->msg, &effect_id, params,
+            N_ELEMENTS(params));
+}
+
+static void encode_set_parameter(Bench *b)
+{
+    tup_encode_set_parameter(b->frame, sizeof(b->frame), 1, b->params,
+            b->n_args);
+}
+
+static void init_bind_effect(Bench *b)
+{
+    tup_message_init_bind_effect(b->msg, 1, TUP_BINDING_FLAG_NONE);
+}
+
+static void parse_bind_effect(Bench *b)
+{
+    unsigned int flags;
+    uint8_t effect_id;
+
+    tup_message_parse_bind_effect(b->msg, &effect_id, &flags);
+}
+
+static void encode_bind_effect(Bench *b)
+{
+    tup_encode_bind_effect(b->frame, sizeof(b->frame), 1,
+            TUP_BINDING_FLAG_NONE);
+}
+
+static void init_get_sensor_value(Bench *b)
+{
+    tup_message_init_get_sensor_value_array(b->msg, b->ids, b->n_args);
+}
+
+static void parse_get_sensor_value(Bench *b)
+{
+    uint8_t ids[BENCH_MAX_ARGS];
+
+    tup_message_parse_get_sensor_value(b->msg, ids, N_ELEMENTS(ids));
+}
+
+static void encode_get_sensor_value(Bench *b)
+{
+    tup_encode_get_sensor_value(b->frame, sizeof(b->frame), b->ids,
+            b->n_args);
+}
+
+static void init_set_sensor_value(Bench *b)
+{
+    tup_message_init_set_sensor_value_array(b->msg, b->sensors, b->n_args);
+}
+
+static void parse_set_sensor_value(Bench *b)
+{
+    TupSensorValueArgs sensors[BENCH_MAX_ARGS];
+
+    tup_message_parse_set_sensor_value(b->msg, sensors, N_ELEMENTS(sensors));
+}
+
+static void encode_set_sensor_value(Bench *b)
+{
+    tup_encode_set_sensor_value(b->frame, sizeof(b->frame), b->sensors,
+            b->n_args);
+}
+
+static void init_get_input_value(Bench *b)
+{
+    tup_message_init_get_input_value_array(b->msg, 1, b->ids, b->n_args);
+}
+
+static void parse_get_input_value(Bench *b)
+{
+    uint8_t ids[BENCH_MAX_ARGS];
+    uint8_t slot_id;
+
+    tup_message_parse_get_input_value(b->msg, &slot_id, ids, N_ELEMENTS(ids));
+}
+
+static void encode_get_input_value(Bench *b)
+{
+    tup_encode_get_input_value(b->frame, sizeof(b->frame), 1, b->ids,
+            b->n_args);
+}
+
+static void init_set_input_value(Bench *b)
+{
+    tup_message_init_set_input_value_array(b->msg, 1, b->inputs, b->n_args);
+}
+
+static void parse_set_input_value(Bench *b)
+{
+    TupInputValueArgs inputs[BENCH_MAX_ARGS];
+    uint8_t slot_id;
+
+    tup_message_parse_set_input_value(b->msg, &slot_id, inputs,
+            N_ELEMENTS(inputs));
+}
+
+static void encode_set_input_value(Bench *b)
+{
+    tup_encode_set_input_value(b->frame, sizeof(b->frame), 1, b->inputs,
+            b->n_args);
+}
+
+static void init_filter_get_active(Bench *b)
+{
+    tup_message_init_filter_get_active(b->msg, TUP_FILTER_ID_BAND_NORM, 0);
+}
+
+static void parse_filter_get_active(Bench *b)
+{
+    TupFilterId filter;
+    uint8_t actuator_id;
+
+    tup_message_parse_filter_get_active(b->msg, &filter, &actuator_id);
+}
+
+static void encode_filter_get_active(Bench *b)
+{
+    tup_encode_filter_get_active(b->frame, sizeof(b->frame),
+            TUP_FILTER_ID_BAND_NORM, 0);
+}
+
+static void init_filter_set_active(Bench *b)
+{
+    tup_message_init_filter_set_active(b->msg, TUP_FILTER_ID_BAND_NORM, 0,
+            true);
+}
+
+static void parse_filter_set_active(Bench *b)
+{
+    TupFilterId filter;
+    uint8_t actuator_id;
+    bool active;
+
+    tup_message_parse_filter_set_active(b->msg, &filter, &actuator_id,
+            &active);
+}
+
+static void encode_filter_set_active(Bench *b)
+{
+    tup_encode_filter_set_active(b->frame, sizeof(b->frame),
+            TUP_FILTER_ID_BAND_NORM, 0, true);
+}
+
+static void init_config_write(Bench *b)
+{
+    tup_message_init_config_write(b->msg);
+}
+
+static void encode_config_write(Bench *b)
+{
+    tup_encode_config_write(b->frame, sizeof(b->frame));
+}
+
+static void init_band_norm_get_coeffs(Bench *b)
+{
+    tup_message_init_config_band_norm_get_coeffs(b->msg, 0);
+}
+
+static void parse_band_norm_get_coeffs(Bench *b)
+{
+    uint8_t actuator_id;
+
+    tup_message_parse_config_band_norm_get_coeffs(b->msg, &actuator_id);
+}
+
+static void encode_band_norm_get_coeffs(Bench *b)
+{
+    tup_encode_config_band_norm_get_coeffs(b->frame, sizeof(b->frame), 0);
+}
+
+static void init_band_norm_set_coeffs(Bench *b)
+{
+    tup_message_init_config_band_norm_set_coeffs(b->msg, 0, b->a, b->b);
+}
+
+static void parse_band_norm_set_coeffs(Bench *b)
+{
+    uint8_t actuator_id;
+    float a[5];
+    float coeffs_b[5];
+
+    tup_message_parse_config_band_norm_set_coeffs(b->msg, &actuator_id, a,
+            coeffs_b);
+}
+
+static void encode_band_norm_set_coeffs(Bench *b)
+{
+    tup_encode_config_band_norm_set_coeffs(b->frame, sizeof(b->frame), 0,
+            b->a, b->b);
+}
+
+static void init_get_buildinfo(Bench *b)
+{
+    tup_message_init_get_buildinfo(b->msg);
+}
+
+static void encode_get_buildinfo(Bench *b)
+{
+    tup_encode_get_buildinfo(b->frame, sizeof(b->frame));
+}
+
+static void init_activate_internal_sensors(Bench *b)
+{
+    tup_message_init_activate_internal_sensors(b->msg, 1);
+}
+
+static void parse_activate_internal_sensors(Bench *b)
+{
+    uint8_t state;
+
+    tup_message_parse_activate_internal_sensors(b->msg, &state);
+}
+
+static void encode_activate_internal_sensors(Bench *b)
+{
+    tup_encode_activate_internal_sensors(b->frame, sizeof(b->frame), 1);
+}
+
+static void init_resp_version(Bench *b)
+{
+    tup_message_init_resp_version(b->msg, "1.2.3");
+}
+
+static void parse_resp_version(Bench *b)
+{
+    const char *version;
+
+    tup_message_parse_resp_version(b->msg, &version);
+}
+
+static void encode_resp_version(Bench *b)
+{
+    tup_encode_resp_version(b->frame, sizeof(b->frame), "1.2.3");
+}
+
+static void init_resp_parameter(Bench *b)
+{
+    tup_message_init_resp_parameter(b->msg, 1, b->params, b->n_args);
+}
+
+static void parse_resp_parameter(Bench *b)
+{
+    TupParameterArgs params[BENCH_MAX_ARGS];
+    uint8_t effect_id;
+
+    tup_message_parse_resp_parameter(b->msg, &effect_id, params,
+            N_ELEMENTS(params));
+}
+
+static void encode_resp_parameter(Bench *b)
+{
+    tup_encode_resp_parameter(b->frame, sizeof(b->frame), 1, b->params,
+            b->n_args);
+}
+
+static void init_resp_sensor(Bench *b)
+{
+    tup_message_init_resp_sensor(b->msg, b->sensors, b->n_args);
+}
+
+static void parse_resp_sensor(Bench *b)
+{
+    TupSensorValueArgs sensors[BENCH_MAX_ARGS];
+
+    tup_message_parse_resp_sensor(b->msg, sensors, N_ELEMENTS(sensors));
+}
+
+static void encode_resp_sensor(Bench *b)
+{
+    tup_encode_resp_sensor(b->frame, sizeof(b->frame), b->sensors,
+            b->n_args);
+}
+
+static void init_resp_input(Bench *b)
+{
+    tup_message_init_resp_input(b->msg, 1, b->inputs, b->n_args);
+}
+
+static void parse_resp_input(Bench *b)
+{
+    TupInputValueArgs inputs[BENCH_MAX_ARGS];
+    uint8_t slot_id;
+
+    tup_message_parse_resp_input(b->msg, &slot_id, inputs,
+            N_ELEMENTS(inputs));
+}
+
+static void encode_resp_input(Bench *b)
+{
+    tup_encode_resp_input(b->frame, sizeof(b->frame), 1, b->inputs,
+            b->n_args);
+}
+
+static void init_resp_buildinfo(Bench *b)
+{
+    tup_message_init_resp_buildinfo(b->msg, "2017-06-01 rev 1234");
+}
+
+static void parse_resp_buildinfo(Bench *b)
+{
+    const char *buildinfo;
+
+    tup_message_parse_resp_buildinfo(b->msg, &buildinfo);
+}
+
+static void encode_resp_buildinfo(Bench *b)
+{
+    tup_encode_resp_buildinfo(b->frame, sizeof(b->frame),
+            "2017-06-01 rev 1234");
+}
+
+static void init_resp_set_parameter(Bench *b)
+{
+    tup_message_init_resp_set_parameter(b->msg, 1, 0, b->params, b->n_args);
+}
+
+static void parse_resp_set_parameter(Bench *b)
+{
+    TupParameterArgs params[BENCH_MAX_ARGS];
+    uint8_t effect_id;
+    int32_t retval;
+
+    tup_message_parse_resp_set_parameter(b->msg, &effect_id, &retval, params,
+            N_ELEMENTS(params));
+}
+
+static void encode_resp_set_parameter(Bench *b)
+{
+    tup_encode_resp_set_parameter(b->frame, sizeof(b->frame), 1, 0,
+            b->params, b->n_args);
+}
+
+static void init_resp_filter_active(Bench *b)
+{
+    tup_message_init_resp_filter_active(b->msg, TUP_FILTER_ID_BAND_NORM, 0,
+            true);
+}
+
+static void parse_resp_filter_active(Bench *b)
+{
+    TupFilterId filter;
+    uint8_t actuator_id;
+    bool active;
+
+    tup_message_parse_resp_filter_active(b->msg, &filter, &actuator_id,
+            &active);
+}
+
+static void encode_resp_filter_active(Bench *b)
+{
+    tup_encode_resp_filter_active(b->frame, sizeof(b->frame),
+            TUP_FILTER_ID_BAND_NORM, 0, true);
+}
+
+static void init_resp_band_norm_coeffs(Bench *b)
+{
+    tup_message_init_resp_band_norm_coeffs(b->msg, 0, b->a, b->b);
+}
+
+static void parse_resp_band_norm_coeffs(Bench *b)
+{
+    uint8_t actuator_id;
+    float a[5];
+    float coeffs_b[5];
+
+    tup_message_parse_resp_band_norm_coeffs(b->msg, &actuator_id, a,
+            coeffs_b);
+}
+
+static void encode_resp_band_norm_coeffs(Bench *b)
+{
+    tup_encode_resp_band_norm_coeffs(b->frame, sizeof(b->frame), 0, b->a,
+            b->b);
+}
+
+static void init_debug_get_system_status(Bench *b)
+{
+    tup_message_init_cmd_debug_get_system_status(b->msg);
+}
+
+static void encode_debug_get_system_status(Bench *b)
+{
+    tup_encode_cmd_debug_get_system_status(b->frame, sizeof(b->frame));
+}
+
+static void init_resp_debug_system_status(Bench *b)
+{
+    tup_message_init_resp_debug_system_status(b->msg, &b->status, b->tasks,
+            b->n_args);
+}
+
+static void parse_resp_debug_system_status(Bench *b)
+{
+    TupDebugTaskStatus tasks[BENCH_MAX_ARGS];
+    TupDebugSystemStatus status;
+
+    tup_message_parse_resp_debug_system_status(b->msg, &status, tasks,
+            N_ELEMENTS(tasks));
+}
+
+static void encode_resp_debug_system_status(Bench *b)
+{
+    tup_encode_resp_debug_system_status(b->frame, sizeof(b->frame),
+            &b->status, b->tasks, b->n_args);
+}
+
+static void decode_any(Bench *b)
+{
+    TupDecoded decoded;
+
+    tup_message_decode(b->msg, &decoded);
+}
+
+static const BenchCase bench_cases[] = {
+    { "ack", init_ack, parse_ack, encode_ack, 0 },
+    { "error", init_error, parse_error, encode_error, 0 },
+    { "load", init_load, parse_load, encode_load, 0 },
+    { "play", init_play, parse_play, encode_play, 0 },
+    { "stop", init_stop, parse_stop, encode_stop, 0 },
+    { "get_version", init_get_version, NULL, encode_get_version, 0 },
+    { "get_parameter", init_get_parameter, parse_get_parameter,
+        encode_get_parameter, 1 },
+    { "set_parameter", init_set_parameter, parse_set_parameter,
+        encode_set_parameter, 1 },
+    { "bind_effect", init_bind_effect, parse_bind_effect, encode_bind_effect,
+        0 },
+    { "get_sensor_value", init_get_sensor_value, parse_get_sensor_value,
+        encode_get_sensor_value, 1 },
+    { "set_sensor_value", init_set_sensor_value, parse_set_sensor_value,
+        encode_set_sensor_value, 1 },
+    { "get_input_value", init_get_input_value, parse_get_input_value,
+        encode_get_input_value, 1 },
+    { "set_input_value", init_set_input_value, parse_set_input_value,
+        encode_set_input_value, 1 },
+    { "filter_get_active", init_filter_get_active, parse_filter_get_active,
+        encode_filter_get_active, 0 },
+    { "filter_set_active", init_filter_set_active, parse_filter_set_active,
+        encode_filter_set_active, 0 },
+    { "config_write", init_config_write, NULL, encode_config_write, 0 },
+    { "config_band_norm_get_coeffs", init_band_norm_get_coeffs,
+        parse_band_norm_get_coeffs, encode_band_norm_get_coeffs, 0 },
+    { "config_band_norm_set_coeffs", init_band_norm_set_coeffs,
+        parse_band_norm_set_coeffs, encode_band_norm_set_coeffs, 0 },
+    { "get_buildinfo", init_get_buildinfo, NULL, encode_get_buildinfo, 0 },
+    { "activate_internal_sensors", init_activate_internal_sensors,
+        parse_activate_internal_sensors, encode_activate_internal_sensors,
+        0 },
+    { "resp_version", init_resp_version, parse_resp_version,
+        encode_resp_version, 0 },
+    { "resp_parameter", init_resp_parameter, parse_resp_parameter,
+        encode_resp_parameter, 1 },
+    { "resp_sensor", init_resp_sensor, parse_resp_sensor, encode_resp_sensor,
+        1 },
+    { "resp_input", init_resp_input, parse_resp_input, encode_resp_input, 1 },
+    { "resp_buildinfo", init_resp_buildinfo, parse_resp_buildinfo,
+        encode_resp_buildinfo, 0 },
+    { "resp_set_parameter", init_resp_set_parameter, parse_resp_set_parameter,
+        encode_resp_set_parameter, 1 },
+    { "resp_filter_active", init_resp_filter_active, parse_resp_filter_active,
+        encode_resp_filter_active, 0 },
+    { "resp_band_norm_coeffs", init_resp_band_norm_coeffs,
+        parse_resp_band_norm_coeffs, encode_resp_band_norm_coeffs, 0 },
+    { "cmd_debug_get_system_status", init_debug_get_system_status, NULL,
+        encode_debug_get_system_status, 0 },
+    { "resp_debug_system_status", init_resp_debug_system_status,
+        parse_resp_debug_system_status, encode_resp_debug_system_status, 1 },
+};
+
+/* argument counts of messages with repeated arguments */
+static const size_t bench_arg_counts[] = { 1, 8, BENCH_MAX_ARGS };
+
+/* In-memory pipe, what is written is read back */
+
+typedef struct
+{
+    uint8_t data[4096];
+    size_t len;
+    size_t pos;
+
+    /* when set, this frame is read again after each end of data */
+    const uint8_t *frame;
+    size_t frame_size;
+    size_t frame_pos;
+
+    unsigned long n_received;
+} BenchPipe;
+
+static int bench_pipe_read(void *priv, uint8_t *buf, size_t size)
+{
+    BenchPipe *pipe = priv;
+    size_t n;
+
+    if (pipe->frame != NULL) {
+        if (pipe->frame_pos == pipe->frame_size) {
+            pipe->frame_pos = 0;
+            return 0;
+        }
+
+        n = pipe->frame_size - pipe->frame_pos;
+        if (n > size)
+            n = size;
+
+        memcpy(buf, pipe->frame + pipe->frame_pos, n);
+        pipe->frame_pos += n;
+        return n;
+    }
+
+    n = pipe->len - pipe->pos;
+    if (n > size)
+        n = size;
+
+    memcpy(buf, pipe->data + pipe->pos, n);
+    pipe->pos += n;
+    if (pipe->pos == pipe->len)
+        pipe->pos = pipe->len = 0;
+
+    return n;
+}
+
+static int bench_pipe_write(void *priv, const uint8_t *data, size_t size)
+{
+    BenchPipe *pipe = priv;
+
+    /* only the last frames are kept */
+    if (pipe->len + size > sizeof(pipe->data))
+        pipe->pos = pipe->len = 0;
+
+    if (size > sizeof(pipe->data))
+        return SMP_ERROR_TOO_BIG;
+
+    memcpy(pipe->data + pipe->len, data, size);
+    pipe->len += size;
+    return 0;
+}
+
+static int bench_pipe_poll(void *priv, int timeout_ms)
+{
+    BenchPipe *pipe = priv;
+
+    return pipe->frame != NULL || pipe->len > pipe->pos;
+}
+
+static const TupTransportOps bench_pipe_ops = {
+    NULL, NULL, bench_pipe_read, bench_pipe_write, bench_pipe_poll, NULL,
+    NULL, NULL
+};
+
+static void on_new_message(TupContext *ctx, TupMessage *message,
+        void *userdata)
+{
+    BenchPipe *pipe = userdata;
+
+    pipe->n_received++;
+}
+
+/* Runner */
+
+typedef struct
+{
+    FILE *json;
+    unsigned long iterations;
+    int first;
+} BenchRunner;
+
+static void bench_report(BenchRunner *runner, const char *group,
+        const char *name, size_t n_args, double ns_per_op,
+        double allocs_per_op)
+{
+    printf("%-8s %-30s %4zu %10.1f %8.2f\n", group, name, n_args, ns_per_op,
+            allocs_per_op);
+
+    if (runner->json == NULL)
+        return;
+
+    fprintf(runner->json, "%s\n    { \"group\": \"%s\", \"name\": \"%s\", "
+            "\"n_args\": %zu, \"ns_per_op\": %.1f, "
+            "\"allocs_per_op\": %.2f }", runner->first ? "" : ",", group,
+            name, n_args, ns_per_op, allocs_per_op);
+    runner->first = 0;
+}
+
+static void bench_run(BenchRunner *runner, Bench *bench, const char *group,
+        const char *name, BenchFunc func)
+{
+    unsigned long allocs;
+    unsigned long i;
+    double start;
+
+    /* warm up */
+    for (i = 0; i < runner->iterations / 10; i++)
+        func(bench);
+
+    allocs = n_allocs;
+    start = get_time_ns();
+    for (i = 0; i < runner->iterations; i++)
+        func(bench);
+
+    bench_report(runner, group, name, bench->n_args,
+            (get_time_ns() - start) / runner->iterations,
+            (double) (n_allocs - allocs) / runner->iterations);
+}
+
+static void bench_messages(BenchRunner *runner, Bench *bench)
+{
+    const BenchCase *bcase;
+    size_t i, j;
+    size_t n_counts;
+
+    for (i = 0; i < N_ELEMENTS(bench_cases); i++) {
+        bcase = &bench_cases[i];
+        n_counts = bcase->counted ? N_ELEMENTS(bench_arg_counts) : 1;
+
+        for (j = 0; j < n_counts; j++) {
+            bench->n_args = bcase->counted ? bench_arg_counts[j] : 0;
+
+            tup_message_clear(bench->msg);
+            bench_run(runner, bench, "init", bcase->name, bcase->init);
+
+            if (bcase->parse != NULL)
+                bench_run(runner, bench, "parse", bcase->name, bcase->parse);
+
+            bench_run(runner, bench, "decode", bcase->name, decode_any);
+            bench_run(runner, bench, "encode", bcase->name, bcase->encode);
+        }
+    }
+}
+
+/* wire benchmarks share this context */
+static TupContext *wire_ctx;
+static BenchPipe wire_pipe;
+
+static void wire_send(Bench *b)
+{
+    tup_message_init_set_input_value_array(b->msg, 1, b->inputs, b->n_args);
+    tup_context_send(wire_ctx, b->msg);
+    wire_pipe.pos = wire_pipe.len = 0;
+}
+
+static void wire_send_raw(Bench *b)
+{
+    int size;
+
+    size = tup_encode_set_input_value(b->frame, sizeof(b->frame), 1,
+            b->inputs, b->n_args);
+    tup_context_send_raw(wire_ctx, b->frame, size);
+    wire_pipe.pos = wire_pipe.len = 0;
+}
+
+static void wire_receive(Bench *b)
+{
+    tup_context_process_fd(wire_ctx);
+}
+
+static void wire_round_trip(Bench *b)
+{
+    tup_message_init_set_input_value_array(b->msg, 1, b->inputs, b->n_args);
+    tup_context_send(wire_ctx, b->msg);
+    tup_context_process_fd(wire_ctx);
+}
+
+static int bench_wire(BenchRunner *runner, Bench *bench)
+{
+    TupCallbacks cbs = { on_new_message, NULL };
+    TupTransport *transport;
+    size_t i;
+    int size;
+
+    transport = tup_transport_new(&bench_pipe_ops, &wire_pipe);
+    if (transport == NULL)
+        return -1;
+
+    wire_ctx = tup_context_new_with_transport(transport, &cbs, &wire_pipe);
+    if (wire_ctx == NULL || tup_context_open(wire_ctx, NULL) < 0)
+        return -1;
+
+    for (i = 0; i < N_ELEMENTS(bench_arg_counts); i++) {
+        bench->n_args = bench_arg_counts[i];
+
+        tup_message_clear(bench->msg);
+        bench_run(runner, bench, "wire", "send", wire_send);
+        bench_run(runner, bench, "wire", "send_raw", wire_send_raw);
+
+        size = tup_encode_set_input_value(bench->frame, sizeof(bench->frame),
+                1, bench->inputs, bench->n_args);
+        wire_pipe.frame = bench->frame;
+        wire_pipe.frame_size = size;
+        wire_pipe.frame_pos = 0;
+        bench_run(runner, bench, "wire", "receive", wire_receive);
+        wire_pipe.frame = NULL;
+
+        tup_message_clear(bench->msg);
+        bench_run(runner, bench, "wire", "round_trip", wire_round_trip);
+    }
+
+    tup_context_free(wire_ctx);
+    return 0;
+}
+
+static void bench_fill(Bench *bench)
+{
+    size_t i;
+
+    for (i = 0; i < BENCH_MAX_ARGS; i++) {
+        bench->ids[i] = i;
+        bench->params[i].parameter_id = i;
+        bench->params[i].parameter_value = 1000 * i;
+        bench->sensors[i].sensor_id = i;
+        bench->sensors[i].sensor_value = 100 * i;
+        bench->inputs[i].input_id = i;
+        bench->inputs[i].input_value = -1000 * (int) i;
+        bench->tasks[i].id = i;
+        bench->tasks[i].name = "task";
+        bench->tasks[i].state = TUP_DEBUG_TASK_STATE_READY;
+        bench->tasks[i].priority = 1;
+        bench->tasks[i].time = 1000 * i;
+        bench->tasks[i].rem_stack = 256;
+    }
+
+    for (i = 0; i < 5; i++) {
+        bench->a[i] = 0.5f * i;
+        bench->b[i] = -0.25f * i;
+    }
+
+    bench->status.rtime = 123456789;
+    bench->status.mem_total = 65536;
+    bench->status.mem_used = 4096;
+}
+
+static void usage(const char *pname)
+{
+    printf("Usage: %s [--help] [-n iterations] [-o output.json] [-l label]\n",
+            pname);
+    printf("\nMeasure the time and libtup allocations per operation of the "
+            "message functions\nand of the wire path over an in-memory "
+            "pipe.\nThe label, a commit id for instance, is written to the "
+            "JSON output.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    BenchRunner runner;
+    Bench *bench;
+    const char *output = NULL;
+    const char *label = "";
+    int i;
+    int ret = 0;
+
+    runner.json = NULL;
+    runner.iterations = BENCH_DEFAULT_ITERATIONS;
+    runner.first = 1;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            usage(argv[0]);
+            return 0;
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            runner.iterations = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            label = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (runner.iterations == 0)
+        runner.iterations = 1;
+
+    tup_set_allocator(bench_malloc, bench_realloc, bench_free, NULL);
+
+    bench = calloc(1, sizeof(*bench));
+    if (bench == NULL)
+        return 1;
+
+    bench->msg = tup_message_new();
+    if (bench->msg == NULL) {
+        free(bench);
+        return 1;
+    }
+
+    bench_fill(bench);
+
+    if (output != NULL) {
+        runner.json = fopen(output, "w");
+        if (runner.json == NULL) {
+            printf("failed to open %s\n", output);
+            ret = 1;
+            goto done;
+        }
+
+        fprintf(runner.json, "{\n  \"version\": \"%s\",\n"
+                "  \"label\": \"%s\",\n  \"iterations\": %lu,\n"
+                "  \"benchmarks\": [", TUP_VERSION, label, runner.iterations);
+    }
+
+    printf("%-8s %-30s %4s %10s %8s\n", "group", "name", "args", "ns/op",
+            "allocs");
+
+    bench_messages(&runner, bench);
+    if (bench_wire(&runner, bench) < 0) {
+        printf("failed to set up the wire benchmarks\n");
+        ret = 1;
+    }
+
+    if (runner.json != NULL) {
+        fprintf(runner.json, "\n  ]\n}\n");
+        fclose(runner.json);
+    }
+
+done:
+    tup_message_free(bench->msg);
+    free(bench);
+    return ret;
+}
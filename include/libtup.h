@@ -46,7 +46,31 @@ extern "C" {
 #endif
 
 typedef void TupMessage;
-typedef SmpContext TupContext;
+typedef struct TupContext TupContext;
+
+/* Allocator API */
+
+/**
+ * \ingroup alloc
+ * Allocate size bytes, return NULL on error.
+ */
+typedef void *(*TupMallocFunc)(size_t size, void *userdata);
+
+/**
+ * \ingroup alloc
+ * Resize a block, ptr may be NULL. Return NULL on error.
+ */
+typedef void *(*TupReallocFunc)(void *ptr, size_t size, void *userdata);
+
+/**
+ * \ingroup alloc
+ * Release a block, ptr is never NULL.
+ */
+typedef void (*TupFreeFunc)(void *ptr, void *userdata);
+
+TUP_API int tup_set_allocator(TupMallocFunc malloc_fn,
+                TupReallocFunc realloc_fn, TupFreeFunc free_fn,
+                void *userdata);
 
 /* TupContext API */
 
@@ -65,10 +89,13 @@ TUP_API TupContext *tup_context_new(TupCallbacks *cbs, void *userdata);
 TUP_API void tup_context_free(TupContext *ctx);
 
 TUP_API int tup_context_open(TupContext *ctx, const char *device);
-TUP_API void tup_context_close(TupContext *ctx);
+TUP_API int tup_context_close(TupContext *ctx);
 
 TUP_API int tup_context_set_config(TupContext *ctx, SmpSerialBaudrate baudrate,
                 SmpSerialParity parity, int flow_control);
+TUP_API unsigned int tup_serial_baudrate_get_bps(SmpSerialBaudrate baudrate);
+TUP_API uint64_t tup_serial_get_byte_time_ns(unsigned int bps,
+                SmpSerialParity parity);
 
 TUP_API intptr_t tup_context_get_fd(TupContext *ctx);
 
@@ -230,6 +257,162 @@ typedef struct
     uint32_t mem_used;     /**< the total used memory */
 } TupDebugSystemStatus;
 
+/**
+ * \ingroup message
+ * The layout of a message type. Sizes are the ones of the serialized
+ * arguments, strings being counted empty.
+ */
+typedef struct
+{
+    const char *name;           /**< name of the message type */
+    unsigned int n_fixed_args;  /**< number of arguments before the group */
+    unsigned int n_group_args;  /**< number of arguments of the repeated
+                                     group, 0 if there is none */
+    size_t fixed_size;          /**< minimum size of the fixed arguments */
+    size_t group_size;          /**< minimum size of a repeated group */
+} TupMessageInfo;
+
+/**
+ * \ingroup message
+ * Iterator over the repeated arguments of a received message, walking them
+ * in place. Its fields are private.
+ */
+typedef struct
+{
+    TupMessage *message;
+    TupMessageType type;
+    size_t index;
+    size_t n_groups;
+} TupMessageIter;
+
+/* maximum number of repeated arguments in a TupDecoded */
+#define TUP_DECODED_MAX_ARGS 32
+
+/**
+ * \ingroup message
+ * The arguments of any message, the member of u in use being given by type.
+ * Messages without arguments have no member. Strings point into the parsed
+ * message.
+ */
+typedef struct
+{
+    TupMessageType type;        /**< type of the message */
+    union {
+        struct {
+            TupMessageType cmd;
+            uint32_t arg1;
+        } ack;                  /**< TUP_MESSAGE_ACK */
+        struct {
+            TupMessageType cmd;
+            uint32_t error;
+            uint32_t arg1;
+        } error;                /**< TUP_MESSAGE_ERROR */
+        struct {
+            uint8_t effect_id;
+            uint16_t bank_id;
+        } load;                 /**< TUP_MESSAGE_CMD_LOAD */
+        struct {
+            uint8_t effect_id;
+        } play;                 /**< TUP_MESSAGE_CMD_PLAY */
+        struct {
+            uint8_t effect_id;
+        } stop;                 /**< TUP_MESSAGE_CMD_STOP */
+        struct {
+            uint8_t effect_id;
+            size_t n_parameters;
+            uint8_t parameter_ids[TUP_DECODED_MAX_ARGS];
+        } get_parameter;        /**< TUP_MESSAGE_CMD_GET_PARAMETER */
+        struct {
+            uint8_t effect_id;
+            size_t n_params;
+            TupParameterArgs params[TUP_DECODED_MAX_ARGS];
+        } set_parameter;        /**< TUP_MESSAGE_CMD_SET_PARAMETER */
+        struct {
+            uint8_t effect_id;
+            unsigned int binding_flags;
+        } bind_effect;          /**< TUP_MESSAGE_CMD_BIND_EFFECT */
+        struct {
+            size_t n_sensors;
+            uint8_t sensor_ids[TUP_DECODED_MAX_ARGS];
+        } get_sensor_value;     /**< TUP_MESSAGE_CMD_GET_SENSOR_VALUE */
+        struct {
+            size_t n_args;
+            TupSensorValueArgs args[TUP_DECODED_MAX_ARGS];
+        } set_sensor_value;     /**< TUP_MESSAGE_CMD_SET_SENSOR_VALUE */
+        struct {
+            uint8_t state;
+        } activate_internal_sensors; /**< TUP_MESSAGE_CMD_ACTIVATE_INTERNAL_SENSORS */
+        struct {
+            uint8_t effect_slot_id;
+            size_t n_inputs;
+            uint8_t input_ids[TUP_DECODED_MAX_ARGS];
+        } get_input_value;      /**< TUP_MESSAGE_CMD_GET_INPUT_VALUE */
+        struct {
+            uint8_t effect_slot_id;
+            size_t n_args;
+            TupInputValueArgs args[TUP_DECODED_MAX_ARGS];
+        } set_input_value;      /**< TUP_MESSAGE_CMD_SET_INPUT_VALUE */
+        struct {
+            TupFilterId filter;
+            uint8_t actuator_id;
+        } filter_get_active;    /**< TUP_MESSAGE_CMD_FILTER_GET_ACTIVE */
+        struct {
+            TupFilterId filter;
+            uint8_t actuator_id;
+            bool active;
+        } filter_set_active;    /**< TUP_MESSAGE_CMD_FILTER_SET_ACTIVE */
+        struct {
+            uint8_t actuator_id;
+        } band_norm_get_coeffs; /**< TUP_MESSAGE_CMD_CONFIG_BAND_NORM_GET_COEFFS */
+        struct {
+            uint8_t actuator_id;
+            float a[5];
+            float b[5];
+        } band_norm_set_coeffs; /**< TUP_MESSAGE_CMD_CONFIG_BAND_NORM_SET_COEFFS */
+        struct {
+            const char *version;
+        } resp_version;         /**< TUP_MESSAGE_RESP_VERSION */
+        struct {
+            uint8_t effect_id;
+            size_t n_args;
+            TupParameterArgs args[TUP_DECODED_MAX_ARGS];
+        } resp_parameter;       /**< TUP_MESSAGE_RESP_PARAMETER */
+        struct {
+            size_t n_args;
+            TupSensorValueArgs args[TUP_DECODED_MAX_ARGS];
+        } resp_sensor;          /**< TUP_MESSAGE_RESP_SENSOR */
+        struct {
+            const char *buildinfo;
+        } resp_buildinfo;       /**< TUP_MESSAGE_RESP_BUILDINFO */
+        struct {
+            uint8_t effect_slot_id;
+            size_t n_args;
+            TupInputValueArgs args[TUP_DECODED_MAX_ARGS];
+        } resp_input;           /**< TUP_MESSAGE_RESP_INPUT */
+        struct {
+            uint8_t effect_id;
+            int32_t retval;
+            size_t n_args;
+            TupParameterArgs args[TUP_DECODED_MAX_ARGS];
+        } resp_set_parameter;   /**< TUP_MESSAGE_RESP_SET_PARAMETER */
+        struct {
+            TupFilterId filter;
+            uint8_t actuator_id;
+            bool active;
+        } resp_filter_active;   /**< TUP_MESSAGE_RESP_FILTER_ACTIVE */
+        struct {
+            uint8_t actuator_id;
+            float a[5];
+            float b[5];
+        } resp_band_norm_coeffs; /**< TUP_MESSAGE_RESP_BAND_NORM_COEFFS */
+        struct {
+            TupDebugSystemStatus status;
+            size_t n_tasks;
+            TupDebugTaskStatus tasks[TUP_DECODED_MAX_ARGS];
+        } resp_debug_system_status; /**< TUP_MESSAGE_RESP_DEBUG_SYSTEM_STATUS */
+    } u;
+} TupDecoded;
+
 /* TUP messages */
 TUP_API TupMessage *tup_message_new(void);
 TUP_API void tup_message_free(TupMessage *message);
@@ -237,6 +420,14 @@ TUP_API TupMessageType tup_message_get_type(TupMessage *message);
 
 TUP_API void tup_message_clear(TupMessage *message);
 
+TUP_API int tup_message_type_get_info(TupMessageType type,
+                TupMessageInfo *info);
+TUP_API int tup_message_parse_values(TupMessage *message, SmpValue *values,
+                size_t size);
+TUP_API int tup_message_decode(TupMessage *message, TupDecoded *decoded);
+TUP_API int tup_message_encode(TupMessage *message,
+                const TupDecoded *decoded);
+
 TUP_API void tup_message_init_ack(TupMessage *message, TupMessageType cmd);
 TUP_API void tup_message_init_ack_full(TupMessage *message, TupMessageType cmd,
                 uint32_t arg1);
@@ -435,9 +626,632 @@ TUP_API int tup_message_parse_resp_debug_system_status(TupMessage *message,
                 TupDebugSystemStatus *status, TupDebugTaskStatus *tasks,
                 size_t n_tasks);
 
+TUP_API size_t tup_message_iter_get_remaining(const TupMessageIter *iter);
+TUP_API int tup_resp_parameter_iter_init(TupMessageIter *iter,
+                TupMessage *message, uint8_t *effect_id);
+TUP_API int tup_resp_parameter_iter_next(TupMessageIter *iter,
+                TupParameterArgs *arg);
+TUP_API int tup_resp_set_parameter_iter_init(TupMessageIter *iter,
+                TupMessage *message, uint8_t *effect_id, int32_t *retval);
+TUP_API int tup_resp_set_parameter_iter_next(TupMessageIter *iter,
+                TupParameterArgs *arg);
+TUP_API int tup_resp_sensor_iter_init(TupMessageIter *iter,
+                TupMessage *message);
+TUP_API int tup_resp_sensor_iter_next(TupMessageIter *iter,
+                TupSensorValueArgs *arg);
+TUP_API int tup_resp_input_iter_init(TupMessageIter *iter,
+                TupMessage *message, uint8_t *effect_slot_id);
+TUP_API int tup_resp_input_iter_next(TupMessageIter *iter,
+                TupInputValueArgs *arg);
+TUP_API int tup_resp_debug_system_status_iter_init(TupMessageIter *iter,
+                TupMessage *message, TupDebugSystemStatus *status);
+TUP_API int tup_resp_debug_system_status_iter_next(TupMessageIter *iter,
+                TupDebugTaskStatus *task);
+
+/* TupMessagePool API */
+
+typedef struct TupMessagePool TupMessagePool;
+typedef struct TupMessagePoolCache TupMessagePoolCache;
+
+/**
+ * \ingroup pool
+ * Message pool statistics
+ */
+typedef struct
+{
+    size_t size;                /**< number of messages the pool holds */
+    size_t n_in_use;            /**< number of messages acquired */
+    size_t high_water;          /**< highest number of messages in use */
+    uint64_t n_acquired;        /**< number of messages acquired */
+    uint64_t n_exhausted;       /**< acquires which had to allocate */
+} TupMessagePoolStats;
+
+TUP_API TupMessagePool *tup_message_pool_new(size_t size);
+TUP_API void tup_message_pool_free(TupMessagePool *pool);
+TUP_API TupMessage *tup_message_pool_acquire(TupMessagePool *pool);
+TUP_API void tup_message_pool_release(TupMessagePool *pool, TupMessage *msg);
+TUP_API void tup_message_pool_get_stats(TupMessagePool *pool,
+                TupMessagePoolStats *stats);
+
+TUP_API TupMessagePoolCache *tup_message_pool_cache_new(TupMessagePool *pool,
+                size_t size);
+TUP_API void tup_message_pool_cache_free(TupMessagePoolCache *cache);
+TUP_API TupMessage *tup_message_pool_cache_acquire(
+                TupMessagePoolCache *cache);
+TUP_API void tup_message_pool_cache_release(TupMessagePoolCache *cache,
+                TupMessage *msg);
+
+/* TupTransport API */
+
+/**
+ * \ingroup transport
+ * Operations of a transport backend. priv is the pointer given to
+ * tup_transport_new(). Optional operations can be NULL.
+ */
+typedef struct
+{
+    /** open a device, optional */
+    int (*open)(void *priv, const char *device);
+    /** close the device, optional */
+    void (*close)(void *priv);
+    /** read at most size bytes without blocking. Return the number of bytes
+     * read, 0 if there is no data or a SmpError. */
+    int (*read)(void *priv, uint8_t *buf, size_t size);
+    /** write size bytes, blocking if needed. Return 0 or a SmpError. */
+    int (*write)(void *priv, const uint8_t *data, size_t size);
+    /** wait for incoming data. Return 1 if data can be read, 0 on timeout or
+     * a SmpError. */
+    int (*poll)(void *priv, int timeout_ms);
+    /** get a file descriptor to poll for incoming data, optional */
+    intptr_t (*get_fd)(void *priv);
+    /** set serial config, optional */
+    int (*set_config)(void *priv, SmpSerialBaudrate baudrate,
+            SmpSerialParity parity, int flow_control);
+    /** release priv, optional */
+    void (*free)(void *priv);
+} TupTransportOps;
+
+typedef struct TupTransport TupTransport;
+
+TUP_API TupTransport *tup_transport_new(const TupTransportOps *ops,
+                void *priv);
+TUP_API void tup_transport_free(TupTransport *transport);
+
+TUP_API TupContext *tup_context_new_with_transport(TupTransport *transport,
+                TupCallbacks *cbs, void *userdata);
+
+/* TupTransport backends (Linux only) */
+TUP_API TupTransport *tup_transport_new_serial(void);
+TUP_API TupTransport *tup_transport_new_pty(void);
+TUP_API const char *tup_transport_get_pty_name(TupTransport *transport);
+TUP_API TupTransport *tup_transport_new_fd(int read_fd, int write_fd);
+TUP_API int tup_transport_new_socketpair(TupTransport **transport0,
+                TupTransport **transport1);
+TUP_API int tup_transport_new_loopback(TupTransport **transport0,
+                TupTransport **transport1, size_t size);
+
+/* TupContext request API */
+
+/**
+ * \ingroup request
+ * Completion status of a request
+ */
+typedef enum
+{
+    TUP_REQUEST_STATUS_OK = 0,      /**< an ACK or a RESP_* message was received */
+    TUP_REQUEST_STATUS_ERROR,       /**< an ERROR message was received */
+    TUP_REQUEST_STATUS_TIMEOUT,     /**< no response, request is considered lost */
+    TUP_REQUEST_STATUS_CANCELLED,   /**< context was closed or freed */
+} TupRequestStatus;
+
+/**
+ * \ingroup request
+ * Called when a request completes. response is the matching ACK, ERROR or
+ * RESP_* message and is NULL on timeout or cancellation. It is only valid
+ * during the callback.
+ */
+typedef void (*TupRequestCallback)(TupContext *ctx, TupMessageType cmd,
+        TupRequestStatus status, TupMessage *response, void *userdata);
+
+TUP_API int tup_context_set_request_window(TupContext *ctx,
+                unsigned int window);
+TUP_API unsigned int tup_context_get_n_pending_requests(TupContext *ctx);
+TUP_API int tup_context_send_request(TupContext *ctx, TupMessage *msg,
+                TupRequestCallback callback, void *userdata);
+TUP_API int tup_context_wait_requests(TupContext *ctx, unsigned int n_pending,
+                int timeout_ms);
+
+/* TupContext message handlers API */
+
+/**
+ * \ingroup handler
+ * Called for any message type, with the raw message.
+ */
+typedef void (*TupMessageHandler)(TupContext *ctx, TupMessage *message,
+        void *userdata);
+
+/**
+ * \ingroup handler
+ * Called on ACK. data is 0 if the firmware doesn't send it.
+ */
+typedef void (*TupAckHandler)(TupContext *ctx, TupMessageType cmd,
+        uint32_t data, void *userdata);
+
+/**
+ * \ingroup handler
+ * Called on ERROR. data is 0 if the firmware doesn't send it.
+ */
+typedef void (*TupErrorHandler)(TupContext *ctx, TupMessageType cmd,
+        uint32_t error, uint32_t data, void *userdata);
+
+/**
+ * \ingroup handler
+ * Called on RESP_VERSION and RESP_BUILDINFO.
+ */
+typedef void (*TupStringHandler)(TupContext *ctx, const char *str,
+        void *userdata);
+
+/**
+ * \ingroup handler
+ * Called on RESP_PARAMETER.
+ */
+typedef void (*TupParameterHandler)(TupContext *ctx, uint8_t effect_id,
+        const TupParameterArgs *args, size_t n_args, void *userdata);
+
+/**
+ * \ingroup handler
+ * Called on RESP_SET_PARAMETER.
+ */
+typedef void (*TupSetParameterHandler)(TupContext *ctx, uint8_t effect_id,
+        int32_t retval, const TupParameterArgs *args, size_t n_args,
+        void *userdata);
+
+/**
+ * \ingroup handler
+ * Called on RESP_SENSOR.
+ */
+typedef void (*TupSensorHandler)(TupContext *ctx,
+        const TupSensorValueArgs *args, size_t n_args, void *userdata);
+
+/**
+ * \ingroup handler
+ * Called on RESP_INPUT.
+ */
+typedef void (*TupInputHandler)(TupContext *ctx, uint8_t effect_slot_id,
+        const TupInputValueArgs *args, size_t n_args, void *userdata);
+
+/**
+ * \ingroup handler
+ * Called on RESP_FILTER_ACTIVE.
+ */
+typedef void (*TupFilterActiveHandler)(TupContext *ctx, TupFilterId filter,
+        uint8_t actuator_id, bool active, void *userdata);
+
+/**
+ * \ingroup handler
+ * Called on RESP_BAND_NORM_COEFFS.
+ */
+typedef void (*TupBandNormCoeffsHandler)(TupContext *ctx, uint8_t actuator_id,
+        const float a[5], const float b[5], void *userdata);
+
+/**
+ * \ingroup handler
+ * Called on RESP_DEBUG_SYSTEM_STATUS.
+ */
+typedef void (*TupDebugSystemStatusHandler)(TupContext *ctx,
+        const TupDebugSystemStatus *status, const TupDebugTaskStatus *tasks,
+        size_t n_tasks, void *userdata);
+
+TUP_API int tup_context_set_message_handler(TupContext *ctx,
+                TupMessageType type, TupMessageHandler handler,
+                void *userdata);
+TUP_API int tup_context_set_ack_handler(TupContext *ctx,
+                TupAckHandler handler, void *userdata);
+TUP_API int tup_context_set_error_handler(TupContext *ctx,
+                TupErrorHandler handler, void *userdata);
+TUP_API int tup_context_set_version_handler(TupContext *ctx,
+                TupStringHandler handler, void *userdata);
+TUP_API int tup_context_set_buildinfo_handler(TupContext *ctx,
+                TupStringHandler handler, void *userdata);
+TUP_API int tup_context_set_parameter_handler(TupContext *ctx,
+                TupParameterHandler handler, void *userdata);
+TUP_API int tup_context_set_set_parameter_handler(TupContext *ctx,
+                TupSetParameterHandler handler, void *userdata);
+TUP_API int tup_context_set_sensor_handler(TupContext *ctx,
+                TupSensorHandler handler, void *userdata);
+TUP_API int tup_context_set_input_handler(TupContext *ctx,
+                TupInputHandler handler, void *userdata);
+TUP_API int tup_context_set_filter_active_handler(TupContext *ctx,
+                TupFilterActiveHandler handler, void *userdata);
+TUP_API int tup_context_set_band_norm_coeffs_handler(TupContext *ctx,
+                TupBandNormCoeffsHandler handler, void *userdata);
+TUP_API int tup_context_set_debug_system_status_handler(TupContext *ctx,
+                TupDebugSystemStatusHandler handler, void *userdata);
+
+/* TupContext statistics API */
+
+/**
+ * \ingroup stats
+ * Number of buckets of a TupLatencyHistogram
+ */
+#define TUP_LATENCY_HISTOGRAM_N_BUCKETS 464
+
+/**
+ * \ingroup stats
+ * Size of TupContextStats.n_errors
+ */
+#define TUP_CONTEXT_STATS_N_ERRORS 20
+
+/**
+ * \ingroup stats
+ * Round-trip latency histogram of a command, in microseconds.
+ * Latencies below 16us have one bucket each, then each power of two is split
+ * in 16 buckets so a latency is known within 1/16 of its value.
+ * Use tup_latency_histogram_get_percentile() to read it.
+ */
+typedef struct
+{
+    uint64_t count;             /**< number of samples */
+    uint64_t sum_us;            /**< sum of the samples */
+    uint32_t min_us;            /**< smallest sample */
+    uint32_t max_us;            /**< biggest sample */
+    uint32_t buckets[TUP_LATENCY_HISTOGRAM_N_BUCKETS]; /**< samples by bucket */
+} TupLatencyHistogram;
+
+/**
+ * \ingroup stats
+ * TupContext counters. Bytes are message bytes, framing and escaping
+ * excluded.
+ */
+typedef struct
+{
+    uint64_t n_frames_tx;       /**< number of messages sent */
+    uint64_t n_bytes_tx;        /**< number of bytes sent */
+    uint64_t n_frames_rx;       /**< number of messages received */
+    uint64_t n_bytes_rx;        /**< number of bytes received */
+    uint64_t n_unanswered;      /**< commands which got no response */
+    uint64_t n_unmatched;       /**< messages which answer no command sent */
+    /** errors by code, n_errors[-error] counts the error SmpError, the last
+     * entry counts errors which don't fit */
+    uint64_t n_errors[TUP_CONTEXT_STATS_N_ERRORS];
+} TupContextStats;
+
+TUP_API int tup_context_enable_stats(TupContext *ctx, bool enable);
+TUP_API int tup_context_get_stats(TupContext *ctx, TupContextStats *stats);
+TUP_API int tup_context_get_latency_histogram(TupContext *ctx,
+                TupMessageType cmd, TupLatencyHistogram *histogram);
+TUP_API void tup_context_reset_stats(TupContext *ctx);
+TUP_API void tup_latency_histogram_add(TupLatencyHistogram *histogram,
+                uint64_t latency_us);
+TUP_API uint32_t tup_latency_histogram_get_percentile(
+                const TupLatencyHistogram *histogram, double percentile);
+
+/* TupContext coalescing API */
+TUP_API int tup_context_enable_coalescing(TupContext *ctx, bool enable);
+TUP_API size_t tup_context_get_n_pending_updates(TupContext *ctx);
+
+/* TupContext shadow state API */
+
+/**
+ * \ingroup shadow
+ * Known state of an effect slot, -1 when unknown.
+ */
+typedef struct
+{
+    int32_t bank_id;            /**< id of the loaded effect */
+    int32_t binding_flags;      /**< TupBindingFlags of the slot */
+    int playing;                /**< last commanded play state */
+} TupShadowSlot;
+
+/**
+ * \ingroup shadow
+ * Shadow state counters
+ */
+typedef struct
+{
+    uint64_t n_hits;            /**< GET commands answered locally */
+    uint64_t n_misses;          /**< commands sent as a value was unknown */
+    uint64_t n_elided;          /**< SET commands not sent as no-op */
+} TupShadowStats;
+
+TUP_API int tup_context_enable_shadow(TupContext *ctx, bool enable);
+TUP_API int tup_context_set_shadow_max_age(TupContext *ctx, int max_age_ms);
+TUP_API void tup_context_invalidate_shadow(TupContext *ctx);
+TUP_API int tup_context_get_shadow_slot(TupContext *ctx, uint8_t slot_id,
+                TupShadowSlot *slot);
+TUP_API int tup_context_get_shadow_parameter(TupContext *ctx,
+                uint8_t effect_id, uint8_t parameter_id, uint32_t *value);
+TUP_API int tup_context_get_shadow_input(TupContext *ctx,
+                uint8_t effect_slot_id, uint8_t input_id, int32_t *value);
+TUP_API int tup_context_get_shadow_filter_active(TupContext *ctx,
+                TupFilterId filter, uint8_t actuator_id, bool *active);
+TUP_API int tup_context_get_shadow_band_norm_coeffs(TupContext *ctx,
+                uint8_t actuator_id, float a[5], float b[5]);
+TUP_API int tup_context_get_shadow_stats(TupContext *ctx,
+                TupShadowStats *stats);
+
+/* TupDeviceConfig API */
+
+typedef struct TupDeviceConfig TupDeviceConfig;
+
+TUP_API TupDeviceConfig *tup_device_config_new(void);
+TUP_API void tup_device_config_free(TupDeviceConfig *config);
+TUP_API int tup_device_config_set_slot(TupDeviceConfig *config,
+                uint8_t slot_id, uint16_t bank_id);
+TUP_API int tup_device_config_set_binding(TupDeviceConfig *config,
+                uint8_t slot_id, unsigned int binding_flags);
+TUP_API int tup_device_config_set_parameter(TupDeviceConfig *config,
+                uint8_t slot_id, uint8_t parameter_id, uint32_t value);
+TUP_API int tup_device_config_set_filter_active(TupDeviceConfig *config,
+                TupFilterId filter, uint8_t actuator_id, bool active);
+TUP_API int tup_device_config_set_band_norm_coeffs(TupDeviceConfig *config,
+                uint8_t actuator_id, const float a[5], const float b[5]);
+TUP_API int tup_context_reconcile(TupContext *ctx, TupDeviceConfig *config,
+                int timeout_ms);
+
+/* TupTimeline API (Linux only) */
+
+typedef struct TupTimeline TupTimeline;
+
+/**
+ * \ingroup timeline
+ * Called after a scheduled command was sent with the time elapsed since it
+ * was due.
+ */
+typedef void (*TupTimelineCallback)(TupTimeline *timeline, int event_id,
+                uint32_t lateness_us, void *userdata);
+
+/**
+ * \ingroup timeline
+ * Timeline statistics
+ */
+typedef struct
+{
+    uint64_t n_sent;                /**< number of commands sent */
+    uint64_t n_errors;              /**< number of commands failed to be sent */
+    TupLatencyHistogram lateness;   /**< lateness of sent commands */
+} TupTimelineStats;
+
+TUP_API TupTimeline *tup_timeline_new(TupContext *ctx);
+TUP_API void tup_timeline_free(TupTimeline *timeline);
+TUP_API TupContext *tup_timeline_get_context(TupTimeline *timeline);
+
+TUP_API int tup_timeline_schedule(TupTimeline *timeline, uint64_t time_us,
+                TupMessage *msg);
+TUP_API void tup_timeline_clear(TupTimeline *timeline);
+TUP_API size_t tup_timeline_get_n_pending(TupTimeline *timeline);
+TUP_API void tup_timeline_set_lookahead(TupTimeline *timeline,
+                uint32_t lookahead_us);
+TUP_API void tup_timeline_set_callback(TupTimeline *timeline,
+                TupTimelineCallback callback, void *userdata);
+
+TUP_API int tup_timeline_start(TupTimeline *timeline);
+TUP_API intptr_t tup_timeline_get_fd(TupTimeline *timeline);
+TUP_API int tup_timeline_dispatch(TupTimeline *timeline);
+TUP_API int tup_timeline_run(TupTimeline *timeline);
+TUP_API void tup_timeline_get_stats(TupTimeline *timeline,
+                TupTimelineStats *stats);
+
+/* TupReactor API (Linux only) */
+
+typedef struct TupReactor TupReactor;
+
+/**
+ * \ingroup reactor
+ * Called when a timer expires.
+ */
+typedef void (*TupReactorTimerCallback)(TupReactor *reactor, void *userdata);
+
+TUP_API TupReactor *tup_reactor_new(void);
+TUP_API void tup_reactor_free(TupReactor *reactor);
+
+TUP_API int tup_reactor_add_context(TupReactor *reactor, TupContext *ctx);
+TUP_API int tup_reactor_remove_context(TupReactor *reactor, TupContext *ctx);
+
+TUP_API int tup_reactor_add_timer(TupReactor *reactor, unsigned int timeout_ms,
+                int repeat, TupReactorTimerCallback callback, void *userdata);
+TUP_API int tup_reactor_remove_timer(TupReactor *reactor, int timer_id);
+
+TUP_API int tup_reactor_add_timeline(TupReactor *reactor,
+                TupTimeline *timeline);
+TUP_API int tup_reactor_remove_timeline(TupReactor *reactor,
+                TupTimeline *timeline);
+
+TUP_API int tup_reactor_wakeup(TupReactor *reactor);
+TUP_API int tup_reactor_iterate(TupReactor *reactor, int timeout_ms);
+TUP_API int tup_reactor_run(TupReactor *reactor);
+TUP_API void tup_reactor_quit(TupReactor *reactor);
+
+/* TupContext batch API */
+TUP_API int tup_context_send_batch(TupContext *ctx, TupMessage **msgs,
+                size_t n);
+TUP_API int tup_context_set_write_combining(TupContext *ctx, size_t window);
+TUP_API int tup_context_flush(TupContext *ctx);
+TUP_API int tup_context_enable_peephole(TupContext *ctx, bool enable);
+
+/* TupPreparedMessage API */
+
+typedef struct TupPreparedMessage TupPreparedMessage;
+
+TUP_API TupPreparedMessage *tup_prepared_message_new(TupMessage *message);
+TUP_API void tup_prepared_message_free(TupPreparedMessage *prepared);
+TUP_API TupMessage *tup_prepared_message_get_message(
+                TupPreparedMessage *prepared);
+TUP_API int tup_prepared_message_set_value(TupPreparedMessage *prepared,
+                unsigned int index, const SmpValue *value);
+TUP_API int tup_prepared_message_set_int32(TupPreparedMessage *prepared,
+                unsigned int index, int32_t value);
+TUP_API int tup_prepared_message_set_uint32(TupPreparedMessage *prepared,
+                unsigned int index, uint32_t value);
+TUP_API int tup_context_send_prepared(TupContext *ctx,
+                TupPreparedMessage *prepared);
+
+/* Encoder API */
+
+/* biggest frame a tup_encode_*() function writes */
+#define TUP_ENCODE_MAX_SIZE (2 * 1024 + 4)
+
+TUP_API int tup_encode_ack(uint8_t *buf, size_t size, TupMessageType cmd);
+TUP_API int tup_encode_ack_full(uint8_t *buf, size_t size, TupMessageType cmd,
+                uint32_t arg1);
+TUP_API int tup_encode_error(uint8_t *buf, size_t size, TupMessageType cmd,
+                uint32_t error);
+TUP_API int tup_encode_error_full(uint8_t *buf, size_t size, TupMessageType cmd,
+                uint32_t error, uint32_t arg1);
+TUP_API int tup_encode_load(uint8_t *buf, size_t size, uint8_t effect_id,
+                uint16_t bank_id);
+TUP_API int tup_encode_play(uint8_t *buf, size_t size, uint8_t effect_id);
+TUP_API int tup_encode_stop(uint8_t *buf, size_t size, uint8_t effect_id);
+TUP_API int tup_encode_get_version(uint8_t *buf, size_t size);
+TUP_API int tup_encode_get_parameter(uint8_t *buf, size_t size,
+                uint8_t effect_id, const uint8_t *parameter_ids,
+                size_t n_parameters);
+TUP_API int tup_encode_set_parameter(uint8_t *buf, size_t size,
+                uint8_t effect_id, const TupParameterArgs *params,
+                size_t n_params);
+TUP_API int tup_encode_bind_effect(uint8_t *buf, size_t size, uint8_t effect_id,
+                unsigned int binding_flags);
+TUP_API int tup_encode_get_sensor_value(uint8_t *buf, size_t size,
+                const uint8_t *sensor_ids, size_t n_sensors);
+TUP_API int tup_encode_set_sensor_value(uint8_t *buf, size_t size,
+                const TupSensorValueArgs *args, size_t n_args);
+TUP_API int tup_encode_get_input_value(uint8_t *buf, size_t size,
+                uint8_t effect_slot_id, const uint8_t *input_ids,
+                size_t n_inputs);
+TUP_API int tup_encode_set_input_value(uint8_t *buf, size_t size,
+                uint8_t effect_slot_id, const TupInputValueArgs *args,
+                size_t n_args);
+TUP_API int tup_encode_filter_get_active(uint8_t *buf, size_t size,
+                TupFilterId filter, uint8_t actuator_id);
+TUP_API int tup_encode_filter_set_active(uint8_t *buf, size_t size,
+                TupFilterId filter, uint8_t actuator_id, bool active);
+TUP_API int tup_encode_config_write(uint8_t *buf, size_t size);
+TUP_API int tup_encode_config_band_norm_get_coeffs(uint8_t *buf, size_t size,
+                uint8_t actuator_id);
+TUP_API int tup_encode_config_band_norm_set_coeffs(uint8_t *buf, size_t size,
+                uint8_t actuator_id, const float a[5], const float b[5]);
+TUP_API int tup_encode_get_buildinfo(uint8_t *buf, size_t size);
+TUP_API int tup_encode_activate_internal_sensors(uint8_t *buf, size_t size,
+                uint8_t state);
+TUP_API int tup_encode_resp_version(uint8_t *buf, size_t size,
+                const char *version);
+TUP_API int tup_encode_resp_parameter(uint8_t *buf, size_t size,
+                uint8_t effect_id, const TupParameterArgs *args, size_t n_args);
+TUP_API int tup_encode_resp_sensor(uint8_t *buf, size_t size,
+                const TupSensorValueArgs *args, size_t n_args);
+TUP_API int tup_encode_resp_input(uint8_t *buf, size_t size,
+                uint8_t effect_slot_id, const TupInputValueArgs *args,
+                size_t n_args);
+TUP_API int tup_encode_resp_buildinfo(uint8_t *buf, size_t size,
+                const char *buildinfo);
+TUP_API int tup_encode_resp_set_parameter(uint8_t *buf, size_t size,
+                uint8_t effect_id, int32_t retval, const TupParameterArgs *args,
+                size_t n_args);
+TUP_API int tup_encode_resp_filter_active(uint8_t *buf, size_t size,
+                TupFilterId filter, uint8_t actuator_id, bool active);
+TUP_API int tup_encode_resp_band_norm_coeffs(uint8_t *buf, size_t size,
+                uint8_t actuator_id, const float a[5], const float b[5]);
+TUP_API int tup_encode_cmd_debug_get_system_status(uint8_t *buf, size_t size);
+TUP_API int tup_encode_resp_debug_system_status(uint8_t *buf, size_t size,
+                const TupDebugSystemStatus *status,
+                const TupDebugTaskStatus *tasks, size_t n_tasks);
+TUP_API int tup_context_send_raw(TupContext *ctx, const uint8_t *data,
+                size_t size);
+
+/* TupContext threaded mode API (Linux only) */
+
+/**
+ * \ingroup iothread
+ * Transmit ring statistics
+ */
+typedef struct
+{
+    size_t queue_size;          /**< number of frames the ring can hold */
+    size_t queue_depth;         /**< number of frames waiting to be written */
+    size_t high_water;          /**< highest queue depth seen */
+    uint64_t n_queued;          /**< number of frames queued */
+    uint64_t n_written;         /**< number of frames written to the device */
+    uint64_t n_overflows;       /**< number of frames rejected as ring was full */
+    uint64_t n_write_errors;    /**< number of frames which failed to be written */
+} TupIoThreadStats;
+
+TUP_API int tup_context_start_io_thread(TupContext *ctx, size_t queue_size);
+TUP_API int tup_context_stop_io_thread(TupContext *ctx);
+TUP_API int tup_context_get_io_thread_stats(TupContext *ctx,
+                TupIoThreadStats *stats);
+
+/* TupContext capture and replay API (Linux only) */
+
+/* capture file format, see capture.c */
+#define TUP_CAPTURE_MAGIC "TUPCAP\r\n"
+#define TUP_CAPTURE_VERSION 1
+#define TUP_CAPTURE_HEADER_SIZE 24
+#define TUP_CAPTURE_RECORD_HEADER_SIZE 16
+#define TUP_CAPTURE_ALIGNMENT 8
+
+/**
+ * \ingroup capture
+ * Direction of a captured frame
+ */
+typedef enum
+{
+    TUP_CAPTURE_TX = 0,     /**< written to the device */
+    TUP_CAPTURE_RX = 1,     /**< received from the device */
+} TupCaptureDirection;
+
+/**
+ * \ingroup replay
+ * A frame read from a capture file
+ */
+typedef struct
+{
+    uint64_t time_ns;               /**< time since the capture start */
+    TupCaptureDirection direction;  /**< direction of the frame */
+    const uint8_t *data;            /**< the frame as on the wire */
+    size_t size;                    /**< size of the frame */
+} TupCaptureFrame;
+
+/**
+ * \ingroup replay
+ * What tup_capture_file_replay() does with captured frames
+ */
+typedef enum
+{
+    TUP_REPLAY_SEND_TX = 1 << 0,        /**< send TX frames to the device */
+    TUP_REPLAY_INJECT_TX = 1 << 1,      /**< dispatch TX frames as if received,
+                                          to feed a simulated device */
+    TUP_REPLAY_INJECT_RX = 1 << 2,      /**< dispatch RX frames as if received */
+    TUP_REPLAY_PROCESS_INPUT = 1 << 3,  /**< process incoming data between
+                                          frames */
+} TupReplayFlags;
+
+typedef struct TupCaptureFile TupCaptureFile;
+
+TUP_API int tup_context_start_capture(TupContext *ctx, const char *path);
+TUP_API int tup_context_stop_capture(TupContext *ctx);
+
+TUP_API TupCaptureFile *tup_capture_file_open(const char *path);
+TUP_API void tup_capture_file_close(TupCaptureFile *file);
+TUP_API uint64_t tup_capture_file_get_start_time(TupCaptureFile *file);
+TUP_API int tup_capture_file_next(TupCaptureFile *file,
+                TupCaptureFrame *frame);
+TUP_API void tup_capture_file_rewind(TupCaptureFile *file);
+TUP_API int tup_capture_frame_decode(const TupCaptureFrame *frame,
+                TupMessage *message, uint8_t *buf, size_t size);
+TUP_API int tup_capture_file_replay(TupCaptureFile *file, TupContext *ctx,
+                unsigned int flags, double speed);
+
 #ifdef TUP_ENABLE_STATIC_API
-/* For now TupContext and TupMessage needs no storage so */
-typedef void TupStaticContext;
+/**
+ * \ingroup context
+ * Storage for a TupContext, see TUP_DEFINE_STATIC_CONTEXT().
+ */
+typedef struct
+{
+    void *reserved[16];
+} TupStaticContext;
+
+/* For now TupMessage needs no storage so */
 typedef void TupStaticMessage;
 
 /**
@@ -462,15 +1276,15 @@ SMP_DEFINE_STATIC_CONTEXT(name##_smp, serial_rx_bufsize, serial_tx_bufsize,    \
             msg_tx_bufsize, msg_rx_values_size)                                \
 static TupContext* name##_create(const TupCallbacks *cbs, void *userdata)      \
 {                                                                              \
+    static TupStaticContext sctx;                                              \
     SmpContext *ctx;                                                           \
     SmpEventCallbacks scbs;                                                    \
                                                                                \
-    scbs.new_message_cb =                                                      \
-        (void (*)(SmpContext* , SmpMessage *, void *)) cbs->new_message_cb;    \
-    scbs.error_cb = cbs->error_cb;                                             \
+    tup_context_init_smp_callbacks(&scbs);                                     \
                                                                                \
-    ctx = name##_smp_create(&scbs, userdata);                                  \
-    return tup_context_new_from_static(NULL, 0, ctx, NULL, NULL);              \
+    ctx = name##_smp_create(&scbs, &sctx);                                     \
+    return tup_context_new_from_static(&sctx, sizeof(sctx), ctx, cbs,          \
+            userdata);                                                         \
 }
 
 /**
@@ -490,6 +1304,7 @@ static TupMessage* name##_create()                                            \
     return tup_message_new_from_static(NULL, 0, name##_smp_create(0));        \
 }
 
+TUP_API void tup_context_init_smp_callbacks(SmpEventCallbacks *scbs);
 TUP_API TupContext *tup_context_new_from_static(TupStaticContext *sctx,
                 size_t struct_size, SmpContext *smp_ctx,
                 const TupCallbacks *cbs, void *userdata);
@@ -22,7 +22,28 @@ INCLUDED_FILES = ["COPYING", "README.md", "library.properties"]
 
 # files to be excluded globally
 EXCLUDED_FILES = [".gitignore"]
+
+# host only sources (see meson.build)
+EXCLUDED_FILES += ["capture.c", "io-thread.c", "reactor.c", "replay.c",
+                   "timeline.c", "transport-unix.c"]
+
+# optional subsystems, left out by default to save flash, and sizes kept low
+# to save RAM (see src/libtup-private.h)
 CONFIGURATION_PARAMETERS = {
+    "libtup-config.h": [
+        ("TUP_ENABLE_STATS", 0, "Traffic statistics and latency histograms"),
+        ("TUP_ENABLE_SHADOW", 0, "Shadow state of the device"),
+        ("TUP_ENABLE_COALESCING", 0, "Coalescing of parameter and input "
+         "updates"),
+        ("TUP_ENABLE_HANDLERS", 0, "Per message type handlers"),
+        ("TUP_ENABLE_BATCH", 0, "Batches and write combining"),
+        ("TUP_ENABLE_PEEPHOLE", 0, "Peephole optimization of batches, "
+         "requires TUP_ENABLE_BATCH"),
+        ("TUP_ENABLE_TRANSPORT", 0, "Pluggable transports, requires "
+         "TUP_ENABLE_BATCH"),
+        ("TUP_MESSAGE_MAX_VALUES", 32, "Values held by a message created "
+         "by tup_message_new()"),
+    ],
 }
 
 parser = argparse.ArgumentParser()
@@ -56,7 +77,7 @@ def generate_config_file(params):
         # Ask user for configuration value
         try:
             value = int(input("> "))
-        except ValueError:
+        except (ValueError, EOFError):
             value = int(param[1])
         print(param[0], "=", value)
         print()
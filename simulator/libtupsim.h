@@ -0,0 +1,170 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ */
+
+#ifndef LIBTUPSIM_H
+#define LIBTUPSIM_H
+
+#include <libtup.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct TupSimDevice TupSimDevice;
+typedef struct TupSimulator TupSimulator;
+typedef struct TupSimLink TupSimLink;
+
+/**
+ * \ingroup simulator
+ * Error codes sent in ERROR messages by the simulated device
+ */
+typedef enum
+{
+    TUP_SIM_ERROR_BAD_MESSAGE = 1,      /**< malformed command */
+    TUP_SIM_ERROR_UNKNOWN_COMMAND,      /**< command not supported */
+    TUP_SIM_ERROR_INVALID_SLOT,         /**< effect slot out of range */
+    TUP_SIM_ERROR_EMPTY_SLOT,           /**< no effect loaded in the slot */
+    TUP_SIM_ERROR_INVALID_ACTUATOR,     /**< actuator out of range */
+    TUP_SIM_ERROR_INVALID_FILTER,       /**< unknown filter */
+} TupSimError;
+
+/**
+ * \ingroup simulator
+ * Simulated device configuration
+ */
+typedef struct
+{
+    const char *version;        /**< answer to GET_VERSION */
+    const char *buildinfo;      /**< answer to GET_BUILDINFO */
+    unsigned int n_slots;       /**< number of effect slots */
+    unsigned int n_actuators;   /**< number of actuators */
+} TupSimConfig;
+
+/**
+ * \ingroup simulator
+ * Simulated device counters
+ */
+typedef struct
+{
+    uint64_t n_commands;        /**< number of commands received */
+    uint64_t n_errors;          /**< number of ERROR sent */
+    uint64_t n_bad_frames;      /**< number of frames which failed to decode */
+    uint64_t n_config_writes;   /**< number of CONFIG_WRITE received */
+} TupSimDeviceStats;
+
+TUP_API void tup_sim_config_init(TupSimConfig *config);
+
+TUP_API TupSimDevice *tup_sim_device_new(TupTransport *transport,
+                const TupSimConfig *config);
+TUP_API void tup_sim_device_free(TupSimDevice *dev);
+TUP_API int tup_sim_device_open(TupSimDevice *dev, const char *device);
+TUP_API TupContext *tup_sim_device_get_context(TupSimDevice *dev);
+TUP_API int tup_sim_device_handle_message(TupSimDevice *dev,
+                TupMessage *command, TupMessage *response);
+TUP_API void tup_sim_device_get_stats(TupSimDevice *dev,
+                TupSimDeviceStats *stats);
+
+TUP_API TupSimulator *tup_simulator_new(void);
+TUP_API void tup_simulator_free(TupSimulator *sim);
+TUP_API int tup_simulator_add_device(TupSimulator *sim, TupSimDevice *dev);
+TUP_API int tup_simulator_remove_device(TupSimulator *sim,
+                TupSimDevice *dev);
+TUP_API size_t tup_simulator_get_n_devices(TupSimulator *sim);
+TUP_API TupReactor *tup_simulator_get_reactor(TupSimulator *sim);
+TUP_API int tup_simulator_iterate(TupSimulator *sim, int timeout_ms);
+TUP_API int tup_simulator_run(TupSimulator *sim);
+TUP_API void tup_simulator_quit(TupSimulator *sim);
+
+/* Simulated serial link */
+
+/**
+ * \ingroup simlink
+ * Distribution of a processing latency
+ */
+typedef enum
+{
+    TUP_SIM_LATENCY_FIXED = 0,      /**< always min_us */
+    TUP_SIM_LATENCY_UNIFORM,        /**< uniform between min_us and max_us */
+    TUP_SIM_LATENCY_EXPONENTIAL,    /**< min_us plus an exponential part of
+                                      mean mean_us, capped to max_us */
+} TupSimLatencyDistribution;
+
+/**
+ * \ingroup simlink
+ * Processing latency of a command by the simulated firmware
+ */
+typedef struct
+{
+    TupSimLatencyDistribution distribution;  /**< the distribution */
+    uint32_t min_us;                         /**< minimum latency */
+    uint32_t max_us;                         /**< maximum latency */
+    uint32_t mean_us;                        /**< mean of the exponential
+                                                part */
+} TupSimLatency;
+
+/**
+ * \ingroup simlink
+ * Simulated link configuration
+ */
+typedef struct
+{
+    SmpSerialBaudrate baudrate;     /**< initial baudrate */
+    unsigned int bitrate;           /**< bits per second overriding baudrate,
+                                      0 to use baudrate */
+    SmpSerialParity parity;         /**< initial parity */
+    int flow_control;               /**< initial flow control, host writes
+                                      fail with SMP_ERROR_BUSY instead of
+                                      overrunning the RX FIFO */
+    size_t rx_fifo_size;            /**< device RX FIFO size in bytes, 0 for
+                                      unlimited */
+    double drop_rate;               /**< probability to lose a frame */
+    double corrupt_rate;            /**< probability to corrupt a frame */
+    uint32_t seed;                  /**< seed of the random generator */
+} TupSimLinkConfig;
+
+/**
+ * \ingroup simlink
+ * Simulated link counters
+ */
+typedef struct
+{
+    uint64_t n_frames_to_device;    /**< frames written by the host */
+    uint64_t n_frames_to_host;      /**< frames written by the device */
+    uint64_t n_bytes_to_device;     /**< bytes written by the host */
+    uint64_t n_bytes_to_host;       /**< bytes written by the device */
+    uint64_t n_dropped;             /**< frames lost on the wire */
+    uint64_t n_corrupted;           /**< frames corrupted on the wire */
+    uint64_t n_overruns;            /**< frames lost as the RX FIFO was full */
+} TupSimLinkStats;
+
+TUP_API void tup_sim_link_config_init(TupSimLinkConfig *config);
+
+TUP_API TupSimLink *tup_sim_link_new(const TupSimLinkConfig *config,
+                TupTransport **host, TupTransport **device);
+TUP_API int tup_sim_link_set_bitrate(TupSimLink *link, unsigned int bitrate);
+TUP_API int tup_sim_link_set_latency(TupSimLink *link, TupMessageType cmd,
+                const TupSimLatency *latency);
+TUP_API void tup_sim_link_get_stats(TupSimLink *link, TupSimLinkStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,762 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * \defgroup simlink Simulated link
+ *
+ * In-memory serial link between a host and a simulated device.
+ *
+ * Unlike the loopback transport, bytes are only delivered once they would
+ * have been serialized on a UART using the current baudrate and parity, and
+ * responses of the device are held for the processing time of the command
+ * they answer. Frames can also be lost, corrupted or overrun the RX FIFO of
+ * the device.
+ *
+ * The link works at frame level: what a side writes is cut in frames, each
+ * frame is scheduled on the wire and the reading side is woken up by a
+ * timerfd once the frame is fully received.
+ *
+ * With flow control and a limited RX FIFO, a host write which doesn't fit
+ * in the FIFO fails with SMP_ERROR_BUSY instead of blocking, as the device
+ * making room may be served by the same thread.
+ */
+
+#include "libtupsim.h"
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+/* libsmp serial frame delimiters */
+#define TUP_SIM_FRAME_START_BYTE 0x10
+#define TUP_SIM_FRAME_END_BYTE 0xFF
+#define TUP_SIM_FRAME_ESC_BYTE 0x1B
+
+/* biggest escaped frame accepted on the link */
+#define TUP_SIM_LINK_MAX_FRAME_SIZE 4096
+
+/* maximum number of commands waiting for their response */
+#define TUP_SIM_LINK_MAX_PENDING 256
+
+enum
+{
+    TUP_SIM_LINK_HOST = 0,
+    TUP_SIM_LINK_DEVICE = 1,
+};
+
+typedef struct TupSimSegment TupSimSegment;
+
+/* a frame on the wire, byte i is received at start_ns + (i + 1) * byte_ns */
+struct TupSimSegment
+{
+    TupSimSegment *next;
+    uint64_t start_ns;
+    uint64_t byte_ns;
+    size_t len;
+    size_t offset;
+    uint8_t data[];
+};
+
+/* data flowing to one end of the link */
+typedef struct
+{
+    TupSimSegment *head;
+    TupSimSegment *tail;
+
+    /* time at which the wire is free */
+    uint64_t wire_free_ns;
+
+    /* bytes written but not read yet */
+    size_t backlog;
+
+    /* readable when the next byte is due */
+    int timer_fd;
+
+    /* frame being written */
+    uint8_t frame[TUP_SIM_LINK_MAX_FRAME_SIZE];
+    size_t frame_len;
+    int in_frame;
+    int escaped;
+} TupSimDirection;
+
+typedef struct
+{
+    TupMessageType cmd;
+    uint64_t ready_ns;
+} TupSimPendingCommand;
+
+struct TupSimLink
+{
+    pthread_mutex_t lock;
+    int n_ends;
+
+    TupSimLinkConfig config;
+    uint64_t byte_ns;
+
+    /* dirs[i] holds the data read by end i */
+    TupSimDirection dirs[2];
+
+    /* latencies by command id, index 0 is the default */
+    TupSimLatency latencies[256];
+
+    /* commands received by the device, waiting for their response */
+    TupSimPendingCommand pending[TUP_SIM_LINK_MAX_PENDING];
+    size_t pending_head;
+    size_t n_pending;
+    uint64_t device_busy_ns;
+
+    uint64_t random_state;
+    TupSimLinkStats stats;
+};
+
+typedef struct
+{
+    TupSimLink *link;
+    int index;
+} TupSimLinkEnd;
+
+static uint64_t tup_sim_link_get_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* xorshift64*, returns a number in [0, 1) */
+static double tup_sim_link_random(TupSimLink *link)
+{
+    uint64_t x = link->random_state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    link->random_state = x;
+
+    return (double) ((x * 0x2545F4914F6CDD1DULL) >> 11) / (double) (1ULL << 53);
+}
+
+/* shall be called with the lock held, bitrate overrides baudrate if set */
+static int tup_sim_link_configure(TupSimLink *link,
+        SmpSerialBaudrate baudrate, unsigned int bitrate,
+        SmpSerialParity parity, int flow_control)
+{
+    uint64_t byte_ns;
+
+    byte_ns = tup_serial_get_byte_time_ns(bitrate > 0 ? bitrate
+            : tup_serial_baudrate_get_bps(baudrate), parity);
+    if (byte_ns == 0)
+        return SMP_ERROR_INVALID_PARAM;
+
+    link->config.baudrate = baudrate;
+    link->config.bitrate = bitrate;
+    link->config.parity = parity;
+    link->config.flow_control = flow_control;
+    link->byte_ns = byte_ns;
+    return 0;
+}
+
+static uint64_t tup_sim_link_draw_latency_ns(TupSimLink *link,
+        TupMessageType cmd)
+{
+    const TupSimLatency *latency;
+    double us;
+
+    latency = &link->latencies[cmd < 256 ? cmd : 0];
+    if (latency->distribution == TUP_SIM_LATENCY_FIXED && latency->min_us == 0
+            && latency->max_us == 0)
+        latency = &link->latencies[0];
+
+    switch (latency->distribution) {
+        case TUP_SIM_LATENCY_UNIFORM:
+            us = latency->min_us + tup_sim_link_random(link)
+                * (double) (latency->max_us - latency->min_us);
+            break;
+        case TUP_SIM_LATENCY_EXPONENTIAL:
+            us = latency->min_us
+                - log(1.0 - tup_sim_link_random(link)) * latency->mean_us;
+            if (latency->max_us > 0 && us > latency->max_us)
+                us = latency->max_us;
+            break;
+        case TUP_SIM_LATENCY_FIXED:
+        default:
+            us = latency->min_us;
+            break;
+    }
+
+    return (uint64_t) (us * 1000.0);
+}
+
+/* arm the timer of dir on the time its next frame is fully received */
+static void tup_sim_direction_arm(TupSimDirection *dir)
+{
+    struct itimerspec its;
+    uint64_t due_ns = 0;
+
+    memset(&its, 0, sizeof(its));
+
+    if (dir->head != NULL) {
+        due_ns = dir->head->start_ns + dir->head->len * dir->head->byte_ns;
+
+        its.it_value.tv_sec = due_ns / 1000000000;
+        its.it_value.tv_nsec = due_ns % 1000000000;
+
+        /* an all zero value would disarm the timer */
+        if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+            its.it_value.tv_nsec = 1;
+    }
+
+    timerfd_settime(dir->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* get the message id of an escaped frame, START and END excluded */
+static TupMessageType tup_sim_frame_get_msgid(const uint8_t *frame,
+        size_t len)
+{
+    uint32_t msgid = 0;
+    size_t n = 0;
+    size_t i;
+    int escaped = 0;
+
+    for (i = 0; i < len && n < 4; i++) {
+        if (!escaped && frame[i] == TUP_SIM_FRAME_ESC_BYTE) {
+            escaped = 1;
+            continue;
+        }
+
+        escaped = 0;
+        msgid |= (uint32_t) frame[i] << (8 * n);
+        n++;
+    }
+
+    return msgid;
+}
+
+/* flip a bit of a payload byte, keeping the framing intact */
+static void tup_sim_frame_corrupt(TupSimLink *link, uint8_t *frame,
+        size_t len)
+{
+    size_t i;
+    int tries;
+
+    for (tries = 0; tries < 16; tries++) {
+        uint8_t byte;
+
+        i = tup_sim_link_random(link) * len;
+        byte = frame[i] ^ (1 << (int) (tup_sim_link_random(link) * 8));
+
+        if (frame[i] == TUP_SIM_FRAME_ESC_BYTE
+                || byte == TUP_SIM_FRAME_START_BYTE
+                || byte == TUP_SIM_FRAME_END_BYTE
+                || byte == TUP_SIM_FRAME_ESC_BYTE)
+            continue;
+
+        /* the escaped byte itself can't become a plain one */
+        if (i > 0 && frame[i - 1] == TUP_SIM_FRAME_ESC_BYTE)
+            continue;
+
+        frame[i] = byte;
+        return;
+    }
+}
+
+/* schedule the frame written by end 'from' on the wire, lock held */
+static int tup_sim_link_commit_frame(TupSimLink *link, int from)
+{
+    TupSimDirection *dir = &link->dirs[!from];
+    TupSimPendingCommand *pending;
+    TupSimSegment *segment;
+    uint64_t now_ns;
+    uint64_t start_ns;
+    size_t len;
+    int lost = 0;
+
+    /* the frame is START | payload | END */
+    len = dir->frame_len + 2;
+    now_ns = tup_sim_link_get_time_ns();
+
+    if (from == TUP_SIM_LINK_HOST) {
+        link->stats.n_frames_to_device++;
+        link->stats.n_bytes_to_device += len;
+
+        /* flow control is handled by the write, see
+         * tup_sim_link_end_write() */
+        if (link->config.rx_fifo_size > 0 && !link->config.flow_control
+                && dir->backlog > 0
+                && dir->backlog + len > link->config.rx_fifo_size) {
+            link->stats.n_overruns++;
+            lost = 1;
+        }
+    } else {
+        link->stats.n_frames_to_host++;
+        link->stats.n_bytes_to_host += len;
+    }
+
+    if (link->n_ends < 2)
+        return SMP_ERROR_PIPE;
+
+    start_ns = now_ns > dir->wire_free_ns ? now_ns : dir->wire_free_ns;
+
+    /* a response leaves once the firmware has processed the command */
+    if (from == TUP_SIM_LINK_DEVICE && link->n_pending > 0) {
+        pending = &link->pending[link->pending_head];
+        if (pending->ready_ns > start_ns)
+            start_ns = pending->ready_ns;
+
+        link->pending_head = (link->pending_head + 1) % TUP_SIM_LINK_MAX_PENDING;
+        link->n_pending--;
+    }
+
+    /* a lost frame still takes its time on the wire */
+    dir->wire_free_ns = start_ns + len * link->byte_ns;
+
+    if (!lost && link->config.drop_rate > 0
+            && tup_sim_link_random(link) < link->config.drop_rate) {
+        link->stats.n_dropped++;
+        lost = 1;
+    }
+
+    if (lost)
+        return 0;
+
+    if (link->config.corrupt_rate > 0 && dir->frame_len > 0
+            && tup_sim_link_random(link) < link->config.corrupt_rate) {
+        link->stats.n_corrupted++;
+        tup_sim_frame_corrupt(link, dir->frame, dir->frame_len);
+
+        /* the device drops it, so no response is expected */
+        lost = 1;
+    }
+
+    if (from == TUP_SIM_LINK_HOST && !lost
+            && link->n_pending < TUP_SIM_LINK_MAX_PENDING) {
+        uint64_t received_ns = dir->wire_free_ns;
+        uint64_t ready_ns;
+
+        ready_ns = received_ns > link->device_busy_ns ? received_ns
+            : link->device_busy_ns;
+        ready_ns += tup_sim_link_draw_latency_ns(link,
+                tup_sim_frame_get_msgid(dir->frame, dir->frame_len));
+        link->device_busy_ns = ready_ns;
+
+        pending = &link->pending[(link->pending_head + link->n_pending)
+            % TUP_SIM_LINK_MAX_PENDING];
+        pending->ready_ns = ready_ns;
+        link->n_pending++;
+    }
+
+    segment = malloc(sizeof(*segment) + len);
+    if (segment == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    segment->next = NULL;
+    segment->start_ns = start_ns;
+    segment->byte_ns = link->byte_ns;
+    segment->len = len;
+    segment->offset = 0;
+    segment->data[0] = TUP_SIM_FRAME_START_BYTE;
+    memcpy(segment->data + 1, dir->frame, dir->frame_len);
+    segment->data[len - 1] = TUP_SIM_FRAME_END_BYTE;
+
+    if (dir->tail != NULL)
+        dir->tail->next = segment;
+    else
+        dir->head = segment;
+
+    dir->tail = segment;
+    dir->backlog += len;
+
+    if (dir->head == segment)
+        tup_sim_direction_arm(dir);
+
+    return 0;
+}
+
+/* Transport operations */
+
+static int tup_sim_link_end_write(void *priv, const uint8_t *data,
+        size_t size)
+{
+    TupSimLinkEnd *end = priv;
+    TupSimLink *link = end->link;
+    TupSimDirection *dir = &link->dirs[!end->index];
+    size_t i;
+    int ret = 0;
+
+    pthread_mutex_lock(&link->lock);
+
+    /* RTS is deasserted until the device makes room, let the host retry
+     * rather than blocking a thread which may also serve the device */
+    if (end->index == TUP_SIM_LINK_HOST && link->config.flow_control
+            && link->config.rx_fifo_size > 0 && dir->backlog > 0
+            && dir->backlog + size > link->config.rx_fifo_size) {
+        pthread_mutex_unlock(&link->lock);
+        return SMP_ERROR_BUSY;
+    }
+
+    for (i = 0; i < size && ret == 0; i++) {
+        uint8_t byte = data[i];
+
+        if (!dir->escaped && byte == TUP_SIM_FRAME_START_BYTE) {
+            dir->in_frame = 1;
+            dir->frame_len = 0;
+            continue;
+        }
+
+        if (!dir->in_frame)
+            continue;
+
+        if (!dir->escaped && byte == TUP_SIM_FRAME_END_BYTE) {
+            dir->in_frame = 0;
+            ret = tup_sim_link_commit_frame(link, end->index);
+            continue;
+        }
+
+        dir->escaped = !dir->escaped && byte == TUP_SIM_FRAME_ESC_BYTE;
+
+        if (dir->frame_len == sizeof(dir->frame)) {
+            /* can't be received by the peer anyway */
+            dir->in_frame = 0;
+            continue;
+        }
+
+        dir->frame[dir->frame_len++] = byte;
+    }
+
+    pthread_mutex_unlock(&link->lock);
+    return ret;
+}
+
+static int tup_sim_link_end_read(void *priv, uint8_t *buf, size_t size)
+{
+    TupSimLinkEnd *end = priv;
+    TupSimLink *link = end->link;
+    TupSimDirection *dir = &link->dirs[end->index];
+    uint64_t expirations;
+    uint64_t now_ns;
+    size_t n = 0;
+
+    pthread_mutex_lock(&link->lock);
+
+    now_ns = tup_sim_link_get_time_ns();
+
+    while (dir->head != NULL && n < size) {
+        TupSimSegment *segment = dir->head;
+        size_t due;
+        size_t chunk;
+
+        if (now_ns < segment->start_ns + segment->byte_ns)
+            break;
+
+        due = (now_ns - segment->start_ns) / segment->byte_ns;
+        if (due > segment->len)
+            due = segment->len;
+
+        if (due <= segment->offset)
+            break;
+
+        chunk = due - segment->offset;
+        if (chunk > size - n)
+            chunk = size - n;
+
+        memcpy(buf + n, segment->data + segment->offset, chunk);
+        segment->offset += chunk;
+        n += chunk;
+
+        if (segment->offset == segment->len) {
+            dir->head = segment->next;
+            if (dir->head == NULL)
+                dir->tail = NULL;
+
+            free(segment);
+        }
+    }
+
+    dir->backlog -= n;
+
+    /* acknowledge the expiration and wait for the next frame */
+    if (read(dir->timer_fd, &expirations, sizeof(expirations)) < 0
+            && errno != EAGAIN)
+        n = 0;
+
+    tup_sim_direction_arm(dir);
+
+    pthread_mutex_unlock(&link->lock);
+    return (int) n;
+}
+
+static int tup_sim_link_end_poll(void *priv, int timeout_ms)
+{
+    TupSimLinkEnd *end = priv;
+    struct pollfd pfd;
+    int ret;
+
+    pfd.fd = end->link->dirs[end->index].timer_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    do {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0)
+        return SMP_ERROR_IO;
+
+    return ret > 0 ? 1 : 0;
+}
+
+static intptr_t tup_sim_link_end_get_fd(void *priv)
+{
+    TupSimLinkEnd *end = priv;
+
+    return end->link->dirs[end->index].timer_fd;
+}
+
+static int tup_sim_link_end_set_config(void *priv,
+        SmpSerialBaudrate baudrate, SmpSerialParity parity, int flow_control)
+{
+    TupSimLinkEnd *end = priv;
+    int ret;
+
+    pthread_mutex_lock(&end->link->lock);
+    ret = tup_sim_link_configure(end->link, baudrate, 0, parity, flow_control);
+    pthread_mutex_unlock(&end->link->lock);
+
+    return ret;
+}
+
+static void tup_sim_link_free(TupSimLink *link)
+{
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        TupSimDirection *dir = &link->dirs[i];
+
+        while (dir->head != NULL) {
+            TupSimSegment *next = dir->head->next;
+
+            free(dir->head);
+            dir->head = next;
+        }
+
+        if (dir->timer_fd >= 0)
+            close(dir->timer_fd);
+    }
+
+    pthread_mutex_destroy(&link->lock);
+    free(link);
+}
+
+static void tup_sim_link_end_free(void *priv)
+{
+    TupSimLinkEnd *end = priv;
+    TupSimLink *link = end->link;
+    int n_ends;
+
+    pthread_mutex_lock(&link->lock);
+    n_ends = --link->n_ends;
+    pthread_mutex_unlock(&link->lock);
+
+    if (n_ends == 0)
+        tup_sim_link_free(link);
+
+    free(end);
+}
+
+static const TupTransportOps tup_sim_link_ops = {
+    .read = tup_sim_link_end_read,
+    .write = tup_sim_link_end_write,
+    .poll = tup_sim_link_end_poll,
+    .get_fd = tup_sim_link_end_get_fd,
+    .set_config = tup_sim_link_end_set_config,
+    .free = tup_sim_link_end_free,
+};
+
+static TupTransport *tup_sim_link_new_end(TupSimLink *link, int index)
+{
+    TupTransport *transport;
+    TupSimLinkEnd *end;
+
+    end = malloc(sizeof(*end));
+    if (end == NULL)
+        return NULL;
+
+    end->link = link;
+    end->index = index;
+
+    transport = tup_transport_new(&tup_sim_link_ops, end);
+    if (transport == NULL)
+        free(end);
+
+    return transport;
+}
+
+/* API */
+
+/**
+ * \ingroup simlink
+ * Fill a TupSimLinkConfig with default values: 115200 bauds, no parity, no
+ * flow control, unlimited RX FIFO and no errors.
+ *
+ * @param[out] config the TupSimLinkConfig to initialize
+ */
+void tup_sim_link_config_init(TupSimLinkConfig *config)
+{
+    memset(config, 0, sizeof(*config));
+    config->baudrate = SMP_SERIAL_BAUDRATE_115200;
+    config->parity = SMP_SERIAL_PARITY_NONE;
+    config->seed = 1;
+}
+
+/**
+ * \ingroup simlink
+ * Create a simulated link. The host end should be given to a TupContext and
+ * the device end to a TupSimDevice. tup_context_set_config() on any end
+ * changes the link config and clears the bitrate set with
+ * tup_sim_link_set_bitrate(). The link is freed with its last end so it shall
+ * not be used once both transports are freed.
+ *
+ * @param[in] config the link config or NULL for default
+ * @param[out] host the host end
+ * @param[out] device the device end
+ *
+ * @return a TupSimLink on success, NULL otherwise.
+ */
+TupSimLink *tup_sim_link_new(const TupSimLinkConfig *config,
+        TupTransport **host, TupTransport **device)
+{
+    TupSimLink *link;
+    int i;
+
+    link = calloc(1, sizeof(*link));
+    if (link == NULL)
+        return NULL;
+
+    if (config != NULL)
+        link->config = *config;
+    else
+        tup_sim_link_config_init(&link->config);
+
+    link->random_state = link->config.seed ? link->config.seed : 1;
+    link->dirs[0].timer_fd = -1;
+    link->dirs[1].timer_fd = -1;
+
+    if (tup_sim_link_configure(link, link->config.baudrate,
+                link->config.bitrate, link->config.parity,
+                link->config.flow_control) < 0) {
+        free(link);
+        return NULL;
+    }
+
+    for (i = 0; i < 2; i++) {
+        link->dirs[i].timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                TFD_NONBLOCK | TFD_CLOEXEC);
+        if (link->dirs[i].timer_fd < 0)
+            goto error;
+    }
+
+    pthread_mutex_init(&link->lock, NULL);
+    link->n_ends = 2;
+
+    *host = tup_sim_link_new_end(link, TUP_SIM_LINK_HOST);
+    if (*host == NULL)
+        goto error;
+
+    *device = tup_sim_link_new_end(link, TUP_SIM_LINK_DEVICE);
+    if (*device == NULL) {
+        /* drop the host end without releasing the link */
+        link->n_ends++;
+        tup_transport_free(*host);
+        goto error;
+    }
+
+    return link;
+
+error:
+    link->n_ends = 0;
+    tup_sim_link_free(link);
+    return NULL;
+}
+
+/**
+ * \ingroup simlink
+ * Set the speed of the link in bits per second, for rates libsmp has no
+ * SmpSerialBaudrate for. Frames already on the wire keep their timing.
+ *
+ * @param[in] link the TupSimLink
+ * @param[in] bitrate the bits per second, 0 to use the configured baudrate
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_sim_link_set_bitrate(TupSimLink *link, unsigned int bitrate)
+{
+    int ret;
+
+    pthread_mutex_lock(&link->lock);
+    ret = tup_sim_link_configure(link, link->config.baudrate, bitrate,
+            link->config.parity, link->config.flow_control);
+    pthread_mutex_unlock(&link->lock);
+
+    return ret;
+}
+
+/**
+ * \ingroup simlink
+ * Set the processing latency of a command. Commands without a latency use
+ * the default one, which is zero unless set.
+ *
+ * @param[in] link the TupSimLink
+ * @param[in] cmd the command or 0 to set the default latency
+ * @param[in] latency the latency
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_sim_link_set_latency(TupSimLink *link, TupMessageType cmd,
+        const TupSimLatency *latency)
+{
+    if ((unsigned int) cmd >= 256 || latency == NULL)
+        return SMP_ERROR_INVALID_PARAM;
+
+    if (latency->max_us < latency->min_us
+            && latency->distribution == TUP_SIM_LATENCY_UNIFORM)
+        return SMP_ERROR_INVALID_PARAM;
+
+    pthread_mutex_lock(&link->lock);
+    link->latencies[cmd] = *latency;
+    pthread_mutex_unlock(&link->lock);
+
+    return 0;
+}
+
+/**
+ * \ingroup simlink
+ * Get the link counters.
+ *
+ * @param[in] link the TupSimLink
+ * @param[out] stats the TupSimLinkStats to fill
+ */
+void tup_sim_link_get_stats(TupSimLink *link, TupSimLinkStats *stats)
+{
+    pthread_mutex_lock(&link->lock);
+    *stats = link->stats;
+    pthread_mutex_unlock(&link->lock);
+}
@@ -0,0 +1,870 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * \defgroup simulator Simulator
+ *
+ * In-memory stand-in for a Tactronik module.
+ *
+ * A TupSimDevice decodes every command of TupMessageType, keeps the state of
+ * effect slots, inputs, bindings, filters and band normalization
+ * coefficients and replies as described in docs/messages.txt. A TupSimulator
+ * serves many devices from a single TupReactor.
+ */
+
+#include "libtupsim.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TUP_SIM_DEFAULT_VERSION "0.0.0-sim"
+#define TUP_SIM_DEFAULT_BUILDINFO "tupsim"
+#define TUP_SIM_DEFAULT_N_SLOTS 16
+#define TUP_SIM_DEFAULT_N_ACTUATORS 2
+
+/* maximum number of ids or values in a single command */
+#define TUP_SIM_MAX_ARGS 64
+
+typedef struct
+{
+    int loaded;
+    uint16_t effect_id;
+    int playing;
+    unsigned int binding_flags;
+    uint32_t parameters[256];
+    int32_t inputs[256];
+} TupSimSlot;
+
+typedef struct
+{
+    bool band_norm_active;
+    float a[5];
+    float b[5];
+} TupSimActuator;
+
+struct TupSimDevice
+{
+    TupSimConfig config;
+    TupContext *ctx;
+    TupMessage *response;
+
+    TupSimSlot *slots;
+    TupSimActuator *actuators;
+    uint16_t sensors[256];
+    uint8_t internal_sensors;
+
+    TupSimDeviceStats stats;
+    uint64_t start_time_us;
+};
+
+struct TupSimulator
+{
+    TupReactor *reactor;
+
+    TupSimDevice **devices;
+    size_t n_devices;
+    size_t n_allocated;
+};
+
+static uint64_t tup_sim_get_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int tup_sim_device_error(TupSimDevice *dev, TupMessage *response,
+        TupMessageType cmd, TupSimError error, uint32_t data)
+{
+    dev->stats.n_errors++;
+    tup_message_init_error_full(response, cmd, error, data);
+    return 0;
+}
+
+static TupSimSlot *tup_sim_device_get_slot(TupSimDevice *dev, uint8_t slot)
+{
+    if (slot >= dev->config.n_slots)
+        return NULL;
+
+    return &dev->slots[slot];
+}
+
+static void tup_sim_slot_reset(TupSimSlot *slot)
+{
+    memset(slot, 0, sizeof(*slot));
+}
+
+static void tup_sim_actuator_reset(TupSimActuator *actuator)
+{
+    memset(actuator, 0, sizeof(*actuator));
+
+    /* identity filter */
+    actuator->a[0] = 1.0f;
+    actuator->b[0] = 1.0f;
+}
+
+/* Command handlers */
+
+static int tup_sim_handle_load(TupSimDevice *dev, TupMessage *command,
+        TupMessage *response)
+{
+    TupSimSlot *slot;
+    uint8_t slot_id;
+    uint16_t effect_id;
+
+    if (tup_message_parse_load(command, &slot_id, &effect_id) < 0)
+        return tup_sim_device_error(dev, response, TUP_MESSAGE_CMD_LOAD,
+                TUP_SIM_ERROR_BAD_MESSAGE, 0);
+
+    slot = tup_sim_device_get_slot(dev, slot_id);
+    if (slot == NULL)
+        return tup_sim_device_error(dev, response, TUP_MESSAGE_CMD_LOAD,
+                TUP_SIM_ERROR_INVALID_SLOT, slot_id);
+
+    tup_sim_slot_reset(slot);
+    slot->loaded = 1;
+    slot->effect_id = effect_id;
+
+    tup_message_init_ack_full(response, TUP_MESSAGE_CMD_LOAD, slot_id);
+    return 0;
+}
+
+static int tup_sim_handle_play_stop(TupSimDevice *dev, TupMessage *command,
+        TupMessage *response, TupMessageType cmd)
+{
+    TupSimSlot *slot;
+    uint8_t slot_id;
+    int ret;
+
+    if (cmd == TUP_MESSAGE_CMD_PLAY)
+        ret = tup_message_parse_play(command, &slot_id);
+    else
+        ret = tup_message_parse_stop(command, &slot_id);
+
+    if (ret < 0)
+        return tup_sim_device_error(dev, response, cmd,
+                TUP_SIM_ERROR_BAD_MESSAGE, 0);
+
+    slot = tup_sim_device_get_slot(dev, slot_id);
+    if (slot == NULL)
+        return tup_sim_device_error(dev, response, cmd,
+                TUP_SIM_ERROR_INVALID_SLOT, slot_id);
+
+    if (!slot->loaded)
+        return tup_sim_device_error(dev, response, cmd,
+                TUP_SIM_ERROR_EMPTY_SLOT, slot_id);
+
+    slot->playing = (cmd == TUP_MESSAGE_CMD_PLAY);
+
+    tup_message_init_ack_full(response, cmd, slot_id);
+    return 0;
+}
+
+static int tup_sim_handle_get_parameter(TupSimDevice *dev,
+        TupMessage *command, TupMessage *response)
+{
+    TupParameterArgs args[TUP_SIM_MAX_ARGS];
+    uint8_t ids[TUP_SIM_MAX_ARGS];
+    TupSimSlot *slot;
+    uint8_t slot_id;
+    int n_ids;
+    int i;
+
+    n_ids = tup_message_parse_get_parameter(command, &slot_id, ids,
+            TUP_SIM_MAX_ARGS);
+    if (n_ids < 0)
+        return tup_sim_device_error(dev, response,
+                TUP_MESSAGE_CMD_GET_PARAMETER, TUP_SIM_ERROR_BAD_MESSAGE, 0);
+
+    slot = tup_sim_device_get_slot(dev, slot_id);
+    if (slot == NULL || !slot->loaded)
+        return tup_sim_device_error(dev, response,
+                TUP_MESSAGE_CMD_GET_PARAMETER,
+                slot == NULL ? TUP_SIM_ERROR_INVALID_SLOT
+                : TUP_SIM_ERROR_EMPTY_SLOT, slot_id);
+
+    for (i = 0; i < n_ids; i++) {
+        args[i].parameter_id = ids[i];
+        args[i].parameter_value = slot->parameters[ids[i]];
+    }
+
+    return tup_message_init_resp_parameter(response, slot_id, args, n_ids);
+}
+
+static int tup_sim_handle_set_parameter(TupSimDevice *dev,
+        TupMessage *command, TupMessage *response)
+{
+    TupParameterArgs args[TUP_SIM_MAX_ARGS];
+    TupSimSlot *slot;
+    uint8_t slot_id;
+    int32_t retval = 0;
+    int n_args;
+    int i;
+
+    n_args = tup_message_parse_set_parameter(command, &slot_id, args,
+            TUP_SIM_MAX_ARGS);
+    if (n_args < 0)
+        return tup_sim_device_error(dev, response,
+                TUP_MESSAGE_CMD_SET_PARAMETER, TUP_SIM_ERROR_BAD_MESSAGE, 0);
+
+    /* errors are reported in RESP_SET_PARAMETER for this command */
+    slot = tup_sim_device_get_slot(dev, slot_id);
+    if (slot == NULL)
+        retval = -TUP_SIM_ERROR_INVALID_SLOT;
+    else if (!slot->loaded)
+        retval = -TUP_SIM_ERROR_EMPTY_SLOT;
+
+    for (i = 0; i < n_args && retval == 0; i++)
+        slot->parameters[args[i].parameter_id] = args[i].parameter_value;
+
+    return tup_message_init_resp_set_parameter(response, slot_id, retval,
+            args, n_args);
+}
+
+static int tup_sim_handle_bind_effect(TupSimDevice *dev, TupMessage *command,
+        TupMessage *response)
+{
+    unsigned int binding_flags;
+    TupSimSlot *slot;
+    uint8_t slot_id;
+
+    if (tup_message_parse_bind_effect(command, &slot_id, &binding_flags) < 0)
+        return tup_sim_device_error(dev, response,
+                TUP_MESSAGE_CMD_BIND_EFFECT, TUP_SIM_ERROR_BAD_MESSAGE, 0);
+
+    slot = tup_sim_device_get_slot(dev, slot_id);
+    if (slot == NULL)
+        return tup_sim_device_error(dev, response,
+                TUP_MESSAGE_CMD_BIND_EFFECT, TUP_SIM_ERROR_INVALID_SLOT,
+                slot_id);
+
+    if (dev->config.n_actuators < 32
+            && (binding_flags >> dev->config.n_actuators) != 0)
+        return tup_sim_device_error(dev, response,
+                TUP_MESSAGE_CMD_BIND_EFFECT, TUP_SIM_ERROR_INVALID_ACTUATOR,
+                slot_id);
+
+    slot->binding_flags = binding_flags;
+
+    tup_message_init_ack_full(response, TUP_MESSAGE_CMD_BIND_EFFECT, slot_id);
+    return 0;
+}
+
+static int tup_sim_handle_get_sensor_value(TupSimDevice *dev,
+        TupMessage *command, TupMessage *response)
+{
+    TupSensorValueArgs args[TUP_SIM_MAX_ARGS];
+    uint8_t ids[TUP_SIM_MAX_ARGS];
+    int n_ids;
+    int i;
+
+    n_ids = tup_message_parse_get_sensor_value(command, ids,
+            TUP_SIM_MAX_ARGS);
+    if (n_ids < 0)
+        return tup_sim_device_error(dev, response,
+                TUP_MESSAGE_CMD_GET_SENSOR_VALUE, TUP_SIM_ERROR_BAD_MESSAGE,
+                0);
+
+    for (i = 0; i < n_ids; i++) {
+        args[i].sensor_id = ids[i];
+        args[i].sensor_value = dev->sensors[ids[i]];
+    }
+
+    return tup_message_init_resp_sensor(response, args, n_ids);
+}
+
+static int tup_sim_handle_set_sensor_value(TupSimDevice *dev,
+        TupMessage *command, TupMessage *response)
+{
+    TupSensorValueArgs args[TUP_SIM_MAX_ARGS];
+    int n_args;
+    int i;
+
+    n_args = tup_message_parse_set_sensor_value(command, args,
+            TUP_SIM_MAX_ARGS);
+    if (n_args < 0)
+        return tup_sim_device_error(dev, response,
+                TUP_MESSAGE_CMD_SET_SENSOR_VALUE, TUP_SIM_ERROR_BAD_MESSAGE,
+                0);
+
+    for (i = 0; i < n_args; i++)
+        dev->sensors[args[i].sensor_id] = args[i].sensor_value;
+
+    tup_message_init_ack_full(response, TUP_MESSAGE_CMD_SET_SENSOR_VALUE, 0);
+    return 0;
+}
+
+static int tup_sim_handle_activate_internal_sensors(TupSimDevice *dev,
+        TupMessage *command, TupMessage *response)
+{
+    uint8_t state;
+
+    if (tup_message_parse_activate_internal_sensors(command, &state) < 0)
+        return tup_sim_device_error(dev, response,
+                TUP_MESSAGE_CMD_ACTIVATE_INTERNAL_SENSORS,
+                TUP_SIM_ERROR_BAD_MESSAGE, 0);
+
+    dev->internal_sensors = state;
+
+    tup_message_init_ack_full(response,
+            TUP_MESSAGE_CMD_ACTIVATE_INTERNAL_SENSORS, state);
+    return 0;
+}
+
+static int tup_sim_handle_get_input_value(TupSimDevice *dev,
+        TupMessage *command, TupMessage *response)
+{
+    TupInputValueArgs args[TUP_SIM_MAX_ARGS];
+    uint8_t ids[TUP_SIM_MAX_ARGS];
+    TupSimSlot *slot;
+    uint8_t slot_id;
+    int n_ids;
+    int i;
+
+    n_ids = tup_message_parse_get_input_value(command, &slot_id, ids,
+            TUP_SIM_MAX_ARGS);
+    if (n_ids < 0)
+        return tup_sim_device_error(dev, response,
+                TUP_MESSAGE_CMD_GET_INPUT_VALUE, TUP_SIM_ERROR_BAD_MESSAGE, 0);
+
+    slot = tup_sim_device_get_slot(dev, slot_id);
+    if (slot == NULL || !slot->loaded)
+        return tup_sim_device_error(dev, response,
+                TUP_MESSAGE_CMD_GET_INPUT_VALUE,
+                slot == NULL ? TUP_SIM_ERROR_INVALID_SLOT
+                : TUP_SIM_ERROR_EMPTY_SLOT, slot_id);
+
+    for (i = 0; i < n_ids; i++) {
+        args[i].input_id = ids[i];
+        args[i].input_value = slot->inputs[ids[i]];
+    }
+
+    return tup_message_init_resp_input(response, slot_id, args, n_ids);
+}
+
+static int tup_sim_handle_set_input_value(TupSimDevice *dev,
+        TupMessage *command, TupMessage *response)
+{
+    TupInputValueArgs args[TUP_SIM_MAX_ARGS];
+    TupSimSlot *slot;
+    uint8_t slot_id;
+    int n_args;
+    int i;
+
+    n_args = tup_message_parse_set_input_value(command, &slot_id, args,
+            TUP_SIM_MAX_ARGS);
+    if (n_args < 0)
+        return tup_sim_device_error(dev, response,
+                TUP_MESSAGE_CMD_SET_INPUT_VALUE, TUP_SIM_ERROR_BAD_MESSAGE, 0);
+
+    slot = tup_sim_device_get_slot(dev, slot_id);
+    if (slot == NULL || !slot->loaded)
+        return tup_sim_device_error(dev, response,
+                TUP_MESSAGE_CMD_SET_INPUT_VALUE,
+                slot == NULL ? TUP_SIM_ERROR_INVALID_SLOT
+                : TUP_SIM_ERROR_EMPTY_SLOT, slot_id);
+
+    for (i = 0; i < n_args; i++)
+        slot->inputs[args[i].input_id] = args[i].input_value;
+
+    tup_message_init_ack_full(response, TUP_MESSAGE_CMD_SET_INPUT_VALUE,
+            slot_id);
+    return 0;
+}
+
+static TupSimActuator *tup_sim_device_get_actuator(TupSimDevice *dev,
+        uint8_t actuator_id)
+{
+    if (actuator_id >= dev->config.n_actuators)
+        return NULL;
+
+    return &dev->actuators[actuator_id];
+}
+
+static int tup_sim_handle_filter(TupSimDevice *dev, TupMessage *command,
+        TupMessage *response, TupMessageType cmd)
+{
+    TupSimActuator *actuator;
+    TupFilterId filter;
+    uint8_t actuator_id;
+    bool active = false;
+    int ret;
+
+    if (cmd == TUP_MESSAGE_CMD_FILTER_SET_ACTIVE)
+        ret = tup_message_parse_filter_set_active(command, &filter,
+                &actuator_id, &active);
+    else
+        ret = tup_message_parse_filter_get_active(command, &filter,
+                &actuator_id);
+
+    if (ret < 0)
+        return tup_sim_device_error(dev, response, cmd,
+                TUP_SIM_ERROR_BAD_MESSAGE, 0);
+
+    if (filter != TUP_FILTER_ID_BAND_NORM)
+        return tup_sim_device_error(dev, response, cmd,
+                TUP_SIM_ERROR_INVALID_FILTER, filter);
+
+    actuator = tup_sim_device_get_actuator(dev, actuator_id);
+    if (actuator == NULL)
+        return tup_sim_device_error(dev, response, cmd,
+                TUP_SIM_ERROR_INVALID_ACTUATOR, actuator_id);
+
+    if (cmd == TUP_MESSAGE_CMD_FILTER_SET_ACTIVE)
+        actuator->band_norm_active = active;
+
+    return tup_message_init_resp_filter_active(response, filter, actuator_id,
+            actuator->band_norm_active);
+}
+
+static int tup_sim_handle_band_norm_coeffs(TupSimDevice *dev,
+        TupMessage *command, TupMessage *response, TupMessageType cmd)
+{
+    TupSimActuator *actuator;
+    uint8_t actuator_id;
+    float a[5];
+    float b[5];
+    int ret;
+
+    if (cmd == TUP_MESSAGE_CMD_CONFIG_BAND_NORM_SET_COEFFS)
+        ret = tup_message_parse_config_band_norm_set_coeffs(command,
+                &actuator_id, a, b);
+    else
+        ret = tup_message_parse_config_band_norm_get_coeffs(command,
+                &actuator_id);
+
+    if (ret < 0)
+        return tup_sim_device_error(dev, response, cmd,
+                TUP_SIM_ERROR_BAD_MESSAGE, 0);
+
+    actuator = tup_sim_device_get_actuator(dev, actuator_id);
+    if (actuator == NULL)
+        return tup_sim_device_error(dev, response, cmd,
+                TUP_SIM_ERROR_INVALID_ACTUATOR, actuator_id);
+
+    if (cmd == TUP_MESSAGE_CMD_CONFIG_BAND_NORM_SET_COEFFS) {
+        memcpy(actuator->a, a, sizeof(a));
+        memcpy(actuator->b, b, sizeof(b));
+    }
+
+    return tup_message_init_resp_band_norm_coeffs(response, actuator_id,
+            actuator->a, actuator->b);
+}
+
+static int tup_sim_handle_debug_get_system_status(TupSimDevice *dev,
+        TupMessage *response)
+{
+    TupDebugSystemStatus status = { 0, 0, 0 };
+    TupDebugTaskStatus tasks[] = {
+        { 1, "uart", TUP_DEBUG_TASK_STATE_RUNNING, 2, 0, 512 },
+        { 2, "idle", TUP_DEBUG_TASK_STATE_READY, 0, 0, 128 },
+    };
+
+    status.rtime = tup_sim_get_time_us() - dev->start_time_us;
+    status.mem_total = 64 * 1024;
+    status.mem_used = dev->config.n_slots * sizeof(TupSimSlot) / 64;
+
+    return tup_message_init_resp_debug_system_status(response, &status, tasks,
+            sizeof(tasks) / sizeof(tasks[0]));
+}
+
+static void tup_sim_device_on_message(TupContext *ctx, TupMessage *message,
+        void *userdata)
+{
+    TupSimDevice *dev = userdata;
+
+    if (tup_sim_device_handle_message(dev, message, dev->response) < 0)
+        return;
+
+    tup_context_send(ctx, dev->response);
+}
+
+static void tup_sim_device_on_error(TupContext *ctx, SmpError error,
+        void *userdata)
+{
+    TupSimDevice *dev = userdata;
+
+    dev->stats.n_bad_frames++;
+}
+
+/* API */
+
+/**
+ * \ingroup simulator
+ * Fill a TupSimConfig with default values.
+ *
+ * @param[out] config the TupSimConfig to initialize
+ */
+void tup_sim_config_init(TupSimConfig *config)
+{
+    config->version = TUP_SIM_DEFAULT_VERSION;
+    config->buildinfo = TUP_SIM_DEFAULT_BUILDINFO;
+    config->n_slots = TUP_SIM_DEFAULT_N_SLOTS;
+    config->n_actuators = TUP_SIM_DEFAULT_N_ACTUATORS;
+}
+
+/**
+ * \ingroup simulator
+ * Create a new simulated device answering on the given transport.
+ *
+ * @param[in] transport the device end of the link. The device takes ownership
+ *                      of it.
+ * @param[in] config the device configuration or NULL for default. Strings
+ *                   shall stay valid while the device exists.
+ *
+ * @return a TupSimDevice on success, NULL otherwise.
+ */
+TupSimDevice *tup_sim_device_new(TupTransport *transport,
+        const TupSimConfig *config)
+{
+    TupCallbacks cbs = {
+        .new_message_cb = tup_sim_device_on_message,
+        .error_cb = tup_sim_device_on_error,
+    };
+    TupSimDevice *dev;
+    unsigned int i;
+
+    dev = calloc(1, sizeof(*dev));
+    if (dev == NULL)
+        return NULL;
+
+    if (config != NULL)
+        dev->config = *config;
+    else
+        tup_sim_config_init(&dev->config);
+
+    dev->slots = calloc(dev->config.n_slots, sizeof(TupSimSlot));
+    dev->actuators = calloc(dev->config.n_actuators, sizeof(TupSimActuator));
+    dev->response = tup_message_new();
+    if ((dev->slots == NULL && dev->config.n_slots > 0)
+            || (dev->actuators == NULL && dev->config.n_actuators > 0)
+            || dev->response == NULL)
+        goto error;
+
+    for (i = 0; i < dev->config.n_actuators; i++)
+        tup_sim_actuator_reset(&dev->actuators[i]);
+
+    dev->ctx = tup_context_new_with_transport(transport, &cbs, dev);
+    if (dev->ctx == NULL)
+        goto error;
+
+    dev->start_time_us = tup_sim_get_time_us();
+
+    return dev;
+
+error:
+    if (dev->response != NULL)
+        tup_message_free(dev->response);
+
+    free(dev->actuators);
+    free(dev->slots);
+    free(dev);
+    return NULL;
+}
+
+/**
+ * \ingroup simulator
+ * Free a simulated device. It shall have been removed from its simulator.
+ *
+ * @param[in] dev the TupSimDevice
+ */
+void tup_sim_device_free(TupSimDevice *dev)
+{
+    tup_context_free(dev->ctx);
+    tup_message_free(dev->response);
+    free(dev->actuators);
+    free(dev->slots);
+    free(dev);
+}
+
+/**
+ * \ingroup simulator
+ * Open the transport of the device.
+ *
+ * @param[in] dev the TupSimDevice
+ * @param[in] device the device to open, depending on the transport
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_sim_device_open(TupSimDevice *dev, const char *device)
+{
+    return tup_context_open(dev->ctx, device);
+}
+
+/**
+ * \ingroup simulator
+ * Get the TupContext used by the device, for instance to process it from a
+ * custom loop.
+ *
+ * @param[in] dev the TupSimDevice
+ *
+ * @return the TupContext.
+ */
+TupContext *tup_sim_device_get_context(TupSimDevice *dev)
+{
+    return dev->ctx;
+}
+
+/**
+ * \ingroup simulator
+ * Execute a command on the device and build the response, without going
+ * through the transport.
+ *
+ * @param[in] dev the TupSimDevice
+ * @param[in] command the received command
+ * @param[out] response the message to fill with the response
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_sim_device_handle_message(TupSimDevice *dev, TupMessage *command,
+        TupMessage *response)
+{
+    TupMessageType cmd = TUP_MESSAGE_TYPE(command);
+
+    dev->stats.n_commands++;
+    tup_message_clear(response);
+
+    switch (cmd) {
+        case TUP_MESSAGE_CMD_LOAD:
+            return tup_sim_handle_load(dev, command, response);
+        case TUP_MESSAGE_CMD_PLAY:
+        case TUP_MESSAGE_CMD_STOP:
+            return tup_sim_handle_play_stop(dev, command, response, cmd);
+        case TUP_MESSAGE_CMD_GET_VERSION:
+            tup_message_init_resp_version(response, dev->config.version);
+            return 0;
+        case TUP_MESSAGE_CMD_GET_PARAMETER:
+            return tup_sim_handle_get_parameter(dev, command, response);
+        case TUP_MESSAGE_CMD_SET_PARAMETER:
+            return tup_sim_handle_set_parameter(dev, command, response);
+        case TUP_MESSAGE_CMD_BIND_EFFECT:
+            return tup_sim_handle_bind_effect(dev, command, response);
+        case TUP_MESSAGE_CMD_GET_SENSOR_VALUE:
+            return tup_sim_handle_get_sensor_value(dev, command, response);
+        case TUP_MESSAGE_CMD_SET_SENSOR_VALUE:
+            return tup_sim_handle_set_sensor_value(dev, command, response);
+        case TUP_MESSAGE_CMD_GET_BUILDINFO:
+            tup_message_init_resp_buildinfo(response, dev->config.buildinfo);
+            return 0;
+        case TUP_MESSAGE_CMD_ACTIVATE_INTERNAL_SENSORS:
+            return tup_sim_handle_activate_internal_sensors(dev, command,
+                    response);
+        case TUP_MESSAGE_CMD_GET_INPUT_VALUE:
+            return tup_sim_handle_get_input_value(dev, command, response);
+        case TUP_MESSAGE_CMD_SET_INPUT_VALUE:
+            return tup_sim_handle_set_input_value(dev, command, response);
+        case TUP_MESSAGE_CMD_FILTER_GET_ACTIVE:
+        case TUP_MESSAGE_CMD_FILTER_SET_ACTIVE:
+            return tup_sim_handle_filter(dev, command, response, cmd);
+        case TUP_MESSAGE_CMD_CONFIG_WRITE:
+            dev->stats.n_config_writes++;
+            tup_message_init_ack(response, cmd);
+            return 0;
+        case TUP_MESSAGE_CMD_CONFIG_BAND_NORM_GET_COEFFS:
+        case TUP_MESSAGE_CMD_CONFIG_BAND_NORM_SET_COEFFS:
+            return tup_sim_handle_band_norm_coeffs(dev, command, response,
+                    cmd);
+        case TUP_MESSAGE_CMD_DEBUG_GET_SYSTEM_STATUS:
+            return tup_sim_handle_debug_get_system_status(dev, response);
+        default:
+            return tup_sim_device_error(dev, response, cmd,
+                    TUP_SIM_ERROR_UNKNOWN_COMMAND, 0);
+    }
+}
+
+/**
+ * \ingroup simulator
+ * Get the device counters.
+ *
+ * @param[in] dev the TupSimDevice
+ * @param[out] stats the TupSimDeviceStats to fill
+ */
+void tup_sim_device_get_stats(TupSimDevice *dev, TupSimDeviceStats *stats)
+{
+    *stats = dev->stats;
+}
+
+/**
+ * \ingroup simulator
+ * Create a new simulator, serving devices from a single thread.
+ *
+ * @return a TupSimulator on success, NULL otherwise.
+ */
+TupSimulator *tup_simulator_new(void)
+{
+    TupSimulator *sim;
+
+    sim = calloc(1, sizeof(*sim));
+    if (sim == NULL)
+        return NULL;
+
+    sim->reactor = tup_reactor_new();
+    if (sim->reactor == NULL) {
+        free(sim);
+        return NULL;
+    }
+
+    return sim;
+}
+
+/**
+ * \ingroup simulator
+ * Free a simulator and all the devices it serves.
+ *
+ * @param[in] sim the TupSimulator
+ */
+void tup_simulator_free(TupSimulator *sim)
+{
+    size_t i;
+
+    for (i = 0; i < sim->n_devices; i++) {
+        tup_reactor_remove_context(sim->reactor, sim->devices[i]->ctx);
+        tup_sim_device_free(sim->devices[i]);
+    }
+
+    tup_reactor_free(sim->reactor);
+    free(sim->devices);
+    free(sim);
+}
+
+/**
+ * \ingroup simulator
+ * Serve an opened device. The simulator takes ownership of the device. Its
+ * transport shall provide a file descriptor.
+ *
+ * @param[in] sim the TupSimulator
+ * @param[in] dev an opened TupSimDevice
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_simulator_add_device(TupSimulator *sim, TupSimDevice *dev)
+{
+    TupSimDevice **devices;
+    size_t n_allocated;
+    int ret;
+
+    if (sim->n_devices == sim->n_allocated) {
+        n_allocated = sim->n_allocated ? 2 * sim->n_allocated : 16;
+        devices = realloc(sim->devices, n_allocated * sizeof(*devices));
+        if (devices == NULL)
+            return SMP_ERROR_NO_MEM;
+
+        sim->devices = devices;
+        sim->n_allocated = n_allocated;
+    }
+
+    ret = tup_reactor_add_context(sim->reactor, dev->ctx);
+    if (ret < 0)
+        return ret;
+
+    sim->devices[sim->n_devices++] = dev;
+    return 0;
+}
+
+/**
+ * \ingroup simulator
+ * Stop serving a device. The caller gets back the ownership of the device.
+ *
+ * @param[in] sim the TupSimulator
+ * @param[in] dev the TupSimDevice
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_simulator_remove_device(TupSimulator *sim, TupSimDevice *dev)
+{
+    size_t i;
+
+    for (i = 0; i < sim->n_devices; i++) {
+        if (sim->devices[i] == dev)
+            break;
+    }
+
+    if (i == sim->n_devices)
+        return SMP_ERROR_NOT_FOUND;
+
+    /* the reactor may already have dropped it on hangup */
+    tup_reactor_remove_context(sim->reactor, dev->ctx);
+
+    sim->devices[i] = sim->devices[--sim->n_devices];
+    return 0;
+}
+
+/**
+ * \ingroup simulator
+ * Get the number of devices served by the simulator.
+ *
+ * @param[in] sim the TupSimulator
+ *
+ * @return the number of devices.
+ */
+size_t tup_simulator_get_n_devices(TupSimulator *sim)
+{
+    return sim->n_devices;
+}
+
+/**
+ * \ingroup simulator
+ * Get the reactor used by the simulator, for instance to add timers.
+ *
+ * @param[in] sim the TupSimulator
+ *
+ * @return the TupReactor.
+ */
+TupReactor *tup_simulator_get_reactor(TupSimulator *sim)
+{
+    return sim->reactor;
+}
+
+/**
+ * \ingroup simulator
+ * Wait for commands and answer them, see tup_reactor_iterate().
+ *
+ * @param[in] sim the TupSimulator
+ * @param[in] timeout_ms a timeout in milliseconds. A negative value means no
+ *                       timeout
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_simulator_iterate(TupSimulator *sim, int timeout_ms)
+{
+    return tup_reactor_iterate(sim->reactor, timeout_ms);
+}
+
+/**
+ * \ingroup simulator
+ * Serve devices until tup_simulator_quit() is called.
+ *
+ * @param[in] sim the TupSimulator
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_simulator_run(TupSimulator *sim)
+{
+    return tup_reactor_run(sim->reactor);
+}
+
+/**
+ * \ingroup simulator
+ * Make tup_simulator_run() return. This can be called from any thread.
+ *
+ * @param[in] sim the TupSimulator
+ */
+void tup_simulator_quit(TupSimulator *sim)
+{
+    tup_reactor_quit(sim->reactor);
+}
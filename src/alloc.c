@@ -0,0 +1,147 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * \defgroup alloc Allocator
+ *
+ * Memory allocation hooks.
+ *
+ * Every allocation libtup makes goes through the functions set with
+ * tup_set_allocator(), the C library ones being used by default. This
+ * includes the storage of contexts created with tup_context_new() and of
+ * messages created with tup_message_new(): libtup allocates it and has
+ * libsmp build its objects in place with its static API, so libsmp itself
+ * never allocates.
+ */
+
+#ifndef TUP_ENABLE_STATIC_API
+#define TUP_ENABLE_STATIC_API
+#endif
+
+#include "libtup-private.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void *tup_default_malloc(size_t size, void *userdata)
+{
+    return malloc(size);
+}
+
+static void *tup_default_realloc(void *ptr, size_t size, void *userdata)
+{
+    return realloc(ptr, size);
+}
+
+static void tup_default_free(void *ptr, void *userdata)
+{
+    free(ptr);
+}
+
+static TupMallocFunc tup_malloc_func = tup_default_malloc;
+static TupReallocFunc tup_realloc_func = tup_default_realloc;
+static TupFreeFunc tup_free_func = tup_default_free;
+static void *tup_alloc_userdata;
+
+void *tup_malloc(size_t size)
+{
+    return tup_malloc_func(size, tup_alloc_userdata);
+}
+
+void *tup_calloc(size_t n, size_t size)
+{
+    void *ptr;
+
+    if (size != 0 && n > SIZE_MAX / size)
+        return NULL;
+
+    ptr = tup_malloc_func(n * size, tup_alloc_userdata);
+    if (ptr != NULL)
+        memset(ptr, 0, n * size);
+
+    return ptr;
+}
+
+void *tup_realloc(void *ptr, size_t size)
+{
+    return tup_realloc_func(ptr, size, tup_alloc_userdata);
+}
+
+void tup_free(void *ptr)
+{
+    if (ptr != NULL)
+        tup_free_func(ptr, tup_alloc_userdata);
+}
+
+/* alignment shall be a power of two. The block is released with
+ * tup_free_aligned() */
+void *tup_malloc_aligned(size_t alignment, size_t size)
+{
+    uintptr_t addr;
+    void *ptr;
+
+    /* room to align and to store the pointer to free */
+    ptr = tup_malloc(size + alignment - 1 + sizeof(void *));
+    if (ptr == NULL)
+        return NULL;
+
+    addr = ((uintptr_t) ptr + sizeof(void *) + alignment - 1)
+        & ~(uintptr_t) (alignment - 1);
+    ((void **) addr)[-1] = ptr;
+
+    return (void *) addr;
+}
+
+void tup_free_aligned(void *ptr)
+{
+    if (ptr != NULL)
+        tup_free(((void **) ptr)[-1]);
+}
+
+/**
+ * \ingroup alloc
+ * Set the functions used to allocate memory. This shall be called before
+ * any other libtup function, as memory allocated with an allocator is freed
+ * with the same one. Passing NULL for all functions restores the C library
+ * allocator.
+ *
+ * @param[in] malloc_fn the function allocating memory
+ * @param[in] realloc_fn the function resizing memory
+ * @param[in] free_fn the function releasing memory
+ * @param[in] userdata userdata to pass to the functions
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_set_allocator(TupMallocFunc malloc_fn, TupReallocFunc realloc_fn,
+        TupFreeFunc free_fn, void *userdata)
+{
+    if (malloc_fn == NULL && realloc_fn == NULL && free_fn == NULL) {
+        tup_malloc_func = tup_default_malloc;
+        tup_realloc_func = tup_default_realloc;
+        tup_free_func = tup_default_free;
+        tup_alloc_userdata = NULL;
+        return 0;
+    }
+
+    if (malloc_fn == NULL || realloc_fn == NULL || free_fn == NULL)
+        return SMP_ERROR_INVALID_PARAM;
+
+    tup_malloc_func = malloc_fn;
+    tup_realloc_func = realloc_fn;
+    tup_free_func = free_fn;
+    tup_alloc_userdata = userdata;
+    return 0;
+}
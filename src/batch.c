@@ -0,0 +1,517 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * \defgroup batch Batch
+ *
+ * Coalescing of several frames into a single write.
+ *
+ * Frames are serialized back to back into a buffer owned by the context
+ * which is then written with a single system call. This is used by
+ * tup_context_send_batch() and, when write combining is enabled, by
+ * tup_context_send().
+ *
+ * Only a TupTransport can write the buffer at once. libsmp has no way to
+ * write raw data, so without a transport the frames are decoded back and
+ * sent one by one through the SmpContext.
+ */
+
+#ifndef TUP_ENABLE_STATIC_API
+#define TUP_ENABLE_STATIC_API
+#endif
+
+#include "libtup-private.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TUP_WRITE_BUFFER_DEFAULT_SIZE 4096
+
+#if TUP_ENABLE_BATCH
+/* SmpContext only sends messages: decode the frames back and send them one
+ * by one */
+static int tup_context_send_frames(TupContext *ctx, const uint8_t *data,
+        size_t size)
+{
+    TupWriteBuffer *wbuf;
+    size_t frame_size;
+    int ret;
+
+    ret = tup_write_buffer_ensure(ctx);
+    if (ret < 0)
+        return ret;
+
+    wbuf = ctx->wbuf;
+
+    if (wbuf->record_msg == NULL) {
+        wbuf->record_msg = tup_message_new();
+        if (wbuf->record_msg == NULL)
+            return SMP_ERROR_NO_MEM;
+    }
+
+    if (wbuf->smp_buf == NULL) {
+        wbuf->smp_buf = tup_malloc(TUP_FRAME_MAX_MESSAGE_SIZE);
+        if (wbuf->smp_buf == NULL)
+            return SMP_ERROR_NO_MEM;
+    }
+
+    while (size > 0) {
+        frame_size = tup_frame_get_size(data, size);
+        if (frame_size == 0)
+            return SMP_ERROR_BAD_MESSAGE;
+
+        tup_message_clear(wbuf->record_msg);
+        ret = tup_frame_decode(wbuf->record_msg, data, frame_size,
+                wbuf->smp_buf, TUP_FRAME_MAX_MESSAGE_SIZE);
+        if (ret < 0)
+            return (ret == SMP_ERROR_OVERFLOW) ? SMP_ERROR_TOO_BIG : ret;
+
+        ret = smp_context_send_message(ctx->smp_ctx, wbuf->record_msg);
+        if (ret < 0)
+            return ret;
+
+        data += frame_size;
+        size -= frame_size;
+    }
+
+    return 0;
+}
+#endif
+
+/* write encoded frames to the device, with a single write if the context
+ * has a transport. libsmp has no way to write raw data though, so they are
+ * sent one by one through SmpContext otherwise. In threaded mode, they are
+ * queued to the I/O thread at once */
+int tup_context_write_raw(TupContext *ctx, const uint8_t *data, size_t size)
+{
+    int ret;
+
+#ifdef HAVE_IO_THREAD
+    /* the I/O thread owns the device */
+    if (ctx->io_thread != NULL)
+        return tup_io_thread_push_frames(ctx->io_thread, data, size);
+#endif
+
+#if TUP_ENABLE_TRANSPORT
+    if (ctx->transport != NULL) {
+        ret = tup_transport_write(ctx->transport, data, size);
+    } else
+#endif
+    {
+#if TUP_ENABLE_BATCH
+        ret = tup_context_send_frames(ctx, data, size);
+#else
+        ret = SMP_ERROR_NOT_SUPPORTED;
+#endif
+    }
+
+#ifdef HAVE_CAPTURE
+    if (ret == 0 && ctx->capture != NULL)
+        tup_capture_record_frames(ctx->capture, TUP_CAPTURE_TX, data, size);
+#endif
+
+    return ret;
+}
+
+#if TUP_ENABLE_BATCH
+int tup_write_buffer_ensure(TupContext *ctx)
+{
+    TupWriteBuffer *wbuf;
+
+    if (ctx->wbuf != NULL)
+        return 0;
+
+    wbuf = tup_calloc(1, sizeof(*wbuf));
+    if (wbuf == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    wbuf->data = tup_malloc(TUP_WRITE_BUFFER_DEFAULT_SIZE);
+    if (wbuf->data == NULL) {
+        tup_free(wbuf);
+        return SMP_ERROR_NO_MEM;
+    }
+
+    wbuf->size = TUP_WRITE_BUFFER_DEFAULT_SIZE;
+    ctx->wbuf = wbuf;
+    return 0;
+}
+
+void tup_write_buffer_free(TupWriteBuffer *wbuf)
+{
+#if TUP_ENABLE_PEEPHOLE
+    if (wbuf->peephole != NULL)
+        tup_peephole_free(wbuf->peephole);
+#endif
+
+    if (wbuf->record_msg != NULL)
+        tup_message_free(wbuf->record_msg);
+
+    tup_free(wbuf->smp_buf);
+    tup_free(wbuf->data);
+    tup_free(wbuf);
+}
+
+/* write the serialized frames */
+static int tup_write_buffer_write(TupContext *ctx)
+{
+    TupWriteBuffer *wbuf = ctx->wbuf;
+    int ret;
+
+    if (wbuf->len == 0)
+        return 0;
+
+    ret = tup_context_write_raw(ctx, wbuf->data, wbuf->len);
+
+    /* frames are dropped on error, as SmpContext does */
+    wbuf->len = 0;
+    return ret;
+}
+
+/* account the frames of [start, end) once they have been written. They are
+ * decoded back as the peephole pass may have merged the messages sent, and
+ * unescaped in place as the buffer content isn't needed anymore */
+static void tup_write_buffer_record(TupContext *ctx, size_t start,
+        size_t end)
+{
+    TupWriteBuffer *wbuf = ctx->wbuf;
+    uint8_t *frame;
+    size_t size;
+    int record = 0;
+
+#if TUP_ENABLE_STATS
+    record |= ctx->stats != NULL;
+#endif
+#if TUP_ENABLE_SHADOW
+    record |= ctx->shadow != NULL;
+#endif
+    if (!record)
+        return;
+
+    if (wbuf->record_msg == NULL) {
+        wbuf->record_msg = tup_message_new();
+        if (wbuf->record_msg == NULL)
+            return;
+    }
+
+    while (start < end) {
+        frame = wbuf->data + start;
+
+        /* frames are back to back */
+        size = tup_frame_get_size(frame, end - start);
+        if (size == 0)
+            break;
+
+        start += size;
+
+        tup_message_clear(wbuf->record_msg);
+        if (tup_frame_decode(wbuf->record_msg, frame, size, frame, size) < 0)
+            continue;
+
+#if TUP_ENABLE_STATS
+        if (ctx->stats != NULL)
+            tup_stats_record_tx(ctx, wbuf->record_msg);
+#endif
+
+#if TUP_ENABLE_SHADOW
+        if (ctx->shadow != NULL)
+            tup_shadow_record_tx(ctx, wbuf->record_msg);
+#endif
+    }
+}
+
+/* serialize msg after the pending frames, flushing or growing the buffer if
+ * needed */
+int tup_write_buffer_append(TupContext *ctx, TupMessage *msg)
+{
+    TupWriteBuffer *wbuf = ctx->wbuf;
+    uint8_t *data;
+    int ret;
+
+    for (;;) {
+        ret = tup_frame_encode(msg, wbuf->data + wbuf->len,
+                wbuf->size - wbuf->len);
+        if (ret != SMP_ERROR_OVERFLOW)
+            break;
+
+        if (wbuf->len > 0 && !wbuf->hold) {
+            ret = tup_write_buffer_write(ctx);
+            if (ret < 0)
+                return ret;
+
+            continue;
+        }
+
+        /* a single frame doesn't fit in an empty buffer, or the batch being
+         * built doesn't */
+        data = tup_realloc(wbuf->data, 2 * wbuf->size);
+        if (data == NULL)
+            return SMP_ERROR_NO_MEM;
+
+        wbuf->data = data;
+        wbuf->size *= 2;
+    }
+
+    if (ret < 0)
+        return ret;
+
+    wbuf->len += ret;
+
+    /* recorded by tup_context_send_batch() once written */
+    if (wbuf->hold)
+        return 0;
+
+#if TUP_ENABLE_STATS
+    if (ctx->stats != NULL)
+        tup_stats_record_tx(ctx, msg);
+#endif
+
+#if TUP_ENABLE_SHADOW
+    if (ctx->shadow != NULL)
+        tup_shadow_record_tx(ctx, msg);
+#endif
+
+    return 0;
+}
+
+/* copy an already encoded frame after the pending ones */
+int tup_write_buffer_append_frame(TupContext *ctx, const uint8_t *frame,
+        size_t size)
+{
+    TupWriteBuffer *wbuf = ctx->wbuf;
+    uint8_t *data;
+    int ret;
+
+    if (wbuf->size - wbuf->len < size) {
+        ret = tup_write_buffer_write(ctx);
+        if (ret < 0)
+            return ret;
+    }
+
+    if (wbuf->size < size) {
+        data = tup_realloc(wbuf->data, size);
+        if (data == NULL)
+            return SMP_ERROR_NO_MEM;
+
+        wbuf->data = data;
+        wbuf->size = size;
+    }
+
+    memcpy(wbuf->data + wbuf->len, frame, size);
+    wbuf->len += size;
+    return 0;
+}
+
+int tup_write_buffer_send(TupContext *ctx, TupMessage *msg, int optimize)
+{
+    int ret;
+
+    ret = tup_write_buffer_ensure(ctx);
+    if (ret < 0)
+        return ret;
+
+#if TUP_ENABLE_PEEPHOLE
+    if (ctx->wbuf->peephole != NULL && ctx->wbuf->window > 0 && optimize) {
+        ret = tup_peephole_push(ctx, msg);
+    } else if (ctx->wbuf->peephole != NULL) {
+        /* frames written right away can't be optimized, and requests wait
+         * for their own response: they go as is after the held message */
+        ret = tup_peephole_flush(ctx);
+        if (ret == 0)
+            ret = tup_write_buffer_append(ctx, msg);
+    } else
+#endif
+    {
+        ret = tup_write_buffer_append(ctx, msg);
+    }
+
+    if (ret < 0)
+        return ret;
+
+    if (ctx->wbuf->len >= ctx->wbuf->window)
+        return tup_context_flush(ctx);
+
+    return 0;
+}
+
+/* API */
+
+/**
+ * \ingroup batch
+ * Send several messages with a single write, see the batch group for
+ * contexts without a TupTransport. In threaded mode, messages are queued to
+ * the I/O thread at once. Messages are optimized first if
+ * tup_context_enable_peephole() was called.
+ * If a message can't be serialized, or the I/O thread queue can't hold the
+ * whole batch, nothing of the batch is sent. The messages are only accounted
+ * in stats and in the shadow state once written.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] msgs an array of TupMessage
+ * @param[in] n the number of messages in msgs
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_send_batch(TupContext *ctx, TupMessage **msgs, size_t n)
+{
+    TupWriteBuffer *wbuf;
+    size_t start;
+    size_t end;
+    size_t i;
+    int ret = 0;
+
+#ifdef HAVE_IO_THREAD
+    if (ctx->io_thread != NULL)
+        return tup_io_thread_push_batch(ctx->io_thread, msgs, n);
+#endif
+
+#if TUP_ENABLE_COALESCING
+    /* pending updates were sent before */
+    if (ctx->coalescer != NULL) {
+        ret = tup_coalescer_drain(ctx, 1);
+        if (ret < 0)
+            return ret;
+    }
+#endif
+
+    ret = tup_write_buffer_ensure(ctx);
+    if (ret < 0)
+        return ret;
+
+    wbuf = ctx->wbuf;
+
+#if TUP_ENABLE_PEEPHOLE
+    /* a message held back before the batch isn't part of it */
+    if (wbuf->peephole != NULL) {
+        ret = tup_peephole_flush(ctx);
+        if (ret < 0)
+            goto error;
+    }
+#endif
+
+    start = wbuf->len;
+    wbuf->hold = 1;
+
+    for (i = 0; i < n && ret == 0; i++) {
+#if TUP_ENABLE_PEEPHOLE
+        if (wbuf->peephole != NULL)
+            ret = tup_peephole_push(ctx, msgs[i]);
+        else
+#endif
+            ret = tup_write_buffer_append(ctx, msgs[i]);
+    }
+
+#if TUP_ENABLE_PEEPHOLE
+    if (ret == 0 && wbuf->peephole != NULL)
+        ret = tup_peephole_flush(ctx);
+#endif
+
+    wbuf->hold = 0;
+
+    if (ret < 0) {
+        /* drop the frames of the batch, combined ones are kept */
+        wbuf->len = start;
+#if TUP_ENABLE_PEEPHOLE
+        if (wbuf->peephole != NULL)
+            tup_peephole_reset(wbuf->peephole);
+#endif
+
+        goto error;
+    }
+
+    end = wbuf->len;
+    ret = tup_write_buffer_write(ctx);
+    if (ret < 0)
+        goto error;
+
+    tup_write_buffer_record(ctx, start, end);
+    return 0;
+
+error:
+#if TUP_ENABLE_STATS
+    if (ctx->stats != NULL)
+        tup_stats_record_error(ctx, ret);
+#endif
+
+    return ret;
+}
+
+/**
+ * \ingroup batch
+ * Enable write combining. When enabled, tup_context_send() appends frames to
+ * a buffer which is only written once it holds at least window bytes, when
+ * tup_context_flush() is called or before waiting for incoming data with
+ * tup_context_process_fd() or tup_context_wait_and_process().
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] window the number of bytes to accumulate, 0 to disable write
+ *                   combining
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_set_write_combining(TupContext *ctx, size_t window)
+{
+    int ret;
+
+    if (window == 0) {
+        if (ctx->wbuf == NULL)
+            return 0;
+
+        ret = tup_context_flush(ctx);
+        ctx->wbuf->window = 0;
+        return ret;
+    }
+
+    ret = tup_write_buffer_ensure(ctx);
+    if (ret < 0)
+        return ret;
+
+    ctx->wbuf->window = window;
+    return 0;
+}
+#endif
+
+/**
+ * \ingroup batch
+ * Write all frames accumulated by write combining.
+ *
+ * @param[in] ctx the TupContext
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_flush(TupContext *ctx)
+{
+#if TUP_ENABLE_BATCH
+#if TUP_ENABLE_PEEPHOLE
+    int ret;
+#endif
+
+    if (ctx->wbuf == NULL)
+        return 0;
+
+#if TUP_ENABLE_PEEPHOLE
+    if (ctx->wbuf->peephole != NULL) {
+        ret = tup_peephole_flush(ctx);
+        if (ret < 0)
+            return ret;
+    }
+#endif
+
+    return tup_write_buffer_write(ctx);
+#else
+    /* nothing is ever combined */
+    return 0;
+#endif
+}
@@ -0,0 +1,255 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * \defgroup capture Capture
+ *
+ * Recording of the traffic of a TupContext (Linux only).
+ *
+ * Once tup_context_start_capture() is called, every frame written to or
+ * received from the device is appended to a capture file, as it is on the
+ * wire, with the time it was written or received and its direction.
+ *
+ * A capture file starts with a 24 bytes header:
+ *  - magic: TUP_CAPTURE_MAGIC, 8 bytes
+ *  - version: TUP_CAPTURE_VERSION, uint32
+ *  - header size: uint32
+ *  - start time: wall clock time of the capture start in nanoseconds since
+ *    the epoch, uint64
+ *
+ * then holds a record per frame:
+ *  - time: nanoseconds since the capture start, uint64
+ *  - size: size of the frame, uint32
+ *  - direction: a TupCaptureDirection, uint8
+ *  - 3 reserved bytes
+ *  - the frame, padded with zeros to a multiple of 8 bytes
+ *
+ * Integers are little endian and records are 8 bytes aligned, so a mapped
+ * capture can be walked in place. Records are only ever appended: a capture
+ * cut short by a crash is valid up to its last complete record.
+ *
+ * Received frames are captured once decoded, frames failing to decode are
+ * not captured.
+ */
+
+#ifndef TUP_ENABLE_STATIC_API
+#define TUP_ENABLE_STATIC_API
+#endif
+
+#include "libtup-private.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TUP_CAPTURE_BUFFER_SIZE (64 * 1024)
+
+/* a frame with every byte of the biggest message escaped */
+#define TUP_CAPTURE_FRAME_SIZE (2 * TUP_FRAME_MAX_MESSAGE_SIZE + 4)
+
+struct TupCapture
+{
+    FILE *file;
+    uint64_t origin_ns;
+
+    /* first write error, reported on stop */
+    int error;
+};
+
+static uint64_t tup_capture_get_time_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void tup_capture_write_le(uint8_t *buf, uint64_t value, size_t size)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++)
+        buf[i] = (value >> (8 * i)) & 0xff;
+}
+
+/* append a record, it can be called from the I/O thread */
+static void tup_capture_write_record(TupCapture *capture,
+        TupCaptureDirection direction, const uint8_t *frame, size_t size)
+{
+    static const uint8_t padding[TUP_CAPTURE_ALIGNMENT];
+    uint8_t header[TUP_CAPTURE_RECORD_HEADER_SIZE];
+    size_t pad;
+
+    if (size > UINT32_MAX)
+        return;
+
+    tup_capture_write_le(header + 8, size, 4);
+    header[12] = direction;
+    header[13] = 0;
+    header[14] = 0;
+    header[15] = 0;
+
+    pad = (TUP_CAPTURE_ALIGNMENT - size % TUP_CAPTURE_ALIGNMENT)
+        % TUP_CAPTURE_ALIGNMENT;
+
+    /* keep the record in one piece, and records in time order */
+    flockfile(capture->file);
+    tup_capture_write_le(header,
+            tup_capture_get_time_ns(CLOCK_MONOTONIC) - capture->origin_ns, 8);
+
+    if (fwrite(header, sizeof(header), 1, capture->file) != 1
+            || fwrite(frame, 1, size, capture->file) != size
+            || fwrite(padding, 1, pad, capture->file) != pad) {
+        if (capture->error == 0)
+            capture->error = SMP_ERROR_IO;
+    }
+    funlockfile(capture->file);
+}
+
+/* record written data, which may hold several frames */
+void tup_capture_record_frames(TupCapture *capture,
+        TupCaptureDirection direction, const uint8_t *data, size_t size)
+{
+    size_t i;
+
+    /* the end byte is always escaped in a frame */
+    while (size > 0) {
+        for (i = 0; i < size && data[i] != TUP_FRAME_END_BYTE; i++)
+            ;
+
+        if (i < size)
+            i++;
+
+        tup_capture_write_record(capture, direction, data, i);
+        data += i;
+        size -= i;
+    }
+}
+
+/* record a message as framed on the wire */
+void tup_capture_record_message(TupCapture *capture,
+        TupCaptureDirection direction, TupMessage *msg)
+{
+    uint8_t frame[TUP_CAPTURE_FRAME_SIZE];
+    int ret;
+
+    ret = tup_frame_encode(msg, frame, sizeof(frame));
+    if (ret < 0) {
+        if (capture->error == 0)
+            capture->error = ret;
+
+        return;
+    }
+
+    tup_capture_write_record(capture, direction, frame, ret);
+}
+
+/* flush and close the file, return the first error */
+int tup_capture_free(TupCapture *capture)
+{
+    int ret = capture->error;
+
+    if (fclose(capture->file) != 0 && ret == 0)
+        ret = SMP_ERROR_IO;
+
+    tup_free(capture);
+    return ret;
+}
+
+/**
+ * \ingroup capture
+ * Start capturing the frames sent and received by a context to a file. The
+ * file is truncated if it exists. Captures can't be started or stopped in
+ * threaded mode, but a capture started before keeps going once the I/O
+ * thread is started.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] path the path of the capture file
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_start_capture(TupContext *ctx, const char *path)
+{
+    uint8_t header[TUP_CAPTURE_HEADER_SIZE];
+    TupCapture *capture;
+
+    if (ctx->capture != NULL)
+        return SMP_ERROR_BUSY;
+
+#ifdef HAVE_IO_THREAD
+    if (ctx->io_thread != NULL)
+        return SMP_ERROR_BUSY;
+#endif
+
+    capture = tup_calloc(1, sizeof(*capture));
+    if (capture == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    capture->file = fopen(path, "wb");
+    if (capture->file == NULL) {
+        tup_free(capture);
+        return SMP_ERROR_IO;
+    }
+
+    setvbuf(capture->file, NULL, _IOFBF, TUP_CAPTURE_BUFFER_SIZE);
+
+    memcpy(header, TUP_CAPTURE_MAGIC, 8);
+    tup_capture_write_le(header + 8, TUP_CAPTURE_VERSION, 4);
+    tup_capture_write_le(header + 12, sizeof(header), 4);
+    tup_capture_write_le(header + 16,
+            tup_capture_get_time_ns(CLOCK_REALTIME), 8);
+
+    if (fwrite(header, sizeof(header), 1, capture->file) != 1) {
+        fclose(capture->file);
+        tup_free(capture);
+        return SMP_ERROR_IO;
+    }
+
+    capture->origin_ns = tup_capture_get_time_ns(CLOCK_MONOTONIC);
+    ctx->capture = capture;
+    return 0;
+}
+
+/**
+ * \ingroup capture
+ * Stop the capture and close its file. It is also stopped when the context
+ * is freed.
+ *
+ * @param[in] ctx the TupContext
+ *
+ * @return 0 on success, SMP_ERROR_IO if some frames could not be written or
+ * another SmpError otherwise.
+ */
+int tup_context_stop_capture(TupContext *ctx)
+{
+    int ret;
+
+    if (ctx->capture == NULL)
+        return 0;
+
+#ifdef HAVE_IO_THREAD
+    if (ctx->io_thread != NULL)
+        return SMP_ERROR_BUSY;
+#endif
+
+    /* combined frames belong to the capture */
+    tup_context_flush(ctx);
+
+    ret = tup_capture_free(ctx->capture);
+    ctx->capture = NULL;
+    return ret;
+}
@@ -0,0 +1,391 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * \defgroup coalesce Coalescing
+ *
+ * Last-writer-wins sending of value updates.
+ *
+ * A control signal streamed with SET_INPUT_VALUE or SET_PARAMETER commands
+ * faster than the serial line can carry them would pile up stale values in
+ * the device queue. Once coalescing is enabled, such commands setting a
+ * single value are kept in a queue keyed by (effect slot id, input id) or
+ * (effect id, parameter id) and a newer value for the same key replaces the
+ * pending one in place. Updates are only written when the line is idle, so
+ * each one leaves at most a frame time after being sent.
+ *
+ * The line occupation is computed from the size of the written frames and
+ * the baudrate set with tup_context_set_config(), 115200 bauds by default.
+ * Pending updates are written by tup_context_send(),
+ * tup_context_process_fd() and tup_context_wait_and_process(). As each
+ * update is answered, the response of the previous one is enough to write
+ * the next. Any other message first writes all the pending updates, so
+ * commands are never reordered. Commands sent with tup_context_send_request()
+ * are not coalesced either, as each of them waits for its own response.
+ */
+
+#ifndef TUP_ENABLE_STATIC_API
+#define TUP_ENABLE_STATIC_API
+#endif
+
+#include "libtup-private.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if TUP_ENABLE_COALESCING
+/* a merged message fits with every byte escaped */
+#define TUP_COALESCER_FRAME_SIZE 512
+
+#define TUP_COALESCER_DEFAULT_SIZE 8
+
+typedef struct
+{
+    TupMessageType type;
+    uint8_t id;                 /* effect or effect slot id */
+    uint8_t sub_id;             /* parameter or input id */
+    SmpValue value;
+} TupCoalescedUpdate;
+
+struct TupCoalescer
+{
+    /* pending updates, oldest first */
+    TupCoalescedUpdate *updates;
+    size_t n_updates;
+    size_t size;
+
+    uint64_t byte_ns;
+
+    /* time at which the line is done with the written frames */
+    uint64_t idle_ns;
+
+    /* message and frame of the update being written */
+    TupMessage *msg;
+    uint8_t frame[TUP_COALESCER_FRAME_SIZE];
+};
+
+static TupCoalescedUpdate *tup_coalescer_find(TupCoalescer *coalescer,
+        TupMessageType type, uint8_t id, uint8_t sub_id)
+{
+    size_t i;
+
+    for (i = 0; i < coalescer->n_updates; i++) {
+        TupCoalescedUpdate *update = &coalescer->updates[i];
+
+        if (update->type == type && update->id == id
+                && update->sub_id == sub_id)
+            return update;
+    }
+
+    return NULL;
+}
+
+static TupCoalescedUpdate *tup_coalescer_append(TupCoalescer *coalescer)
+{
+    if (coalescer->n_updates == coalescer->size) {
+        TupCoalescedUpdate *updates;
+
+        updates = tup_realloc(coalescer->updates,
+                2 * coalescer->size * sizeof(TupCoalescedUpdate));
+        if (updates == NULL)
+            return NULL;
+
+        coalescer->updates = updates;
+        coalescer->size *= 2;
+    }
+
+    return &coalescer->updates[coalescer->n_updates++];
+}
+
+void tup_coalescer_free(TupCoalescer *coalescer)
+{
+    tup_message_free(coalescer->msg);
+    tup_free(coalescer->updates);
+    tup_free(coalescer);
+}
+
+void tup_coalescer_set_config(TupCoalescer *coalescer,
+        SmpSerialBaudrate baudrate, SmpSerialParity parity)
+{
+    unsigned int bps = tup_serial_baudrate_get_bps(baudrate);
+
+    coalescer->byte_ns = tup_serial_get_byte_time_ns(bps > 0 ? bps : 115200,
+            parity);
+}
+
+/* queue msg if it is an update, write all pending updates otherwise.
+ * Returns 1 if msg has been queued, 0 if it shall be sent as usual */
+int tup_coalescer_send(TupContext *ctx, TupMessage *msg)
+{
+    TupCoalescer *coalescer = ctx->coalescer;
+    TupCoalescedUpdate *update;
+    SmpValue value;
+    uint8_t id;
+    uint8_t sub_id;
+    int ret;
+
+    if (!tup_peephole_get_update_key(msg, &id, &sub_id)) {
+        ret = tup_coalescer_drain(ctx, 1);
+        return (ret < 0) ? ret : 0;
+    }
+
+    ret = smp_message_get_value(msg, 2, &value);
+    if (ret < 0)
+        return ret;
+
+    update = tup_coalescer_find(coalescer, TUP_MESSAGE_TYPE(msg), id, sub_id);
+    if (update == NULL) {
+        update = tup_coalescer_append(coalescer);
+        if (update == NULL)
+            return SMP_ERROR_NO_MEM;
+
+        update->type = TUP_MESSAGE_TYPE(msg);
+        update->id = id;
+        update->sub_id = sub_id;
+    }
+
+    update->value = value;
+
+    ret = tup_coalescer_drain(ctx, 0);
+    return (ret < 0) ? ret : 1;
+}
+
+/* check whether msg sets a value which a pending update is about to change */
+int tup_coalescer_is_pending(TupContext *ctx, TupMessage *msg)
+{
+    TupCoalescer *coalescer = ctx->coalescer;
+    TupMessageType type = TUP_MESSAGE_TYPE(msg);
+    uint8_t sub_id;
+    uint8_t id;
+    int n_args;
+    int i;
+
+    if (coalescer->n_updates == 0 || smp_message_get_uint8(msg, 0, &id) < 0)
+        return 0;
+
+    /* id, then (sub id, value) pairs */
+    n_args = smp_message_n_args(msg);
+    for (i = 1; i + 1 < n_args; i += 2) {
+        if (smp_message_get_uint8(msg, i, &sub_id) == 0
+                && tup_coalescer_find(coalescer, type, id, sub_id) != NULL)
+            return 1;
+    }
+
+    return 0;
+}
+
+/* build the message of the oldest update, merging later updates of the same
+ * effect or slot if the peephole optimizer is enabled */
+static int tup_coalescer_take(TupContext *ctx)
+{
+    TupCoalescer *coalescer = ctx->coalescer;
+    TupCoalescedUpdate *first = &coalescer->updates[0];
+    TupMessage *msg = coalescer->msg;
+    int merge;
+    size_t n = 0;
+    size_t i;
+    int ret;
+
+    merge = ctx->wbuf != NULL && ctx->wbuf->peephole != NULL;
+
+    tup_message_clear(msg);
+    smp_message_set_id(msg, first->type);
+
+    ret = smp_message_set_uint8(msg, 0, first->id);
+    if (ret < 0)
+        return ret;
+
+    for (i = 0; i < coalescer->n_updates; i++) {
+        TupCoalescedUpdate *update = &coalescer->updates[i];
+        int index = smp_message_n_args(msg);
+
+        if (i == 0 || (merge && update->type == first->type
+                    && update->id == first->id
+                    && TUP_PEEPHOLE_N_VALUES(index)
+                        < TUP_PEEPHOLE_MAX_VALUES)) {
+            ret = smp_message_set_uint8(msg, index, update->sub_id);
+            if (ret < 0)
+                return ret;
+
+            ret = smp_message_set_value(msg, index + 1, &update->value);
+            if (ret < 0)
+                return ret;
+
+            continue;
+        }
+
+        /* keep the others in order */
+        coalescer->updates[n++] = *update;
+    }
+
+    coalescer->n_updates = n;
+    return 0;
+}
+
+/* write the oldest pending update once the line is idle, or all of them if
+ * all is set */
+int tup_coalescer_drain(TupContext *ctx, int all)
+{
+    TupCoalescer *coalescer = ctx->coalescer;
+    uint64_t now_ns;
+    int len;
+    int ret;
+
+    while (coalescer->n_updates > 0) {
+        now_ns = tup_get_time_ns();
+        if (!all && coalescer->idle_ns > now_ns)
+            break;
+
+        /* don't overtake combined frames */
+        ret = tup_context_flush(ctx);
+        if (ret < 0)
+            return ret;
+
+        ret = tup_coalescer_take(ctx);
+        if (ret < 0)
+            return ret;
+
+        len = tup_frame_encode(coalescer->msg, coalescer->frame,
+                sizeof(coalescer->frame));
+        if (len < 0)
+            return len;
+
+        ret = tup_context_write_raw(ctx, coalescer->frame, len);
+        if (ret < 0)
+            return ret;
+
+#if TUP_ENABLE_STATS
+        if (ctx->stats != NULL)
+            tup_stats_record_tx(ctx, coalescer->msg);
+#endif
+
+#if TUP_ENABLE_SHADOW
+        if (ctx->shadow != NULL)
+            tup_shadow_record_tx(ctx, coalescer->msg);
+#endif
+
+        if (coalescer->idle_ns < now_ns)
+            coalescer->idle_ns = now_ns;
+
+        coalescer->idle_ns += len * coalescer->byte_ns;
+    }
+
+    return 0;
+}
+
+/* get the time in milliseconds until the next pending update can be
+ * written, -1 if there is none */
+int tup_coalescer_get_timeout(TupContext *ctx)
+{
+    TupCoalescer *coalescer = ctx->coalescer;
+    uint64_t now_ns;
+
+    if (coalescer->n_updates == 0)
+        return -1;
+
+    now_ns = tup_get_time_ns();
+    if (coalescer->idle_ns <= now_ns)
+        return 0;
+
+    return (int) ((coalescer->idle_ns - now_ns + 999999) / 1000000);
+}
+
+/* API */
+
+/**
+ * \ingroup coalesce
+ * Enable or disable coalescing of value updates. Disabling writes the
+ * pending updates. Coalescing needs a monotonic clock and is not available
+ * in threaded mode.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] enable true to enable coalescing, false to disable it
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_enable_coalescing(TupContext *ctx, bool enable)
+{
+#ifdef HAVE_CLOCK_GETTIME
+    TupCoalescer *coalescer;
+#endif
+    int ret;
+
+    if (!enable) {
+        if (ctx->coalescer == NULL)
+            return 0;
+
+        ret = tup_coalescer_drain(ctx, 1);
+        tup_coalescer_free(ctx->coalescer);
+        ctx->coalescer = NULL;
+        return ret;
+    }
+
+#ifndef HAVE_CLOCK_GETTIME
+    return SMP_ERROR_NOT_SUPPORTED;
+#else
+    if (ctx->coalescer != NULL)
+        return 0;
+
+#ifdef HAVE_IO_THREAD
+    /* updates are written from the I/O thread */
+    if (ctx->io_thread != NULL)
+        return SMP_ERROR_NOT_SUPPORTED;
+#endif
+
+    coalescer = tup_calloc(1, sizeof(*coalescer));
+    if (coalescer == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    coalescer->updates = tup_malloc(TUP_COALESCER_DEFAULT_SIZE
+            * sizeof(TupCoalescedUpdate));
+    if (coalescer->updates == NULL)
+        goto updates_failed;
+
+    coalescer->msg = tup_message_new();
+    if (coalescer->msg == NULL)
+        goto msg_failed;
+
+    coalescer->size = TUP_COALESCER_DEFAULT_SIZE;
+    tup_coalescer_set_config(coalescer, SMP_SERIAL_BAUDRATE_115200,
+            SMP_SERIAL_PARITY_NONE);
+
+    ctx->coalescer = coalescer;
+    return 0;
+
+msg_failed:
+    tup_free(coalescer->updates);
+updates_failed:
+    tup_free(coalescer);
+    return SMP_ERROR_NO_MEM;
+#endif
+}
+
+/**
+ * \ingroup coalesce
+ * Get the number of updates waiting for the line to be idle.
+ *
+ * @param[in] ctx the TupContext
+ *
+ * @return the number of pending updates.
+ */
+size_t tup_context_get_n_pending_updates(TupContext *ctx)
+{
+    if (ctx->coalescer == NULL)
+        return 0;
+
+    return ctx->coalescer->n_updates;
+}
+#endif
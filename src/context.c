@@ -23,17 +23,195 @@
 #define TUP_ENABLE_STATIC_API
 #endif
 
-#include "libtup.h"
+#include "libtup-private.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-/* API */
+/* ensure TupStaticContext is big enough to hold a TupContext */
+typedef char tup_static_context_size_check[
+    (sizeof(TupStaticContext) >= sizeof(struct TupContext)) ? 1 : -1];
+
+/* a context created by tup_context_new() and the storage of its SmpContext,
+ * in one block allocated by libtup */
+typedef struct
+{
+    struct TupContext ctx;
+
+    SmpStaticContext sctx;
+    SmpStaticSerialProtocolDecoder sdec;
+    uint8_t serial_rx_buf[TUP_CONTEXT_SERIAL_RX_BUFSIZE];
+    uint8_t serial_tx_buf[TUP_CONTEXT_SERIAL_TX_BUFSIZE];
+    uint8_t msg_tx_buf[TUP_CONTEXT_MSG_TX_BUFSIZE];
+    SmpValue msg_rx_values[TUP_MESSAGE_MAX_VALUES];
+} TupContextStorage;
+
+void tup_context_dispatch_message(TupContext *ctx, TupMessage *message)
+{
+#ifdef HAVE_CAPTURE
+    if (ctx->capture != NULL)
+        tup_capture_record_message(ctx->capture, TUP_CAPTURE_RX, message);
+#endif
+
+#if TUP_ENABLE_STATS
+    if (ctx->stats != NULL)
+        tup_stats_record_rx(ctx, message);
+#endif
+
+#if TUP_ENABLE_SHADOW
+    if (ctx->shadow != NULL)
+        tup_shadow_handle_message(ctx, message);
+#endif
+
+    tup_context_dispatch_local_message(ctx, message);
+}
+
+/* dispatch a message without accounting it as received */
+void tup_context_dispatch_local_message(TupContext *ctx, TupMessage *message)
+{
+    if (ctx->requests != NULL
+            && tup_request_table_handle_message(ctx, message))
+        return;
+
+#if TUP_ENABLE_HANDLERS
+    if (ctx->handlers != NULL
+            && tup_handler_table_handle_message(ctx, message))
+        return;
+#endif
+
+    if (ctx->cbs.new_message_cb != NULL)
+        ctx->cbs.new_message_cb(ctx, message, ctx->userdata);
+}
+
+void tup_context_dispatch_error(TupContext *ctx, SmpError error)
+{
+#if TUP_ENABLE_STATS
+    if (ctx->stats != NULL)
+        tup_stats_record_error(ctx, error);
+#endif
+
+    if (ctx->cbs.error_cb != NULL)
+        ctx->cbs.error_cb(ctx, error, ctx->userdata);
+}
+
+static void tup_context_on_new_message(SmpContext *smp_ctx,
+        SmpMessage *message, void *userdata)
+{
+    tup_context_dispatch_message(userdata, message);
+}
+
+static void tup_context_on_error(SmpContext *smp_ctx, SmpError error,
+        void *userdata)
+{
+    tup_context_dispatch_error(userdata, error);
+}
+
+static void tup_context_init(TupContext *ctx, const TupCallbacks *cbs,
+        void *userdata)
+{
+    memset(ctx, 0, sizeof(*ctx));
+
+    if (cbs != NULL)
+        ctx->cbs = *cbs;
+
+    ctx->userdata = userdata;
+}
+
+/* read and dispatch pending incoming data, whatever the I/O mode */
+int tup_context_process_input(TupContext *ctx)
+{
+#if TUP_ENABLE_TRANSPORT
+    uint8_t buf[256];
+    int ret;
 
-typedef void (*SmpNewMessageCb)(SmpContext* , SmpMessage *, void *);
+    if (ctx->transport != NULL) {
+        do {
+            ret = tup_transport_read(ctx->transport, buf, sizeof(buf));
+            if (ret < 0)
+                return ret;
+
+            tup_frame_decoder_feed(ctx->decoder, ctx, buf, ret);
+        } while (ret == sizeof(buf));
+
+        return 0;
+    }
+#endif
+
+    return smp_context_process_fd(ctx->smp_ctx);
+}
+
+/* send a message, letting the coalescer and the peephole pass merge it with
+ * other messages if optimize is set. Otherwise pending updates and the
+ * message held by the peephole pass are written first, and msg is written
+ * as is */
+int tup_context_send_message(TupContext *ctx, TupMessage *msg, int optimize)
+{
+    int ret = 0;
+
+#ifdef HAVE_IO_THREAD
+    if (ctx->io_thread != NULL)
+        return tup_io_thread_push(ctx->io_thread, msg);
+#endif
+
+#if TUP_ENABLE_SHADOW
+    /* answered from the known state */
+    if (ctx->shadow != NULL && tup_shadow_send(ctx, msg))
+        return 0;
+#endif
+
+#if TUP_ENABLE_COALESCING
+    /* updates may replace a pending one, other messages go after them */
+    if (ctx->coalescer != NULL && optimize) {
+        ret = tup_coalescer_send(ctx, msg);
+    } else if (ctx->coalescer != NULL) {
+        ret = tup_coalescer_drain(ctx, 1);
+        ret = (ret < 0) ? ret : 0;
+    }
+#endif
+
+    if (ret > 0) {
+        ret = 0;
+    } else if (ret < 0) {
+        /* error recorded below */
+#if TUP_ENABLE_BATCH
+    } else if (ctx->transport != NULL
+            || (ctx->wbuf != NULL && ctx->wbuf->window > 0)) {
+        /* transports have no framing of their own */
+        ret = tup_write_buffer_send(ctx, msg, optimize);
+#endif
+    } else {
+        ret = smp_context_send_message(ctx->smp_ctx, msg);
+#if TUP_ENABLE_STATS
+        if (ret == 0 && ctx->stats != NULL)
+            tup_stats_record_tx(ctx, msg);
+#endif
+
+#if TUP_ENABLE_SHADOW
+        if (ret == 0 && ctx->shadow != NULL)
+            tup_shadow_record_tx(ctx, msg);
+#endif
+
+#ifdef HAVE_CAPTURE
+        if (ret == 0 && ctx->capture != NULL)
+            tup_capture_record_message(ctx->capture, TUP_CAPTURE_TX, msg);
+#endif
+    }
+
+#if TUP_ENABLE_STATS
+    if (ret < 0 && ctx->stats != NULL)
+        tup_stats_record_error(ctx, ret);
+#endif
+
+    return ret;
+}
+
+
+/* API */
 
 /**
  * \ingroup context
- * Create an initialize a new TupContext
+ * Create an initialize a new TupContext. The context and the buffers of its
+ * SmpContext are allocated with the allocator set with tup_set_allocator().
  *
  * @param[in] cbs pointer to a callback structure
  * @param[in] userdata userdata to pass in callbacks
@@ -42,44 +220,184 @@ typedef void (*SmpNewMessageCb)(SmpContext* , SmpMessage *, void *);
  */
 TupContext *tup_context_new(TupCallbacks *cbs, void *userdata)
 {
-    SmpEventCallbacks scbs = {
-        .new_message_cb = (SmpNewMessageCb) cbs->new_message_cb,
-        .error_cb = cbs->error_cb,
-    };
+    SmpEventCallbacks scbs;
+    TupContextStorage *storage;
+    TupContext *ctx;
+
+    storage = tup_malloc(sizeof(*storage));
+    if (storage == NULL)
+        return NULL;
+
+    ctx = &storage->ctx;
+    tup_context_init(ctx, cbs, userdata);
+    tup_context_init_smp_callbacks(&scbs);
+
+    /* libsmp allocates nothing once given its buffers */
+    ctx->smp_ctx = smp_context_new_from_static(&storage->sctx,
+            sizeof(storage->sctx), &scbs, ctx,
+            &storage->sdec, sizeof(storage->sdec),
+            storage->serial_rx_buf, sizeof(storage->serial_rx_buf),
+            storage->serial_tx_buf, sizeof(storage->serial_tx_buf),
+            storage->msg_tx_buf, sizeof(storage->msg_tx_buf),
+            storage->msg_rx_values, TUP_MESSAGE_MAX_VALUES);
+    if (ctx->smp_ctx == NULL) {
+        tup_free(storage);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+#if TUP_ENABLE_TRANSPORT
+/**
+ * \ingroup context
+ * Create an initialize a new TupContext using a transport instead of a
+ * serial device opened by libsmp. The context takes ownership of the
+ * transport.
+ *
+ * @param[in] transport the TupTransport to use
+ * @param[in] cbs pointer to a callback structure
+ * @param[in] userdata userdata to pass in callbacks
+ *
+ * @return a TupContext on success, NULL otherwise.
+ */
+TupContext *tup_context_new_with_transport(TupTransport *transport,
+        TupCallbacks *cbs, void *userdata)
+{
+    TupContext *ctx;
+
+    if (transport == NULL)
+        return NULL;
+
+    ctx = tup_malloc(sizeof(*ctx));
+    if (ctx == NULL)
+        return NULL;
+
+    tup_context_init(ctx, cbs, userdata);
+
+    ctx->decoder = tup_frame_decoder_new();
+    if (ctx->decoder == NULL) {
+        tup_free(ctx);
+        return NULL;
+    }
+
+    ctx->transport = transport;
+    return ctx;
+}
+#endif
 
-    return smp_context_new(&scbs, userdata);
+/**
+ * \ingroup context
+ * Fill a SmpEventCallbacks structure with the callbacks that a SmpContext
+ * used by a TupContext shall use. The SmpContext userdata shall be the
+ * TupContext storage. This is used by TUP_DEFINE_STATIC_CONTEXT().
+ *
+ * @param[out] scbs the SmpEventCallbacks to fill
+ */
+void tup_context_init_smp_callbacks(SmpEventCallbacks *scbs)
+{
+    scbs->new_message_cb = tup_context_on_new_message;
+    scbs->error_cb = tup_context_on_error;
 }
 
 /**
  * \ingroup context
  * Create a new TupContext object from a static storage.
- * @warning for now the TupContext is only a typedef of SmpContext so the
- * TupCallbacks should be converted and set to the SmpContext. This function
- * takes the callbacks only for future compatibility purpose.
- * Also you can pass NULL and 0 for TupStaticContext and struct_size for now.
+ * The SmpContext shall have been created with the callbacks returned by
+ * tup_context_init_smp_callbacks() and sctx as userdata. You should use
+ * TUP_DEFINE_STATIC_CONTEXT() which takes care of it.
  *
- * @param[in] sctx a TupStaticContext (not used)
- * @param[in] struct_size the size of sctx (not used)
+ * @param[in] sctx a TupStaticContext
+ * @param[in] struct_size the size of sctx
  * @param[in] smp_ctx a SmpContext to use
+ * @param[in] cbs pointer to a callback structure
+ * @param[in] userdata userdata to pass in callbacks
  *
- * @return a SmpContext or NULL on error.
+ * @return a TupContext or NULL on error.
  */
 TupContext *tup_context_new_from_static(TupStaticContext *sctx,
         size_t struct_size, SmpContext *smp_ctx, const TupCallbacks *cbs,
         void *userdata)
 {
-    return smp_ctx;
+    TupContext *ctx = (TupContext *) sctx;
+
+    if (sctx == NULL || smp_ctx == NULL || struct_size < sizeof(TupContext))
+        return NULL;
+
+    tup_context_init(ctx, cbs, userdata);
+    ctx->smp_ctx = smp_ctx;
+    ctx->is_static = 1;
+
+    return ctx;
 }
 
 /**
  * \ingroup context
- * Free a TupContext.
+ * Free a TupContext. In threaded mode, it shall not be called from a
+ * callback, which runs in the I/O thread, and does nothing if it is.
  *
  * @param[in] ctx the TupContext to free
  */
 void tup_context_free(TupContext *ctx)
 {
-    smp_context_free(ctx);
+#ifdef HAVE_IO_THREAD
+    /* the I/O thread can't be stopped from itself */
+    if (tup_context_stop_io_thread(ctx) < 0)
+        return;
+#endif
+
+    if (ctx->requests != NULL) {
+        tup_request_table_cancel_all(ctx, TUP_REQUEST_STATUS_CANCELLED);
+        tup_request_table_free(ctx->requests);
+    }
+
+#if TUP_ENABLE_COALESCING
+    if (ctx->coalescer != NULL) {
+        tup_coalescer_drain(ctx, 1);
+        tup_coalescer_free(ctx->coalescer);
+    }
+#endif
+
+#if TUP_ENABLE_SHADOW
+    if (ctx->shadow != NULL)
+        tup_shadow_free(ctx->shadow);
+#endif
+
+#if TUP_ENABLE_BATCH
+    if (ctx->wbuf != NULL) {
+        tup_context_flush(ctx);
+        tup_write_buffer_free(ctx->wbuf);
+    }
+#endif
+
+#if TUP_ENABLE_STATS
+    if (ctx->stats != NULL)
+        tup_stats_free(ctx->stats);
+#endif
+
+#if TUP_ENABLE_HANDLERS
+    if (ctx->handlers != NULL)
+        tup_handler_table_free(ctx->handlers);
+#endif
+
+#ifdef HAVE_CAPTURE
+    if (ctx->capture != NULL)
+        tup_capture_free(ctx->capture);
+#endif
+
+#if TUP_ENABLE_TRANSPORT
+    if (ctx->transport != NULL) {
+        tup_transport_close(ctx->transport);
+        tup_transport_free(ctx->transport);
+        tup_frame_decoder_free(ctx->decoder);
+    } else
+#endif
+    {
+        smp_context_free(ctx->smp_ctx);
+    }
+
+    if (!ctx->is_static)
+        tup_free(ctx);
 }
 
 /**
@@ -93,18 +411,54 @@ void tup_context_free(TupContext *ctx)
  */
 int tup_context_open(TupContext *ctx, const char *device)
 {
-    return smp_context_open(ctx, device);
+#if TUP_ENABLE_TRANSPORT
+    if (ctx->transport != NULL) {
+        tup_frame_decoder_reset(ctx->decoder);
+        return tup_transport_open(ctx->transport, device);
+    }
+#endif
+
+    return smp_context_open(ctx->smp_ctx, device);
 }
 
 /**
  * \ingroup context
- * Close the context, releasing the attached serial device.
+ * Close the context, releasing the attached serial device. In threaded mode,
+ * it can't be called from a callback, which runs in the I/O thread.
  *
  * @param[in] ctx the TupContext
+ *
+ * @return 0 on success, SMP_ERROR_BUSY if called from the I/O thread.
  */
-void tup_context_close(TupContext *ctx)
+int tup_context_close(TupContext *ctx)
 {
-    return smp_context_close(ctx);
+#ifdef HAVE_IO_THREAD
+    int ret;
+
+    ret = tup_context_stop_io_thread(ctx);
+    if (ret < 0)
+        return ret;
+#endif
+
+    if (ctx->requests != NULL)
+        tup_request_table_cancel_all(ctx, TUP_REQUEST_STATUS_CANCELLED);
+
+#if TUP_ENABLE_COALESCING
+    if (ctx->coalescer != NULL)
+        tup_coalescer_drain(ctx, 1);
+#endif
+
+    tup_context_flush(ctx);
+
+#if TUP_ENABLE_TRANSPORT
+    if (ctx->transport != NULL) {
+        tup_transport_close(ctx->transport);
+        return 0;
+    }
+#endif
+
+    smp_context_close(ctx->smp_ctx);
+    return 0;
 }
 
 /**
@@ -121,7 +475,25 @@ void tup_context_close(TupContext *ctx)
 int tup_context_set_config(TupContext *ctx, SmpSerialBaudrate baudrate,
         SmpSerialParity parity, int flow_control)
 {
-    return smp_context_set_serial_config(ctx, baudrate, parity, flow_control);
+    int ret;
+
+#if TUP_ENABLE_TRANSPORT
+    if (ctx->transport != NULL) {
+        ret = tup_transport_set_config(ctx->transport, baudrate, parity,
+                flow_control);
+    } else
+#endif
+    {
+        ret = smp_context_set_serial_config(ctx->smp_ctx, baudrate, parity,
+                flow_control);
+    }
+
+#if TUP_ENABLE_COALESCING
+    if (ret == 0 && ctx->coalescer != NULL)
+        tup_coalescer_set_config(ctx->coalescer, baudrate, parity);
+#endif
+
+    return ret;
 }
 
 /**
@@ -134,7 +506,12 @@ int tup_context_set_config(TupContext *ctx, SmpSerialBaudrate baudrate,
  */
 intptr_t tup_context_get_fd(TupContext *ctx)
 {
-    return smp_context_get_fd(ctx);
+#if TUP_ENABLE_TRANSPORT
+    if (ctx->transport != NULL)
+        return tup_transport_get_fd(ctx->transport);
+#endif
+
+    return smp_context_get_fd(ctx->smp_ctx);
 }
 
 /**
@@ -148,7 +525,7 @@ intptr_t tup_context_get_fd(TupContext *ctx)
  */
 int tup_context_send(TupContext *ctx, TupMessage *msg)
 {
-    return smp_context_send_message(ctx, msg);
+    return tup_context_send_message(ctx, msg, 1);
 }
 
 /**
@@ -162,12 +539,36 @@ int tup_context_send(TupContext *ctx, TupMessage *msg)
  */
 int tup_context_process_fd(TupContext *ctx)
 {
-    return smp_context_process_fd(ctx);
+    int ret;
+
+#ifdef HAVE_IO_THREAD
+    /* the I/O thread owns the reception */
+    if (ctx->io_thread != NULL)
+        return SMP_ERROR_BUSY;
+#endif
+
+    /* replies may only come once combined frames are written */
+    ret = tup_context_flush(ctx);
+    if (ret < 0)
+        return ret;
+
+    ret = tup_context_process_input(ctx);
+    if (ret < 0)
+        return ret;
+
+#if TUP_ENABLE_COALESCING
+    /* a response may tell the previous update went through */
+    if (ctx->coalescer != NULL)
+        ret = tup_coalescer_drain(ctx, 0);
+#endif
+
+    return ret;
 }
 
 /**
  * \ingroup context
- * Wait and process event data.
+ * Wait and process event data. When updates are coalesced, this returns
+ * early once the next pending update has been written.
  *
  * @param[in] ctx the TupContext
  * @param[in] timeout_ms a timeout in milliseconds. A negative value means no
@@ -177,5 +578,59 @@ int tup_context_process_fd(TupContext *ctx)
  */
 int tup_context_wait_and_process(TupContext *ctx, int timeout_ms)
 {
-    return smp_context_wait_and_process(ctx, timeout_ms);
+#if TUP_ENABLE_COALESCING
+    int update_timeout_ms = -1;
+#endif
+    int ret;
+
+#ifdef HAVE_IO_THREAD
+    /* the I/O thread owns the reception */
+    if (ctx->io_thread != NULL)
+        return SMP_ERROR_BUSY;
+#endif
+
+    /* replies may only come once combined frames are written */
+    ret = tup_context_flush(ctx);
+    if (ret < 0)
+        return ret;
+
+#if TUP_ENABLE_COALESCING
+    /* wake up in time to write the next pending update */
+    if (ctx->coalescer != NULL) {
+        ret = tup_coalescer_drain(ctx, 0);
+        if (ret < 0)
+            return ret;
+
+        update_timeout_ms = tup_coalescer_get_timeout(ctx);
+        if (update_timeout_ms >= 0
+                && (timeout_ms < 0 || update_timeout_ms < timeout_ms))
+            timeout_ms = update_timeout_ms;
+        else
+            update_timeout_ms = -1;
+    }
+#endif
+
+#if TUP_ENABLE_TRANSPORT
+    if (ctx->transport != NULL) {
+        ret = tup_transport_poll(ctx->transport, timeout_ms);
+        if (ret < 0)
+            return ret;
+        else if (ret == 0)
+            ret = SMP_ERROR_TIMEDOUT;
+        else
+            ret = tup_context_process_input(ctx);
+    } else
+#endif
+    {
+        ret = smp_context_wait_and_process(ctx->smp_ctx, timeout_ms);
+    }
+
+#if TUP_ENABLE_COALESCING
+    /* waking up for an update is not a timeout */
+    if (update_timeout_ms >= 0 && (ret == 0 || ret == SMP_ERROR_TIMEDOUT))
+        ret = tup_coalescer_drain(ctx, 0);
+#endif
+
+    return ret;
 }
+
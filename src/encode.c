@@ -0,0 +1,722 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * \defgroup encode Encoder
+ *
+ * Messages encoded straight into frames.
+ *
+ * The tup_encode_*() functions take the arguments of the matching
+ * tup_message_init_*() function and write the frame of the message in a
+ * caller buffer, without storing the arguments in a TupMessage first. They
+ * don't allocate memory and return the size of the frame, or
+ * SMP_ERROR_OVERFLOW if the buffer is too small. TUP_ENCODE_MAX_SIZE bytes
+ * are always enough.
+ *
+ * Frames are sent with tup_context_send_raw().
+ */
+
+#ifndef TUP_ENABLE_STATIC_API
+#define TUP_ENABLE_STATIC_API
+#endif
+
+#include "libtup-private.h"
+
+/**
+ * \ingroup encode
+ * Encode an ACK message.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] cmd the type of the acknowledged message
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_ack(uint8_t *buf, size_t size, TupMessageType cmd)
+{
+    return tup_encode_ack_full(buf, size, cmd, 0);
+}
+
+/**
+ * \ingroup encode
+ * Encode an ACK message with an argument.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] cmd the type of the acknowledged message
+ * @param[in] arg1 the first argument
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_ack_full(uint8_t *buf, size_t size, TupMessageType cmd,
+        uint32_t arg1)
+{
+    const void *fields[] = { &cmd, &arg1 };
+
+    return tup_message_encode_frame(buf, size,
+            TUP_MESSAGE_ACK, fields, NULL, 0);
+}
+
+/**
+ * \ingroup encode
+ * Encode an ERROR message.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] cmd the type of the message in error
+ * @param[in] error the error code
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_error(uint8_t *buf, size_t size, TupMessageType cmd,
+        uint32_t error)
+{
+    return tup_encode_error_full(buf, size, cmd, error, 0);
+}
+
+/**
+ * \ingroup encode
+ * Encode an ERROR message with an argument.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] cmd the type of the message in error
+ * @param[in] error the error code
+ * @param[in] arg1 the first argument
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_error_full(uint8_t *buf, size_t size, TupMessageType cmd,
+        uint32_t error, uint32_t arg1)
+{
+    const void *fields[] = { &cmd, &error, &arg1 };
+
+    return tup_message_encode_frame(buf, size,
+            TUP_MESSAGE_ERROR, fields, NULL, 0);
+}
+
+/**
+ * \ingroup encode
+ * Encode a load message.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] effect_id the id of the effect to load
+ * @param[in] bank_id the bank where the effect is
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_load(uint8_t *buf, size_t size, uint8_t effect_id,
+        uint16_t bank_id)
+{
+    const void *fields[] = { &effect_id, &bank_id };
+
+    return tup_message_encode_frame(buf, size, TUP_MESSAGE_CMD_LOAD,
+            fields, NULL, 0);
+}
+
+/**
+ * \ingroup encode
+ * Encode a play message.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] effect_id the loaded effect id to play
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_play(uint8_t *buf, size_t size, uint8_t effect_id)
+{
+    const void *fields[] = { &effect_id };
+
+    return tup_message_encode_frame(buf, size, TUP_MESSAGE_CMD_PLAY,
+            fields, NULL, 0);
+}
+
+/**
+ * \ingroup encode
+ * Encode a stop message.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] effect_id the loaded effect id to stop
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_stop(uint8_t *buf, size_t size, uint8_t effect_id)
+{
+    const void *fields[] = { &effect_id };
+
+    return tup_message_encode_frame(buf, size, TUP_MESSAGE_CMD_STOP,
+            fields, NULL, 0);
+}
+
+/**
+ * \ingroup encode
+ * Encode a get_version message.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_get_version(uint8_t *buf, size_t size)
+{
+    return tup_message_encode_frame(buf, size, TUP_MESSAGE_CMD_GET_VERSION,
+            NULL, NULL, 0);
+}
+
+/**
+ * \ingroup encode
+ * Encode a get_parameter message.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] effect_id the loaded effect id
+ * @param[in] parameter_ids an array of parameter ids
+ * @param[in] n_parameters the number of ids in parameter_ids
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_get_parameter(uint8_t *buf, size_t size, uint8_t effect_id,
+        const uint8_t *parameter_ids, size_t n_parameters)
+{
+    const void *fields[] = { &effect_id };
+
+    return tup_message_encode_frame(buf, size, TUP_MESSAGE_CMD_GET_PARAMETER,
+            fields, parameter_ids, n_parameters);
+}
+
+/**
+ * \ingroup encode
+ * Encode a set_parameter message.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] effect_id the loaded effect id
+ * @param[in] params an array of TupParameterArgs
+ * @param[in] n_params the number of parameters in params
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_set_parameter(uint8_t *buf, size_t size, uint8_t effect_id,
+        const TupParameterArgs *params, size_t n_params)
+{
+    const void *fields[] = { &effect_id };
+
+    return tup_message_encode_frame(buf, size, TUP_MESSAGE_CMD_SET_PARAMETER,
+            fields, params, n_params);
+}
+
+/**
+ * \ingroup encode
+ * Encode a bind_effect message.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] effect_id the loaded effect id to bind to
+ * @param[in] binding_flags the binding flags
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_bind_effect(uint8_t *buf, size_t size, uint8_t effect_id,
+        unsigned int binding_flags)
+{
+    const void *fields[] = { &effect_id, &binding_flags };
+
+    return tup_message_encode_frame(buf, size, TUP_MESSAGE_CMD_BIND_EFFECT,
+            fields, NULL, 0);
+}
+
+/**
+ * \ingroup encode
+ * Encode a get_sensor_value message.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] sensor_ids an array of sensor ids
+ * @param[in] n_sensors the number of ids in sensor_ids
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_get_sensor_value(uint8_t *buf, size_t size,
+        const uint8_t *sensor_ids, size_t n_sensors)
+{
+    return tup_message_encode_frame(buf, size,
+            TUP_MESSAGE_CMD_GET_SENSOR_VALUE, NULL, sensor_ids, n_sensors);
+}
+
+/**
+ * \ingroup encode
+ * Encode a set_sensor_value message.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] args an array of TupSensorValueArgs
+ * @param[in] n_args the number of sensors in args
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_set_sensor_value(uint8_t *buf, size_t size,
+        const TupSensorValueArgs *args, size_t n_args)
+{
+    return tup_message_encode_frame(buf, size,
+            TUP_MESSAGE_CMD_SET_SENSOR_VALUE, NULL, args, n_args);
+}
+
+/**
+ * \ingroup encode
+ * Encode a get_input_value message.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] effect_slot_id the effect slot id
+ * @param[in] input_ids an array of input ids
+ * @param[in] n_inputs the number of ids in input_ids
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_get_input_value(uint8_t *buf, size_t size,
+        uint8_t effect_slot_id, const uint8_t *input_ids, size_t n_inputs)
+{
+    const void *fields[] = { &effect_slot_id };
+
+    return tup_message_encode_frame(buf, size, TUP_MESSAGE_CMD_GET_INPUT_VALUE,
+            fields, input_ids, n_inputs);
+}
+
+/**
+ * \ingroup encode
+ * Encode a set_input_value message.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] effect_slot_id the effect slot id
+ * @param[in] args an array of TupInputValueArgs
+ * @param[in] n_args the number of inputs in args
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_set_input_value(uint8_t *buf, size_t size,
+        uint8_t effect_slot_id, const TupInputValueArgs *args, size_t n_args)
+{
+    const void *fields[] = { &effect_slot_id };
+
+    return tup_message_encode_frame(buf, size, TUP_MESSAGE_CMD_SET_INPUT_VALUE,
+            fields, args, n_args);
+}
+
+/**
+ * \ingroup encode
+ * Encode a filter_get_active message.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] filter the filter to get the state of
+ * @param[in] actuator_id the actuator id
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_filter_get_active(uint8_t *buf, size_t size, TupFilterId filter,
+        uint8_t actuator_id)
+{
+    const void *fields[] = { &filter, &actuator_id };
+
+    return tup_message_encode_frame(buf, size,
+            TUP_MESSAGE_CMD_FILTER_GET_ACTIVE, fields, NULL, 0);
+}
+
+/**
+ * \ingroup encode
+ * Encode a filter_set_active message.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] filter the filter to set the state of
+ * @param[in] actuator_id the actuator id
+ * @param[in] active the requested filter state
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_filter_set_active(uint8_t *buf, size_t size, TupFilterId filter,
+        uint8_t actuator_id, bool active)
+{
+    const void *fields[] = { &filter, &actuator_id, &active };
+
+    return tup_message_encode_frame(buf, size,
+            TUP_MESSAGE_CMD_FILTER_SET_ACTIVE, fields, NULL, 0);
+}
+
+/**
+ * \ingroup encode
+ * Encode a config_write message.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_config_write(uint8_t *buf, size_t size)
+{
+    return tup_message_encode_frame(buf, size, TUP_MESSAGE_CMD_CONFIG_WRITE,
+            NULL, NULL, 0);
+}
+
+/**
+ * \ingroup encode
+ * Encode a CONFIG_BAND_NORM_GET_COEFFS message.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] actuator_id the actuator id to which the filter is attached
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_config_band_norm_get_coeffs(uint8_t *buf, size_t size,
+        uint8_t actuator_id)
+{
+    const void *fields[] = { &actuator_id };
+
+    return tup_message_encode_frame(buf, size,
+            TUP_MESSAGE_CMD_CONFIG_BAND_NORM_GET_COEFFS, fields, NULL, 0);
+}
+
+/**
+ * \ingroup encode
+ * Encode a CONFIG_BAND_NORM_SET_COEFFS message.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] actuator_id the actuator id to which the filter is attached
+ * @param[in] a the array of a coefficients
+ * @param[in] b the array of b coefficients
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_config_band_norm_set_coeffs(uint8_t *buf, size_t size,
+        uint8_t actuator_id, const float a[5], const float b[5])
+{
+    const void *fields[] = { &actuator_id, a, b };
+
+    return tup_message_encode_frame(buf, size,
+            TUP_MESSAGE_CMD_CONFIG_BAND_NORM_SET_COEFFS, fields, NULL, 0);
+}
+
+/**
+ * \ingroup encode
+ * Encode a get_buildinfo message.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_get_buildinfo(uint8_t *buf, size_t size)
+{
+    return tup_message_encode_frame(buf, size, TUP_MESSAGE_CMD_GET_BUILDINFO,
+            NULL, NULL, 0);
+}
+
+/**
+ * \ingroup encode
+ * Encode an activate_internal_sensors message.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] state the requested sensors state
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_activate_internal_sensors(uint8_t *buf, size_t size,
+        uint8_t state)
+{
+    const void *fields[] = { &state };
+
+    return tup_message_encode_frame(buf, size,
+            TUP_MESSAGE_CMD_ACTIVATE_INTERNAL_SENSORS, fields, NULL, 0);
+}
+
+/**
+ * \ingroup encode
+ * Encode a response message with the firmware version.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] version the version string
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_resp_version(uint8_t *buf, size_t size, const char *version)
+{
+    const void *fields[] = { &version };
+
+    return tup_message_encode_frame(buf, size, TUP_MESSAGE_RESP_VERSION,
+            fields, NULL, 0);
+}
+
+/**
+ * \ingroup encode
+ * Encode a response message with parameter values.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] effect_id the loaded effect id
+ * @param[in] args an array of TupParameterArgs
+ * @param[in] n_args the number of parameters in args
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_resp_parameter(uint8_t *buf, size_t size, uint8_t effect_id,
+        const TupParameterArgs *args, size_t n_args)
+{
+    const void *fields[] = { &effect_id };
+
+    return tup_message_encode_frame(buf, size, TUP_MESSAGE_RESP_PARAMETER,
+            fields, args, n_args);
+}
+
+/**
+ * \ingroup encode
+ * Encode a response message with sensor values.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] args an array of TupSensorValueArgs
+ * @param[in] n_args the number of sensors in args
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_resp_sensor(uint8_t *buf, size_t size,
+        const TupSensorValueArgs *args, size_t n_args)
+{
+    return tup_message_encode_frame(buf, size, TUP_MESSAGE_RESP_SENSOR,
+            NULL, args, n_args);
+}
+
+/**
+ * \ingroup encode
+ * Encode a response message with input values.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] effect_slot_id the effect slot id
+ * @param[in] args an array of TupInputValueArgs
+ * @param[in] n_args the number of inputs in args
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_resp_input(uint8_t *buf, size_t size, uint8_t effect_slot_id,
+        const TupInputValueArgs *args, size_t n_args)
+{
+    const void *fields[] = { &effect_slot_id };
+
+    return tup_message_encode_frame(buf, size, TUP_MESSAGE_RESP_INPUT,
+            fields, args, n_args);
+}
+
+/**
+ * \ingroup encode
+ * Encode a response message with the firmware build information.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] buildinfo the build information string
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_resp_buildinfo(uint8_t *buf, size_t size, const char *buildinfo)
+{
+    const void *fields[] = { &buildinfo };
+
+    return tup_message_encode_frame(buf, size, TUP_MESSAGE_RESP_BUILDINFO,
+            fields, NULL, 0);
+}
+
+/**
+ * \ingroup encode
+ * Encode a response message to a set_parameter message.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] effect_id the loaded effect id
+ * @param[in] retval the return value of the command
+ * @param[in] args an array of TupParameterArgs
+ * @param[in] n_args the number of parameters in args
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_resp_set_parameter(uint8_t *buf, size_t size, uint8_t effect_id,
+        int32_t retval, const TupParameterArgs *args, size_t n_args)
+{
+    const void *fields[] = { &effect_id, &retval };
+
+    return tup_message_encode_frame(buf, size, TUP_MESSAGE_RESP_SET_PARAMETER,
+            fields, args, n_args);
+}
+
+/**
+ * \ingroup encode
+ * Encode a response message with a filter state.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] filter the filter
+ * @param[in] actuator_id the actuator id
+ * @param[in] active the filter state
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_resp_filter_active(uint8_t *buf, size_t size,
+        TupFilterId filter, uint8_t actuator_id, bool active)
+{
+    const void *fields[] = { &filter, &actuator_id, &active };
+
+    return tup_message_encode_frame(buf, size, TUP_MESSAGE_RESP_FILTER_ACTIVE,
+            fields, NULL, 0);
+}
+
+/**
+ * \ingroup encode
+ * Encode a response message with band norm coefficients.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] actuator_id the actuator id to which the filter is attached
+ * @param[in] a the array of a coefficients
+ * @param[in] b the array of b coefficients
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_resp_band_norm_coeffs(uint8_t *buf, size_t size,
+        uint8_t actuator_id, const float a[5], const float b[5])
+{
+    const void *fields[] = { &actuator_id, a, b };
+
+    return tup_message_encode_frame(buf, size,
+            TUP_MESSAGE_RESP_BAND_NORM_COEFFS, fields, NULL, 0);
+}
+
+/**
+ * \ingroup encode
+ * Encode a message requesting the system status.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_cmd_debug_get_system_status(uint8_t *buf, size_t size)
+{
+    return tup_message_encode_frame(buf, size,
+            TUP_MESSAGE_CMD_DEBUG_GET_SYSTEM_STATUS, NULL, NULL, 0);
+}
+
+/**
+ * \ingroup encode
+ * Encode a response message with the system status.
+ *
+ * @param[out] buf the buffer to write the frame to
+ * @param[in] size the size of buf
+ * @param[in] status a TupDebugSystemStatus structure
+ * @param[in] tasks an array of TupDebugTaskStatus
+ * @param[in] n_tasks the number of tasks in tasks
+ *
+ * @return the size of the frame on success, a SmpError otherwise.
+ */
+int tup_encode_resp_debug_system_status(uint8_t *buf, size_t size,
+        const TupDebugSystemStatus *status, const TupDebugTaskStatus *tasks,
+        size_t n_tasks)
+{
+    const void *fields[] = {
+        &status->rtime, &status->mem_total, &status->mem_used
+    };
+
+    return tup_message_encode_frame(buf, size,
+            TUP_MESSAGE_RESP_DEBUG_SYSTEM_STATUS, fields, tasks, n_tasks);
+}
+
+/**
+ * \ingroup encode
+ * Send an encoded frame. It goes through the I/O thread, the write combining
+ * buffer and the transport as messages sent with tup_context_send() do, but
+ * it isn't accounted in the context statistics and it can't be sent when
+ * the shadow state is enabled.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] data the frame, as returned by a tup_encode_*() function
+ * @param[in] size the size of the frame
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_send_raw(TupContext *ctx, const uint8_t *data, size_t size)
+{
+    int combine = 0;
+    int ret;
+
+    if (data == NULL || size == 0)
+        return SMP_ERROR_INVALID_PARAM;
+
+#if TUP_ENABLE_SHADOW
+    /* the shadow state needs the message itself */
+    if (ctx->shadow != NULL)
+        return SMP_ERROR_NOT_SUPPORTED;
+#endif
+
+#ifdef HAVE_IO_THREAD
+    if (ctx->io_thread != NULL)
+        return tup_io_thread_push_frames(ctx->io_thread, data, size);
+#endif
+
+#if TUP_ENABLE_COALESCING
+    /* keep the order with pending updates */
+    if (ctx->coalescer != NULL) {
+        ret = tup_coalescer_drain(ctx, 1);
+        if (ret < 0)
+            return ret;
+    }
+#endif
+
+#if TUP_ENABLE_BATCH
+    combine = ctx->wbuf != NULL && ctx->wbuf->window > 0;
+    if (combine) {
+        ret = 0;
+#if TUP_ENABLE_PEEPHOLE
+        if (ctx->wbuf->peephole != NULL)
+            ret = tup_peephole_flush(ctx);
+#endif
+        if (ret == 0)
+            ret = tup_write_buffer_append_frame(ctx, data, size);
+    } else
+#endif
+    {
+        ret = tup_context_write_raw(ctx, data, size);
+    }
+
+    if (ret < 0) {
+#if TUP_ENABLE_STATS
+        if (ctx->stats != NULL)
+            tup_stats_record_error(ctx, ret);
+#endif
+
+        return ret;
+    }
+
+    if (combine && ctx->wbuf->len >= ctx->wbuf->window)
+        return tup_context_flush(ctx);
+
+    return 0;
+}
@@ -0,0 +1,563 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Serialization of a TupMessage into a libsmp serial frame and back.
+ *
+ * This follows the libsmp wire format so that frames can be written to the
+ * device without going through SmpContext:
+ *   - message: msgid (uint32) | payload size (uint32) | arguments, where each
+ *     argument is its SmpType (uint8) followed by its value. Integers and
+ *     floats are little endian, strings are prefixed by their size (uint16,
+ *     including the terminating NUL).
+ *   - frame: START | escaped message | escaped crc | END, the crc being the
+ *     xor of all message bytes. START, END and ESC bytes are prefixed by ESC.
+ */
+
+#ifndef TUP_ENABLE_STATIC_API
+#define TUP_ENABLE_STATIC_API
+#endif
+
+#include "libtup-private.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void tup_frame_writer_put_raw(TupFrameWriter *writer, uint8_t byte)
+{
+    if (writer->offset < writer->size)
+        writer->buf[writer->offset] = byte;
+
+    /* keep counting so the caller knows the required size */
+    writer->offset++;
+}
+
+static void tup_frame_writer_put(TupFrameWriter *writer, uint8_t byte)
+{
+    if (!writer->raw && (byte == TUP_FRAME_START_BYTE
+                || byte == TUP_FRAME_END_BYTE || byte == TUP_FRAME_ESC_BYTE))
+        tup_frame_writer_put_raw(writer, TUP_FRAME_ESC_BYTE);
+
+    tup_frame_writer_put_raw(writer, byte);
+}
+
+void tup_frame_writer_put_le(TupFrameWriter *writer, uint64_t value,
+        size_t size)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        uint8_t byte = (value >> (8 * i)) & 0xff;
+
+        writer->crc ^= byte;
+        tup_frame_writer_put(writer, byte);
+    }
+}
+
+void tup_frame_writer_put_data(TupFrameWriter *writer,
+        const uint8_t *data, size_t size)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        writer->crc ^= data[i];
+        tup_frame_writer_put(writer, data[i]);
+    }
+}
+
+/* start a frame in buf */
+void tup_frame_writer_init(TupFrameWriter *writer, uint8_t *buf, size_t size)
+{
+    writer->buf = buf;
+    writer->size = size;
+    writer->offset = 0;
+    writer->crc = 0;
+    writer->raw = 0;
+
+    tup_frame_writer_put_raw(writer, TUP_FRAME_START_BYTE);
+}
+
+/* end the frame. Return its size or SMP_ERROR_OVERFLOW if it doesn't fit */
+int tup_frame_writer_finish(TupFrameWriter *writer)
+{
+    tup_frame_writer_put(writer, writer->crc);
+    tup_frame_writer_put_raw(writer, TUP_FRAME_END_BYTE);
+
+    if (writer->offset > writer->size)
+        return SMP_ERROR_OVERFLOW;
+
+    return (int) writer->offset;
+}
+
+/* return the size of the encoded argument (without its type) or 0 if type
+ * is not supported */
+size_t tup_frame_get_value_size(const SmpValue *value)
+{
+    switch (value->type) {
+        case SMP_TYPE_UINT8:
+        case SMP_TYPE_INT8:
+            return 1;
+        case SMP_TYPE_UINT16:
+        case SMP_TYPE_INT16:
+            return 2;
+        case SMP_TYPE_UINT32:
+        case SMP_TYPE_INT32:
+        case SMP_TYPE_F32:
+            return 4;
+        case SMP_TYPE_UINT64:
+        case SMP_TYPE_INT64:
+        case SMP_TYPE_F64:
+            return 8;
+        case SMP_TYPE_STRING:
+            return 2 + strlen(value->value.cstring) + 1;
+        default:
+            return 0;
+    }
+}
+
+void tup_frame_writer_put_value(TupFrameWriter *writer,
+        const SmpValue *value)
+{
+    uint32_t u32;
+    uint64_t u64;
+    size_t len;
+
+    tup_frame_writer_put_le(writer, value->type, 1);
+
+    switch (value->type) {
+        case SMP_TYPE_UINT8:
+        case SMP_TYPE_INT8:
+            tup_frame_writer_put_le(writer, value->value.u8, 1);
+            break;
+        case SMP_TYPE_UINT16:
+        case SMP_TYPE_INT16:
+            tup_frame_writer_put_le(writer, value->value.u16, 2);
+            break;
+        case SMP_TYPE_UINT32:
+        case SMP_TYPE_INT32:
+            tup_frame_writer_put_le(writer, value->value.u32, 4);
+            break;
+        case SMP_TYPE_F32:
+            memcpy(&u32, &value->value.f32, sizeof(u32));
+            tup_frame_writer_put_le(writer, u32, 4);
+            break;
+        case SMP_TYPE_UINT64:
+        case SMP_TYPE_INT64:
+            tup_frame_writer_put_le(writer, value->value.u64, 8);
+            break;
+        case SMP_TYPE_F64:
+            memcpy(&u64, &value->value.f64, sizeof(u64));
+            tup_frame_writer_put_le(writer, u64, 8);
+            break;
+        case SMP_TYPE_STRING:
+            len = strlen(value->value.cstring) + 1;
+            tup_frame_writer_put_le(writer, len, 2);
+            tup_frame_writer_put_data(writer,
+                    (const uint8_t *) value->value.cstring, len);
+            break;
+        default:
+            break;
+    }
+}
+
+/* return the size of the message arguments once serialized or a SmpError */
+int tup_frame_get_payload_size(TupMessage *message)
+{
+    SmpValue value;
+    size_t payload_size = 0;
+    int n_args;
+    int ret;
+    int i;
+
+    n_args = smp_message_n_args(message);
+    for (i = 0; i < n_args; i++) {
+        size_t value_size;
+
+        ret = smp_message_get_value(message, i, &value);
+        if (ret < 0)
+            return ret;
+
+        value_size = tup_frame_get_value_size(&value);
+        if (value_size == 0)
+            return SMP_ERROR_BAD_TYPE;
+
+        payload_size += 1 + value_size;
+    }
+
+    return (int) payload_size;
+}
+
+/* Encode message as a serial frame in buf.
+ * Return the size of the frame on success, SMP_ERROR_OVERFLOW if buf is too
+ * small or another SmpError otherwise. */
+int tup_frame_encode(TupMessage *message, uint8_t *buf, size_t size)
+{
+    TupFrameWriter writer;
+    SmpValue value;
+    int payload_size;
+    int n_args;
+    int i;
+
+    payload_size = tup_frame_get_payload_size(message);
+    if (payload_size < 0)
+        return payload_size;
+
+    n_args = smp_message_n_args(message);
+
+    tup_frame_writer_init(&writer, buf, size);
+    tup_frame_writer_put_le(&writer, smp_message_get_msgid(message), 4);
+    tup_frame_writer_put_le(&writer, payload_size, 4);
+
+    for (i = 0; i < n_args; i++) {
+        smp_message_get_value(message, i, &value);
+        tup_frame_writer_put_value(&writer, &value);
+    }
+
+    return tup_frame_writer_finish(&writer);
+}
+
+/* Serialize message in buf without framing nor escaping, storing the offset
+ * of each argument value in offsets which shall hold one entry per argument.
+ * Return the size of the message on success, SMP_ERROR_OVERFLOW if buf is
+ * too small or another SmpError otherwise. */
+int tup_frame_serialize(TupMessage *message, uint8_t *buf, size_t size,
+        size_t *offsets)
+{
+    TupFrameWriter writer;
+    SmpValue value;
+    int payload_size;
+    int n_args;
+    int i;
+
+    payload_size = tup_frame_get_payload_size(message);
+    if (payload_size < 0)
+        return payload_size;
+
+    n_args = smp_message_n_args(message);
+
+    writer.buf = buf;
+    writer.size = size;
+    writer.offset = 0;
+    writer.crc = 0;
+    writer.raw = 1;
+
+    tup_frame_writer_put_le(&writer, smp_message_get_msgid(message), 4);
+    tup_frame_writer_put_le(&writer, payload_size, 4);
+
+    for (i = 0; i < n_args; i++) {
+        smp_message_get_value(message, i, &value);
+
+        /* the value follows its type */
+        offsets[i] = writer.offset + 1;
+        tup_frame_writer_put_value(&writer, &value);
+    }
+
+    if (writer.offset > size)
+        return SMP_ERROR_OVERFLOW;
+
+    return (int) writer.offset;
+}
+
+/* Frame a message serialized with tup_frame_serialize(), crc being the xor
+ * of its bytes. frame shall hold 2 * size + 4 bytes.
+ * Return the size of the frame. */
+size_t tup_frame_wrap(const uint8_t *data, size_t size, uint8_t crc,
+        uint8_t *frame)
+{
+    uint8_t *p = frame;
+    uint8_t byte;
+    size_t i;
+
+    /* called for every send of a prepared message, so don't go through
+     * TupFrameWriter */
+    *p++ = TUP_FRAME_START_BYTE;
+
+    for (i = 0; i <= size; i++) {
+        byte = (i < size) ? data[i] : crc;
+
+        if (byte == TUP_FRAME_START_BYTE || byte == TUP_FRAME_END_BYTE
+                || byte == TUP_FRAME_ESC_BYTE)
+            *p++ = TUP_FRAME_ESC_BYTE;
+
+        *p++ = byte;
+    }
+
+    *p++ = TUP_FRAME_END_BYTE;
+    return p - frame;
+}
+
+/* Decoding */
+
+struct TupFrameDecoder
+{
+    uint8_t buf[TUP_FRAME_MAX_MESSAGE_SIZE + 1];
+    size_t len;
+    int in_frame;
+    int escaped;
+
+    /* reused for every decoded frame */
+    TupMessage *msg;
+};
+
+TupFrameDecoder *tup_frame_decoder_new(void)
+{
+    TupFrameDecoder *decoder;
+
+    decoder = tup_calloc(1, sizeof(*decoder));
+    if (decoder == NULL)
+        return NULL;
+
+    decoder->msg = tup_message_new();
+    if (decoder->msg == NULL) {
+        tup_free(decoder);
+        return NULL;
+    }
+
+    return decoder;
+}
+
+void tup_frame_decoder_free(TupFrameDecoder *decoder)
+{
+    tup_message_free(decoder->msg);
+    tup_free(decoder);
+}
+
+void tup_frame_decoder_reset(TupFrameDecoder *decoder)
+{
+    decoder->len = 0;
+    decoder->in_frame = 0;
+    decoder->escaped = 0;
+}
+
+static uint64_t tup_frame_read_le(const uint8_t *data, size_t size)
+{
+    uint64_t value = 0;
+    size_t i;
+
+    for (i = 0; i < size; i++)
+        value |= (uint64_t) data[i] << (8 * i);
+
+    return value;
+}
+
+/* parse a complete unescaped message (crc excluded), strings are used in
+ * place */
+int tup_frame_parse(TupMessage *message, const uint8_t *data, size_t size)
+{
+    size_t payload_size;
+    size_t offset;
+    SmpValue value;
+    uint64_t raw;
+    size_t value_size;
+    uint32_t u32;
+    int index;
+    int ret;
+
+    if (size < 8)
+        return SMP_ERROR_BAD_MESSAGE;
+
+    payload_size = tup_frame_read_le(data + 4, 4);
+    if (payload_size != size - 8)
+        return SMP_ERROR_BAD_MESSAGE;
+
+    smp_message_clear(message);
+    smp_message_init(message, tup_frame_read_le(data, 4));
+
+    for (offset = 8, index = 0; offset < size; index++) {
+        value.type = data[offset++];
+
+        if (value.type == SMP_TYPE_STRING) {
+            if (size - offset < 2)
+                return SMP_ERROR_BAD_MESSAGE;
+
+            value_size = tup_frame_read_le(data + offset, 2);
+            offset += 2;
+
+            /* the string is used in place so it must be NUL terminated */
+            if (value_size == 0 || size - offset < value_size
+                    || data[offset + value_size - 1] != '\0')
+                return SMP_ERROR_BAD_MESSAGE;
+
+            value.value.cstring = (const char *) data + offset;
+        } else {
+            value_size = tup_frame_get_value_size(&value);
+            if (value_size == 0)
+                return SMP_ERROR_BAD_TYPE;
+
+            if (size - offset < value_size)
+                return SMP_ERROR_BAD_MESSAGE;
+
+            raw = tup_frame_read_le(data + offset, value_size);
+
+            switch (value.type) {
+                case SMP_TYPE_UINT8:
+                case SMP_TYPE_INT8:
+                    value.value.u8 = raw;
+                    break;
+                case SMP_TYPE_UINT16:
+                case SMP_TYPE_INT16:
+                    value.value.u16 = raw;
+                    break;
+                case SMP_TYPE_UINT32:
+                case SMP_TYPE_INT32:
+                    value.value.u32 = raw;
+                    break;
+                case SMP_TYPE_F32:
+                    u32 = raw;
+                    memcpy(&value.value.f32, &u32, sizeof(u32));
+                    break;
+                case SMP_TYPE_UINT64:
+                case SMP_TYPE_INT64:
+                    value.value.u64 = raw;
+                    break;
+                case SMP_TYPE_F64:
+                    memcpy(&value.value.f64, &raw, sizeof(raw));
+                    break;
+                default:
+                    return SMP_ERROR_BAD_TYPE;
+            }
+        }
+
+        offset += value_size;
+
+        ret = smp_message_set_value(message, index, &value);
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+/* get the size of the frame starting data, END included, 0 if it doesn't end
+ * in data. An escaped END doesn't end a frame */
+size_t tup_frame_get_size(const uint8_t *data, size_t size)
+{
+    size_t i;
+
+    for (i = 1; i < size; i++) {
+        if (data[i] == TUP_FRAME_ESC_BYTE)
+            i++;
+        else if (data[i] == TUP_FRAME_END_BYTE)
+            return i + 1;
+    }
+
+    return 0;
+}
+
+/* unescape a whole frame, START and END included, in buf and parse it. buf
+ * may be the frame itself as it is written behind what is read */
+int tup_frame_decode(TupMessage *message, const uint8_t *frame, size_t size,
+        uint8_t *buf, size_t buf_size)
+{
+    uint8_t crc = 0;
+    size_t len = 0;
+    size_t i;
+
+    if (size < 2 || frame[0] != TUP_FRAME_START_BYTE
+            || frame[size - 1] != TUP_FRAME_END_BYTE)
+        return SMP_ERROR_BAD_MESSAGE;
+
+    for (i = 1; i < size - 1; i++) {
+        if (frame[i] == TUP_FRAME_ESC_BYTE && ++i == size - 1)
+            return SMP_ERROR_BAD_MESSAGE;
+
+        if (len == buf_size)
+            return SMP_ERROR_OVERFLOW;
+
+        buf[len++] = frame[i];
+    }
+
+    /* the last byte is the checksum */
+    if (len == 0)
+        return SMP_ERROR_BAD_MESSAGE;
+
+    for (i = 0; i < len - 1; i++)
+        crc ^= buf[i];
+
+    if (crc != buf[len - 1])
+        return SMP_ERROR_BAD_MESSAGE;
+
+    return tup_frame_parse(message, buf, len - 1);
+}
+
+static void tup_frame_decoder_end_frame(TupFrameDecoder *decoder,
+        TupContext *ctx)
+{
+    uint8_t crc = 0;
+    size_t i;
+    int ret;
+
+    if (decoder->len == 0) {
+        tup_context_dispatch_error(ctx, SMP_ERROR_BAD_MESSAGE);
+        return;
+    }
+
+    for (i = 0; i < decoder->len - 1; i++)
+        crc ^= decoder->buf[i];
+
+    if (crc != decoder->buf[decoder->len - 1]) {
+        tup_context_dispatch_error(ctx, SMP_ERROR_BAD_MESSAGE);
+        return;
+    }
+
+    ret = tup_frame_parse(decoder->msg, decoder->buf, decoder->len - 1);
+    if (ret < 0) {
+        tup_context_dispatch_error(ctx, ret);
+        return;
+    }
+
+    tup_context_dispatch_message(ctx, decoder->msg);
+}
+
+/* Feed received bytes to the decoder. Each complete message is dispatched
+ * to ctx, as well as framing errors. */
+void tup_frame_decoder_feed(TupFrameDecoder *decoder, TupContext *ctx,
+        const uint8_t *data, size_t size)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        uint8_t byte = data[i];
+
+        if (decoder->escaped) {
+            decoder->escaped = 0;
+        } else if (byte == TUP_FRAME_ESC_BYTE) {
+            decoder->escaped = 1;
+            continue;
+        } else if (byte == TUP_FRAME_START_BYTE) {
+            /* an unterminated frame is silently dropped, as libsmp does */
+            decoder->len = 0;
+            decoder->in_frame = 1;
+            continue;
+        } else if (byte == TUP_FRAME_END_BYTE) {
+            if (decoder->in_frame)
+                tup_frame_decoder_end_frame(decoder, ctx);
+
+            decoder->in_frame = 0;
+            continue;
+        }
+
+        if (!decoder->in_frame)
+            continue;
+
+        if (decoder->len == sizeof(decoder->buf)) {
+            tup_context_dispatch_error(ctx, SMP_ERROR_TOO_BIG);
+            decoder->in_frame = 0;
+            continue;
+        }
+
+        decoder->buf[decoder->len++] = byte;
+    }
+}
@@ -0,0 +1,574 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * \defgroup handler Message handlers
+ *
+ * Per message type handlers.
+ *
+ * Instead of switching on the message type in new_message_cb, a handler can
+ * be registered for each message type. Incoming messages are looked up in a
+ * table indexed by their type and, for responses, parsed before calling the
+ * handler with their content. Messages without handler are passed to
+ * new_message_cb without being parsed. Messages which fail to parse are
+ * reported to error_cb with SMP_ERROR_BAD_MESSAGE.
+ *
+ * Handlers are called after pipelined requests had a chance to consume the
+ * message. In threaded mode, they are called from the I/O thread and shall
+ * be set before starting it.
+ */
+
+#ifndef TUP_ENABLE_STATIC_API
+#define TUP_ENABLE_STATIC_API
+#endif
+
+#include "libtup-private.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if TUP_ENABLE_HANDLERS
+/* message types are all below this value */
+#define TUP_HANDLER_TABLE_SIZE 256
+
+typedef struct TupHandler TupHandler;
+
+/* parse message and call handler->func */
+typedef int (*TupHandlerDispatchFunc)(TupContext *ctx, TupMessage *message,
+        const TupHandler *handler);
+
+/* generic function pointer, cast back to the right type on dispatch */
+typedef void (*TupHandlerFunc)(void);
+
+struct TupHandler
+{
+    TupHandlerDispatchFunc dispatch;
+    TupHandlerFunc func;
+    void *userdata;
+};
+
+struct TupHandlerTable
+{
+    TupHandler entries[TUP_HANDLER_TABLE_SIZE];
+
+    /* storage for parsed arrays, grown on demand */
+    void *scratch;
+    size_t scratch_size;
+};
+
+static void *tup_handler_table_get_scratch(TupContext *ctx, size_t size)
+{
+    TupHandlerTable *table = ctx->handlers;
+    void *scratch;
+
+    /* let parsing report empty messages */
+    if (size == 0)
+        size = 1;
+
+    if (size <= table->scratch_size)
+        return table->scratch;
+
+    scratch = tup_realloc(table->scratch, size);
+    if (scratch == NULL)
+        return NULL;
+
+    table->scratch = scratch;
+    table->scratch_size = size;
+    return scratch;
+}
+
+static int tup_handler_set(TupContext *ctx, TupMessageType type,
+        TupHandlerDispatchFunc dispatch, TupHandlerFunc func, void *userdata)
+{
+    TupHandler *handler;
+
+    if ((unsigned int) type >= TUP_HANDLER_TABLE_SIZE)
+        return SMP_ERROR_INVALID_PARAM;
+
+    if (ctx->handlers == NULL) {
+        if (func == NULL)
+            return 0;
+
+        ctx->handlers = tup_calloc(1, sizeof(TupHandlerTable));
+        if (ctx->handlers == NULL)
+            return SMP_ERROR_NO_MEM;
+    }
+
+    handler = &ctx->handlers->entries[type];
+    handler->dispatch = (func != NULL) ? dispatch : NULL;
+    handler->func = func;
+    handler->userdata = userdata;
+    return 0;
+}
+
+void tup_handler_table_free(TupHandlerTable *table)
+{
+    tup_free(table->scratch);
+    tup_free(table);
+}
+
+/* return 1 if message was handled, 0 otherwise */
+int tup_handler_table_handle_message(TupContext *ctx, TupMessage *message)
+{
+    TupMessageType type = TUP_MESSAGE_TYPE(message);
+    const TupHandler *handler;
+
+    if ((unsigned int) type >= TUP_HANDLER_TABLE_SIZE)
+        return 0;
+
+    handler = &ctx->handlers->entries[type];
+    if (handler->dispatch == NULL)
+        return 0;
+
+    if (handler->dispatch(ctx, message, handler) < 0)
+        tup_context_dispatch_error(ctx, SMP_ERROR_BAD_MESSAGE);
+
+    return 1;
+}
+
+/* Dispatch functions */
+
+static int tup_handler_dispatch_message(TupContext *ctx, TupMessage *message,
+        const TupHandler *handler)
+{
+    ((TupMessageHandler) handler->func)(ctx, message, handler->userdata);
+    return 0;
+}
+
+static int tup_handler_dispatch_ack(TupContext *ctx, TupMessage *message,
+        const TupHandler *handler)
+{
+    uint32_t cmd;
+    uint32_t data = 0;
+    int ret;
+
+    ret = smp_message_get_uint32(message, 0, &cmd);
+    if (ret < 0)
+        return ret;
+
+    /* [data] is optional with old firmwares */
+    smp_message_get_uint32(message, 1, &data);
+
+    ((TupAckHandler) handler->func)(ctx, (TupMessageType) cmd, data,
+            handler->userdata);
+    return 0;
+}
+
+static int tup_handler_dispatch_error(TupContext *ctx, TupMessage *message,
+        const TupHandler *handler)
+{
+    uint32_t cmd;
+    uint32_t error;
+    uint32_t data = 0;
+    int ret;
+
+    ret = smp_message_get(message, 0, SMP_TYPE_UINT32, &cmd,
+            1, SMP_TYPE_UINT32, &error, -1);
+    if (ret < 0)
+        return ret;
+
+    /* [data] is optional with old firmwares */
+    smp_message_get_uint32(message, 2, &data);
+
+    ((TupErrorHandler) handler->func)(ctx, (TupMessageType) cmd, error, data,
+            handler->userdata);
+    return 0;
+}
+
+static int tup_handler_dispatch_version(TupContext *ctx, TupMessage *message,
+        const TupHandler *handler)
+{
+    const char *version;
+    int ret;
+
+    ret = tup_message_parse_resp_version(message, &version);
+    if (ret < 0)
+        return ret;
+
+    ((TupStringHandler) handler->func)(ctx, version, handler->userdata);
+    return 0;
+}
+
+static int tup_handler_dispatch_buildinfo(TupContext *ctx,
+        TupMessage *message, const TupHandler *handler)
+{
+    const char *buildinfo;
+    int ret;
+
+    ret = tup_message_parse_resp_buildinfo(message, &buildinfo);
+    if (ret < 0)
+        return ret;
+
+    ((TupStringHandler) handler->func)(ctx, buildinfo, handler->userdata);
+    return 0;
+}
+
+static int tup_handler_dispatch_parameter(TupContext *ctx,
+        TupMessage *message, const TupHandler *handler)
+{
+    size_t size = smp_message_n_args(message);
+    TupParameterArgs *args;
+    uint8_t effect_id;
+    int ret;
+
+    args = tup_handler_table_get_scratch(ctx, size * sizeof(*args));
+    if (args == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    ret = tup_message_parse_resp_parameter(message, &effect_id, args, size);
+    if (ret < 0)
+        return ret;
+
+    ((TupParameterHandler) handler->func)(ctx, effect_id, args, ret,
+            handler->userdata);
+    return 0;
+}
+
+static int tup_handler_dispatch_set_parameter(TupContext *ctx,
+        TupMessage *message, const TupHandler *handler)
+{
+    size_t size = smp_message_n_args(message);
+    TupParameterArgs *args;
+    uint8_t effect_id;
+    int32_t retval;
+    int ret;
+
+    args = tup_handler_table_get_scratch(ctx, size * sizeof(*args));
+    if (args == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    ret = tup_message_parse_resp_set_parameter(message, &effect_id, &retval,
+            args, size);
+    if (ret < 0)
+        return ret;
+
+    ((TupSetParameterHandler) handler->func)(ctx, effect_id, retval, args,
+            ret, handler->userdata);
+    return 0;
+}
+
+static int tup_handler_dispatch_sensor(TupContext *ctx, TupMessage *message,
+        const TupHandler *handler)
+{
+    size_t size = smp_message_n_args(message);
+    TupSensorValueArgs *args;
+    int ret;
+
+    args = tup_handler_table_get_scratch(ctx, size * sizeof(*args));
+    if (args == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    ret = tup_message_parse_resp_sensor(message, args, size);
+    if (ret < 0)
+        return ret;
+
+    ((TupSensorHandler) handler->func)(ctx, args, ret, handler->userdata);
+    return 0;
+}
+
+static int tup_handler_dispatch_input(TupContext *ctx, TupMessage *message,
+        const TupHandler *handler)
+{
+    size_t size = smp_message_n_args(message);
+    TupInputValueArgs *args;
+    uint8_t effect_slot_id;
+    int ret;
+
+    args = tup_handler_table_get_scratch(ctx, size * sizeof(*args));
+    if (args == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    ret = tup_message_parse_resp_input(message, &effect_slot_id, args, size);
+    if (ret < 0)
+        return ret;
+
+    ((TupInputHandler) handler->func)(ctx, effect_slot_id, args, ret,
+            handler->userdata);
+    return 0;
+}
+
+static int tup_handler_dispatch_filter_active(TupContext *ctx,
+        TupMessage *message, const TupHandler *handler)
+{
+    TupFilterId filter;
+    uint8_t actuator_id;
+    bool active;
+    int ret;
+
+    ret = tup_message_parse_resp_filter_active(message, &filter, &actuator_id,
+            &active);
+    if (ret < 0)
+        return ret;
+
+    ((TupFilterActiveHandler) handler->func)(ctx, filter, actuator_id, active,
+            handler->userdata);
+    return 0;
+}
+
+static int tup_handler_dispatch_band_norm_coeffs(TupContext *ctx,
+        TupMessage *message, const TupHandler *handler)
+{
+    uint8_t actuator_id;
+    float a[5];
+    float b[5];
+    int ret;
+
+    ret = tup_message_parse_resp_band_norm_coeffs(message, &actuator_id, a, b);
+    if (ret < 0)
+        return ret;
+
+    ((TupBandNormCoeffsHandler) handler->func)(ctx, actuator_id, a, b,
+            handler->userdata);
+    return 0;
+}
+
+static int tup_handler_dispatch_debug_system_status(TupContext *ctx,
+        TupMessage *message, const TupHandler *handler)
+{
+    size_t size = smp_message_n_args(message);
+    TupDebugSystemStatus status;
+    TupDebugTaskStatus *tasks;
+    int ret;
+
+    tasks = tup_handler_table_get_scratch(ctx, size * sizeof(*tasks));
+    if (tasks == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    ret = tup_message_parse_resp_debug_system_status(message, &status, tasks,
+            size);
+    if (ret < 0)
+        return ret;
+
+    ((TupDebugSystemStatusHandler) handler->func)(ctx, &status, tasks, ret,
+            handler->userdata);
+    return 0;
+}
+
+/* API */
+
+/**
+ * \ingroup handler
+ * Set the handler of a message type. The handler gets the raw message, it
+ * can be used for any type including commands. It replaces any typed handler
+ * of this type.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] type the message type
+ * @param[in] handler the handler, NULL to remove it
+ * @param[in] userdata userdata to pass to handler
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_set_message_handler(TupContext *ctx, TupMessageType type,
+        TupMessageHandler handler, void *userdata)
+{
+    return tup_handler_set(ctx, type, tup_handler_dispatch_message,
+            (TupHandlerFunc) handler, userdata);
+}
+
+/**
+ * \ingroup handler
+ * Set the handler of ACK messages.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] handler the handler, NULL to remove it
+ * @param[in] userdata userdata to pass to handler
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_set_ack_handler(TupContext *ctx, TupAckHandler handler,
+        void *userdata)
+{
+    return tup_handler_set(ctx, TUP_MESSAGE_ACK, tup_handler_dispatch_ack,
+            (TupHandlerFunc) handler, userdata);
+}
+
+/**
+ * \ingroup handler
+ * Set the handler of ERROR messages.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] handler the handler, NULL to remove it
+ * @param[in] userdata userdata to pass to handler
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_set_error_handler(TupContext *ctx, TupErrorHandler handler,
+        void *userdata)
+{
+    return tup_handler_set(ctx, TUP_MESSAGE_ERROR, tup_handler_dispatch_error,
+            (TupHandlerFunc) handler, userdata);
+}
+
+/**
+ * \ingroup handler
+ * Set the handler of RESP_VERSION messages.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] handler the handler, NULL to remove it
+ * @param[in] userdata userdata to pass to handler
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_set_version_handler(TupContext *ctx, TupStringHandler handler,
+        void *userdata)
+{
+    return tup_handler_set(ctx, TUP_MESSAGE_RESP_VERSION,
+            tup_handler_dispatch_version, (TupHandlerFunc) handler, userdata);
+}
+
+/**
+ * \ingroup handler
+ * Set the handler of RESP_BUILDINFO messages.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] handler the handler, NULL to remove it
+ * @param[in] userdata userdata to pass to handler
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_set_buildinfo_handler(TupContext *ctx,
+        TupStringHandler handler, void *userdata)
+{
+    return tup_handler_set(ctx, TUP_MESSAGE_RESP_BUILDINFO,
+            tup_handler_dispatch_buildinfo, (TupHandlerFunc) handler,
+            userdata);
+}
+
+/**
+ * \ingroup handler
+ * Set the handler of RESP_PARAMETER messages.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] handler the handler, NULL to remove it
+ * @param[in] userdata userdata to pass to handler
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_set_parameter_handler(TupContext *ctx,
+        TupParameterHandler handler, void *userdata)
+{
+    return tup_handler_set(ctx, TUP_MESSAGE_RESP_PARAMETER,
+            tup_handler_dispatch_parameter, (TupHandlerFunc) handler,
+            userdata);
+}
+
+/**
+ * \ingroup handler
+ * Set the handler of RESP_SET_PARAMETER messages.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] handler the handler, NULL to remove it
+ * @param[in] userdata userdata to pass to handler
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_set_set_parameter_handler(TupContext *ctx,
+        TupSetParameterHandler handler, void *userdata)
+{
+    return tup_handler_set(ctx, TUP_MESSAGE_RESP_SET_PARAMETER,
+            tup_handler_dispatch_set_parameter, (TupHandlerFunc) handler,
+            userdata);
+}
+
+/**
+ * \ingroup handler
+ * Set the handler of RESP_SENSOR messages.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] handler the handler, NULL to remove it
+ * @param[in] userdata userdata to pass to handler
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_set_sensor_handler(TupContext *ctx, TupSensorHandler handler,
+        void *userdata)
+{
+    return tup_handler_set(ctx, TUP_MESSAGE_RESP_SENSOR,
+            tup_handler_dispatch_sensor, (TupHandlerFunc) handler, userdata);
+}
+
+/**
+ * \ingroup handler
+ * Set the handler of RESP_INPUT messages.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] handler the handler, NULL to remove it
+ * @param[in] userdata userdata to pass to handler
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_set_input_handler(TupContext *ctx, TupInputHandler handler,
+        void *userdata)
+{
+    return tup_handler_set(ctx, TUP_MESSAGE_RESP_INPUT,
+            tup_handler_dispatch_input, (TupHandlerFunc) handler, userdata);
+}
+
+/**
+ * \ingroup handler
+ * Set the handler of RESP_FILTER_ACTIVE messages.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] handler the handler, NULL to remove it
+ * @param[in] userdata userdata to pass to handler
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_set_filter_active_handler(TupContext *ctx,
+        TupFilterActiveHandler handler, void *userdata)
+{
+    return tup_handler_set(ctx, TUP_MESSAGE_RESP_FILTER_ACTIVE,
+            tup_handler_dispatch_filter_active, (TupHandlerFunc) handler,
+            userdata);
+}
+
+/**
+ * \ingroup handler
+ * Set the handler of RESP_BAND_NORM_COEFFS messages.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] handler the handler, NULL to remove it
+ * @param[in] userdata userdata to pass to handler
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_set_band_norm_coeffs_handler(TupContext *ctx,
+        TupBandNormCoeffsHandler handler, void *userdata)
+{
+    return tup_handler_set(ctx, TUP_MESSAGE_RESP_BAND_NORM_COEFFS,
+            tup_handler_dispatch_band_norm_coeffs, (TupHandlerFunc) handler,
+            userdata);
+}
+
+/**
+ * \ingroup handler
+ * Set the handler of RESP_DEBUG_SYSTEM_STATUS messages.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] handler the handler, NULL to remove it
+ * @param[in] userdata userdata to pass to handler
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_set_debug_system_status_handler(TupContext *ctx,
+        TupDebugSystemStatusHandler handler, void *userdata)
+{
+    return tup_handler_set(ctx, TUP_MESSAGE_RESP_DEBUG_SYSTEM_STATUS,
+            tup_handler_dispatch_debug_system_status, (TupHandlerFunc) handler,
+            userdata);
+}
+#endif
@@ -0,0 +1,623 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * \defgroup iothread I/O thread
+ *
+ * Threaded mode of a TupContext (Linux only).
+ *
+ * In threaded mode, tup_context_send() encodes the frame into a bounded
+ * lock-free ring. A dedicated thread drains the ring to the device and
+ * processes incoming data, so context callbacks are called from that thread.
+ *
+ * The ring is a multi-producer single-consumer queue where each cell carries
+ * a sequence number telling whether it is free or holds a frame. Once the
+ * ring is empty, the I/O thread polls it a little while before going to
+ * sleep. Producers only wake it up, with a write to an eventfd, when it
+ * sleeps, so a busy stream of frames doesn't cost any syscall on the
+ * producer side.
+ */
+
+#ifndef TUP_ENABLE_STATIC_API
+#define TUP_ENABLE_STATIC_API
+#endif
+
+#include "libtup-private.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+/* maximum size of an encoded frame in the ring */
+#define TUP_IO_THREAD_FRAME_SIZE 256
+
+#define TUP_IO_THREAD_DEFAULT_QUEUE_SIZE 64
+
+/* number of times the I/O thread polls the empty ring before sleeping */
+#define TUP_IO_THREAD_SPIN_COUNT 1000
+
+typedef struct
+{
+    atomic_size_t sequence;
+    uint16_t size;
+    uint8_t data[TUP_IO_THREAD_FRAME_SIZE];
+} TupIoCell;
+
+struct TupIoThread
+{
+    TupContext *ctx;
+    int fd;
+
+    pthread_t thread;
+    int wakeup_fd;
+
+    TupIoCell *cells;
+    size_t mask;
+
+    /* producers and consumer positions on their own cache lines */
+    _Alignas(TUP_CACHELINE_SIZE) atomic_size_t enqueue_pos;
+    _Alignas(TUP_CACHELINE_SIZE) atomic_size_t dequeue_pos;
+
+    _Alignas(TUP_CACHELINE_SIZE) atomic_int sleeping;
+    atomic_int stop;
+    atomic_int hangup;
+
+    atomic_size_t high_water;
+    atomic_uint_least64_t n_queued;
+    atomic_uint_least64_t n_written;
+    atomic_uint_least64_t n_overflows;
+    atomic_uint_least64_t n_write_errors;
+};
+
+static int tup_io_thread_write_all(TupIoThread *thread, const uint8_t *data,
+        size_t size)
+{
+    struct pollfd pfd;
+    ssize_t ret;
+
+    while (size > 0) {
+        ret = write(thread->fd, data, size);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return SMP_ERROR_IO;
+
+            /* the device is backed up, wait for it on the I/O thread */
+            pfd.fd = thread->fd;
+            pfd.events = POLLOUT;
+            pfd.revents = 0;
+            poll(&pfd, 1, -1);
+            continue;
+        }
+
+        data += ret;
+        size -= ret;
+    }
+
+    return 0;
+}
+
+/* consumer side: write all queued frames, return the number of frames */
+static size_t tup_io_thread_drain(TupIoThread *thread)
+{
+    size_t pos = atomic_load_explicit(&thread->dequeue_pos,
+            memory_order_relaxed);
+    size_t n = 0;
+
+    for (;;) {
+        TupIoCell *cell = &thread->cells[pos & thread->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence,
+                memory_order_acquire);
+
+        if ((intptr_t) seq - (intptr_t) (pos + 1) < 0)
+            break;
+
+        /* an empty cell is a frame which failed to encode */
+        if (cell->size > 0) {
+            if (tup_io_thread_write_all(thread, cell->data, cell->size) == 0) {
+                atomic_fetch_add_explicit(&thread->n_written, 1,
+                        memory_order_relaxed);
+
+#ifdef HAVE_CAPTURE
+                /* the capture can't be stopped while the thread runs */
+                if (thread->ctx->capture != NULL)
+                    tup_capture_record_frames(thread->ctx->capture,
+                            TUP_CAPTURE_TX, cell->data, cell->size);
+#endif
+            } else {
+                atomic_fetch_add_explicit(&thread->n_write_errors, 1,
+                        memory_order_relaxed);
+            }
+        }
+
+        atomic_store_explicit(&cell->sequence, pos + thread->mask + 1,
+                memory_order_release);
+        pos++;
+        atomic_store_explicit(&thread->dequeue_pos, pos,
+                memory_order_relaxed);
+        n++;
+    }
+
+    return n;
+}
+
+static int tup_io_thread_is_empty(TupIoThread *thread)
+{
+    size_t pos = atomic_load_explicit(&thread->dequeue_pos,
+            memory_order_relaxed);
+    TupIoCell *cell = &thread->cells[pos & thread->mask];
+
+    return (intptr_t) atomic_load_explicit(&cell->sequence,
+            memory_order_acquire) - (intptr_t) (pos + 1) < 0;
+}
+
+static inline void tup_io_thread_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/* the device is gone: report it and fail next pushes */
+static void tup_io_thread_hangup(TupIoThread *thread, SmpError error)
+{
+    atomic_store(&thread->hangup, 1);
+
+    if (thread->ctx->cbs.error_cb != NULL)
+        thread->ctx->cbs.error_cb(thread->ctx, error, thread->ctx->userdata);
+}
+
+static void *tup_io_thread_run(void *data)
+{
+    TupIoThread *thread = data;
+    struct pollfd pfds[2];
+    uint64_t value;
+    int timeout_ms;
+    int spin;
+
+    pfds[0].fd = thread->fd;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = thread->wakeup_fd;
+    pfds[1].events = POLLIN;
+
+    while (!atomic_load(&thread->stop)) {
+        tup_io_thread_drain(thread);
+
+        /* a producer may be about to publish, don't make it wake us up */
+        for (spin = 0; spin < TUP_IO_THREAD_SPIN_COUNT
+                && tup_io_thread_is_empty(thread)
+                && !atomic_load_explicit(&thread->stop, memory_order_relaxed);
+                spin++)
+            tup_io_thread_cpu_relax();
+
+        /* announce we are going to sleep then check again, producers check
+         * the flag after publishing a frame. If frames arrived meanwhile,
+         * only check for incoming data so reception is not starved. */
+        atomic_store(&thread->sleeping, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (!tup_io_thread_is_empty(thread)) {
+            atomic_store(&thread->sleeping, 0);
+            timeout_ms = 0;
+        } else {
+            timeout_ms = -1;
+        }
+
+        pfds[0].revents = 0;
+        pfds[1].revents = 0;
+        if (poll(pfds, 2, timeout_ms) < 0 && errno != EINTR) {
+            tup_io_thread_hangup(thread, SMP_ERROR_IO);
+            break;
+        }
+
+        atomic_store(&thread->sleeping, 0);
+
+        if (pfds[1].revents & POLLIN) {
+            if (read(thread->wakeup_fd, &value, sizeof(value)) < 0) {
+                /* nothing to do, eventfd is non blocking */
+            }
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            int ret = smp_context_process_fd(thread->ctx->smp_ctx);
+
+            if (ret < 0 && thread->ctx->cbs.error_cb != NULL)
+                thread->ctx->cbs.error_cb(thread->ctx, ret,
+                        thread->ctx->userdata);
+        }
+
+        /* the device is gone, nothing more to do */
+        if (pfds[0].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+            tup_io_thread_hangup(thread, SMP_ERROR_PIPE);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static void tup_io_thread_wakeup(TupIoThread *thread)
+{
+    uint64_t value = 1;
+
+    if (write(thread->wakeup_fd, &value, sizeof(value)) < 0) {
+        /* eventfd counter is saturated, thread is awake anyway */
+    }
+}
+
+static void tup_io_thread_update_high_water(TupIoThread *thread,
+        size_t depth)
+{
+    size_t hw = atomic_load_explicit(&thread->high_water,
+            memory_order_relaxed);
+
+    while (depth > hw) {
+        if (atomic_compare_exchange_weak_explicit(&thread->high_water, &hw,
+                    depth, memory_order_relaxed, memory_order_relaxed))
+            break;
+    }
+}
+
+/* producer side: claim n consecutive free cells, the first one being at
+ * *ppos. The consumer frees cells in order, so they are all free once the
+ * last one is */
+static int tup_io_thread_claim(TupIoThread *thread, size_t n, size_t *ppos)
+{
+    size_t pos = atomic_load_explicit(&thread->enqueue_pos,
+            memory_order_relaxed);
+
+    if (n > thread->mask + 1)
+        return SMP_ERROR_TOO_BIG;
+
+    for (;;) {
+        TupIoCell *last = &thread->cells[(pos + n - 1) & thread->mask];
+        size_t seq;
+        intptr_t diff;
+
+        seq = atomic_load_explicit(&last->sequence, memory_order_acquire);
+        diff = (intptr_t) seq - (intptr_t) (pos + n - 1);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&thread->enqueue_pos,
+                        &pos, pos + n, memory_order_relaxed,
+                        memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit(&thread->n_overflows, 1,
+                    memory_order_relaxed);
+            return SMP_ERROR_WOULD_BLOCK;
+        } else {
+            pos = atomic_load_explicit(&thread->enqueue_pos,
+                    memory_order_relaxed);
+        }
+    }
+
+    *ppos = pos;
+    return 0;
+}
+
+/* producer side: publish n claimed cells, even empty ones, to keep the ring
+ * going */
+static void tup_io_thread_publish(TupIoThread *thread, size_t pos, size_t n)
+{
+    size_t n_frames = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        TupIoCell *cell = &thread->cells[(pos + i) & thread->mask];
+
+        if (cell->size > 0)
+            n_frames++;
+
+        atomic_store_explicit(&cell->sequence, pos + i + 1,
+                memory_order_release);
+    }
+
+    if (n_frames == 0)
+        return;
+
+    atomic_fetch_add_explicit(&thread->n_queued, n_frames,
+            memory_order_relaxed);
+    tup_io_thread_update_high_water(thread, pos + n
+            - atomic_load_explicit(&thread->dequeue_pos, memory_order_relaxed));
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_exchange(&thread->sleeping, 0))
+        tup_io_thread_wakeup(thread);
+}
+
+/* producer side: encode msg in a free cell */
+int tup_io_thread_push(TupIoThread *thread, TupMessage *msg)
+{
+    return tup_io_thread_push_batch(thread, &msg, 1);
+}
+
+/* producer side: encode msgs in consecutive cells, none of them is written
+ * if one fails to encode */
+int tup_io_thread_push_batch(TupIoThread *thread, TupMessage **msgs,
+        size_t n)
+{
+    TupIoCell *cell;
+    size_t pos;
+    size_t i;
+    int ret;
+
+    if (atomic_load_explicit(&thread->hangup, memory_order_relaxed))
+        return SMP_ERROR_PIPE;
+
+    if (n == 0)
+        return 0;
+
+    ret = tup_io_thread_claim(thread, n, &pos);
+    if (ret < 0)
+        return ret;
+
+    for (i = 0; i < n && ret >= 0; i++) {
+        cell = &thread->cells[(pos + i) & thread->mask];
+        ret = tup_frame_encode(msgs[i], cell->data, sizeof(cell->data));
+        cell->size = (ret > 0) ? ret : 0;
+    }
+
+    if (ret < 0) {
+        for (i = 0; i < n; i++)
+            thread->cells[(pos + i) & thread->mask].size = 0;
+    }
+
+    tup_io_thread_publish(thread, pos, n);
+
+    if (ret < 0)
+        return (ret == SMP_ERROR_OVERFLOW) ? SMP_ERROR_TOO_BIG : ret;
+
+    return 0;
+}
+
+/* producer side: copy back to back encoded frames in consecutive cells,
+ * none of them is written if one doesn't fit in a cell */
+int tup_io_thread_push_frames(TupIoThread *thread, const uint8_t *data,
+        size_t size)
+{
+    TupIoCell *cell;
+    size_t frame_size;
+    size_t offset;
+    size_t pos;
+    size_t n = 0;
+    int ret;
+
+    if (atomic_load_explicit(&thread->hangup, memory_order_relaxed))
+        return SMP_ERROR_PIPE;
+
+    for (offset = 0; offset < size; offset += frame_size) {
+        frame_size = tup_frame_get_size(data + offset, size - offset);
+        if (frame_size == 0)
+            return SMP_ERROR_BAD_MESSAGE;
+
+        if (frame_size > TUP_IO_THREAD_FRAME_SIZE)
+            return SMP_ERROR_TOO_BIG;
+
+        n++;
+    }
+
+    if (n == 0)
+        return 0;
+
+    ret = tup_io_thread_claim(thread, n, &pos);
+    if (ret < 0)
+        return ret;
+
+    for (offset = 0; offset < size; offset += frame_size) {
+        frame_size = tup_frame_get_size(data + offset, size - offset);
+
+        cell = &thread->cells[pos++ & thread->mask];
+        memcpy(cell->data, data + offset, frame_size);
+        cell->size = frame_size;
+    }
+
+    tup_io_thread_publish(thread, pos - n, n);
+    return 0;
+}
+
+static void tup_io_thread_free(TupIoThread *thread)
+{
+    close(thread->wakeup_fd);
+    tup_free(thread->cells);
+    tup_free_aligned(thread);
+}
+
+int tup_io_thread_stop(TupIoThread *thread)
+{
+    /* joining itself would never return */
+    if (pthread_equal(pthread_self(), thread->thread))
+        return SMP_ERROR_BUSY;
+
+    atomic_store(&thread->stop, 1);
+    tup_io_thread_wakeup(thread);
+    pthread_join(thread->thread, NULL);
+
+    /* don't lose frames queued before stopping */
+    tup_io_thread_drain(thread);
+    tup_io_thread_free(thread);
+    return 0;
+}
+
+/* API */
+
+/**
+ * \ingroup iothread
+ * Switch an opened TupContext to threaded mode. From now on, tup_context_send()
+ * only queues frames and callbacks are called from the I/O thread.
+ * tup_context_process_fd() and tup_context_wait_and_process() shall not be
+ * used anymore and pipelined requests are not available. Frames held by write
+ * combining are written first.
+ * Frames bigger than 256 bytes once encoded can't be sent in this mode and
+ * contexts using a TupTransport, collecting statistics or coalescing updates
+ * are not supported.
+ * If the device hangs up, the error callback is called from the I/O thread
+ * with SMP_ERROR_PIPE and tup_context_send() fails with SMP_ERROR_PIPE from
+ * then on.
+ *
+ * @param[in] ctx an opened TupContext
+ * @param[in] queue_size the number of frames the transmit ring can hold,
+ *                       rounded up to a power of two. 0 selects a default
+ *                       size.
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_start_io_thread(TupContext *ctx, size_t queue_size)
+{
+    TupIoThread *thread;
+    intptr_t fd;
+    size_t size;
+    size_t i;
+    int ret;
+
+    if (ctx->io_thread != NULL)
+        return SMP_ERROR_BUSY;
+
+    if (tup_context_get_n_pending_requests(ctx) > 0)
+        return SMP_ERROR_BUSY;
+
+    /* the I/O thread talks to the serial device directly */
+    if (ctx->transport != NULL)
+        return SMP_ERROR_NOT_SUPPORTED;
+
+    /* stats are recorded without locking */
+    if (ctx->stats != NULL)
+        return SMP_ERROR_NOT_SUPPORTED;
+
+    /* the ring has no notion of pending updates */
+    if (ctx->coalescer != NULL)
+        return SMP_ERROR_NOT_SUPPORTED;
+
+    /* the known state is updated without locking */
+    if (ctx->shadow != NULL)
+        return SMP_ERROR_NOT_SUPPORTED;
+
+    fd = tup_context_get_fd(ctx);
+    if (fd < 0)
+        return (int) fd;
+
+    /* combined frames go before the ones queued from now on */
+    ret = tup_context_flush(ctx);
+    if (ret < 0)
+        return ret;
+
+    if (queue_size == 0)
+        queue_size = TUP_IO_THREAD_DEFAULT_QUEUE_SIZE;
+
+    for (size = 2; size < queue_size; size <<= 1) {
+        if (size > (SIZE_MAX >> 2))
+            return SMP_ERROR_INVALID_PARAM;
+    }
+
+    /* honor the cache line alignment of the ring positions */
+    thread = tup_malloc_aligned(TUP_CACHELINE_SIZE, sizeof(*thread));
+    if (thread == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    memset(thread, 0, sizeof(*thread));
+    thread->ctx = ctx;
+    thread->fd = (int) fd;
+    thread->mask = size - 1;
+
+    thread->cells = tup_calloc(size, sizeof(TupIoCell));
+    if (thread->cells == NULL) {
+        tup_free_aligned(thread);
+        return SMP_ERROR_NO_MEM;
+    }
+
+    for (i = 0; i < size; i++)
+        atomic_init(&thread->cells[i].sequence, i);
+
+    thread->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (thread->wakeup_fd < 0) {
+        tup_free(thread->cells);
+        tup_free_aligned(thread);
+        return SMP_ERROR_IO;
+    }
+
+    if (pthread_create(&thread->thread, NULL, tup_io_thread_run, thread)) {
+        tup_io_thread_free(thread);
+        return SMP_ERROR_OTHER;
+    }
+
+    ctx->io_thread = thread;
+    return 0;
+}
+
+/**
+ * \ingroup iothread
+ * Leave threaded mode. Frames still in the ring are written before returning.
+ * It can't be called from a callback, which runs in the I/O thread.
+ *
+ * @param[in] ctx the TupContext
+ *
+ * @return 0 on success, SMP_ERROR_BUSY if called from the I/O thread.
+ */
+int tup_context_stop_io_thread(TupContext *ctx)
+{
+    int ret;
+
+    if (ctx->io_thread == NULL)
+        return 0;
+
+    ret = tup_io_thread_stop(ctx->io_thread);
+    if (ret < 0)
+        return ret;
+
+    ctx->io_thread = NULL;
+    return 0;
+}
+
+/**
+ * \ingroup iothread
+ * Get the transmit ring statistics of a context in threaded mode. It can be
+ * called from any thread.
+ *
+ * @param[in] ctx the TupContext
+ * @param[out] stats the statistics
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_get_io_thread_stats(TupContext *ctx, TupIoThreadStats *stats)
+{
+    TupIoThread *thread = ctx->io_thread;
+    size_t enqueue_pos;
+    size_t dequeue_pos;
+
+    if (thread == NULL)
+        return SMP_ERROR_NOT_FOUND;
+
+    dequeue_pos = atomic_load(&thread->dequeue_pos);
+    enqueue_pos = atomic_load(&thread->enqueue_pos);
+
+    stats->queue_size = thread->mask + 1;
+    stats->queue_depth = enqueue_pos - dequeue_pos;
+    stats->high_water = atomic_load(&thread->high_water);
+    stats->n_queued = atomic_load(&thread->n_queued);
+    stats->n_written = atomic_load(&thread->n_written);
+    stats->n_overflows = atomic_load(&thread->n_overflows);
+    stats->n_write_errors = atomic_load(&thread->n_write_errors);
+
+    return 0;
+}
@@ -0,0 +1,329 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBTUP_PRIVATE_H
+#define LIBTUP_PRIVATE_H
+
+#include "libtup.h"
+
+/* the Arduino library comes with a configuration generated by
+ * scripts/export-arduino-lib.py */
+#ifdef ARDUINO
+#include "libtup-config.h"
+#endif
+
+/* optional subsystems, all built unless the configuration disables them.
+ * The API of a disabled subsystem is not available. */
+#ifndef TUP_ENABLE_STATS
+#define TUP_ENABLE_STATS 1
+#endif
+
+#ifndef TUP_ENABLE_SHADOW
+#define TUP_ENABLE_SHADOW 1
+#endif
+
+#ifndef TUP_ENABLE_COALESCING
+#define TUP_ENABLE_COALESCING 1
+#endif
+
+#ifndef TUP_ENABLE_HANDLERS
+#define TUP_ENABLE_HANDLERS 1
+#endif
+
+/* batches, write combining and write buffers */
+#ifndef TUP_ENABLE_BATCH
+#define TUP_ENABLE_BATCH 1
+#endif
+
+#ifndef TUP_ENABLE_PEEPHOLE
+#define TUP_ENABLE_PEEPHOLE 1
+#endif
+
+#ifndef TUP_ENABLE_TRANSPORT
+#define TUP_ENABLE_TRANSPORT 1
+#endif
+
+/* both serialize frames in the write buffer */
+#if TUP_ENABLE_PEEPHOLE && !TUP_ENABLE_BATCH
+#error "TUP_ENABLE_PEEPHOLE requires TUP_ENABLE_BATCH"
+#endif
+
+#if TUP_ENABLE_TRANSPORT && !TUP_ENABLE_BATCH
+#error "TUP_ENABLE_TRANSPORT requires TUP_ENABLE_BATCH"
+#endif
+
+typedef struct TupRequestTable TupRequestTable;
+typedef struct TupIoThread TupIoThread;
+typedef struct TupFrameDecoder TupFrameDecoder;
+typedef struct TupStats TupStats;
+typedef struct TupHandlerTable TupHandlerTable;
+typedef struct TupCoalescer TupCoalescer;
+typedef struct TupPeephole TupPeephole;
+typedef struct TupShadow TupShadow;
+typedef struct TupCapture TupCapture;
+
+typedef struct
+{
+    uint8_t *data;
+    size_t size;
+    size_t len;
+
+    /* write combining threshold, 0 if disabled */
+    size_t window;
+
+    /* NULL unless tup_context_enable_peephole() */
+    TupPeephole *peephole;
+
+    /* set while a batch is built: frames are neither written nor recorded
+     * until the whole batch is serialized */
+    int hold;
+
+    /* frames of a batch decoded back for stats and shadow, or to be sent
+     * through SmpContext, NULL until used */
+    TupMessage *record_msg;
+
+    /* frames unescaped before being sent through SmpContext, NULL until
+     * used */
+    uint8_t *smp_buf;
+} TupWriteBuffer;
+
+/* libsmp serial frame delimiters */
+#define TUP_FRAME_START_BYTE 0x10
+#define TUP_FRAME_END_BYTE 0xFF
+#define TUP_FRAME_ESC_BYTE 0x1B
+
+/* biggest unescaped message accepted by the frame decoder */
+#define TUP_FRAME_MAX_MESSAGE_SIZE 1024
+
+/* values of a message created by tup_message_new(), enough for the biggest
+ * message: a debug system status with TUP_DECODED_MAX_ARGS tasks of 6
+ * values. Configurations talking to a device with a few known messages can
+ * set it lower */
+#ifndef TUP_MESSAGE_MAX_VALUES
+#define TUP_MESSAGE_MAX_VALUES (3 + 6 * TUP_DECODED_MAX_ARGS)
+#endif
+
+/* storage of a message created by tup_message_new(), libsmp builds the
+ * message in place so the SmpMessage is at the start of the block */
+typedef struct
+{
+    SmpStaticMessage smsg;
+    SmpValue values[TUP_MESSAGE_MAX_VALUES];
+} TupMessageStorage;
+
+/* storage of the SmpContext of a context created by tup_context_new() */
+#define TUP_CONTEXT_SERIAL_RX_BUFSIZE TUP_FRAME_MAX_MESSAGE_SIZE
+#define TUP_CONTEXT_SERIAL_TX_BUFSIZE (2 * TUP_FRAME_MAX_MESSAGE_SIZE + 4)
+#define TUP_CONTEXT_MSG_TX_BUFSIZE TUP_FRAME_MAX_MESSAGE_SIZE
+
+struct TupTransport
+{
+    const TupTransportOps *ops;
+    void *priv;
+};
+
+struct TupContext
+{
+    SmpContext *smp_ctx;
+
+    TupCallbacks cbs;
+    void *userdata;
+
+    /* set when the context storage is provided by the user */
+    int is_static;
+
+    /* in-flight requests, NULL until tup_context_set_request_window() */
+    TupRequestTable *requests;
+
+    /* threaded mode, NULL unless tup_context_start_io_thread() */
+    TupIoThread *io_thread;
+
+    /* serialized frames, NULL until first batch or write combining */
+    TupWriteBuffer *wbuf;
+
+    /* set when created with tup_context_new_with_transport(), smp_ctx is
+     * NULL then */
+    TupTransport *transport;
+    TupFrameDecoder *decoder;
+
+    /* NULL until tup_context_enable_stats() */
+    TupStats *stats;
+
+    /* per type handlers, NULL until the first one is set */
+    TupHandlerTable *handlers;
+
+    /* pending updates, NULL until tup_context_enable_coalescing() */
+    TupCoalescer *coalescer;
+
+    /* known device state, NULL until tup_context_enable_shadow() */
+    TupShadow *shadow;
+
+    /* traffic recording, NULL until tup_context_start_capture() */
+    TupCapture *capture;
+};
+
+/* alloc.c */
+
+/* alignment of data shared between threads or walked in the hot path */
+#define TUP_CACHELINE_SIZE 64
+
+void *tup_malloc(size_t size);
+void *tup_calloc(size_t n, size_t size);
+void *tup_realloc(void *ptr, size_t size);
+void tup_free(void *ptr);
+void *tup_malloc_aligned(size_t alignment, size_t size);
+void tup_free_aligned(void *ptr);
+
+/* timing.c */
+uint64_t tup_get_time_ns(void);
+uint32_t tup_get_time_ms(void);
+
+/* context.c */
+void tup_context_dispatch_message(TupContext *ctx, TupMessage *message);
+void tup_context_dispatch_local_message(TupContext *ctx, TupMessage *message);
+void tup_context_dispatch_error(TupContext *ctx, SmpError error);
+int tup_context_process_input(TupContext *ctx);
+int tup_context_send_message(TupContext *ctx, TupMessage *msg, int optimize);
+
+/* batch.c */
+int tup_context_write_raw(TupContext *ctx, const uint8_t *data, size_t size);
+int tup_write_buffer_ensure(TupContext *ctx);
+int tup_write_buffer_append(TupContext *ctx, TupMessage *msg);
+int tup_write_buffer_send(TupContext *ctx, TupMessage *msg, int optimize);
+int tup_write_buffer_append_frame(TupContext *ctx, const uint8_t *frame,
+        size_t size);
+void tup_write_buffer_free(TupWriteBuffer *wbuf);
+
+/* frame.c */
+typedef struct
+{
+    uint8_t *buf;
+    size_t size;
+    size_t offset;
+    uint8_t crc;
+
+    /* set to write the message without framing, see tup_frame_serialize() */
+    int raw;
+} TupFrameWriter;
+
+void tup_frame_writer_init(TupFrameWriter *writer, uint8_t *buf, size_t size);
+void tup_frame_writer_put_le(TupFrameWriter *writer, uint64_t value,
+        size_t size);
+void tup_frame_writer_put_data(TupFrameWriter *writer, const uint8_t *data,
+        size_t size);
+void tup_frame_writer_put_value(TupFrameWriter *writer,
+        const SmpValue *value);
+int tup_frame_writer_finish(TupFrameWriter *writer);
+size_t tup_frame_get_value_size(const SmpValue *value);
+int tup_frame_get_payload_size(TupMessage *message);
+int tup_frame_encode(TupMessage *message, uint8_t *buf, size_t size);
+int tup_frame_serialize(TupMessage *message, uint8_t *buf, size_t size,
+        size_t *offsets);
+size_t tup_frame_wrap(const uint8_t *data, size_t size, uint8_t crc,
+        uint8_t *frame);
+int tup_frame_parse(TupMessage *message, const uint8_t *data, size_t size);
+size_t tup_frame_get_size(const uint8_t *data, size_t size);
+int tup_frame_decode(TupMessage *message, const uint8_t *frame, size_t size,
+        uint8_t *buf, size_t buf_size);
+TupFrameDecoder *tup_frame_decoder_new(void);
+void tup_frame_decoder_free(TupFrameDecoder *decoder);
+void tup_frame_decoder_reset(TupFrameDecoder *decoder);
+void tup_frame_decoder_feed(TupFrameDecoder *decoder, TupContext *ctx,
+        const uint8_t *data, size_t size);
+
+/* message.c */
+TupMessage *tup_message_new_in(TupMessageStorage *storage);
+int tup_message_encode_frame(uint8_t *buf, size_t size,
+        TupMessageType type, const void *const *fields, const void *groups,
+        size_t n_groups);
+
+/* request.c */
+TupMessageType tup_request_get_response_type(TupMessageType cmd);
+void tup_request_table_free(TupRequestTable *table);
+int tup_request_table_handle_message(TupContext *ctx, TupMessage *message);
+void tup_request_table_cancel_all(TupContext *ctx, TupRequestStatus status);
+
+/* stats.c */
+void tup_stats_free(TupStats *stats);
+void tup_stats_record_tx(TupContext *ctx, TupMessage *msg);
+void tup_stats_record_tx_frame(TupContext *ctx, TupMessageType cmd,
+        size_t payload_size);
+void tup_stats_record_rx(TupContext *ctx, TupMessage *msg);
+void tup_stats_record_error(TupContext *ctx, SmpError error);
+
+/* transport.c */
+int tup_transport_open(TupTransport *transport, const char *device);
+void tup_transport_close(TupTransport *transport);
+int tup_transport_read(TupTransport *transport, uint8_t *buf, size_t size);
+int tup_transport_write(TupTransport *transport, const uint8_t *data,
+        size_t size);
+int tup_transport_poll(TupTransport *transport, int timeout_ms);
+intptr_t tup_transport_get_fd(TupTransport *transport);
+int tup_transport_set_config(TupTransport *transport,
+        SmpSerialBaudrate baudrate, SmpSerialParity parity, int flow_control);
+
+/* handler.c */
+void tup_handler_table_free(TupHandlerTable *table);
+int tup_handler_table_handle_message(TupContext *ctx, TupMessage *message);
+
+/* peephole.c */
+
+/* maximum number of values in a merged message */
+#define TUP_PEEPHOLE_MAX_VALUES 16
+
+/* number of (id, value) pairs of an update with n_args arguments, the first
+ * argument being the effect or slot id */
+#define TUP_PEEPHOLE_N_VALUES(n_args) (((n_args) - 1) / 2)
+
+int tup_peephole_get_update_key(TupMessage *msg, uint8_t *id,
+        uint8_t *sub_id);
+void tup_peephole_free(TupPeephole *peephole);
+void tup_peephole_reset(TupPeephole *peephole);
+int tup_peephole_push(TupContext *ctx, TupMessage *msg);
+int tup_peephole_flush(TupContext *ctx);
+
+/* coalesce.c */
+void tup_coalescer_free(TupCoalescer *coalescer);
+void tup_coalescer_set_config(TupCoalescer *coalescer,
+        SmpSerialBaudrate baudrate, SmpSerialParity parity);
+int tup_coalescer_send(TupContext *ctx, TupMessage *msg);
+int tup_coalescer_drain(TupContext *ctx, int all);
+int tup_coalescer_is_pending(TupContext *ctx, TupMessage *msg);
+int tup_coalescer_get_timeout(TupContext *ctx);
+
+/* shadow.c */
+void tup_shadow_free(TupShadow *shadow);
+void tup_shadow_record_tx(TupContext *ctx, TupMessage *msg);
+void tup_shadow_handle_message(TupContext *ctx, TupMessage *msg);
+int tup_shadow_send(TupContext *ctx, TupMessage *msg);
+
+/* capture.c */
+int tup_capture_free(TupCapture *capture);
+void tup_capture_record_frames(TupCapture *capture,
+        TupCaptureDirection direction, const uint8_t *data, size_t size);
+void tup_capture_record_message(TupCapture *capture,
+        TupCaptureDirection direction, TupMessage *msg);
+
+/* io-thread.c */
+int tup_io_thread_push(TupIoThread *thread, TupMessage *msg);
+int tup_io_thread_push_batch(TupIoThread *thread, TupMessage **msgs,
+        size_t n);
+int tup_io_thread_push_frames(TupIoThread *thread, const uint8_t *data,
+        size_t size);
+int tup_io_thread_stop(TupIoThread *thread);
+
+#endif
@@ -0,0 +1,386 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * \defgroup pool Message pool
+ *
+ * Recycling of TupMessage objects.
+ *
+ * A TupMessagePool builds its messages once, when created, in a single
+ * block where each message starts on its own cache line, and keeps the
+ * released ones in a free list so acquiring and releasing a message are
+ * constant time and don't allocate. Released messages are cleared.
+ *
+ * When every message is in use, a new one is allocated and the exhaustion
+ * is counted in the pool statistics. Such a message is freed once released.
+ *
+ * On Linux the free list is locked so threads can share a pool. A thread
+ * acquiring and releasing many messages can use a TupMessagePoolCache: it
+ * keeps messages for its own use, without locking, and moves them from and
+ * to the pool in batches. Messages held by caches count as in use in the
+ * pool statistics, and acquires made from a cache are only counted when
+ * it next reaches the pool.
+ */
+
+#ifndef TUP_ENABLE_STATIC_API
+#define TUP_ENABLE_STATIC_API
+#endif
+
+#include "libtup-private.h"
+#include <stdlib.h>
+
+#ifdef HAVE_IO_THREAD
+#include <pthread.h>
+#endif
+
+struct TupMessagePool
+{
+    /* messages storage, one every stride bytes */
+    uint8_t *storage;
+    size_t stride;
+    size_t size;
+
+    /* free list, used as a stack */
+    TupMessage **free_msgs;
+    size_t n_free;
+
+    TupMessagePoolStats stats;
+
+#ifdef HAVE_IO_THREAD
+    pthread_mutex_t lock;
+#endif
+};
+
+struct TupMessagePoolCache
+{
+    TupMessagePool *pool;
+
+    /* messages kept for the owner thread, used as a stack */
+    TupMessage **msgs;
+    size_t n_msgs;
+    size_t size;
+
+    /* acquires not counted in the pool statistics yet */
+    uint64_t n_acquired;
+};
+
+static void tup_message_pool_lock(TupMessagePool *pool)
+{
+#ifdef HAVE_IO_THREAD
+    pthread_mutex_lock(&pool->lock);
+#endif
+}
+
+static void tup_message_pool_unlock(TupMessagePool *pool)
+{
+#ifdef HAVE_IO_THREAD
+    pthread_mutex_unlock(&pool->lock);
+#endif
+}
+
+static int tup_message_pool_owns(TupMessagePool *pool, TupMessage *msg)
+{
+    const uint8_t *addr = msg;
+
+    return addr >= pool->storage
+        && addr < pool->storage + pool->size * pool->stride;
+}
+
+/* take up to n messages, allocating one if none is free, and count n_acquired
+ * acquires. Return the number of messages taken */
+static size_t tup_message_pool_take(TupMessagePool *pool, TupMessage **msgs,
+        size_t n, uint64_t n_acquired)
+{
+    size_t n_taken;
+
+    tup_message_pool_lock(pool);
+
+    for (n_taken = 0; n_taken < n && pool->n_free > 0; n_taken++)
+        msgs[n_taken] = pool->free_msgs[--pool->n_free];
+
+    if (n_taken == 0) {
+        tup_message_pool_unlock(pool);
+
+        msgs[0] = tup_message_new();
+        if (msgs[0] == NULL)
+            return 0;
+
+        tup_message_pool_lock(pool);
+        pool->stats.n_exhausted++;
+        n_taken = 1;
+    }
+
+    pool->stats.n_acquired += n_acquired;
+    pool->stats.n_in_use += n_taken;
+    if (pool->stats.n_in_use > pool->stats.high_water)
+        pool->stats.high_water = pool->stats.n_in_use;
+
+    tup_message_pool_unlock(pool);
+    return n_taken;
+}
+
+/* give back n cleared messages and count n_acquired acquires */
+static void tup_message_pool_give(TupMessagePool *pool, TupMessage **msgs,
+        size_t n, uint64_t n_acquired)
+{
+    size_t i;
+
+    /* messages allocated on exhaustion don't stay */
+    for (i = 0; i < n; i++) {
+        if (!tup_message_pool_owns(pool, msgs[i])) {
+            tup_message_free(msgs[i]);
+            msgs[i] = NULL;
+        }
+    }
+
+    tup_message_pool_lock(pool);
+
+    for (i = 0; i < n; i++) {
+        if (msgs[i] != NULL)
+            pool->free_msgs[pool->n_free++] = msgs[i];
+    }
+
+    pool->stats.n_acquired += n_acquired;
+    pool->stats.n_in_use -= (n < pool->stats.n_in_use)
+        ? n : pool->stats.n_in_use;
+
+    tup_message_pool_unlock(pool);
+}
+
+/**
+ * \ingroup pool
+ * Create a new TupMessagePool holding size messages.
+ *
+ * @param[in] size the number of messages to allocate
+ *
+ * @return a new TupMessagePool or NULL on error.
+ */
+TupMessagePool *tup_message_pool_new(size_t size)
+{
+    TupMessagePool *pool;
+    size_t i;
+
+    if (size == 0)
+        return NULL;
+
+    pool = tup_calloc(1, sizeof(TupMessagePool));
+    if (pool == NULL)
+        return NULL;
+
+    /* no message shares a cache line with another one */
+    pool->stride = (sizeof(TupMessageStorage) + TUP_CACHELINE_SIZE - 1)
+        & ~(size_t) (TUP_CACHELINE_SIZE - 1);
+    if (size > SIZE_MAX / pool->stride)
+        goto storage_failed;
+
+    pool->storage = tup_malloc_aligned(TUP_CACHELINE_SIZE,
+            size * pool->stride);
+    if (pool->storage == NULL)
+        goto storage_failed;
+
+    pool->free_msgs = tup_malloc(size * sizeof(TupMessage *));
+    if (pool->free_msgs == NULL)
+        goto free_msgs_failed;
+
+    pool->size = size;
+
+    /* the first message is acquired first */
+    for (i = size; i > 0; i--) {
+        TupMessage *msg;
+
+        msg = tup_message_new_in((TupMessageStorage *)
+                (pool->storage + (i - 1) * pool->stride));
+        if (msg == NULL)
+            goto msg_failed;
+
+        pool->free_msgs[pool->n_free++] = msg;
+    }
+
+#ifdef HAVE_IO_THREAD
+    pthread_mutex_init(&pool->lock, NULL);
+#endif
+
+    pool->stats.size = size;
+    return pool;
+
+msg_failed:
+    tup_free(pool->free_msgs);
+free_msgs_failed:
+    tup_free_aligned(pool->storage);
+storage_failed:
+    tup_free(pool);
+    return NULL;
+}
+
+/**
+ * \ingroup pool
+ * Free a TupMessagePool and the messages it holds. Its caches shall have
+ * been freed and its messages released before.
+ *
+ * @param[in] pool the TupMessagePool to free
+ */
+void tup_message_pool_free(TupMessagePool *pool)
+{
+#ifdef HAVE_IO_THREAD
+    pthread_mutex_destroy(&pool->lock);
+#endif
+
+    tup_free(pool->free_msgs);
+    tup_free_aligned(pool->storage);
+    tup_free(pool);
+}
+
+/**
+ * \ingroup pool
+ * Take a cleared message from the pool.
+ *
+ * @param[in] pool the TupMessagePool
+ *
+ * @return a TupMessage or NULL on error.
+ */
+TupMessage *tup_message_pool_acquire(TupMessagePool *pool)
+{
+    TupMessage *msg;
+
+    if (tup_message_pool_take(pool, &msg, 1, 1) == 0)
+        return NULL;
+
+    return msg;
+}
+
+/**
+ * \ingroup pool
+ * Give a message back to the pool.
+ *
+ * @param[in] pool the TupMessagePool
+ * @param[in] msg a TupMessage acquired from pool or one of its caches
+ */
+void tup_message_pool_release(TupMessagePool *pool, TupMessage *msg)
+{
+    tup_message_clear(msg);
+    tup_message_pool_give(pool, &msg, 1, 0);
+}
+
+/**
+ * \ingroup pool
+ * Get the statistics of a pool.
+ *
+ * @param[in] pool the TupMessagePool
+ * @param[out] stats the statistics
+ */
+void tup_message_pool_get_stats(TupMessagePool *pool,
+        TupMessagePoolStats *stats)
+{
+    tup_message_pool_lock(pool);
+    *stats = pool->stats;
+    tup_message_pool_unlock(pool);
+}
+
+/**
+ * \ingroup pool
+ * Create a cache of a pool, to be used by a single thread. It is filled
+ * with half its size when empty and gives half of it back when full.
+ *
+ * @param[in] pool the TupMessagePool
+ * @param[in] size the number of messages the cache can keep, at least 2
+ *
+ * @return a new TupMessagePoolCache or NULL on error.
+ */
+TupMessagePoolCache *tup_message_pool_cache_new(TupMessagePool *pool,
+        size_t size)
+{
+    TupMessagePoolCache *cache;
+
+    if (size < 2)
+        return NULL;
+
+    cache = tup_calloc(1, sizeof(TupMessagePoolCache));
+    if (cache == NULL)
+        return NULL;
+
+    cache->msgs = tup_malloc(size * sizeof(TupMessage *));
+    if (cache->msgs == NULL) {
+        tup_free(cache);
+        return NULL;
+    }
+
+    cache->pool = pool;
+    cache->size = size;
+    return cache;
+}
+
+/**
+ * \ingroup pool
+ * Give the messages of a cache back to its pool and free it.
+ *
+ * @param[in] cache the TupMessagePoolCache to free
+ */
+void tup_message_pool_cache_free(TupMessagePoolCache *cache)
+{
+    tup_message_pool_give(cache->pool, cache->msgs, cache->n_msgs,
+            cache->n_acquired);
+
+    tup_free(cache->msgs);
+    tup_free(cache);
+}
+
+/**
+ * \ingroup pool
+ * Take a cleared message from a cache, refilling it from its pool if it is
+ * empty.
+ *
+ * @param[in] cache the TupMessagePoolCache
+ *
+ * @return a TupMessage or NULL on error.
+ */
+TupMessage *tup_message_pool_cache_acquire(TupMessagePoolCache *cache)
+{
+    if (cache->n_msgs == 0) {
+        cache->n_msgs = tup_message_pool_take(cache->pool, cache->msgs,
+                cache->size / 2, cache->n_acquired);
+        if (cache->n_msgs == 0)
+            return NULL;
+
+        cache->n_acquired = 0;
+    }
+
+    cache->n_acquired++;
+    return cache->msgs[--cache->n_msgs];
+}
+
+/**
+ * \ingroup pool
+ * Give a message back to a cache, moving half of the cache to its pool if it
+ * is full.
+ *
+ * @param[in] cache the TupMessagePoolCache
+ * @param[in] msg a TupMessage acquired from the pool of cache or one of its
+ *                caches
+ */
+void tup_message_pool_cache_release(TupMessagePoolCache *cache,
+        TupMessage *msg)
+{
+    if (cache->n_msgs == cache->size) {
+        cache->n_msgs -= cache->size / 2;
+        tup_message_pool_give(cache->pool, cache->msgs + cache->n_msgs,
+                cache->size / 2, cache->n_acquired);
+        cache->n_acquired = 0;
+    }
+
+    tup_message_clear(msg);
+    cache->msgs[cache->n_msgs++] = msg;
+}
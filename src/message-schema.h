@@ -0,0 +1,78 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MESSAGE_SCHEMA_H
+#define MESSAGE_SCHEMA_H
+
+/* Arguments of every TUP message.
+ *
+ * X(id, fixed, group, layout)
+ *  - id: the TupMessageType without its TUP_MESSAGE_ prefix
+ *  - fixed: the arguments at the beginning of the message
+ *  - group: the arguments repeated until the end of the message, "" if none
+ *  - layout: the C structure holding a repeated group, see message.c
+ *
+ * Each argument is a code giving its type on the wire and the C type it is
+ * stored in:
+ *  - 'B': uint8, uint8_t
+ *  - 'b': uint8, bool
+ *  - 'e': uint8, an enum or an unsigned int
+ *  - 'H': uint16, uint16_t
+ *  - 'I': uint32, uint32_t
+ *  - 'E': uint32, an enum or an unsigned int
+ *  - 'i': int32, int32_t
+ *  - 'Q': uint64, uint64_t
+ *  - 'f': f32, float
+ *  - 's': string, const char *
+ *
+ * In fixed arguments, a digit before a code repeats it over an array. */
+#define TUP_MESSAGE_SCHEMA(X) \
+    X(ACK,                              "EI",       "",         none) \
+    X(ERROR,                            "EII",      "",         none) \
+    X(CMD_LOAD,                         "BH",       "",         none) \
+    X(CMD_PLAY,                         "B",        "",         none) \
+    X(CMD_STOP,                         "B",        "",         none) \
+    X(CMD_GET_VERSION,                  "",         "",         none) \
+    X(CMD_GET_PARAMETER,                "B",        "B",        id) \
+    X(CMD_SET_PARAMETER,                "B",        "BI",       parameter) \
+    X(CMD_BIND_EFFECT,                  "Be",       "",         none) \
+    X(CMD_GET_SENSOR_VALUE,             "",         "B",        id) \
+    X(CMD_SET_SENSOR_VALUE,             "",         "BH",       sensor) \
+    X(CMD_GET_BUILDINFO,                "",         "",         none) \
+    X(CMD_ACTIVATE_INTERNAL_SENSORS,    "B",        "",         none) \
+    X(CMD_GET_INPUT_VALUE,              "B",        "B",        id) \
+    X(CMD_SET_INPUT_VALUE,              "B",        "Bi",       input) \
+    X(CMD_FILTER_GET_ACTIVE,            "eB",       "",         none) \
+    X(CMD_FILTER_SET_ACTIVE,            "eBb",      "",         none) \
+    X(CMD_CONFIG_WRITE,                 "",         "",         none) \
+    X(CMD_CONFIG_BAND_NORM_GET_COEFFS,  "B",        "",         none) \
+    X(CMD_CONFIG_BAND_NORM_SET_COEFFS,  "B5f5f",    "",         none) \
+    X(RESP_VERSION,                     "s",        "",         none) \
+    X(RESP_PARAMETER,                   "B",        "BI",       parameter) \
+    X(RESP_SENSOR,                      "",         "BH",       sensor) \
+    X(RESP_BUILDINFO,                   "s",        "",         none) \
+    X(RESP_INPUT,                       "B",        "Bi",       input) \
+    X(RESP_SET_PARAMETER,               "Bi",       "BI",       parameter) \
+    X(RESP_FILTER_ACTIVE,               "eBb",      "",         none) \
+    X(RESP_BAND_NORM_COEFFS,            "B5f5f",    "",         none) \
+    X(CMD_DEBUG_GET_SYSTEM_STATUS,      "",         "",         none) \
+    X(RESP_DEBUG_SYSTEM_STATUS,         "QII",      "IseIQI",   task)
+
+/* biggest repeated group */
+#define TUP_MESSAGE_GROUP_MAX_ARGS 6
+
+#endif
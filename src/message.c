@@ -25,20 +25,682 @@
 #define TUP_ENABLE_STATIC_API
 #endif
 
-#include "libtup.h"
+#include "libtup-private.h"
+#include "message-schema.h"
 #include <errno.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_IO_THREAD
+#include <pthread.h>
+#endif
+
+/* storage of a message created by tup_message_new(). Such messages are
+ * linked together so tup_message_free() can tell them from static, pooled
+ * or foreign messages, which it leaves alone */
+typedef struct TupHeapMessage
+{
+    TupMessageStorage storage;
+    TupMessage *message;
+    struct TupHeapMessage *prev;
+    struct TupHeapMessage *next;
+} TupHeapMessage;
+
+static TupHeapMessage *tup_heap_messages;
+
+#ifdef HAVE_IO_THREAD
+static pthread_mutex_t tup_heap_messages_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* where the arguments of a repeated group are stored in its C structure */
+typedef struct
+{
+    size_t stride;
+    size_t offsets[TUP_MESSAGE_GROUP_MAX_ARGS];
+} TupMessageGroupLayout;
+
+typedef struct
+{
+    const char *name;
+    const char *fixed;
+    const char *group;
+    const TupMessageGroupLayout *layout;
+} TupMessageSchema;
+
+static const TupMessageGroupLayout tup_group_none = { 0, { 0 } };
+
+static const TupMessageGroupLayout tup_group_id = { sizeof(uint8_t), { 0 } };
+
+static const TupMessageGroupLayout tup_group_parameter = {
+    sizeof(TupParameterArgs), {
+        offsetof(TupParameterArgs, parameter_id),
+        offsetof(TupParameterArgs, parameter_value),
+    }
+};
+
+static const TupMessageGroupLayout tup_group_sensor = {
+    sizeof(TupSensorValueArgs), {
+        offsetof(TupSensorValueArgs, sensor_id),
+        offsetof(TupSensorValueArgs, sensor_value),
+    }
+};
+
+static const TupMessageGroupLayout tup_group_input = {
+    sizeof(TupInputValueArgs), {
+        offsetof(TupInputValueArgs, input_id),
+        offsetof(TupInputValueArgs, input_value),
+    }
+};
+
+static const TupMessageGroupLayout tup_group_task = {
+    sizeof(TupDebugTaskStatus), {
+        offsetof(TupDebugTaskStatus, id),
+        offsetof(TupDebugTaskStatus, name),
+        offsetof(TupDebugTaskStatus, state),
+        offsetof(TupDebugTaskStatus, priority),
+        offsetof(TupDebugTaskStatus, time),
+        offsetof(TupDebugTaskStatus, rem_stack),
+    }
+};
+
+enum
+{
+#define TUP_SCHEMA_INDEX(id, fixed, group, layout) TUP_SCHEMA_##id,
+    TUP_MESSAGE_SCHEMA(TUP_SCHEMA_INDEX)
+#undef TUP_SCHEMA_INDEX
+};
+
+static const TupMessageSchema tup_message_schemas[] = {
+#define TUP_SCHEMA_ENTRY(id, fixed, group, layout) \
+    { #id, fixed, group, &tup_group_##layout },
+    TUP_MESSAGE_SCHEMA(TUP_SCHEMA_ENTRY)
+#undef TUP_SCHEMA_ENTRY
+};
+
+static const TupMessageSchema *tup_message_schema_lookup(int type)
+{
+    switch (type) {
+#define TUP_SCHEMA_CASE(id, fixed, group, layout) \
+        case TUP_MESSAGE_##id: \
+            return &tup_message_schemas[TUP_SCHEMA_##id];
+        TUP_MESSAGE_SCHEMA(TUP_SCHEMA_CASE)
+#undef TUP_SCHEMA_CASE
+        default:
+            return NULL;
+    }
+}
+
+static SmpType tup_message_arg_smp_type(char code)
+{
+    switch (code) {
+        case 'B':
+        case 'b':
+        case 'e':
+            return SMP_TYPE_UINT8;
+        case 'H':
+            return SMP_TYPE_UINT16;
+        case 'I':
+        case 'E':
+            return SMP_TYPE_UINT32;
+        case 'i':
+            return SMP_TYPE_INT32;
+        case 'Q':
+            return SMP_TYPE_UINT64;
+        case 'f':
+            return SMP_TYPE_F32;
+        case 's':
+            return SMP_TYPE_STRING;
+        default:
+            return SMP_TYPE_NONE;
+    }
+}
+
+/* size of an argument once serialized, with its type. Strings are counted
+ * empty */
+static size_t tup_message_arg_size(char code)
+{
+    switch (tup_message_arg_smp_type(code)) {
+        case SMP_TYPE_UINT8:
+            return 1 + 1;
+        case SMP_TYPE_UINT16:
+            return 1 + 2;
+        case SMP_TYPE_UINT32:
+        case SMP_TYPE_INT32:
+        case SMP_TYPE_F32:
+            return 1 + 4;
+        case SMP_TYPE_UINT64:
+            return 1 + 8;
+        case SMP_TYPE_STRING:
+            return 1 + 2 + 1;
+        default:
+            return 0;
+    }
+}
+
+/* only floats are repeated over arrays for now */
+static size_t tup_message_arg_c_size(char code)
+{
+    return code == 'f' ? sizeof(float) : 0;
+}
+
+/* return how many times the code pointed by codes is repeated and skip the
+ * repeat count */
+static int tup_message_arg_count(const char **codes)
+{
+    if (**codes >= '1' && **codes <= '9')
+        return *(*codes)++ - '0';
+
+    return 1;
+}
+
+static int tup_message_count_args(const char *codes)
+{
+    int n = 0;
+
+    for (; *codes != '\0'; codes++)
+        n += tup_message_arg_count(&codes);
+
+    return n;
+}
+
+/* return the code of the index-th argument of a message */
+static char tup_message_schema_get_code(const TupMessageSchema *schema,
+        int index)
+{
+    const char *codes;
+    int n;
+
+    for (codes = schema->fixed; *codes != '\0'; codes++) {
+        n = tup_message_arg_count(&codes);
+        if (index < n)
+            return *codes;
+
+        index -= n;
+    }
+
+    if (schema->group[0] == '\0')
+        return '\0';
+
+    return schema->group[index % strlen(schema->group)];
+}
+
+/* load the argument stored in field into value */
+static int tup_message_load_arg(char code, const void *field, SmpValue *value)
+{
+    value->type = tup_message_arg_smp_type(code);
+
+    switch (code) {
+        case 'B':
+            value->value.u8 = *(const uint8_t *) field;
+            break;
+        case 'b':
+            value->value.u8 = *(const bool *) field ? 1 : 0;
+            break;
+        case 'e':
+            value->value.u8 = *(const unsigned int *) field;
+            break;
+        case 'H':
+            value->value.u16 = *(const uint16_t *) field;
+            break;
+        case 'I':
+            value->value.u32 = *(const uint32_t *) field;
+            break;
+        case 'E':
+            value->value.u32 = *(const unsigned int *) field;
+            break;
+        case 'i':
+            value->value.i32 = *(const int32_t *) field;
+            break;
+        case 'Q':
+            value->value.u64 = *(const uint64_t *) field;
+            break;
+        case 'f':
+            value->value.f32 = *(const float *) field;
+            break;
+        case 's':
+            value->value.cstring = *(const char *const *) field;
+            break;
+        default:
+            return SMP_ERROR_INVALID_PARAM;
+    }
+
+    return 0;
+}
+
+static int tup_message_put_arg(TupMessage *message, int index, char code,
+        const void *field)
+{
+    SmpValue value;
+    int ret;
+
+    ret = tup_message_load_arg(code, field, &value);
+    if (ret < 0)
+        return ret;
+
+    return smp_message_set_value(message, index, &value);
+}
+
+/* field can be NULL to only check the argument */
+static int tup_message_get_arg(TupMessage *message, int index, char code,
+        void *field)
+{
+    SmpValue value;
+    int ret;
+
+    ret = smp_message_get_value(message, index, &value);
+    if (ret < 0)
+        return ret;
+
+    if (value.type != tup_message_arg_smp_type(code))
+        return SMP_ERROR_BAD_TYPE;
+
+    if (field == NULL)
+        return 0;
+
+    switch (code) {
+        case 'B':
+            *(uint8_t *) field = value.value.u8;
+            break;
+        case 'b':
+            *(bool *) field = (value.value.u8 > 0) ? true : false;
+            break;
+        case 'e':
+            *(unsigned int *) field = value.value.u8;
+            break;
+        case 'H':
+            *(uint16_t *) field = value.value.u16;
+            break;
+        case 'I':
+            *(uint32_t *) field = value.value.u32;
+            break;
+        case 'E':
+            *(unsigned int *) field = value.value.u32;
+            break;
+        case 'i':
+            *(int32_t *) field = value.value.i32;
+            break;
+        case 'Q':
+            *(uint64_t *) field = value.value.u64;
+            break;
+        case 'f':
+            *(float *) field = value.value.f32;
+            break;
+        case 's':
+            *(const char **) field = value.value.cstring;
+            break;
+        default:
+            return SMP_ERROR_INVALID_PARAM;
+    }
+
+    return 0;
+}
+
+/* set the arguments described by codes from fields, starting at index.
+ * Return the index following the last argument or a SmpError */
+static int tup_message_put_args(TupMessage *message, int index,
+        const char *codes, const void *const *fields)
+{
+    int n, k;
+    int ret;
+
+    for (; *codes != '\0'; codes++, fields++) {
+        n = tup_message_arg_count(&codes);
+
+        for (k = 0; k < n; k++) {
+            ret = tup_message_put_arg(message, index++, *codes,
+                    (const char *) *fields + k * tup_message_arg_c_size(*codes));
+            if (ret < 0)
+                return ret;
+        }
+    }
+
+    return index;
+}
+
+/* get the arguments described by codes into fields, starting at index.
+ * Return the index following the last argument or a SmpError */
+static int tup_message_get_args(TupMessage *message, int index,
+        const char *codes, void *const *fields)
+{
+    char *field;
+    int n, k;
+    int ret;
+
+    for (; *codes != '\0'; codes++, fields++) {
+        n = tup_message_arg_count(&codes);
+
+        for (k = 0; k < n; k++) {
+            field = *fields;
+            if (field != NULL)
+                field += k * tup_message_arg_c_size(*codes);
+
+            ret = tup_message_get_arg(message, index++, *codes, field);
+            if (ret < 0)
+                return ret;
+        }
+    }
+
+    return index;
+}
+
+/* point fields to the arguments of a repeated group */
+static void tup_message_get_group_fields(const TupMessageSchema *schema,
+        const void *group, const void **fields)
+{
+    size_t n_args = strlen(schema->group);
+    size_t i;
+
+    for (i = 0; i < n_args; i++)
+        fields[i] = (const char *) group + schema->layout->offsets[i];
+}
+
+/* set the index-th repeated group of a message */
+static int tup_message_write_group(TupMessage *message, TupMessageType type,
+        size_t index, const void *group)
+{
+    const TupMessageSchema *schema = tup_message_schema_lookup(type);
+    const void *fields[TUP_MESSAGE_GROUP_MAX_ARGS];
+    size_t n_args = strlen(schema->group);
+    int ret;
+
+    tup_message_get_group_fields(schema, group, fields);
+
+    ret = tup_message_put_args(message,
+            tup_message_count_args(schema->fixed) + index * n_args,
+            schema->group, fields);
+
+    return (ret < 0) ? ret : 0;
+}
+
+/* get the index-th repeated group of a message */
+static int tup_message_read_group(TupMessage *message, TupMessageType type,
+        size_t index, void *group)
+{
+    const TupMessageSchema *schema = tup_message_schema_lookup(type);
+    void *fields[TUP_MESSAGE_GROUP_MAX_ARGS];
+    size_t n_args = strlen(schema->group);
+    size_t i;
+    int ret;
+
+    if (smp_message_get_msgid(message) != type)
+        return SMP_ERROR_BAD_MESSAGE;
+
+    for (i = 0; i < n_args; i++)
+        fields[i] = (char *) group + schema->layout->offsets[i];
+
+    ret = tup_message_get_args(message,
+            tup_message_count_args(schema->fixed) + index * n_args,
+            schema->group, fields);
+
+    return (ret < 0) ? ret : 0;
+}
+
+/* initialize a message from the fixed arguments in fields followed by
+ * n_groups repeated groups */
+static int tup_message_write(TupMessage *message, TupMessageType type,
+        const void *const *fields, const void *groups, size_t n_groups)
+{
+    const TupMessageSchema *schema = tup_message_schema_lookup(type);
+    size_t i;
+    int ret;
+
+    smp_message_set_id(message, type);
+
+    ret = tup_message_put_args(message, 0, schema->fixed, fields);
+    if (ret < 0)
+        return ret;
+
+    for (i = 0; i < n_groups; i++) {
+        ret = tup_message_write_group(message, type, i,
+                (const char *) groups + i * schema->layout->stride);
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+/* parse a message into the fixed arguments in fields and its repeated
+ * groups into an array of size elements. Return the number of groups */
+static int tup_message_read(TupMessage *message, TupMessageType type,
+        void *const *fields, void *groups, size_t size)
+{
+    const TupMessageSchema *schema;
+    int n_groups;
+    int index;
+    int i;
+    int ret;
+
+    if (smp_message_get_msgid(message) != type)
+        return SMP_ERROR_BAD_MESSAGE;
+
+    schema = tup_message_schema_lookup(type);
+
+    index = tup_message_get_args(message, 0, schema->fixed, fields);
+    if (index < 0)
+        return index;
+
+    /* groups can be NULL to only get the fixed arguments */
+    if (schema->group[0] == '\0' || groups == NULL)
+        return 0;
+
+    /* a trailing incomplete group is ignored */
+    n_groups = (smp_message_n_args(message) - index)
+        / (int) strlen(schema->group);
+    if (size < (size_t) n_groups)
+        return SMP_ERROR_OVERFLOW;
+
+    for (i = 0; i < n_groups; i++) {
+        ret = tup_message_read_group(message, type, i,
+                (char *) groups + i * schema->layout->stride);
+        if (ret < 0)
+            return ret;
+    }
+
+    return n_groups;
+}
+
+/* write the arguments described by codes from fields, or only add their
+ * size to payload_size if writer is NULL */
+static int tup_message_encode_args(TupFrameWriter *writer, const char *codes,
+        const void *const *fields, size_t *payload_size)
+{
+    SmpValue value;
+    int n, k;
+    int ret;
+
+    for (; *codes != '\0'; codes++, fields++) {
+        n = tup_message_arg_count(&codes);
+
+        /* only strings need their value to be sized */
+        if (writer == NULL && *codes != 's') {
+            *payload_size += n * tup_message_arg_size(*codes);
+            continue;
+        }
+
+        for (k = 0; k < n; k++) {
+            ret = tup_message_load_arg(*codes,
+                    (const char *) *fields + k * tup_message_arg_c_size(*codes),
+                    &value);
+            if (ret < 0)
+                return ret;
+
+            if (writer != NULL)
+                tup_frame_writer_put_value(writer, &value);
+            else
+                *payload_size += 1 + tup_frame_get_value_size(&value);
+        }
+    }
+
+    return 0;
+}
+
+static int tup_message_encode_all(TupFrameWriter *writer,
+        const TupMessageSchema *schema, const void *const *fields,
+        const void *groups, size_t n_groups, size_t *payload_size)
+{
+    const void *group_fields[TUP_MESSAGE_GROUP_MAX_ARGS];
+    size_t i;
+    int ret;
+
+    ret = tup_message_encode_args(writer, schema->fixed, fields,
+            payload_size);
+    if (ret < 0)
+        return ret;
+
+    for (i = 0; i < n_groups; i++) {
+        tup_message_get_group_fields(schema,
+                (const char *) groups + i * schema->layout->stride,
+                group_fields);
+
+        ret = tup_message_encode_args(writer, schema->group, group_fields,
+                payload_size);
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+/* encode the frame of a message, given as for tup_message_write(), into buf
+ * without going through a TupMessage. Return the frame size or a SmpError */
+int tup_message_encode_frame(uint8_t *buf, size_t size,
+        TupMessageType type, const void *const *fields, const void *groups,
+        size_t n_groups)
+{
+    const TupMessageSchema *schema = tup_message_schema_lookup(type);
+    TupFrameWriter writer;
+    size_t payload_size = 0;
+    int ret;
+
+    if (schema == NULL || buf == NULL)
+        return SMP_ERROR_INVALID_PARAM;
+
+    ret = tup_message_encode_all(NULL, schema, fields, groups, n_groups,
+            &payload_size);
+    if (ret < 0)
+        return ret;
+
+    /* the message header and its arguments */
+    if (8 + payload_size > TUP_FRAME_MAX_MESSAGE_SIZE)
+        return SMP_ERROR_TOO_BIG;
+
+    tup_frame_writer_init(&writer, buf, size);
+    tup_frame_writer_put_le(&writer, type, 4);
+    tup_frame_writer_put_le(&writer, payload_size, 4);
+
+    ret = tup_message_encode_all(&writer, schema, fields, groups, n_groups,
+            &payload_size);
+    if (ret < 0)
+        return ret;
+
+    return tup_frame_writer_finish(&writer);
+}
+
+/* parse the fixed arguments of a message into fields and set iter to walk
+ * its repeated groups */
+static int tup_message_iter_init(TupMessageIter *iter, TupMessage *message,
+        TupMessageType type, void *const *fields)
+{
+    const TupMessageSchema *schema;
+    int index;
+
+    if (smp_message_get_msgid(message) != type)
+        return SMP_ERROR_BAD_MESSAGE;
+
+    schema = tup_message_schema_lookup(type);
+
+    index = tup_message_get_args(message, 0, schema->fixed, fields);
+    if (index < 0)
+        return index;
+
+    iter->message = message;
+    iter->type = type;
+    iter->index = 0;
+
+    /* a trailing incomplete group is ignored */
+    iter->n_groups = (smp_message_n_args(message) - index)
+        / strlen(schema->group);
+    return 0;
+}
+
+/* get the next repeated group. Return 1 if group is set, 0 at the end */
+static int tup_message_iter_next(TupMessageIter *iter, void *group)
+{
+    int ret;
+
+    if (iter->index >= iter->n_groups)
+        return 0;
+
+    ret = tup_message_read_group(iter->message, iter->type, iter->index,
+            group);
+    if (ret < 0)
+        return ret;
+
+    iter->index++;
+    return 1;
+}
+
+static void tup_heap_messages_lock_acquire(void)
+{
+#ifdef HAVE_IO_THREAD
+    pthread_mutex_lock(&tup_heap_messages_lock);
+#endif
+}
+
+static void tup_heap_messages_lock_release(void)
+{
+#ifdef HAVE_IO_THREAD
+    pthread_mutex_unlock(&tup_heap_messages_lock);
+#endif
+}
 
 /**
  * \ingroup message
- * Create a new TupMessage. Message shall be inititialize afterward
+ * Create a new TupMessage. Message shall be inititialize afterward. It can
+ * hold any message with up to TUP_DECODED_MAX_ARGS repeated groups and its
+ * storage comes from the allocator set with tup_set_allocator().
  *
  * @return a new TupMessage or NULL on error.
  */
 TupMessage *tup_message_new()
 {
-    return smp_message_new();
+    TupHeapMessage *heap_msg;
+    TupMessage *message;
+
+    heap_msg = tup_malloc(sizeof(*heap_msg));
+    if (heap_msg == NULL)
+        return NULL;
+
+    message = tup_message_new_in(&heap_msg->storage);
+    if (message == NULL) {
+        tup_free(heap_msg);
+        return NULL;
+    }
+
+    heap_msg->message = message;
+
+    tup_heap_messages_lock_acquire();
+
+    heap_msg->prev = NULL;
+    heap_msg->next = tup_heap_messages;
+    if (tup_heap_messages != NULL)
+        tup_heap_messages->prev = heap_msg;
+    tup_heap_messages = heap_msg;
+
+    tup_heap_messages_lock_release();
+
+    return message;
+}
+
+/* build a message in storage provided by libtup, the message starts the
+ * storage */
+TupMessage *tup_message_new_in(TupMessageStorage *storage)
+{
+    return smp_message_new_from_static(&storage->smsg, sizeof(storage->smsg),
+            storage->values, TUP_MESSAGE_MAX_VALUES);
 }
 
 /**
@@ -61,37 +723,371 @@ TupMessage *tup_message_new_from_static(TupStaticMessage *smsg,
 
 /**
  * \ingroup message
- * Free a previously allocated TupMessage.
+ * Free a TupMessage created by tup_message_new(). Messages with static
+ * storage, messages of a TupMessagePool and SmpMessage objects created
+ * elsewhere are not owned by libtup and are left untouched.
  *
  * @param[in] message the TupMessage.
  */
 void tup_message_free(TupMessage *message)
 {
-    return smp_message_free(message);
+    TupHeapMessage *heap_msg;
+
+    if (message == NULL)
+        return;
+
+    tup_heap_messages_lock_acquire();
+
+    for (heap_msg = tup_heap_messages; heap_msg != NULL;
+            heap_msg = heap_msg->next) {
+        if (heap_msg->message == message)
+            break;
+    }
+
+    if (heap_msg != NULL) {
+        if (heap_msg->prev != NULL)
+            heap_msg->prev->next = heap_msg->next;
+        else
+            tup_heap_messages = heap_msg->next;
+
+        if (heap_msg->next != NULL)
+            heap_msg->next->prev = heap_msg->prev;
+    }
+
+    tup_heap_messages_lock_release();
+
+    tup_free(heap_msg);
+}
+
+/**
+ * \ingroup message
+ * Clear a tup message.
+ *
+ * @param[in] message the TupMessage
+ */
+void tup_message_clear(TupMessage *message)
+{
+    smp_message_clear(message);
+}
+
+/**
+ * \ingroup message
+ * Get the type of a TupMessage.
+ *
+ * @param[in] message the TupMessage
+ *
+ * @return the message type as a TupMessageType.
+ */
+TupMessageType tup_message_get_type(TupMessage *message)
+{
+    return smp_message_get_msgid(message);
 }
 
-/**
- * \ingroup message
- * Clear a tup message.
- *
- * @param[in] message the TupMessage
- */
-void tup_message_clear(TupMessage *message)
-{
-    smp_message_clear(message);
+/**
+ * \ingroup message
+ * Get the layout of a message type.
+ *
+ * @param[in] type the TupMessageType
+ * @param[out] info the TupMessageInfo to fill
+ *
+ * @return 0 on success, SMP_ERROR_NOT_FOUND if type is unknown.
+ */
+int tup_message_type_get_info(TupMessageType type, TupMessageInfo *info)
+{
+    const TupMessageSchema *schema = tup_message_schema_lookup(type);
+    const char *codes;
+    int n;
+
+    if (schema == NULL)
+        return SMP_ERROR_NOT_FOUND;
+
+    info->name = schema->name;
+    info->n_fixed_args = tup_message_count_args(schema->fixed);
+    info->n_group_args = strlen(schema->group);
+
+    info->fixed_size = 0;
+    for (codes = schema->fixed; *codes != '\0'; codes++) {
+        n = tup_message_arg_count(&codes);
+        info->fixed_size += n * tup_message_arg_size(*codes);
+    }
+
+    info->group_size = 0;
+    for (codes = schema->group; *codes != '\0'; codes++)
+        info->group_size += tup_message_arg_size(*codes);
+
+    return 0;
+}
+
+/**
+ * \ingroup message
+ * Check a message against its schema and copy its arguments. Unlike the
+ * tup_message_parse_*() functions, trailing arguments which don't make a
+ * complete repeated group are an error.
+ *
+ * @param[in] message the TupMessage
+ * @param[out] values an array of SmpValue to hold the arguments (can be NULL)
+ * @param[in] size the size of values array
+ *
+ * @return the number of arguments on success, a SmpError otherwise.
+ */
+int tup_message_parse_values(TupMessage *message, SmpValue *values,
+        size_t size)
+{
+    const TupMessageSchema *schema;
+    SmpValue value;
+    int n_fixed_args;
+    int n_group_args;
+    int n_args;
+    int i;
+    int ret;
+
+    schema = tup_message_schema_lookup(smp_message_get_msgid(message));
+    if (schema == NULL)
+        return SMP_ERROR_BAD_MESSAGE;
+
+    n_args = smp_message_n_args(message);
+    n_fixed_args = tup_message_count_args(schema->fixed);
+    n_group_args = strlen(schema->group);
+
+    if (n_args < n_fixed_args)
+        return SMP_ERROR_BAD_MESSAGE;
+
+    if (n_group_args == 0 && n_args != n_fixed_args)
+        return SMP_ERROR_BAD_MESSAGE;
+
+    if (n_group_args != 0 && (n_args - n_fixed_args) % n_group_args != 0)
+        return SMP_ERROR_BAD_MESSAGE;
+
+    if (values != NULL && size < (size_t) n_args)
+        return SMP_ERROR_OVERFLOW;
+
+    for (i = 0; i < n_args; i++) {
+        ret = smp_message_get_value(message, i, &value);
+        if (ret < 0)
+            return ret;
+
+        if (value.type != tup_message_arg_smp_type(
+                    tup_message_schema_get_code(schema, i)))
+            return SMP_ERROR_BAD_TYPE;
+
+        if (values != NULL)
+            values[i] = value;
+    }
+
+    return n_args;
+}
+
+/* where the arguments of a message are stored in a TupDecoded. Offsets of
+ * 0 are unused, u is never at the beginning */
+typedef struct
+{
+    size_t fields[3];
+    size_t n_groups;
+    size_t groups;
+} TupDecodedLayout;
+
+#define TUP_DECODED(member) offsetof(TupDecoded, u.member)
+
+/* messages left out have no arguments */
+static const TupDecodedLayout tup_decoded_layouts[
+        sizeof(tup_message_schemas) / sizeof(tup_message_schemas[0])] = {
+    [TUP_SCHEMA_ACK] = {
+        { TUP_DECODED(ack.cmd), TUP_DECODED(ack.arg1) }, 0, 0
+    },
+    [TUP_SCHEMA_ERROR] = {
+        { TUP_DECODED(error.cmd), TUP_DECODED(error.error),
+            TUP_DECODED(error.arg1) }, 0, 0
+    },
+    [TUP_SCHEMA_CMD_LOAD] = {
+        { TUP_DECODED(load.effect_id), TUP_DECODED(load.bank_id) }, 0, 0
+    },
+    [TUP_SCHEMA_CMD_PLAY] = { { TUP_DECODED(play.effect_id) }, 0, 0 },
+    [TUP_SCHEMA_CMD_STOP] = { { TUP_DECODED(stop.effect_id) }, 0, 0 },
+    [TUP_SCHEMA_CMD_GET_PARAMETER] = {
+        { TUP_DECODED(get_parameter.effect_id) },
+        TUP_DECODED(get_parameter.n_parameters),
+        TUP_DECODED(get_parameter.parameter_ids)
+    },
+    [TUP_SCHEMA_CMD_SET_PARAMETER] = {
+        { TUP_DECODED(set_parameter.effect_id) },
+        TUP_DECODED(set_parameter.n_params),
+        TUP_DECODED(set_parameter.params)
+    },
+    [TUP_SCHEMA_CMD_BIND_EFFECT] = {
+        { TUP_DECODED(bind_effect.effect_id),
+            TUP_DECODED(bind_effect.binding_flags) }, 0, 0
+    },
+    [TUP_SCHEMA_CMD_GET_SENSOR_VALUE] = {
+        { 0 }, TUP_DECODED(get_sensor_value.n_sensors),
+        TUP_DECODED(get_sensor_value.sensor_ids)
+    },
+    [TUP_SCHEMA_CMD_SET_SENSOR_VALUE] = {
+        { 0 }, TUP_DECODED(set_sensor_value.n_args),
+        TUP_DECODED(set_sensor_value.args)
+    },
+    [TUP_SCHEMA_CMD_ACTIVATE_INTERNAL_SENSORS] = {
+        { TUP_DECODED(activate_internal_sensors.state) }, 0, 0
+    },
+    [TUP_SCHEMA_CMD_GET_INPUT_VALUE] = {
+        { TUP_DECODED(get_input_value.effect_slot_id) },
+        TUP_DECODED(get_input_value.n_inputs),
+        TUP_DECODED(get_input_value.input_ids)
+    },
+    [TUP_SCHEMA_CMD_SET_INPUT_VALUE] = {
+        { TUP_DECODED(set_input_value.effect_slot_id) },
+        TUP_DECODED(set_input_value.n_args),
+        TUP_DECODED(set_input_value.args)
+    },
+    [TUP_SCHEMA_CMD_FILTER_GET_ACTIVE] = {
+        { TUP_DECODED(filter_get_active.filter),
+            TUP_DECODED(filter_get_active.actuator_id) }, 0, 0
+    },
+    [TUP_SCHEMA_CMD_FILTER_SET_ACTIVE] = {
+        { TUP_DECODED(filter_set_active.filter),
+            TUP_DECODED(filter_set_active.actuator_id),
+            TUP_DECODED(filter_set_active.active) }, 0, 0
+    },
+    [TUP_SCHEMA_CMD_CONFIG_BAND_NORM_GET_COEFFS] = {
+        { TUP_DECODED(band_norm_get_coeffs.actuator_id) }, 0, 0
+    },
+    [TUP_SCHEMA_CMD_CONFIG_BAND_NORM_SET_COEFFS] = {
+        { TUP_DECODED(band_norm_set_coeffs.actuator_id),
+            TUP_DECODED(band_norm_set_coeffs.a),
+            TUP_DECODED(band_norm_set_coeffs.b) }, 0, 0
+    },
+    [TUP_SCHEMA_RESP_VERSION] = {
+        { TUP_DECODED(resp_version.version) }, 0, 0
+    },
+    [TUP_SCHEMA_RESP_PARAMETER] = {
+        { TUP_DECODED(resp_parameter.effect_id) },
+        TUP_DECODED(resp_parameter.n_args),
+        TUP_DECODED(resp_parameter.args)
+    },
+    [TUP_SCHEMA_RESP_SENSOR] = {
+        { 0 }, TUP_DECODED(resp_sensor.n_args), TUP_DECODED(resp_sensor.args)
+    },
+    [TUP_SCHEMA_RESP_BUILDINFO] = {
+        { TUP_DECODED(resp_buildinfo.buildinfo) }, 0, 0
+    },
+    [TUP_SCHEMA_RESP_INPUT] = {
+        { TUP_DECODED(resp_input.effect_slot_id) },
+        TUP_DECODED(resp_input.n_args), TUP_DECODED(resp_input.args)
+    },
+    [TUP_SCHEMA_RESP_SET_PARAMETER] = {
+        { TUP_DECODED(resp_set_parameter.effect_id),
+            TUP_DECODED(resp_set_parameter.retval) },
+        TUP_DECODED(resp_set_parameter.n_args),
+        TUP_DECODED(resp_set_parameter.args)
+    },
+    [TUP_SCHEMA_RESP_FILTER_ACTIVE] = {
+        { TUP_DECODED(resp_filter_active.filter),
+            TUP_DECODED(resp_filter_active.actuator_id),
+            TUP_DECODED(resp_filter_active.active) }, 0, 0
+    },
+    [TUP_SCHEMA_RESP_BAND_NORM_COEFFS] = {
+        { TUP_DECODED(resp_band_norm_coeffs.actuator_id),
+            TUP_DECODED(resp_band_norm_coeffs.a),
+            TUP_DECODED(resp_band_norm_coeffs.b) }, 0, 0
+    },
+    [TUP_SCHEMA_RESP_DEBUG_SYSTEM_STATUS] = {
+        { TUP_DECODED(resp_debug_system_status.status.rtime),
+            TUP_DECODED(resp_debug_system_status.status.mem_total),
+            TUP_DECODED(resp_debug_system_status.status.mem_used) },
+        TUP_DECODED(resp_debug_system_status.n_tasks),
+        TUP_DECODED(resp_debug_system_status.tasks)
+    },
+};
+
+static const TupDecodedLayout *tup_decoded_layout_lookup(int type)
+{
+    const TupMessageSchema *schema = tup_message_schema_lookup(type);
+
+    if (schema == NULL)
+        return NULL;
+
+    return &tup_decoded_layouts[schema - tup_message_schemas];
+}
+
+/**
+ * \ingroup message
+ * Decode any message into a TupDecoded, the type being read from the message
+ * once. Strings point into the message, which shall outlive decoded.
+ * Messages with more than TUP_DECODED_MAX_ARGS repeated arguments don't fit,
+ * the tup_resp_*_iter_init() functions walk them instead.
+ *
+ * @param[in] message the TupMessage
+ * @param[out] decoded the TupDecoded to fill
+ *
+ * @return 0 on success, SMP_ERROR_BAD_MESSAGE if the type is unknown,
+ * SMP_ERROR_OVERFLOW if the repeated arguments don't fit or another
+ * SmpError otherwise.
+ */
+int tup_message_decode(TupMessage *message, TupDecoded *decoded)
+{
+    const TupDecodedLayout *layout;
+    void *fields[3];
+    void *groups;
+    size_t i;
+    int ret;
+
+    decoded->type = smp_message_get_msgid(message);
+
+    layout = tup_decoded_layout_lookup(decoded->type);
+    if (layout == NULL)
+        return SMP_ERROR_BAD_MESSAGE;
+
+    for (i = 0; i < 3; i++)
+        fields[i] = (char *) decoded + layout->fields[i];
+
+    groups = (layout->groups != 0) ? (char *) decoded + layout->groups : NULL;
+
+    ret = tup_message_read(message, decoded->type, fields, groups,
+            TUP_DECODED_MAX_ARGS);
+    if (ret < 0)
+        return ret;
+
+    if (groups != NULL)
+        *(size_t *) ((char *) decoded + layout->n_groups) = ret;
+
+    return 0;
 }
 
 /**
  * \ingroup message
- * Get the type of a TupMessage.
+ * Encode a message of any type from a TupDecoded, the reverse of
+ * tup_message_decode().
  *
  * @param[in] message the TupMessage
+ * @param[in] decoded the type and arguments of the message
  *
- * @return the message type as a TupMessageType.
+ * @return 0 on success, a SmpError otherwise.
  */
-TupMessageType tup_message_get_type(TupMessage *message)
+int tup_message_encode(TupMessage *message, const TupDecoded *decoded)
 {
-    return smp_message_get_msgid(message);
+    const TupDecodedLayout *layout;
+    const void *fields[3];
+    const void *groups = NULL;
+    size_t n_groups = 0;
+    size_t i;
+
+    layout = tup_decoded_layout_lookup(decoded->type);
+    if (layout == NULL)
+        return SMP_ERROR_INVALID_PARAM;
+
+    for (i = 0; i < 3; i++)
+        fields[i] = (const char *) decoded + layout->fields[i];
+
+    if (layout->groups != 0) {
+        groups = (const char *) decoded + layout->groups;
+        n_groups = *(const size_t *) ((const char *) decoded
+                + layout->n_groups);
+
+        if (n_groups > TUP_DECODED_MAX_ARGS)
+            return SMP_ERROR_INVALID_PARAM;
+    }
+
+    return tup_message_write(message, decoded->type, fields, groups,
+            n_groups);
 }
 
 /**
@@ -117,10 +1113,9 @@ void tup_message_init_ack(TupMessage *message, TupMessageType cmd)
 void tup_message_init_ack_full(TupMessage *message, TupMessageType cmd,
         uint32_t arg1)
 {
-    smp_message_set_id(message, TUP_MESSAGE_ACK);
-    smp_message_set(message, 0, SMP_TYPE_UINT32, cmd,
-            1, SMP_TYPE_UINT32, arg1,
-            -1);
+    const void *fields[] = { &cmd, &arg1 };
+
+    tup_message_write(message, TUP_MESSAGE_ACK, fields, NULL, 0);
 }
 
 /**
@@ -152,24 +1147,9 @@ int tup_message_parse_ack(TupMessage *message, TupMessageType *cmd)
 int tup_message_parse_ack_full(TupMessage *message, TupMessageType *cmd,
         uint32_t *arg1)
 {
-    uint32_t cmd_id, arg1_tmp;
-    int ret;
-
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_ACK)
-        return SMP_ERROR_BAD_MESSAGE;
-
-    ret = smp_message_get(message, 0, SMP_TYPE_UINT32, &cmd_id,
-            1, SMP_TYPE_UINT32, &arg1_tmp,
-            -1);
-    if (ret < 0)
-        return ret;
+    void *fields[] = { cmd, arg1 };
 
-    *cmd = (TupMessageType) cmd_id;
-
-    if (arg1 != NULL)
-        *arg1 = arg1_tmp;
-
-    return 0;
+    return tup_message_read(message, TUP_MESSAGE_ACK, fields, NULL, 0);
 }
 
 /**
@@ -183,7 +1163,7 @@ int tup_message_parse_ack_full(TupMessage *message, TupMessageType *cmd,
 void tup_message_init_error(TupMessage *message, TupMessageType cmd,
         uint32_t error)
 {
-    tup_message_init_error_full(message, TUP_MESSAGE_ERROR, error, 0);
+    tup_message_init_error_full(message, cmd, error, 0);
 }
 
 /**
@@ -198,11 +1178,9 @@ void tup_message_init_error(TupMessage *message, TupMessageType cmd,
 void tup_message_init_error_full(TupMessage *message, TupMessageType cmd,
         uint32_t error, uint32_t arg1)
 {
-    smp_message_set_id(message, TUP_MESSAGE_ERROR);
-    smp_message_set(message, 0, SMP_TYPE_UINT32, cmd,
-            1, SMP_TYPE_UINT32, error,
-            2, SMP_TYPE_UINT32, arg1,
-            -1);
+    const void *fields[] = { &cmd, &error, &arg1 };
+
+    tup_message_write(message, TUP_MESSAGE_ERROR, fields, NULL, 0);
 }
 
 /**
@@ -235,24 +1213,9 @@ int tup_message_parse_error(TupMessage *message, TupMessageType *cmd,
 int tup_message_parse_error_full(TupMessage *message, TupMessageType *cmd,
         uint32_t *error, uint32_t *arg1)
 {
-    uint32_t cmd_id, arg1_tmp;
-    int ret;
-
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_ERROR)
-        return SMP_ERROR_BAD_MESSAGE;
-
-    ret = smp_message_get(message, 0, SMP_TYPE_UINT32, &cmd_id,
-            1, SMP_TYPE_UINT32, error,
-            2, SMP_TYPE_UINT32, &arg1_tmp,
-            -1);
-    if (ret < 0)
-        return ret;
+    void *fields[] = { cmd, error, arg1 };
 
-    if (arg1 != NULL)
-        *arg1 = arg1_tmp;
-
-    *cmd = cmd_id;
-    return 0;
+    return tup_message_read(message, TUP_MESSAGE_ERROR, fields, NULL, 0);
 }
 
 /**
@@ -266,9 +1229,9 @@ int tup_message_parse_error_full(TupMessage *message, TupMessageType *cmd,
 void tup_message_init_load(TupMessage *message, uint8_t effect_id,
         uint16_t bank_id)
 {
-    smp_message_set_id(message, TUP_MESSAGE_CMD_LOAD);
-    smp_message_set_uint8(message, 0, effect_id);
-    smp_message_set_uint16(message, 1, bank_id);
+    const void *fields[] = { &effect_id, &bank_id };
+
+    tup_message_write(message, TUP_MESSAGE_CMD_LOAD, fields, NULL, 0);
 }
 
 /**
@@ -284,11 +1247,9 @@ void tup_message_init_load(TupMessage *message, uint8_t effect_id,
 int tup_message_parse_load(TupMessage *message, uint8_t *effect_id,
         uint16_t *bank_id)
 {
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_CMD_LOAD)
-        return SMP_ERROR_BAD_MESSAGE;
+    void *fields[] = { effect_id, bank_id };
 
-    return smp_message_get(message, 0, SMP_TYPE_UINT8, effect_id,
-            1, SMP_TYPE_UINT16, bank_id, -1);
+    return tup_message_read(message, TUP_MESSAGE_CMD_LOAD, fields, NULL, 0);
 }
 
 /**
@@ -300,8 +1261,9 @@ int tup_message_parse_load(TupMessage *message, uint8_t *effect_id,
  */
 void tup_message_init_play(TupMessage *message, uint8_t effect_id)
 {
-    smp_message_set_id(message, TUP_MESSAGE_CMD_PLAY);
-    smp_message_set_uint8(message, 0, effect_id);
+    const void *fields[] = { &effect_id };
+
+    tup_message_write(message, TUP_MESSAGE_CMD_PLAY, fields, NULL, 0);
 }
 
 /**
@@ -315,10 +1277,9 @@ void tup_message_init_play(TupMessage *message, uint8_t effect_id)
  */
 int tup_message_parse_play(TupMessage *message, uint8_t *effect_id)
 {
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_CMD_PLAY)
-        return SMP_ERROR_BAD_MESSAGE;
+    void *fields[] = { effect_id };
 
-    return smp_message_get_uint8(message, 0, effect_id);
+    return tup_message_read(message, TUP_MESSAGE_CMD_PLAY, fields, NULL, 0);
 }
 
 /**
@@ -330,8 +1291,9 @@ int tup_message_parse_play(TupMessage *message, uint8_t *effect_id)
  */
 void tup_message_init_stop(TupMessage *message, uint8_t effect_id)
 {
-    smp_message_set_id(message, TUP_MESSAGE_CMD_STOP);
-    smp_message_set_uint8(message, 0, effect_id);
+    const void *fields[] = { &effect_id };
+
+    tup_message_write(message, TUP_MESSAGE_CMD_STOP, fields, NULL, 0);
 }
 
 /**
@@ -345,10 +1307,9 @@ void tup_message_init_stop(TupMessage *message, uint8_t effect_id)
  */
 int tup_message_parse_stop(TupMessage *message, uint8_t *effect_id)
 {
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_CMD_STOP)
-        return SMP_ERROR_BAD_MESSAGE;
+    void *fields[] = { effect_id };
 
-    return smp_message_get_uint8(message, 0, effect_id);
+    return tup_message_read(message, TUP_MESSAGE_CMD_STOP, fields, NULL, 0);
 }
 
 /**
@@ -403,14 +1364,20 @@ int tup_message_init_get_parameter(TupMessage *message, uint8_t effect_id,
 int tup_message_init_get_parameter_valist(TupMessage *message,
         uint8_t effect_id, int parameter_id, va_list varargs)
 {
+    const void *fields[] = { &effect_id };
+    uint8_t id;
+    size_t i;
     int ret;
-    int i;
 
-    smp_message_set_id(message, TUP_MESSAGE_CMD_GET_PARAMETER);
-    smp_message_set_uint8(message, 0, effect_id);
+    ret = tup_message_write(message, TUP_MESSAGE_CMD_GET_PARAMETER, fields,
+            NULL, 0);
+    if (ret < 0)
+        return ret;
 
-    for (i = 1; parameter_id != -1; i++) {
-        ret = smp_message_set_uint8(message, i, parameter_id);
+    for (i = 0; parameter_id != -1; i++) {
+        id = parameter_id;
+        ret = tup_message_write_group(message, TUP_MESSAGE_CMD_GET_PARAMETER,
+                i, &id);
         if (ret < 0)
             return ret;
 
@@ -448,19 +1415,10 @@ void tup_message_init_get_parameter_simple(TupMessage *message,
 int tup_message_init_get_parameter_array(TupMessage *message,
         uint8_t effect_id, uint8_t *parameter_ids, size_t n_parameters)
 {
-    int ret;
-    size_t i;
-
-    smp_message_set_id(message, TUP_MESSAGE_CMD_GET_PARAMETER);
-    smp_message_set_uint8(message, 0, effect_id);
-
-    for (i = 0; i < n_parameters; i++) {
-        ret = smp_message_set_uint8(message, i + 1, parameter_ids[i]);
-        if (ret < 0)
-            return ret;
-    }
+    const void *fields[] = { &effect_id };
 
-    return 0;
+    return tup_message_write(message, TUP_MESSAGE_CMD_GET_PARAMETER, fields,
+            parameter_ids, n_parameters);
 }
 
 /**
@@ -475,8 +1433,9 @@ int tup_message_init_get_parameter_array(TupMessage *message,
 void tup_message_init_get_parameter_set_effect_id(TupMessage *message,
         uint8_t effect_id)
 {
-    smp_message_set_id(message, TUP_MESSAGE_CMD_GET_PARAMETER);
-    smp_message_set_uint8(message, 0, effect_id);
+    const void *fields[] = { &effect_id };
+
+    tup_message_write(message, TUP_MESSAGE_CMD_GET_PARAMETER, fields, NULL, 0);
 }
 
 /**
@@ -494,7 +1453,8 @@ void tup_message_init_get_parameter_set_effect_id(TupMessage *message,
 int tup_message_init_get_parameter_set_parameter_id(TupMessage *message,
         unsigned int index, uint8_t parameter_id)
 {
-    return smp_message_set_uint8(message, 1 + index, parameter_id);
+    return tup_message_write_group(message, TUP_MESSAGE_CMD_GET_PARAMETER,
+            index, &parameter_id);
 }
 
 /**
@@ -512,33 +1472,10 @@ int tup_message_init_get_parameter_set_parameter_id(TupMessage *message,
 int tup_message_parse_get_parameter(TupMessage *message, uint8_t *effect_id,
         uint8_t *parameter_ids, size_t size)
 {
-    int n_params = 0;
-    int ret;
-    int i;
-
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_CMD_GET_PARAMETER)
-        return SMP_ERROR_BAD_MESSAGE;
-
-    ret = smp_message_get_uint8(message, 0, effect_id);
-    if (ret < 0)
-        return ret;
-
-    /* n_params >= 0 as we already get one arg */
-    n_params = smp_message_n_args(message) - 1;
-    if (size < (size_t) n_params) {
-        /* array too small */
-        return SMP_ERROR_OVERFLOW;
-    }
-
-    for (i = 0; i < n_params; i++) {
-        ret = smp_message_get_uint8(message, i + 1, &parameter_ids[i]);
-        if (ret < 0) {
-            /* should not happen but... */
-            return ret;
-        }
-    }
+    void *fields[] = { effect_id };
 
-    return n_params;
+    return tup_message_read(message, TUP_MESSAGE_CMD_GET_PARAMETER, fields,
+            parameter_ids, size);
 }
 
 /**
@@ -587,18 +1524,21 @@ int tup_message_init_set_parameter_valist(TupMessage *message,
         uint8_t effect_id, int parameter_id, uint32_t parameter_value,
         va_list varargs)
 {
+    const void *fields[] = { &effect_id };
+    TupParameterArgs param;
+    size_t i;
     int ret;
-    int i;
-
-    smp_message_set_id(message, TUP_MESSAGE_CMD_SET_PARAMETER);
-    smp_message_set_uint8(message, 0, effect_id);
 
-    for (i = 1; parameter_id != -1; i += 2) {
-        ret = smp_message_set_uint8(message, i, parameter_id);
-        if (ret < 0)
-            return ret;
+    ret = tup_message_write(message, TUP_MESSAGE_CMD_SET_PARAMETER, fields,
+            NULL, 0);
+    if (ret < 0)
+        return ret;
 
-        ret = smp_message_set_uint32(message, i + 1, parameter_value);
+    for (i = 0; parameter_id != -1; i++) {
+        param.parameter_id = parameter_id;
+        param.parameter_value = parameter_value;
+        ret = tup_message_write_group(message, TUP_MESSAGE_CMD_SET_PARAMETER,
+                i, &param);
         if (ret < 0)
             return ret;
 
@@ -639,23 +1579,10 @@ void tup_message_init_set_parameter_simple(TupMessage *message,
 int tup_message_init_set_parameter_array(TupMessage *message,
         uint8_t effect_id, TupParameterArgs *params, size_t n_params)
 {
-    int ret;
-    size_t i, j;
-
-    smp_message_set_id(message, TUP_MESSAGE_CMD_SET_PARAMETER);
-    smp_message_set_uint8(message, 0, effect_id);
-
-    for (i = 0, j = 1; i < n_params; i++, j += 2) {
-        ret = smp_message_set_uint8(message, j, params[i].parameter_id);
-        if (ret < 0)
-            return ret;
-
-        ret = smp_message_set_uint32(message, j + 1, params[i].parameter_value);
-        if (ret < 0)
-            return ret;
-    }
+    const void *fields[] = { &effect_id };
 
-    return 0;
+    return tup_message_write(message, TUP_MESSAGE_CMD_SET_PARAMETER, fields,
+            params, n_params);
 }
 
 /**
@@ -673,35 +1600,10 @@ int tup_message_init_set_parameter_array(TupMessage *message,
 int tup_message_parse_set_parameter(TupMessage *message,
         uint8_t *effect_id, TupParameterArgs *params, size_t size)
 {
-    int n_params = 0;
-    int ret;
-    int i, j;
-
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_CMD_SET_PARAMETER)
-        return SMP_ERROR_BAD_MESSAGE;
-
-    ret = smp_message_get_uint8(message, 0, effect_id);
-    if (ret < 0)
-        return ret;
-
-    /* we use two args in SmpMessage for one parameter and n_args > 0 as we
-     * already get one */
-    n_params = (smp_message_n_args(message) - 1) / 2;
-    if (size < (size_t) n_params)
-        return SMP_ERROR_OVERFLOW;
-
-    for (i = 0, j = 1; i < n_params; i++, j += 2) {
-        ret = smp_message_get_uint8(message, j, &params[i].parameter_id);
-        if (ret < 0)
-            return ret;
-
-        ret = smp_message_get_uint32(message, j + 1,
-                &params[i].parameter_value);
-        if (ret < 0)
-            return ret;
-    }
+    void *fields[] = { effect_id };
 
-    return n_params;
+    return tup_message_read(message, TUP_MESSAGE_CMD_SET_PARAMETER, fields,
+            params, size);
 }
 
 /**
@@ -715,9 +1617,9 @@ int tup_message_parse_set_parameter(TupMessage *message,
 void tup_message_init_bind_effect(TupMessage *message, uint8_t effect_id,
         unsigned int binding_flags)
 {
-    smp_message_set_id(message, TUP_MESSAGE_CMD_BIND_EFFECT);
-    smp_message_set_uint8(message, 0, effect_id);
-    smp_message_set_uint8(message, 1, binding_flags);
+    const void *fields[] = { &effect_id, &binding_flags };
+
+    tup_message_write(message, TUP_MESSAGE_CMD_BIND_EFFECT, fields, NULL, 0);
 }
 
 /**
@@ -733,17 +1635,10 @@ void tup_message_init_bind_effect(TupMessage *message, uint8_t effect_id,
 int tup_message_parse_bind_effect(TupMessage *message, uint8_t *effect_id,
         unsigned int *binding_flags)
 {
-    uint8_t flags = 0;
-    int ret;
-
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_CMD_BIND_EFFECT)
-        return SMP_ERROR_BAD_MESSAGE;
-
-    ret = smp_message_get(message, 0, SMP_TYPE_UINT8, effect_id,
-            1, SMP_TYPE_UINT8, &flags, -1);
+    void *fields[] = { effect_id, binding_flags };
 
-    *binding_flags = flags;
-    return ret;
+    return tup_message_read(message, TUP_MESSAGE_CMD_BIND_EFFECT, fields,
+            NULL, 0);
 }
 
 /**
@@ -783,13 +1678,17 @@ int tup_message_init_get_sensor_value(TupMessage *message, int sensor_id, ...)
 int tup_message_init_get_sensor_value_valist(TupMessage *message, int sensor_id,
         va_list varargs)
 {
+    uint8_t id;
+    size_t i;
     int ret;
-    int i;
 
-    smp_message_set_id(message, TUP_MESSAGE_CMD_GET_SENSOR_VALUE);
+    tup_message_write(message, TUP_MESSAGE_CMD_GET_SENSOR_VALUE, NULL, NULL,
+            0);
 
     for (i = 0; sensor_id != -1; i++) {
-        ret = smp_message_set_uint8(message, i, sensor_id);
+        id = sensor_id;
+        ret = tup_message_write_group(message,
+                TUP_MESSAGE_CMD_GET_SENSOR_VALUE, i, &id);
         if (ret < 0)
             return ret;
 
@@ -825,17 +1724,8 @@ void tup_message_init_get_sensor_value_simple(TupMessage *message,
 int tup_message_init_get_sensor_value_array(TupMessage *message,
         uint8_t *sensor_ids, size_t n_sensors)
 {
-    int ret;
-    size_t i;
-
-    smp_message_set_id(message, TUP_MESSAGE_CMD_GET_SENSOR_VALUE);
-    for (i = 0; i < n_sensors; i++) {
-        ret = smp_message_set_uint8(message, i, sensor_ids[i]);
-        if (ret < 0)
-            return ret;
-    }
-
-    return 0;
+    return tup_message_write(message, TUP_MESSAGE_CMD_GET_SENSOR_VALUE, NULL,
+            sensor_ids, n_sensors);
 }
 
 /**
@@ -851,27 +1741,8 @@ int tup_message_init_get_sensor_value_array(TupMessage *message,
 int tup_message_parse_get_sensor_value(TupMessage *message,
         uint8_t *sensor_ids, size_t size)
 {
-    int n_params = 0;
-    int ret;
-    int i;
-
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_CMD_GET_SENSOR_VALUE)
-        return SMP_ERROR_BAD_MESSAGE;
-
-    /* n_params >= 0 as we already get one arg */
-    n_params = smp_message_n_args(message);
-    if (size < (size_t) n_params)
-        return SMP_ERROR_OVERFLOW;
-
-    for (i = 0; i < n_params; i++) {
-        ret = smp_message_get_uint8(message, i, &sensor_ids[i]);
-        if (ret < 0) {
-            /* should not happen */
-            return ret;
-        }
-    }
-
-    return n_params;
+    return tup_message_read(message, TUP_MESSAGE_CMD_GET_SENSOR_VALUE, NULL,
+            sensor_ids, size);
 }
 
 /**
@@ -917,17 +1788,18 @@ int tup_message_init_set_sensor_value(TupMessage *message, int sensor_id,
 int tup_message_init_set_sensor_value_valist(TupMessage *message, int sensor_id,
         int sensor_value, va_list varargs)
 {
+    TupSensorValueArgs arg;
+    size_t i;
     int ret;
-    int i;
 
-    smp_message_set_id(message, TUP_MESSAGE_CMD_SET_SENSOR_VALUE);
-
-    for (i = 0; sensor_id != -1; i += 2) {
-        ret = smp_message_set_uint8(message, i, sensor_id);
-        if (ret < 0)
-            return ret;
+    tup_message_write(message, TUP_MESSAGE_CMD_SET_SENSOR_VALUE, NULL, NULL,
+            0);
 
-        ret = smp_message_set_uint16(message, i + 1, sensor_value);
+    for (i = 0; sensor_id != -1; i++) {
+        arg.sensor_id = sensor_id;
+        arg.sensor_value = sensor_value;
+        ret = tup_message_write_group(message,
+                TUP_MESSAGE_CMD_SET_SENSOR_VALUE, i, &arg);
         if (ret < 0)
             return ret;
 
@@ -965,21 +1837,8 @@ void tup_message_init_set_sensor_value_simple(TupMessage *message,
 int tup_message_init_set_sensor_value_array(TupMessage *message,
         TupSensorValueArgs *args, size_t n_args)
 {
-    int ret;
-    size_t i, j;
-
-    smp_message_set_id(message, TUP_MESSAGE_CMD_SET_SENSOR_VALUE);
-    for (i = 0, j = 0; i < n_args; i++, j += 2) {
-        ret = smp_message_set_uint8(message, j, args[i].sensor_id);
-        if (ret < 0)
-            return ret;
-
-        ret = smp_message_set_uint16(message, j + 1, args[i].sensor_value);
-        if (ret < 0)
-            return ret;
-    }
-
-    return 0;
+    return tup_message_write(message, TUP_MESSAGE_CMD_SET_SENSOR_VALUE, NULL,
+            args, n_args);
 }
 
 /**
@@ -995,29 +1854,8 @@ int tup_message_init_set_sensor_value_array(TupMessage *message,
 int tup_message_parse_set_sensor_value(TupMessage *message,
         TupSensorValueArgs *args, size_t size)
 {
-    int n_params = 0;
-    int ret;
-    int i, j;
-
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_CMD_SET_SENSOR_VALUE)
-        return SMP_ERROR_BAD_MESSAGE;
-
-    /* we use two args in SmpMessage for one sensor value */
-    n_params = smp_message_n_args(message) / 2;
-    if (size < (size_t) n_params)
-        return SMP_ERROR_OVERFLOW;
-
-    for (i = 0, j = 0; i < n_params; i++, j += 2) {
-        ret = smp_message_get_uint8(message, j, &args[i].sensor_id);
-        if (ret < 0)
-            return ret;
-
-        ret = smp_message_get_uint16(message, j + 1, &args[i].sensor_value);
-        if (ret < 0)
-            return ret;
-    }
-
-    return n_params;
+    return tup_message_read(message, TUP_MESSAGE_CMD_SET_SENSOR_VALUE, NULL,
+            args, size);
 }
 
 /**
@@ -1061,17 +1899,21 @@ int tup_message_init_get_input_value(TupMessage *message, int effect_slot_id,
 int tup_message_init_get_input_value_valist(TupMessage *message,
         int effect_slot_id, int input_id, va_list varargs)
 {
+    uint8_t slot_id = effect_slot_id;
+    const void *fields[] = { &slot_id };
+    uint8_t id;
+    size_t i;
     int ret;
-    int i;
-
-    smp_message_set_id(message, TUP_MESSAGE_CMD_GET_INPUT_VALUE);
 
-    ret = smp_message_set_uint8(message, 0, effect_slot_id);
+    ret = tup_message_write(message, TUP_MESSAGE_CMD_GET_INPUT_VALUE, fields,
+            NULL, 0);
     if (ret < 0)
         return ret;
 
-    for (i = 1; input_id != -1; i++) {
-        ret = smp_message_set_uint8(message, i, input_id);
+    for (i = 0; input_id != -1; i++) {
+        id = input_id;
+        ret = tup_message_write_group(message,
+                TUP_MESSAGE_CMD_GET_INPUT_VALUE, i, &id);
         if (ret < 0)
             return ret;
 
@@ -1109,22 +1951,10 @@ void tup_message_init_get_input_value_simple(TupMessage *message,
 int tup_message_init_get_input_value_array(TupMessage *message,
         uint8_t effect_slot_id, uint8_t *input_ids, size_t n_inputs)
 {
-    int ret;
-    size_t i;
-
-    smp_message_set_id(message, TUP_MESSAGE_CMD_GET_INPUT_VALUE);
-
-    ret = smp_message_set_uint8(message, 0, effect_slot_id);
-    if (ret < 0)
-        return ret;
-
-    for (i = 1; i <= n_inputs; i++) {
-        ret = smp_message_set_uint8(message, i, input_ids[i]);
-        if (ret < 0)
-            return ret;
-    }
+    const void *fields[] = { &effect_slot_id };
 
-    return 0;
+    return tup_message_write(message, TUP_MESSAGE_CMD_GET_INPUT_VALUE, fields,
+            input_ids, n_inputs);
 }
 
 /**
@@ -1141,33 +1971,10 @@ int tup_message_init_get_input_value_array(TupMessage *message,
 int tup_message_parse_get_input_value(TupMessage *message,
         uint8_t *effect_slot_id, uint8_t *input_ids, size_t size)
 {
-    int n_params = 0;
-    int ret;
-    int i;
-
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_CMD_GET_INPUT_VALUE)
-        return SMP_ERROR_BAD_MESSAGE;
-
-    /* n_params >= 0 as we already get one arg */
-    n_params = smp_message_n_args(message) - 1;
-    if (size < (size_t) n_params)
-        return SMP_ERROR_OVERFLOW;
-
-    ret = smp_message_get_uint8(message, 0, effect_slot_id);
-    if (ret < 0) {
-        /* should not happen */
-        return ret;
-    }
+    void *fields[] = { effect_slot_id };
 
-    for (i = 0; i < n_params; i++) {
-        ret = smp_message_get_uint8(message, i+1, &input_ids[i]);
-        if (ret < 0) {
-            /* should not happen */
-            return ret;
-        }
-    }
-
-    return n_params;
+    return tup_message_read(message, TUP_MESSAGE_CMD_GET_INPUT_VALUE, fields,
+            input_ids, size);
 }
 
 /**
@@ -1215,21 +2022,22 @@ int tup_message_init_set_input_value(TupMessage *message,
 int tup_message_init_set_input_value_valist(TupMessage *message,
         int effect_slot_id, int input_id, int input_value, va_list varargs)
 {
+    uint8_t slot_id = effect_slot_id;
+    const void *fields[] = { &slot_id };
+    TupInputValueArgs arg;
+    size_t i;
     int ret;
-    int i;
 
-    smp_message_set_id(message, TUP_MESSAGE_CMD_SET_INPUT_VALUE);
-
-    ret = smp_message_set_uint8(message, 0, effect_slot_id);
+    ret = tup_message_write(message, TUP_MESSAGE_CMD_SET_INPUT_VALUE, fields,
+            NULL, 0);
     if (ret < 0)
         return ret;
 
-    for (i = 1; input_id != -1; i += 2) {
-        ret = smp_message_set_uint8(message, i, input_id);
-        if (ret < 0)
-            return ret;
-
-        ret = smp_message_set_int32(message, i + 1, input_value);
+    for (i = 0; input_id != -1; i++) {
+        arg.input_id = input_id;
+        arg.input_value = input_value;
+        ret = tup_message_write_group(message,
+                TUP_MESSAGE_CMD_SET_INPUT_VALUE, i, &arg);
         if (ret < 0)
             return ret;
 
@@ -1270,26 +2078,10 @@ void tup_message_init_set_input_value_simple(TupMessage *message,
 int tup_message_init_set_input_value_array(TupMessage *message,
         uint8_t effect_slot_id, TupInputValueArgs *args, size_t n_args)
 {
-    int ret;
-    size_t i, j;
-
-    smp_message_set_id(message, TUP_MESSAGE_CMD_SET_INPUT_VALUE);
-
-    ret = smp_message_set_uint8(message, 0, effect_slot_id);
-    if (ret < 0)
-        return ret;
-
-    for (i = 0, j = 1; i < n_args; i++, j += 2) {
-        ret = smp_message_set_uint8(message, j, args[i].input_id);
-        if (ret < 0)
-            return ret;
-
-        ret = smp_message_set_int32(message, j + 1, args[i].input_value);
-        if (ret < 0)
-            return ret;
-    }
+    const void *fields[] = { &effect_slot_id };
 
-    return 0;
+    return tup_message_write(message, TUP_MESSAGE_CMD_SET_INPUT_VALUE, fields,
+            args, n_args);
 }
 
 /**
@@ -1306,33 +2098,10 @@ int tup_message_init_set_input_value_array(TupMessage *message,
 int tup_message_parse_set_input_value(TupMessage *message,
         uint8_t *effect_slot_id, TupInputValueArgs *args, size_t size)
 {
-    int n_params = 0;
-    int ret;
-    int i, j;
-
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_CMD_SET_INPUT_VALUE)
-        return SMP_ERROR_BAD_MESSAGE;
-
-    /* we use two args in SmpMessage for one input value */
-    n_params = (smp_message_n_args(message) - 1 ) / 2;
-    if (size < (size_t) n_params)
-        return SMP_ERROR_OVERFLOW;
-
-    ret = smp_message_get_uint8(message, 0, effect_slot_id);
-    if (ret < 0)
-        return ret;
-
-    for (i = 0, j = 1; i < n_params; i++, j += 2) {
-        ret = smp_message_get_uint8(message, j, &args[i].input_id);
-        if (ret < 0)
-            return ret;
-
-        ret = smp_message_get_int32(message, j + 1, &args[i].input_value);
-        if (ret < 0)
-            return ret;
-    }
+    void *fields[] = { effect_slot_id };
 
-    return n_params;
+    return tup_message_read(message, TUP_MESSAGE_CMD_SET_INPUT_VALUE, fields,
+            args, size);
 }
 
 /**
@@ -1345,8 +2114,10 @@ int tup_message_parse_set_input_value(TupMessage *message,
 void tup_message_init_activate_internal_sensors(TupMessage *message,
         uint8_t state)
 {
-    smp_message_set_id(message, TUP_MESSAGE_CMD_ACTIVATE_INTERNAL_SENSORS);
-    smp_message_set_uint8(message, 0, state);
+    const void *fields[] = { &state };
+
+    tup_message_write(message, TUP_MESSAGE_CMD_ACTIVATE_INTERNAL_SENSORS,
+            fields, NULL, 0);
 }
 
 /**
@@ -1360,12 +2131,10 @@ void tup_message_init_activate_internal_sensors(TupMessage *message,
 int tup_message_parse_activate_internal_sensors(TupMessage *message,
         uint8_t *state)
 {
-    int msgid = smp_message_get_msgid(message);
-
-    if (msgid != TUP_MESSAGE_CMD_ACTIVATE_INTERNAL_SENSORS)
-        return SMP_ERROR_BAD_MESSAGE;
+    void *fields[] = { state };
 
-    return smp_message_get_uint8(message, 0, state);
+    return tup_message_read(message, TUP_MESSAGE_CMD_ACTIVATE_INTERNAL_SENSORS,
+            fields, NULL, 0);
 }
 
 /**
@@ -1392,10 +2161,10 @@ void tup_message_init_get_buildinfo(TupMessage *message)
 int tup_message_init_filter_get_active(TupMessage *message, TupFilterId filter,
         uint8_t actuator_id)
 {
-    smp_message_set_id(message, TUP_MESSAGE_CMD_FILTER_GET_ACTIVE);
-    return smp_message_set(message, 0, SMP_TYPE_UINT8, filter,
-            1, SMP_TYPE_UINT8, actuator_id,
-            -1);
+    const void *fields[] = { &filter, &actuator_id };
+
+    return tup_message_write(message, TUP_MESSAGE_CMD_FILTER_GET_ACTIVE,
+            fields, NULL, 0);
 }
 
 /**
@@ -1410,20 +2179,10 @@ int tup_message_init_filter_get_active(TupMessage *message, TupFilterId filter,
 int tup_message_parse_filter_get_active(TupMessage *message,
         TupFilterId *filter, uint8_t *actuator_id)
 {
-    int msgid = smp_message_get_msgid(message);
-    uint8_t filter_tmp;
-    int ret;
-
-    if (msgid != TUP_MESSAGE_CMD_FILTER_GET_ACTIVE)
-        return SMP_ERROR_BAD_MESSAGE;
-
-    ret = smp_message_get(message, 0, SMP_TYPE_UINT8, &filter_tmp,
-            1, SMP_TYPE_UINT8, actuator_id, -1);
-    if (ret < 0)
-        return ret;
+    void *fields[] = { filter, actuator_id };
 
-    *filter = (TupFilterId) filter_tmp;
-    return 0;
+    return tup_message_read(message, TUP_MESSAGE_CMD_FILTER_GET_ACTIVE, fields,
+            NULL, 0);
 }
 
 /**
@@ -1439,11 +2198,10 @@ int tup_message_parse_filter_get_active(TupMessage *message,
 int tup_message_init_filter_set_active(TupMessage *message, TupFilterId filter,
         uint8_t actuator_id, bool active)
 {
-    smp_message_set_id(message, TUP_MESSAGE_CMD_FILTER_SET_ACTIVE);
-    return smp_message_set(message, 0, SMP_TYPE_UINT8, filter,
-            1, SMP_TYPE_UINT8, actuator_id,
-            2, SMP_TYPE_UINT8, active ? 1 : 0,
-            -1);
+    const void *fields[] = { &filter, &actuator_id, &active };
+
+    return tup_message_write(message, TUP_MESSAGE_CMD_FILTER_SET_ACTIVE,
+            fields, NULL, 0);
 }
 
 /**
@@ -1459,24 +2217,10 @@ int tup_message_init_filter_set_active(TupMessage *message, TupFilterId filter,
 int tup_message_parse_filter_set_active(TupMessage *message,
         TupFilterId *filter, uint8_t *actuator_id, bool *active)
 {
-    int msgid = smp_message_get_msgid(message);
-    uint8_t filter_tmp;
-    uint8_t active_tmp;
-    int ret;
-
-    if (msgid != TUP_MESSAGE_CMD_FILTER_SET_ACTIVE)
-        return SMP_ERROR_BAD_MESSAGE;
-
-    ret = smp_message_get(message, 0, SMP_TYPE_UINT8, &filter_tmp,
-            1, SMP_TYPE_UINT8, actuator_id,
-            2, SMP_TYPE_UINT8, &active_tmp,
-            -1);
-    if (ret < 0)
-        return ret;
+    void *fields[] = { filter, actuator_id, active };
 
-    *filter = (TupFilterId) filter_tmp;
-    *active = (active_tmp > 0) ? true : false;
-    return 0;
+    return tup_message_read(message, TUP_MESSAGE_CMD_FILTER_SET_ACTIVE, fields,
+            NULL, 0);
 }
 
 /**
@@ -1502,8 +2246,10 @@ void tup_message_init_config_write(TupMessage *message)
 int tup_message_init_config_band_norm_get_coeffs(TupMessage *message,
         uint8_t actuator_id)
 {
-    smp_message_set_id(message, TUP_MESSAGE_CMD_CONFIG_BAND_NORM_GET_COEFFS);
-    return smp_message_set_uint8(message, 0, actuator_id);
+    const void *fields[] = { &actuator_id };
+
+    return tup_message_write(message,
+            TUP_MESSAGE_CMD_CONFIG_BAND_NORM_GET_COEFFS, fields, NULL, 0);
 }
 
 /**
@@ -1518,12 +2264,10 @@ int tup_message_init_config_band_norm_get_coeffs(TupMessage *message,
 int tup_message_parse_config_band_norm_get_coeffs(TupMessage *message,
         uint8_t *actuator_id)
 {
-    int msgid = smp_message_get_msgid(message);
-
-    if (msgid != TUP_MESSAGE_CMD_CONFIG_BAND_NORM_GET_COEFFS)
-        return SMP_ERROR_BAD_MESSAGE;
+    void *fields[] = { actuator_id };
 
-    return smp_message_get_uint8(message, 0, actuator_id);
+    return tup_message_read(message,
+            TUP_MESSAGE_CMD_CONFIG_BAND_NORM_GET_COEFFS, fields, NULL, 0);
 }
 
 /**
@@ -1540,19 +2284,10 @@ int tup_message_parse_config_band_norm_get_coeffs(TupMessage *message,
 int tup_message_init_config_band_norm_set_coeffs(TupMessage *message,
         uint8_t actuator_id, float a[5], float b[5])
 {
-    smp_message_set_id(message, TUP_MESSAGE_CMD_CONFIG_BAND_NORM_SET_COEFFS);
-    return smp_message_set(message, 0, SMP_TYPE_UINT8, actuator_id,
-            1, SMP_TYPE_F32, a[0],
-            2, SMP_TYPE_F32, a[1],
-            3, SMP_TYPE_F32, a[2],
-            4, SMP_TYPE_F32, a[3],
-            5, SMP_TYPE_F32, a[4],
-            6, SMP_TYPE_F32, b[0],
-            7, SMP_TYPE_F32, b[1],
-            8, SMP_TYPE_F32, b[2],
-            9, SMP_TYPE_F32, b[3],
-            10, SMP_TYPE_F32, b[4],
-            -1);
+    const void *fields[] = { &actuator_id, a, b };
+
+    return tup_message_write(message,
+            TUP_MESSAGE_CMD_CONFIG_BAND_NORM_SET_COEFFS, fields, NULL, 0);
 }
 
 /**
@@ -1568,24 +2303,11 @@ int tup_message_init_config_band_norm_set_coeffs(TupMessage *message,
  */
 int tup_message_parse_config_band_norm_set_coeffs(TupMessage *message,
         uint8_t *actuator_id, float a[5], float b[5])
-{
-    int msgid = smp_message_get_msgid(message);
-
-    if (msgid != TUP_MESSAGE_CMD_CONFIG_BAND_NORM_SET_COEFFS)
-        return SMP_ERROR_BAD_MESSAGE;
+{
+    void *fields[] = { actuator_id, a, b };
 
-    return smp_message_get(message, 0, SMP_TYPE_UINT8, actuator_id,
-            1, SMP_TYPE_F32, &a[0],
-            2, SMP_TYPE_F32, &a[1],
-            3, SMP_TYPE_F32, &a[2],
-            4, SMP_TYPE_F32, &a[3],
-            5, SMP_TYPE_F32, &a[4],
-            6, SMP_TYPE_F32, &b[0],
-            7, SMP_TYPE_F32, &b[1],
-            8, SMP_TYPE_F32, &b[2],
-            9, SMP_TYPE_F32, &b[3],
-            10, SMP_TYPE_F32, &b[4],
-            -1);
+    return tup_message_read(message,
+            TUP_MESSAGE_CMD_CONFIG_BAND_NORM_SET_COEFFS, fields, NULL, 0);
 }
 
 /**
@@ -1599,8 +2321,9 @@ int tup_message_parse_config_band_norm_set_coeffs(TupMessage *message,
  */
 void tup_message_init_resp_version(TupMessage *message, const char *version)
 {
-    smp_message_set_id(message, TUP_MESSAGE_RESP_VERSION);
-    smp_message_set_cstring(message, 0, version);
+    const void *fields[] = { &version };
+
+    tup_message_write(message, TUP_MESSAGE_RESP_VERSION, fields, NULL, 0);
 }
 
 /**
@@ -1616,10 +2339,9 @@ void tup_message_init_resp_version(TupMessage *message, const char *version)
  */
 int tup_message_parse_resp_version(TupMessage *message, const char **version)
 {
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_RESP_VERSION)
-        return SMP_ERROR_BAD_MESSAGE;
+    void *fields[] = { version };
 
-    return smp_message_get_cstring(message, 0, version);
+    return tup_message_read(message, TUP_MESSAGE_RESP_VERSION, fields, NULL, 0);
 }
 
 /**
@@ -1636,23 +2358,10 @@ int tup_message_parse_resp_version(TupMessage *message, const char **version)
 int tup_message_init_resp_parameter(TupMessage *message, uint8_t effect_id,
         TupParameterArgs *args, size_t n_args)
 {
-    int ret;
-    size_t i, j;
-
-    smp_message_set_id(message, TUP_MESSAGE_RESP_PARAMETER);
-    smp_message_set_uint8(message, 0, effect_id);
-
-    for (i = 0, j = 1; i < n_args; i++, j += 2) {
-        ret = smp_message_set_uint8(message, j, args[i].parameter_id);
-        if (ret < 0)
-            return ret;
+    const void *fields[] = { &effect_id };
 
-        ret = smp_message_set_uint32(message, j + 1, args[i].parameter_value);
-        if (ret < 0)
-            return ret;
-    }
-
-    return 0;
+    return tup_message_write(message, TUP_MESSAGE_RESP_PARAMETER, fields,
+            args, n_args);
 }
 
 /**
@@ -1669,34 +2378,10 @@ int tup_message_init_resp_parameter(TupMessage *message, uint8_t effect_id,
 int tup_message_parse_resp_parameter(TupMessage *message, uint8_t *effect_id,
         TupParameterArgs *args, size_t size)
 {
-    int n_params = 0;
-    int ret;
-    int i, j;
-
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_RESP_PARAMETER)
-        return SMP_ERROR_BAD_MESSAGE;
+    void *fields[] = { effect_id };
 
-    ret = smp_message_get_uint8(message, 0, effect_id);
-    if (ret < 0)
-        return ret;
-
-    /* we use two args in SmpMessage for one parameter and n_args > 0 as we
-     * already get one */
-    n_params = (smp_message_n_args(message) - 1) / 2;
-    if (size < (size_t) n_params)
-        return SMP_ERROR_OVERFLOW;
-
-    for (i = 0, j = 1; i < n_params; i++, j += 2) {
-        ret = smp_message_get_uint8(message, j, &args[i].parameter_id);
-        if (ret < 0)
-            return ret;
-
-        ret = smp_message_get_uint32(message, j + 1, &args[i].parameter_value);
-        if (ret < 0)
-            return ret;
-    }
-
-    return n_params;
+    return tup_message_read(message, TUP_MESSAGE_RESP_PARAMETER, fields,
+            args, size);
 }
 
 /**
@@ -1711,10 +2396,10 @@ int tup_message_parse_resp_parameter(TupMessage *message, uint8_t *effect_id,
 int tup_message_parse_resp_parameter_get_effect_id(TupMessage *message,
         uint8_t *effect_id)
 {
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_RESP_PARAMETER)
-        return SMP_ERROR_BAD_MESSAGE;
+    void *fields[] = { effect_id };
 
-    return smp_message_get_uint8(message, 0, effect_id);
+    return tup_message_read(message, TUP_MESSAGE_RESP_PARAMETER, fields,
+            NULL, 0);
 }
 
 /**
@@ -1730,20 +2415,8 @@ int tup_message_parse_resp_parameter_get_effect_id(TupMessage *message,
 int tup_message_parse_resp_parameter_get_parameter(TupMessage *message,
         unsigned int index, TupParameterArgs *arg)
 {
-    int ret;
-
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_RESP_PARAMETER)
-        return SMP_ERROR_BAD_MESSAGE;
-
-    ret = smp_message_get_uint8(message, 1 + 2 * index, &arg->parameter_id);
-    if (ret < 0)
-        return ret;
-
-    ret = smp_message_get_uint32(message, 2 + 2 * index, &arg->parameter_value);
-    if (ret < 0)
-        return ret;
-
-    return 0;
+    return tup_message_read_group(message, TUP_MESSAGE_RESP_PARAMETER, index,
+            arg);
 }
 
 /**
@@ -1759,22 +2432,8 @@ int tup_message_parse_resp_parameter_get_parameter(TupMessage *message,
 int tup_message_init_resp_sensor(TupMessage *message, TupSensorValueArgs *args,
         size_t n_args)
 {
-    int ret;
-    size_t i, j;
-
-    smp_message_set_id(message, TUP_MESSAGE_RESP_SENSOR);
-
-    for (i = 0, j = 0; i < n_args; i++, j += 2) {
-        ret = smp_message_set_uint8(message, j, args[i].sensor_id);
-        if (ret < 0)
-            return ret;
-
-        ret = smp_message_set_uint16(message, j + 1, args[i].sensor_value);
-        if (ret < 0)
-            return ret;
-    }
-
-    return 0;
+    return tup_message_write(message, TUP_MESSAGE_RESP_SENSOR, NULL, args,
+            n_args);
 }
 
 /**
@@ -1790,29 +2449,8 @@ int tup_message_init_resp_sensor(TupMessage *message, TupSensorValueArgs *args,
 int tup_message_parse_resp_sensor(TupMessage *message, TupSensorValueArgs *args,
         size_t size)
 {
-    int n_params = 0;
-    int ret;
-    int i, j;
-
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_RESP_SENSOR)
-        return SMP_ERROR_BAD_MESSAGE;
-
-    /* we use two args in SmpMessage for one parameter */
-    n_params = smp_message_n_args(message) / 2;
-    if (size < (size_t) n_params)
-        return SMP_ERROR_OVERFLOW;
-
-    for (i = 0, j = 0; i < n_params; i++, j += 2) {
-        ret = smp_message_get_uint8(message, j, &args[i].sensor_id);
-        if (ret < 0)
-            return ret;
-
-        ret = smp_message_get_uint16(message, j + 1, &args[i].sensor_value);
-        if (ret < 0)
-            return ret;
-    }
-
-    return n_params;
+    return tup_message_read(message, TUP_MESSAGE_RESP_SENSOR, NULL, args,
+            size);
 }
 
 /**
@@ -1829,26 +2467,10 @@ int tup_message_parse_resp_sensor(TupMessage *message, TupSensorValueArgs *args,
 int tup_message_init_resp_input(TupMessage *message, uint8_t effect_slot_id,
         TupInputValueArgs *args, size_t n_args)
 {
-    int ret;
-    size_t i, j;
-
-    smp_message_set_id(message, TUP_MESSAGE_RESP_INPUT);
-
-    ret = smp_message_set_uint8(message, 0, effect_slot_id);
-    if (ret < 0)
-        return ret;
-
-    for (i = 0, j = 1; i < n_args; i++, j += 2) {
-        ret = smp_message_set_uint8(message, j, args[i].input_id);
-        if (ret < 0)
-            return ret;
+    const void *fields[] = { &effect_slot_id };
 
-        ret = smp_message_set_int32(message, j + 1, args[i].input_value);
-        if (ret < 0)
-            return ret;
-    }
-
-    return 0;
+    return tup_message_write(message, TUP_MESSAGE_RESP_INPUT, fields, args,
+            n_args);
 }
 
 /**
@@ -1865,33 +2487,10 @@ int tup_message_init_resp_input(TupMessage *message, uint8_t effect_slot_id,
 int tup_message_parse_resp_input(TupMessage *message, uint8_t *effect_slot_id,
         TupInputValueArgs *args, size_t size)
 {
-    int n_params = 0;
-    int ret;
-    int i, j;
-
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_RESP_INPUT)
-        return SMP_ERROR_BAD_MESSAGE;
+    void *fields[] = { effect_slot_id };
 
-    /* we use two args in SmpMessage for one parameter */
-    n_params = (smp_message_n_args(message) - 1) / 2;
-    if (size < (size_t) n_params)
-        return SMP_ERROR_OVERFLOW;
-
-    ret = smp_message_get_uint8(message, 0, effect_slot_id);
-    if (ret < 0)
-        return ret;
-
-    for (i = 0, j = 1; i < n_params; i++, j += 2) {
-        ret = smp_message_get_uint8(message, j, &args[i].input_id);
-        if (ret < 0)
-            return ret;
-
-        ret = smp_message_get_int32(message, j + 1, &args[i].input_value);
-        if (ret < 0)
-            return ret;
-    }
-
-    return n_params;
+    return tup_message_read(message, TUP_MESSAGE_RESP_INPUT, fields, args,
+            size);
 }
 
 /**
@@ -1905,8 +2504,9 @@ int tup_message_parse_resp_input(TupMessage *message, uint8_t *effect_slot_id,
  */
 void tup_message_init_resp_buildinfo(TupMessage *message, const char *buildinfo)
 {
-    smp_message_set_id(message, TUP_MESSAGE_RESP_BUILDINFO);
-    smp_message_set_cstring(message, 0, buildinfo);
+    const void *fields[] = { &buildinfo };
+
+    tup_message_write(message, TUP_MESSAGE_RESP_BUILDINFO, fields, NULL, 0);
 }
 
 /**
@@ -1923,70 +2523,29 @@ void tup_message_init_resp_buildinfo(TupMessage *message, const char *buildinfo)
 int tup_message_parse_resp_buildinfo(TupMessage *message,
         const char **buildinfo)
 {
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_RESP_BUILDINFO)
-        return SMP_ERROR_BAD_MESSAGE;
+    void *fields[] = { buildinfo };
 
-    return smp_message_get_cstring(message, 0, buildinfo);
+    return tup_message_read(message, TUP_MESSAGE_RESP_BUILDINFO, fields, NULL,
+            0);
 }
 
 int tup_message_init_resp_set_parameter(TupMessage *message, uint8_t effect_id,
         int32_t retval, TupParameterArgs *args, size_t n_args)
 {
-    size_t i;
-    int ret;
+    const void *fields[] = { &effect_id, &retval };
 
-    smp_message_set_id(message, TUP_MESSAGE_RESP_SET_PARAMETER);
-
-    ret = smp_message_set(message, 0, SMP_TYPE_UINT8, effect_id,
-            1, SMP_TYPE_INT32, retval, -1);
-    if (ret < 0)
-        return ret;
-
-    for (i = 0; i < n_args; i++) {
-        ret = smp_message_set(message,
-                2 + 2 * i + 0, SMP_TYPE_UINT8, args[i].parameter_id,
-                2 + 2 * i + 1, SMP_TYPE_UINT32, args[i].parameter_value,
-                -1);
-        if (ret < 0)
-            return ret;
-    }
-
-    return 0;
+    return tup_message_write(message, TUP_MESSAGE_RESP_SET_PARAMETER, fields,
+            args, n_args);
 }
 
 int tup_message_parse_resp_set_parameter(TupMessage *message,
         uint8_t *effect_id, int32_t *retval, TupParameterArgs *args,
         size_t n_args)
 {
-    int n_params;
-    int i;
-    int ret;
-
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_RESP_INPUT)
-        return SMP_ERROR_BAD_MESSAGE;
-
-    n_params = tup_message_parse_resp_set_parameter_get_parameter_count(message);
-    if (n_params < 0)
-        return n_params;
-
-    if (n_args < (size_t) n_params)
-        return SMP_ERROR_OVERFLOW;
-
-    ret = smp_message_get(message, 0, SMP_TYPE_UINT8, &effect_id,
-            1, SMP_TYPE_INT32, &retval, -1);
-    if (ret < 0)
-        return ret;
-
-    for (i = 0; i < n_params; i++) {
-        ret = smp_message_get(message,
-                2 + 2 * i + 0, SMP_TYPE_UINT8, &args[i].parameter_id,
-                2 + 2 * i + 1, SMP_TYPE_UINT32, &args[i].parameter_value,
-                -1);
-        if (ret < 0)
-            return ret;
-    }
+    void *fields[] = { effect_id, retval };
 
-    return n_params;
+    return tup_message_read(message, TUP_MESSAGE_RESP_SET_PARAMETER, fields,
+            args, n_args);
 }
 
 int tup_message_parse_resp_set_parameter_get_parameter_count(TupMessage *message)
@@ -2002,31 +2561,26 @@ int tup_message_parse_resp_set_parameter_get_parameter_count(TupMessage *message
 int tup_message_parse_resp_set_parameter_get_effect_id(TupMessage *message,
         uint8_t *effect_id)
 {
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_RESP_SET_PARAMETER)
-        return SMP_ERROR_BAD_MESSAGE;
+    void *fields[] = { effect_id, NULL };
 
-    return smp_message_get_uint8(message, 0, effect_id);
+    return tup_message_read(message, TUP_MESSAGE_RESP_SET_PARAMETER, fields,
+            NULL, 0);
 }
 
 int tup_message_parse_resp_set_parameter_get_return_value(TupMessage *message,
         int32_t *retval)
 {
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_RESP_SET_PARAMETER)
-        return SMP_ERROR_BAD_MESSAGE;
+    void *fields[] = { NULL, retval };
 
-    return smp_message_get_int32(message, 1, retval);
+    return tup_message_read(message, TUP_MESSAGE_RESP_SET_PARAMETER, fields,
+            NULL, 0);
 }
 
 int tup_message_parse_resp_set_parameter_get_parameter(TupMessage *message,
         unsigned int index, TupParameterArgs *arg)
 {
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_RESP_SET_PARAMETER)
-        return SMP_ERROR_BAD_MESSAGE;
-
-    return smp_message_get(message,
-            2 + 2 * index + 0, SMP_TYPE_UINT8, &arg->parameter_id,
-            2 + 2 * index + 1, SMP_TYPE_UINT32, &arg->parameter_value,
-            -1);
+    return tup_message_read_group(message, TUP_MESSAGE_RESP_SET_PARAMETER,
+            index, arg);
 }
 
 /**
@@ -2042,11 +2596,10 @@ int tup_message_parse_resp_set_parameter_get_parameter(TupMessage *message,
 int tup_message_init_resp_filter_active(TupMessage *message, TupFilterId filter,
         uint8_t actuator_id, bool active)
 {
-    smp_message_set_id(message, TUP_MESSAGE_RESP_FILTER_ACTIVE);
-    return smp_message_set(message, 0, SMP_TYPE_UINT8, filter,
-            1, SMP_TYPE_UINT8, actuator_id,
-            2, SMP_TYPE_UINT8, active ? 1 : 0,
-            -1);
+    const void *fields[] = { &filter, &actuator_id, &active };
+
+    return tup_message_write(message, TUP_MESSAGE_RESP_FILTER_ACTIVE, fields,
+            NULL, 0);
 }
 
 /**
@@ -2062,23 +2615,10 @@ int tup_message_init_resp_filter_active(TupMessage *message, TupFilterId filter,
 int tup_message_parse_resp_filter_active(TupMessage *message,
         TupFilterId *filter, uint8_t *actuator_id, bool *active)
 {
-    uint8_t filter_tmp;
-    uint8_t active_tmp;
-    int ret;
-
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_RESP_FILTER_ACTIVE)
-        return SMP_ERROR_BAD_MESSAGE;
-
-    ret = smp_message_get(message, 0, SMP_TYPE_UINT8, &filter_tmp,
-            1, SMP_TYPE_UINT8, actuator_id,
-            2, SMP_TYPE_UINT8, &active_tmp,
-            -1);
-    if (ret < 0)
-        return ret;
+    void *fields[] = { filter, actuator_id, active };
 
-    *filter = (TupFilterId) filter_tmp;
-    *active = (active_tmp > 0) ? true : false;
-    return 0;
+    return tup_message_read(message, TUP_MESSAGE_RESP_FILTER_ACTIVE, fields,
+            NULL, 0);
 }
 
 /**
@@ -2095,19 +2635,10 @@ int tup_message_parse_resp_filter_active(TupMessage *message,
 int tup_message_init_resp_band_norm_coeffs(TupMessage *message,
         uint8_t actuator_id, float a[5], float b[5])
 {
-    smp_message_set_id(message, TUP_MESSAGE_RESP_BAND_NORM_COEFFS);
-    return smp_message_set(message, 0, SMP_TYPE_UINT8, actuator_id,
-            1, SMP_TYPE_F32, a[0],
-            2, SMP_TYPE_F32, a[1],
-            3, SMP_TYPE_F32, a[2],
-            4, SMP_TYPE_F32, a[3],
-            5, SMP_TYPE_F32, a[4],
-            6, SMP_TYPE_F32, b[0],
-            7, SMP_TYPE_F32, b[1],
-            8, SMP_TYPE_F32, b[2],
-            9, SMP_TYPE_F32, b[3],
-            10, SMP_TYPE_F32, b[4],
-            -1);
+    const void *fields[] = { &actuator_id, a, b };
+
+    return tup_message_write(message, TUP_MESSAGE_RESP_BAND_NORM_COEFFS,
+            fields, NULL, 0);
 }
 
 /**
@@ -2124,23 +2655,10 @@ int tup_message_init_resp_band_norm_coeffs(TupMessage *message,
 int tup_message_parse_resp_band_norm_coeffs(TupMessage *message,
         uint8_t *actuator_id, float a[5], float b[5])
 {
-    int msgid = smp_message_get_msgid(message);
+    void *fields[] = { actuator_id, a, b };
 
-    if (msgid != TUP_MESSAGE_RESP_BAND_NORM_COEFFS)
-        return SMP_ERROR_BAD_MESSAGE;
-
-    return smp_message_get(message, 0, SMP_TYPE_UINT8, actuator_id,
-            1, SMP_TYPE_F32, &a[0],
-            2, SMP_TYPE_F32, &a[1],
-            3, SMP_TYPE_F32, &a[2],
-            4, SMP_TYPE_F32, &a[3],
-            5, SMP_TYPE_F32, &a[4],
-            6, SMP_TYPE_F32, &b[0],
-            7, SMP_TYPE_F32, &b[1],
-            8, SMP_TYPE_F32, &b[2],
-            9, SMP_TYPE_F32, &b[3],
-            10, SMP_TYPE_F32, &b[4],
-            -1);
+    return tup_message_read(message, TUP_MESSAGE_RESP_BAND_NORM_COEFFS,
+            fields, NULL, 0);
 }
 
 /**
@@ -2168,31 +2686,12 @@ void tup_message_init_cmd_debug_get_system_status(TupMessage *message)
 int tup_message_init_resp_debug_system_status(TupMessage *message,
         TupDebugSystemStatus *status, TupDebugTaskStatus *tasks, size_t n_tasks)
 {
-    int sindex = 0;
-    size_t i;
-    int ret;
-
-    smp_message_set_id(message, TUP_MESSAGE_RESP_DEBUG_SYSTEM_STATUS);
-
-    /* first, serialize TupDebugSystemStatus */
-    smp_message_set_uint64(message, sindex++, status->rtime);
-    smp_message_set_uint32(message, sindex++, status->mem_total);
-    smp_message_set_uint32(message, sindex++, status->mem_used);
-
-    for (i = 0; i < n_tasks; i++) {
-        ret = smp_message_set(message,
-                6 * i + sindex + 0, SMP_TYPE_UINT32, tasks[i].id,
-                6 * i + sindex + 1, SMP_TYPE_STRING, tasks[i].name,
-                6 * i + sindex + 2, SMP_TYPE_UINT8, tasks[i].state,
-                6 * i + sindex + 3, SMP_TYPE_UINT32, tasks[i].priority,
-                6 * i + sindex + 4, SMP_TYPE_UINT64, tasks[i].time,
-                6 * i + sindex + 5, SMP_TYPE_UINT32, tasks[i].rem_stack,
-                -1);
-        if (ret < 0)
-            return ret;
-    }
+    const void *fields[] = {
+        &status->rtime, &status->mem_total, &status->mem_used
+    };
 
-    return 0;
+    return tup_message_write(message, TUP_MESSAGE_RESP_DEBUG_SYSTEM_STATUS,
+            fields, tasks, n_tasks);
 }
 
 /**
@@ -2209,46 +2708,195 @@ int tup_message_init_resp_debug_system_status(TupMessage *message,
 int tup_message_parse_resp_debug_system_status(TupMessage *message,
         TupDebugSystemStatus *status, TupDebugTaskStatus *tasks, size_t n_tasks)
 {
-    size_t i;
-    int ret;
-    int n_msg_tasks;
-    int sindex = 0;
+    void *fields[] = { &status->rtime, &status->mem_total, &status->mem_used };
 
-    if (smp_message_get_msgid(message) != TUP_MESSAGE_RESP_DEBUG_SYSTEM_STATUS)
-        return SMP_ERROR_BAD_MESSAGE;
+    return tup_message_read(message, TUP_MESSAGE_RESP_DEBUG_SYSTEM_STATUS,
+            fields, tasks, n_tasks);
+}
 
-    n_msg_tasks = (smp_message_n_args(message) - 3) / 6;
-    if (n_tasks < (size_t) n_msg_tasks)
-        return SMP_ERROR_OVERFLOW;
+/**
+ * \ingroup message
+ * Get the number of repeated arguments an iterator has not returned yet.
+ *
+ * @param[in] iter an initialized TupMessageIter
+ *
+ * @return the number of remaining elements.
+ */
+size_t tup_message_iter_get_remaining(const TupMessageIter *iter)
+{
+    return iter->n_groups - iter->index;
+}
 
-    ret = smp_message_get_uint64(message, sindex++, &status->rtime);
-    if (ret < 0)
-        return ret;
+/**
+ * \ingroup message
+ * Parse the effect id of a get_parameter response message and initialize an
+ * iterator over its parameters. The message shall outlive the iterator.
+ *
+ * @param[out] iter the TupMessageIter to initialize
+ * @param[in] message the TupMessage
+ * @param[out] effect_id pointer to hold the loaded effect id
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_resp_parameter_iter_init(TupMessageIter *iter, TupMessage *message,
+        uint8_t *effect_id)
+{
+    void *fields[] = { effect_id };
 
-    ret = smp_message_get_uint32(message, sindex++, &status->mem_total);
-    if (ret < 0)
-        return ret;
+    return tup_message_iter_init(iter, message, TUP_MESSAGE_RESP_PARAMETER,
+            fields);
+}
 
-    ret = smp_message_get_uint32(message, sindex++, &status->mem_used);
-    if (ret < 0)
-        return ret;
+/**
+ * \ingroup message
+ * Get the next parameter of a get_parameter response message.
+ *
+ * @param[in] iter a TupMessageIter set by tup_resp_parameter_iter_init()
+ * @param[out] arg the parameter
+ *
+ * @return 1 if arg is set, 0 at the end of the message, a SmpError otherwise.
+ */
+int tup_resp_parameter_iter_next(TupMessageIter *iter, TupParameterArgs *arg)
+{
+    return tup_message_iter_next(iter, arg);
+}
 
-    for (i = 0; i < (size_t) n_msg_tasks; i++) {
-        uint8_t tmp_state;
-
-        ret = smp_message_get(message,
-                6 * i + sindex + 0, SMP_TYPE_UINT32, &tasks[i].id,
-                6 * i + sindex + 1, SMP_TYPE_STRING, &tasks[i].name,
-                6 * i + sindex + 2, SMP_TYPE_UINT8, &tmp_state,
-                6 * i + sindex + 3, SMP_TYPE_UINT32, &tasks[i].priority,
-                6 * i + sindex + 4, SMP_TYPE_UINT64, &tasks[i].time,
-                6 * i + sindex + 5, SMP_TYPE_UINT32, &tasks[i].rem_stack,
-                -1);
-        if (ret < 0)
-            return ret;
+/**
+ * \ingroup message
+ * Parse the fixed arguments of a set_parameter response message and
+ * initialize an iterator over its parameters. The message shall outlive the
+ * iterator.
+ *
+ * @param[out] iter the TupMessageIter to initialize
+ * @param[in] message the TupMessage
+ * @param[out] effect_id pointer to hold the loaded effect id
+ * @param[out] retval pointer to hold the return value of the command
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_resp_set_parameter_iter_init(TupMessageIter *iter,
+        TupMessage *message, uint8_t *effect_id, int32_t *retval)
+{
+    void *fields[] = { effect_id, retval };
 
-        tasks[i].state = tmp_state;
-    }
+    return tup_message_iter_init(iter, message,
+            TUP_MESSAGE_RESP_SET_PARAMETER, fields);
+}
+
+/**
+ * \ingroup message
+ * Get the next parameter of a set_parameter response message.
+ *
+ * @param[in] iter a TupMessageIter set by tup_resp_set_parameter_iter_init()
+ * @param[out] arg the parameter
+ *
+ * @return 1 if arg is set, 0 at the end of the message, a SmpError otherwise.
+ */
+int tup_resp_set_parameter_iter_next(TupMessageIter *iter,
+        TupParameterArgs *arg)
+{
+    return tup_message_iter_next(iter, arg);
+}
+
+/**
+ * \ingroup message
+ * Initialize an iterator over the sensor values of a get_sensor_value
+ * response message. The message shall outlive the iterator.
+ *
+ * @param[out] iter the TupMessageIter to initialize
+ * @param[in] message the TupMessage
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_resp_sensor_iter_init(TupMessageIter *iter, TupMessage *message)
+{
+    return tup_message_iter_init(iter, message, TUP_MESSAGE_RESP_SENSOR,
+            NULL);
+}
+
+/**
+ * \ingroup message
+ * Get the next sensor value of a get_sensor_value response message.
+ *
+ * @param[in] iter a TupMessageIter set by tup_resp_sensor_iter_init()
+ * @param[out] arg the sensor value
+ *
+ * @return 1 if arg is set, 0 at the end of the message, a SmpError otherwise.
+ */
+int tup_resp_sensor_iter_next(TupMessageIter *iter, TupSensorValueArgs *arg)
+{
+    return tup_message_iter_next(iter, arg);
+}
+
+/**
+ * \ingroup message
+ * Parse the effect slot id of a get_input_value response message and
+ * initialize an iterator over its input values. The message shall outlive
+ * the iterator.
+ *
+ * @param[out] iter the TupMessageIter to initialize
+ * @param[in] message the TupMessage
+ * @param[out] effect_slot_id pointer to hold the effect slot id
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_resp_input_iter_init(TupMessageIter *iter, TupMessage *message,
+        uint8_t *effect_slot_id)
+{
+    void *fields[] = { effect_slot_id };
+
+    return tup_message_iter_init(iter, message, TUP_MESSAGE_RESP_INPUT,
+            fields);
+}
+
+/**
+ * \ingroup message
+ * Get the next input value of a get_input_value response message.
+ *
+ * @param[in] iter a TupMessageIter set by tup_resp_input_iter_init()
+ * @param[out] arg the input value
+ *
+ * @return 1 if arg is set, 0 at the end of the message, a SmpError otherwise.
+ */
+int tup_resp_input_iter_next(TupMessageIter *iter, TupInputValueArgs *arg)
+{
+    return tup_message_iter_next(iter, arg);
+}
+
+/**
+ * \ingroup message
+ * Parse the system status of a response message and initialize an iterator
+ * over its tasks. The message shall outlive the iterator.
+ *
+ * @param[out] iter the TupMessageIter to initialize
+ * @param[in] message the TupMessage
+ * @param[out] status a TupDebugSystemStatus structure
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_resp_debug_system_status_iter_init(TupMessageIter *iter,
+        TupMessage *message, TupDebugSystemStatus *status)
+{
+    void *fields[] = { &status->rtime, &status->mem_total, &status->mem_used };
 
-    return n_msg_tasks;
+    return tup_message_iter_init(iter, message,
+            TUP_MESSAGE_RESP_DEBUG_SYSTEM_STATUS, fields);
+}
+
+/**
+ * \ingroup message
+ * Get the next task of a system status response message. The task name
+ * points into the message.
+ *
+ * @param[in] iter a TupMessageIter set by
+ *                 tup_resp_debug_system_status_iter_init()
+ * @param[out] task the task status
+ *
+ * @return 1 if task is set, 0 at the end of the message, a SmpError
+ * otherwise.
+ */
+int tup_resp_debug_system_status_iter_next(TupMessageIter *iter,
+        TupDebugTaskStatus *task)
+{
+    return tup_message_iter_next(iter, task);
 }
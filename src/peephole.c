@@ -0,0 +1,230 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * \defgroup peephole Peephole
+ *
+ * Optimization of queued commands.
+ *
+ * Before being serialized into the write buffer, messages sent with
+ * tup_context_send_batch() or with write combining enabled go through a
+ * small peephole pass keeping back the last command:
+ * - adjacent SET_PARAMETER or SET_INPUT_VALUE commands setting a single
+ *   value of the same effect or effect slot are merged into one message
+ *   with several (id, value) pairs, up to TUP_PEEPHOLE_MAX_VALUES values;
+ * - a PLAY immediately followed by a STOP of the same effect is dropped.
+ *   The STOP is still sent as the effect may have been playing before.
+ *
+ * Each frame costs 8 bytes of header and framing, so merging n values
+ * mostly saves (n - 1) of them. A merged command gets a single response
+ * though, so commands sent with tup_context_send_request() are written as
+ * is, after the held message.
+ */
+
+#ifndef TUP_ENABLE_STATIC_API
+#define TUP_ENABLE_STATIC_API
+#endif
+
+#include "libtup-private.h"
+#include <stdlib.h>
+
+/* get the key of a command setting a single value, 0 if msg isn't one. The
+ * coalescer uses it too */
+int tup_peephole_get_update_key(TupMessage *msg, uint8_t *id,
+        uint8_t *sub_id)
+{
+    TupMessageType type = TUP_MESSAGE_TYPE(msg);
+
+    if (type != TUP_MESSAGE_CMD_SET_INPUT_VALUE
+            && type != TUP_MESSAGE_CMD_SET_PARAMETER)
+        return 0;
+
+    /* id, then a single (sub id, value) pair */
+    if (smp_message_n_args(msg) != 3)
+        return 0;
+
+    if (smp_message_get_uint8(msg, 0, id) < 0
+            || smp_message_get_uint8(msg, 1, sub_id) < 0)
+        return 0;
+
+    return 1;
+}
+
+#if TUP_ENABLE_PEEPHOLE
+struct TupPeephole
+{
+    /* merged command, or PLAY, waiting for the next message */
+    TupMessage *held;
+    TupMessageType held_type;       /* 0 if nothing is held */
+    uint8_t held_id;
+};
+
+/* copy values [first, first + n) of src at the end of dst */
+static int tup_peephole_copy_values(TupMessage *dst, TupMessage *src,
+        int first, int n)
+{
+    SmpValue value;
+    int index = smp_message_n_args(dst);
+    int ret;
+    int i;
+
+    for (i = first; i < first + n; i++) {
+        ret = smp_message_get_value(src, i, &value);
+        if (ret < 0)
+            return ret;
+
+        ret = smp_message_set_value(dst, index++, &value);
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+void tup_peephole_free(TupPeephole *peephole)
+{
+    tup_message_free(peephole->held);
+    tup_free(peephole);
+}
+
+/* drop the held message, if any */
+void tup_peephole_reset(TupPeephole *peephole)
+{
+    peephole->held_type = 0;
+}
+
+/* serialize the held message, if any */
+int tup_peephole_flush(TupContext *ctx)
+{
+    TupPeephole *peephole = ctx->wbuf->peephole;
+    TupMessageType type = peephole->held_type;
+
+    if (type == 0)
+        return 0;
+
+    peephole->held_type = 0;
+
+    if (type == TUP_MESSAGE_CMD_PLAY) {
+        tup_message_clear(peephole->held);
+        tup_message_init_play(peephole->held, peephole->held_id);
+    }
+
+    return tup_write_buffer_append(ctx, peephole->held);
+}
+
+/* optimize msg with the held message and serialize what can't be anymore */
+int tup_peephole_push(TupContext *ctx, TupMessage *msg)
+{
+    TupPeephole *peephole = ctx->wbuf->peephole;
+    TupMessageType type = TUP_MESSAGE_TYPE(msg);
+    uint8_t sub_id;
+    uint8_t id;
+    int ret;
+
+    if (tup_peephole_get_update_key(msg, &id, &sub_id)) {
+        if (peephole->held_type == type && peephole->held_id == id
+                && TUP_PEEPHOLE_N_VALUES(smp_message_n_args(peephole->held))
+                    < TUP_PEEPHOLE_MAX_VALUES)
+            return tup_peephole_copy_values(peephole->held, msg, 1, 2);
+
+        ret = tup_peephole_flush(ctx);
+        if (ret < 0)
+            return ret;
+
+        tup_message_clear(peephole->held);
+        smp_message_set_id(peephole->held, type);
+
+        ret = tup_peephole_copy_values(peephole->held, msg, 0, 3);
+        if (ret < 0)
+            return ret;
+
+        peephole->held_type = type;
+        peephole->held_id = id;
+        return 0;
+    }
+
+    if (type == TUP_MESSAGE_CMD_STOP
+            && peephole->held_type == TUP_MESSAGE_CMD_PLAY
+            && smp_message_get_uint8(msg, 0, &id) == 0
+            && id == peephole->held_id) {
+        peephole->held_type = 0;
+        return tup_write_buffer_append(ctx, msg);
+    }
+
+    ret = tup_peephole_flush(ctx);
+    if (ret < 0)
+        return ret;
+
+    if (type == TUP_MESSAGE_CMD_PLAY && smp_message_n_args(msg) == 1
+            && smp_message_get_uint8(msg, 0, &id) == 0) {
+        peephole->held_type = type;
+        peephole->held_id = id;
+        return 0;
+    }
+
+    return tup_write_buffer_append(ctx, msg);
+}
+
+/* API */
+
+/**
+ * \ingroup peephole
+ * Enable or disable the optimization of messages sent with
+ * tup_context_send_batch() or with write combining enabled. Disabling
+ * serializes the message held back.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] enable true to enable optimization, false to disable it
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_enable_peephole(TupContext *ctx, bool enable)
+{
+    TupPeephole *peephole;
+    int ret;
+
+    if (!enable) {
+        if (ctx->wbuf == NULL || ctx->wbuf->peephole == NULL)
+            return 0;
+
+        ret = tup_peephole_flush(ctx);
+        tup_peephole_free(ctx->wbuf->peephole);
+        ctx->wbuf->peephole = NULL;
+        return ret;
+    }
+
+    ret = tup_write_buffer_ensure(ctx);
+    if (ret < 0)
+        return ret;
+
+    if (ctx->wbuf->peephole != NULL)
+        return 0;
+
+    peephole = tup_calloc(1, sizeof(*peephole));
+    if (peephole == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    peephole->held = tup_message_new();
+    if (peephole->held == NULL) {
+        tup_free(peephole);
+        return SMP_ERROR_NO_MEM;
+    }
+
+    ctx->wbuf->peephole = peephole;
+    return 0;
+}
+#endif
@@ -0,0 +1,410 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * \defgroup prepared Prepared message
+ *
+ * Messages serialized once and sent many times.
+ *
+ * A TupPreparedMessage holds a message serialized when it is created, along
+ * with the position of each of its arguments. Setting an argument patches
+ * its bytes and the checksum in place, so the message shape shall not
+ * change: the new value shall have the type of the old one and strings
+ * can't be set. The frame is escaped again on the next send only.
+ *
+ * Prepared messages are written directly to the device, or to the write
+ * combining buffer. When the context needs the message itself, that is in
+ * threaded mode or when coalescing, the shadow state or the peephole
+ * optimizer are enabled, they are sent with tup_context_send() instead.
+ */
+
+#ifndef TUP_ENABLE_STATIC_API
+#define TUP_ENABLE_STATIC_API
+#endif
+
+#include "libtup-private.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct TupPreparedMessage
+{
+    /* updated from data when stale, for tup_context_send() */
+    TupMessage *msg;
+    int msg_stale;
+
+    /* serialized message and offset of each argument value */
+    uint8_t *data;
+    size_t size;
+    size_t *offsets;
+    int n_args;
+    uint8_t crc;
+
+    /* escaped frame, updated on send when dirty */
+    uint8_t *frame;
+    size_t frame_size;
+    int dirty;
+};
+
+/**
+ * \ingroup prepared
+ * Create a TupPreparedMessage from a message. The message arguments are
+ * copied, except strings which shall exist as long as the prepared message.
+ *
+ * @param[in] message an initialized TupMessage
+ *
+ * @return a new TupPreparedMessage or NULL on error.
+ */
+TupPreparedMessage *tup_prepared_message_new(TupMessage *message)
+{
+    TupPreparedMessage *prepared;
+    SmpValue value;
+    size_t i;
+    int ret;
+
+    prepared = tup_calloc(1, sizeof(TupPreparedMessage));
+    if (prepared == NULL)
+        return NULL;
+
+    prepared->msg = tup_message_new();
+    if (prepared->msg == NULL)
+        goto error;
+
+    smp_message_set_id(prepared->msg, smp_message_get_msgid(message));
+
+    prepared->n_args = smp_message_n_args(message);
+    for (i = 0; i < (size_t) prepared->n_args; i++) {
+        if (smp_message_get_value(message, i, &value) < 0
+                || smp_message_set_value(prepared->msg, i, &value) < 0)
+            goto error;
+    }
+
+    ret = tup_frame_get_payload_size(message);
+    if (ret < 0 || ret > TUP_FRAME_MAX_MESSAGE_SIZE)
+        goto error;
+
+    /* message header and arguments */
+    prepared->size = 8 + ret;
+    prepared->data = tup_malloc(prepared->size);
+    prepared->offsets = tup_malloc((prepared->n_args + 1) * sizeof(size_t));
+    prepared->frame = tup_malloc(2 * prepared->size + 4);
+    if (prepared->data == NULL || prepared->offsets == NULL
+            || prepared->frame == NULL)
+        goto error;
+
+    ret = tup_frame_serialize(message, prepared->data, prepared->size,
+            prepared->offsets);
+    if (ret < 0)
+        goto error;
+
+    for (i = 0; i < prepared->size; i++)
+        prepared->crc ^= prepared->data[i];
+
+    prepared->dirty = 1;
+    return prepared;
+
+error:
+    tup_prepared_message_free(prepared);
+    return NULL;
+}
+
+/**
+ * \ingroup prepared
+ * Free a TupPreparedMessage.
+ *
+ * @param[in] prepared the TupPreparedMessage
+ */
+void tup_prepared_message_free(TupPreparedMessage *prepared)
+{
+    if (prepared->msg != NULL)
+        tup_message_free(prepared->msg);
+
+    tup_free(prepared->frame);
+    tup_free(prepared->offsets);
+    tup_free(prepared->data);
+    tup_free(prepared);
+}
+
+/* set the arguments of msg back from data */
+static void tup_prepared_message_update(TupPreparedMessage *prepared)
+{
+    const uint8_t *data;
+    SmpValue value;
+    uint64_t bits;
+    uint32_t u32;
+    size_t size;
+    size_t i;
+    int j;
+
+    for (j = 0; j < prepared->n_args; j++) {
+        data = prepared->data + prepared->offsets[j];
+
+        switch (data[-1]) {
+            case SMP_TYPE_UINT8:
+            case SMP_TYPE_INT8:
+                size = 1;
+                break;
+            case SMP_TYPE_UINT16:
+            case SMP_TYPE_INT16:
+                size = 2;
+                break;
+            case SMP_TYPE_UINT32:
+            case SMP_TYPE_INT32:
+            case SMP_TYPE_F32:
+                size = 4;
+                break;
+            case SMP_TYPE_UINT64:
+            case SMP_TYPE_INT64:
+            case SMP_TYPE_F64:
+                size = 8;
+                break;
+            default:
+                /* strings can't be set */
+                continue;
+        }
+
+        bits = 0;
+        for (i = 0; i < size; i++)
+            bits |= (uint64_t) data[i] << (8 * i);
+
+        value.type = data[-1];
+        switch (value.type) {
+            case SMP_TYPE_F32:
+                u32 = bits;
+                memcpy(&value.value.f32, &u32, sizeof(u32));
+                break;
+            case SMP_TYPE_F64:
+                memcpy(&value.value.f64, &bits, sizeof(bits));
+                break;
+            case SMP_TYPE_UINT8:
+            case SMP_TYPE_INT8:
+                value.value.u8 = bits;
+                break;
+            case SMP_TYPE_UINT16:
+            case SMP_TYPE_INT16:
+                value.value.u16 = bits;
+                break;
+            case SMP_TYPE_UINT32:
+            case SMP_TYPE_INT32:
+                value.value.u32 = bits;
+                break;
+            default:
+                value.value.u64 = bits;
+                break;
+        }
+
+        smp_message_set_value(prepared->msg, j, &value);
+    }
+
+    prepared->msg_stale = 0;
+}
+
+/**
+ * \ingroup prepared
+ * Get the message a TupPreparedMessage sends, with its current arguments. It
+ * shall not be modified.
+ *
+ * @param[in] prepared the TupPreparedMessage
+ *
+ * @return the TupMessage.
+ */
+TupMessage *tup_prepared_message_get_message(TupPreparedMessage *prepared)
+{
+    if (prepared->msg_stale)
+        tup_prepared_message_update(prepared);
+
+    return prepared->msg;
+}
+
+/**
+ * \ingroup prepared
+ * Set an argument of a prepared message.
+ *
+ * @param[in] prepared the TupPreparedMessage
+ * @param[in] index the index of the argument
+ * @param[in] value the new value, of the type of the current one
+ *
+ * @return 0 on success, SMP_ERROR_BAD_TYPE if the type differs,
+ * SMP_ERROR_NOT_SUPPORTED for strings or another SmpError otherwise.
+ */
+int tup_prepared_message_set_value(TupPreparedMessage *prepared,
+        unsigned int index, const SmpValue *value)
+{
+    uint64_t bits;
+    uint32_t u32;
+    uint8_t *data;
+    size_t size;
+    size_t i;
+
+    if (index >= (unsigned int) prepared->n_args)
+        return SMP_ERROR_NOT_FOUND;
+
+    /* the argument type precedes its value */
+    data = prepared->data + prepared->offsets[index];
+    if (data[-1] != value->type)
+        return SMP_ERROR_BAD_TYPE;
+
+    switch (value->type) {
+        case SMP_TYPE_UINT8:
+        case SMP_TYPE_INT8:
+            bits = value->value.u8;
+            size = 1;
+            break;
+        case SMP_TYPE_UINT16:
+        case SMP_TYPE_INT16:
+            bits = value->value.u16;
+            size = 2;
+            break;
+        case SMP_TYPE_UINT32:
+        case SMP_TYPE_INT32:
+            bits = value->value.u32;
+            size = 4;
+            break;
+        case SMP_TYPE_F32:
+            memcpy(&u32, &value->value.f32, sizeof(u32));
+            bits = u32;
+            size = 4;
+            break;
+        case SMP_TYPE_UINT64:
+        case SMP_TYPE_INT64:
+            bits = value->value.u64;
+            size = 8;
+            break;
+        case SMP_TYPE_F64:
+            memcpy(&bits, &value->value.f64, sizeof(bits));
+            size = 8;
+            break;
+        default:
+            return SMP_ERROR_NOT_SUPPORTED;
+    }
+
+    /* the checksum is a xor, swap the old bytes for the new ones */
+    for (i = 0; i < size; i++) {
+        prepared->crc ^= data[i];
+        data[i] = (bits >> (8 * i)) & 0xff;
+        prepared->crc ^= data[i];
+    }
+
+    prepared->dirty = 1;
+    prepared->msg_stale = 1;
+    return 0;
+}
+
+/**
+ * \ingroup prepared
+ * Set an int32 argument of a prepared message.
+ *
+ * @param[in] prepared the TupPreparedMessage
+ * @param[in] index the index of the argument
+ * @param[in] value the new value
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_prepared_message_set_int32(TupPreparedMessage *prepared,
+        unsigned int index, int32_t value)
+{
+    SmpValue svalue;
+
+    svalue.type = SMP_TYPE_INT32;
+    svalue.value.i32 = value;
+    return tup_prepared_message_set_value(prepared, index, &svalue);
+}
+
+/**
+ * \ingroup prepared
+ * Set an uint32 argument of a prepared message.
+ *
+ * @param[in] prepared the TupPreparedMessage
+ * @param[in] index the index of the argument
+ * @param[in] value the new value
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_prepared_message_set_uint32(TupPreparedMessage *prepared,
+        unsigned int index, uint32_t value)
+{
+    SmpValue svalue;
+
+    svalue.type = SMP_TYPE_UINT32;
+    svalue.value.u32 = value;
+    return tup_prepared_message_set_value(prepared, index, &svalue);
+}
+
+/**
+ * \ingroup prepared
+ * Send a prepared message.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] prepared the TupPreparedMessage
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_send_prepared(TupContext *ctx, TupPreparedMessage *prepared)
+{
+    int combine = 0;
+    int ret;
+
+    /* those look at the message */
+    if (ctx->shadow != NULL || ctx->coalescer != NULL
+            || (ctx->wbuf != NULL && ctx->wbuf->peephole != NULL
+                && ctx->wbuf->window > 0))
+        return tup_context_send(ctx,
+                tup_prepared_message_get_message(prepared));
+
+#ifdef HAVE_IO_THREAD
+    if (ctx->io_thread != NULL)
+        return tup_context_send(ctx,
+                tup_prepared_message_get_message(prepared));
+#endif
+
+    if (prepared->dirty) {
+        prepared->frame_size = tup_frame_wrap(prepared->data, prepared->size,
+                prepared->crc, prepared->frame);
+        prepared->dirty = 0;
+    }
+
+#if TUP_ENABLE_BATCH
+    combine = ctx->wbuf != NULL && ctx->wbuf->window > 0;
+    if (combine) {
+        ret = tup_write_buffer_append_frame(ctx, prepared->frame,
+                prepared->frame_size);
+    } else
+#endif
+    {
+        ret = tup_context_write_raw(ctx, prepared->frame,
+                prepared->frame_size);
+    }
+
+    if (ret < 0) {
+#if TUP_ENABLE_STATS
+        if (ctx->stats != NULL)
+            tup_stats_record_error(ctx, ret);
+#endif
+
+        return ret;
+    }
+
+#if TUP_ENABLE_STATS
+    if (ctx->stats != NULL)
+        tup_stats_record_tx_frame(ctx, smp_message_get_msgid(prepared->msg),
+                prepared->size - 8);
+#endif
+
+    if (combine && ctx->wbuf->len >= ctx->wbuf->window)
+        return tup_context_flush(ctx);
+
+    return 0;
+}
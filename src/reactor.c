@@ -0,0 +1,593 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * \defgroup reactor Reactor
+ *
+ * Event loop serving many TupContext from a single thread (Linux only).
+ *
+ * Every registered context is watched through its file descriptor in a
+ * single epoll set and tup_context_process_fd() is only called on the ready
+ * ones. Timers are backed by timerfd and tup_reactor_wakeup() uses an eventfd
+ * so another thread can interrupt tup_reactor_iterate().
+ *
+ * Before waiting, frames held by write combining are written and updates
+ * due in the coalescer are sent, the wait being shortened so the next
+ * pending update is sent on time even if no data is received.
+ */
+
+#ifndef TUP_ENABLE_STATIC_API
+#define TUP_ENABLE_STATIC_API
+#endif
+
+#include "libtup-private.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#define TUP_REACTOR_MAX_EVENTS 64
+
+typedef enum
+{
+    TUP_REACTOR_SOURCE_WAKEUP,
+    TUP_REACTOR_SOURCE_CONTEXT,
+    TUP_REACTOR_SOURCE_TIMER,
+    TUP_REACTOR_SOURCE_TIMELINE,
+} TupReactorSourceType;
+
+typedef struct TupReactorSource TupReactorSource;
+struct TupReactorSource
+{
+    TupReactorSourceType type;
+    int fd;
+    int removed;
+
+    /* TUP_REACTOR_SOURCE_CONTEXT */
+    TupContext *ctx;
+
+    /* TUP_REACTOR_SOURCE_TIMER */
+    int id;
+    int repeat;
+    TupReactorTimerCallback callback;
+    void *userdata;
+
+    /* TUP_REACTOR_SOURCE_TIMELINE */
+    TupTimeline *timeline;
+
+    TupReactorSource *next;
+};
+
+struct TupReactor
+{
+    int epfd;
+    TupReactorSource wakeup;
+
+    TupReactorSource *sources;
+    int next_timer_id;
+
+    /* sources removed while dispatching, freed at the end of iteration */
+    TupReactorSource *removed;
+
+    /* set by tup_reactor_quit(), possibly from another thread */
+    atomic_int quit;
+};
+
+static int tup_reactor_add_source(TupReactor *reactor,
+        TupReactorSource *source)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = source;
+
+    if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, source->fd, &ev) < 0)
+        return (errno == EEXIST) ? SMP_ERROR_ENTRY_EXISTS : SMP_ERROR_IO;
+
+    if (source != &reactor->wakeup) {
+        source->next = reactor->sources;
+        reactor->sources = source;
+    }
+
+    return 0;
+}
+
+static void tup_reactor_remove_source(TupReactor *reactor,
+        TupReactorSource *source)
+{
+    TupReactorSource **it;
+
+    for (it = &reactor->sources; *it != NULL; it = &(*it)->next) {
+        if (*it == source) {
+            *it = source->next;
+            break;
+        }
+    }
+
+    epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, source->fd, NULL);
+
+    if (source->type == TUP_REACTOR_SOURCE_TIMER)
+        close(source->fd);
+
+    /* an event may still reference it in the current iteration */
+    source->removed = 1;
+    source->next = reactor->removed;
+    reactor->removed = source;
+}
+
+static void tup_reactor_free_removed(TupReactor *reactor)
+{
+    while (reactor->removed != NULL) {
+        TupReactorSource *source = reactor->removed;
+
+        reactor->removed = source->next;
+        tup_free(source);
+    }
+}
+
+static void tup_reactor_report_error(TupContext *ctx, int error)
+{
+    if (ctx->cbs.error_cb != NULL)
+        ctx->cbs.error_cb(ctx, error, ctx->userdata);
+}
+
+static void tup_reactor_dispatch(TupReactor *reactor, TupReactorSource *source,
+        uint32_t events)
+{
+    uint64_t value;
+    int ret;
+
+    if (source->removed)
+        return;
+
+    switch (source->type) {
+        case TUP_REACTOR_SOURCE_WAKEUP:
+            if (read(source->fd, &value, sizeof(value)) < 0) {
+                /* nothing to do, eventfd is non blocking */
+            }
+            break;
+        case TUP_REACTOR_SOURCE_CONTEXT:
+            if (events & EPOLLIN) {
+                ret = tup_context_process_fd(source->ctx);
+                if (ret < 0)
+                    tup_reactor_report_error(source->ctx, ret);
+            }
+
+            /* device is gone, stop watching it to avoid spinning */
+            if (!source->removed && (events & (EPOLLHUP | EPOLLERR))) {
+                tup_reactor_remove_source(reactor, source);
+                tup_reactor_report_error(source->ctx, SMP_ERROR_NO_DEVICE);
+            }
+            break;
+        case TUP_REACTOR_SOURCE_TIMER:
+            if (read(source->fd, &value, sizeof(value)) != sizeof(value))
+                break;
+
+            if (!source->repeat)
+                tup_reactor_remove_source(reactor, source);
+
+            source->callback(reactor, source->userdata);
+            break;
+        case TUP_REACTOR_SOURCE_TIMELINE:
+            ret = tup_timeline_dispatch(source->timeline);
+            if (ret < 0) {
+                tup_reactor_report_error(
+                        tup_timeline_get_context(source->timeline), ret);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/* write what the registered contexts hold back and return the timeout of
+ * the next pending update, or timeout_ms if it is sooner */
+static int tup_reactor_flush_contexts(TupReactor *reactor, int timeout_ms)
+{
+    TupReactorSource *source;
+#if TUP_ENABLE_COALESCING
+    int update_timeout_ms;
+#endif
+    int ret;
+
+    for (source = reactor->sources; source != NULL; source = source->next) {
+        TupContext *ctx = source->ctx;
+
+        if (source->type != TUP_REACTOR_SOURCE_CONTEXT)
+            continue;
+
+#ifdef HAVE_IO_THREAD
+        /* the I/O thread writes on its own */
+        if (ctx->io_thread != NULL)
+            continue;
+#endif
+
+        ret = tup_context_flush(ctx);
+        if (ret < 0)
+            tup_reactor_report_error(ctx, ret);
+
+#if TUP_ENABLE_COALESCING
+        if (ctx->coalescer == NULL)
+            continue;
+
+        ret = tup_coalescer_drain(ctx, 0);
+        if (ret < 0)
+            tup_reactor_report_error(ctx, ret);
+
+        update_timeout_ms = tup_coalescer_get_timeout(ctx);
+        if (update_timeout_ms >= 0
+                && (timeout_ms < 0 || update_timeout_ms < timeout_ms))
+            timeout_ms = update_timeout_ms;
+#endif
+    }
+
+    return timeout_ms;
+}
+
+/* API */
+
+/**
+ * \ingroup reactor
+ * Create a new TupReactor.
+ *
+ * @return a TupReactor on success, NULL otherwise.
+ */
+TupReactor *tup_reactor_new(void)
+{
+    TupReactor *reactor;
+
+    reactor = tup_calloc(1, sizeof(*reactor));
+    if (reactor == NULL)
+        return NULL;
+
+    reactor->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (reactor->epfd < 0)
+        goto epoll_failed;
+
+    reactor->wakeup.type = TUP_REACTOR_SOURCE_WAKEUP;
+    reactor->wakeup.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reactor->wakeup.fd < 0)
+        goto eventfd_failed;
+
+    if (tup_reactor_add_source(reactor, &reactor->wakeup) < 0)
+        goto add_failed;
+
+    reactor->next_timer_id = 1;
+    return reactor;
+
+add_failed:
+    close(reactor->wakeup.fd);
+eventfd_failed:
+    close(reactor->epfd);
+epoll_failed:
+    tup_free(reactor);
+    return NULL;
+}
+
+/**
+ * \ingroup reactor
+ * Free a TupReactor. Registered contexts are not freed.
+ *
+ * @param[in] reactor the TupReactor
+ */
+void tup_reactor_free(TupReactor *reactor)
+{
+    while (reactor->sources != NULL)
+        tup_reactor_remove_source(reactor, reactor->sources);
+
+    tup_reactor_free_removed(reactor);
+
+    close(reactor->wakeup.fd);
+    close(reactor->epfd);
+    tup_free(reactor);
+}
+
+/**
+ * \ingroup reactor
+ * Watch an opened TupContext. Incoming data will be processed by
+ * tup_reactor_iterate() and dispatched to the context callbacks.
+ *
+ * @param[in] reactor the TupReactor
+ * @param[in] ctx an opened TupContext
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_reactor_add_context(TupReactor *reactor, TupContext *ctx)
+{
+    TupReactorSource *source;
+    intptr_t fd;
+    int ret;
+
+    fd = tup_context_get_fd(ctx);
+    if (fd < 0)
+        return (int) fd;
+
+    source = tup_calloc(1, sizeof(*source));
+    if (source == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    source->type = TUP_REACTOR_SOURCE_CONTEXT;
+    source->fd = (int) fd;
+    source->ctx = ctx;
+
+    ret = tup_reactor_add_source(reactor, source);
+    if (ret < 0)
+        tup_free(source);
+
+    return ret;
+}
+
+/**
+ * \ingroup reactor
+ * Stop watching a TupContext. This shall be called before closing the
+ * context.
+ *
+ * @param[in] reactor the TupReactor
+ * @param[in] ctx the TupContext
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_reactor_remove_context(TupReactor *reactor, TupContext *ctx)
+{
+    TupReactorSource *source;
+
+    for (source = reactor->sources; source != NULL; source = source->next) {
+        if (source->type == TUP_REACTOR_SOURCE_CONTEXT && source->ctx == ctx) {
+            tup_reactor_remove_source(reactor, source);
+            return 0;
+        }
+    }
+
+    return SMP_ERROR_NOT_FOUND;
+}
+
+/**
+ * \ingroup reactor
+ * Add a timer to the reactor. Its callback is called from
+ * tup_reactor_iterate() once timeout_ms elapsed and then every timeout_ms if
+ * repeat is set. A non repeating timer is removed after its callback is
+ * called.
+ *
+ * @param[in] reactor the TupReactor
+ * @param[in] timeout_ms the timeout in milliseconds, shall be greater than 0
+ * @param[in] repeat 1 to rearm the timer after each expiration, 0 otherwise
+ * @param[in] callback the function to call
+ * @param[in] userdata userdata to pass to callback
+ *
+ * @return a positive timer id on success, a SmpError otherwise.
+ */
+int tup_reactor_add_timer(TupReactor *reactor, unsigned int timeout_ms,
+        int repeat, TupReactorTimerCallback callback, void *userdata)
+{
+    TupReactorSource *source;
+    struct itimerspec spec;
+    int ret;
+
+    if (timeout_ms == 0 || callback == NULL)
+        return SMP_ERROR_INVALID_PARAM;
+
+    source = tup_calloc(1, sizeof(*source));
+    if (source == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    source->type = TUP_REACTOR_SOURCE_TIMER;
+    source->repeat = repeat;
+    source->callback = callback;
+    source->userdata = userdata;
+
+    source->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (source->fd < 0) {
+        tup_free(source);
+        return SMP_ERROR_IO;
+    }
+
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = timeout_ms / 1000;
+    spec.it_value.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    if (repeat)
+        spec.it_interval = spec.it_value;
+
+    if (timerfd_settime(source->fd, 0, &spec, NULL) < 0) {
+        ret = SMP_ERROR_IO;
+        goto error;
+    }
+
+    ret = tup_reactor_add_source(reactor, source);
+    if (ret < 0)
+        goto error;
+
+    source->id = reactor->next_timer_id++;
+    return source->id;
+
+error:
+    close(source->fd);
+    tup_free(source);
+    return ret;
+}
+
+/**
+ * \ingroup reactor
+ * Remove a timer from the reactor.
+ *
+ * @param[in] reactor the TupReactor
+ * @param[in] timer_id the id returned by tup_reactor_add_timer()
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_reactor_remove_timer(TupReactor *reactor, int timer_id)
+{
+    TupReactorSource *source;
+
+    for (source = reactor->sources; source != NULL; source = source->next) {
+        if (source->type == TUP_REACTOR_SOURCE_TIMER && source->id == timer_id) {
+            tup_reactor_remove_source(reactor, source);
+            return 0;
+        }
+    }
+
+    return SMP_ERROR_NOT_FOUND;
+}
+
+/**
+ * \ingroup reactor
+ * Watch a TupTimeline. Its commands will be sent by tup_reactor_iterate()
+ * once due and send errors reported to the error callback of its context.
+ *
+ * @param[in] reactor the TupReactor
+ * @param[in] timeline the TupTimeline
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_reactor_add_timeline(TupReactor *reactor, TupTimeline *timeline)
+{
+    TupReactorSource *source;
+    int ret;
+
+    source = tup_calloc(1, sizeof(*source));
+    if (source == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    source->type = TUP_REACTOR_SOURCE_TIMELINE;
+    source->fd = (int) tup_timeline_get_fd(timeline);
+    source->timeline = timeline;
+
+    ret = tup_reactor_add_source(reactor, source);
+    if (ret < 0)
+        tup_free(source);
+
+    return ret;
+}
+
+/**
+ * \ingroup reactor
+ * Stop watching a TupTimeline. This shall be called before freeing the
+ * timeline.
+ *
+ * @param[in] reactor the TupReactor
+ * @param[in] timeline the TupTimeline
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_reactor_remove_timeline(TupReactor *reactor, TupTimeline *timeline)
+{
+    TupReactorSource *source;
+
+    for (source = reactor->sources; source != NULL; source = source->next) {
+        if (source->type == TUP_REACTOR_SOURCE_TIMELINE
+                && source->timeline == timeline) {
+            tup_reactor_remove_source(reactor, source);
+            return 0;
+        }
+    }
+
+    return SMP_ERROR_NOT_FOUND;
+}
+
+/**
+ * \ingroup reactor
+ * Wake up the reactor if it is waiting in tup_reactor_iterate(). This is the
+ * only function which can be called from another thread.
+ *
+ * @param[in] reactor the TupReactor
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_reactor_wakeup(TupReactor *reactor)
+{
+    uint64_t value = 1;
+
+    if (write(reactor->wakeup.fd, &value, sizeof(value)) < 0
+            && errno != EAGAIN)
+        return SMP_ERROR_IO;
+
+    return 0;
+}
+
+/**
+ * \ingroup reactor
+ * Wait for events on registered sources and dispatch them. Frames combined
+ * by registered contexts are written and their due updates sent before
+ * waiting, the wait ends early when the next pending update is due.
+ *
+ * @param[in] reactor the TupReactor
+ * @param[in] timeout_ms a timeout in milliseconds. A negative value means no
+ *                       timeout
+ *
+ * @return the number of dispatched events on success, a SmpError otherwise.
+ */
+int tup_reactor_iterate(TupReactor *reactor, int timeout_ms)
+{
+    struct epoll_event events[TUP_REACTOR_MAX_EVENTS];
+    int n_events;
+    int i;
+
+    timeout_ms = tup_reactor_flush_contexts(reactor, timeout_ms);
+
+    n_events = epoll_wait(reactor->epfd, events, TUP_REACTOR_MAX_EVENTS,
+            timeout_ms);
+    if (n_events < 0)
+        return (errno == EINTR) ? 0 : SMP_ERROR_IO;
+
+    for (i = 0; i < n_events; i++)
+        tup_reactor_dispatch(reactor, events[i].data.ptr, events[i].events);
+
+    tup_reactor_free_removed(reactor);
+
+    /* callbacks may have sent messages and updates may be due */
+    tup_reactor_flush_contexts(reactor, -1);
+    return n_events;
+}
+
+/**
+ * \ingroup reactor
+ * Run the reactor until tup_reactor_quit() is called.
+ *
+ * @param[in] reactor the TupReactor
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_reactor_run(TupReactor *reactor)
+{
+    int ret;
+
+    atomic_store(&reactor->quit, 0);
+    while (!atomic_load(&reactor->quit)) {
+        ret = tup_reactor_iterate(reactor, -1);
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+/**
+ * \ingroup reactor
+ * Make tup_reactor_run() return. It can be called from a callback or from
+ * another thread.
+ *
+ * @param[in] reactor the TupReactor
+ */
+void tup_reactor_quit(TupReactor *reactor)
+{
+    atomic_store(&reactor->quit, 1);
+    tup_reactor_wakeup(reactor);
+}
@@ -0,0 +1,523 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * \defgroup reconcile Reconciliation
+ *
+ * Declarative device configuration.
+ *
+ * A TupDeviceConfig describes a target configuration: the bank loaded in
+ * each slot with its bindings and parameters, the filter states and the
+ * band normalization coefficients. Anything left out is not touched.
+ *
+ * tup_context_reconcile() compares it to the shadow state of the context
+ * (see tup_context_enable_shadow()) and only sends the commands needed to
+ * reach it, as pipelined requests. For each slot, a LOAD comes first if the
+ * bank differs, then BIND_EFFECT and SET_PARAMETER, several parameters
+ * being set by a single command. Filters and coefficients come last. Without
+ * shadow state, nothing is known and the whole configuration is sent.
+ */
+
+#ifndef TUP_ENABLE_STATIC_API
+#define TUP_ENABLE_STATIC_API
+#endif
+
+#include "libtup-private.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* parameters set by a single SET_PARAMETER command */
+#define TUP_RECONCILE_MAX_PARAMS 16
+
+/* filters are indexed by TupFilterId */
+#define TUP_RECONCILE_N_FILTERS 2
+
+typedef struct
+{
+    int32_t bank_id;                /* -1 if not set */
+    int32_t binding_flags;          /* -1 if not set */
+    uint8_t has_parameter[256];
+    uint32_t parameters[256];
+} TupDeviceConfigSlot;
+
+typedef struct
+{
+    float a[5];
+    float b[5];
+} TupDeviceConfigCoeffs;
+
+struct TupDeviceConfig
+{
+    /* allocated on first use */
+    TupDeviceConfigSlot *slots[256];
+    TupDeviceConfigCoeffs *coeffs[256];
+
+    /* -1 if not set */
+    int8_t filters[TUP_RECONCILE_N_FILTERS][256];
+};
+
+typedef struct
+{
+    TupContext *ctx;
+    TupMessage *msg;
+    int timeout_ms;
+    int n_sent;
+    int n_failed;
+} TupReconciliation;
+
+static TupDeviceConfigSlot *tup_device_config_get_slot(TupDeviceConfig *config,
+        uint8_t slot_id)
+{
+    TupDeviceConfigSlot *slot = config->slots[slot_id];
+
+    if (slot == NULL) {
+        slot = tup_calloc(1, sizeof(TupDeviceConfigSlot));
+        if (slot == NULL)
+            return NULL;
+
+        slot->bank_id = -1;
+        slot->binding_flags = -1;
+        config->slots[slot_id] = slot;
+    }
+
+    return slot;
+}
+
+static void tup_reconcile_request_cb(TupContext *ctx, TupMessageType cmd,
+        TupRequestStatus status, TupMessage *response, void *userdata)
+{
+    TupReconciliation *rec = userdata;
+    int32_t retval;
+
+    if (status != TUP_REQUEST_STATUS_OK) {
+        rec->n_failed++;
+        return;
+    }
+
+    /* SET_PARAMETER errors come in its response */
+    if (TUP_MESSAGE_TYPE(response) == TUP_MESSAGE_RESP_SET_PARAMETER
+            && tup_message_parse_resp_set_parameter_get_return_value(response,
+                &retval) == 0 && retval != 0)
+        rec->n_failed++;
+}
+
+/* send rec->msg as a request, waiting for room in the window */
+static int tup_reconcile_send(TupReconciliation *rec)
+{
+    int ret;
+
+    for (;;) {
+        ret = tup_context_send_request(rec->ctx, rec->msg,
+                tup_reconcile_request_cb, rec);
+        if (ret != SMP_ERROR_BUSY)
+            break;
+
+        ret = tup_context_wait_requests(rec->ctx,
+                tup_context_get_n_pending_requests(rec->ctx) - 1,
+                rec->timeout_ms);
+        if (ret < 0)
+            return ret;
+    }
+
+    if (ret < 0)
+        return ret;
+
+    tup_message_clear(rec->msg);
+    rec->n_sent++;
+    return 0;
+}
+
+static int tup_reconcile_parameters(TupReconciliation *rec, uint8_t slot_id,
+        const TupDeviceConfigSlot *slot)
+{
+    TupParameterArgs params[TUP_RECONCILE_MAX_PARAMS];
+    size_t n_params = 0;
+#if TUP_ENABLE_SHADOW
+    uint32_t value;
+#endif
+    unsigned int i;
+    int ret;
+
+    for (i = 0; i < 256; i++) {
+        if (!slot->has_parameter[i])
+            continue;
+
+#if TUP_ENABLE_SHADOW
+        if (tup_context_get_shadow_parameter(rec->ctx, slot_id, i,
+                    &value) == 0 && value == slot->parameters[i])
+            continue;
+#endif
+
+        params[n_params].parameter_id = i;
+        params[n_params].parameter_value = slot->parameters[i];
+        n_params++;
+
+        if (n_params < TUP_RECONCILE_MAX_PARAMS)
+            continue;
+
+        ret = tup_message_init_set_parameter_array(rec->msg, slot_id, params,
+                n_params);
+        if (ret < 0)
+            return ret;
+
+        ret = tup_reconcile_send(rec);
+        if (ret < 0)
+            return ret;
+
+        n_params = 0;
+    }
+
+    if (n_params == 0)
+        return 0;
+
+    ret = tup_message_init_set_parameter_array(rec->msg, slot_id, params,
+            n_params);
+    if (ret < 0)
+        return ret;
+
+    return tup_reconcile_send(rec);
+}
+
+static int tup_reconcile_slot(TupReconciliation *rec, uint8_t slot_id,
+        const TupDeviceConfigSlot *slot)
+{
+    TupShadowSlot known;
+    int ret;
+
+#if TUP_ENABLE_SHADOW
+    ret = tup_context_get_shadow_slot(rec->ctx, slot_id, &known);
+#else
+    ret = SMP_ERROR_NOT_FOUND;
+#endif
+    if (ret < 0) {
+        known.bank_id = -1;
+        known.binding_flags = -1;
+    }
+
+    if (slot->bank_id >= 0 && slot->bank_id != known.bank_id) {
+        tup_message_init_load(rec->msg, slot_id, slot->bank_id);
+        ret = tup_reconcile_send(rec);
+        if (ret < 0)
+            return ret;
+
+        /* the effect starts over with its default bindings */
+        known.binding_flags = -1;
+    }
+
+    if (slot->binding_flags >= 0
+            && slot->binding_flags != known.binding_flags) {
+        tup_message_init_bind_effect(rec->msg, slot_id, slot->binding_flags);
+        ret = tup_reconcile_send(rec);
+        if (ret < 0)
+            return ret;
+    }
+
+    return tup_reconcile_parameters(rec, slot_id, slot);
+}
+
+static int tup_reconcile_filters(TupReconciliation *rec,
+        const TupDeviceConfig *config)
+{
+    unsigned int filter;
+    unsigned int i;
+#if TUP_ENABLE_SHADOW
+    bool active;
+#endif
+    int ret;
+
+    for (filter = 0; filter < TUP_RECONCILE_N_FILTERS; filter++) {
+        for (i = 0; i < 256; i++) {
+            if (config->filters[filter][i] < 0)
+                continue;
+
+#if TUP_ENABLE_SHADOW
+            if (tup_context_get_shadow_filter_active(rec->ctx, filter, i,
+                        &active) == 0
+                    && active == (config->filters[filter][i] != 0))
+                continue;
+#endif
+
+            ret = tup_message_init_filter_set_active(rec->msg, filter, i,
+                    config->filters[filter][i] != 0);
+            if (ret < 0)
+                return ret;
+
+            ret = tup_reconcile_send(rec);
+            if (ret < 0)
+                return ret;
+        }
+    }
+
+    return 0;
+}
+
+static int tup_reconcile_coeffs(TupReconciliation *rec,
+        const TupDeviceConfig *config)
+{
+    TupDeviceConfigCoeffs *coeffs;
+    unsigned int i;
+#if TUP_ENABLE_SHADOW
+    float a[5];
+    float b[5];
+#endif
+    int ret;
+
+    for (i = 0; i < 256; i++) {
+        coeffs = config->coeffs[i];
+        if (coeffs == NULL)
+            continue;
+
+#if TUP_ENABLE_SHADOW
+        if (tup_context_get_shadow_band_norm_coeffs(rec->ctx, i, a, b) == 0
+                && memcmp(a, coeffs->a, sizeof(a)) == 0
+                && memcmp(b, coeffs->b, sizeof(b)) == 0)
+            continue;
+#endif
+
+        ret = tup_message_init_config_band_norm_set_coeffs(rec->msg, i,
+                coeffs->a, coeffs->b);
+        if (ret < 0)
+            return ret;
+
+        ret = tup_reconcile_send(rec);
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+/* API */
+
+/**
+ * \ingroup reconcile
+ * Create a new empty TupDeviceConfig.
+ *
+ * @return a new TupDeviceConfig or NULL on error.
+ */
+TupDeviceConfig *tup_device_config_new(void)
+{
+    TupDeviceConfig *config;
+
+    config = tup_calloc(1, sizeof(TupDeviceConfig));
+    if (config == NULL)
+        return NULL;
+
+    memset(config->filters, -1, sizeof(config->filters));
+    return config;
+}
+
+/**
+ * \ingroup reconcile
+ * Free a TupDeviceConfig.
+ *
+ * @param[in] config the TupDeviceConfig to free
+ */
+void tup_device_config_free(TupDeviceConfig *config)
+{
+    unsigned int i;
+
+    for (i = 0; i < 256; i++) {
+        tup_free(config->slots[i]);
+        tup_free(config->coeffs[i]);
+    }
+
+    tup_free(config);
+}
+
+/**
+ * \ingroup reconcile
+ * Set the effect to load in a slot.
+ *
+ * @param[in] config the TupDeviceConfig
+ * @param[in] slot_id the effect slot id
+ * @param[in] bank_id the effect id in the bank
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_device_config_set_slot(TupDeviceConfig *config, uint8_t slot_id,
+        uint16_t bank_id)
+{
+    TupDeviceConfigSlot *slot;
+
+    slot = tup_device_config_get_slot(config, slot_id);
+    if (slot == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    slot->bank_id = bank_id;
+    return 0;
+}
+
+/**
+ * \ingroup reconcile
+ * Set the actuators a slot is bound to.
+ *
+ * @param[in] config the TupDeviceConfig
+ * @param[in] slot_id the effect slot id
+ * @param[in] binding_flags a combination of TupBindingFlags
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_device_config_set_binding(TupDeviceConfig *config, uint8_t slot_id,
+        unsigned int binding_flags)
+{
+    TupDeviceConfigSlot *slot;
+
+    if (binding_flags > 0xffff)
+        return SMP_ERROR_INVALID_PARAM;
+
+    slot = tup_device_config_get_slot(config, slot_id);
+    if (slot == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    slot->binding_flags = binding_flags;
+    return 0;
+}
+
+/**
+ * \ingroup reconcile
+ * Set the value of an effect parameter.
+ *
+ * @param[in] config the TupDeviceConfig
+ * @param[in] slot_id the effect slot id
+ * @param[in] parameter_id the parameter id
+ * @param[in] value the value of the parameter
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_device_config_set_parameter(TupDeviceConfig *config, uint8_t slot_id,
+        uint8_t parameter_id, uint32_t value)
+{
+    TupDeviceConfigSlot *slot;
+
+    slot = tup_device_config_get_slot(config, slot_id);
+    if (slot == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    slot->has_parameter[parameter_id] = 1;
+    slot->parameters[parameter_id] = value;
+    return 0;
+}
+
+/**
+ * \ingroup reconcile
+ * Set the state of a filter.
+ *
+ * @param[in] config the TupDeviceConfig
+ * @param[in] filter the filter
+ * @param[in] actuator_id the actuator id
+ * @param[in] active whether the filter shall be active
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_device_config_set_filter_active(TupDeviceConfig *config,
+        TupFilterId filter, uint8_t actuator_id, bool active)
+{
+    if ((unsigned int) filter >= TUP_RECONCILE_N_FILTERS)
+        return SMP_ERROR_INVALID_PARAM;
+
+    config->filters[filter][actuator_id] = active;
+    return 0;
+}
+
+/**
+ * \ingroup reconcile
+ * Set the band normalization coefficients of an actuator.
+ *
+ * @param[in] config the TupDeviceConfig
+ * @param[in] actuator_id the actuator id
+ * @param[in] a the a coefficients
+ * @param[in] b the b coefficients
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_device_config_set_band_norm_coeffs(TupDeviceConfig *config,
+        uint8_t actuator_id, const float a[5], const float b[5])
+{
+    TupDeviceConfigCoeffs *coeffs = config->coeffs[actuator_id];
+
+    if (coeffs == NULL) {
+        coeffs = tup_malloc(sizeof(TupDeviceConfigCoeffs));
+        if (coeffs == NULL)
+            return SMP_ERROR_NO_MEM;
+
+        config->coeffs[actuator_id] = coeffs;
+    }
+
+    memcpy(coeffs->a, a, sizeof(coeffs->a));
+    memcpy(coeffs->b, b, sizeof(coeffs->b));
+    return 0;
+}
+
+/**
+ * \ingroup reconcile
+ * Bring the device to the configuration described by config, sending only
+ * what differs from the known state. Returns once every command has been
+ * answered.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] config the target configuration
+ * @param[in] timeout_ms the maximum time to wait for a response in
+ *                       milliseconds. A negative value means no timeout
+ *
+ * @return the number of commands sent on success, SMP_ERROR_IO if the
+ * device rejected some of them, a SmpError otherwise.
+ */
+int tup_context_reconcile(TupContext *ctx, TupDeviceConfig *config,
+        int timeout_ms)
+{
+    TupReconciliation rec;
+    unsigned int i;
+    int ret = 0;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.ctx = ctx;
+    rec.timeout_ms = timeout_ms;
+
+    rec.msg = tup_message_new();
+    if (rec.msg == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    for (i = 0; i < 256 && ret == 0; i++) {
+        if (config->slots[i] != NULL)
+            ret = tup_reconcile_slot(&rec, i, config->slots[i]);
+    }
+
+    if (ret == 0)
+        ret = tup_reconcile_filters(&rec, config);
+
+    if (ret == 0)
+        ret = tup_reconcile_coeffs(&rec, config);
+
+    /* callbacks refer to rec, don't leave them pending */
+    if (tup_context_get_n_pending_requests(ctx) > 0) {
+        int wait_ret = tup_context_wait_requests(ctx, 0, timeout_ms);
+
+        if (wait_ret < 0)
+            tup_request_table_cancel_all(ctx, TUP_REQUEST_STATUS_CANCELLED);
+
+        if (ret == 0)
+            ret = wait_ret;
+    }
+
+    tup_message_free(rec.msg);
+
+    if (ret < 0)
+        return ret;
+
+    return (rec.n_failed > 0) ? SMP_ERROR_IO : rec.n_sent;
+}
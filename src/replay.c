@@ -0,0 +1,348 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * \defgroup replay Replay
+ *
+ * Reading and replay of capture files (Linux only).
+ *
+ * A TupCaptureFile maps a file written by tup_context_start_capture() and
+ * walks its frames in place, without copying them.
+ *
+ * tup_capture_file_replay() plays the frames of a capture into a context,
+ * at their original pace, scaled or as fast as possible. Sent frames can be
+ * sent again to a device, or dispatched as if received to the context of a
+ * TupSimDevice to load it with real traffic. Received frames can be
+ * dispatched to a host context to replay what the device answered.
+ */
+
+#ifndef TUP_ENABLE_STATIC_API
+#define TUP_ENABLE_STATIC_API
+#endif
+
+#include "libtup-private.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct TupCaptureFile
+{
+    uint8_t *data;
+    size_t size;
+
+    /* offset of the next record */
+    size_t offset;
+    size_t first_offset;
+
+    uint64_t start_time_ns;
+};
+
+static uint64_t tup_replay_read_le(const uint8_t *data, size_t size)
+{
+    uint64_t value = 0;
+    size_t i;
+
+    for (i = 0; i < size; i++)
+        value |= (uint64_t) data[i] << (8 * i);
+
+    return value;
+}
+
+static void tup_replay_sleep_until(uint64_t deadline_ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = deadline_ns / 1000000000;
+    ts.tv_nsec = deadline_ns % 1000000000;
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+                NULL) == EINTR)
+        ;
+}
+
+/**
+ * \ingroup replay
+ * Open and map a capture file.
+ *
+ * @param[in] path the path of the capture file
+ *
+ * @return a TupCaptureFile or NULL if the file can't be read or is not a
+ * capture.
+ */
+TupCaptureFile *tup_capture_file_open(const char *path)
+{
+    TupCaptureFile *file;
+    struct stat st;
+    void *data;
+    size_t header_size;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) < 0 || st.st_size < TUP_CAPTURE_HEADER_SIZE) {
+        close(fd);
+        return NULL;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return NULL;
+
+    /* frames are read once, in order */
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    file = tup_calloc(1, sizeof(*file));
+    if (file == NULL)
+        goto error;
+
+    file->data = data;
+    file->size = st.st_size;
+
+    header_size = tup_replay_read_le(file->data + 12, 4);
+    if (memcmp(file->data, TUP_CAPTURE_MAGIC, 8) != 0
+            || tup_replay_read_le(file->data + 8, 4) != TUP_CAPTURE_VERSION
+            || header_size < TUP_CAPTURE_HEADER_SIZE
+            || header_size > file->size)
+        goto error;
+
+    file->start_time_ns = tup_replay_read_le(file->data + 16, 8);
+    file->first_offset = header_size;
+    file->offset = header_size;
+    return file;
+
+error:
+    tup_free(file);
+    munmap(data, st.st_size);
+    return NULL;
+}
+
+/**
+ * \ingroup replay
+ * Unmap and free a capture file. Frames read from it shall not be used
+ * anymore.
+ *
+ * @param[in] file the TupCaptureFile
+ */
+void tup_capture_file_close(TupCaptureFile *file)
+{
+    munmap(file->data, file->size);
+    tup_free(file);
+}
+
+/**
+ * \ingroup replay
+ * Get the time at which a capture started.
+ *
+ * @param[in] file the TupCaptureFile
+ *
+ * @return the wall clock time in nanoseconds since the epoch.
+ */
+uint64_t tup_capture_file_get_start_time(TupCaptureFile *file)
+{
+    return file->start_time_ns;
+}
+
+/**
+ * \ingroup replay
+ * Read the next frame of a capture. The frame data points into the mapped
+ * file and is valid until the file is closed. A record cut short, as left by
+ * a process killed while capturing, ends the capture.
+ *
+ * @param[in] file the TupCaptureFile
+ * @param[out] frame the frame
+ *
+ * @return 1 if a frame was read, 0 at the end of the capture.
+ */
+int tup_capture_file_next(TupCaptureFile *file, TupCaptureFrame *frame)
+{
+    const uint8_t *record;
+    size_t remaining;
+    size_t size;
+
+    remaining = file->size - file->offset;
+    if (remaining < TUP_CAPTURE_RECORD_HEADER_SIZE)
+        return 0;
+
+    record = file->data + file->offset;
+    size = tup_replay_read_le(record + 8, 4);
+    if (size > remaining - TUP_CAPTURE_RECORD_HEADER_SIZE)
+        return 0;
+
+    frame->time_ns = tup_replay_read_le(record, 8);
+    frame->direction = record[12];
+    frame->data = record + TUP_CAPTURE_RECORD_HEADER_SIZE;
+    frame->size = size;
+
+    size = TUP_CAPTURE_RECORD_HEADER_SIZE + size
+        + (TUP_CAPTURE_ALIGNMENT - size % TUP_CAPTURE_ALIGNMENT)
+        % TUP_CAPTURE_ALIGNMENT;
+
+    /* the padding of the last record may be missing */
+    file->offset += (size < remaining) ? size : remaining;
+    return 1;
+}
+
+/**
+ * \ingroup replay
+ * Decode a captured frame into a message. The frame is unescaped in buf,
+ * which shall be at least as big as the frame, and strings of the message
+ * point into it.
+ *
+ * @param[in] frame the TupCaptureFrame
+ * @param[out] message the TupMessage to fill
+ * @param[in] buf a buffer to unescape the frame in
+ * @param[in] size the size of buf
+ *
+ * @return 0 on success, SMP_ERROR_BAD_MESSAGE if the frame is malformed or
+ * another SmpError otherwise.
+ */
+int tup_capture_frame_decode(const TupCaptureFrame *frame,
+        TupMessage *message, uint8_t *buf, size_t size)
+{
+    return tup_frame_decode(message, frame->data, frame->size, buf, size);
+}
+
+/**
+ * \ingroup replay
+ * Go back to the first frame of a capture.
+ *
+ * @param[in] file the TupCaptureFile
+ */
+void tup_capture_file_rewind(TupCaptureFile *file)
+{
+    file->offset = file->first_offset;
+}
+
+/* wait for a frame time, processing input meanwhile if asked to */
+static int tup_replay_wait(TupContext *ctx, uint64_t due_ns,
+        unsigned int flags)
+{
+    uint64_t now_ns;
+    int timeout_ms;
+    int ret;
+
+    if (flags & TUP_REPLAY_PROCESS_INPUT) {
+        do {
+            now_ns = tup_get_time_ns();
+            timeout_ms = (due_ns > now_ns) ? (due_ns - now_ns) / 1000000 : 0;
+
+            ret = tup_context_wait_and_process(ctx, timeout_ms);
+            if (ret < 0 && ret != SMP_ERROR_TIMEDOUT)
+                return ret;
+        } while (timeout_ms > 0);
+    }
+
+    /* the rest is below the poll resolution */
+    if (due_ns > tup_get_time_ns())
+        tup_replay_sleep_until(due_ns);
+
+    return 0;
+}
+
+/**
+ * \ingroup replay
+ * Replay the frames of a capture into a context, from the beginning of the
+ * capture. What is done with TX and RX frames is set by flags, frames whose
+ * direction is not selected are skipped.
+ * Sent frames go through tup_context_send_raw() and injected ones through
+ * the context frame decoder, so they reach requests, handlers and callbacks
+ * like received ones. The function returns once the last frame is replayed.
+ *
+ * @param[in] file the TupCaptureFile
+ * @param[in] ctx the TupContext
+ * @param[in] flags a combination of TupReplayFlags
+ * @param[in] speed 1.0 to replay at the captured pace, 2.0 twice as fast
+ *                  and so on, 0 to replay as fast as possible
+ *
+ * @return the number of frames replayed on success, a SmpError otherwise.
+ */
+int tup_capture_file_replay(TupCaptureFile *file, TupContext *ctx,
+        unsigned int flags, double speed)
+{
+    TupFrameDecoder *decoder = NULL;
+    TupCaptureFrame frame;
+    uint64_t origin_ns = 0;
+    uint64_t first_ns = 0;
+    int send;
+    int n = 0;
+    int ret = 0;
+
+    if (speed < 0)
+        return SMP_ERROR_INVALID_PARAM;
+
+    if (flags & (TUP_REPLAY_INJECT_TX | TUP_REPLAY_INJECT_RX)) {
+        decoder = tup_frame_decoder_new();
+        if (decoder == NULL)
+            return SMP_ERROR_NO_MEM;
+    }
+
+    tup_capture_file_rewind(file);
+
+    while (tup_capture_file_next(file, &frame) > 0) {
+        if (frame.direction == TUP_CAPTURE_TX
+                && (flags & TUP_REPLAY_SEND_TX))
+            send = 1;
+        else if ((frame.direction == TUP_CAPTURE_TX
+                    && (flags & TUP_REPLAY_INJECT_TX))
+                || (frame.direction == TUP_CAPTURE_RX
+                    && (flags & TUP_REPLAY_INJECT_RX)))
+            send = 0;
+        else
+            continue;
+
+        if (n == 0) {
+            origin_ns = tup_get_time_ns();
+            first_ns = frame.time_ns;
+        }
+
+        /* a frame is never due before the first one */
+        if (frame.time_ns < first_ns)
+            frame.time_ns = first_ns;
+
+        ret = tup_replay_wait(ctx, (speed > 0)
+                ? origin_ns + (uint64_t) ((frame.time_ns - first_ns) / speed)
+                : 0, flags);
+        if (ret < 0)
+            break;
+
+        if (send) {
+            ret = tup_context_send_raw(ctx, frame.data, frame.size);
+            if (ret < 0)
+                break;
+        } else {
+            tup_frame_decoder_feed(decoder, ctx, frame.data, frame.size);
+        }
+
+        n++;
+    }
+
+    if (ret == 0)
+        ret = tup_context_flush(ctx);
+
+    if (decoder != NULL)
+        tup_frame_decoder_free(decoder);
+
+    return (ret < 0) ? ret : n;
+}
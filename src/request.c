@@ -0,0 +1,458 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * \defgroup request Request
+ *
+ * Pipelined requests.
+ *
+ * Tactronik answers every command, in order, with an ACK, an ERROR or a
+ * RESP_* message (see docs/overview.txt). Instead of waiting for the response
+ * of a command before sending the next one, a client can keep a window of
+ * commands in flight: each incoming response is matched back to the oldest
+ * pending request having the same command id and the same [data] argument
+ * (the effect slot for most commands) and its callback is called.
+ */
+
+#ifndef TUP_ENABLE_STATIC_API
+#define TUP_ENABLE_STATIC_API
+#endif
+
+#include "libtup-private.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TUP_REQUEST_DEFAULT_WINDOW 8
+
+/* a key of -1 matches any response of the right type */
+#define TUP_REQUEST_KEY_ANY -1
+
+typedef struct
+{
+    TupMessageType cmd;         /* the command sent */
+    TupMessageType resp;        /* TUP_MESSAGE_ACK or the expected RESP_* */
+    int32_t resp_key;           /* expected [data] in ACK or key in RESP_* */
+    int32_t error_key;          /* expected [data] in ERROR */
+    TupRequestCallback callback;
+    void *userdata;
+} TupRequest;
+
+struct TupRequestTable
+{
+    TupRequest *entries;        /* pending requests, oldest first */
+    unsigned int n_entries;
+    unsigned int window;
+};
+
+static int tup_request_table_resize(TupContext *ctx, unsigned int window)
+{
+    TupRequestTable *table = ctx->requests;
+    TupRequest *entries;
+
+    if (table == NULL) {
+        table = tup_calloc(1, sizeof(*table));
+        if (table == NULL)
+            return SMP_ERROR_NO_MEM;
+
+        ctx->requests = table;
+    }
+
+    entries = tup_realloc(table->entries, window * sizeof(TupRequest));
+    if (entries == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    table->entries = entries;
+    table->window = window;
+    return 0;
+}
+
+void tup_request_table_free(TupRequestTable *table)
+{
+    tup_free(table->entries);
+    tup_free(table);
+}
+
+/* get the message answering cmd on success, 0 if cmd is not a command */
+TupMessageType tup_request_get_response_type(TupMessageType cmd)
+{
+    switch (cmd) {
+        case TUP_MESSAGE_CMD_LOAD:
+        case TUP_MESSAGE_CMD_PLAY:
+        case TUP_MESSAGE_CMD_STOP:
+        case TUP_MESSAGE_CMD_BIND_EFFECT:
+        case TUP_MESSAGE_CMD_SET_INPUT_VALUE:
+        case TUP_MESSAGE_CMD_ACTIVATE_INTERNAL_SENSORS:
+        case TUP_MESSAGE_CMD_SET_SENSOR_VALUE:
+        case TUP_MESSAGE_CMD_CONFIG_WRITE:
+            return TUP_MESSAGE_ACK;
+        case TUP_MESSAGE_CMD_GET_VERSION:
+            return TUP_MESSAGE_RESP_VERSION;
+        case TUP_MESSAGE_CMD_GET_BUILDINFO:
+            return TUP_MESSAGE_RESP_BUILDINFO;
+        case TUP_MESSAGE_CMD_GET_SENSOR_VALUE:
+            return TUP_MESSAGE_RESP_SENSOR;
+        case TUP_MESSAGE_CMD_DEBUG_GET_SYSTEM_STATUS:
+            return TUP_MESSAGE_RESP_DEBUG_SYSTEM_STATUS;
+        case TUP_MESSAGE_CMD_GET_PARAMETER:
+            return TUP_MESSAGE_RESP_PARAMETER;
+        case TUP_MESSAGE_CMD_GET_INPUT_VALUE:
+            return TUP_MESSAGE_RESP_INPUT;
+        case TUP_MESSAGE_CMD_SET_PARAMETER:
+            return TUP_MESSAGE_RESP_SET_PARAMETER;
+        case TUP_MESSAGE_CMD_FILTER_GET_ACTIVE:
+        case TUP_MESSAGE_CMD_FILTER_SET_ACTIVE:
+            return TUP_MESSAGE_RESP_FILTER_ACTIVE;
+        case TUP_MESSAGE_CMD_CONFIG_BAND_NORM_GET_COEFFS:
+        case TUP_MESSAGE_CMD_CONFIG_BAND_NORM_SET_COEFFS:
+            return TUP_MESSAGE_RESP_BAND_NORM_COEFFS;
+        default:
+            return 0;
+    }
+}
+
+/* fill the expected response of a command, return 0 on success */
+static int tup_request_init(TupRequest *req, TupMessage *msg)
+{
+    uint8_t slot = 0;
+    uint8_t actuator_id;
+    TupFilterId filter;
+    bool active;
+
+    req->cmd = TUP_MESSAGE_TYPE(msg);
+    req->resp = tup_request_get_response_type(req->cmd);
+    req->resp_key = TUP_REQUEST_KEY_ANY;
+    req->error_key = TUP_REQUEST_KEY_ANY;
+
+    /* not a command, nothing will answer it */
+    if (req->resp == 0)
+        return SMP_ERROR_BAD_MESSAGE;
+
+    switch (req->cmd) {
+        case TUP_MESSAGE_CMD_LOAD:
+        case TUP_MESSAGE_CMD_PLAY:
+        case TUP_MESSAGE_CMD_STOP:
+        case TUP_MESSAGE_CMD_BIND_EFFECT:
+        case TUP_MESSAGE_CMD_SET_INPUT_VALUE:
+        case TUP_MESSAGE_CMD_ACTIVATE_INTERNAL_SENSORS:
+            /* [data] is the slot (or the state) which is always the first
+             * argument */
+            if (smp_message_get_uint8(msg, 0, &slot) < 0)
+                return SMP_ERROR_BAD_MESSAGE;
+
+            req->resp_key = slot;
+            req->error_key = slot;
+            break;
+        case TUP_MESSAGE_CMD_SET_SENSOR_VALUE:
+            req->resp_key = 0;
+            req->error_key = 0;
+            break;
+        case TUP_MESSAGE_CMD_GET_SENSOR_VALUE:
+            req->error_key = 0;
+            break;
+        case TUP_MESSAGE_CMD_GET_PARAMETER:
+        case TUP_MESSAGE_CMD_GET_INPUT_VALUE:
+            if (smp_message_get_uint8(msg, 0, &slot) < 0)
+                return SMP_ERROR_BAD_MESSAGE;
+
+            req->resp_key = slot;
+            req->error_key = slot;
+            break;
+        case TUP_MESSAGE_CMD_SET_PARAMETER:
+            if (smp_message_get_uint8(msg, 0, &slot) < 0)
+                return SMP_ERROR_BAD_MESSAGE;
+
+            req->resp_key = slot;
+            break;
+        case TUP_MESSAGE_CMD_FILTER_GET_ACTIVE:
+        case TUP_MESSAGE_CMD_FILTER_SET_ACTIVE:
+            if (req->cmd == TUP_MESSAGE_CMD_FILTER_GET_ACTIVE) {
+                if (tup_message_parse_filter_get_active(msg, &filter,
+                            &actuator_id) < 0)
+                    return SMP_ERROR_BAD_MESSAGE;
+            } else {
+                if (tup_message_parse_filter_set_active(msg, &filter,
+                            &actuator_id, &active) < 0)
+                    return SMP_ERROR_BAD_MESSAGE;
+            }
+
+            req->resp_key = (filter << 8) | actuator_id;
+            break;
+        case TUP_MESSAGE_CMD_CONFIG_BAND_NORM_GET_COEFFS:
+        case TUP_MESSAGE_CMD_CONFIG_BAND_NORM_SET_COEFFS:
+            if (smp_message_get_uint8(msg, 0, &actuator_id) < 0)
+                return SMP_ERROR_BAD_MESSAGE;
+
+            req->resp_key = actuator_id;
+            break;
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+/* get the key of a RESP_* message, TUP_REQUEST_KEY_ANY if it has none */
+static int32_t tup_request_get_response_key(TupMessage *message)
+{
+    uint8_t id = 0;
+    uint8_t actuator_id;
+    TupFilterId filter;
+    bool active;
+
+    switch (TUP_MESSAGE_TYPE(message)) {
+        case TUP_MESSAGE_RESP_PARAMETER:
+        case TUP_MESSAGE_RESP_INPUT:
+        case TUP_MESSAGE_RESP_SET_PARAMETER:
+        case TUP_MESSAGE_RESP_BAND_NORM_COEFFS:
+            if (smp_message_get_uint8(message, 0, &id) < 0)
+                return TUP_REQUEST_KEY_ANY;
+
+            return id;
+        case TUP_MESSAGE_RESP_FILTER_ACTIVE:
+            if (tup_message_parse_resp_filter_active(message, &filter,
+                        &actuator_id, &active) < 0)
+                return TUP_REQUEST_KEY_ANY;
+
+            return (filter << 8) | actuator_id;
+        default:
+            return TUP_REQUEST_KEY_ANY;
+    }
+}
+
+static int tup_request_key_match(int32_t expected, int32_t key)
+{
+    return expected == TUP_REQUEST_KEY_ANY || key == TUP_REQUEST_KEY_ANY
+        || expected == key;
+}
+
+/* remove the entry at index and call its callback */
+static void tup_request_table_complete(TupContext *ctx, unsigned int index,
+        TupRequestStatus status, TupMessage *response)
+{
+    TupRequestTable *table = ctx->requests;
+    TupRequest req = table->entries[index];
+
+    table->n_entries--;
+    memmove(&table->entries[index], &table->entries[index + 1],
+            (table->n_entries - index) * sizeof(TupRequest));
+
+    /* entry is removed so callback can send new requests */
+    if (req.callback != NULL)
+        req.callback(ctx, req.cmd, status, response, req.userdata);
+}
+
+/* return 1 if message completed a request, 0 otherwise */
+int tup_request_table_handle_message(TupContext *ctx, TupMessage *message)
+{
+    TupRequestTable *table = ctx->requests;
+    TupMessageType type = TUP_MESSAGE_TYPE(message);
+    TupMessageType cmd = type;
+    TupRequestStatus status = TUP_REQUEST_STATUS_OK;
+    uint32_t data;
+    int32_t key;
+    unsigned int i;
+
+    if (table->n_entries == 0)
+        return 0;
+
+    if (type == TUP_MESSAGE_ACK || type == TUP_MESSAGE_ERROR) {
+        uint32_t cmd_id;
+
+        if (smp_message_get_uint32(message, 0, &cmd_id) < 0)
+            return 0;
+
+        /* [data] is optional with old firmwares, match any in this case */
+        if (smp_message_get_uint32(message, (type == TUP_MESSAGE_ACK) ? 1 : 2,
+                    &data) == 0)
+            key = data;
+        else
+            key = TUP_REQUEST_KEY_ANY;
+
+        cmd = (TupMessageType) cmd_id;
+        if (type == TUP_MESSAGE_ERROR)
+            status = TUP_REQUEST_STATUS_ERROR;
+    } else {
+        key = tup_request_get_response_key(message);
+    }
+
+    for (i = 0; i < table->n_entries; i++) {
+        TupRequest *req = &table->entries[i];
+
+        if (type == TUP_MESSAGE_ERROR) {
+            if (req->cmd == cmd && tup_request_key_match(req->error_key, key))
+                break;
+        } else if (type == TUP_MESSAGE_ACK) {
+            if (req->resp == TUP_MESSAGE_ACK && req->cmd == cmd
+                    && tup_request_key_match(req->resp_key, key))
+                break;
+        } else if (req->resp == type
+                && tup_request_key_match(req->resp_key, key)) {
+            break;
+        }
+    }
+
+    if (i == table->n_entries)
+        return 0;
+
+    tup_request_table_complete(ctx, i, status, message);
+    return 1;
+}
+
+void tup_request_table_cancel_all(TupContext *ctx, TupRequestStatus status)
+{
+    unsigned int n = ctx->requests->n_entries;
+
+    /* callbacks may add new requests, only complete the current ones */
+    while (n-- > 0 && ctx->requests->n_entries > 0)
+        tup_request_table_complete(ctx, 0, status, NULL);
+}
+
+/* API */
+
+/**
+ * \ingroup request
+ * Set the maximum number of requests which can be in flight at the same time.
+ * A window of 1 gives a stop-and-wait behavior. A window of 0 releases the
+ * request table. The window can't be changed while requests are pending.
+ * If this function is not called, tup_context_send_request() uses a window
+ * of 8.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] window the maximum number of pending requests
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_set_request_window(TupContext *ctx, unsigned int window)
+{
+    if (ctx->requests != NULL && ctx->requests->n_entries > 0)
+        return SMP_ERROR_BUSY;
+
+    if (window == 0) {
+        if (ctx->requests != NULL) {
+            tup_request_table_free(ctx->requests);
+            ctx->requests = NULL;
+        }
+
+        return 0;
+    }
+
+    return tup_request_table_resize(ctx, window);
+}
+
+/**
+ * \ingroup request
+ * Get the number of requests waiting for a response.
+ *
+ * @param[in] ctx the TupContext
+ *
+ * @return the number of pending requests.
+ */
+unsigned int tup_context_get_n_pending_requests(TupContext *ctx)
+{
+    return (ctx->requests != NULL) ? ctx->requests->n_entries : 0;
+}
+
+/**
+ * \ingroup request
+ * Send a command and register a callback to be called when its response is
+ * received. The response is consumed by the request and is not passed to
+ * the context new_message_cb. The message can be reused as soon as this
+ * function returns.
+ * If the request window is full, nothing is sent and SMP_ERROR_BUSY is
+ * returned, use tup_context_wait_requests() to make room.
+ * Requests are never coalesced: updates pending in the coalescer are
+ * written first and the command is sent as is.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] msg the command to send
+ * @param[in] callback the function to call on completion (can be NULL)
+ * @param[in] userdata userdata to pass to callback
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_send_request(TupContext *ctx, TupMessage *msg,
+        TupRequestCallback callback, void *userdata)
+{
+    TupRequestTable *table;
+    TupRequest req;
+    int ret;
+
+    /* responses are dispatched from the I/O thread in threaded mode */
+    if (ctx->io_thread != NULL)
+        return SMP_ERROR_NOT_SUPPORTED;
+
+    if (ctx->requests == NULL) {
+        ret = tup_request_table_resize(ctx, TUP_REQUEST_DEFAULT_WINDOW);
+        if (ret < 0)
+            return ret;
+    }
+
+    table = ctx->requests;
+    if (table->n_entries >= table->window)
+        return SMP_ERROR_BUSY;
+
+    ret = tup_request_init(&req, msg);
+    if (ret < 0)
+        return ret;
+
+    req.callback = callback;
+    req.userdata = userdata;
+
+    /* the response may be dispatched before the message is sent */
+    table->entries[table->n_entries++] = req;
+
+    /* a coalesced or merged command would never get its own response */
+    ret = tup_context_send_message(ctx, msg, 0);
+    if (ret < 0) {
+        table->n_entries--;
+        return ret;
+    }
+
+    return 0;
+}
+
+/**
+ * \ingroup request
+ * Process incoming data until at most n_pending requests are in flight.
+ * As Tactronik answers every command, if no message is received during
+ * timeout_ms, all pending requests are considered lost and completed with
+ * TUP_REQUEST_STATUS_TIMEOUT.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] n_pending the number of requests which can stay in flight
+ * @param[in] timeout_ms the maximum time to wait for a message in
+ *                       milliseconds. A negative value means no timeout
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_wait_requests(TupContext *ctx, unsigned int n_pending,
+        int timeout_ms)
+{
+    int ret;
+
+    while (tup_context_get_n_pending_requests(ctx) > n_pending) {
+        ret = tup_context_wait_and_process(ctx, timeout_ms);
+        if (ret == SMP_ERROR_TIMEDOUT) {
+            tup_request_table_cancel_all(ctx, TUP_REQUEST_STATUS_TIMEOUT);
+            return ret;
+        } else if (ret < 0) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
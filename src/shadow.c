@@ -0,0 +1,1014 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * \defgroup shadow Shadow state
+ *
+ * Local copy of the device state.
+ *
+ * Once enabled with tup_context_enable_shadow(), a context keeps what it
+ * knows of the device: the bank loaded in each slot, its bindings and last
+ * commanded play state, effect parameters, slot inputs, filter states and
+ * band normalization coefficients.
+ *
+ * A value sent to the device is forgotten as soon as the command is written
+ * and only known again once the device confirmed it, either with the ACK of
+ * the command or with a RESP_* message. Then:
+ * - a GET command whose values are all known is answered locally, the
+ *   RESP_* message being dispatched before tup_context_send() returns;
+ * - a SET command which doesn't change any known value is not sent, its
+ *   response being dispatched locally as well. It is sent though if a
+ *   coalesced update of the same value is still pending.
+ *
+ * How long a value is trusted is set by tup_context_set_shadow_max_age().
+ * Other programs talking to the device, or the device resetting, can't be
+ * seen so tup_context_invalidate_shadow() shall then be called.
+ */
+
+#ifndef TUP_ENABLE_STATIC_API
+#define TUP_ENABLE_STATIC_API
+#endif
+
+#include "libtup-private.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if TUP_ENABLE_SHADOW
+/* number of commands waiting for their ACK */
+#define TUP_SHADOW_MAX_PENDING 64
+
+/* inputs remembered per SET_INPUT_VALUE command */
+#define TUP_SHADOW_MAX_INPUTS 16
+
+/* values parsed from a single message */
+#define TUP_SHADOW_MAX_ARGS 64
+
+/* filters are indexed by TupFilterId */
+#define TUP_SHADOW_N_FILTERS 2
+
+/* local responses kept around, more are allocated if handlers nest */
+#define TUP_SHADOW_N_RESPONSES 2
+
+typedef struct
+{
+    uint32_t value;
+    uint32_t time_ms;           /* when the device confirmed the value */
+    uint8_t known;
+} TupShadowValue;
+
+typedef struct
+{
+    TupShadowValue bank_id;
+    TupShadowValue binding_flags;
+    TupShadowValue playing;
+    TupShadowValue parameters[256];
+    TupShadowValue inputs[256];
+} TupShadowSlotState;
+
+typedef struct
+{
+    float a[5];
+    float b[5];
+    uint32_t time_ms;
+    uint8_t known;
+} TupShadowCoeffs;
+
+/* a command applied once acknowledged */
+typedef struct
+{
+    TupMessageType cmd;
+    uint8_t id;                 /* slot id */
+    uint32_t value;             /* bank id or binding flags */
+    size_t n_inputs;
+    TupInputValueArgs inputs[TUP_SHADOW_MAX_INPUTS];
+} TupShadowPending;
+
+struct TupShadow
+{
+    /* allocated on first use */
+    TupShadowSlotState *slots[256];
+    TupShadowCoeffs *coeffs[256];
+
+    TupShadowValue filters[TUP_SHADOW_N_FILTERS][256];
+
+    TupShadowPending pending[TUP_SHADOW_MAX_PENDING];
+    unsigned int head;
+    unsigned int n_pending;
+
+    int max_age_ms;
+
+    /* local responses, handlers may send messages from their dispatch */
+    TupMessagePool *responses;
+
+    TupShadowStats stats;
+};
+
+static void tup_shadow_value_set(TupShadowValue *value, uint32_t v,
+        uint32_t now_ms)
+{
+    value->value = v;
+    value->time_ms = now_ms;
+    value->known = 1;
+}
+
+static int tup_shadow_is_fresh(TupShadow *shadow, uint8_t known,
+        uint32_t time_ms, uint32_t now_ms)
+{
+    if (!known || shadow->max_age_ms == 0)
+        return 0;
+
+    return shadow->max_age_ms < 0
+        || now_ms - time_ms <= (uint32_t) shadow->max_age_ms;
+}
+
+static int tup_shadow_value_get(TupShadow *shadow, TupShadowValue *value,
+        uint32_t now_ms, uint32_t *v)
+{
+    if (!tup_shadow_is_fresh(shadow, value->known, value->time_ms, now_ms))
+        return SMP_ERROR_NOT_FOUND;
+
+    *v = value->value;
+    return 0;
+}
+
+static TupShadowSlotState *tup_shadow_get_slot(TupShadow *shadow,
+        uint8_t slot_id, int create)
+{
+    if (shadow->slots[slot_id] == NULL && create)
+        shadow->slots[slot_id] = tup_calloc(1, sizeof(TupShadowSlotState));
+
+    return shadow->slots[slot_id];
+}
+
+static TupShadowCoeffs *tup_shadow_get_coeffs(TupShadow *shadow,
+        uint8_t actuator_id, int create)
+{
+    if (shadow->coeffs[actuator_id] == NULL && create)
+        shadow->coeffs[actuator_id] = tup_calloc(1, sizeof(TupShadowCoeffs));
+
+    return shadow->coeffs[actuator_id];
+}
+
+static TupShadowValue *tup_shadow_get_filter(TupShadow *shadow,
+        TupFilterId filter, uint8_t actuator_id)
+{
+    if ((unsigned int) filter >= TUP_SHADOW_N_FILTERS)
+        return NULL;
+
+    return &shadow->filters[filter][actuator_id];
+}
+
+static void tup_shadow_forget_slot(TupShadow *shadow, uint8_t slot_id)
+{
+    tup_free(shadow->slots[slot_id]);
+    shadow->slots[slot_id] = NULL;
+}
+
+static void tup_shadow_forget_all(TupShadow *shadow)
+{
+    unsigned int i;
+
+    for (i = 0; i < 256; i++) {
+        tup_shadow_forget_slot(shadow, i);
+
+        tup_free(shadow->coeffs[i]);
+        shadow->coeffs[i] = NULL;
+    }
+
+    memset(shadow->filters, 0, sizeof(shadow->filters));
+    shadow->n_pending = 0;
+}
+
+static void tup_shadow_push_pending(TupShadow *shadow,
+        const TupShadowPending *pending)
+{
+    if (shadow->n_pending == TUP_SHADOW_MAX_PENDING) {
+        /* the oldest one won't be answered */
+        shadow->head = (shadow->head + 1) % TUP_SHADOW_MAX_PENDING;
+        shadow->n_pending--;
+    }
+
+    shadow->pending[(shadow->head + shadow->n_pending)
+        % TUP_SHADOW_MAX_PENDING] = *pending;
+    shadow->n_pending++;
+}
+
+/* remove the oldest pending cmd for slot id, id < 0 matching any slot */
+static int tup_shadow_pop_pending(TupShadow *shadow, TupMessageType cmd,
+        int id, TupShadowPending *pending)
+{
+    unsigned int i;
+    unsigned int j;
+
+    for (i = 0; i < shadow->n_pending; i++) {
+        TupShadowPending *it = &shadow->pending[(shadow->head + i)
+            % TUP_SHADOW_MAX_PENDING];
+
+        if (it->cmd != cmd || (id >= 0 && it->id != id))
+            continue;
+
+        *pending = *it;
+
+        for (j = i; j + 1 < shadow->n_pending; j++) {
+            shadow->pending[(shadow->head + j) % TUP_SHADOW_MAX_PENDING] =
+                shadow->pending[(shadow->head + j + 1)
+                % TUP_SHADOW_MAX_PENDING];
+        }
+
+        shadow->n_pending--;
+        return 1;
+    }
+
+    return 0;
+}
+
+static void tup_shadow_apply_pending(TupShadow *shadow,
+        const TupShadowPending *pending)
+{
+    TupShadowSlotState *slot;
+    uint32_t now_ms = tup_get_time_ms();
+    size_t i;
+
+    slot = tup_shadow_get_slot(shadow, pending->id, 1);
+    if (slot == NULL)
+        return;
+
+    switch (pending->cmd) {
+        case TUP_MESSAGE_CMD_LOAD:
+            tup_shadow_value_set(&slot->bank_id, pending->value, now_ms);
+            break;
+        case TUP_MESSAGE_CMD_PLAY:
+            tup_shadow_value_set(&slot->playing, 1, now_ms);
+            break;
+        case TUP_MESSAGE_CMD_STOP:
+            tup_shadow_value_set(&slot->playing, 0, now_ms);
+            break;
+        case TUP_MESSAGE_CMD_BIND_EFFECT:
+            tup_shadow_value_set(&slot->binding_flags, pending->value, now_ms);
+            break;
+        case TUP_MESSAGE_CMD_SET_INPUT_VALUE:
+            for (i = 0; i < pending->n_inputs; i++) {
+                tup_shadow_value_set(
+                        &slot->inputs[pending->inputs[i].input_id],
+                        (uint32_t) pending->inputs[i].input_value, now_ms);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void tup_shadow_set_parameters(TupShadow *shadow, uint8_t effect_id,
+        const TupParameterArgs *args, int n_args)
+{
+    TupShadowSlotState *slot;
+    uint32_t now_ms = tup_get_time_ms();
+    int i;
+
+    slot = tup_shadow_get_slot(shadow, effect_id, 1);
+    if (slot == NULL)
+        return;
+
+    for (i = 0; i < n_args; i++) {
+        tup_shadow_value_set(&slot->parameters[args[i].parameter_id],
+                args[i].parameter_value, now_ms);
+    }
+}
+
+static void tup_shadow_set_coeffs(TupShadow *shadow, uint8_t actuator_id,
+        const float a[5], const float b[5])
+{
+    TupShadowCoeffs *coeffs;
+
+    coeffs = tup_shadow_get_coeffs(shadow, actuator_id, 1);
+    if (coeffs == NULL)
+        return;
+
+    memcpy(coeffs->a, a, sizeof(coeffs->a));
+    memcpy(coeffs->b, b, sizeof(coeffs->b));
+    coeffs->time_ms = tup_get_time_ms();
+    coeffs->known = 1;
+}
+
+void tup_shadow_free(TupShadow *shadow)
+{
+    tup_shadow_forget_all(shadow);
+    tup_message_pool_free(shadow->responses);
+    tup_free(shadow);
+}
+
+/* forget the values msg changes, they are known again once confirmed */
+void tup_shadow_record_tx(TupContext *ctx, TupMessage *msg)
+{
+    TupShadow *shadow = ctx->shadow;
+    TupShadowSlotState *slot;
+    TupShadowPending pending;
+    TupParameterArgs params[TUP_SHADOW_MAX_ARGS];
+    TupShadowCoeffs *coeffs;
+    TupShadowValue *value;
+    TupFilterId filter;
+    uint16_t bank_id;
+    uint8_t actuator_id;
+    bool active;
+    int n;
+    int i;
+
+    memset(&pending, 0, sizeof(pending));
+    pending.cmd = TUP_MESSAGE_TYPE(msg);
+
+    switch (pending.cmd) {
+        case TUP_MESSAGE_CMD_LOAD:
+            if (tup_message_parse_load(msg, &pending.id, &bank_id) < 0)
+                return;
+
+            /* the slot starts over with the new effect */
+            tup_shadow_forget_slot(shadow, pending.id);
+            pending.value = bank_id;
+            break;
+        case TUP_MESSAGE_CMD_PLAY:
+        case TUP_MESSAGE_CMD_STOP:
+            if (smp_message_get_uint8(msg, 0, &pending.id) < 0)
+                return;
+
+            slot = tup_shadow_get_slot(shadow, pending.id, 0);
+            if (slot != NULL)
+                slot->playing.known = 0;
+            break;
+        case TUP_MESSAGE_CMD_BIND_EFFECT:
+            if (tup_message_parse_bind_effect(msg, &pending.id,
+                        (unsigned int *) &pending.value) < 0)
+                return;
+
+            slot = tup_shadow_get_slot(shadow, pending.id, 0);
+            if (slot != NULL)
+                slot->binding_flags.known = 0;
+            break;
+        case TUP_MESSAGE_CMD_SET_INPUT_VALUE:
+            if (smp_message_get_uint8(msg, 0, &pending.id) < 0)
+                return;
+
+            slot = tup_shadow_get_slot(shadow, pending.id, 0);
+            n = tup_message_parse_set_input_value(msg, &pending.id,
+                    pending.inputs, TUP_SHADOW_MAX_INPUTS);
+            if (n < 0) {
+                /* can't tell which inputs change */
+                if (slot != NULL)
+                    memset(slot->inputs, 0, sizeof(slot->inputs));
+
+                return;
+            }
+
+            pending.n_inputs = n;
+            for (i = 0; slot != NULL && i < n; i++)
+                slot->inputs[pending.inputs[i].input_id].known = 0;
+            break;
+        case TUP_MESSAGE_CMD_SET_PARAMETER:
+            if (smp_message_get_uint8(msg, 0, &pending.id) < 0)
+                return;
+
+            slot = tup_shadow_get_slot(shadow, pending.id, 0);
+            if (slot == NULL)
+                return;
+
+            /* RESP_SET_PARAMETER tells the new values */
+            n = tup_message_parse_set_parameter(msg, &pending.id, params,
+                    TUP_SHADOW_MAX_ARGS);
+            if (n < 0)
+                memset(slot->parameters, 0, sizeof(slot->parameters));
+
+            for (i = 0; i < n; i++)
+                slot->parameters[params[i].parameter_id].known = 0;
+            return;
+        case TUP_MESSAGE_CMD_FILTER_SET_ACTIVE:
+            if (tup_message_parse_filter_set_active(msg, &filter,
+                        &actuator_id, &active) < 0)
+                return;
+
+            value = tup_shadow_get_filter(shadow, filter, actuator_id);
+            if (value != NULL)
+                value->known = 0;
+            return;
+        case TUP_MESSAGE_CMD_CONFIG_BAND_NORM_SET_COEFFS:
+            if (smp_message_get_uint8(msg, 0, &actuator_id) < 0)
+                return;
+
+            coeffs = tup_shadow_get_coeffs(shadow, actuator_id, 0);
+            if (coeffs != NULL)
+                coeffs->known = 0;
+            return;
+        default:
+            return;
+    }
+
+    tup_shadow_push_pending(shadow, &pending);
+}
+
+/* learn from a message sent by the device */
+void tup_shadow_handle_message(TupContext *ctx, TupMessage *msg)
+{
+    TupShadow *shadow = ctx->shadow;
+    TupShadowPending pending;
+    TupMessageIter iter;
+    TupParameterArgs param;
+    TupInputValueArgs input;
+    TupShadowValue *value;
+    TupFilterId filter;
+    TupMessageType cmd;
+    uint32_t cmd_id;
+    uint32_t arg;
+    uint8_t id;
+    int32_t retval;
+    bool active;
+    float a[5];
+    float b[5];
+
+    switch (TUP_MESSAGE_TYPE(msg)) {
+        case TUP_MESSAGE_ACK:
+            if (tup_message_parse_ack_full(msg, &cmd, &arg) < 0)
+                return;
+
+            if (tup_shadow_pop_pending(shadow, cmd, arg > 255 ? -1 : (int) arg,
+                        &pending))
+                tup_shadow_apply_pending(shadow, &pending);
+            break;
+        case TUP_MESSAGE_ERROR:
+            /* the slot in [data] is optional */
+            if (smp_message_get_uint32(msg, 0, &cmd_id) < 0)
+                return;
+
+            if (smp_message_get_uint32(msg, 2, &arg) < 0 || arg > 255)
+                tup_shadow_pop_pending(shadow, cmd_id, -1, &pending);
+            else
+                tup_shadow_pop_pending(shadow, cmd_id, arg, &pending);
+            break;
+        case TUP_MESSAGE_RESP_PARAMETER:
+            if (tup_resp_parameter_iter_init(&iter, msg, &id) < 0)
+                return;
+
+            while (tup_resp_parameter_iter_next(&iter, &param) > 0)
+                tup_shadow_set_parameters(shadow, id, &param, 1);
+            break;
+        case TUP_MESSAGE_RESP_SET_PARAMETER:
+            if (tup_resp_set_parameter_iter_init(&iter, msg, &id,
+                        &retval) < 0 || retval != 0)
+                return;
+
+            while (tup_resp_set_parameter_iter_next(&iter, &param) > 0)
+                tup_shadow_set_parameters(shadow, id, &param, 1);
+            break;
+        case TUP_MESSAGE_RESP_INPUT:
+            if (tup_resp_input_iter_init(&iter, msg, &id) < 0)
+                return;
+
+            while (tup_resp_input_iter_next(&iter, &input) > 0) {
+                TupShadowSlotState *slot = tup_shadow_get_slot(shadow, id, 1);
+
+                if (slot == NULL)
+                    break;
+
+                tup_shadow_value_set(&slot->inputs[input.input_id],
+                        (uint32_t) input.input_value,
+                        tup_get_time_ms());
+            }
+            break;
+        case TUP_MESSAGE_RESP_FILTER_ACTIVE:
+            if (tup_message_parse_resp_filter_active(msg, &filter, &id,
+                        &active) < 0)
+                return;
+
+            value = tup_shadow_get_filter(shadow, filter, id);
+            if (value != NULL)
+                tup_shadow_value_set(value, active, tup_get_time_ms());
+            break;
+        case TUP_MESSAGE_RESP_BAND_NORM_COEFFS:
+            if (tup_message_parse_resp_band_norm_coeffs(msg, &id, a, b) == 0)
+                tup_shadow_set_coeffs(shadow, id, a, b);
+            break;
+        default:
+            break;
+    }
+}
+
+/* fill response with the answer of a GET command, 0 if a value is missing */
+static int tup_shadow_answer_get(TupShadow *shadow, TupMessage *msg,
+        TupMessage *response, uint32_t now_ms)
+{
+    TupParameterArgs params[TUP_SHADOW_MAX_ARGS];
+    TupInputValueArgs inputs[TUP_SHADOW_MAX_ARGS];
+    uint8_t ids[TUP_SHADOW_MAX_ARGS];
+    TupShadowSlotState *slot;
+    TupShadowCoeffs *coeffs;
+    TupShadowValue *value;
+    TupFilterId filter;
+    uint8_t id;
+    uint32_t v;
+    int n;
+    int i;
+
+    switch (TUP_MESSAGE_TYPE(msg)) {
+        case TUP_MESSAGE_CMD_GET_PARAMETER:
+            n = tup_message_parse_get_parameter(msg, &id, ids,
+                    TUP_SHADOW_MAX_ARGS);
+            slot = tup_shadow_get_slot(shadow, id, 0);
+            if (n <= 0 || slot == NULL)
+                return 0;
+
+            for (i = 0; i < n; i++) {
+                params[i].parameter_id = ids[i];
+                if (tup_shadow_value_get(shadow, &slot->parameters[ids[i]],
+                            now_ms, &params[i].parameter_value) < 0)
+                    return 0;
+            }
+
+            return tup_message_init_resp_parameter(response, id, params,
+                    n) == 0;
+        case TUP_MESSAGE_CMD_GET_INPUT_VALUE:
+            n = tup_message_parse_get_input_value(msg, &id, ids,
+                    TUP_SHADOW_MAX_ARGS);
+            slot = tup_shadow_get_slot(shadow, id, 0);
+            if (n <= 0 || slot == NULL)
+                return 0;
+
+            for (i = 0; i < n; i++) {
+                inputs[i].input_id = ids[i];
+                if (tup_shadow_value_get(shadow, &slot->inputs[ids[i]],
+                            now_ms, &v) < 0)
+                    return 0;
+
+                inputs[i].input_value = (int32_t) v;
+            }
+
+            return tup_message_init_resp_input(response, id, inputs, n) == 0;
+        case TUP_MESSAGE_CMD_FILTER_GET_ACTIVE:
+            if (tup_message_parse_filter_get_active(msg, &filter, &id) < 0)
+                return 0;
+
+            value = tup_shadow_get_filter(shadow, filter, id);
+            if (value == NULL
+                    || tup_shadow_value_get(shadow, value, now_ms, &v) < 0)
+                return 0;
+
+            return tup_message_init_resp_filter_active(response, filter, id,
+                    v != 0) == 0;
+        case TUP_MESSAGE_CMD_CONFIG_BAND_NORM_GET_COEFFS:
+            if (tup_message_parse_config_band_norm_get_coeffs(msg, &id) < 0)
+                return 0;
+
+            coeffs = tup_shadow_get_coeffs(shadow, id, 0);
+            if (coeffs == NULL || !tup_shadow_is_fresh(shadow, coeffs->known,
+                        coeffs->time_ms, now_ms))
+                return 0;
+
+            return tup_message_init_resp_band_norm_coeffs(response, id,
+                    coeffs->a, coeffs->b) == 0;
+        default:
+            return 0;
+    }
+}
+
+/* fill response with the answer of a SET command which changes nothing, 0
+ * if it does change something */
+static int tup_shadow_answer_set(TupShadow *shadow, TupMessage *msg,
+        TupMessage *response, uint32_t now_ms)
+{
+    TupParameterArgs params[TUP_SHADOW_MAX_ARGS];
+    TupInputValueArgs inputs[TUP_SHADOW_MAX_ARGS];
+    TupShadowSlotState *slot;
+    TupShadowCoeffs *coeffs;
+    TupShadowValue *value;
+    TupFilterId filter;
+    unsigned int flags;
+    uint8_t id;
+    uint32_t v;
+    bool active;
+    float a[5];
+    float b[5];
+    int n;
+    int i;
+
+    switch (TUP_MESSAGE_TYPE(msg)) {
+        case TUP_MESSAGE_CMD_SET_PARAMETER:
+            n = tup_message_parse_set_parameter(msg, &id, params,
+                    TUP_SHADOW_MAX_ARGS);
+            slot = tup_shadow_get_slot(shadow, id, 0);
+            if (n <= 0 || slot == NULL)
+                return 0;
+
+            for (i = 0; i < n; i++) {
+                if (tup_shadow_value_get(shadow,
+                            &slot->parameters[params[i].parameter_id], now_ms,
+                            &v) < 0 || v != params[i].parameter_value)
+                    return 0;
+            }
+
+            return tup_message_init_resp_set_parameter(response, id, 0,
+                    params, n) == 0;
+        case TUP_MESSAGE_CMD_SET_INPUT_VALUE:
+            n = tup_message_parse_set_input_value(msg, &id, inputs,
+                    TUP_SHADOW_MAX_ARGS);
+            slot = tup_shadow_get_slot(shadow, id, 0);
+            if (n <= 0 || slot == NULL)
+                return 0;
+
+            for (i = 0; i < n; i++) {
+                if (tup_shadow_value_get(shadow,
+                            &slot->inputs[inputs[i].input_id], now_ms, &v) < 0
+                        || (int32_t) v != inputs[i].input_value)
+                    return 0;
+            }
+
+            tup_message_init_ack_full(response,
+                    TUP_MESSAGE_CMD_SET_INPUT_VALUE, id);
+            return 1;
+        case TUP_MESSAGE_CMD_BIND_EFFECT:
+            if (tup_message_parse_bind_effect(msg, &id, &flags) < 0)
+                return 0;
+
+            slot = tup_shadow_get_slot(shadow, id, 0);
+            if (slot == NULL || tup_shadow_value_get(shadow,
+                        &slot->binding_flags, now_ms, &v) < 0 || v != flags)
+                return 0;
+
+            tup_message_init_ack_full(response, TUP_MESSAGE_CMD_BIND_EFFECT,
+                    id);
+            return 1;
+        case TUP_MESSAGE_CMD_FILTER_SET_ACTIVE:
+            if (tup_message_parse_filter_set_active(msg, &filter, &id,
+                        &active) < 0)
+                return 0;
+
+            value = tup_shadow_get_filter(shadow, filter, id);
+            if (value == NULL
+                    || tup_shadow_value_get(shadow, value, now_ms, &v) < 0
+                    || (v != 0) != active)
+                return 0;
+
+            return tup_message_init_resp_filter_active(response, filter, id,
+                    active) == 0;
+        case TUP_MESSAGE_CMD_CONFIG_BAND_NORM_SET_COEFFS:
+            if (tup_message_parse_config_band_norm_set_coeffs(msg, &id, a,
+                        b) < 0)
+                return 0;
+
+            coeffs = tup_shadow_get_coeffs(shadow, id, 0);
+            if (coeffs == NULL || !tup_shadow_is_fresh(shadow, coeffs->known,
+                        coeffs->time_ms, now_ms)
+                    || memcmp(coeffs->a, a, sizeof(a)) != 0
+                    || memcmp(coeffs->b, b, sizeof(b)) != 0)
+                return 0;
+
+            return tup_message_init_resp_band_norm_coeffs(response, id, a,
+                    b) == 0;
+        default:
+            return 0;
+    }
+}
+
+/* answer msg locally if possible. Returns 1 if it has been answered, 0 if it
+ * shall be sent */
+int tup_shadow_send(TupContext *ctx, TupMessage *msg)
+{
+    TupShadow *shadow = ctx->shadow;
+    TupMessage *response;
+    uint32_t now_ms;
+    int answered;
+
+    switch (TUP_MESSAGE_TYPE(msg)) {
+        case TUP_MESSAGE_CMD_GET_PARAMETER:
+        case TUP_MESSAGE_CMD_GET_INPUT_VALUE:
+        case TUP_MESSAGE_CMD_FILTER_GET_ACTIVE:
+        case TUP_MESSAGE_CMD_CONFIG_BAND_NORM_GET_COEFFS:
+        case TUP_MESSAGE_CMD_SET_PARAMETER:
+        case TUP_MESSAGE_CMD_SET_INPUT_VALUE:
+        case TUP_MESSAGE_CMD_BIND_EFFECT:
+        case TUP_MESSAGE_CMD_FILTER_SET_ACTIVE:
+        case TUP_MESSAGE_CMD_CONFIG_BAND_NORM_SET_COEFFS:
+            break;
+        default:
+            return 0;
+    }
+
+    if (shadow->max_age_ms == 0)
+        return 0;
+
+#if TUP_ENABLE_COALESCING
+    /* the known value is about to change: msg must replace the pending
+     * update rather than be elided */
+    if (ctx->coalescer != NULL && tup_coalescer_is_pending(ctx, msg)) {
+        shadow->stats.n_misses++;
+        return 0;
+    }
+#endif
+
+    response = tup_message_pool_acquire(shadow->responses);
+    if (response == NULL)
+        return 0;
+
+    now_ms = tup_get_time_ms();
+
+    if (tup_shadow_answer_get(shadow, msg, response, now_ms)) {
+        shadow->stats.n_hits++;
+        answered = 1;
+    } else if (tup_shadow_answer_set(shadow, msg, response, now_ms)) {
+        shadow->stats.n_elided++;
+        answered = 1;
+    } else {
+        shadow->stats.n_misses++;
+        answered = 0;
+    }
+
+    if (answered)
+        tup_context_dispatch_local_message(ctx, response);
+
+    tup_message_pool_release(shadow->responses, response);
+    return answered;
+}
+
+/* API */
+
+/**
+ * \ingroup shadow
+ * Enable or disable the shadow state. Disabling forgets the known state.
+ * The shadow state is not available in threaded mode.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] enable true to enable the shadow state, false to disable it
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_enable_shadow(TupContext *ctx, bool enable)
+{
+    TupShadow *shadow;
+
+    if (!enable) {
+        if (ctx->shadow != NULL) {
+            tup_shadow_free(ctx->shadow);
+            ctx->shadow = NULL;
+        }
+
+        return 0;
+    }
+
+    if (ctx->shadow != NULL)
+        return 0;
+
+#ifdef HAVE_IO_THREAD
+    /* messages are seen from the I/O thread */
+    if (ctx->io_thread != NULL)
+        return SMP_ERROR_NOT_SUPPORTED;
+#endif
+
+    shadow = tup_calloc(1, sizeof(TupShadow));
+    if (shadow == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    shadow->responses = tup_message_pool_new(TUP_SHADOW_N_RESPONSES);
+    if (shadow->responses == NULL) {
+        tup_free(shadow);
+        return SMP_ERROR_NO_MEM;
+    }
+
+    shadow->max_age_ms = -1;
+    ctx->shadow = shadow;
+    return 0;
+}
+
+/**
+ * \ingroup shadow
+ * Set how long a value confirmed by the device is used to answer commands
+ * locally. By default, known values are trusted until they are changed.
+ * Values are still tracked with a max age of 0.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] max_age_ms the max age in milliseconds, a negative value to
+ *                       trust known values forever or 0 to always send
+ *                       commands
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_set_shadow_max_age(TupContext *ctx, int max_age_ms)
+{
+    if (ctx->shadow == NULL)
+        return SMP_ERROR_NOT_FOUND;
+
+#ifndef HAVE_CLOCK_GETTIME
+    /* values can't age */
+    if (max_age_ms > 0)
+        return SMP_ERROR_NOT_SUPPORTED;
+#endif
+
+    ctx->shadow->max_age_ms = max_age_ms;
+    return 0;
+}
+
+/**
+ * \ingroup shadow
+ * Forget the whole known state, for instance after the device was reset.
+ *
+ * @param[in] ctx the TupContext
+ */
+void tup_context_invalidate_shadow(TupContext *ctx)
+{
+    if (ctx->shadow != NULL)
+        tup_shadow_forget_all(ctx->shadow);
+}
+
+/**
+ * \ingroup shadow
+ * Get the known state of a slot. Unknown fields are set to -1.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] slot_id the effect slot id
+ * @param[out] slot the state of the slot
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_get_shadow_slot(TupContext *ctx, uint8_t slot_id,
+        TupShadowSlot *slot)
+{
+    TupShadowSlotState *state;
+    uint32_t now_ms;
+    uint32_t v;
+
+    if (ctx->shadow == NULL)
+        return SMP_ERROR_NOT_FOUND;
+
+    slot->bank_id = -1;
+    slot->binding_flags = -1;
+    slot->playing = -1;
+
+    state = tup_shadow_get_slot(ctx->shadow, slot_id, 0);
+    if (state == NULL)
+        return 0;
+
+    now_ms = tup_get_time_ms();
+
+    if (tup_shadow_value_get(ctx->shadow, &state->bank_id, now_ms, &v) == 0)
+        slot->bank_id = v;
+
+    if (tup_shadow_value_get(ctx->shadow, &state->binding_flags, now_ms,
+                &v) == 0)
+        slot->binding_flags = v;
+
+    if (tup_shadow_value_get(ctx->shadow, &state->playing, now_ms, &v) == 0)
+        slot->playing = v;
+
+    return 0;
+}
+
+/**
+ * \ingroup shadow
+ * Get the known value of an effect parameter.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] effect_id the loaded effect id
+ * @param[in] parameter_id the parameter id
+ * @param[out] value the value of the parameter
+ *
+ * @return 0 on success, SMP_ERROR_NOT_FOUND if the value is not known.
+ */
+int tup_context_get_shadow_parameter(TupContext *ctx, uint8_t effect_id,
+        uint8_t parameter_id, uint32_t *value)
+{
+    TupShadowSlotState *slot;
+
+    if (ctx->shadow == NULL)
+        return SMP_ERROR_NOT_FOUND;
+
+    slot = tup_shadow_get_slot(ctx->shadow, effect_id, 0);
+    if (slot == NULL)
+        return SMP_ERROR_NOT_FOUND;
+
+    return tup_shadow_value_get(ctx->shadow, &slot->parameters[parameter_id],
+            tup_get_time_ms(), value);
+}
+
+/**
+ * \ingroup shadow
+ * Get the known value of a slot input.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] effect_slot_id the effect slot id
+ * @param[in] input_id the input id
+ * @param[out] value the value of the input
+ *
+ * @return 0 on success, SMP_ERROR_NOT_FOUND if the value is not known.
+ */
+int tup_context_get_shadow_input(TupContext *ctx, uint8_t effect_slot_id,
+        uint8_t input_id, int32_t *value)
+{
+    TupShadowSlotState *slot;
+    uint32_t v;
+    int ret;
+
+    if (ctx->shadow == NULL)
+        return SMP_ERROR_NOT_FOUND;
+
+    slot = tup_shadow_get_slot(ctx->shadow, effect_slot_id, 0);
+    if (slot == NULL)
+        return SMP_ERROR_NOT_FOUND;
+
+    ret = tup_shadow_value_get(ctx->shadow, &slot->inputs[input_id],
+            tup_get_time_ms(), &v);
+    if (ret < 0)
+        return ret;
+
+    *value = (int32_t) v;
+    return 0;
+}
+
+/**
+ * \ingroup shadow
+ * Get the known state of a filter.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] filter the filter
+ * @param[in] actuator_id the actuator id
+ * @param[out] active whether the filter is active
+ *
+ * @return 0 on success, SMP_ERROR_NOT_FOUND if the state is not known.
+ */
+int tup_context_get_shadow_filter_active(TupContext *ctx, TupFilterId filter,
+        uint8_t actuator_id, bool *active)
+{
+    TupShadowValue *value;
+    uint32_t v;
+    int ret;
+
+    if (ctx->shadow == NULL)
+        return SMP_ERROR_NOT_FOUND;
+
+    value = tup_shadow_get_filter(ctx->shadow, filter, actuator_id);
+    if (value == NULL)
+        return SMP_ERROR_NOT_FOUND;
+
+    ret = tup_shadow_value_get(ctx->shadow, value, tup_get_time_ms(),
+            &v);
+    if (ret < 0)
+        return ret;
+
+    *active = v != 0;
+    return 0;
+}
+
+/**
+ * \ingroup shadow
+ * Get the known band normalization coefficients of an actuator.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] actuator_id the actuator id
+ * @param[out] a the a coefficients
+ * @param[out] b the b coefficients
+ *
+ * @return 0 on success, SMP_ERROR_NOT_FOUND if they are not known.
+ */
+int tup_context_get_shadow_band_norm_coeffs(TupContext *ctx,
+        uint8_t actuator_id, float a[5], float b[5])
+{
+    TupShadowCoeffs *coeffs;
+
+    if (ctx->shadow == NULL)
+        return SMP_ERROR_NOT_FOUND;
+
+    coeffs = tup_shadow_get_coeffs(ctx->shadow, actuator_id, 0);
+    if (coeffs == NULL || !tup_shadow_is_fresh(ctx->shadow, coeffs->known,
+                coeffs->time_ms, tup_get_time_ms()))
+        return SMP_ERROR_NOT_FOUND;
+
+    memcpy(a, coeffs->a, sizeof(coeffs->a));
+    memcpy(b, coeffs->b, sizeof(coeffs->b));
+    return 0;
+}
+
+/**
+ * \ingroup shadow
+ * Get the number of commands answered locally.
+ *
+ * @param[in] ctx the TupContext
+ * @param[out] stats the statistics
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_get_shadow_stats(TupContext *ctx, TupShadowStats *stats)
+{
+    if (ctx->shadow == NULL)
+        return SMP_ERROR_NOT_FOUND;
+
+    *stats = ctx->shadow->stats;
+    return 0;
+}
+#endif
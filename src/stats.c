@@ -0,0 +1,425 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * \defgroup stats Statistics
+ *
+ * Context instrumentation.
+ *
+ * Once enabled with tup_context_enable_stats(), a context counts the
+ * messages and bytes it sends and receives and the errors it sees.
+ * Each command sent is timestamped and kept in a small FIFO. As Tactronik
+ * answers commands in order, an incoming ACK, ERROR or RESP_* message is
+ * matched with the oldest command it answers and the round-trip latency is
+ * added to the histogram of this command. Commands skipped by the match are
+ * counted as unanswered. A lost response can't be told apart from a late one
+ * though, so the next response of the same kind is credited to the older
+ * command.
+ *
+ * Recording a message costs a clock read and a few memory accesses so stats
+ * can be left enabled.
+ */
+
+#ifndef TUP_ENABLE_STATIC_API
+#define TUP_ENABLE_STATIC_API
+#endif
+
+#include "libtup-private.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* maximum number of commands waiting for a response */
+#define TUP_STATS_MAX_IN_FLIGHT 64
+
+/* latencies are counted with a precision of 1 / (1 << SUB_BUCKET_BITS) */
+#define TUP_LATENCY_SUB_BUCKET_BITS 4
+#define TUP_LATENCY_SUB_BUCKETS (1 << TUP_LATENCY_SUB_BUCKET_BITS)
+
+/* ensure buckets cover the whole uint32_t range */
+typedef char tup_latency_histogram_size_check[
+    (TUP_LATENCY_HISTOGRAM_N_BUCKETS == TUP_LATENCY_SUB_BUCKETS
+     + (32 - TUP_LATENCY_SUB_BUCKET_BITS) * TUP_LATENCY_SUB_BUCKETS) ? 1 : -1];
+
+typedef struct
+{
+    TupMessageType cmd;
+    TupMessageType resp;
+    uint64_t sent_us;
+} TupStatsCommand;
+
+struct TupStats
+{
+    TupContextStats counters;
+
+    /* commands sent, oldest first */
+    TupStatsCommand in_flight[TUP_STATS_MAX_IN_FLIGHT];
+    unsigned int head;
+    unsigned int n_in_flight;
+
+    /* indexed by command, allocated on first response */
+    TupLatencyHistogram *latencies[256];
+};
+
+static unsigned int tup_latency_histogram_get_bucket(uint32_t value)
+{
+    unsigned int shift = 0;
+
+    if (value < TUP_LATENCY_SUB_BUCKETS)
+        return value;
+
+    /* keep the SUB_BUCKET_BITS + 1 most significant bits */
+    while ((value >> shift) >= 2 * TUP_LATENCY_SUB_BUCKETS)
+        shift++;
+
+    return TUP_LATENCY_SUB_BUCKETS + shift * TUP_LATENCY_SUB_BUCKETS
+        + (value >> shift) - TUP_LATENCY_SUB_BUCKETS;
+}
+
+/**
+ * \ingroup stats
+ * Add a sample to a latency histogram, for instance to build one from
+ * recorded traffic. The histogram shall be zeroed before the first sample.
+ *
+ * @param[in] histogram the TupLatencyHistogram
+ * @param[in] latency_us the latency in microseconds
+ */
+void tup_latency_histogram_add(TupLatencyHistogram *histogram,
+        uint64_t latency_us)
+{
+    uint32_t value;
+
+    value = (latency_us > UINT32_MAX) ? UINT32_MAX : (uint32_t) latency_us;
+
+    if (histogram->count == 0 || value < histogram->min_us)
+        histogram->min_us = value;
+
+    if (value > histogram->max_us)
+        histogram->max_us = value;
+
+    histogram->count++;
+    histogram->sum_us += value;
+    histogram->buckets[tup_latency_histogram_get_bucket(value)]++;
+}
+
+#if TUP_ENABLE_STATS && defined(HAVE_CLOCK_GETTIME)
+static void tup_stats_record_latency(TupStats *stats,
+        const TupStatsCommand *command)
+{
+    TupLatencyHistogram *histogram;
+
+    if ((unsigned int) command->cmd >= 256)
+        return;
+
+    histogram = stats->latencies[command->cmd];
+    if (histogram == NULL) {
+        histogram = tup_calloc(1, sizeof(*histogram));
+        if (histogram == NULL)
+            return;
+
+        stats->latencies[command->cmd] = histogram;
+    }
+
+    tup_latency_histogram_add(histogram,
+            tup_get_time_ns() / 1000 - command->sent_us);
+}
+#endif
+
+/* get the highest value counted in bucket */
+static uint32_t tup_latency_histogram_get_bucket_max(unsigned int bucket)
+{
+    unsigned int shift;
+    uint64_t base;
+
+    if (bucket < TUP_LATENCY_SUB_BUCKETS)
+        return bucket;
+
+    shift = bucket / TUP_LATENCY_SUB_BUCKETS - 1;
+    base = bucket % TUP_LATENCY_SUB_BUCKETS + TUP_LATENCY_SUB_BUCKETS;
+
+    return (uint32_t) (((base + 1) << shift) - 1);
+}
+
+#if TUP_ENABLE_STATS
+void tup_stats_free(TupStats *stats)
+{
+    unsigned int i;
+
+    for (i = 0; i < 256; i++)
+        tup_free(stats->latencies[i]);
+
+    tup_free(stats);
+}
+
+void tup_stats_record_tx(TupContext *ctx, TupMessage *msg)
+{
+    int payload_size;
+
+    payload_size = tup_frame_get_payload_size(msg);
+
+    tup_stats_record_tx_frame(ctx, TUP_MESSAGE_TYPE(msg),
+            payload_size > 0 ? payload_size : 0);
+}
+
+/* record a frame sent without a TupMessage */
+void tup_stats_record_tx_frame(TupContext *ctx, TupMessageType cmd,
+        size_t payload_size)
+{
+    TupStats *stats = ctx->stats;
+    TupStatsCommand *command;
+
+    stats->counters.n_frames_tx++;
+    stats->counters.n_bytes_tx += 8 + payload_size;
+
+    command = &stats->in_flight[(stats->head + stats->n_in_flight)
+        % TUP_STATS_MAX_IN_FLIGHT];
+    command->cmd = cmd;
+    command->resp = tup_request_get_response_type(command->cmd);
+    if (command->resp == 0)
+        return;
+
+    command->sent_us = tup_get_time_ns() / 1000;
+
+    if (stats->n_in_flight == TUP_STATS_MAX_IN_FLIGHT) {
+        /* the oldest command has been overwritten */
+        stats->head = (stats->head + 1) % TUP_STATS_MAX_IN_FLIGHT;
+        stats->counters.n_unanswered++;
+    } else {
+        stats->n_in_flight++;
+    }
+}
+
+void tup_stats_record_rx(TupContext *ctx, TupMessage *msg)
+{
+    TupStats *stats = ctx->stats;
+    TupMessageType type = TUP_MESSAGE_TYPE(msg);
+    uint32_t cmd_id = 0;
+    int payload_size;
+    unsigned int i;
+
+    payload_size = tup_frame_get_payload_size(msg);
+
+    stats->counters.n_frames_rx++;
+    stats->counters.n_bytes_rx += 8 + (payload_size > 0 ? payload_size : 0);
+
+    if (type == TUP_MESSAGE_ACK || type == TUP_MESSAGE_ERROR) {
+        if (smp_message_get_uint32(msg, 0, &cmd_id) < 0)
+            return;
+    }
+
+    for (i = 0; i < stats->n_in_flight; i++) {
+        TupStatsCommand *c = &stats->in_flight[(stats->head + i)
+            % TUP_STATS_MAX_IN_FLIGHT];
+
+        if (type == TUP_MESSAGE_ERROR) {
+            if (c->cmd == (TupMessageType) cmd_id)
+                break;
+        } else if (type == TUP_MESSAGE_ACK) {
+            if (c->resp == TUP_MESSAGE_ACK && c->cmd == (TupMessageType) cmd_id)
+                break;
+        } else if (c->resp == type) {
+            break;
+        }
+    }
+
+    if (i == stats->n_in_flight) {
+        /* commands are received by the device side */
+        if (tup_request_get_response_type(type) == 0)
+            stats->counters.n_unmatched++;
+
+        return;
+    }
+
+    /* responses come in order, older commands won't be answered */
+    stats->counters.n_unanswered += i;
+
+#ifdef HAVE_CLOCK_GETTIME
+    tup_stats_record_latency(stats,
+            &stats->in_flight[(stats->head + i) % TUP_STATS_MAX_IN_FLIGHT]);
+#endif
+
+    stats->head = (stats->head + i + 1) % TUP_STATS_MAX_IN_FLIGHT;
+    stats->n_in_flight -= i + 1;
+}
+
+void tup_stats_record_error(TupContext *ctx, SmpError error)
+{
+    TupStats *stats = ctx->stats;
+    unsigned int index = (error < 0) ? (unsigned int) -error : 0;
+
+    if (index >= TUP_CONTEXT_STATS_N_ERRORS)
+        index = TUP_CONTEXT_STATS_N_ERRORS - 1;
+
+    stats->counters.n_errors[index]++;
+}
+
+/* API */
+
+/**
+ * \ingroup stats
+ * Enable or disable statistics collection. Disabling releases the collected
+ * statistics. Statistics are not available in threaded mode.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] enable true to enable collection, false to disable it
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_enable_stats(TupContext *ctx, bool enable)
+{
+    if (!enable) {
+        if (ctx->stats != NULL) {
+            tup_stats_free(ctx->stats);
+            ctx->stats = NULL;
+        }
+
+        return 0;
+    }
+
+    if (ctx->stats != NULL)
+        return 0;
+
+    /* send and receive would record from different threads */
+    if (ctx->io_thread != NULL)
+        return SMP_ERROR_NOT_SUPPORTED;
+
+    ctx->stats = tup_calloc(1, sizeof(TupStats));
+    if (ctx->stats == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    return 0;
+}
+
+/**
+ * \ingroup stats
+ * Get the counters of a context.
+ *
+ * @param[in] ctx the TupContext
+ * @param[out] stats the counters
+ *
+ * @return 0 on success, SMP_ERROR_NOT_FOUND if statistics are not enabled.
+ */
+int tup_context_get_stats(TupContext *ctx, TupContextStats *stats)
+{
+    if (ctx->stats == NULL)
+        return SMP_ERROR_NOT_FOUND;
+
+    *stats = ctx->stats->counters;
+    return 0;
+}
+
+/**
+ * \ingroup stats
+ * Get the round-trip latency histogram of a command, from the time it was
+ * sent to the time its response was decoded.
+ *
+ * @param[in] ctx the TupContext
+ * @param[in] cmd the command
+ * @param[out] histogram the histogram, empty if the command was never
+ *                       answered
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_context_get_latency_histogram(TupContext *ctx, TupMessageType cmd,
+        TupLatencyHistogram *histogram)
+{
+#ifndef HAVE_CLOCK_GETTIME
+    return SMP_ERROR_NOT_SUPPORTED;
+#else
+    if (ctx->stats == NULL)
+        return SMP_ERROR_NOT_FOUND;
+
+    if ((unsigned int) cmd >= 256)
+        return SMP_ERROR_INVALID_PARAM;
+
+    if (ctx->stats->latencies[cmd] != NULL)
+        *histogram = *ctx->stats->latencies[cmd];
+    else
+        memset(histogram, 0, sizeof(*histogram));
+
+    return 0;
+#endif
+}
+
+/**
+ * \ingroup stats
+ * Reset the counters and histograms of a context. Commands in flight are
+ * kept so their latency is still recorded.
+ *
+ * @param[in] ctx the TupContext
+ */
+void tup_context_reset_stats(TupContext *ctx)
+{
+    unsigned int i;
+
+    if (ctx->stats == NULL)
+        return;
+
+    memset(&ctx->stats->counters, 0, sizeof(ctx->stats->counters));
+
+    for (i = 0; i < 256; i++) {
+        if (ctx->stats->latencies[i] != NULL) {
+            memset(ctx->stats->latencies[i], 0,
+                    sizeof(*ctx->stats->latencies[i]));
+        }
+    }
+}
+
+#endif
+
+/**
+ * \ingroup stats
+ * Get a percentile of a latency histogram, e.g. 99.0 for the p99.
+ * The result is the upper bound of the bucket holding the percentile.
+ *
+ * @param[in] histogram the TupLatencyHistogram
+ * @param[in] percentile the percentile, between 0 and 100
+ *
+ * @return the latency in microseconds, 0 if the histogram is empty.
+ */
+uint32_t tup_latency_histogram_get_percentile(
+        const TupLatencyHistogram *histogram, double percentile)
+{
+    uint64_t rank;
+    uint64_t n = 0;
+    unsigned int i;
+
+    if (histogram->count == 0)
+        return 0;
+
+    if (percentile <= 0.0)
+        return histogram->min_us;
+
+    if (percentile >= 100.0)
+        return histogram->max_us;
+
+    /* rank of the sample, rounded up */
+    rank = (uint64_t) (percentile * histogram->count / 100.0);
+    if (rank < percentile * histogram->count / 100.0 || rank == 0)
+        rank++;
+
+    for (i = 0; i < TUP_LATENCY_HISTOGRAM_N_BUCKETS; i++) {
+        n += histogram->buckets[i];
+        if (n >= rank)
+            break;
+    }
+
+    if (i == TUP_LATENCY_HISTOGRAM_N_BUCKETS
+            || tup_latency_histogram_get_bucket_max(i) > histogram->max_us)
+        return histogram->max_us;
+
+    return tup_latency_histogram_get_bucket_max(i);
+}
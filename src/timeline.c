@@ -0,0 +1,666 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * \defgroup timeline Timeline
+ *
+ * Time-stamped commands (Linux only).
+ *
+ * A TupTimeline sends commands at given times relative to its start instead
+ * of sleeping between tup_context_send() calls. Commands are encoded when
+ * they are scheduled and kept in an earliest deadline first queue. A timerfd
+ * wakes the timeline slightly before the next deadline, the remaining time
+ * is spent polling the clock so frames leave on time, and all the commands
+ * due at once are written in a single write.
+ *
+ * Each command is sent lookahead microseconds before its time, to account
+ * for its transmission and processing by the device. How late each command
+ * actually left is reported to the event callback and in the lateness
+ * histogram.
+ */
+
+#ifndef TUP_ENABLE_STATIC_API
+#define TUP_ENABLE_STATIC_API
+#endif
+
+#include "libtup-private.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+/* the timer fires this early, the rest is spent polling the clock */
+#define TUP_TIMELINE_SPIN_NS 200000
+
+#define TUP_TIMELINE_DEFAULT_SIZE 32
+
+typedef struct
+{
+    uint64_t time_ns;           /* time relative to the timeline start */
+    uint64_t seq;               /* keeps scheduling order for equal times */
+    int id;
+    size_t len;
+    uint8_t *frame;
+} TupTimelineEvent;
+
+typedef struct
+{
+    int id;
+    uint32_t lateness_us;
+} TupTimelineReport;
+
+struct TupTimeline
+{
+    TupContext *ctx;
+    int timer_fd;
+
+    int started;
+    uint64_t origin_ns;
+    uint64_t lookahead_ns;
+
+    /* binary min-heap of events */
+    TupTimelineEvent *events;
+    size_t n_events;
+    size_t size;
+
+    uint64_t next_seq;
+    int next_id;
+
+    /* frames and reports of the events sent in one dispatch */
+    uint8_t *buf;
+    size_t buf_size;
+    TupTimelineReport *reports;
+    size_t reports_size;
+
+    TupTimelineCallback callback;
+    void *userdata;
+
+    TupTimelineStats stats;
+};
+
+static int tup_timeline_event_before(const TupTimelineEvent *a,
+        const TupTimelineEvent *b)
+{
+    if (a->time_ns != b->time_ns)
+        return a->time_ns < b->time_ns;
+
+    return a->seq < b->seq;
+}
+
+static void tup_timeline_heap_push(TupTimeline *timeline,
+        const TupTimelineEvent *event)
+{
+    size_t i = timeline->n_events++;
+
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+
+        if (!tup_timeline_event_before(event, &timeline->events[parent]))
+            break;
+
+        timeline->events[i] = timeline->events[parent];
+        i = parent;
+    }
+
+    timeline->events[i] = *event;
+}
+
+static void tup_timeline_heap_pop(TupTimeline *timeline)
+{
+    TupTimelineEvent last;
+    size_t i = 0;
+
+    last = timeline->events[--timeline->n_events];
+
+    for (;;) {
+        size_t child = 2 * i + 1;
+
+        if (child >= timeline->n_events)
+            break;
+
+        if (child + 1 < timeline->n_events
+                && tup_timeline_event_before(&timeline->events[child + 1],
+                    &timeline->events[child]))
+            child++;
+
+        if (!tup_timeline_event_before(&timeline->events[child], &last))
+            break;
+
+        timeline->events[i] = timeline->events[child];
+        i = child;
+    }
+
+    if (timeline->n_events > 0)
+        timeline->events[i] = last;
+}
+
+/* get the time at which an event shall be written */
+static uint64_t tup_timeline_get_send_time(TupTimeline *timeline,
+        const TupTimelineEvent *event)
+{
+    uint64_t time_ns = timeline->origin_ns + event->time_ns;
+
+    if (time_ns < timeline->origin_ns + timeline->lookahead_ns)
+        return timeline->origin_ns;
+
+    return time_ns - timeline->lookahead_ns;
+}
+
+static void tup_timeline_arm(TupTimeline *timeline)
+{
+    struct itimerspec spec;
+    uint64_t wakeup_ns;
+
+    memset(&spec, 0, sizeof(spec));
+
+    if (timeline->started && timeline->n_events > 0) {
+        wakeup_ns = tup_timeline_get_send_time(timeline, &timeline->events[0]);
+        if (wakeup_ns > TUP_TIMELINE_SPIN_NS)
+            wakeup_ns -= TUP_TIMELINE_SPIN_NS;
+
+        /* an all zero value would disarm the timer */
+        if (wakeup_ns == 0)
+            wakeup_ns = 1;
+
+        spec.it_value.tv_sec = wakeup_ns / 1000000000;
+        spec.it_value.tv_nsec = wakeup_ns % 1000000000;
+    }
+
+    timerfd_settime(timeline->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+/* append the frame of the first event to buf, it is freed on success */
+static int tup_timeline_collect(TupTimeline *timeline, size_t *len)
+{
+    TupTimelineEvent *event = &timeline->events[0];
+    uint8_t *buf;
+
+    if (*len + event->len > timeline->buf_size) {
+        size_t size = timeline->buf_size ? timeline->buf_size : 256;
+
+        while (size < *len + event->len)
+            size *= 2;
+
+        buf = tup_realloc(timeline->buf, size);
+        if (buf == NULL)
+            return SMP_ERROR_NO_MEM;
+
+        timeline->buf = buf;
+        timeline->buf_size = size;
+    }
+
+    memcpy(timeline->buf + *len, event->frame, event->len);
+    *len += event->len;
+    tup_free(event->frame);
+
+    return 0;
+}
+
+static int tup_timeline_add_report(TupTimeline *timeline, size_t index,
+        int id, uint32_t lateness_us)
+{
+    TupTimelineReport *reports;
+
+    if (index == timeline->reports_size) {
+        size_t size = timeline->reports_size ? 2 * timeline->reports_size : 8;
+
+        reports = tup_realloc(timeline->reports, size * sizeof(*reports));
+        if (reports == NULL)
+            return SMP_ERROR_NO_MEM;
+
+        timeline->reports = reports;
+        timeline->reports_size = size;
+    }
+
+    timeline->reports[index].id = id;
+    timeline->reports[index].lateness_us = lateness_us;
+    return 0;
+}
+
+/* API */
+
+/**
+ * \ingroup timeline
+ * Create a TupTimeline sending commands on an opened TupContext. The
+ * timeline shall be freed before the context.
+ *
+ * @param[in] ctx the TupContext
+ *
+ * @return a TupTimeline on success, NULL otherwise.
+ */
+TupTimeline *tup_timeline_new(TupContext *ctx)
+{
+    TupTimeline *timeline;
+
+    timeline = tup_calloc(1, sizeof(*timeline));
+    if (timeline == NULL)
+        return NULL;
+
+    timeline->events = tup_malloc(TUP_TIMELINE_DEFAULT_SIZE
+            * sizeof(TupTimelineEvent));
+    if (timeline->events == NULL)
+        goto events_failed;
+
+    timeline->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+            TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timeline->timer_fd < 0)
+        goto timerfd_failed;
+
+    timeline->ctx = ctx;
+    timeline->size = TUP_TIMELINE_DEFAULT_SIZE;
+    timeline->next_id = 1;
+    return timeline;
+
+timerfd_failed:
+    tup_free(timeline->events);
+events_failed:
+    tup_free(timeline);
+    return NULL;
+}
+
+/**
+ * \ingroup timeline
+ * Free a TupTimeline. Pending commands are dropped.
+ *
+ * @param[in] timeline the TupTimeline
+ */
+void tup_timeline_free(TupTimeline *timeline)
+{
+    tup_timeline_clear(timeline);
+
+    close(timeline->timer_fd);
+    tup_free(timeline->events);
+    tup_free(timeline->buf);
+    tup_free(timeline->reports);
+    tup_free(timeline);
+}
+
+/**
+ * \ingroup timeline
+ * Get the TupContext of a timeline.
+ *
+ * @param[in] timeline the TupTimeline
+ *
+ * @return the TupContext.
+ */
+TupContext *tup_timeline_get_context(TupTimeline *timeline)
+{
+    return timeline->ctx;
+}
+
+/**
+ * \ingroup timeline
+ * Schedule a command. The message is encoded right away and can be reused
+ * as soon as this function returns. Commands scheduled for the same time
+ * are sent in scheduling order and a command whose time is already elapsed
+ * is sent on next dispatch.
+ *
+ * @param[in] timeline the TupTimeline
+ * @param[in] time_us the time of the command, in microseconds from the
+ *                    timeline start
+ * @param[in] msg the message to send
+ *
+ * @return a positive event id on success, a SmpError otherwise.
+ */
+int tup_timeline_schedule(TupTimeline *timeline, uint64_t time_us,
+        TupMessage *msg)
+{
+    TupTimelineEvent event;
+    uint8_t stack_buf[256];
+    int len;
+
+    if (timeline->n_events == timeline->size) {
+        TupTimelineEvent *events;
+
+        events = tup_realloc(timeline->events,
+                2 * timeline->size * sizeof(TupTimelineEvent));
+        if (events == NULL)
+            return SMP_ERROR_NO_MEM;
+
+        timeline->events = events;
+        timeline->size *= 2;
+    }
+
+    len = tup_frame_encode(msg, stack_buf, sizeof(stack_buf));
+    if (len == SMP_ERROR_OVERFLOW) {
+        size_t size = 2 * sizeof(stack_buf);
+
+        /* bigger than most frames, find the right size */
+        event.frame = NULL;
+        do {
+            uint8_t *frame = tup_realloc(event.frame, size);
+
+            if (frame == NULL) {
+                tup_free(event.frame);
+                return SMP_ERROR_NO_MEM;
+            }
+
+            event.frame = frame;
+            len = tup_frame_encode(msg, event.frame, size);
+            size *= 2;
+        } while (len == SMP_ERROR_OVERFLOW);
+
+        if (len < 0) {
+            tup_free(event.frame);
+            return len;
+        }
+    } else if (len < 0) {
+        return len;
+    } else {
+        event.frame = tup_malloc(len);
+        if (event.frame == NULL)
+            return SMP_ERROR_NO_MEM;
+
+        memcpy(event.frame, stack_buf, len);
+    }
+
+    event.time_ns = time_us * 1000;
+    event.seq = timeline->next_seq++;
+    event.id = timeline->next_id++;
+    event.len = len;
+
+    /* keep ids positive */
+    if (timeline->next_id <= 0)
+        timeline->next_id = 1;
+
+    tup_timeline_heap_push(timeline, &event);
+
+#if TUP_ENABLE_SHADOW
+    /* the command is out of the context hands from now on */
+    if (timeline->ctx->shadow != NULL)
+        tup_shadow_record_tx(timeline->ctx, msg);
+#endif
+
+    if (timeline->events[0].id == event.id)
+        tup_timeline_arm(timeline);
+
+    return event.id;
+}
+
+/**
+ * \ingroup timeline
+ * Drop all pending commands.
+ *
+ * @param[in] timeline the TupTimeline
+ */
+void tup_timeline_clear(TupTimeline *timeline)
+{
+    size_t i;
+
+    for (i = 0; i < timeline->n_events; i++)
+        tup_free(timeline->events[i].frame);
+
+    timeline->n_events = 0;
+    tup_timeline_arm(timeline);
+}
+
+/**
+ * \ingroup timeline
+ * Get the number of commands waiting to be sent.
+ *
+ * @param[in] timeline the TupTimeline
+ *
+ * @return the number of pending commands.
+ */
+size_t tup_timeline_get_n_pending(TupTimeline *timeline)
+{
+    return timeline->n_events;
+}
+
+/**
+ * \ingroup timeline
+ * Send commands lookahead_us before their time. Use the lateness reported by
+ * the timeline to tune it. Default is 0.
+ *
+ * @param[in] timeline the TupTimeline
+ * @param[in] lookahead_us the lookahead in microseconds
+ */
+void tup_timeline_set_lookahead(TupTimeline *timeline, uint32_t lookahead_us)
+{
+    timeline->lookahead_ns = (uint64_t) lookahead_us * 1000;
+    tup_timeline_arm(timeline);
+}
+
+/**
+ * \ingroup timeline
+ * Set the function called after each command is sent.
+ *
+ * @param[in] timeline the TupTimeline
+ * @param[in] callback the function to call, NULL to unset it
+ * @param[in] userdata userdata to pass to callback
+ */
+void tup_timeline_set_callback(TupTimeline *timeline,
+        TupTimelineCallback callback, void *userdata)
+{
+    timeline->callback = callback;
+    timeline->userdata = userdata;
+}
+
+/**
+ * \ingroup timeline
+ * Start the timeline, command times are relative to this call. Starting an
+ * already started timeline moves its origin to now.
+ *
+ * @param[in] timeline the TupTimeline
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_timeline_start(TupTimeline *timeline)
+{
+    timeline->origin_ns = tup_get_time_ns();
+    timeline->started = 1;
+    tup_timeline_arm(timeline);
+
+    return 0;
+}
+
+/**
+ * \ingroup timeline
+ * Get the file descriptor of the timeline. It is readable when commands
+ * are about to be due, tup_timeline_dispatch() shall then be called.
+ *
+ * @param[in] timeline the TupTimeline
+ *
+ * @return the file descriptor.
+ */
+intptr_t tup_timeline_get_fd(TupTimeline *timeline)
+{
+    return timeline->timer_fd;
+}
+
+/**
+ * \ingroup timeline
+ * Send the due commands. If the next command is due within a few hundred
+ * microseconds, this function waits for it.
+ *
+ * @param[in] timeline the TupTimeline
+ *
+ * @return the number of commands sent on success, a SmpError otherwise.
+ */
+int tup_timeline_dispatch(TupTimeline *timeline)
+{
+    TupContext *ctx = timeline->ctx;
+    uint64_t expirations;
+    uint64_t send_ns;
+    uint64_t now_ns;
+    size_t n_sent = 0;
+    size_t n;
+    size_t len;
+    size_t i;
+    int ret = 0;
+
+    if (read(timeline->timer_fd, &expirations, sizeof(expirations)) < 0) {
+        /* nothing to do, timerfd is non blocking */
+    }
+
+    if (!timeline->started)
+        return 0;
+
+    /* frames are written to the device directly */
+    if (ctx->io_thread != NULL)
+        return SMP_ERROR_NOT_SUPPORTED;
+
+#if TUP_ENABLE_COALESCING
+    /* don't overtake pending updates nor combined frames */
+    if (ctx->coalescer != NULL) {
+        ret = tup_coalescer_drain(ctx, 1);
+        if (ret < 0)
+            return ret;
+    }
+#endif
+
+    ret = tup_context_flush(ctx);
+    if (ret < 0)
+        return ret;
+
+    while (timeline->n_events > 0) {
+        send_ns = tup_timeline_get_send_time(timeline, &timeline->events[0]);
+        now_ns = tup_get_time_ns();
+
+        if (send_ns > now_ns + TUP_TIMELINE_SPIN_NS)
+            break;
+
+        while (now_ns < send_ns)
+            now_ns = tup_get_time_ns();
+
+        len = 0;
+        n = 0;
+        while (timeline->n_events > 0) {
+            const TupTimelineEvent *event = &timeline->events[0];
+            uint64_t lateness_ns;
+
+            send_ns = tup_timeline_get_send_time(timeline, event);
+            if (send_ns > now_ns)
+                break;
+
+            lateness_ns = now_ns - send_ns;
+
+            ret = tup_timeline_add_report(timeline, n, event->id,
+                    (lateness_ns / 1000 > UINT32_MAX) ? UINT32_MAX
+                    : (uint32_t) (lateness_ns / 1000));
+            if (ret < 0)
+                break;
+
+            ret = tup_timeline_collect(timeline, &len);
+            if (ret < 0)
+                break;
+
+            tup_timeline_heap_pop(timeline);
+            n++;
+        }
+
+        if (len > 0) {
+            int write_ret = tup_context_write_raw(ctx, timeline->buf, len);
+
+            if (write_ret < 0) {
+                timeline->stats.n_errors += n;
+                ret = write_ret;
+            } else {
+                timeline->stats.n_sent += n;
+            }
+        }
+
+        for (i = 0; i < n; i++) {
+            tup_latency_histogram_add(&timeline->stats.lateness,
+                    timeline->reports[i].lateness_us);
+
+            if (timeline->callback != NULL) {
+                timeline->callback(timeline, timeline->reports[i].id,
+                        timeline->reports[i].lateness_us, timeline->userdata);
+            }
+        }
+
+        n_sent += n;
+        if (ret < 0)
+            break;
+    }
+
+    tup_timeline_arm(timeline);
+    return (ret < 0) ? ret : (int) n_sent;
+}
+
+/**
+ * \ingroup timeline
+ * Send all pending commands, processing incoming data of the context
+ * meanwhile, and return once the last one is sent.
+ *
+ * @param[in] timeline a started TupTimeline
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_timeline_run(TupTimeline *timeline)
+{
+    struct pollfd pfds[2];
+    intptr_t fd;
+    nfds_t n_fds = 1;
+    int ret;
+
+    if (!timeline->started)
+        return SMP_ERROR_INVALID_PARAM;
+
+    pfds[0].fd = timeline->timer_fd;
+    pfds[0].events = POLLIN;
+
+    fd = tup_context_get_fd(timeline->ctx);
+    if (fd >= 0) {
+        pfds[1].fd = (int) fd;
+        pfds[1].events = POLLIN;
+        n_fds = 2;
+    }
+
+    while (timeline->n_events > 0) {
+        pfds[0].revents = 0;
+        pfds[1].revents = 0;
+
+        ret = poll(pfds, n_fds, -1);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return SMP_ERROR_IO;
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            ret = tup_timeline_dispatch(timeline);
+            if (ret < 0)
+                return ret;
+        }
+
+        if (n_fds > 1 && (pfds[1].revents & POLLIN)) {
+            ret = tup_context_process_fd(timeline->ctx);
+            if (ret < 0)
+                return ret;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * \ingroup timeline
+ * Get the statistics of a timeline.
+ *
+ * @param[in] timeline the TupTimeline
+ * @param[out] stats the statistics
+ */
+void tup_timeline_get_stats(TupTimeline *timeline, TupTimelineStats *stats)
+{
+    *stats = timeline->stats;
+}
@@ -0,0 +1,99 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TUP_ENABLE_STATIC_API
+#define TUP_ENABLE_STATIC_API
+#endif
+
+#include "libtup-private.h"
+
+#ifdef HAVE_CLOCK_GETTIME
+#include <time.h>
+#endif
+
+/* get a monotonic timestamp, always 0 if there is no clock */
+uint64_t tup_get_time_ns(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+/* same as tup_get_time_ns() in milliseconds, wraps after 49 days */
+uint32_t tup_get_time_ms(void)
+{
+    return (uint32_t) (tup_get_time_ns() / 1000000);
+}
+
+/* API */
+
+/**
+ * \ingroup context
+ * Get the number of bits per second of a baudrate.
+ *
+ * @param[in] baudrate the baudrate
+ *
+ * @return the bits per second, 0 if baudrate is invalid.
+ */
+unsigned int tup_serial_baudrate_get_bps(SmpSerialBaudrate baudrate)
+{
+    switch (baudrate) {
+        case SMP_SERIAL_BAUDRATE_1200:
+            return 1200;
+        case SMP_SERIAL_BAUDRATE_2400:
+            return 2400;
+        case SMP_SERIAL_BAUDRATE_4800:
+            return 4800;
+        case SMP_SERIAL_BAUDRATE_9600:
+            return 9600;
+        case SMP_SERIAL_BAUDRATE_19200:
+            return 19200;
+        case SMP_SERIAL_BAUDRATE_38400:
+            return 38400;
+        case SMP_SERIAL_BAUDRATE_57600:
+            return 57600;
+        case SMP_SERIAL_BAUDRATE_115200:
+            return 115200;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * \ingroup context
+ * Get the time needed to serialize one byte on a UART: a start bit, 8 data
+ * bits, the parity bit if any and a stop bit.
+ *
+ * @param[in] bps the bits per second of the line
+ * @param[in] parity the parity of the line
+ *
+ * @return the byte time in nanoseconds, 0 if bps is 0.
+ */
+uint64_t tup_serial_get_byte_time_ns(unsigned int bps, SmpSerialParity parity)
+{
+    unsigned int bits = (parity == SMP_SERIAL_PARITY_NONE) ? 10 : 11;
+
+    if (bps == 0)
+        return 0;
+
+    return (uint64_t) bits * 1000000000 / bps;
+}
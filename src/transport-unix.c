@@ -0,0 +1,773 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Transport backends: serial device, pty master, file descriptors
+ * (pipes, socketpair) and in-memory loopback. */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#ifndef TUP_ENABLE_STATIC_API
+#define TUP_ENABLE_STATIC_API
+#endif
+
+#include "libtup-private.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TUP_LOOPBACK_DEFAULT_SIZE (64 * 1024)
+#define TUP_PTY_NAME_SIZE 64
+
+/* File descriptor based transports */
+
+typedef struct
+{
+    int read_fd;
+    int write_fd;
+
+    /* pty only */
+    char pty_name[TUP_PTY_NAME_SIZE];
+    int pty_slave_fd;
+} TupFdTransport;
+
+static TupFdTransport *tup_fd_transport_new(int read_fd, int write_fd)
+{
+    TupFdTransport *fdt;
+
+    fdt = tup_calloc(1, sizeof(*fdt));
+    if (fdt == NULL)
+        return NULL;
+
+    fdt->read_fd = read_fd;
+    fdt->write_fd = write_fd;
+    fdt->pty_slave_fd = -1;
+    return fdt;
+}
+
+static void tup_fd_transport_close_fds(TupFdTransport *fdt)
+{
+    if (fdt->read_fd >= 0)
+        close(fdt->read_fd);
+
+    if (fdt->write_fd >= 0 && fdt->write_fd != fdt->read_fd)
+        close(fdt->write_fd);
+
+    if (fdt->pty_slave_fd >= 0)
+        close(fdt->pty_slave_fd);
+
+    fdt->read_fd = -1;
+    fdt->write_fd = -1;
+    fdt->pty_slave_fd = -1;
+}
+
+static int tup_fd_transport_read(void *priv, uint8_t *buf, size_t size)
+{
+    TupFdTransport *fdt = priv;
+    ssize_t ret;
+
+    if (fdt->read_fd < 0)
+        return SMP_ERROR_BAD_FD;
+
+    do {
+        ret = read(fdt->read_fd, buf, size);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+
+        return SMP_ERROR_IO;
+    } else if (ret == 0 && size > 0) {
+        /* peer is gone */
+        return SMP_ERROR_NO_DEVICE;
+    }
+
+    return (int) ret;
+}
+
+/* write the whole buffer to fd, waiting for it to be writable if needed */
+static int tup_fd_write_all(int fd, const uint8_t *data, size_t size)
+{
+    struct pollfd pfd;
+    ssize_t ret;
+
+    while (size > 0) {
+        ret = write(fd, data, size);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return SMP_ERROR_IO;
+
+            pfd.fd = fd;
+            pfd.events = POLLOUT;
+            pfd.revents = 0;
+            poll(&pfd, 1, -1);
+            continue;
+        }
+
+        data += ret;
+        size -= ret;
+    }
+
+    return 0;
+}
+
+static int tup_fd_transport_write(void *priv, const uint8_t *data,
+        size_t size)
+{
+    TupFdTransport *fdt = priv;
+
+    if (fdt->write_fd < 0)
+        return SMP_ERROR_BAD_FD;
+
+    return tup_fd_write_all(fdt->write_fd, data, size);
+}
+
+static int tup_fd_transport_poll(void *priv, int timeout_ms)
+{
+    TupFdTransport *fdt = priv;
+    struct pollfd pfd;
+    int ret;
+
+    if (fdt->read_fd < 0)
+        return SMP_ERROR_BAD_FD;
+
+    pfd.fd = fdt->read_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    do {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0)
+        return SMP_ERROR_IO;
+
+    /* a hangup is reported by the next read */
+    return ret > 0 ? 1 : 0;
+}
+
+static intptr_t tup_fd_transport_get_fd(void *priv)
+{
+    TupFdTransport *fdt = priv;
+
+    if (fdt->read_fd < 0)
+        return SMP_ERROR_BAD_FD;
+
+    return fdt->read_fd;
+}
+
+static void tup_fd_transport_free(void *priv)
+{
+    TupFdTransport *fdt = priv;
+
+    tup_fd_transport_close_fds(fdt);
+    tup_free(fdt);
+}
+
+static TupTransport *tup_fd_transport_wrap(const TupTransportOps *ops,
+        int read_fd, int write_fd)
+{
+    TupTransport *transport;
+    TupFdTransport *fdt;
+
+    fdt = tup_fd_transport_new(read_fd, write_fd);
+    if (fdt == NULL)
+        return NULL;
+
+    transport = tup_transport_new(ops, fdt);
+    if (transport == NULL) {
+        tup_free(fdt);
+        return NULL;
+    }
+
+    return transport;
+}
+
+/* Serial */
+
+static speed_t tup_serial_get_speed(SmpSerialBaudrate baudrate)
+{
+    switch (tup_serial_baudrate_get_bps(baudrate)) {
+        case 1200:
+            return B1200;
+        case 2400:
+            return B2400;
+        case 4800:
+            return B4800;
+        case 9600:
+            return B9600;
+        case 19200:
+            return B19200;
+        case 38400:
+            return B38400;
+        case 57600:
+            return B57600;
+        case 115200:
+            return B115200;
+        default:
+            return B0;
+    }
+}
+
+static int tup_serial_configure(int fd, SmpSerialBaudrate baudrate,
+        SmpSerialParity parity, int flow_control)
+{
+    struct termios term;
+    speed_t speed;
+
+    speed = tup_serial_get_speed(baudrate);
+    if (speed == B0)
+        return SMP_ERROR_INVALID_PARAM;
+
+    if (tcgetattr(fd, &term) < 0)
+        return SMP_ERROR_IO;
+
+    cfmakeraw(&term);
+    cfsetispeed(&term, speed);
+    cfsetospeed(&term, speed);
+
+    term.c_cflag &= ~(PARENB | PARODD | CRTSCTS);
+    switch (parity) {
+        case SMP_SERIAL_PARITY_NONE:
+            break;
+        case SMP_SERIAL_PARITY_ODD:
+            term.c_cflag |= PARENB | PARODD;
+            break;
+        case SMP_SERIAL_PARITY_EVEN:
+            term.c_cflag |= PARENB;
+            break;
+        default:
+            return SMP_ERROR_INVALID_PARAM;
+    }
+
+    if (flow_control)
+        term.c_cflag |= CRTSCTS;
+
+    if (tcsetattr(fd, TCSANOW, &term) < 0)
+        return SMP_ERROR_IO;
+
+    return 0;
+}
+
+static int tup_serial_transport_open(void *priv, const char *device)
+{
+    TupFdTransport *fdt = priv;
+    int fd;
+    int ret;
+
+    if (device == NULL)
+        return SMP_ERROR_INVALID_PARAM;
+
+    if (fdt->read_fd >= 0)
+        return SMP_ERROR_BUSY;
+
+    fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return errno == ENOENT ? SMP_ERROR_NO_DEVICE : SMP_ERROR_IO;
+
+    /* libsmp defaults */
+    ret = tup_serial_configure(fd, SMP_SERIAL_BAUDRATE_115200,
+            SMP_SERIAL_PARITY_NONE, 0);
+    if (ret < 0) {
+        close(fd);
+        return ret;
+    }
+
+    fdt->read_fd = fd;
+    fdt->write_fd = fd;
+    return 0;
+}
+
+static void tup_serial_transport_close(void *priv)
+{
+    tup_fd_transport_close_fds(priv);
+}
+
+static int tup_serial_transport_set_config(void *priv,
+        SmpSerialBaudrate baudrate, SmpSerialParity parity, int flow_control)
+{
+    TupFdTransport *fdt = priv;
+
+    if (fdt->read_fd < 0)
+        return SMP_ERROR_BAD_FD;
+
+    return tup_serial_configure(fdt->read_fd, baudrate, parity, flow_control);
+}
+
+static const TupTransportOps tup_serial_transport_ops = {
+    .open = tup_serial_transport_open,
+    .close = tup_serial_transport_close,
+    .read = tup_fd_transport_read,
+    .write = tup_fd_transport_write,
+    .poll = tup_fd_transport_poll,
+    .get_fd = tup_fd_transport_get_fd,
+    .set_config = tup_serial_transport_set_config,
+    .free = tup_fd_transport_free,
+};
+
+/* Pty */
+
+/* device is ignored, a new pty is allocated */
+static int tup_pty_transport_open(void *priv, const char *device)
+{
+    TupFdTransport *fdt = priv;
+    int fd;
+
+    if (fdt->read_fd >= 0)
+        return SMP_ERROR_BUSY;
+
+    fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return SMP_ERROR_IO;
+
+    if (grantpt(fd) < 0 || unlockpt(fd) < 0
+            || ptsname_r(fd, fdt->pty_name, sizeof(fdt->pty_name)) != 0) {
+        close(fd);
+        return SMP_ERROR_IO;
+    }
+
+    /* keep the slave opened so the master doesn't hang up while no peer is
+     * connected */
+    fdt->pty_slave_fd = open(fdt->pty_name,
+            O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fdt->pty_slave_fd < 0) {
+        close(fd);
+        return SMP_ERROR_IO;
+    }
+
+    /* the line discipline is shared with the slave side */
+    tup_serial_configure(fd, SMP_SERIAL_BAUDRATE_115200,
+            SMP_SERIAL_PARITY_NONE, 0);
+
+    fdt->read_fd = fd;
+    fdt->write_fd = fd;
+    return 0;
+}
+
+static void tup_pty_transport_close(void *priv)
+{
+    TupFdTransport *fdt = priv;
+
+    tup_fd_transport_close_fds(fdt);
+    fdt->pty_name[0] = '\0';
+}
+
+static const TupTransportOps tup_pty_transport_ops = {
+    .open = tup_pty_transport_open,
+    .close = tup_pty_transport_close,
+    .read = tup_fd_transport_read,
+    .write = tup_fd_transport_write,
+    .poll = tup_fd_transport_poll,
+    .get_fd = tup_fd_transport_get_fd,
+    .set_config = tup_serial_transport_set_config,
+    .free = tup_fd_transport_free,
+};
+
+/* Generic file descriptors */
+
+static const TupTransportOps tup_fd_transport_ops = {
+    .read = tup_fd_transport_read,
+    .write = tup_fd_transport_write,
+    .poll = tup_fd_transport_poll,
+    .get_fd = tup_fd_transport_get_fd,
+    .free = tup_fd_transport_free,
+};
+
+/* Loopback */
+
+typedef struct
+{
+    uint8_t *data;
+    size_t size;
+    size_t head;
+    size_t len;
+} TupLoopbackFifo;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    /* fifos[i] holds the data to be read by end i */
+    TupLoopbackFifo fifos[2];
+    int n_ends;
+} TupLoopbackLink;
+
+typedef struct
+{
+    TupLoopbackLink *link;
+    int index;
+} TupLoopbackEnd;
+
+static int tup_loopback_transport_read(void *priv, uint8_t *buf, size_t size)
+{
+    TupLoopbackEnd *end = priv;
+    TupLoopbackLink *link = end->link;
+    TupLoopbackFifo *fifo = &link->fifos[end->index];
+    size_t n;
+    size_t chunk;
+
+    pthread_mutex_lock(&link->lock);
+
+    n = fifo->len < size ? fifo->len : size;
+
+    chunk = fifo->size - fifo->head;
+    if (chunk > n)
+        chunk = n;
+
+    memcpy(buf, fifo->data + fifo->head, chunk);
+    memcpy(buf + chunk, fifo->data, n - chunk);
+
+    fifo->head = (fifo->head + n) % fifo->size;
+    fifo->len -= n;
+
+    if (n > 0)
+        pthread_cond_broadcast(&link->cond);
+
+    pthread_mutex_unlock(&link->lock);
+    return (int) n;
+}
+
+static int tup_loopback_transport_write(void *priv, const uint8_t *data,
+        size_t size)
+{
+    TupLoopbackEnd *end = priv;
+    TupLoopbackLink *link = end->link;
+    TupLoopbackFifo *fifo = &link->fifos[!end->index];
+    size_t tail;
+    size_t n;
+    size_t chunk;
+
+    pthread_mutex_lock(&link->lock);
+
+    while (size > 0) {
+        if (link->n_ends < 2) {
+            pthread_mutex_unlock(&link->lock);
+            return SMP_ERROR_PIPE;
+        }
+
+        if (fifo->len == fifo->size) {
+            pthread_cond_wait(&link->cond, &link->lock);
+            continue;
+        }
+
+        n = fifo->size - fifo->len;
+        if (n > size)
+            n = size;
+
+        tail = (fifo->head + fifo->len) % fifo->size;
+        chunk = fifo->size - tail;
+        if (chunk > n)
+            chunk = n;
+
+        memcpy(fifo->data + tail, data, chunk);
+        memcpy(fifo->data, data + chunk, n - chunk);
+
+        fifo->len += n;
+        data += n;
+        size -= n;
+
+        pthread_cond_broadcast(&link->cond);
+    }
+
+    pthread_mutex_unlock(&link->lock);
+    return 0;
+}
+
+static int tup_loopback_transport_poll(void *priv, int timeout_ms)
+{
+    TupLoopbackEnd *end = priv;
+    TupLoopbackLink *link = end->link;
+    TupLoopbackFifo *fifo = &link->fifos[end->index];
+    struct timespec deadline;
+    int ret = 0;
+
+    if (timeout_ms >= 0) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    pthread_mutex_lock(&link->lock);
+
+    while (fifo->len == 0 && link->n_ends == 2 && ret == 0) {
+        if (timeout_ms < 0)
+            pthread_cond_wait(&link->cond, &link->lock);
+        else
+            ret = pthread_cond_timedwait(&link->cond, &link->lock, &deadline);
+    }
+
+    ret = fifo->len > 0 ? 1 : 0;
+    if (ret == 0 && link->n_ends < 2)
+        ret = SMP_ERROR_NO_DEVICE;
+
+    pthread_mutex_unlock(&link->lock);
+    return ret;
+}
+
+static void tup_loopback_link_free(TupLoopbackLink *link)
+{
+    pthread_cond_destroy(&link->cond);
+    pthread_mutex_destroy(&link->lock);
+    tup_free(link->fifos[0].data);
+    tup_free(link->fifos[1].data);
+    tup_free(link);
+}
+
+static void tup_loopback_transport_free(void *priv)
+{
+    TupLoopbackEnd *end = priv;
+    TupLoopbackLink *link = end->link;
+    int n_ends;
+
+    pthread_mutex_lock(&link->lock);
+    n_ends = --link->n_ends;
+    pthread_cond_broadcast(&link->cond);
+    pthread_mutex_unlock(&link->lock);
+
+    if (n_ends == 0)
+        tup_loopback_link_free(link);
+
+    tup_free(end);
+}
+
+static const TupTransportOps tup_loopback_transport_ops = {
+    .read = tup_loopback_transport_read,
+    .write = tup_loopback_transport_write,
+    .poll = tup_loopback_transport_poll,
+    .free = tup_loopback_transport_free,
+};
+
+static TupLoopbackLink *tup_loopback_link_new(size_t size)
+{
+    TupLoopbackLink *link;
+    pthread_condattr_t attr;
+
+    link = tup_calloc(1, sizeof(*link));
+    if (link == NULL)
+        return NULL;
+
+    link->fifos[0].data = tup_malloc(size);
+    link->fifos[1].data = tup_malloc(size);
+    if (link->fifos[0].data == NULL || link->fifos[1].data == NULL) {
+        tup_free(link->fifos[0].data);
+        tup_free(link->fifos[1].data);
+        tup_free(link);
+        return NULL;
+    }
+
+    link->fifos[0].size = size;
+    link->fifos[1].size = size;
+    link->n_ends = 2;
+
+    pthread_mutex_init(&link->lock, NULL);
+
+    /* poll deadlines are computed on the monotonic clock */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&link->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    return link;
+}
+
+/* API */
+
+/**
+ * \ingroup transport
+ * Create a transport using a serial device. tup_context_open() opens the
+ * device path with the same default config as libsmp (115200 bauds, no
+ * parity, no flow control).
+ *
+ * @return a TupTransport on success, NULL otherwise.
+ */
+TupTransport *tup_transport_new_serial(void)
+{
+    return tup_fd_transport_wrap(&tup_serial_transport_ops, -1, -1);
+}
+
+/**
+ * \ingroup transport
+ * Create a transport using the master side of a pty. tup_context_open()
+ * allocates a new pty whatever the device, then the slave side can be
+ * opened by a peer using tup_transport_get_pty_name(). The transport keeps
+ * the slave side opened too so peers can come and go.
+ *
+ * @return a TupTransport on success, NULL otherwise.
+ */
+TupTransport *tup_transport_new_pty(void)
+{
+    return tup_fd_transport_wrap(&tup_pty_transport_ops, -1, -1);
+}
+
+/**
+ * \ingroup transport
+ * Get the path of the slave side of an opened pty transport.
+ *
+ * @param[in] transport a transport created with tup_transport_new_pty()
+ *
+ * @return the slave path or NULL if transport is not an opened pty.
+ */
+const char *tup_transport_get_pty_name(TupTransport *transport)
+{
+    TupFdTransport *fdt;
+
+    if (transport == NULL || transport->ops != &tup_pty_transport_ops)
+        return NULL;
+
+    fdt = transport->priv;
+    if (fdt->read_fd < 0)
+        return NULL;
+
+    return fdt->pty_name;
+}
+
+/**
+ * \ingroup transport
+ * Create a transport using already opened file descriptors, like pipes or a
+ * socket. The transport takes ownership of the file descriptors and sets
+ * read_fd in non blocking mode.
+ *
+ * @param[in] read_fd the file descriptor to read from
+ * @param[in] write_fd the file descriptor to write to, can be read_fd
+ *
+ * @return a TupTransport on success, NULL otherwise.
+ */
+TupTransport *tup_transport_new_fd(int read_fd, int write_fd)
+{
+    int flags;
+
+    if (read_fd < 0 || write_fd < 0)
+        return NULL;
+
+    flags = fcntl(read_fd, F_GETFL);
+    if (flags < 0 || fcntl(read_fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return NULL;
+
+    return tup_fd_transport_wrap(&tup_fd_transport_ops, read_fd, write_fd);
+}
+
+/**
+ * \ingroup transport
+ * Create two transports connected by a socketpair.
+ *
+ * @param[out] transport0 the first end
+ * @param[out] transport1 the second end
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_transport_new_socketpair(TupTransport **transport0,
+        TupTransport **transport1)
+{
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+        return SMP_ERROR_IO;
+
+    *transport0 = tup_transport_new_fd(sv[0], sv[0]);
+    if (*transport0 == NULL) {
+        close(sv[0]);
+        close(sv[1]);
+        return SMP_ERROR_NO_MEM;
+    }
+
+    *transport1 = tup_transport_new_fd(sv[1], sv[1]);
+    if (*transport1 == NULL) {
+        tup_transport_free(*transport0);
+        close(sv[1]);
+        return SMP_ERROR_NO_MEM;
+    }
+
+    return 0;
+}
+
+/**
+ * \ingroup transport
+ * Create two transports connected in memory, without any system call.
+ * Each end has a FIFO of size bytes, written data is copied once in the FIFO
+ * of the peer. Writing blocks while the FIFO of the peer is full so both ends
+ * should be served by different threads unless the FIFO is big enough for
+ * the traffic between two reads. Loopback transports have no file
+ * descriptor.
+ *
+ * @param[out] transport0 the first end
+ * @param[out] transport1 the second end
+ * @param[in] size the size of each FIFO, 0 selects a default size
+ *
+ * @return 0 on success, a SmpError otherwise.
+ */
+int tup_transport_new_loopback(TupTransport **transport0,
+        TupTransport **transport1, size_t size)
+{
+    TupLoopbackLink *link;
+    TupLoopbackEnd *ends[2];
+    TupTransport *transports[2] = { NULL, NULL };
+    int i;
+
+    if (size == 0)
+        size = TUP_LOOPBACK_DEFAULT_SIZE;
+
+    link = tup_loopback_link_new(size);
+    if (link == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    for (i = 0; i < 2; i++) {
+        ends[i] = tup_malloc(sizeof(*ends[i]));
+        if (ends[i] == NULL)
+            goto error;
+
+        ends[i]->link = link;
+        ends[i]->index = i;
+
+        transports[i] = tup_transport_new(&tup_loopback_transport_ops,
+                ends[i]);
+        if (transports[i] == NULL) {
+            tup_free(ends[i]);
+            goto error;
+        }
+    }
+
+    *transport0 = transports[0];
+    *transport1 = transports[1];
+    return 0;
+
+error:
+    /* release the first end without going through the link refcount */
+    if (transports[0] != NULL) {
+        tup_free(ends[0]);
+        tup_free(transports[0]);
+    }
+
+    tup_loopback_link_free(link);
+    return SMP_ERROR_NO_MEM;
+}
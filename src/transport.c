@@ -0,0 +1,128 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * @file
+ * \defgroup transport Transport
+ *
+ * Byte stream used by a TupContext in place of the libsmp serial device.
+ *
+ * A context created with tup_context_new_with_transport() does the framing
+ * itself and moves bytes through the transport operations. This allows to
+ * run the library over a pty, a socket or in memory, for instance to test or
+ * benchmark it without hardware.
+ */
+
+#ifndef TUP_ENABLE_STATIC_API
+#define TUP_ENABLE_STATIC_API
+#endif
+
+#include "libtup-private.h"
+#include <stdlib.h>
+
+#if TUP_ENABLE_TRANSPORT
+int tup_transport_open(TupTransport *transport, const char *device)
+{
+    if (transport->ops->open == NULL)
+        return 0;
+
+    return transport->ops->open(transport->priv, device);
+}
+
+void tup_transport_close(TupTransport *transport)
+{
+    if (transport->ops->close != NULL)
+        transport->ops->close(transport->priv);
+}
+
+int tup_transport_read(TupTransport *transport, uint8_t *buf, size_t size)
+{
+    return transport->ops->read(transport->priv, buf, size);
+}
+
+int tup_transport_write(TupTransport *transport, const uint8_t *data,
+        size_t size)
+{
+    return transport->ops->write(transport->priv, data, size);
+}
+
+int tup_transport_poll(TupTransport *transport, int timeout_ms)
+{
+    return transport->ops->poll(transport->priv, timeout_ms);
+}
+
+intptr_t tup_transport_get_fd(TupTransport *transport)
+{
+    if (transport->ops->get_fd == NULL)
+        return SMP_ERROR_NOT_SUPPORTED;
+
+    return transport->ops->get_fd(transport->priv);
+}
+
+int tup_transport_set_config(TupTransport *transport,
+        SmpSerialBaudrate baudrate, SmpSerialParity parity, int flow_control)
+{
+    if (transport->ops->set_config == NULL)
+        return SMP_ERROR_NOT_SUPPORTED;
+
+    return transport->ops->set_config(transport->priv, baudrate, parity,
+            flow_control);
+}
+
+/* API */
+
+/**
+ * \ingroup transport
+ * Create a new TupTransport. read, write and poll operations are mandatory.
+ *
+ * @param[in] ops the transport operations, shall stay valid while the
+ *                transport is used
+ * @param[in] priv the private data passed to operations
+ *
+ * @return a TupTransport on success, NULL otherwise.
+ */
+TupTransport *tup_transport_new(const TupTransportOps *ops, void *priv)
+{
+    TupTransport *transport;
+
+    if (ops == NULL || ops->read == NULL || ops->write == NULL
+            || ops->poll == NULL)
+        return NULL;
+
+    transport = tup_malloc(sizeof(*transport));
+    if (transport == NULL)
+        return NULL;
+
+    transport->ops = ops;
+    transport->priv = priv;
+    return transport;
+}
+
+/**
+ * \ingroup transport
+ * Free a TupTransport. This should only be used on a transport which has not
+ * been given to tup_context_new_with_transport().
+ *
+ * @param[in] transport the TupTransport to free
+ */
+void tup_transport_free(TupTransport *transport)
+{
+    if (transport->ops->free != NULL)
+        transport->ops->free(transport->priv);
+
+    tup_free(transport);
+}
+#endif
@@ -0,0 +1,281 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#define TUP_ENABLE_STATIC_API
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <libtup.h>
+
+#define TEST_WARMUP_COUNT 64
+#define TEST_COUNT 10000
+
+typedef struct
+{
+    unsigned long n_allocs;
+    long n_live;
+} TestAllocator;
+
+typedef struct
+{
+    TupMessage *reply;
+    unsigned long n_received;
+} TestPeer;
+
+static TestAllocator allocator;
+
+static void *test_malloc(size_t size, void *userdata)
+{
+    TestAllocator *alloc = userdata;
+    void *ptr;
+
+    ptr = malloc(size);
+    if (ptr != NULL) {
+        alloc->n_allocs++;
+        alloc->n_live++;
+    }
+
+    return ptr;
+}
+
+static void *test_realloc(void *ptr, size_t size, void *userdata)
+{
+    TestAllocator *alloc = userdata;
+    void *new_ptr;
+
+    new_ptr = realloc(ptr, size);
+    if (new_ptr != NULL) {
+        alloc->n_allocs++;
+        if (ptr == NULL)
+            alloc->n_live++;
+    }
+
+    return new_ptr;
+}
+
+static void test_free(void *ptr, void *userdata)
+{
+    TestAllocator *alloc = userdata;
+
+    if (ptr != NULL)
+        alloc->n_live--;
+
+    free(ptr);
+}
+
+/* the device acks every command, the host only counts the acks */
+static void on_device_message(TupContext *ctx, TupMessage *msg,
+        void *userdata)
+{
+    TestPeer *device = userdata;
+
+    device->n_received++;
+    tup_message_init_ack(device->reply, tup_message_get_type(msg));
+    tup_context_send(ctx, device->reply);
+}
+
+static void on_host_message(TupContext *ctx, TupMessage *msg, void *userdata)
+{
+    TestPeer *host = userdata;
+
+    host->n_received++;
+}
+
+static int run(TupContext *host, TupContext *device, TupMessage *msg,
+        unsigned long count)
+{
+    unsigned long i;
+    int ret;
+
+    for (i = 0; i < count; i++) {
+        tup_message_init_set_input_value_simple(msg, 1, 0, i);
+
+        ret = tup_context_send(host, msg);
+        if (ret < 0)
+            return ret;
+
+        ret = tup_context_process_fd(device);
+        if (ret < 0)
+            return ret;
+
+        ret = tup_context_process_fd(host);
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+/* contexts and messages are allocated with the hooks */
+static bool test_storage(void)
+{
+    TupContext *ctx;
+    TupMessage *msg;
+
+    allocator.n_allocs = 0;
+
+    ctx = tup_context_new(NULL, NULL);
+    msg = tup_message_new();
+    if (ctx == NULL || msg == NULL) {
+        fprintf(stderr, "failed to create a context and a message\n");
+        return false;
+    }
+
+    tup_message_init_ack(msg, TUP_MESSAGE_CMD_PLAY);
+
+    tup_message_free(msg);
+    tup_context_free(ctx);
+
+    if (allocator.n_allocs != 2 || allocator.n_live != 0) {
+        fprintf(stderr, "storage: %lu allocations, %ld live blocks, "
+                "expected 2 and 0\n", allocator.n_allocs, allocator.n_live);
+        return false;
+    }
+
+    return true;
+}
+
+TUP_DEFINE_STATIC_MESSAGE(static_msg, 8);
+
+/* messages libtup doesn't own are left alone by tup_message_free() */
+static bool test_foreign_messages(void)
+{
+    SmpStaticMessage smsg;
+    SmpValue values[8];
+    TupMessage *msg;
+    long n_live = allocator.n_live;
+
+    msg = static_msg_create();
+    tup_message_init_play(msg, 1);
+    tup_message_free(msg);
+
+    msg = tup_message_new_from_static(NULL, 0,
+            smp_message_new_from_static(&smsg, sizeof(smsg), values, 8));
+    tup_message_init_play(msg, 1);
+    tup_message_free(msg);
+
+    if (allocator.n_live != n_live) {
+        fprintf(stderr, "foreign messages: %ld blocks released, expected "
+                "none\n", n_live - allocator.n_live);
+        return false;
+    }
+
+    return true;
+}
+
+/* sending and processing make no allocation at steady state */
+static bool test_steady_state(void)
+{
+    TupCallbacks host_cbs = {
+        .new_message_cb = on_host_message,
+        .error_cb = NULL,
+    };
+    TupCallbacks device_cbs = {
+        .new_message_cb = on_device_message,
+        .error_cb = NULL,
+    };
+    TupTransport *transports[2];
+    TupContext *host = NULL;
+    TupContext *device = NULL;
+    TestPeer host_peer = { NULL, 0 };
+    TestPeer device_peer = { NULL, 0 };
+    TupMessage *msg;
+    unsigned long n_allocs;
+    bool success = false;
+    int ret;
+
+    ret = tup_transport_new_loopback(&transports[0], &transports[1], 0);
+    if (ret < 0) {
+        fprintf(stderr, "failed to create loopback transports: %d\n", ret);
+        return false;
+    }
+
+    host = tup_context_new_with_transport(transports[0], &host_cbs,
+            &host_peer);
+    device = tup_context_new_with_transport(transports[1], &device_cbs,
+            &device_peer);
+    msg = tup_message_new();
+    device_peer.reply = tup_message_new();
+    if (host == NULL || device == NULL || msg == NULL
+            || device_peer.reply == NULL) {
+        fprintf(stderr, "failed to create the contexts\n");
+        goto done;
+    }
+
+    tup_context_enable_stats(host, true);
+
+    ret = run(host, device, msg, TEST_WARMUP_COUNT);
+    if (ret < 0) {
+        fprintf(stderr, "warmup failed: %d\n", ret);
+        goto done;
+    }
+
+    n_allocs = allocator.n_allocs;
+
+    ret = run(host, device, msg, TEST_COUNT);
+    if (ret < 0) {
+        fprintf(stderr, "run failed: %d\n", ret);
+        goto done;
+    }
+
+    if (allocator.n_allocs != n_allocs) {
+        fprintf(stderr, "steady state: %lu allocations for %d commands\n",
+                allocator.n_allocs - n_allocs, TEST_COUNT);
+        goto done;
+    }
+
+    if (device_peer.n_received != TEST_WARMUP_COUNT + TEST_COUNT
+            || host_peer.n_received != TEST_WARMUP_COUNT + TEST_COUNT) {
+        fprintf(stderr, "steady state: %lu commands and %lu acks received, "
+                "expected %d\n", device_peer.n_received,
+                host_peer.n_received, TEST_WARMUP_COUNT + TEST_COUNT);
+        goto done;
+    }
+
+    success = true;
+
+done:
+    if (device_peer.reply != NULL)
+        tup_message_free(device_peer.reply);
+
+    if (msg != NULL)
+        tup_message_free(msg);
+
+    if (device != NULL)
+        tup_context_free(device);
+    else
+        tup_transport_free(transports[1]);
+
+    if (host != NULL)
+        tup_context_free(host);
+    else
+        tup_transport_free(transports[0]);
+
+    if (success && allocator.n_live != 0) {
+        fprintf(stderr, "steady state: %ld blocks leaked\n",
+                allocator.n_live);
+        success = false;
+    }
+
+    return success;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret;
+
+    ret = tup_set_allocator(test_malloc, test_realloc, test_free, &allocator);
+    if (ret < 0) {
+        fprintf(stderr, "failed to set the allocator: %d\n", ret);
+        return 1;
+    }
+
+    if (!test_storage() || !test_foreign_messages() || !test_steady_state())
+        return 1;
+
+    printf("no allocation in %d commands\n", TEST_COUNT);
+    return 0;
+}
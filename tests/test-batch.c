@@ -0,0 +1,293 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <libtup.h>
+#include <libtupsim.h>
+
+#define TEST_N_MESSAGES 8
+
+/* time given to the I/O thread to write queued frames */
+#define TEST_WAIT_MS 500
+
+/* more parameters than a frame of the I/O thread ring can hold */
+#define TEST_N_BIG_PARAMETERS 40
+
+typedef struct
+{
+    TupTransport *transport;
+    TupContext *host;
+    TupSimDevice *dev;
+    unsigned long n_received;
+} TestSetup;
+
+static void on_host_message(TupContext *ctx, TupMessage *msg, void *userdata)
+{
+    TestSetup *setup = userdata;
+
+    setup->n_received++;
+}
+
+/* the host is a plain libsmp context opened on the pty of the device */
+static bool setup_init(TestSetup *setup)
+{
+    TupCallbacks cbs = {
+        .new_message_cb = on_host_message,
+        .error_cb = NULL,
+    };
+    int ret;
+
+    setup->host = NULL;
+    setup->dev = NULL;
+    setup->n_received = 0;
+
+    setup->transport = tup_transport_new_pty();
+    if (setup->transport == NULL) {
+        fprintf(stderr, "failed to create a pty\n");
+        return false;
+    }
+
+    setup->dev = tup_sim_device_new(setup->transport, NULL);
+    if (setup->dev == NULL || tup_sim_device_open(setup->dev, NULL) < 0) {
+        fprintf(stderr, "failed to create the device\n");
+        return false;
+    }
+
+    setup->host = tup_context_new(&cbs, setup);
+    if (setup->host == NULL) {
+        fprintf(stderr, "failed to create the host\n");
+        return false;
+    }
+
+    ret = tup_context_open(setup->host,
+            tup_transport_get_pty_name(setup->transport));
+    if (ret < 0) {
+        fprintf(stderr, "failed to open the pty: %d\n", ret);
+        return false;
+    }
+
+    return true;
+}
+
+static void setup_clear(TestSetup *setup)
+{
+    if (setup->host != NULL)
+        tup_context_free(setup->host);
+
+    if (setup->dev != NULL)
+        tup_sim_device_free(setup->dev);
+    else if (setup->transport != NULL)
+        tup_transport_free(setup->transport);
+}
+
+static uint64_t get_n_commands(TestSetup *setup)
+{
+    TupSimDeviceStats stats;
+
+    tup_sim_device_get_stats(setup->dev, &stats);
+    return stats.n_commands;
+}
+
+/* let the device answer, the host only reads when not threaded */
+static int pump(TestSetup *setup, bool threaded)
+{
+    TupContext *device = tup_sim_device_get_context(setup->dev);
+    int ret;
+    int i;
+
+    for (i = 0; i < TEST_WAIT_MS; i++) {
+        ret = tup_context_process_fd(device);
+        if (ret < 0)
+            return ret;
+
+        if (!threaded) {
+            ret = tup_context_process_fd(setup->host);
+            if (ret < 0)
+                return ret;
+        }
+
+        usleep(1000);
+    }
+
+    return 0;
+}
+
+static void init_messages(TupMessage **msgs, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        tup_message_clear(msgs[i]);
+        tup_message_init_set_input_value_simple(msgs[i], 1, i, i);
+    }
+}
+
+/* without a transport, batches and combined frames go through libsmp */
+static bool test_smp_context(TupMessage **msgs)
+{
+    TestSetup setup;
+    bool success = false;
+    int ret;
+
+    if (!setup_init(&setup))
+        goto done;
+
+    init_messages(msgs, TEST_N_MESSAGES);
+
+    ret = tup_context_send_batch(setup.host, msgs, TEST_N_MESSAGES);
+    if (ret < 0) {
+        fprintf(stderr, "smp context: failed to send the batch: %d\n", ret);
+        goto done;
+    }
+
+    ret = tup_context_set_write_combining(setup.host, 4096);
+    if (ret == 0)
+        ret = tup_context_send(setup.host, msgs[0]);
+
+    if (ret == 0)
+        ret = tup_context_flush(setup.host);
+
+    if (ret < 0) {
+        fprintf(stderr, "smp context: failed to combine frames: %d\n", ret);
+        goto done;
+    }
+
+    ret = pump(&setup, false);
+    if (ret < 0) {
+        fprintf(stderr, "smp context: pump failed: %d\n", ret);
+        goto done;
+    }
+
+    if (get_n_commands(&setup) != TEST_N_MESSAGES + 1
+            || setup.n_received != TEST_N_MESSAGES + 1) {
+        fprintf(stderr, "smp context: %lu commands and %lu responses, "
+                "expected %d\n", (unsigned long) get_n_commands(&setup),
+                setup.n_received, TEST_N_MESSAGES + 1);
+        goto done;
+    }
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    return success;
+}
+
+/* a batch queued to the I/O thread is written whole or not at all */
+static bool test_threaded(TupMessage **msgs)
+{
+    TupParameterArgs params[TEST_N_BIG_PARAMETERS];
+    TestSetup setup;
+    bool success = false;
+    int ret;
+    int i;
+
+    if (!setup_init(&setup))
+        goto done;
+
+    ret = tup_context_start_io_thread(setup.host, 4);
+    if (ret < 0) {
+        fprintf(stderr, "threaded: failed to start the I/O thread: %d\n",
+                ret);
+        goto done;
+    }
+
+    init_messages(msgs, TEST_N_MESSAGES);
+
+    /* bigger than the ring */
+    ret = tup_context_send_batch(setup.host, msgs, TEST_N_MESSAGES);
+    if (ret != SMP_ERROR_TOO_BIG) {
+        fprintf(stderr, "threaded: sending a batch bigger than the ring "
+                "returned %d\n", ret);
+        goto done;
+    }
+
+    /* a frame too big for the ring */
+    for (i = 0; i < TEST_N_BIG_PARAMETERS; i++) {
+        params[i].parameter_id = i;
+        params[i].parameter_value = 0x7f7f7f7f;
+    }
+
+    tup_message_clear(msgs[1]);
+    ret = tup_message_init_set_parameter_array(msgs[1], 1, params,
+            TEST_N_BIG_PARAMETERS);
+    if (ret < 0) {
+        fprintf(stderr, "threaded: failed to init the big message: %d\n",
+                ret);
+        goto done;
+    }
+
+    ret = tup_context_send_batch(setup.host, msgs, 3);
+    if (ret != SMP_ERROR_TOO_BIG) {
+        fprintf(stderr, "threaded: sending a frame bigger than a cell "
+                "returned %d\n", ret);
+        goto done;
+    }
+
+    init_messages(msgs, 3);
+
+    /* the cells of the rejected batch may not be drained yet */
+    for (i = 0; i < TEST_WAIT_MS; i++) {
+        ret = tup_context_send_batch(setup.host, msgs, 3);
+        if (ret != SMP_ERROR_WOULD_BLOCK)
+            break;
+
+        usleep(1000);
+    }
+
+    if (ret < 0) {
+        fprintf(stderr, "threaded: failed to send the batch: %d\n", ret);
+        goto done;
+    }
+
+    ret = pump(&setup, true);
+    if (ret < 0) {
+        fprintf(stderr, "threaded: pump failed: %d\n", ret);
+        goto done;
+    }
+
+    if (get_n_commands(&setup) != 3) {
+        fprintf(stderr, "threaded: %lu commands received, expected 3\n",
+                (unsigned long) get_n_commands(&setup));
+        goto done;
+    }
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    return success;
+}
+
+int main(int argc, char *argv[])
+{
+    TupMessage *msgs[TEST_N_MESSAGES];
+    bool success = false;
+    int i;
+
+    for (i = 0; i < TEST_N_MESSAGES; i++)
+        msgs[i] = tup_message_new();
+
+    for (i = 0; i < TEST_N_MESSAGES; i++) {
+        if (msgs[i] == NULL) {
+            fprintf(stderr, "failed to create the messages\n");
+            goto done;
+        }
+    }
+
+    if (!test_smp_context(msgs) || !test_threaded(msgs))
+        goto done;
+
+    printf("batches are sent whole\n");
+    success = true;
+
+done:
+    for (i = 0; i < TEST_N_MESSAGES; i++)
+        tup_message_free(msgs[i]);
+
+    return success ? 0 : 1;
+}
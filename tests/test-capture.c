@@ -0,0 +1,507 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <libtup.h>
+#include <libtupsim.h>
+
+#define N_ELEMENTS(arr) (sizeof((arr)) / sizeof((arr)[0]))
+
+#define TEST_N_PUMPS 16
+
+/* enough for the unescaped test frames */
+#define TEST_FRAME_SIZE 64
+
+typedef struct
+{
+    TupTransport *transports[2];
+    TupContext *host;
+    TupSimDevice *dev;
+    TupMessage *msg;
+
+    unsigned long n_received;
+    TupMessageType last_received;
+} TestSetup;
+
+typedef struct
+{
+    TupCaptureDirection direction;
+    TupMessageType type;
+} TestFrame;
+
+/* what the capture of run_session() holds */
+static const TestFrame test_frames[] = {
+    { TUP_CAPTURE_TX, TUP_MESSAGE_CMD_LOAD },
+    { TUP_CAPTURE_TX, TUP_MESSAGE_CMD_SET_INPUT_VALUE },
+    { TUP_CAPTURE_TX, TUP_MESSAGE_CMD_GET_VERSION },
+    { TUP_CAPTURE_RX, TUP_MESSAGE_ACK },
+    { TUP_CAPTURE_RX, TUP_MESSAGE_ACK },
+    { TUP_CAPTURE_RX, TUP_MESSAGE_RESP_VERSION },
+};
+
+static void on_host_message(TupContext *ctx, TupMessage *msg, void *userdata)
+{
+    TestSetup *setup = userdata;
+
+    setup->n_received++;
+    setup->last_received = tup_message_get_type(msg);
+}
+
+static bool setup_init(TestSetup *setup)
+{
+    TupCallbacks cbs = {
+        .new_message_cb = on_host_message,
+        .error_cb = NULL,
+    };
+    int ret;
+
+    memset(setup, 0, sizeof(*setup));
+
+    setup->msg = tup_message_new();
+    if (setup->msg == NULL) {
+        fprintf(stderr, "failed to create the message\n");
+        return false;
+    }
+
+    ret = tup_transport_new_loopback(&setup->transports[0],
+            &setup->transports[1], 0);
+    if (ret < 0) {
+        fprintf(stderr, "failed to create loopback transports: %d\n", ret);
+        return false;
+    }
+
+    setup->host = tup_context_new_with_transport(setup->transports[0], &cbs,
+            setup);
+    setup->dev = tup_sim_device_new(setup->transports[1], NULL);
+    if (setup->host == NULL || setup->dev == NULL
+            || tup_sim_device_open(setup->dev, NULL) < 0) {
+        fprintf(stderr, "failed to create the host and the device\n");
+        return false;
+    }
+
+    return true;
+}
+
+static void setup_clear(TestSetup *setup)
+{
+    if (setup->dev != NULL)
+        tup_sim_device_free(setup->dev);
+    else if (setup->transports[1] != NULL)
+        tup_transport_free(setup->transports[1]);
+
+    if (setup->host != NULL)
+        tup_context_free(setup->host);
+    else if (setup->transports[0] != NULL)
+        tup_transport_free(setup->transports[0]);
+
+    if (setup->msg != NULL)
+        tup_message_free(setup->msg);
+}
+
+static int pump(TestSetup *setup)
+{
+    TupContext *device = tup_sim_device_get_context(setup->dev);
+    int ret;
+    int i;
+
+    for (i = 0; i < TEST_N_PUMPS; i++) {
+        ret = tup_context_process_fd(device);
+        if (ret == 0)
+            ret = tup_context_process_fd(setup->host);
+
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+static int get_device_input(TestSetup *setup, int32_t *value)
+{
+    TupInputValueArgs args[1];
+    TupMessage *response;
+    uint8_t slot_id;
+    int ret;
+
+    response = tup_message_new();
+    if (response == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    tup_message_clear(setup->msg);
+    tup_message_init_get_input_value_simple(setup->msg, 1, 0);
+
+    ret = tup_sim_device_handle_message(setup->dev, setup->msg, response);
+    if (ret == 0)
+        ret = tup_message_parse_resp_input(response, &slot_id, args, 1);
+
+    if (ret == 1)
+        *value = args[0].input_value;
+
+    tup_message_free(response);
+    return (ret == 1) ? 0 : SMP_ERROR_BAD_MESSAGE;
+}
+
+static uint64_t get_n_commands(TestSetup *setup)
+{
+    TupSimDeviceStats stats;
+
+    tup_sim_device_get_stats(setup->dev, &stats);
+    return stats.n_commands;
+}
+
+/* capture a short session, all commands being sent before the device
+ * answers */
+static bool run_session(const char *path)
+{
+    TestSetup setup;
+    bool success = false;
+    int ret;
+
+    if (!setup_init(&setup))
+        goto done;
+
+    ret = tup_context_start_capture(setup.host, path);
+    if (ret == 0) {
+        tup_message_init_load(setup.msg, 1, 0);
+        ret = tup_context_send(setup.host, setup.msg);
+    }
+
+    if (ret == 0) {
+        tup_message_clear(setup.msg);
+        tup_message_init_set_input_value_simple(setup.msg, 1, 0, 5);
+        ret = tup_context_send(setup.host, setup.msg);
+    }
+
+    if (ret == 0) {
+        tup_message_clear(setup.msg);
+        tup_message_init_get_version(setup.msg);
+        ret = tup_context_send(setup.host, setup.msg);
+    }
+
+    if (ret == 0)
+        ret = pump(&setup);
+
+    if (ret == 0)
+        ret = tup_context_stop_capture(setup.host);
+
+    if (ret < 0) {
+        fprintf(stderr, "session: failed to capture: %d\n", ret);
+        goto done;
+    }
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    return success;
+}
+
+/* frames are captured as on the wire, in order, with their direction and
+ * time */
+static bool test_read(const char *path)
+{
+    uint8_t buf[TEST_FRAME_SIZE];
+    TupCaptureFrame frame;
+    TupCaptureFile *file;
+    TupMessage *msg;
+    bool success = false;
+    uint64_t last_ns = 0;
+    uint64_t start_s;
+    size_t n_frames = 0;
+    int ret;
+
+    msg = tup_message_new();
+    if (msg == NULL)
+        return false;
+
+    file = tup_capture_file_open(path);
+    if (file == NULL) {
+        fprintf(stderr, "read: failed to open the capture\n");
+        goto done;
+    }
+
+    start_s = tup_capture_file_get_start_time(file) / 1000000000;
+    if (start_s + 60 < (uint64_t) time(NULL)
+            || start_s > (uint64_t) time(NULL)) {
+        fprintf(stderr, "read: capture started at %lu\n",
+                (unsigned long) start_s);
+        goto done;
+    }
+
+    while ((ret = tup_capture_file_next(file, &frame)) > 0) {
+        const TestFrame *expected;
+
+        if (n_frames == N_ELEMENTS(test_frames)) {
+            fprintf(stderr, "read: too many frames\n");
+            goto done;
+        }
+
+        expected = &test_frames[n_frames];
+
+        tup_message_clear(msg);
+        ret = tup_capture_frame_decode(&frame, msg, buf, sizeof(buf));
+        if (ret < 0 || frame.direction != expected->direction
+                || tup_message_get_type(msg) != expected->type
+                || frame.time_ns < last_ns) {
+            fprintf(stderr, "read: frame %zu is %d in direction %d at %lu "
+                    "ns: %d\n", n_frames, tup_message_get_type(msg),
+                    frame.direction, (unsigned long) frame.time_ns, ret);
+            goto done;
+        }
+
+        last_ns = frame.time_ns;
+        n_frames++;
+    }
+
+    if (ret < 0 || n_frames != N_ELEMENTS(test_frames)) {
+        fprintf(stderr, "read: %zu frames read, expected %zu: %d\n", n_frames,
+                N_ELEMENTS(test_frames), ret);
+        goto done;
+    }
+
+    /* rewinding starts over */
+    tup_capture_file_rewind(file);
+    if (tup_capture_file_next(file, &frame) != 1
+            || frame.direction != TUP_CAPTURE_TX) {
+        fprintf(stderr, "read: rewind doesn't start over\n");
+        goto done;
+    }
+
+    success = true;
+
+done:
+    if (file != NULL)
+        tup_capture_file_close(file);
+
+    tup_message_free(msg);
+    return success;
+}
+
+/* sent frames can be sent again or fed to a simulated device, received ones
+ * to a host */
+static bool test_replay(const char *path)
+{
+    TupCaptureFile *file;
+    TestSetup setup;
+    bool success = false;
+    int32_t value = 0;
+    int ret;
+
+    file = tup_capture_file_open(path);
+    if (file == NULL) {
+        fprintf(stderr, "replay: failed to open the capture\n");
+        return false;
+    }
+
+    if (!setup_init(&setup))
+        goto done;
+
+    ret = tup_capture_file_replay(file, setup.host, TUP_REPLAY_SEND_TX, 0);
+    if (ret == 3)
+        ret = pump(&setup);
+
+    if (ret < 0 || get_n_commands(&setup) != 3 || setup.n_received != 3
+            || get_device_input(&setup, &value) < 0 || value != 5) {
+        fprintf(stderr, "replay: sending gave %d, device got %lu commands, "
+                "input %d, host got %lu responses\n", ret,
+                (unsigned long) get_n_commands(&setup), value,
+                setup.n_received);
+        goto done;
+    }
+
+    setup_clear(&setup);
+    if (!setup_init(&setup))
+        goto done;
+
+    value = 0;
+    ret = tup_capture_file_replay(file,
+            tup_sim_device_get_context(setup.dev), TUP_REPLAY_INJECT_TX, 0);
+    if (ret != 3 || get_n_commands(&setup) != 3
+            || get_device_input(&setup, &value) < 0 || value != 5) {
+        fprintf(stderr, "replay: injecting gave %d, device got %lu commands "
+                "and input %d\n", ret, (unsigned long) get_n_commands(&setup),
+                value);
+        goto done;
+    }
+
+    ret = tup_capture_file_replay(file, setup.host, TUP_REPLAY_INJECT_RX, 0);
+    if (ret != 3 || setup.n_received != 3
+            || setup.last_received != TUP_MESSAGE_RESP_VERSION) {
+        fprintf(stderr, "replay: injecting responses gave %d, host got %lu "
+                "messages\n", ret, setup.n_received);
+        goto done;
+    }
+
+    ret = tup_capture_file_replay(file, setup.host, TUP_REPLAY_SEND_TX, -1.0);
+    if (ret != SMP_ERROR_INVALID_PARAM) {
+        fprintf(stderr, "replay: negative speed gave %d\n", ret);
+        goto done;
+    }
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    tup_capture_file_close(file);
+    return success;
+}
+
+/* a capture cut in its last record is valid up to the record before */
+static bool test_truncated(const char *path)
+{
+    TupCaptureFrame frame;
+    TupCaptureFile *file;
+    FILE *stream;
+    size_t n_frames = 0;
+    long size;
+
+    stream = fopen(path, "rb");
+    if (stream == NULL || fseek(stream, 0, SEEK_END) != 0) {
+        if (stream != NULL)
+            fclose(stream);
+
+        fprintf(stderr, "truncated: failed to read the capture size\n");
+        return false;
+    }
+
+    size = ftell(stream);
+    fclose(stream);
+
+    if (size <= 4 || truncate(path, size - 4) < 0) {
+        fprintf(stderr, "truncated: failed to truncate the capture\n");
+        return false;
+    }
+
+    file = tup_capture_file_open(path);
+    if (file == NULL) {
+        fprintf(stderr, "truncated: failed to open the capture\n");
+        return false;
+    }
+
+    while (tup_capture_file_next(file, &frame) > 0)
+        n_frames++;
+
+    tup_capture_file_close(file);
+
+    if (n_frames != N_ELEMENTS(test_frames) - 1) {
+        fprintf(stderr, "truncated: %zu frames read, expected %zu\n",
+                n_frames, N_ELEMENTS(test_frames) - 1);
+        return false;
+    }
+
+    /* not a capture anymore */
+    if (truncate(path, 4) < 0 || tup_capture_file_open(path) != NULL) {
+        fprintf(stderr, "truncated: header cut short is opened\n");
+        return false;
+    }
+
+    return true;
+}
+
+/* captured frames decode in place, malformed ones are refused */
+static bool test_decode(void)
+{
+    uint8_t data[TEST_FRAME_SIZE];
+    uint8_t buf[TEST_FRAME_SIZE];
+    TupCaptureFrame frame;
+    const char *version;
+    TupMessage *msg;
+    bool success = false;
+    int size;
+    int ret;
+
+    msg = tup_message_new();
+    if (msg == NULL)
+        return false;
+
+    size = tup_encode_resp_version(data, sizeof(data), "1.2.3");
+    if (size < 0) {
+        fprintf(stderr, "decode: failed to encode: %d\n", size);
+        goto done;
+    }
+
+    frame.time_ns = 0;
+    frame.direction = TUP_CAPTURE_RX;
+    frame.data = data;
+    frame.size = size;
+
+    ret = tup_capture_frame_decode(&frame, msg, buf, sizeof(buf));
+    if (ret == 0)
+        ret = tup_message_parse_resp_version(msg, &version);
+
+    if (ret < 0 || strcmp(version, "1.2.3") != 0
+            || (const uint8_t *) version < buf
+            || (const uint8_t *) version >= buf + sizeof(buf)) {
+        fprintf(stderr, "decode: version isn't decoded in place: %d\n", ret);
+        goto done;
+    }
+
+    ret = tup_capture_frame_decode(&frame, msg, buf, size / 2);
+    if (ret != SMP_ERROR_OVERFLOW) {
+        fprintf(stderr, "decode: short buffer gave %d\n", ret);
+        goto done;
+    }
+
+    /* a payload byte changed, the checksum doesn't match */
+    data[size - 3] ^= 0x01;
+    ret = tup_capture_frame_decode(&frame, msg, buf, sizeof(buf));
+    data[size - 3] ^= 0x01;
+    if (ret != SMP_ERROR_BAD_MESSAGE) {
+        fprintf(stderr, "decode: bad checksum gave %d\n", ret);
+        goto done;
+    }
+
+    /* an escape byte escaping the end byte */
+    data[size - 2] = 0x1b;
+    ret = tup_capture_frame_decode(&frame, msg, buf, sizeof(buf));
+    if (ret != SMP_ERROR_BAD_MESSAGE) {
+        fprintf(stderr, "decode: dangling escape gave %d\n", ret);
+        goto done;
+    }
+
+    /* no end byte */
+    frame.size = size - 1;
+    ret = tup_capture_frame_decode(&frame, msg, buf, sizeof(buf));
+    if (ret != SMP_ERROR_BAD_MESSAGE) {
+        fprintf(stderr, "decode: cut frame gave %d\n", ret);
+        goto done;
+    }
+
+    success = true;
+
+done:
+    tup_message_free(msg);
+    return success;
+}
+
+int main(int argc, char *argv[])
+{
+    char path[] = "/tmp/test-capture-XXXXXX";
+    bool success;
+    int fd;
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "failed to create the capture file\n");
+        return 1;
+    }
+
+    close(fd);
+
+    success = run_session(path) && test_read(path) && test_replay(path)
+        && test_truncated(path) && test_decode();
+
+    unlink(path);
+    if (!success)
+        return 1;
+
+    printf("captures are read and replayed\n");
+    return 0;
+}
@@ -0,0 +1,313 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <libtup.h>
+#include <libtupsim.h>
+
+#define TEST_N_UPDATES 50
+
+/* time given to the data to go through the pty */
+#define TEST_WAIT_MS 100
+
+typedef struct
+{
+    TupTransport *transports[2];
+    TupContext *host;
+    TupSimDevice *dev;
+    TupMessage *msg;
+
+    unsigned long n_received;
+    TupMessageType last_received;
+} TestSetup;
+
+static void on_host_message(TupContext *ctx, TupMessage *msg, void *userdata)
+{
+    TestSetup *setup = userdata;
+
+    setup->n_received++;
+    setup->last_received = tup_message_get_type(msg);
+}
+
+/* the host opens the pty of the device like a serial device, so that the
+ * baudrate can be set */
+static bool setup_init(TestSetup *setup)
+{
+    TupCallbacks cbs = {
+        .new_message_cb = on_host_message,
+        .error_cb = NULL,
+    };
+    int ret;
+
+    memset(setup, 0, sizeof(*setup));
+
+    setup->msg = tup_message_new();
+    if (setup->msg == NULL) {
+        fprintf(stderr, "failed to create the message\n");
+        return false;
+    }
+
+    setup->transports[1] = tup_transport_new_pty();
+    setup->transports[0] = tup_transport_new_serial();
+    if (setup->transports[0] == NULL || setup->transports[1] == NULL) {
+        fprintf(stderr, "failed to create the transports\n");
+        return false;
+    }
+
+    setup->dev = tup_sim_device_new(setup->transports[1], NULL);
+    if (setup->dev == NULL || tup_sim_device_open(setup->dev, NULL) < 0) {
+        fprintf(stderr, "failed to create the device\n");
+        return false;
+    }
+
+    setup->host = tup_context_new_with_transport(setup->transports[0], &cbs,
+            setup);
+    if (setup->host == NULL) {
+        fprintf(stderr, "failed to create the host\n");
+        return false;
+    }
+
+    ret = tup_context_open(setup->host,
+            tup_transport_get_pty_name(setup->transports[1]));
+    if (ret < 0) {
+        fprintf(stderr, "failed to open the pty: %d\n", ret);
+        return false;
+    }
+
+    ret = tup_context_enable_coalescing(setup->host, true);
+    if (ret < 0) {
+        fprintf(stderr, "failed to enable coalescing: %d\n", ret);
+        return false;
+    }
+
+    /* a frame keeps the line busy for about 100 ms */
+    ret = tup_context_set_config(setup->host, SMP_SERIAL_BAUDRATE_1200,
+            SMP_SERIAL_PARITY_NONE, 0);
+    if (ret < 0) {
+        fprintf(stderr, "failed to set the config: %d\n", ret);
+        return false;
+    }
+
+    return true;
+}
+
+static void setup_clear(TestSetup *setup)
+{
+    if (setup->dev != NULL)
+        tup_sim_device_free(setup->dev);
+    else if (setup->transports[1] != NULL)
+        tup_transport_free(setup->transports[1]);
+
+    if (setup->host != NULL)
+        tup_context_free(setup->host);
+    else if (setup->transports[0] != NULL)
+        tup_transport_free(setup->transports[0]);
+
+    if (setup->msg != NULL)
+        tup_message_free(setup->msg);
+}
+
+/* let the device answer what has been written so far, the host only reads
+ * as reading may write pending updates */
+static int pump(TestSetup *setup, bool read_host)
+{
+    TupContext *device = tup_sim_device_get_context(setup->dev);
+    int ret;
+    int i;
+
+    for (i = 0; i < TEST_WAIT_MS; i++) {
+        ret = tup_context_process_fd(device);
+        if (ret == 0 && read_host)
+            ret = tup_context_process_fd(setup->host);
+
+        if (ret < 0)
+            return ret;
+
+        usleep(1000);
+    }
+
+    return 0;
+}
+
+static int send_input(TestSetup *setup, uint8_t input_id, int32_t value)
+{
+    tup_message_clear(setup->msg);
+    tup_message_init_set_input_value_simple(setup->msg, 1, input_id, value);
+    return tup_context_send(setup->host, setup->msg);
+}
+
+static int get_device_input(TestSetup *setup, uint8_t input_id,
+        int32_t *value)
+{
+    TupInputValueArgs args[1];
+    TupMessage *response;
+    uint8_t slot_id;
+    int ret;
+
+    response = tup_message_new();
+    if (response == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    tup_message_clear(setup->msg);
+    tup_message_init_get_input_value_simple(setup->msg, 1, input_id);
+
+    ret = tup_sim_device_handle_message(setup->dev, setup->msg, response);
+    if (ret == 0)
+        ret = tup_message_parse_resp_input(response, &slot_id, args, 1);
+
+    if (ret == 1)
+        *value = args[0].input_value;
+
+    tup_message_free(response);
+    return (ret == 1) ? 0 : SMP_ERROR_BAD_MESSAGE;
+}
+
+static uint64_t get_n_commands(TestSetup *setup)
+{
+    TupSimDeviceStats stats;
+
+    tup_sim_device_get_stats(setup->dev, &stats);
+    return stats.n_commands;
+}
+
+/* updates of a busy line replace the pending value of their key, and other
+ * commands write the pending updates first */
+static bool test_last_writer_wins(void)
+{
+    TestSetup setup;
+    int32_t values[2] = { 0, 0 };
+    bool success = false;
+    uint64_t n_commands;
+    int ret;
+    int i;
+
+    if (!setup_init(&setup))
+        goto done;
+
+    tup_message_init_load(setup.msg, 1, 0);
+    ret = tup_context_send(setup.host, setup.msg);
+
+    /* the first update is written, the others wait for the line */
+    for (i = 1; i <= TEST_N_UPDATES && ret == 0; i++)
+        ret = send_input(&setup, 0, i);
+
+    if (ret == 0)
+        ret = send_input(&setup, 1, -7);
+
+    if (ret == 0) {
+        tup_message_clear(setup.msg);
+        tup_message_init_get_version(setup.msg);
+        ret = tup_context_send(setup.host, setup.msg);
+    }
+
+    if (ret == 0)
+        ret = pump(&setup, true);
+
+    if (ret < 0) {
+        fprintf(stderr, "coalesce: failed to send: %d\n", ret);
+        goto done;
+    }
+
+    /* load, first update, last updates of both inputs, get version, unless
+     * the machine stalled long enough for the line to become idle */
+    n_commands = get_n_commands(&setup);
+    if (n_commands < 5 || n_commands > TEST_N_UPDATES / 2) {
+        fprintf(stderr, "coalesce: device got %lu commands\n",
+                (unsigned long) n_commands);
+        goto done;
+    }
+
+    if (setup.n_received != n_commands
+            || setup.last_received != TUP_MESSAGE_RESP_VERSION) {
+        fprintf(stderr, "coalesce: %lu responses, last %d, expected %lu, "
+                "last %d\n", setup.n_received, setup.last_received,
+                (unsigned long) n_commands, TUP_MESSAGE_RESP_VERSION);
+        goto done;
+    }
+
+    if (get_device_input(&setup, 0, &values[0]) < 0
+            || get_device_input(&setup, 1, &values[1]) < 0
+            || values[0] != TEST_N_UPDATES || values[1] != -7) {
+        fprintf(stderr, "coalesce: device inputs are %d and %d, expected %d "
+                "and -7\n", values[0], values[1], TEST_N_UPDATES);
+        goto done;
+    }
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    return success;
+}
+
+/* disabling coalescing writes the pending updates */
+static bool test_disable(void)
+{
+    TestSetup setup;
+    int32_t value = 0;
+    bool success = false;
+    int ret;
+
+    if (!setup_init(&setup))
+        goto done;
+
+    tup_message_init_load(setup.msg, 1, 0);
+    ret = tup_context_send(setup.host, setup.msg);
+
+    if (ret == 0)
+        ret = send_input(&setup, 0, 1);
+
+    if (ret == 0)
+        ret = send_input(&setup, 0, 2);
+
+    if (ret == 0)
+        ret = pump(&setup, false);
+
+    if (ret < 0) {
+        fprintf(stderr, "disable: failed to send: %d\n", ret);
+        goto done;
+    }
+
+    if (get_n_commands(&setup) != 2) {
+        fprintf(stderr, "disable: device got %lu commands before disabling, "
+                "expected 2\n", (unsigned long) get_n_commands(&setup));
+        goto done;
+    }
+
+    ret = tup_context_enable_coalescing(setup.host, false);
+    if (ret == 0)
+        ret = pump(&setup, false);
+
+    if (ret < 0) {
+        fprintf(stderr, "disable: failed to disable: %d\n", ret);
+        goto done;
+    }
+
+    if (get_n_commands(&setup) != 3 || get_device_input(&setup, 0, &value) < 0
+            || value != 2) {
+        fprintf(stderr, "disable: device got %lu commands and input %d, "
+                "expected 3 and 2\n", (unsigned long) get_n_commands(&setup),
+                value);
+        goto done;
+    }
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    return success;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!test_last_writer_wins() || !test_disable())
+        return 1;
+
+    printf("coalescing keeps the last value of each key\n");
+    return 0;
+}
@@ -0,0 +1,455 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libtup.h>
+
+#define N_ELEMENTS(arr) (sizeof((arr)) / sizeof((arr)[0]))
+
+#define TEST_N_PUMPS 4
+#define TEST_MAX_ARGS 16
+
+static const TupMessageType test_types[] = {
+    TUP_MESSAGE_ACK,
+    TUP_MESSAGE_ERROR,
+    TUP_MESSAGE_CMD_LOAD,
+    TUP_MESSAGE_CMD_PLAY,
+    TUP_MESSAGE_CMD_STOP,
+    TUP_MESSAGE_CMD_GET_VERSION,
+    TUP_MESSAGE_CMD_GET_PARAMETER,
+    TUP_MESSAGE_CMD_SET_PARAMETER,
+    TUP_MESSAGE_CMD_BIND_EFFECT,
+    TUP_MESSAGE_CMD_GET_SENSOR_VALUE,
+    TUP_MESSAGE_CMD_SET_SENSOR_VALUE,
+    TUP_MESSAGE_CMD_GET_BUILDINFO,
+    TUP_MESSAGE_CMD_ACTIVATE_INTERNAL_SENSORS,
+    TUP_MESSAGE_CMD_GET_INPUT_VALUE,
+    TUP_MESSAGE_CMD_SET_INPUT_VALUE,
+    TUP_MESSAGE_CMD_FILTER_GET_ACTIVE,
+    TUP_MESSAGE_CMD_FILTER_SET_ACTIVE,
+    TUP_MESSAGE_CMD_CONFIG_WRITE,
+    TUP_MESSAGE_CMD_CONFIG_BAND_NORM_GET_COEFFS,
+    TUP_MESSAGE_CMD_CONFIG_BAND_NORM_SET_COEFFS,
+    TUP_MESSAGE_RESP_VERSION,
+    TUP_MESSAGE_RESP_PARAMETER,
+    TUP_MESSAGE_RESP_SENSOR,
+    TUP_MESSAGE_RESP_BUILDINFO,
+    TUP_MESSAGE_RESP_INPUT,
+    TUP_MESSAGE_RESP_SET_PARAMETER,
+    TUP_MESSAGE_RESP_FILTER_ACTIVE,
+    TUP_MESSAGE_RESP_BAND_NORM_COEFFS,
+    TUP_MESSAGE_CMD_DEBUG_GET_SYSTEM_STATUS,
+    TUP_MESSAGE_RESP_DEBUG_SYSTEM_STATUS,
+};
+
+typedef struct
+{
+    TupTransport *transports[2];
+    TupContext *sender;
+    TupContext *receiver;
+
+    /* the message sent and the one received decoded then encoded again */
+    TupMessage *expected;
+    TupMessage *received;
+    TupDecoded *decoded;
+    unsigned long n_received;
+    unsigned long n_mismatches;
+} TestSetup;
+
+static uint8_t test_ids[] = { 4, 5, 6 };
+static TupParameterArgs test_params[] = { { 1, 0xdeadbeef }, { 2, 7 } };
+static TupSensorValueArgs test_sensors[] = { { 1, 300 }, { 2, 0xffff } };
+static TupInputValueArgs test_inputs[] = { { 0, -3 }, { 9, 100000 } };
+static float test_a[5] = { 1.0f, -0.5f, 0.25f, 0.0f, 2.0f };
+static float test_b[5] = { 0.5f, 0.0f, -1.0f, 3.0f, 0.125f };
+static TupDebugSystemStatus test_status = { 1000000, 65536, 4096 };
+static TupDebugTaskStatus test_task = { 3, "idle", 0, 1, 999, 128 };
+
+static int build_message(TupMessage *msg, TupMessageType type)
+{
+    switch (type) {
+        case TUP_MESSAGE_ACK:
+            tup_message_init_ack_full(msg, TUP_MESSAGE_CMD_LOAD, 7);
+            return 0;
+        case TUP_MESSAGE_ERROR:
+            tup_message_init_error_full(msg, TUP_MESSAGE_CMD_PLAY, 2, 7);
+            return 0;
+        case TUP_MESSAGE_CMD_LOAD:
+            tup_message_init_load(msg, 1, 0x1234);
+            return 0;
+        case TUP_MESSAGE_CMD_PLAY:
+            tup_message_init_play(msg, 1);
+            return 0;
+        case TUP_MESSAGE_CMD_STOP:
+            tup_message_init_stop(msg, 1);
+            return 0;
+        case TUP_MESSAGE_CMD_GET_VERSION:
+            tup_message_init_get_version(msg);
+            return 0;
+        case TUP_MESSAGE_CMD_GET_PARAMETER:
+            return tup_message_init_get_parameter_array(msg, 1, test_ids,
+                    N_ELEMENTS(test_ids));
+        case TUP_MESSAGE_CMD_SET_PARAMETER:
+            return tup_message_init_set_parameter_array(msg, 1, test_params,
+                    N_ELEMENTS(test_params));
+        case TUP_MESSAGE_CMD_BIND_EFFECT:
+            tup_message_init_bind_effect(msg, 1, TUP_BINDING_FLAG_BOTH);
+            return 0;
+        case TUP_MESSAGE_CMD_GET_SENSOR_VALUE:
+            return tup_message_init_get_sensor_value_array(msg, test_ids,
+                    N_ELEMENTS(test_ids));
+        case TUP_MESSAGE_CMD_SET_SENSOR_VALUE:
+            return tup_message_init_set_sensor_value_array(msg, test_sensors,
+                    N_ELEMENTS(test_sensors));
+        case TUP_MESSAGE_CMD_GET_BUILDINFO:
+            tup_message_init_get_buildinfo(msg);
+            return 0;
+        case TUP_MESSAGE_CMD_ACTIVATE_INTERNAL_SENSORS:
+            tup_message_init_activate_internal_sensors(msg, 1);
+            return 0;
+        case TUP_MESSAGE_CMD_GET_INPUT_VALUE:
+            return tup_message_init_get_input_value_array(msg, 2, test_ids,
+                    N_ELEMENTS(test_ids));
+        case TUP_MESSAGE_CMD_SET_INPUT_VALUE:
+            return tup_message_init_set_input_value_array(msg, 2, test_inputs,
+                    N_ELEMENTS(test_inputs));
+        case TUP_MESSAGE_CMD_FILTER_GET_ACTIVE:
+            return tup_message_init_filter_get_active(msg,
+                    TUP_FILTER_ID_BAND_NORM, 1);
+        case TUP_MESSAGE_CMD_FILTER_SET_ACTIVE:
+            return tup_message_init_filter_set_active(msg,
+                    TUP_FILTER_ID_BAND_NORM, 1, true);
+        case TUP_MESSAGE_CMD_CONFIG_WRITE:
+            tup_message_init_config_write(msg);
+            return 0;
+        case TUP_MESSAGE_CMD_CONFIG_BAND_NORM_GET_COEFFS:
+            return tup_message_init_config_band_norm_get_coeffs(msg, 1);
+        case TUP_MESSAGE_CMD_CONFIG_BAND_NORM_SET_COEFFS:
+            return tup_message_init_config_band_norm_set_coeffs(msg, 1,
+                    test_a, test_b);
+        case TUP_MESSAGE_RESP_VERSION:
+            tup_message_init_resp_version(msg, "1.2.3");
+            return 0;
+        case TUP_MESSAGE_RESP_PARAMETER:
+            return tup_message_init_resp_parameter(msg, 1, test_params,
+                    N_ELEMENTS(test_params));
+        case TUP_MESSAGE_RESP_SENSOR:
+            return tup_message_init_resp_sensor(msg, test_sensors,
+                    N_ELEMENTS(test_sensors));
+        case TUP_MESSAGE_RESP_BUILDINFO:
+            tup_message_init_resp_buildinfo(msg, "test");
+            return 0;
+        case TUP_MESSAGE_RESP_INPUT:
+            return tup_message_init_resp_input(msg, 2, test_inputs,
+                    N_ELEMENTS(test_inputs));
+        case TUP_MESSAGE_RESP_SET_PARAMETER:
+            return tup_message_init_resp_set_parameter(msg, 1, -1,
+                    test_params, N_ELEMENTS(test_params));
+        case TUP_MESSAGE_RESP_FILTER_ACTIVE:
+            return tup_message_init_resp_filter_active(msg,
+                    TUP_FILTER_ID_BAND_NORM, 1, false);
+        case TUP_MESSAGE_RESP_BAND_NORM_COEFFS:
+            return tup_message_init_resp_band_norm_coeffs(msg, 1, test_a,
+                    test_b);
+        case TUP_MESSAGE_CMD_DEBUG_GET_SYSTEM_STATUS:
+            tup_message_init_cmd_debug_get_system_status(msg);
+            return 0;
+        case TUP_MESSAGE_RESP_DEBUG_SYSTEM_STATUS:
+            return tup_message_init_resp_debug_system_status(msg,
+                    &test_status, &test_task, 1);
+        default:
+            return SMP_ERROR_NOT_FOUND;
+    }
+}
+
+static bool values_equal(const SmpValue *a, const SmpValue *b)
+{
+    if (a->type != b->type)
+        return false;
+
+    switch (a->type) {
+        case SMP_TYPE_UINT8:
+            return a->value.u8 == b->value.u8;
+        case SMP_TYPE_UINT16:
+            return a->value.u16 == b->value.u16;
+        case SMP_TYPE_UINT32:
+        case SMP_TYPE_INT32:
+            return a->value.u32 == b->value.u32;
+        case SMP_TYPE_UINT64:
+            return a->value.u64 == b->value.u64;
+        case SMP_TYPE_F32:
+            return memcmp(&a->value.f32, &b->value.f32, sizeof(float)) == 0;
+        case SMP_TYPE_STRING:
+            return strcmp(a->value.cstring, b->value.cstring) == 0;
+        default:
+            return false;
+    }
+}
+
+/* same type and same arguments */
+static bool messages_equal(TupMessage *a, TupMessage *b)
+{
+    SmpValue values_a[TEST_MAX_ARGS];
+    SmpValue values_b[TEST_MAX_ARGS];
+    int n_args;
+    int i;
+
+    if (tup_message_get_type(a) != tup_message_get_type(b))
+        return false;
+
+    n_args = tup_message_parse_values(a, values_a, N_ELEMENTS(values_a));
+    if (n_args < 0 || tup_message_parse_values(b, values_b,
+                N_ELEMENTS(values_b)) != n_args)
+        return false;
+
+    for (i = 0; i < n_args; i++) {
+        if (!values_equal(&values_a[i], &values_b[i]))
+            return false;
+    }
+
+    return true;
+}
+
+/* received messages are decoded and encoded again, while their strings are
+ * still alive */
+static void on_receiver_message(TupContext *ctx, TupMessage *msg,
+        void *userdata)
+{
+    TestSetup *setup = userdata;
+    int ret;
+
+    setup->n_received++;
+
+    tup_message_clear(setup->received);
+
+    ret = tup_message_decode(msg, setup->decoded);
+    if (ret == 0)
+        ret = tup_message_encode(setup->received, setup->decoded);
+
+    if (ret < 0 || setup->decoded->type != tup_message_get_type(msg)
+            || !messages_equal(setup->expected, setup->received))
+        setup->n_mismatches++;
+}
+
+static bool setup_init(TestSetup *setup)
+{
+    TupCallbacks cbs = {
+        .new_message_cb = on_receiver_message,
+        .error_cb = NULL,
+    };
+    int ret;
+
+    memset(setup, 0, sizeof(*setup));
+
+    setup->expected = tup_message_new();
+    setup->received = tup_message_new();
+    setup->decoded = malloc(sizeof(TupDecoded));
+    if (setup->expected == NULL || setup->received == NULL
+            || setup->decoded == NULL) {
+        fprintf(stderr, "failed to create the messages\n");
+        return false;
+    }
+
+    ret = tup_transport_new_loopback(&setup->transports[0],
+            &setup->transports[1], 0);
+    if (ret < 0) {
+        fprintf(stderr, "failed to create loopback transports: %d\n", ret);
+        return false;
+    }
+
+    setup->sender = tup_context_new_with_transport(setup->transports[0], NULL,
+            NULL);
+    setup->receiver = tup_context_new_with_transport(setup->transports[1],
+            &cbs, setup);
+    if (setup->sender == NULL || setup->receiver == NULL) {
+        fprintf(stderr, "failed to create the contexts\n");
+        return false;
+    }
+
+    return true;
+}
+
+static void setup_clear(TestSetup *setup)
+{
+    if (setup->receiver != NULL)
+        tup_context_free(setup->receiver);
+    else if (setup->transports[1] != NULL)
+        tup_transport_free(setup->transports[1]);
+
+    if (setup->sender != NULL)
+        tup_context_free(setup->sender);
+    else if (setup->transports[0] != NULL)
+        tup_transport_free(setup->transports[0]);
+
+    if (setup->expected != NULL)
+        tup_message_free(setup->expected);
+
+    if (setup->received != NULL)
+        tup_message_free(setup->received);
+
+    free(setup->decoded);
+}
+
+/* every message type survives decoding and encoding, on both ends of the
+ * link */
+static bool test_round_trip(void)
+{
+    TupMessage *encoded = NULL;
+    TestSetup setup;
+    bool success = false;
+    size_t i;
+    int ret;
+    int j;
+
+    if (!setup_init(&setup))
+        goto done;
+
+    encoded = tup_message_new();
+    if (encoded == NULL)
+        goto done;
+
+    for (i = 0; i < N_ELEMENTS(test_types); i++) {
+        TupMessageType type = test_types[i];
+
+        tup_message_clear(setup.expected);
+        tup_message_clear(encoded);
+
+        ret = build_message(setup.expected, type);
+        if (ret == 0)
+            ret = tup_message_decode(setup.expected, setup.decoded);
+
+        if (ret == 0)
+            ret = tup_message_encode(encoded, setup.decoded);
+
+        if (ret < 0 || setup.decoded->type != type
+                || !messages_equal(setup.expected, encoded)) {
+            fprintf(stderr, "round trip: %d doesn't survive: %d\n", type,
+                    ret);
+            goto done;
+        }
+
+        ret = tup_context_send(setup.sender, encoded);
+        for (j = 0; j < TEST_N_PUMPS && ret == 0; j++)
+            ret = tup_context_process_fd(setup.receiver);
+
+        if (ret < 0 || setup.n_received != i + 1 || setup.n_mismatches != 0) {
+            fprintf(stderr, "round trip: %d received wrong: %d\n", type, ret);
+            goto done;
+        }
+    }
+
+    success = true;
+
+done:
+    if (encoded != NULL)
+        tup_message_free(encoded);
+
+    setup_clear(&setup);
+    return success;
+}
+
+/* decoded fields are the message arguments */
+static bool test_fields(TupMessage *msg, TupDecoded *decoded)
+{
+    int ret;
+
+    tup_message_clear(msg);
+    build_message(msg, TUP_MESSAGE_CMD_SET_PARAMETER);
+    ret = tup_message_decode(msg, decoded);
+    if (ret < 0 || decoded->u.set_parameter.effect_id != 1
+            || decoded->u.set_parameter.n_params != N_ELEMENTS(test_params)
+            || decoded->u.set_parameter.params[0].parameter_value
+                != test_params[0].parameter_value
+            || decoded->u.set_parameter.params[1].parameter_id
+                != test_params[1].parameter_id) {
+        fprintf(stderr, "fields: set parameter is wrong: %d\n", ret);
+        return false;
+    }
+
+    tup_message_clear(msg);
+    build_message(msg, TUP_MESSAGE_CMD_LOAD);
+    ret = tup_message_decode(msg, decoded);
+    if (ret < 0 || decoded->u.load.effect_id != 1
+            || decoded->u.load.bank_id != 0x1234) {
+        fprintf(stderr, "fields: load is wrong: %d\n", ret);
+        return false;
+    }
+
+    tup_message_clear(msg);
+    build_message(msg, TUP_MESSAGE_RESP_BAND_NORM_COEFFS);
+    ret = tup_message_decode(msg, decoded);
+    if (ret < 0 || decoded->u.resp_band_norm_coeffs.actuator_id != 1
+            || memcmp(decoded->u.resp_band_norm_coeffs.a, test_a,
+                sizeof(test_a)) != 0
+            || memcmp(decoded->u.resp_band_norm_coeffs.b, test_b,
+                sizeof(test_b)) != 0) {
+        fprintf(stderr, "fields: band norm coefficients are wrong: %d\n",
+                ret);
+        return false;
+    }
+
+    return true;
+}
+
+/* unknown types and too many repeated arguments are refused */
+static bool test_invalid(TupMessage *msg, TupDecoded *decoded)
+{
+    TupParameterArgs params[TUP_DECODED_MAX_ARGS + 1];
+    size_t i;
+    int ret;
+
+    tup_message_clear(msg);
+    smp_message_init(msg, 3);
+
+    ret = tup_message_decode(msg, decoded);
+    if (ret != SMP_ERROR_BAD_MESSAGE) {
+        fprintf(stderr, "invalid: unknown type gave %d\n", ret);
+        return false;
+    }
+
+    for (i = 0; i < N_ELEMENTS(params); i++) {
+        params[i].parameter_id = i;
+        params[i].parameter_value = i;
+    }
+
+    tup_message_clear(msg);
+    ret = tup_message_init_resp_parameter(msg, 1, params, N_ELEMENTS(params));
+    if (ret == 0)
+        ret = tup_message_decode(msg, decoded);
+
+    if (ret != SMP_ERROR_OVERFLOW) {
+        fprintf(stderr, "invalid: too many parameters gave %d\n", ret);
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    TupDecoded *decoded;
+    TupMessage *msg;
+    bool success = false;
+
+    msg = tup_message_new();
+    decoded = malloc(sizeof(TupDecoded));
+
+    if (msg != NULL && decoded != NULL)
+        success = test_round_trip() && test_fields(msg, decoded)
+            && test_invalid(msg, decoded);
+
+    free(decoded);
+    if (msg != NULL)
+        tup_message_free(msg);
+
+    if (!success)
+        return 1;
+
+    printf("messages survive decoding and encoding\n");
+    return 0;
+}
@@ -0,0 +1,333 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <libtup.h>
+
+#define N_ELEMENTS(arr) (sizeof((arr)) / sizeof((arr)[0]))
+
+/* enough for the escaped frames of the test arguments */
+#define TEST_FRAME_SIZE 256
+
+static const TupMessageType test_types[] = {
+    TUP_MESSAGE_ACK,
+    TUP_MESSAGE_ERROR,
+    TUP_MESSAGE_CMD_LOAD,
+    TUP_MESSAGE_CMD_PLAY,
+    TUP_MESSAGE_CMD_STOP,
+    TUP_MESSAGE_CMD_GET_VERSION,
+    TUP_MESSAGE_CMD_GET_PARAMETER,
+    TUP_MESSAGE_CMD_SET_PARAMETER,
+    TUP_MESSAGE_CMD_BIND_EFFECT,
+    TUP_MESSAGE_CMD_GET_SENSOR_VALUE,
+    TUP_MESSAGE_CMD_SET_SENSOR_VALUE,
+    TUP_MESSAGE_CMD_GET_BUILDINFO,
+    TUP_MESSAGE_CMD_ACTIVATE_INTERNAL_SENSORS,
+    TUP_MESSAGE_CMD_GET_INPUT_VALUE,
+    TUP_MESSAGE_CMD_SET_INPUT_VALUE,
+    TUP_MESSAGE_CMD_FILTER_GET_ACTIVE,
+    TUP_MESSAGE_CMD_FILTER_SET_ACTIVE,
+    TUP_MESSAGE_CMD_CONFIG_WRITE,
+    TUP_MESSAGE_CMD_CONFIG_BAND_NORM_GET_COEFFS,
+    TUP_MESSAGE_CMD_CONFIG_BAND_NORM_SET_COEFFS,
+    TUP_MESSAGE_RESP_VERSION,
+    TUP_MESSAGE_RESP_PARAMETER,
+    TUP_MESSAGE_RESP_SENSOR,
+    TUP_MESSAGE_RESP_BUILDINFO,
+    TUP_MESSAGE_RESP_INPUT,
+    TUP_MESSAGE_RESP_SET_PARAMETER,
+    TUP_MESSAGE_RESP_FILTER_ACTIVE,
+    TUP_MESSAGE_RESP_BAND_NORM_COEFFS,
+    TUP_MESSAGE_CMD_DEBUG_GET_SYSTEM_STATUS,
+    TUP_MESSAGE_RESP_DEBUG_SYSTEM_STATUS,
+};
+
+/* values holding the frame start and escape bytes */
+static uint8_t test_ids[] = { 0x10, 0x1b, 6 };
+static TupParameterArgs test_params[] = { { 1, 0x10ff1b10 }, { 0x1b, 7 } };
+static TupSensorValueArgs test_sensors[] = { { 1, 0x1b10 }, { 2, 0xffff } };
+static TupInputValueArgs test_inputs[] = { { 0, -3 }, { 0x10, 100000 } };
+static float test_a[5] = { 1.0f, -0.5f, 0.25f, 0.0f, 2.0f };
+static float test_b[5] = { 0.5f, 0.0f, -1.0f, 3.0f, 0.125f };
+static TupDebugSystemStatus test_status = { 1000000, 65536, 4096 };
+static TupDebugTaskStatus test_task = { 3, "idle", 0, 1, 999, 128 };
+
+/* initialize msg and encode the same message in buf */
+static int encode_message(TupMessageType type, TupMessage *msg, uint8_t *buf,
+        size_t size)
+{
+    int ret = 0;
+
+    switch (type) {
+        case TUP_MESSAGE_ACK:
+            tup_message_init_ack_full(msg, TUP_MESSAGE_CMD_LOAD, 0x1b);
+            return tup_encode_ack_full(buf, size, TUP_MESSAGE_CMD_LOAD, 0x1b);
+        case TUP_MESSAGE_ERROR:
+            tup_message_init_error_full(msg, TUP_MESSAGE_CMD_PLAY, 2, 0x10);
+            return tup_encode_error_full(buf, size, TUP_MESSAGE_CMD_PLAY, 2,
+                    0x10);
+        case TUP_MESSAGE_CMD_LOAD:
+            tup_message_init_load(msg, 1, 0x101b);
+            return tup_encode_load(buf, size, 1, 0x101b);
+        case TUP_MESSAGE_CMD_PLAY:
+            tup_message_init_play(msg, 1);
+            return tup_encode_play(buf, size, 1);
+        case TUP_MESSAGE_CMD_STOP:
+            tup_message_init_stop(msg, 1);
+            return tup_encode_stop(buf, size, 1);
+        case TUP_MESSAGE_CMD_GET_VERSION:
+            tup_message_init_get_version(msg);
+            return tup_encode_get_version(buf, size);
+        case TUP_MESSAGE_CMD_GET_PARAMETER:
+            ret = tup_message_init_get_parameter_array(msg, 1, test_ids,
+                    N_ELEMENTS(test_ids));
+            return (ret < 0) ? ret : tup_encode_get_parameter(buf, size, 1,
+                    test_ids, N_ELEMENTS(test_ids));
+        case TUP_MESSAGE_CMD_SET_PARAMETER:
+            ret = tup_message_init_set_parameter_array(msg, 1, test_params,
+                    N_ELEMENTS(test_params));
+            return (ret < 0) ? ret : tup_encode_set_parameter(buf, size, 1,
+                    test_params, N_ELEMENTS(test_params));
+        case TUP_MESSAGE_CMD_BIND_EFFECT:
+            tup_message_init_bind_effect(msg, 1, TUP_BINDING_FLAG_BOTH);
+            return tup_encode_bind_effect(buf, size, 1, TUP_BINDING_FLAG_BOTH);
+        case TUP_MESSAGE_CMD_GET_SENSOR_VALUE:
+            ret = tup_message_init_get_sensor_value_array(msg, test_ids,
+                    N_ELEMENTS(test_ids));
+            return (ret < 0) ? ret : tup_encode_get_sensor_value(buf, size,
+                    test_ids, N_ELEMENTS(test_ids));
+        case TUP_MESSAGE_CMD_SET_SENSOR_VALUE:
+            ret = tup_message_init_set_sensor_value_array(msg, test_sensors,
+                    N_ELEMENTS(test_sensors));
+            return (ret < 0) ? ret : tup_encode_set_sensor_value(buf, size,
+                    test_sensors, N_ELEMENTS(test_sensors));
+        case TUP_MESSAGE_CMD_GET_BUILDINFO:
+            tup_message_init_get_buildinfo(msg);
+            return tup_encode_get_buildinfo(buf, size);
+        case TUP_MESSAGE_CMD_ACTIVATE_INTERNAL_SENSORS:
+            tup_message_init_activate_internal_sensors(msg, 1);
+            return tup_encode_activate_internal_sensors(buf, size, 1);
+        case TUP_MESSAGE_CMD_GET_INPUT_VALUE:
+            ret = tup_message_init_get_input_value_array(msg, 2, test_ids,
+                    N_ELEMENTS(test_ids));
+            return (ret < 0) ? ret : tup_encode_get_input_value(buf, size, 2,
+                    test_ids, N_ELEMENTS(test_ids));
+        case TUP_MESSAGE_CMD_SET_INPUT_VALUE:
+            ret = tup_message_init_set_input_value_array(msg, 2, test_inputs,
+                    N_ELEMENTS(test_inputs));
+            return (ret < 0) ? ret : tup_encode_set_input_value(buf, size, 2,
+                    test_inputs, N_ELEMENTS(test_inputs));
+        case TUP_MESSAGE_CMD_FILTER_GET_ACTIVE:
+            ret = tup_message_init_filter_get_active(msg,
+                    TUP_FILTER_ID_BAND_NORM, 1);
+            return (ret < 0) ? ret : tup_encode_filter_get_active(buf, size,
+                    TUP_FILTER_ID_BAND_NORM, 1);
+        case TUP_MESSAGE_CMD_FILTER_SET_ACTIVE:
+            ret = tup_message_init_filter_set_active(msg,
+                    TUP_FILTER_ID_BAND_NORM, 1, true);
+            return (ret < 0) ? ret : tup_encode_filter_set_active(buf, size,
+                    TUP_FILTER_ID_BAND_NORM, 1, true);
+        case TUP_MESSAGE_CMD_CONFIG_WRITE:
+            tup_message_init_config_write(msg);
+            return tup_encode_config_write(buf, size);
+        case TUP_MESSAGE_CMD_CONFIG_BAND_NORM_GET_COEFFS:
+            ret = tup_message_init_config_band_norm_get_coeffs(msg, 1);
+            return (ret < 0) ? ret
+                : tup_encode_config_band_norm_get_coeffs(buf, size, 1);
+        case TUP_MESSAGE_CMD_CONFIG_BAND_NORM_SET_COEFFS:
+            ret = tup_message_init_config_band_norm_set_coeffs(msg, 1, test_a,
+                    test_b);
+            return (ret < 0) ? ret
+                : tup_encode_config_band_norm_set_coeffs(buf, size, 1, test_a,
+                        test_b);
+        case TUP_MESSAGE_RESP_VERSION:
+            tup_message_init_resp_version(msg, "1.2.3");
+            return tup_encode_resp_version(buf, size, "1.2.3");
+        case TUP_MESSAGE_RESP_PARAMETER:
+            ret = tup_message_init_resp_parameter(msg, 1, test_params,
+                    N_ELEMENTS(test_params));
+            return (ret < 0) ? ret : tup_encode_resp_parameter(buf, size, 1,
+                    test_params, N_ELEMENTS(test_params));
+        case TUP_MESSAGE_RESP_SENSOR:
+            ret = tup_message_init_resp_sensor(msg, test_sensors,
+                    N_ELEMENTS(test_sensors));
+            return (ret < 0) ? ret : tup_encode_resp_sensor(buf, size,
+                    test_sensors, N_ELEMENTS(test_sensors));
+        case TUP_MESSAGE_RESP_BUILDINFO:
+            tup_message_init_resp_buildinfo(msg, "test");
+            return tup_encode_resp_buildinfo(buf, size, "test");
+        case TUP_MESSAGE_RESP_INPUT:
+            ret = tup_message_init_resp_input(msg, 2, test_inputs,
+                    N_ELEMENTS(test_inputs));
+            return (ret < 0) ? ret : tup_encode_resp_input(buf, size, 2,
+                    test_inputs, N_ELEMENTS(test_inputs));
+        case TUP_MESSAGE_RESP_SET_PARAMETER:
+            ret = tup_message_init_resp_set_parameter(msg, 1, -1, test_params,
+                    N_ELEMENTS(test_params));
+            return (ret < 0) ? ret : tup_encode_resp_set_parameter(buf, size,
+                    1, -1, test_params, N_ELEMENTS(test_params));
+        case TUP_MESSAGE_RESP_FILTER_ACTIVE:
+            ret = tup_message_init_resp_filter_active(msg,
+                    TUP_FILTER_ID_BAND_NORM, 1, false);
+            return (ret < 0) ? ret : tup_encode_resp_filter_active(buf, size,
+                    TUP_FILTER_ID_BAND_NORM, 1, false);
+        case TUP_MESSAGE_RESP_BAND_NORM_COEFFS:
+            ret = tup_message_init_resp_band_norm_coeffs(msg, 1, test_a,
+                    test_b);
+            return (ret < 0) ? ret : tup_encode_resp_band_norm_coeffs(buf,
+                    size, 1, test_a, test_b);
+        case TUP_MESSAGE_CMD_DEBUG_GET_SYSTEM_STATUS:
+            tup_message_init_cmd_debug_get_system_status(msg);
+            return tup_encode_cmd_debug_get_system_status(buf, size);
+        case TUP_MESSAGE_RESP_DEBUG_SYSTEM_STATUS:
+            ret = tup_message_init_resp_debug_system_status(msg, &test_status,
+                    &test_task, 1);
+            return (ret < 0) ? ret : tup_encode_resp_debug_system_status(buf,
+                    size, &test_status, &test_task, 1);
+        default:
+            return SMP_ERROR_NOT_FOUND;
+    }
+}
+
+/* encoded frames are the ones tup_context_send() writes, and they are written
+ * as is by tup_context_send_raw() */
+static bool test_frames(TupContext *ctx, int fd, TupMessage *msg)
+{
+    uint8_t expected[TEST_FRAME_SIZE];
+    uint8_t frame[TEST_FRAME_SIZE];
+    ssize_t expected_size;
+    int size;
+    size_t i;
+    int ret;
+
+    for (i = 0; i < N_ELEMENTS(test_types); i++) {
+        TupMessageType type = test_types[i];
+
+        tup_message_clear(msg);
+
+        size = encode_message(type, msg, frame, sizeof(frame));
+        if (size <= 0) {
+            fprintf(stderr, "frames: failed to encode %d: %d\n", type, size);
+            return false;
+        }
+
+        ret = tup_context_send(ctx, msg);
+        if (ret < 0) {
+            fprintf(stderr, "frames: failed to send %d: %d\n", type, ret);
+            return false;
+        }
+
+        expected_size = read(fd, expected, sizeof(expected));
+        if (expected_size != size || memcmp(frame, expected, size) != 0) {
+            fprintf(stderr, "frames: encoded %d differs from the message "
+                    "frame\n", type);
+            return false;
+        }
+
+        ret = tup_context_send_raw(ctx, frame, size);
+        if (ret < 0) {
+            fprintf(stderr, "frames: failed to send %d raw: %d\n", type, ret);
+            return false;
+        }
+
+        expected_size = read(fd, expected, sizeof(expected));
+        if (expected_size != size || memcmp(frame, expected, size) != 0) {
+            fprintf(stderr, "frames: raw %d isn't written as is\n", type);
+            return false;
+        }
+
+        /* a byte short */
+        tup_message_clear(msg);
+        ret = encode_message(type, msg, frame, size - 1);
+        if (ret != SMP_ERROR_OVERFLOW) {
+            fprintf(stderr, "frames: %d in a short buffer gave %d\n", type,
+                    ret);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* raw frames can't go through the shadow state */
+static bool test_invalid(TupContext *ctx)
+{
+    uint8_t frame[TEST_FRAME_SIZE];
+    int size;
+    int ret;
+
+    ret = tup_context_send_raw(ctx, NULL, 0);
+    if (ret != SMP_ERROR_INVALID_PARAM) {
+        fprintf(stderr, "invalid: empty frame gave %d\n", ret);
+        return false;
+    }
+
+    size = tup_encode_play(frame, sizeof(frame), 1);
+    ret = tup_context_enable_shadow(ctx, true);
+    if (size < 0 || ret < 0) {
+        fprintf(stderr, "invalid: failed to init: %d %d\n", size, ret);
+        return false;
+    }
+
+    ret = tup_context_send_raw(ctx, frame, size);
+    tup_context_enable_shadow(ctx, false);
+
+    if (ret != SMP_ERROR_NOT_SUPPORTED) {
+        fprintf(stderr, "invalid: raw frame with shadow gave %d\n", ret);
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    TupTransport *transport;
+    TupContext *ctx = NULL;
+    TupMessage *msg;
+    bool success = false;
+    int sv[2];
+
+    msg = tup_message_new();
+    if (msg == NULL)
+        return 1;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        fprintf(stderr, "failed to create a socketpair\n");
+        goto done;
+    }
+
+    transport = tup_transport_new_fd(sv[0], sv[0]);
+    if (transport != NULL)
+        ctx = tup_context_new_with_transport(transport, NULL, NULL);
+
+    if (ctx == NULL) {
+        fprintf(stderr, "failed to create the context\n");
+        if (transport != NULL)
+            tup_transport_free(transport);
+        else
+            close(sv[0]);
+
+        close(sv[1]);
+        goto done;
+    }
+
+    success = test_frames(ctx, sv[1], msg) && test_invalid(ctx);
+
+    tup_context_free(ctx);
+    close(sv[1]);
+
+done:
+    tup_message_free(msg);
+    if (!success)
+        return 1;
+
+    printf("direct encoders write the message frames\n");
+    return 0;
+}
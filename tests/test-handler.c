@@ -0,0 +1,438 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <libtup.h>
+#include <libtupsim.h>
+
+#define TEST_N_PUMPS 16
+
+typedef struct
+{
+    TupTransport *transports[2];
+    TupContext *host;
+    TupSimDevice *dev;
+    TupMessage *msg;
+
+    /* messages which reached new_message_cb, by type */
+    unsigned int n_unhandled[256];
+    unsigned long n_bad_messages;
+
+    unsigned int n_acks;
+    TupMessageType ack_cmd;
+    uint32_t ack_data;
+
+    unsigned int n_errors;
+    TupMessageType error_cmd;
+    uint32_t error;
+    uint32_t error_data;
+
+    unsigned int n_versions;
+    char version[32];
+
+    unsigned int n_parameters;
+    uint8_t parameter_effect_id;
+    TupParameterArgs parameter;
+
+    unsigned int n_inputs;
+    TupInputValueArgs input;
+
+    unsigned int n_raw;
+} TestSetup;
+
+static void on_host_message(TupContext *ctx, TupMessage *msg, void *userdata)
+{
+    TestSetup *setup = userdata;
+
+    setup->n_unhandled[tup_message_get_type(msg) & 0xff]++;
+}
+
+static void on_host_error(TupContext *ctx, SmpError error, void *userdata)
+{
+    TestSetup *setup = userdata;
+
+    if (error == SMP_ERROR_BAD_MESSAGE)
+        setup->n_bad_messages++;
+}
+
+static void on_ack(TupContext *ctx, TupMessageType cmd, uint32_t data,
+        void *userdata)
+{
+    TestSetup *setup = userdata;
+
+    setup->n_acks++;
+    setup->ack_cmd = cmd;
+    setup->ack_data = data;
+}
+
+static void on_error(TupContext *ctx, TupMessageType cmd, uint32_t error,
+        uint32_t data, void *userdata)
+{
+    TestSetup *setup = userdata;
+
+    setup->n_errors++;
+    setup->error_cmd = cmd;
+    setup->error = error;
+    setup->error_data = data;
+}
+
+static void on_version(TupContext *ctx, const char *str, void *userdata)
+{
+    TestSetup *setup = userdata;
+
+    setup->n_versions++;
+    snprintf(setup->version, sizeof(setup->version), "%s", str);
+}
+
+static void on_parameter(TupContext *ctx, uint8_t effect_id,
+        const TupParameterArgs *args, size_t n_args, void *userdata)
+{
+    TestSetup *setup = userdata;
+
+    setup->n_parameters++;
+    setup->parameter_effect_id = effect_id;
+    if (n_args == 1)
+        setup->parameter = args[0];
+}
+
+static void on_input(TupContext *ctx, uint8_t effect_slot_id,
+        const TupInputValueArgs *args, size_t n_args, void *userdata)
+{
+    TestSetup *setup = userdata;
+
+    setup->n_inputs++;
+    if (n_args == 1)
+        setup->input = args[0];
+}
+
+static void on_raw_input(TupContext *ctx, TupMessage *msg, void *userdata)
+{
+    TestSetup *setup = userdata;
+
+    setup->n_raw++;
+}
+
+static void on_request_done(TupContext *ctx, TupMessageType cmd,
+        TupRequestStatus status, TupMessage *response, void *userdata)
+{
+}
+
+static bool setup_init(TestSetup *setup)
+{
+    TupCallbacks cbs = {
+        .new_message_cb = on_host_message,
+        .error_cb = on_host_error,
+    };
+    int ret;
+
+    memset(setup, 0, sizeof(*setup));
+
+    setup->msg = tup_message_new();
+    if (setup->msg == NULL) {
+        fprintf(stderr, "failed to create the message\n");
+        return false;
+    }
+
+    ret = tup_transport_new_loopback(&setup->transports[0],
+            &setup->transports[1], 0);
+    if (ret < 0) {
+        fprintf(stderr, "failed to create loopback transports: %d\n", ret);
+        return false;
+    }
+
+    setup->host = tup_context_new_with_transport(setup->transports[0], &cbs,
+            setup);
+    setup->dev = tup_sim_device_new(setup->transports[1], NULL);
+    if (setup->host == NULL || setup->dev == NULL
+            || tup_sim_device_open(setup->dev, NULL) < 0) {
+        fprintf(stderr, "failed to create the host and the device\n");
+        return false;
+    }
+
+    ret = tup_context_set_ack_handler(setup->host, on_ack, setup);
+    if (ret == 0)
+        ret = tup_context_set_error_handler(setup->host, on_error, setup);
+
+    if (ret == 0)
+        ret = tup_context_set_version_handler(setup->host, on_version, setup);
+
+    if (ret == 0)
+        ret = tup_context_set_parameter_handler(setup->host, on_parameter,
+                setup);
+
+    if (ret == 0)
+        ret = tup_context_set_input_handler(setup->host, on_input, setup);
+
+    if (ret < 0) {
+        fprintf(stderr, "failed to set the handlers: %d\n", ret);
+        return false;
+    }
+
+    return true;
+}
+
+static void setup_clear(TestSetup *setup)
+{
+    if (setup->dev != NULL)
+        tup_sim_device_free(setup->dev);
+    else if (setup->transports[1] != NULL)
+        tup_transport_free(setup->transports[1]);
+
+    if (setup->host != NULL)
+        tup_context_free(setup->host);
+    else if (setup->transports[0] != NULL)
+        tup_transport_free(setup->transports[0]);
+
+    if (setup->msg != NULL)
+        tup_message_free(setup->msg);
+}
+
+/* send the command and let the device answer it */
+static int exchange(TestSetup *setup)
+{
+    TupContext *device = tup_sim_device_get_context(setup->dev);
+    int ret;
+    int i;
+
+    ret = tup_context_send(setup->host, setup->msg);
+
+    for (i = 0; i < TEST_N_PUMPS && ret == 0; i++)
+        ret = tup_context_process_fd(device);
+
+    for (i = 0; i < TEST_N_PUMPS && ret == 0; i++)
+        ret = tup_context_process_fd(setup->host);
+
+    tup_message_clear(setup->msg);
+    return ret;
+}
+
+/* responses are parsed for their handler and don't reach new_message_cb */
+static bool test_typed(void)
+{
+    TestSetup setup;
+    bool success = false;
+    int ret;
+
+    if (!setup_init(&setup))
+        goto done;
+
+    tup_message_init_load(setup.msg, 1, 0);
+    ret = exchange(&setup);
+
+    if (ret == 0) {
+        tup_message_init_play(setup.msg, 2);
+        ret = exchange(&setup);
+    }
+
+    if (ret == 0) {
+        tup_message_init_get_version(setup.msg);
+        ret = exchange(&setup);
+    }
+
+    if (ret == 0) {
+        tup_message_init_set_parameter_simple(setup.msg, 1, 4, 1234);
+        ret = exchange(&setup);
+    }
+
+    if (ret == 0) {
+        tup_message_init_get_parameter_simple(setup.msg, 1, 4);
+        ret = exchange(&setup);
+    }
+
+    if (ret == 0) {
+        tup_message_init_set_input_value_simple(setup.msg, 1, 2, -56);
+        ret = exchange(&setup);
+    }
+
+    if (ret == 0) {
+        tup_message_init_get_input_value_simple(setup.msg, 1, 2);
+        ret = exchange(&setup);
+    }
+
+    if (ret < 0) {
+        fprintf(stderr, "typed: failed to exchange: %d\n", ret);
+        goto done;
+    }
+
+    if (setup.n_acks != 2 || setup.ack_cmd != TUP_MESSAGE_CMD_SET_INPUT_VALUE
+            || setup.ack_data != 1) {
+        fprintf(stderr, "typed: %u acks, last for %d with %u\n", setup.n_acks,
+                setup.ack_cmd, setup.ack_data);
+        goto done;
+    }
+
+    if (setup.n_errors != 1 || setup.error_cmd != TUP_MESSAGE_CMD_PLAY
+            || setup.error != TUP_SIM_ERROR_EMPTY_SLOT
+            || setup.error_data != 2) {
+        fprintf(stderr, "typed: %u errors, last for %d: %u with %u\n",
+                setup.n_errors, setup.error_cmd, setup.error,
+                setup.error_data);
+        goto done;
+    }
+
+    if (setup.n_versions != 1 || strcmp(setup.version, "0.0.0-sim") != 0) {
+        fprintf(stderr, "typed: %u versions, last %s\n", setup.n_versions,
+                setup.version);
+        goto done;
+    }
+
+    if (setup.n_parameters != 1 || setup.parameter_effect_id != 1
+            || setup.parameter.parameter_id != 4
+            || setup.parameter.parameter_value != 1234) {
+        fprintf(stderr, "typed: %u parameters, last %u = %u\n",
+                setup.n_parameters, setup.parameter.parameter_id,
+                setup.parameter.parameter_value);
+        goto done;
+    }
+
+    if (setup.n_inputs != 1 || setup.input.input_id != 2
+            || setup.input.input_value != -56) {
+        fprintf(stderr, "typed: %u inputs, last %u = %d\n", setup.n_inputs,
+                setup.input.input_id, setup.input.input_value);
+        goto done;
+    }
+
+    /* only the response without handler reaches new_message_cb */
+    if (setup.n_unhandled[TUP_MESSAGE_RESP_SET_PARAMETER] != 1
+            || setup.n_unhandled[TUP_MESSAGE_ACK] != 0
+            || setup.n_unhandled[TUP_MESSAGE_RESP_PARAMETER] != 0) {
+        fprintf(stderr, "typed: handled messages reached new_message_cb\n");
+        goto done;
+    }
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    return success;
+}
+
+/* handlers can be replaced or removed, and run after requests */
+static bool test_replace(void)
+{
+    TestSetup setup;
+    bool success = false;
+    int ret;
+
+    if (!setup_init(&setup))
+        goto done;
+
+    tup_message_init_load(setup.msg, 1, 0);
+    ret = exchange(&setup);
+
+    /* a raw handler replaces the typed one */
+    if (ret == 0)
+        ret = tup_context_set_message_handler(setup.host,
+                TUP_MESSAGE_RESP_INPUT, on_raw_input, &setup);
+
+    if (ret == 0) {
+        tup_message_init_get_input_value_simple(setup.msg, 1, 0);
+        ret = exchange(&setup);
+    }
+
+    /* without handler, the message goes to new_message_cb */
+    if (ret == 0)
+        ret = tup_context_set_version_handler(setup.host, NULL, NULL);
+
+    if (ret == 0) {
+        tup_message_init_get_version(setup.msg);
+        ret = exchange(&setup);
+    }
+
+    /* a pending request consumes its response first */
+    if (ret == 0) {
+        tup_message_init_get_parameter_simple(setup.msg, 1, 0);
+        ret = tup_context_send_request(setup.host, setup.msg,
+                on_request_done, NULL);
+        tup_message_clear(setup.msg);
+    }
+
+    if (ret == 0)
+        ret = exchange(&setup);
+
+    if (ret < 0) {
+        fprintf(stderr, "replace: failed to exchange: %d\n", ret);
+        goto done;
+    }
+
+    if (setup.n_raw != 1 || setup.n_inputs != 0) {
+        fprintf(stderr, "replace: %u raw and %u typed input handler "
+                "calls\n", setup.n_raw, setup.n_inputs);
+        goto done;
+    }
+
+    if (setup.n_versions != 0
+            || setup.n_unhandled[TUP_MESSAGE_RESP_VERSION] != 1) {
+        fprintf(stderr, "replace: removed handler still called\n");
+        goto done;
+    }
+
+    if (setup.n_parameters != 0
+            || setup.n_unhandled[TUP_MESSAGE_RESP_PARAMETER] != 0) {
+        fprintf(stderr, "replace: response of a request was dispatched\n");
+        goto done;
+    }
+
+    ret = tup_context_set_message_handler(setup.host, 256, on_raw_input,
+            &setup);
+    if (ret != SMP_ERROR_INVALID_PARAM) {
+        fprintf(stderr, "replace: out of range type returned %d\n", ret);
+        goto done;
+    }
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    return success;
+}
+
+/* a response which fails to parse is reported to error_cb */
+static bool test_bad_message(void)
+{
+    TestSetup setup;
+    bool success = false;
+    int ret;
+    int i;
+
+    if (!setup_init(&setup))
+        goto done;
+
+    /* a RESP_VERSION without its string */
+    smp_message_init(setup.msg, TUP_MESSAGE_RESP_VERSION);
+
+    ret = tup_context_send(tup_sim_device_get_context(setup.dev), setup.msg);
+    for (i = 0; i < TEST_N_PUMPS && ret == 0; i++)
+        ret = tup_context_process_fd(setup.host);
+
+    if (ret < 0) {
+        fprintf(stderr, "bad message: failed to exchange: %d\n", ret);
+        goto done;
+    }
+
+    if (setup.n_bad_messages != 1 || setup.n_versions != 0
+            || setup.n_unhandled[TUP_MESSAGE_RESP_VERSION] != 0) {
+        fprintf(stderr, "bad message: %lu errors and %u handler calls\n",
+                setup.n_bad_messages, setup.n_versions);
+        goto done;
+    }
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    return success;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!test_typed() || !test_replace() || !test_bad_message())
+        return 1;
+
+    printf("handlers get parsed messages\n");
+    return 0;
+}
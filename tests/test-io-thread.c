@@ -0,0 +1,315 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <libtup.h>
+#include <libtupsim.h>
+
+#define TEST_N_MESSAGES 16
+
+/* time given to the I/O thread to write queued frames */
+#define TEST_WAIT_MS 500
+
+typedef struct
+{
+    TupTransport *transport;
+    TupContext *host;
+    TupSimDevice *dev;
+    TupMessage *msg;
+
+    /* updated from the I/O thread */
+    atomic_uint n_received;
+    atomic_int stop_ret;
+    atomic_int close_ret;
+} TestSetup;
+
+static void on_host_message(TupContext *ctx, TupMessage *msg, void *userdata)
+{
+    TestSetup *setup = userdata;
+
+    atomic_fetch_add(&setup->n_received, 1);
+}
+
+/* neither stopping the thread nor closing can wait for the calling thread */
+static void on_host_message_stop(TupContext *ctx, TupMessage *msg,
+        void *userdata)
+{
+    TestSetup *setup = userdata;
+
+    atomic_store(&setup->stop_ret, tup_context_stop_io_thread(ctx));
+    atomic_store(&setup->close_ret, tup_context_close(ctx));
+    atomic_fetch_add(&setup->n_received, 1);
+}
+
+/* the host is a plain libsmp context opened on the pty of the device */
+static bool setup_init(TestSetup *setup, TupMessageHandler cb)
+{
+    TupCallbacks cbs = {
+        .new_message_cb = cb,
+        .error_cb = NULL,
+    };
+    int ret;
+
+    setup->host = NULL;
+    setup->dev = NULL;
+    atomic_init(&setup->n_received, 0);
+    atomic_init(&setup->stop_ret, 1);
+    atomic_init(&setup->close_ret, 1);
+
+    setup->msg = tup_message_new();
+    if (setup->msg == NULL) {
+        fprintf(stderr, "failed to create the message\n");
+        return false;
+    }
+
+    setup->transport = tup_transport_new_pty();
+    if (setup->transport == NULL) {
+        fprintf(stderr, "failed to create a pty\n");
+        return false;
+    }
+
+    setup->dev = tup_sim_device_new(setup->transport, NULL);
+    if (setup->dev == NULL || tup_sim_device_open(setup->dev, NULL) < 0) {
+        fprintf(stderr, "failed to create the device\n");
+        return false;
+    }
+
+    setup->host = tup_context_new(&cbs, setup);
+    if (setup->host == NULL) {
+        fprintf(stderr, "failed to create the host\n");
+        return false;
+    }
+
+    ret = tup_context_open(setup->host,
+            tup_transport_get_pty_name(setup->transport));
+    if (ret < 0) {
+        fprintf(stderr, "failed to open the pty: %d\n", ret);
+        return false;
+    }
+
+    return true;
+}
+
+static void setup_clear(TestSetup *setup)
+{
+    if (setup->host != NULL)
+        tup_context_free(setup->host);
+
+    if (setup->dev != NULL)
+        tup_sim_device_free(setup->dev);
+    else if (setup->transport != NULL)
+        tup_transport_free(setup->transport);
+
+    if (setup->msg != NULL)
+        tup_message_free(setup->msg);
+}
+
+/* let the device answer until the host received n messages */
+static int pump(TestSetup *setup, unsigned int n)
+{
+    TupContext *device = tup_sim_device_get_context(setup->dev);
+    int ret;
+    int i;
+
+    for (i = 0; i < TEST_WAIT_MS; i++) {
+        ret = tup_context_process_fd(device);
+        if (ret < 0)
+            return ret;
+
+        if (atomic_load(&setup->n_received) >= n)
+            return 0;
+
+        usleep(1000);
+    }
+
+    return SMP_ERROR_TIMEDOUT;
+}
+
+static int send_input(TestSetup *setup, uint8_t input_id, int32_t value)
+{
+    int ret;
+    int i;
+
+    tup_message_clear(setup->msg);
+    tup_message_init_set_input_value_simple(setup->msg, 1, input_id, value);
+
+    /* the ring may be full */
+    for (i = 0; i < TEST_WAIT_MS; i++) {
+        ret = tup_context_send(setup->host, setup->msg);
+        if (ret != SMP_ERROR_WOULD_BLOCK)
+            break;
+
+        usleep(1000);
+    }
+
+    return ret;
+}
+
+/* read an input of slot 1 on the device itself */
+static int get_device_input(TestSetup *setup, uint8_t input_id,
+        int32_t *value)
+{
+    TupInputValueArgs args[1];
+    TupMessage *response;
+    uint8_t slot_id;
+    int ret;
+
+    response = tup_message_new();
+    if (response == NULL)
+        return -1;
+
+    tup_message_clear(setup->msg);
+    tup_message_init_get_input_value_simple(setup->msg, 1, input_id);
+
+    ret = tup_sim_device_handle_message(setup->dev, setup->msg, response);
+    if (ret == 0)
+        ret = tup_message_parse_resp_input(response, &slot_id, args, 1);
+
+    if (ret == 1)
+        *value = args[0].input_value;
+
+    tup_message_free(response);
+    return (ret == 1) ? 0 : -1;
+}
+
+/* frames combined before starting the thread are written before the ones
+ * queued to the ring, and every queued frame is answered */
+static bool test_order(void)
+{
+    TestSetup setup;
+    int32_t value;
+    bool success = false;
+    int ret;
+    int i;
+
+    if (!setup_init(&setup, on_host_message))
+        goto done;
+
+    tup_message_clear(setup.msg);
+    tup_message_init_load(setup.msg, 1, 0);
+
+    ret = tup_context_set_write_combining(setup.host, 4096);
+    if (ret == 0)
+        ret = tup_context_send(setup.host, setup.msg);
+
+    if (ret == 0)
+        ret = send_input(&setup, 0, 1);
+
+    if (ret < 0) {
+        fprintf(stderr, "order: failed to combine a frame: %d\n", ret);
+        goto done;
+    }
+
+    ret = tup_context_start_io_thread(setup.host, 4);
+    if (ret < 0) {
+        fprintf(stderr, "order: failed to start the I/O thread: %d\n", ret);
+        goto done;
+    }
+
+    for (i = 0; i < TEST_N_MESSAGES && ret == 0; i++) {
+        ret = send_input(&setup, 0, 2 + i);
+        if (ret == 0)
+            ret = tup_context_flush(setup.host);
+
+        /* keep the pty from filling up */
+        if (ret == 0)
+            ret = tup_context_process_fd(tup_sim_device_get_context(
+                        setup.dev));
+    }
+
+    if (ret < 0) {
+        fprintf(stderr, "order: failed to send: %d\n", ret);
+        goto done;
+    }
+
+    ret = pump(&setup, TEST_N_MESSAGES + 2);
+    if (ret < 0) {
+        fprintf(stderr, "order: %u responses, expected %d\n",
+                atomic_load(&setup.n_received), TEST_N_MESSAGES + 2);
+        goto done;
+    }
+
+    if (get_device_input(&setup, 0, &value) < 0) {
+        fprintf(stderr, "order: failed to read the device input\n");
+        goto done;
+    }
+
+    if (value != 1 + TEST_N_MESSAGES) {
+        fprintf(stderr, "order: device input is %d, expected %d\n", value,
+                1 + TEST_N_MESSAGES);
+        goto done;
+    }
+
+    ret = tup_context_stop_io_thread(setup.host);
+    if (ret < 0) {
+        fprintf(stderr, "order: failed to stop the I/O thread: %d\n", ret);
+        goto done;
+    }
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    return success;
+}
+
+/* stopping the thread from one of its callbacks fails instead of hanging */
+static bool test_stop_from_callback(void)
+{
+    TestSetup setup;
+    bool success = false;
+    int ret;
+
+    if (!setup_init(&setup, on_host_message_stop))
+        goto done;
+
+    ret = tup_context_start_io_thread(setup.host, 0);
+    if (ret == 0)
+        ret = send_input(&setup, 0, 1);
+
+    if (ret < 0) {
+        fprintf(stderr, "callback: failed to send: %d\n", ret);
+        goto done;
+    }
+
+    ret = pump(&setup, 1);
+    if (ret < 0) {
+        fprintf(stderr, "callback: no response received\n");
+        goto done;
+    }
+
+    if (atomic_load(&setup.stop_ret) != SMP_ERROR_BUSY
+            || atomic_load(&setup.close_ret) != SMP_ERROR_BUSY) {
+        fprintf(stderr, "callback: stop returned %d and close %d, expected "
+                "%d\n", atomic_load(&setup.stop_ret),
+                atomic_load(&setup.close_ret), SMP_ERROR_BUSY);
+        goto done;
+    }
+
+    ret = tup_context_stop_io_thread(setup.host);
+    if (ret < 0) {
+        fprintf(stderr, "callback: failed to stop the I/O thread: %d\n",
+                ret);
+        goto done;
+    }
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    return success;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!test_order() || !test_stop_from_callback())
+        return 1;
+
+    printf("I/O thread keeps frames in order and isn't joined from itself\n");
+    return 0;
+}
@@ -0,0 +1,389 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <libtup.h>
+#include <libtupsim.h>
+
+#define N_ELEMENTS(arr) (sizeof((arr)) / sizeof((arr)[0]))
+
+#define TEST_N_PUMPS 16
+
+/* more groups than the simple parsers are usually given room for */
+#define TEST_N_GROUPS 24
+
+typedef struct
+{
+    TupTransport *transports[2];
+    TupContext *host;
+    TupSimDevice *dev;
+    TupMessage *msg;
+
+    /* what the iterators returned from the received responses */
+    TupInputValueArgs inputs[TEST_N_GROUPS];
+    size_t n_inputs;
+    TupParameterArgs params[TEST_N_GROUPS];
+    size_t n_params;
+    size_t n_set_params;
+    int32_t retval;
+    int n_failed;
+} TestSetup;
+
+static int32_t test_input_value(int i)
+{
+    return i * 1000 - 7;
+}
+
+static uint32_t test_parameter_value(int i)
+{
+    return 0x10ff1b00 + i;
+}
+
+static void on_host_message(TupContext *ctx, TupMessage *msg, void *userdata)
+{
+    TestSetup *setup = userdata;
+    TupMessageIter iter;
+    TupParameterArgs param;
+    uint8_t id;
+    int ret = 0;
+
+    switch (tup_message_get_type(msg)) {
+        case TUP_MESSAGE_RESP_INPUT:
+            ret = tup_resp_input_iter_init(&iter, msg, &id);
+            while (ret == 0 && setup->n_inputs < TEST_N_GROUPS) {
+                ret = tup_resp_input_iter_next(&iter,
+                        &setup->inputs[setup->n_inputs]);
+                if (ret == 1) {
+                    setup->n_inputs++;
+                    ret = 0;
+                } else if (ret == 0) {
+                    break;
+                }
+            }
+            break;
+        case TUP_MESSAGE_RESP_PARAMETER:
+            ret = tup_resp_parameter_iter_init(&iter, msg, &id);
+            while (ret == 0 && setup->n_params < TEST_N_GROUPS) {
+                ret = tup_resp_parameter_iter_next(&iter,
+                        &setup->params[setup->n_params]);
+                if (ret == 1) {
+                    setup->n_params++;
+                    ret = 0;
+                } else if (ret == 0) {
+                    break;
+                }
+            }
+            break;
+        case TUP_MESSAGE_RESP_SET_PARAMETER:
+            ret = tup_resp_set_parameter_iter_init(&iter, msg, &id,
+                    &setup->retval);
+            while (ret == 0) {
+                ret = tup_resp_set_parameter_iter_next(&iter, &param);
+                if (ret == 1) {
+                    setup->n_set_params++;
+                    ret = 0;
+                } else if (ret == 0) {
+                    break;
+                }
+            }
+            break;
+        default:
+            break;
+    }
+
+    if (ret < 0)
+        setup->n_failed++;
+}
+
+static bool setup_init(TestSetup *setup)
+{
+    TupCallbacks cbs = {
+        .new_message_cb = on_host_message,
+        .error_cb = NULL,
+    };
+    int ret;
+
+    memset(setup, 0, sizeof(*setup));
+
+    setup->msg = tup_message_new();
+    if (setup->msg == NULL) {
+        fprintf(stderr, "failed to create the message\n");
+        return false;
+    }
+
+    ret = tup_transport_new_loopback(&setup->transports[0],
+            &setup->transports[1], 0);
+    if (ret < 0) {
+        fprintf(stderr, "failed to create loopback transports: %d\n", ret);
+        return false;
+    }
+
+    setup->host = tup_context_new_with_transport(setup->transports[0], &cbs,
+            setup);
+    setup->dev = tup_sim_device_new(setup->transports[1], NULL);
+    if (setup->host == NULL || setup->dev == NULL
+            || tup_sim_device_open(setup->dev, NULL) < 0) {
+        fprintf(stderr, "failed to create the host and the device\n");
+        return false;
+    }
+
+    return true;
+}
+
+static void setup_clear(TestSetup *setup)
+{
+    if (setup->dev != NULL)
+        tup_sim_device_free(setup->dev);
+    else if (setup->transports[1] != NULL)
+        tup_transport_free(setup->transports[1]);
+
+    if (setup->host != NULL)
+        tup_context_free(setup->host);
+    else if (setup->transports[0] != NULL)
+        tup_transport_free(setup->transports[0]);
+
+    if (setup->msg != NULL)
+        tup_message_free(setup->msg);
+}
+
+static int pump(TestSetup *setup)
+{
+    TupContext *device = tup_sim_device_get_context(setup->dev);
+    int ret;
+    int i;
+
+    for (i = 0; i < TEST_N_PUMPS; i++) {
+        ret = tup_context_process_fd(device);
+        if (ret == 0)
+            ret = tup_context_process_fd(setup->host);
+
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+static int send_commands(TestSetup *setup)
+{
+    TupInputValueArgs inputs[TEST_N_GROUPS];
+    TupParameterArgs params[TEST_N_GROUPS];
+    uint8_t ids[TEST_N_GROUPS];
+    int ret;
+    int i;
+
+    for (i = 0; i < TEST_N_GROUPS; i++) {
+        ids[i] = i;
+        inputs[i].input_id = i;
+        inputs[i].input_value = test_input_value(i);
+        params[i].parameter_id = i;
+        params[i].parameter_value = test_parameter_value(i);
+    }
+
+    tup_message_init_load(setup->msg, 1, 0);
+    ret = tup_context_send(setup->host, setup->msg);
+
+    if (ret == 0) {
+        tup_message_clear(setup->msg);
+        ret = tup_message_init_set_input_value_array(setup->msg, 1, inputs,
+                TEST_N_GROUPS);
+    }
+
+    if (ret == 0)
+        ret = tup_context_send(setup->host, setup->msg);
+
+    if (ret == 0) {
+        tup_message_clear(setup->msg);
+        ret = tup_message_init_get_input_value_array(setup->msg, 1, ids,
+                TEST_N_GROUPS);
+    }
+
+    if (ret == 0)
+        ret = tup_context_send(setup->host, setup->msg);
+
+    if (ret == 0) {
+        tup_message_clear(setup->msg);
+        ret = tup_message_init_set_parameter_array(setup->msg, 1, params,
+                TEST_N_GROUPS);
+    }
+
+    if (ret == 0)
+        ret = tup_context_send(setup->host, setup->msg);
+
+    if (ret == 0) {
+        tup_message_clear(setup->msg);
+        ret = tup_message_init_get_parameter_array(setup->msg, 1, ids,
+                TEST_N_GROUPS);
+    }
+
+    if (ret == 0)
+        ret = tup_context_send(setup->host, setup->msg);
+
+    return ret;
+}
+
+/* the responses of the device are walked in place, whatever their number of
+ * groups */
+static bool test_responses(void)
+{
+    TestSetup setup;
+    bool success = false;
+    int ret;
+    int i;
+
+    if (!setup_init(&setup))
+        goto done;
+
+    ret = send_commands(&setup);
+    if (ret == 0)
+        ret = pump(&setup);
+
+    if (ret < 0) {
+        fprintf(stderr, "responses: failed to exchange messages: %d\n", ret);
+        goto done;
+    }
+
+    if (setup.n_failed != 0 || setup.n_inputs != TEST_N_GROUPS
+            || setup.n_params != TEST_N_GROUPS
+            || setup.n_set_params != TEST_N_GROUPS || setup.retval != 0) {
+        fprintf(stderr, "responses: %d failures, %zu inputs, %zu parameters "
+                "and %zu set, expected %d of each\n", setup.n_failed,
+                setup.n_inputs, setup.n_params, setup.n_set_params,
+                TEST_N_GROUPS);
+        goto done;
+    }
+
+    for (i = 0; i < TEST_N_GROUPS; i++) {
+        if (setup.inputs[i].input_id != i
+                || setup.inputs[i].input_value != test_input_value(i)
+                || setup.params[i].parameter_id != i
+                || setup.params[i].parameter_value
+                    != test_parameter_value(i)) {
+            fprintf(stderr, "responses: group %d is wrong\n", i);
+            goto done;
+        }
+    }
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    return success;
+}
+
+/* iterators count what remains, stop at the end, ignore an incomplete
+ * trailing group and only take their message type */
+static bool test_bounds(void)
+{
+    TupSensorValueArgs sensors[] = { { 1, 300 }, { 2, 0xffff }, { 3, 0 } };
+    TupDebugSystemStatus status = { 1000000, 65536, 4096 };
+    TupDebugTaskStatus tasks[] = {
+        { 1, "idle", 0, 0, 999, 128 },
+        { 2, "main", 0, 1, 1234, 512 },
+    };
+    TupDebugSystemStatus parsed_status;
+    TupDebugTaskStatus task;
+    TupSensorValueArgs sensor;
+    TupMessageIter iter;
+    TupMessage *msg;
+    bool success = false;
+    uint8_t id;
+    size_t i;
+    int ret;
+
+    msg = tup_message_new();
+    if (msg == NULL)
+        return false;
+
+    ret = tup_message_init_resp_sensor(msg, sensors, N_ELEMENTS(sensors));
+    if (ret == 0)
+        ret = tup_resp_sensor_iter_init(&iter, msg);
+
+    for (i = 0; ret == 0 && i < N_ELEMENTS(sensors); i++) {
+        if (tup_message_iter_get_remaining(&iter) != N_ELEMENTS(sensors) - i) {
+            fprintf(stderr, "bounds: %zu remaining sensors at %zu\n",
+                    tup_message_iter_get_remaining(&iter), i);
+            goto done;
+        }
+
+        ret = tup_resp_sensor_iter_next(&iter, &sensor);
+        if (ret != 1 || sensor.sensor_id != sensors[i].sensor_id
+                || sensor.sensor_value != sensors[i].sensor_value) {
+            fprintf(stderr, "bounds: sensor %zu is wrong: %d\n", i, ret);
+            goto done;
+        }
+
+        ret = 0;
+    }
+
+    if (ret < 0 || tup_resp_sensor_iter_next(&iter, &sensor) != 0
+            || tup_resp_sensor_iter_next(&iter, &sensor) != 0
+            || tup_message_iter_get_remaining(&iter) != 0) {
+        fprintf(stderr, "bounds: sensors don't end: %d\n", ret);
+        goto done;
+    }
+
+    /* a sensor id without its value */
+    smp_message_set_uint8(msg, 2 * N_ELEMENTS(sensors), 4);
+    ret = tup_resp_sensor_iter_init(&iter, msg);
+    if (ret < 0
+            || tup_message_iter_get_remaining(&iter) != N_ELEMENTS(sensors)) {
+        fprintf(stderr, "bounds: incomplete group is counted: %d\n", ret);
+        goto done;
+    }
+
+    ret = tup_resp_input_iter_init(&iter, msg, &id);
+    if (ret != SMP_ERROR_BAD_MESSAGE) {
+        fprintf(stderr, "bounds: wrong type gave %d\n", ret);
+        goto done;
+    }
+
+    /* fixed arguments come with the iterator, strings point in the
+     * message */
+    tup_message_clear(msg);
+    ret = tup_message_init_resp_debug_system_status(msg, &status, tasks,
+            N_ELEMENTS(tasks));
+    if (ret == 0)
+        ret = tup_resp_debug_system_status_iter_init(&iter, msg,
+                &parsed_status);
+
+    if (ret < 0 || parsed_status.rtime != status.rtime
+            || parsed_status.mem_used != status.mem_used) {
+        fprintf(stderr, "bounds: system status is wrong: %d\n", ret);
+        goto done;
+    }
+
+    for (i = 0; i < N_ELEMENTS(tasks); i++) {
+        ret = tup_resp_debug_system_status_iter_next(&iter, &task);
+        if (ret != 1 || task.id != tasks[i].id || task.name == NULL
+                || strcmp(task.name, tasks[i].name) != 0
+                || task.time != tasks[i].time) {
+            fprintf(stderr, "bounds: task %zu is wrong: %d\n", i, ret);
+            goto done;
+        }
+    }
+
+    if (tup_resp_debug_system_status_iter_next(&iter, &task) != 0) {
+        fprintf(stderr, "bounds: tasks don't end\n");
+        goto done;
+    }
+
+    success = true;
+
+done:
+    tup_message_free(msg);
+    return success;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!test_responses() || !test_bounds())
+        return 1;
+
+    printf("iterators walk every repeated group\n");
+    return 0;
+}
@@ -0,0 +1,341 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <libtup.h>
+#include <libtupsim.h>
+
+/* 1 ms per byte without parity */
+#define TEST_BITRATE 10000
+
+#define TEST_LATENCY_US 20000
+
+/* longer than a frame on the wire at 115200 bauds */
+#define TEST_DROP_TIMEOUT_MS 20
+
+/* upper bound of an exchange, only to not hang on failure */
+#define TEST_TIMEOUT_MS 2000
+
+typedef struct
+{
+    TupSimLink *link;
+    TupContext *host;
+    TupSimDevice *dev;
+    TupReactor *reactor;
+    TupMessage *msg;
+
+    int done;
+    TupRequestStatus status;
+} TestSetup;
+
+static uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void on_request_done(TupContext *ctx, TupMessageType cmd,
+        TupRequestStatus status, TupMessage *response, void *userdata)
+{
+    TestSetup *setup = userdata;
+
+    setup->done++;
+    setup->status = status;
+}
+
+static bool setup_init(TestSetup *setup, const TupSimLinkConfig *config)
+{
+    TupTransport *host_transport;
+    TupTransport *device_transport;
+    int ret;
+
+    memset(setup, 0, sizeof(*setup));
+
+    setup->msg = tup_message_new();
+    setup->reactor = tup_reactor_new();
+    if (setup->msg == NULL || setup->reactor == NULL) {
+        fprintf(stderr, "failed to create the message and the reactor\n");
+        return false;
+    }
+
+    setup->link = tup_sim_link_new(config, &host_transport,
+            &device_transport);
+    if (setup->link == NULL) {
+        fprintf(stderr, "failed to create the link\n");
+        return false;
+    }
+
+    setup->host = tup_context_new_with_transport(host_transport, NULL, NULL);
+    if (setup->host == NULL) {
+        fprintf(stderr, "failed to create the host\n");
+        tup_transport_free(host_transport);
+        tup_transport_free(device_transport);
+        return false;
+    }
+
+    setup->dev = tup_sim_device_new(device_transport, NULL);
+    if (setup->dev == NULL || tup_sim_device_open(setup->dev, NULL) < 0) {
+        fprintf(stderr, "failed to create the device\n");
+        if (setup->dev == NULL)
+            tup_transport_free(device_transport);
+
+        return false;
+    }
+
+    ret = tup_reactor_add_context(setup->reactor, setup->host);
+    if (ret == 0)
+        ret = tup_reactor_add_context(setup->reactor,
+                tup_sim_device_get_context(setup->dev));
+
+    if (ret < 0) {
+        fprintf(stderr, "failed to add the contexts: %d\n", ret);
+        return false;
+    }
+
+    return true;
+}
+
+static void setup_clear(TestSetup *setup)
+{
+    if (setup->dev != NULL) {
+        tup_reactor_remove_context(setup->reactor,
+                tup_sim_device_get_context(setup->dev));
+        tup_sim_device_free(setup->dev);
+    }
+
+    if (setup->host != NULL) {
+        tup_reactor_remove_context(setup->reactor, setup->host);
+        tup_context_free(setup->host);
+    }
+
+    if (setup->reactor != NULL)
+        tup_reactor_free(setup->reactor);
+
+    if (setup->msg != NULL)
+        tup_message_free(setup->msg);
+}
+
+/* send a request and serve both ends until it completes */
+static int exchange(TestSetup *setup)
+{
+    uint64_t deadline_ns;
+    int ret;
+
+    setup->done = 0;
+
+    ret = tup_context_send_request(setup->host, setup->msg, on_request_done,
+            setup);
+    if (ret < 0)
+        return ret;
+
+    deadline_ns = get_time_ns() + (uint64_t) TEST_TIMEOUT_MS * 1000000;
+
+    while (!setup->done && get_time_ns() < deadline_ns) {
+        ret = tup_reactor_iterate(setup->reactor, 10);
+        if (ret < 0)
+            return ret;
+    }
+
+    return setup->done ? 0 : SMP_ERROR_TIMEDOUT;
+}
+
+/* an exchange takes at least the time of its bytes on the wire plus the
+ * processing latency, only lower bounds are checked as the machine may be
+ * slow */
+static bool run_timing(const char *name, TestSetup *setup,
+        uint64_t byte_ns)
+{
+    TupSimLinkStats stats;
+    uint64_t expected_ns;
+    uint64_t start_ns;
+    uint64_t elapsed_ns;
+    uint64_t n_bytes;
+    int ret;
+
+    tup_message_clear(setup->msg);
+    tup_message_init_get_version(setup->msg);
+
+    /* counters include the previous exchanges */
+    tup_sim_link_get_stats(setup->link, &stats);
+    n_bytes = stats.n_bytes_to_device + stats.n_bytes_to_host;
+
+    start_ns = get_time_ns();
+    ret = exchange(setup);
+    elapsed_ns = get_time_ns() - start_ns;
+
+    if (ret < 0 || setup->status != TUP_REQUEST_STATUS_OK) {
+        fprintf(stderr, "%s: request failed: %d, status %d\n", name, ret,
+                setup->status);
+        return false;
+    }
+
+    tup_sim_link_get_stats(setup->link, &stats);
+    n_bytes = stats.n_bytes_to_device + stats.n_bytes_to_host - n_bytes;
+    expected_ns = n_bytes * byte_ns + (uint64_t) TEST_LATENCY_US * 1000;
+
+    if (elapsed_ns < expected_ns) {
+        fprintf(stderr, "%s: exchange took %lu us, expected at least %lu "
+                "us\n", name, (unsigned long) (elapsed_ns / 1000),
+                (unsigned long) (expected_ns / 1000));
+        return false;
+    }
+
+    return true;
+}
+
+static bool test_timing(void)
+{
+    TupSimLinkConfig config;
+    TupSimLatency latency = { TUP_SIM_LATENCY_FIXED, TEST_LATENCY_US, 0, 0 };
+    TestSetup setup;
+    bool success = false;
+    int ret;
+
+    tup_sim_link_config_init(&config);
+    config.bitrate = TEST_BITRATE;
+
+    if (!setup_init(&setup, &config))
+        goto done;
+
+    ret = tup_sim_link_set_latency(setup.link, TUP_MESSAGE_CMD_GET_VERSION,
+            &latency);
+    if (ret < 0) {
+        fprintf(stderr, "timing: failed to set the latency: %d\n", ret);
+        goto done;
+    }
+
+    if (!run_timing("bitrate", &setup, 10ULL * 1000000000 / TEST_BITRATE))
+        goto done;
+
+    /* the config of the host applies to the link, parity adds a bit */
+    ret = tup_context_set_config(setup.host, SMP_SERIAL_BAUDRATE_9600,
+            SMP_SERIAL_PARITY_EVEN, 0);
+    if (ret < 0) {
+        fprintf(stderr, "timing: failed to set the config: %d\n", ret);
+        goto done;
+    }
+
+    if (!run_timing("parity", &setup, 11ULL * 1000000000 / 9600))
+        goto done;
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    return success;
+}
+
+/* lost frames are counted and the request times out, the device is never
+ * served */
+static bool test_drop(void)
+{
+    TupSimLinkConfig config;
+    TupSimLinkStats stats;
+    TestSetup setup;
+    bool success = false;
+    int ret;
+
+    tup_sim_link_config_init(&config);
+    config.drop_rate = 1.0;
+
+    if (!setup_init(&setup, &config))
+        goto done;
+
+    tup_message_init_get_version(setup.msg);
+
+    ret = tup_context_send_request(setup.host, setup.msg, on_request_done,
+            &setup);
+    if (ret < 0) {
+        fprintf(stderr, "drop: failed to send: %d\n", ret);
+        goto done;
+    }
+
+    ret = tup_context_wait_requests(setup.host, 0, TEST_DROP_TIMEOUT_MS);
+    if (ret != SMP_ERROR_TIMEDOUT || setup.done != 1
+            || setup.status != TUP_REQUEST_STATUS_TIMEOUT) {
+        fprintf(stderr, "drop: request completed with %d, status %d\n", ret,
+                setup.status);
+        goto done;
+    }
+
+    tup_sim_link_get_stats(setup.link, &stats);
+    if (stats.n_dropped != 1 || stats.n_frames_to_host != 0) {
+        fprintf(stderr, "drop: %lu frames dropped and %lu answered, "
+                "expected 1 and 0\n", (unsigned long) stats.n_dropped,
+                (unsigned long) stats.n_frames_to_host);
+        goto done;
+    }
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    return success;
+}
+
+/* a write which doesn't fit in the RX FIFO overruns it, or is refused with
+ * flow control */
+static bool run_fifo(const char *name, int flow_control)
+{
+    TupSimLinkConfig config;
+    TupSimLinkStats stats;
+    TestSetup setup;
+    bool success = false;
+    int ret;
+
+    tup_sim_link_config_init(&config);
+    config.rx_fifo_size = 8;
+    config.flow_control = flow_control;
+
+    if (!setup_init(&setup, &config))
+        goto done;
+
+    tup_message_init_get_version(setup.msg);
+
+    /* an empty FIFO always accepts a frame */
+    ret = tup_context_send(setup.host, setup.msg);
+    if (ret < 0) {
+        fprintf(stderr, "%s: first send failed: %d\n", name, ret);
+        goto done;
+    }
+
+    ret = tup_context_send(setup.host, setup.msg);
+    if (ret != (flow_control ? SMP_ERROR_BUSY : 0)) {
+        fprintf(stderr, "%s: second send returned %d\n", name, ret);
+        goto done;
+    }
+
+    tup_sim_link_get_stats(setup.link, &stats);
+    if (stats.n_overruns != (flow_control ? 0 : 1)) {
+        fprintf(stderr, "%s: %lu overruns\n", name,
+                (unsigned long) stats.n_overruns);
+        goto done;
+    }
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    return success;
+}
+
+static bool test_fifo(void)
+{
+    return run_fifo("overrun", 0) && run_fifo("flow control", 1);
+}
+
+int main(int argc, char *argv[])
+{
+    if (!test_timing() || !test_drop() || !test_fifo())
+        return 1;
+
+    printf("simulated link takes the time of a UART\n");
+    return 0;
+}
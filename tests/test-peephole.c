@@ -0,0 +1,245 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <libtup.h>
+#include <libtupsim.h>
+
+#define TEST_N_PUMPS 16
+
+typedef struct
+{
+    unsigned int n_ok;
+    unsigned int n_failed;
+} TestRequests;
+
+typedef struct
+{
+    TupTransport *transports[2];
+    TupContext *host;
+    TupSimDevice *dev;
+    unsigned long n_received;
+} TestSetup;
+
+static void on_request_done(TupContext *ctx, TupMessageType cmd,
+        TupRequestStatus status, TupMessage *response, void *userdata)
+{
+    TestRequests *requests = userdata;
+
+    if (status == TUP_REQUEST_STATUS_OK) {
+        requests->n_ok++;
+    } else {
+        fprintf(stderr, "request %d completed with status %d\n", cmd, status);
+        requests->n_failed++;
+    }
+}
+
+static void on_host_message(TupContext *ctx, TupMessage *msg, void *userdata)
+{
+    TestSetup *setup = userdata;
+
+    setup->n_received++;
+}
+
+static bool setup_init(TestSetup *setup)
+{
+    TupCallbacks cbs = {
+        .new_message_cb = on_host_message,
+        .error_cb = NULL,
+    };
+    int ret;
+
+    setup->transports[0] = NULL;
+    setup->transports[1] = NULL;
+    setup->host = NULL;
+    setup->dev = NULL;
+    setup->n_received = 0;
+
+    ret = tup_transport_new_loopback(&setup->transports[0],
+            &setup->transports[1], 0);
+    if (ret < 0) {
+        fprintf(stderr, "failed to create loopback transports: %d\n", ret);
+        return false;
+    }
+
+    setup->host = tup_context_new_with_transport(setup->transports[0], &cbs,
+            setup);
+    setup->dev = tup_sim_device_new(setup->transports[1], NULL);
+    if (setup->host == NULL || setup->dev == NULL
+            || tup_sim_device_open(setup->dev, NULL) < 0) {
+        fprintf(stderr, "failed to create the host and the device\n");
+        return false;
+    }
+
+    /* merge as much as possible: everything stays in the write buffer until
+     * the next flush */
+    if (tup_context_set_write_combining(setup->host, 4096) < 0
+            || tup_context_enable_peephole(setup->host, true) < 0) {
+        fprintf(stderr, "failed to enable the peephole pass\n");
+        return false;
+    }
+
+    return true;
+}
+
+static void setup_clear(TestSetup *setup)
+{
+    if (setup->dev != NULL)
+        tup_sim_device_free(setup->dev);
+    else if (setup->transports[1] != NULL)
+        tup_transport_free(setup->transports[1]);
+
+    if (setup->host != NULL)
+        tup_context_free(setup->host);
+    else if (setup->transports[0] != NULL)
+        tup_transport_free(setup->transports[0]);
+}
+
+/* let the device answer everything written so far */
+static int pump(TestSetup *setup)
+{
+    TupContext *device = tup_sim_device_get_context(setup->dev);
+    int ret;
+    int i;
+
+    for (i = 0; i < TEST_N_PUMPS; i++) {
+        ret = tup_context_flush(setup->host);
+        if (ret < 0)
+            return ret;
+
+        ret = tup_context_process_fd(device);
+        if (ret < 0)
+            return ret;
+
+        ret = tup_context_process_fd(setup->host);
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+/* every command sent as a request gets its own response, even the ones the
+ * peephole pass would have dropped or merged */
+static bool test_requests(void)
+{
+    TestSetup setup;
+    TestRequests requests = { 0, 0 };
+    TupMessage *msgs[5] = { NULL };
+    bool success = false;
+    unsigned int i;
+    int ret;
+
+    if (!setup_init(&setup))
+        goto done;
+
+    for (i = 0; i < 5; i++) {
+        msgs[i] = tup_message_new();
+        if (msgs[i] == NULL) {
+            fprintf(stderr, "failed to create the messages\n");
+            goto done;
+        }
+    }
+
+    tup_message_init_load(msgs[0], 1, 0);
+    tup_message_init_play(msgs[1], 1);
+    tup_message_init_stop(msgs[2], 1);
+    tup_message_init_set_input_value_simple(msgs[3], 1, 0, 5);
+    tup_message_init_set_input_value_simple(msgs[4], 1, 0, 7);
+
+    for (i = 0; i < 5; i++) {
+        ret = tup_context_send_request(setup.host, msgs[i], on_request_done,
+                &requests);
+        if (ret < 0) {
+            fprintf(stderr, "failed to send request %u: %d\n", i, ret);
+            goto done;
+        }
+    }
+
+    ret = pump(&setup);
+    if (ret < 0) {
+        fprintf(stderr, "requests: pump failed: %d\n", ret);
+        goto done;
+    }
+
+    if (requests.n_ok != 5 || requests.n_failed != 0
+            || tup_context_get_n_pending_requests(setup.host) != 0) {
+        fprintf(stderr, "requests: %u ok, %u failed, %u pending, "
+                "expected 5 ok\n", requests.n_ok, requests.n_failed,
+                tup_context_get_n_pending_requests(setup.host));
+        goto done;
+    }
+
+    success = true;
+
+done:
+    for (i = 0; i < 5; i++) {
+        if (msgs[i] != NULL)
+            tup_message_free(msgs[i]);
+    }
+
+    setup_clear(&setup);
+    return success;
+}
+
+/* plain sends are still merged */
+static bool test_sends(void)
+{
+    TestSetup setup;
+    TupMessage *msg = NULL;
+    bool success = false;
+    int i;
+    int ret;
+
+    if (!setup_init(&setup))
+        goto done;
+
+    msg = tup_message_new();
+    if (msg == NULL) {
+        fprintf(stderr, "failed to create the message\n");
+        goto done;
+    }
+
+    for (i = 0; i < 4; i++) {
+        tup_message_init_set_input_value_simple(msg, 1, 0, i);
+
+        ret = tup_context_send(setup.host, msg);
+        if (ret < 0) {
+            fprintf(stderr, "failed to send: %d\n", ret);
+            goto done;
+        }
+    }
+
+    ret = pump(&setup);
+    if (ret < 0) {
+        fprintf(stderr, "sends: pump failed: %d\n", ret);
+        goto done;
+    }
+
+    if (setup.n_received != 1) {
+        fprintf(stderr, "sends: %lu responses, expected a single merged "
+                "update\n", setup.n_received);
+        goto done;
+    }
+
+    success = true;
+
+done:
+    if (msg != NULL)
+        tup_message_free(msg);
+
+    setup_clear(&setup);
+    return success;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!test_requests() || !test_sends())
+        return 1;
+
+    printf("peephole keeps requests as is\n");
+    return 0;
+}
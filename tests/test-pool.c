@@ -0,0 +1,235 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <libtup.h>
+
+#define N_ELEMENTS(arr) (sizeof((arr)) / sizeof((arr)[0]))
+
+#define TEST_POOL_SIZE 4
+#define TEST_CACHELINE_SIZE 64
+
+#define TEST_N_THREADS 4
+#define TEST_N_CYCLES 10000
+#define TEST_CACHE_SIZE 8
+
+typedef struct
+{
+    TupMessagePool *pool;
+    bool success;
+} TestThread;
+
+static bool check_stats(const char *name, TupMessagePool *pool,
+        size_t n_in_use, size_t high_water, uint64_t n_acquired,
+        uint64_t n_exhausted)
+{
+    TupMessagePoolStats stats;
+
+    tup_message_pool_get_stats(pool, &stats);
+    if (stats.n_in_use != n_in_use || stats.high_water != high_water
+            || stats.n_acquired != n_acquired
+            || stats.n_exhausted != n_exhausted) {
+        fprintf(stderr, "%s: %zu in use, high water %zu, %lu acquired, %lu "
+                "exhausted, expected %zu, %zu, %lu and %lu\n", name,
+                stats.n_in_use, stats.high_water,
+                (unsigned long) stats.n_acquired,
+                (unsigned long) stats.n_exhausted, n_in_use, high_water,
+                (unsigned long) n_acquired, (unsigned long) n_exhausted);
+        return false;
+    }
+
+    return true;
+}
+
+/* pool messages are distinct and on their own cache line, and an exhausted
+ * pool allocates */
+static bool test_acquire(void)
+{
+    TupMessage *msgs[TEST_POOL_SIZE + 1];
+    TupMessagePoolStats stats;
+    TupMessagePool *pool;
+    TupMessage *fresh;
+    TupMessage *msg;
+    bool success = false;
+    size_t n_acquired;
+    size_t i;
+
+    pool = tup_message_pool_new(TEST_POOL_SIZE);
+    fresh = tup_message_new();
+    if (pool == NULL || fresh == NULL) {
+        fprintf(stderr, "acquire: failed to create the pool\n");
+        goto done;
+    }
+
+    tup_message_pool_get_stats(pool, &stats);
+    if (stats.size != TEST_POOL_SIZE) {
+        fprintf(stderr, "acquire: pool size is %zu\n", stats.size);
+        goto done;
+    }
+
+    for (n_acquired = 0; n_acquired < N_ELEMENTS(msgs); n_acquired++) {
+        msgs[n_acquired] = tup_message_pool_acquire(pool);
+        if (msgs[n_acquired] == NULL) {
+            fprintf(stderr, "acquire: failed to acquire %zu\n", n_acquired);
+            goto release;
+        }
+
+        for (i = 0; i < n_acquired; i++) {
+            if (msgs[i] == msgs[n_acquired]) {
+                fprintf(stderr, "acquire: %zu and %zu are the same\n", i,
+                        n_acquired);
+                goto release;
+            }
+        }
+    }
+
+    for (i = 0; i < TEST_POOL_SIZE; i++) {
+        if ((uintptr_t) msgs[i] % TEST_CACHELINE_SIZE != 0) {
+            fprintf(stderr, "acquire: message %zu isn't aligned\n", i);
+            goto release;
+        }
+    }
+
+    if (!check_stats("acquire", pool, TEST_POOL_SIZE + 1, TEST_POOL_SIZE + 1,
+                TEST_POOL_SIZE + 1, 1))
+        goto release;
+
+    tup_message_init_get_version(msgs[TEST_POOL_SIZE - 1]);
+    success = true;
+
+release:
+    for (i = 0; i < n_acquired; i++)
+        tup_message_pool_release(pool, msgs[i]);
+
+    if (!success)
+        goto done;
+
+    success = false;
+
+    /* the message allocated on exhaustion was freed */
+    if (!check_stats("release", pool, 0, TEST_POOL_SIZE + 1,
+                TEST_POOL_SIZE + 1, 1))
+        goto done;
+
+    /* the last released pool message comes back first, cleared */
+    msg = tup_message_pool_acquire(pool);
+    if (msg != msgs[TEST_POOL_SIZE - 1]
+            || tup_message_get_type(msg) != tup_message_get_type(fresh)) {
+        fprintf(stderr, "acquire: released message isn't reused cleared\n");
+        goto done;
+    }
+
+    tup_message_pool_release(pool, msg);
+    success = true;
+
+done:
+    if (fresh != NULL)
+        tup_message_free(fresh);
+
+    if (pool != NULL)
+        tup_message_pool_free(pool);
+
+    return success;
+}
+
+static void *cache_thread(void *userdata)
+{
+    TestThread *thread = userdata;
+    TupMessagePoolCache *cache;
+    TupMessage *msgs[2];
+    int i;
+
+    cache = tup_message_pool_cache_new(thread->pool, TEST_CACHE_SIZE);
+    if (cache == NULL)
+        return NULL;
+
+    thread->success = true;
+
+    for (i = 0; i < TEST_N_CYCLES && thread->success; i++) {
+        msgs[0] = tup_message_pool_cache_acquire(cache);
+        msgs[1] = tup_message_pool_cache_acquire(cache);
+        if (msgs[0] == NULL || msgs[1] == NULL || msgs[0] == msgs[1]) {
+            thread->success = false;
+            break;
+        }
+
+        tup_message_init_load(msgs[0], 1, i);
+        tup_message_init_get_version(msgs[1]);
+
+        tup_message_pool_cache_release(cache, msgs[1]);
+        tup_message_pool_cache_release(cache, msgs[0]);
+    }
+
+    tup_message_pool_cache_free(cache);
+    return NULL;
+}
+
+/* threads sharing a pool through their caches never exhaust it and every
+ * acquire is counted once the caches are freed */
+static bool test_caches(void)
+{
+    TestThread threads[TEST_N_THREADS];
+    pthread_t ids[TEST_N_THREADS];
+    TupMessagePoolStats stats;
+    TupMessagePool *pool;
+    bool success = true;
+    size_t n_started;
+    size_t i;
+
+    /* a cache keeps at most its size plus what its thread holds */
+    pool = tup_message_pool_new(TEST_N_THREADS * (TEST_CACHE_SIZE + 2));
+    if (pool == NULL) {
+        fprintf(stderr, "caches: failed to create the pool\n");
+        return false;
+    }
+
+    for (n_started = 0; n_started < TEST_N_THREADS; n_started++) {
+        threads[n_started].pool = pool;
+        threads[n_started].success = false;
+
+        if (pthread_create(&ids[n_started], NULL, cache_thread,
+                    &threads[n_started]) != 0) {
+            fprintf(stderr, "caches: failed to create thread %zu\n",
+                    n_started);
+            success = false;
+            break;
+        }
+    }
+
+    for (i = 0; i < n_started; i++) {
+        pthread_join(ids[i], NULL);
+
+        if (!threads[i].success) {
+            fprintf(stderr, "caches: thread %zu failed\n", i);
+            success = false;
+        }
+    }
+
+    tup_message_pool_get_stats(pool, &stats);
+    if (success && (stats.n_in_use != 0 || stats.n_exhausted != 0
+                || stats.n_acquired != 2ULL * TEST_N_THREADS * TEST_N_CYCLES
+                || stats.high_water > stats.size)) {
+        fprintf(stderr, "caches: %zu in use, %lu acquired, %lu exhausted, "
+                "high water %zu\n", stats.n_in_use,
+                (unsigned long) stats.n_acquired,
+                (unsigned long) stats.n_exhausted, stats.high_water);
+        success = false;
+    }
+
+    tup_message_pool_free(pool);
+    return success;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!test_acquire() || !test_caches())
+        return 1;
+
+    printf("message pool recycles its messages\n");
+    return 0;
+}
@@ -0,0 +1,322 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <libtup.h>
+#include <libtupsim.h>
+
+#define N_ELEMENTS(arr) (sizeof((arr)) / sizeof((arr)[0]))
+
+#define TEST_N_PUMPS 64
+#define TEST_N_SENDS 100
+
+/* enough for an escaped set_input_value */
+#define TEST_FRAME_SIZE 64
+
+typedef struct
+{
+    int sv[2];
+    TupContext *host;
+    TupSimDevice *dev;
+    TupMessage *msg;
+    TupPreparedMessage *prepared;
+} TestSetup;
+
+/* the host and the device talk through a raw socketpair so that the frames
+ * the host writes can be read back */
+static bool setup_init(TestSetup *setup)
+{
+    TupTransport *transport;
+
+    memset(setup, 0, sizeof(*setup));
+    setup->sv[0] = -1;
+    setup->sv[1] = -1;
+
+    setup->msg = tup_message_new();
+    if (setup->msg == NULL) {
+        fprintf(stderr, "failed to create the message\n");
+        return false;
+    }
+
+    /* the value is patched before each send */
+    tup_message_init_set_input_value_simple(setup->msg, 1, 0, 0);
+    setup->prepared = tup_prepared_message_new(setup->msg);
+    if (setup->prepared == NULL) {
+        fprintf(stderr, "failed to create the prepared message\n");
+        return false;
+    }
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, setup->sv) < 0) {
+        fprintf(stderr, "failed to create a socketpair\n");
+        return false;
+    }
+
+    transport = tup_transport_new_fd(setup->sv[0], setup->sv[0]);
+    if (transport == NULL)
+        return false;
+
+    setup->host = tup_context_new_with_transport(transport, NULL, NULL);
+    if (setup->host == NULL) {
+        tup_transport_free(transport);
+        setup->sv[0] = -1;
+        return false;
+    }
+
+    transport = tup_transport_new_fd(setup->sv[1], setup->sv[1]);
+    if (transport == NULL)
+        return false;
+
+    setup->dev = tup_sim_device_new(transport, NULL);
+    if (setup->dev == NULL) {
+        tup_transport_free(transport);
+        setup->sv[1] = -1;
+        return false;
+    }
+
+    return tup_sim_device_open(setup->dev, NULL) == 0;
+}
+
+static void setup_clear(TestSetup *setup)
+{
+    if (setup->dev != NULL)
+        tup_sim_device_free(setup->dev);
+    else if (setup->sv[1] >= 0)
+        close(setup->sv[1]);
+
+    if (setup->host != NULL)
+        tup_context_free(setup->host);
+    else if (setup->sv[0] >= 0)
+        close(setup->sv[0]);
+
+    if (setup->prepared != NULL)
+        tup_prepared_message_free(setup->prepared);
+
+    if (setup->msg != NULL)
+        tup_message_free(setup->msg);
+}
+
+static int pump_device(TestSetup *setup)
+{
+    TupContext *device = tup_sim_device_get_context(setup->dev);
+    int ret;
+    int i;
+
+    for (i = 0; i < TEST_N_PUMPS; i++) {
+        ret = tup_context_process_fd(device);
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+/* a patched frame is the one a message with the new value gives, escaping
+ * and checksum included */
+static bool test_frames(void)
+{
+    const int32_t values[] = { 0, 42, 0x10ff1b10, -1, 0x1b1b1b1b, 7 };
+    uint8_t expected[TEST_FRAME_SIZE];
+    uint8_t frame[TEST_FRAME_SIZE];
+    TupInputValueArgs args[1];
+    TestSetup setup;
+    bool success = false;
+    uint8_t slot_id;
+    ssize_t expected_size;
+    ssize_t size;
+    size_t i;
+    int ret;
+
+    if (!setup_init(&setup)) {
+        fprintf(stderr, "frames: failed to create the host and the device\n");
+        goto done;
+    }
+
+    for (i = 0; i < N_ELEMENTS(values); i++) {
+        ret = tup_prepared_message_set_int32(setup.prepared, 2, values[i]);
+        if (ret == 0)
+            ret = tup_context_send_prepared(setup.host, setup.prepared);
+
+        if (ret < 0) {
+            fprintf(stderr, "frames: failed to send %d: %d\n", values[i],
+                    ret);
+            goto done;
+        }
+
+        size = read(setup.sv[1], frame, sizeof(frame));
+
+        tup_message_clear(setup.msg);
+        tup_message_init_set_input_value_simple(setup.msg, 1, 0, values[i]);
+        ret = tup_context_send(setup.host, setup.msg);
+        if (ret < 0) {
+            fprintf(stderr, "frames: failed to send the message: %d\n", ret);
+            goto done;
+        }
+
+        expected_size = read(setup.sv[1], expected, sizeof(expected));
+
+        if (size <= 0 || size != expected_size
+                || memcmp(frame, expected, size) != 0) {
+            fprintf(stderr, "frames: frame of %d differs from the message "
+                    "one\n", values[i]);
+            goto done;
+        }
+
+        /* the message follows the patched value */
+        ret = tup_message_parse_set_input_value(
+                tup_prepared_message_get_message(setup.prepared), &slot_id,
+                args, N_ELEMENTS(args));
+        if (ret != 1 || args[0].input_value != values[i]) {
+            fprintf(stderr, "frames: message has %d, expected %d\n",
+                    args[0].input_value, values[i]);
+            goto done;
+        }
+    }
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    return success;
+}
+
+/* only values of the argument type can be set */
+static bool test_invalid(void)
+{
+    TupPreparedMessage *prepared = NULL;
+    TupMessage *msg;
+    SmpValue value;
+    bool success = false;
+    int ret;
+
+    msg = tup_message_new();
+    if (msg == NULL)
+        return false;
+
+    tup_message_init_set_input_value_simple(msg, 1, 0, 0);
+    prepared = tup_prepared_message_new(msg);
+    if (prepared == NULL) {
+        fprintf(stderr, "invalid: failed to create the prepared message\n");
+        goto done;
+    }
+
+    ret = tup_prepared_message_set_uint32(prepared, 2, 1);
+    if (ret != SMP_ERROR_BAD_TYPE) {
+        fprintf(stderr, "invalid: wrong type gave %d\n", ret);
+        goto done;
+    }
+
+    ret = tup_prepared_message_set_int32(prepared, 3, 1);
+    if (ret != SMP_ERROR_NOT_FOUND) {
+        fprintf(stderr, "invalid: wrong index gave %d\n", ret);
+        goto done;
+    }
+
+    tup_prepared_message_free(prepared);
+
+    tup_message_clear(msg);
+    tup_message_init_resp_version(msg, "1.0");
+    prepared = tup_prepared_message_new(msg);
+    if (prepared == NULL) {
+        fprintf(stderr, "invalid: failed to create the prepared message\n");
+        goto done;
+    }
+
+    value.type = SMP_TYPE_STRING;
+    value.value.cstring = "2.0";
+    ret = tup_prepared_message_set_value(prepared, 0, &value);
+    if (ret != SMP_ERROR_NOT_SUPPORTED) {
+        fprintf(stderr, "invalid: string gave %d\n", ret);
+        goto done;
+    }
+
+    success = true;
+
+done:
+    if (prepared != NULL)
+        tup_prepared_message_free(prepared);
+
+    tup_message_free(msg);
+    return success;
+}
+
+/* the device executes every prepared send */
+static bool test_device(void)
+{
+    TupInputValueArgs args[1];
+    TupSimDeviceStats stats;
+    TupMessage *response;
+    TestSetup setup;
+    bool success = false;
+    uint8_t slot_id;
+    int ret;
+    int i;
+
+    response = tup_message_new();
+    if (response == NULL)
+        return false;
+
+    if (!setup_init(&setup)) {
+        fprintf(stderr, "device: failed to create the host and the device\n");
+        goto done;
+    }
+
+    tup_message_clear(setup.msg);
+    tup_message_init_load(setup.msg, 1, 0);
+    ret = tup_context_send(setup.host, setup.msg);
+
+    for (i = 1; i <= TEST_N_SENDS && ret == 0; i++) {
+        ret = tup_prepared_message_set_int32(setup.prepared, 2, i);
+        if (ret == 0)
+            ret = tup_context_send_prepared(setup.host, setup.prepared);
+
+        if (ret == 0 && i % 10 == 0)
+            ret = pump_device(&setup);
+    }
+
+    if (ret < 0) {
+        fprintf(stderr, "device: failed to send: %d\n", ret);
+        goto done;
+    }
+
+    tup_sim_device_get_stats(setup.dev, &stats);
+    if (stats.n_commands != TEST_N_SENDS + 1) {
+        fprintf(stderr, "device: got %lu commands, expected %d\n",
+                (unsigned long) stats.n_commands, TEST_N_SENDS + 1);
+        goto done;
+    }
+
+    tup_message_clear(setup.msg);
+    tup_message_init_get_input_value_simple(setup.msg, 1, 0);
+
+    ret = tup_sim_device_handle_message(setup.dev, setup.msg, response);
+    if (ret == 0)
+        ret = tup_message_parse_resp_input(response, &slot_id, args, 1);
+
+    if (ret != 1 || args[0].input_value != TEST_N_SENDS) {
+        fprintf(stderr, "device: input is %d, expected %d\n",
+                args[0].input_value, TEST_N_SENDS);
+        goto done;
+    }
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    tup_message_free(response);
+    return success;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!test_frames() || !test_invalid() || !test_device())
+        return 1;
+
+    printf("prepared messages send their patched values\n");
+    return 0;
+}
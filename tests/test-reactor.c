@@ -0,0 +1,210 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <libtup.h>
+#include <libtupsim.h>
+
+#define TEST_N_DEVICES 2
+
+/* time after which the other thread stops the reactor */
+#define TEST_QUIT_DELAY_US 100000
+
+typedef struct
+{
+    TupTransport *transports[2];
+    TupContext *host;
+    TupSimDevice *dev;
+} TestLink;
+
+typedef struct
+{
+    TupReactor *reactor;
+    TestLink links[TEST_N_DEVICES];
+    unsigned int n_ok;
+} TestSetup;
+
+static void on_request_done(TupContext *ctx, TupMessageType cmd,
+        TupRequestStatus status, TupMessage *response, void *userdata)
+{
+    TestSetup *setup = userdata;
+
+    if (status == TUP_REQUEST_STATUS_OK)
+        setup->n_ok++;
+    else
+        fprintf(stderr, "request %d completed with status %d\n", cmd, status);
+}
+
+static bool link_init(TestSetup *setup, TestLink *link)
+{
+    int ret;
+
+    ret = tup_transport_new_socketpair(&link->transports[0],
+            &link->transports[1]);
+    if (ret < 0) {
+        fprintf(stderr, "failed to create socketpair transports: %d\n", ret);
+        return false;
+    }
+
+    link->host = tup_context_new_with_transport(link->transports[0], NULL,
+            NULL);
+    link->dev = tup_sim_device_new(link->transports[1], NULL);
+    if (link->host == NULL || link->dev == NULL
+            || tup_sim_device_open(link->dev, NULL) < 0) {
+        fprintf(stderr, "failed to create the host and the device\n");
+        return false;
+    }
+
+    ret = tup_reactor_add_context(setup->reactor, link->host);
+    if (ret == 0) {
+        ret = tup_reactor_add_context(setup->reactor,
+                tup_sim_device_get_context(link->dev));
+    }
+
+    if (ret < 0) {
+        fprintf(stderr, "failed to add the contexts: %d\n", ret);
+        return false;
+    }
+
+    return true;
+}
+
+static void link_clear(TestSetup *setup, TestLink *link)
+{
+    if (link->dev != NULL) {
+        tup_reactor_remove_context(setup->reactor,
+                tup_sim_device_get_context(link->dev));
+        tup_sim_device_free(link->dev);
+    } else if (link->transports[1] != NULL) {
+        tup_transport_free(link->transports[1]);
+    }
+
+    if (link->host != NULL) {
+        tup_reactor_remove_context(setup->reactor, link->host);
+        tup_context_free(link->host);
+    } else if (link->transports[0] != NULL) {
+        tup_transport_free(link->transports[0]);
+    }
+}
+
+static bool setup_init(TestSetup *setup)
+{
+    int i;
+
+    setup->n_ok = 0;
+
+    for (i = 0; i < TEST_N_DEVICES; i++) {
+        setup->links[i].transports[0] = NULL;
+        setup->links[i].transports[1] = NULL;
+        setup->links[i].host = NULL;
+        setup->links[i].dev = NULL;
+    }
+
+    setup->reactor = tup_reactor_new();
+    if (setup->reactor == NULL) {
+        fprintf(stderr, "failed to create the reactor\n");
+        return false;
+    }
+
+    for (i = 0; i < TEST_N_DEVICES; i++) {
+        if (!link_init(setup, &setup->links[i]))
+            return false;
+    }
+
+    return true;
+}
+
+static void setup_clear(TestSetup *setup)
+{
+    int i;
+
+    if (setup->reactor == NULL)
+        return;
+
+    for (i = 0; i < TEST_N_DEVICES; i++)
+        link_clear(setup, &setup->links[i]);
+
+    tup_reactor_free(setup->reactor);
+}
+
+static void *quit_thread(void *userdata)
+{
+    TupReactor *reactor = userdata;
+
+    usleep(TEST_QUIT_DELAY_US);
+    tup_reactor_quit(reactor);
+    return NULL;
+}
+
+/* a single thread answers the requests of every host, then the reactor is
+ * stopped from another thread while it waits */
+static bool test_run(void)
+{
+    TestSetup setup;
+    TupMessage *msg;
+    pthread_t thread;
+    bool success = false;
+    int ret;
+    int i;
+
+    msg = tup_message_new();
+    if (msg == NULL) {
+        fprintf(stderr, "failed to create the message\n");
+        return false;
+    }
+
+    if (!setup_init(&setup))
+        goto done;
+
+    for (i = 0; i < TEST_N_DEVICES; i++) {
+        tup_message_clear(msg);
+        tup_message_init_get_version(msg);
+
+        ret = tup_context_send_request(setup.links[i].host, msg,
+                on_request_done, &setup);
+        if (ret < 0) {
+            fprintf(stderr, "failed to send request %d: %d\n", i, ret);
+            goto done;
+        }
+    }
+
+    if (pthread_create(&thread, NULL, quit_thread, setup.reactor) != 0) {
+        fprintf(stderr, "failed to create the thread\n");
+        goto done;
+    }
+
+    ret = tup_reactor_run(setup.reactor);
+    pthread_join(thread, NULL);
+
+    if (ret < 0) {
+        fprintf(stderr, "failed to run the reactor: %d\n", ret);
+        goto done;
+    }
+
+    if (setup.n_ok != TEST_N_DEVICES) {
+        fprintf(stderr, "%u requests completed, expected %d\n", setup.n_ok,
+                TEST_N_DEVICES);
+        goto done;
+    }
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    tup_message_free(msg);
+    return success;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!test_run())
+        return 1;
+
+    printf("reactor serves every device and quits from another thread\n");
+    return 0;
+}
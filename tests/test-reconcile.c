@@ -0,0 +1,322 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <libtup.h>
+#include <libtupsim.h>
+
+#define TEST_TIMEOUT_MS 1000
+
+typedef struct
+{
+    TupContext *host;
+    TupSimDevice *dev;
+    TupSimulator *sim;
+    pthread_t thread;
+    bool running;
+} TestSetup;
+
+static void *device_thread(void *userdata)
+{
+    TupSimulator *sim = userdata;
+
+    tup_simulator_run(sim);
+    return NULL;
+}
+
+/* the device is served from another thread while the host waits for the
+ * responses */
+static bool setup_init(TestSetup *setup)
+{
+    TupTransport *host_transport;
+    TupTransport *device_transport;
+    int ret;
+
+    memset(setup, 0, sizeof(*setup));
+
+    setup->sim = tup_simulator_new();
+    if (setup->sim == NULL) {
+        fprintf(stderr, "failed to create the simulator\n");
+        return false;
+    }
+
+    ret = tup_transport_new_socketpair(&host_transport, &device_transport);
+    if (ret < 0) {
+        fprintf(stderr, "failed to create socketpair transports: %d\n", ret);
+        return false;
+    }
+
+    setup->host = tup_context_new_with_transport(host_transport, NULL, NULL);
+    if (setup->host == NULL) {
+        tup_transport_free(host_transport);
+        tup_transport_free(device_transport);
+        fprintf(stderr, "failed to create the host\n");
+        return false;
+    }
+
+    setup->dev = tup_sim_device_new(device_transport, NULL);
+    if (setup->dev == NULL) {
+        tup_transport_free(device_transport);
+        fprintf(stderr, "failed to create the device\n");
+        return false;
+    }
+
+    ret = tup_sim_device_open(setup->dev, NULL);
+    if (ret == 0)
+        ret = tup_simulator_add_device(setup->sim, setup->dev);
+
+    if (ret < 0) {
+        tup_sim_device_free(setup->dev);
+        setup->dev = NULL;
+        fprintf(stderr, "failed to add the device: %d\n", ret);
+        return false;
+    }
+
+    if (pthread_create(&setup->thread, NULL, device_thread, setup->sim) != 0) {
+        fprintf(stderr, "failed to create the thread\n");
+        return false;
+    }
+
+    setup->running = true;
+    return true;
+}
+
+/* the device can be inspected once stopped */
+static void setup_stop(TestSetup *setup)
+{
+    if (!setup->running)
+        return;
+
+    tup_simulator_quit(setup->sim);
+    pthread_join(setup->thread, NULL);
+    setup->running = false;
+}
+
+static void setup_clear(TestSetup *setup)
+{
+    setup_stop(setup);
+
+    /* frees the device */
+    if (setup->sim != NULL)
+        tup_simulator_free(setup->sim);
+
+    if (setup->host != NULL)
+        tup_context_free(setup->host);
+}
+
+static int get_device_parameter(TestSetup *setup, uint8_t parameter_id,
+        uint32_t *value)
+{
+    TupParameterArgs args[1];
+    TupMessage *command;
+    TupMessage *response;
+    uint8_t effect_id;
+    int ret = SMP_ERROR_NO_MEM;
+
+    command = tup_message_new();
+    response = tup_message_new();
+
+    if (command != NULL && response != NULL) {
+        tup_message_init_get_parameter_simple(command, 1, parameter_id);
+        ret = tup_sim_device_handle_message(setup->dev, command, response);
+    }
+
+    if (ret == 0)
+        ret = tup_message_parse_resp_parameter(response, &effect_id, args, 1);
+
+    if (ret == 1)
+        *value = args[0].parameter_value;
+
+    if (response != NULL)
+        tup_message_free(response);
+
+    if (command != NULL)
+        tup_message_free(command);
+
+    return (ret == 1) ? 0 : SMP_ERROR_BAD_MESSAGE;
+}
+
+static int init_config(TupDeviceConfig *config)
+{
+    const float a[5] = { 1.0f, 0.5f, 0.0f, 0.0f, 0.0f };
+    const float b[5] = { 0.25f, 0.0f, 0.0f, 0.0f, 0.0f };
+    int ret;
+
+    ret = tup_device_config_set_slot(config, 1, 3);
+    if (ret == 0)
+        ret = tup_device_config_set_binding(config, 1, 0x1);
+
+    if (ret == 0)
+        ret = tup_device_config_set_parameter(config, 1, 0, 10);
+
+    if (ret == 0)
+        ret = tup_device_config_set_parameter(config, 1, 1, 20);
+
+    if (ret == 0)
+        ret = tup_device_config_set_filter_active(config,
+                TUP_FILTER_ID_BAND_NORM, 0, true);
+
+    if (ret == 0)
+        ret = tup_device_config_set_band_norm_coeffs(config, 1, a, b);
+
+    return ret;
+}
+
+static bool check_reconcile(const char *name, TestSetup *setup,
+        TupDeviceConfig *config, int expected)
+{
+    int ret;
+
+    ret = tup_context_reconcile(setup->host, config, TEST_TIMEOUT_MS);
+    if (ret != expected) {
+        fprintf(stderr, "%s: reconcile returned %d, expected %d\n", name, ret,
+                expected);
+        return false;
+    }
+
+    return true;
+}
+
+/* with shadow state, only what differs from the known state is sent */
+static bool test_diff(void)
+{
+    TupDeviceConfig *config;
+    TestSetup setup;
+    uint32_t values[2] = { 0, 0 };
+    bool success = false;
+    int ret;
+
+    config = tup_device_config_new();
+    if (config == NULL) {
+        fprintf(stderr, "diff: failed to create the config\n");
+        return false;
+    }
+
+    if (!setup_init(&setup))
+        goto done;
+
+    ret = tup_context_enable_shadow(setup.host, true);
+    if (ret == 0)
+        ret = init_config(config);
+
+    if (ret < 0) {
+        fprintf(stderr, "diff: failed to init: %d\n", ret);
+        goto done;
+    }
+
+    /* LOAD, BIND_EFFECT, a single SET_PARAMETER, FILTER_SET_ACTIVE and
+     * CONFIG_BAND_NORM_SET_COEFFS */
+    if (!check_reconcile("diff", &setup, config, 5)
+            || !check_reconcile("diff again", &setup, config, 0))
+        goto done;
+
+    ret = tup_device_config_set_parameter(config, 1, 1, 21);
+    if (ret < 0) {
+        fprintf(stderr, "diff: failed to set the parameter: %d\n", ret);
+        goto done;
+    }
+
+    if (!check_reconcile("diff parameter", &setup, config, 1))
+        goto done;
+
+    setup_stop(&setup);
+
+    if (get_device_parameter(&setup, 0, &values[0]) < 0
+            || get_device_parameter(&setup, 1, &values[1]) < 0
+            || values[0] != 10 || values[1] != 21) {
+        fprintf(stderr, "diff: device parameters are %u and %u, expected 10 "
+                "and 21\n", values[0], values[1]);
+        goto done;
+    }
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    tup_device_config_free(config);
+    return success;
+}
+
+/* without shadow state, the whole configuration is sent each time */
+static bool test_no_shadow(void)
+{
+    TupDeviceConfig *config;
+    TestSetup setup;
+    bool success = false;
+    int ret;
+
+    config = tup_device_config_new();
+    if (config == NULL) {
+        fprintf(stderr, "no shadow: failed to create the config\n");
+        return false;
+    }
+
+    if (!setup_init(&setup))
+        goto done;
+
+    ret = init_config(config);
+    if (ret < 0) {
+        fprintf(stderr, "no shadow: failed to init: %d\n", ret);
+        goto done;
+    }
+
+    if (!check_reconcile("no shadow", &setup, config, 5)
+            || !check_reconcile("no shadow again", &setup, config, 5))
+        goto done;
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    tup_device_config_free(config);
+    return success;
+}
+
+/* commands rejected by the device fail the reconciliation */
+static bool test_rejected(void)
+{
+    TupDeviceConfig *config;
+    TestSetup setup;
+    bool success = false;
+    int ret;
+
+    config = tup_device_config_new();
+    if (config == NULL) {
+        fprintf(stderr, "rejected: failed to create the config\n");
+        return false;
+    }
+
+    if (!setup_init(&setup))
+        goto done;
+
+    /* out of the slots of the simulated device */
+    ret = tup_device_config_set_slot(config, 200, 3);
+    if (ret < 0) {
+        fprintf(stderr, "rejected: failed to init: %d\n", ret);
+        goto done;
+    }
+
+    if (!check_reconcile("rejected", &setup, config, SMP_ERROR_IO))
+        goto done;
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    tup_device_config_free(config);
+    return success;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!test_diff() || !test_no_shadow() || !test_rejected())
+        return 1;
+
+    printf("reconciliation only sends what differs\n");
+    return 0;
+}
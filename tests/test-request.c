@@ -0,0 +1,374 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <libtup.h>
+#include <libtupsim.h>
+
+#define N_ELEMENTS(arr) (sizeof((arr)) / sizeof((arr)[0]))
+
+#define TEST_N_PUMPS 16
+#define TEST_TIMEOUT_MS 1000
+
+/* short enough to keep the test fast, the device is never pumped */
+#define TEST_LOST_TIMEOUT_MS 20
+
+typedef struct
+{
+    TupRequestStatus expected_status;
+    TupMessageType expected_response;
+
+    int done;
+    TupRequestStatus status;
+    TupMessageType response;
+} TestRequest;
+
+typedef struct
+{
+    TupTransport *transports[2];
+    TupContext *host;
+    TupSimDevice *dev;
+    TupMessage *msg;
+    unsigned long n_received;
+} TestSetup;
+
+static void on_request_done(TupContext *ctx, TupMessageType cmd,
+        TupRequestStatus status, TupMessage *response, void *userdata)
+{
+    TestRequest *request = userdata;
+
+    request->done++;
+    request->status = status;
+    request->response = (response != NULL) ? tup_message_get_type(response)
+        : 0;
+}
+
+static void on_host_message(TupContext *ctx, TupMessage *msg, void *userdata)
+{
+    TestSetup *setup = userdata;
+
+    setup->n_received++;
+}
+
+static bool setup_init(TestSetup *setup)
+{
+    TupCallbacks cbs = {
+        .new_message_cb = on_host_message,
+        .error_cb = NULL,
+    };
+    int ret;
+
+    setup->transports[0] = NULL;
+    setup->transports[1] = NULL;
+    setup->host = NULL;
+    setup->dev = NULL;
+    setup->n_received = 0;
+
+    setup->msg = tup_message_new();
+    if (setup->msg == NULL) {
+        fprintf(stderr, "failed to create the message\n");
+        return false;
+    }
+
+    ret = tup_transport_new_loopback(&setup->transports[0],
+            &setup->transports[1], 0);
+    if (ret < 0) {
+        fprintf(stderr, "failed to create loopback transports: %d\n", ret);
+        return false;
+    }
+
+    setup->host = tup_context_new_with_transport(setup->transports[0], &cbs,
+            setup);
+    setup->dev = tup_sim_device_new(setup->transports[1], NULL);
+    if (setup->host == NULL || setup->dev == NULL
+            || tup_sim_device_open(setup->dev, NULL) < 0) {
+        fprintf(stderr, "failed to create the host and the device\n");
+        return false;
+    }
+
+    return true;
+}
+
+static void setup_clear(TestSetup *setup)
+{
+    if (setup->dev != NULL)
+        tup_sim_device_free(setup->dev);
+    else if (setup->transports[1] != NULL)
+        tup_transport_free(setup->transports[1]);
+
+    if (setup->host != NULL)
+        tup_context_free(setup->host);
+    else if (setup->transports[0] != NULL)
+        tup_transport_free(setup->transports[0]);
+
+    if (setup->msg != NULL)
+        tup_message_free(setup->msg);
+}
+
+/* let the device answer everything written so far */
+static int pump_device(TestSetup *setup)
+{
+    TupContext *device = tup_sim_device_get_context(setup->dev);
+    int ret;
+    int i;
+
+    for (i = 0; i < TEST_N_PUMPS; i++) {
+        ret = tup_context_process_fd(device);
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+static int send_request(TestSetup *setup, TestRequest *request)
+{
+    request->done = 0;
+    return tup_context_send_request(setup->host, setup->msg,
+            on_request_done, request);
+}
+
+static bool check_request(const char *name, TestRequest *request)
+{
+    if (request->done != 1) {
+        fprintf(stderr, "%s: completed %d times\n", name, request->done);
+        return false;
+    }
+
+    if (request->status != request->expected_status
+            || request->response != request->expected_response) {
+        fprintf(stderr, "%s: completed with status %d and response %d, "
+                "expected %d and %d\n", name, request->status,
+                request->response, request->expected_status,
+                request->expected_response);
+        return false;
+    }
+
+    return true;
+}
+
+/* responses are matched back to their request, whatever their type, and
+ * are not passed to new_message_cb */
+static bool test_matching(void)
+{
+    TestRequest requests[] = {
+        { TUP_REQUEST_STATUS_OK, TUP_MESSAGE_ACK, 0, 0, 0 },
+        { TUP_REQUEST_STATUS_ERROR, TUP_MESSAGE_ERROR, 0, 0, 0 },
+        { TUP_REQUEST_STATUS_OK, TUP_MESSAGE_RESP_VERSION, 0, 0, 0 },
+        { TUP_REQUEST_STATUS_OK, TUP_MESSAGE_ACK, 0, 0, 0 },
+        { TUP_REQUEST_STATUS_OK, TUP_MESSAGE_RESP_PARAMETER, 0, 0, 0 },
+    };
+    TestSetup setup;
+    bool success = false;
+    size_t i;
+    int ret;
+
+    if (!setup_init(&setup))
+        goto done;
+
+    for (i = 0; i < N_ELEMENTS(requests); i++) {
+        tup_message_clear(setup.msg);
+
+        switch (i) {
+            case 0:
+                tup_message_init_load(setup.msg, 1, 0);
+                break;
+            case 1:
+                /* nothing is loaded in slot 2 */
+                tup_message_init_play(setup.msg, 2);
+                break;
+            case 2:
+                tup_message_init_get_version(setup.msg);
+                break;
+            case 3:
+                tup_message_init_play(setup.msg, 1);
+                break;
+            default:
+                tup_message_init_get_parameter_simple(setup.msg, 1, 0);
+                break;
+        }
+
+        ret = send_request(&setup, &requests[i]);
+        if (ret < 0) {
+            fprintf(stderr, "matching: failed to send request %zu: %d\n", i,
+                    ret);
+            goto done;
+        }
+    }
+
+    if (tup_context_get_n_pending_requests(setup.host)
+            != N_ELEMENTS(requests)) {
+        fprintf(stderr, "matching: %u pending requests, expected %zu\n",
+                tup_context_get_n_pending_requests(setup.host),
+                N_ELEMENTS(requests));
+        goto done;
+    }
+
+    ret = pump_device(&setup);
+    if (ret == 0)
+        ret = tup_context_wait_requests(setup.host, 0, TEST_TIMEOUT_MS);
+
+    if (ret < 0) {
+        fprintf(stderr, "matching: failed to wait the requests: %d\n", ret);
+        goto done;
+    }
+
+    for (i = 0; i < N_ELEMENTS(requests); i++) {
+        if (!check_request("matching", &requests[i]))
+            goto done;
+    }
+
+    if (setup.n_received != 0) {
+        fprintf(stderr, "matching: %lu responses passed to new_message_cb\n",
+                setup.n_received);
+        goto done;
+    }
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    return success;
+}
+
+/* no more requests than the window are in flight */
+static bool test_window(void)
+{
+    TestRequest requests[3];
+    TestSetup setup;
+    bool success = false;
+    size_t i;
+    int ret;
+
+    if (!setup_init(&setup))
+        goto done;
+
+    ret = tup_context_set_request_window(setup.host, 2);
+    if (ret < 0) {
+        fprintf(stderr, "window: failed to set the window: %d\n", ret);
+        goto done;
+    }
+
+    tup_message_init_get_version(setup.msg);
+
+    for (i = 0; i < N_ELEMENTS(requests); i++) {
+        requests[i].expected_status = TUP_REQUEST_STATUS_OK;
+        requests[i].expected_response = TUP_MESSAGE_RESP_VERSION;
+    }
+
+    ret = send_request(&setup, &requests[0]);
+    if (ret == 0)
+        ret = send_request(&setup, &requests[1]);
+
+    if (ret < 0) {
+        fprintf(stderr, "window: failed to send: %d\n", ret);
+        goto done;
+    }
+
+    ret = send_request(&setup, &requests[2]);
+    if (ret != SMP_ERROR_BUSY) {
+        fprintf(stderr, "window: sending with a full window returned %d\n",
+                ret);
+        goto done;
+    }
+
+    ret = tup_context_set_request_window(setup.host, 4);
+    if (ret != SMP_ERROR_BUSY) {
+        fprintf(stderr, "window: resizing with pending requests returned "
+                "%d\n", ret);
+        goto done;
+    }
+
+    /* make room for the last one */
+    ret = pump_device(&setup);
+    if (ret == 0)
+        ret = tup_context_wait_requests(setup.host, 1, TEST_TIMEOUT_MS);
+
+    if (ret == 0)
+        ret = send_request(&setup, &requests[2]);
+
+    if (ret == 0)
+        ret = pump_device(&setup);
+
+    if (ret == 0)
+        ret = tup_context_wait_requests(setup.host, 0, TEST_TIMEOUT_MS);
+
+    if (ret < 0) {
+        fprintf(stderr, "window: failed to complete the requests: %d\n", ret);
+        goto done;
+    }
+
+    for (i = 0; i < N_ELEMENTS(requests); i++) {
+        if (!check_request("window", &requests[i]))
+            goto done;
+    }
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    return success;
+}
+
+/* requests without response time out, pending ones are cancelled when the
+ * context is freed */
+static bool test_lost(void)
+{
+    TestRequest lost = { TUP_REQUEST_STATUS_TIMEOUT, 0, 0, 0, 0 };
+    TestRequest cancelled = { TUP_REQUEST_STATUS_CANCELLED, 0, 0, 0, 0 };
+    TestSetup setup;
+    bool success = false;
+    int ret;
+
+    if (!setup_init(&setup))
+        goto done;
+
+    tup_message_init_get_version(setup.msg);
+
+    ret = send_request(&setup, &lost);
+    if (ret < 0) {
+        fprintf(stderr, "lost: failed to send: %d\n", ret);
+        goto done;
+    }
+
+    ret = tup_context_wait_requests(setup.host, 0, TEST_LOST_TIMEOUT_MS);
+    if (ret != SMP_ERROR_TIMEDOUT) {
+        fprintf(stderr, "lost: waiting returned %d\n", ret);
+        goto done;
+    }
+
+    if (!check_request("lost", &lost)
+            || tup_context_get_n_pending_requests(setup.host) != 0)
+        goto done;
+
+    ret = send_request(&setup, &cancelled);
+    if (ret < 0) {
+        fprintf(stderr, "lost: failed to send: %d\n", ret);
+        goto done;
+    }
+
+    tup_context_free(setup.host);
+    setup.host = NULL;
+    setup.transports[0] = NULL;
+
+    if (!check_request("cancelled", &cancelled))
+        goto done;
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    return success;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!test_matching() || !test_window() || !test_lost())
+        return 1;
+
+    printf("requests are matched to their response\n");
+    return 0;
+}
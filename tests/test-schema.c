@@ -0,0 +1,370 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <libtup.h>
+
+#define N_ELEMENTS(arr) (sizeof((arr)) / sizeof((arr)[0]))
+
+#define TEST_MAX_ARGS 16
+
+typedef struct
+{
+    TupMessageType type;
+    const char *name;
+    int n_args;
+} TestMessage;
+
+/* every message type with the number of arguments build_message() gives */
+static const TestMessage test_messages[] = {
+    { TUP_MESSAGE_ACK, "ACK", 2 },
+    { TUP_MESSAGE_ERROR, "ERROR", 3 },
+    { TUP_MESSAGE_CMD_LOAD, "CMD_LOAD", 2 },
+    { TUP_MESSAGE_CMD_PLAY, "CMD_PLAY", 1 },
+    { TUP_MESSAGE_CMD_STOP, "CMD_STOP", 1 },
+    { TUP_MESSAGE_CMD_GET_VERSION, "CMD_GET_VERSION", 0 },
+    { TUP_MESSAGE_CMD_GET_PARAMETER, "CMD_GET_PARAMETER", 4 },
+    { TUP_MESSAGE_CMD_SET_PARAMETER, "CMD_SET_PARAMETER", 5 },
+    { TUP_MESSAGE_CMD_BIND_EFFECT, "CMD_BIND_EFFECT", 2 },
+    { TUP_MESSAGE_CMD_GET_SENSOR_VALUE, "CMD_GET_SENSOR_VALUE", 2 },
+    { TUP_MESSAGE_CMD_SET_SENSOR_VALUE, "CMD_SET_SENSOR_VALUE", 4 },
+    { TUP_MESSAGE_CMD_GET_BUILDINFO, "CMD_GET_BUILDINFO", 0 },
+    { TUP_MESSAGE_CMD_ACTIVATE_INTERNAL_SENSORS,
+        "CMD_ACTIVATE_INTERNAL_SENSORS", 1 },
+    { TUP_MESSAGE_CMD_GET_INPUT_VALUE, "CMD_GET_INPUT_VALUE", 4 },
+    { TUP_MESSAGE_CMD_SET_INPUT_VALUE, "CMD_SET_INPUT_VALUE", 5 },
+    { TUP_MESSAGE_CMD_FILTER_GET_ACTIVE, "CMD_FILTER_GET_ACTIVE", 2 },
+    { TUP_MESSAGE_CMD_FILTER_SET_ACTIVE, "CMD_FILTER_SET_ACTIVE", 3 },
+    { TUP_MESSAGE_CMD_CONFIG_WRITE, "CMD_CONFIG_WRITE", 0 },
+    { TUP_MESSAGE_CMD_CONFIG_BAND_NORM_GET_COEFFS,
+        "CMD_CONFIG_BAND_NORM_GET_COEFFS", 1 },
+    { TUP_MESSAGE_CMD_CONFIG_BAND_NORM_SET_COEFFS,
+        "CMD_CONFIG_BAND_NORM_SET_COEFFS", 11 },
+    { TUP_MESSAGE_RESP_VERSION, "RESP_VERSION", 1 },
+    { TUP_MESSAGE_RESP_PARAMETER, "RESP_PARAMETER", 5 },
+    { TUP_MESSAGE_RESP_SENSOR, "RESP_SENSOR", 4 },
+    { TUP_MESSAGE_RESP_BUILDINFO, "RESP_BUILDINFO", 1 },
+    { TUP_MESSAGE_RESP_INPUT, "RESP_INPUT", 5 },
+    { TUP_MESSAGE_RESP_SET_PARAMETER, "RESP_SET_PARAMETER", 6 },
+    { TUP_MESSAGE_RESP_FILTER_ACTIVE, "RESP_FILTER_ACTIVE", 3 },
+    { TUP_MESSAGE_RESP_BAND_NORM_COEFFS, "RESP_BAND_NORM_COEFFS", 11 },
+    { TUP_MESSAGE_CMD_DEBUG_GET_SYSTEM_STATUS, "CMD_DEBUG_GET_SYSTEM_STATUS",
+        0 },
+    { TUP_MESSAGE_RESP_DEBUG_SYSTEM_STATUS, "RESP_DEBUG_SYSTEM_STATUS", 9 },
+};
+
+static float test_a[5] = { 1.0f, -0.5f, 0.25f, 0.0f, 2.0f };
+static float test_b[5] = { 0.5f, 0.0f, -1.0f, 3.0f, 0.125f };
+
+static int build_message(TupMessage *msg, TupMessageType type)
+{
+    uint8_t ids[] = { 4, 5, 6 };
+    TupParameterArgs params[] = { { 1, 0xdeadbeef }, { 2, 7 } };
+    TupSensorValueArgs sensors[] = { { 1, 300 }, { 2, 0xffff } };
+    TupInputValueArgs inputs[] = { { 0, -3 }, { 9, 100000 } };
+    TupDebugSystemStatus status = { 1000000, 65536, 4096 };
+    TupDebugTaskStatus task = { 3, "idle", 0, 1, 999, 128 };
+
+    switch (type) {
+        case TUP_MESSAGE_ACK:
+            tup_message_init_ack_full(msg, TUP_MESSAGE_CMD_LOAD, 7);
+            return 0;
+        case TUP_MESSAGE_ERROR:
+            tup_message_init_error_full(msg, TUP_MESSAGE_CMD_PLAY, 2, 7);
+            return 0;
+        case TUP_MESSAGE_CMD_LOAD:
+            tup_message_init_load(msg, 1, 0x1234);
+            return 0;
+        case TUP_MESSAGE_CMD_PLAY:
+            tup_message_init_play(msg, 1);
+            return 0;
+        case TUP_MESSAGE_CMD_STOP:
+            tup_message_init_stop(msg, 1);
+            return 0;
+        case TUP_MESSAGE_CMD_GET_VERSION:
+            tup_message_init_get_version(msg);
+            return 0;
+        case TUP_MESSAGE_CMD_GET_PARAMETER:
+            return tup_message_init_get_parameter_array(msg, 1, ids,
+                    N_ELEMENTS(ids));
+        case TUP_MESSAGE_CMD_SET_PARAMETER:
+            return tup_message_init_set_parameter_array(msg, 1, params,
+                    N_ELEMENTS(params));
+        case TUP_MESSAGE_CMD_BIND_EFFECT:
+            tup_message_init_bind_effect(msg, 1, TUP_BINDING_FLAG_BOTH);
+            return 0;
+        case TUP_MESSAGE_CMD_GET_SENSOR_VALUE:
+            return tup_message_init_get_sensor_value_array(msg, ids, 2);
+        case TUP_MESSAGE_CMD_SET_SENSOR_VALUE:
+            return tup_message_init_set_sensor_value_array(msg, sensors,
+                    N_ELEMENTS(sensors));
+        case TUP_MESSAGE_CMD_GET_BUILDINFO:
+            tup_message_init_get_buildinfo(msg);
+            return 0;
+        case TUP_MESSAGE_CMD_ACTIVATE_INTERNAL_SENSORS:
+            tup_message_init_activate_internal_sensors(msg, 1);
+            return 0;
+        case TUP_MESSAGE_CMD_GET_INPUT_VALUE:
+            return tup_message_init_get_input_value_array(msg, 2, ids,
+                    N_ELEMENTS(ids));
+        case TUP_MESSAGE_CMD_SET_INPUT_VALUE:
+            return tup_message_init_set_input_value_array(msg, 2, inputs,
+                    N_ELEMENTS(inputs));
+        case TUP_MESSAGE_CMD_FILTER_GET_ACTIVE:
+            return tup_message_init_filter_get_active(msg,
+                    TUP_FILTER_ID_BAND_NORM, 1);
+        case TUP_MESSAGE_CMD_FILTER_SET_ACTIVE:
+            return tup_message_init_filter_set_active(msg,
+                    TUP_FILTER_ID_BAND_NORM, 1, true);
+        case TUP_MESSAGE_CMD_CONFIG_WRITE:
+            tup_message_init_config_write(msg);
+            return 0;
+        case TUP_MESSAGE_CMD_CONFIG_BAND_NORM_GET_COEFFS:
+            return tup_message_init_config_band_norm_get_coeffs(msg, 1);
+        case TUP_MESSAGE_CMD_CONFIG_BAND_NORM_SET_COEFFS:
+            return tup_message_init_config_band_norm_set_coeffs(msg, 1,
+                    test_a, test_b);
+        case TUP_MESSAGE_RESP_VERSION:
+            tup_message_init_resp_version(msg, "1.2.3");
+            return 0;
+        case TUP_MESSAGE_RESP_PARAMETER:
+            return tup_message_init_resp_parameter(msg, 1, params,
+                    N_ELEMENTS(params));
+        case TUP_MESSAGE_RESP_SENSOR:
+            return tup_message_init_resp_sensor(msg, sensors,
+                    N_ELEMENTS(sensors));
+        case TUP_MESSAGE_RESP_BUILDINFO:
+            tup_message_init_resp_buildinfo(msg, "test");
+            return 0;
+        case TUP_MESSAGE_RESP_INPUT:
+            return tup_message_init_resp_input(msg, 2, inputs,
+                    N_ELEMENTS(inputs));
+        case TUP_MESSAGE_RESP_SET_PARAMETER:
+            return tup_message_init_resp_set_parameter(msg, 1, -1, params,
+                    N_ELEMENTS(params));
+        case TUP_MESSAGE_RESP_FILTER_ACTIVE:
+            return tup_message_init_resp_filter_active(msg,
+                    TUP_FILTER_ID_BAND_NORM, 1, false);
+        case TUP_MESSAGE_RESP_BAND_NORM_COEFFS:
+            return tup_message_init_resp_band_norm_coeffs(msg, 1, test_a,
+                    test_b);
+        case TUP_MESSAGE_CMD_DEBUG_GET_SYSTEM_STATUS:
+            tup_message_init_cmd_debug_get_system_status(msg);
+            return 0;
+        case TUP_MESSAGE_RESP_DEBUG_SYSTEM_STATUS:
+            return tup_message_init_resp_debug_system_status(msg, &status,
+                    &task, 1);
+        default:
+            return SMP_ERROR_NOT_FOUND;
+    }
+}
+
+/* the initializers follow the layout the schema gives */
+static bool test_layout(TupMessage *msg)
+{
+    SmpValue values[TEST_MAX_ARGS];
+    TupMessageInfo info;
+    size_t i;
+    int ret;
+
+    for (i = 0; i < N_ELEMENTS(test_messages); i++) {
+        const TestMessage *test = &test_messages[i];
+        int n_groups;
+
+        tup_message_clear(msg);
+
+        ret = build_message(msg, test->type);
+        if (ret < 0) {
+            fprintf(stderr, "layout: failed to build %s: %d\n", test->name,
+                    ret);
+            return false;
+        }
+
+        ret = tup_message_type_get_info(test->type, &info);
+        if (ret < 0 || strcmp(info.name, test->name) != 0) {
+            fprintf(stderr, "layout: no info for %s: %d\n", test->name, ret);
+            return false;
+        }
+
+        if (tup_message_get_type(msg) != test->type) {
+            fprintf(stderr, "layout: %s built as %d\n", test->name,
+                    tup_message_get_type(msg));
+            return false;
+        }
+
+        ret = tup_message_parse_values(msg, values, N_ELEMENTS(values));
+        if (ret != test->n_args) {
+            fprintf(stderr, "layout: %s has %d arguments, expected %d\n",
+                    test->name, ret, test->n_args);
+            return false;
+        }
+
+        n_groups = (info.n_group_args == 0) ? 0
+            : (ret - (int) info.n_fixed_args) / (int) info.n_group_args;
+        if ((int) info.n_fixed_args + n_groups * (int) info.n_group_args
+                != ret) {
+            fprintf(stderr, "layout: %s info doesn't match its arguments\n",
+                    test->name);
+            return false;
+        }
+
+        if (ret > 0 && tup_message_parse_values(msg, values, ret - 1)
+                != SMP_ERROR_OVERFLOW) {
+            fprintf(stderr, "layout: %s overflowed the values\n", test->name);
+            return false;
+        }
+    }
+
+    if (tup_message_type_get_info(3, &info) != SMP_ERROR_NOT_FOUND) {
+        fprintf(stderr, "layout: unknown type has info\n");
+        return false;
+    }
+
+    return true;
+}
+
+/* what an initializer writes is read back by its parser */
+static bool test_round_trip(TupMessage *msg)
+{
+    TupParameterArgs params[2];
+    TupInputValueArgs inputs[2];
+    TupMessageType cmd;
+    uint8_t ids[3];
+    uint8_t effect_id;
+    float a[5];
+    float b[5];
+    uint32_t error;
+    uint32_t arg1;
+    int32_t retval;
+    int ret;
+
+    /* errors carry the failed command, not their own type */
+    tup_message_clear(msg);
+    build_message(msg, TUP_MESSAGE_ERROR);
+    ret = tup_message_parse_error_full(msg, &cmd, &error, &arg1);
+    if (ret < 0 || cmd != TUP_MESSAGE_CMD_PLAY || error != 2 || arg1 != 7) {
+        fprintf(stderr, "round trip: error is %d, %u, %u\n", cmd, error,
+                arg1);
+        return false;
+    }
+
+    tup_message_clear(msg);
+    build_message(msg, TUP_MESSAGE_CMD_GET_INPUT_VALUE);
+    ret = tup_message_parse_get_input_value(msg, &effect_id, ids,
+            N_ELEMENTS(ids));
+    if (ret != 3 || effect_id != 2 || ids[0] != 4 || ids[1] != 5
+            || ids[2] != 6) {
+        fprintf(stderr, "round trip: get input value is %d, %u, %u %u %u\n",
+                ret, effect_id, ids[0], ids[1], ids[2]);
+        return false;
+    }
+
+    tup_message_clear(msg);
+    build_message(msg, TUP_MESSAGE_CMD_SET_INPUT_VALUE);
+    ret = tup_message_parse_set_input_value(msg, &effect_id, inputs,
+            N_ELEMENTS(inputs));
+    if (ret != 2 || effect_id != 2 || inputs[0].input_value != -3
+            || inputs[1].input_id != 9 || inputs[1].input_value != 100000) {
+        fprintf(stderr, "round trip: set input value is wrong\n");
+        return false;
+    }
+
+    tup_message_clear(msg);
+    build_message(msg, TUP_MESSAGE_RESP_SET_PARAMETER);
+    ret = tup_message_parse_resp_set_parameter(msg, &effect_id, &retval,
+            params, N_ELEMENTS(params));
+    if (ret != 2 || effect_id != 1 || retval != -1
+            || params[0].parameter_value != 0xdeadbeef
+            || params[1].parameter_id != 2) {
+        fprintf(stderr, "round trip: resp set parameter is wrong\n");
+        return false;
+    }
+
+    tup_message_clear(msg);
+    build_message(msg, TUP_MESSAGE_CMD_CONFIG_BAND_NORM_SET_COEFFS);
+    ret = tup_message_parse_config_band_norm_set_coeffs(msg, &effect_id, a, b);
+    if (ret < 0 || effect_id != 1 || memcmp(a, test_a, sizeof(a)) != 0
+            || memcmp(b, test_b, sizeof(b)) != 0) {
+        fprintf(stderr, "round trip: band norm coefficients are wrong\n");
+        return false;
+    }
+
+    /* the varargs initializers append groups like the array ones */
+    tup_message_clear(msg);
+    ret = tup_message_init_set_parameter(msg, 1, 1, 0xdeadbeef, 2, 7, -1);
+    if (ret == 0)
+        ret = tup_message_parse_set_parameter(msg, &effect_id, params,
+                N_ELEMENTS(params));
+
+    if (ret != 2 || params[0].parameter_value != 0xdeadbeef
+            || params[1].parameter_value != 7) {
+        fprintf(stderr, "round trip: varargs set parameter is wrong\n");
+        return false;
+    }
+
+    return true;
+}
+
+/* messages not matching their schema are rejected */
+static bool test_invalid(TupMessage *msg)
+{
+    int ret;
+
+    /* a repeated group cut short */
+    tup_message_clear(msg);
+    tup_message_init_set_parameter_simple(msg, 1, 2, 3);
+    smp_message_set_uint8(msg, 3, 4);
+
+    ret = tup_message_parse_values(msg, NULL, 0);
+    if (ret != SMP_ERROR_BAD_MESSAGE) {
+        fprintf(stderr, "invalid: incomplete group gave %d\n", ret);
+        return false;
+    }
+
+    /* an argument of the wrong type */
+    tup_message_clear(msg);
+    tup_message_init_load(msg, 1, 2);
+    smp_message_set_uint32(msg, 1, 2);
+
+    ret = tup_message_parse_values(msg, NULL, 0);
+    if (ret != SMP_ERROR_BAD_TYPE) {
+        fprintf(stderr, "invalid: wrong type gave %d\n", ret);
+        return false;
+    }
+
+    /* a fixed argument missing */
+    tup_message_clear(msg);
+    smp_message_init(msg, TUP_MESSAGE_CMD_LOAD);
+    smp_message_set_uint8(msg, 0, 1);
+
+    ret = tup_message_parse_values(msg, NULL, 0);
+    if (ret != SMP_ERROR_BAD_MESSAGE) {
+        fprintf(stderr, "invalid: missing argument gave %d\n", ret);
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    TupMessage *msg;
+    bool success;
+
+    msg = tup_message_new();
+    if (msg == NULL)
+        return 1;
+
+    success = test_layout(msg) && test_round_trip(msg) && test_invalid(msg);
+
+    tup_message_free(msg);
+    if (!success)
+        return 1;
+
+    printf("messages follow their schema\n");
+    return 0;
+}
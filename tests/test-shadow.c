@@ -0,0 +1,239 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <libtup.h>
+#include <libtupsim.h>
+
+#define TEST_N_PUMPS 16
+
+/* the pending update must be set up within a frame time, retry if the
+ * test gets preempted in between */
+#define TEST_N_ATTEMPTS 5
+
+typedef struct
+{
+    TupTransport *transports[2];
+    TupContext *host;
+    TupSimDevice *dev;
+    TupMessage *msg;
+} TestSetup;
+
+static bool setup_init(TestSetup *setup)
+{
+    int ret;
+
+    setup->transports[0] = NULL;
+    setup->transports[1] = NULL;
+    setup->host = NULL;
+    setup->dev = NULL;
+
+    setup->msg = tup_message_new();
+    if (setup->msg == NULL) {
+        fprintf(stderr, "failed to create the message\n");
+        return false;
+    }
+
+    ret = tup_transport_new_loopback(&setup->transports[0],
+            &setup->transports[1], 0);
+    if (ret < 0) {
+        fprintf(stderr, "failed to create loopback transports: %d\n", ret);
+        return false;
+    }
+
+    setup->host = tup_context_new_with_transport(setup->transports[0], NULL,
+            NULL);
+    setup->dev = tup_sim_device_new(setup->transports[1], NULL);
+    if (setup->host == NULL || setup->dev == NULL
+            || tup_sim_device_open(setup->dev, NULL) < 0) {
+        fprintf(stderr, "failed to create the host and the device\n");
+        return false;
+    }
+
+    ret = tup_context_enable_shadow(setup->host, true);
+    if (ret < 0) {
+        fprintf(stderr, "failed to enable the shadow state: %d\n", ret);
+        return false;
+    }
+
+    return true;
+}
+
+static void setup_clear(TestSetup *setup)
+{
+    if (setup->dev != NULL)
+        tup_sim_device_free(setup->dev);
+    else if (setup->transports[1] != NULL)
+        tup_transport_free(setup->transports[1]);
+
+    if (setup->host != NULL)
+        tup_context_free(setup->host);
+    else if (setup->transports[0] != NULL)
+        tup_transport_free(setup->transports[0]);
+
+    if (setup->msg != NULL)
+        tup_message_free(setup->msg);
+}
+
+/* let the device answer everything written so far */
+static int pump(TestSetup *setup)
+{
+    TupContext *device = tup_sim_device_get_context(setup->dev);
+    int ret;
+    int i;
+
+    for (i = 0; i < TEST_N_PUMPS; i++) {
+        ret = tup_context_process_fd(device);
+        if (ret < 0)
+            return ret;
+
+        ret = tup_context_process_fd(setup->host);
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+static int send_input(TestSetup *setup, uint8_t input_id, int32_t value)
+{
+    tup_message_clear(setup->msg);
+    tup_message_init_set_input_value_simple(setup->msg, 1, input_id, value);
+    return tup_context_send(setup->host, setup->msg);
+}
+
+/* read an input of slot 1 on the device itself */
+static int get_device_input(TestSetup *setup, uint8_t input_id,
+        int32_t *value)
+{
+    TupInputValueArgs args[1];
+    TupMessage *response;
+    uint8_t slot_id;
+    int ret;
+
+    response = tup_message_new();
+    if (response == NULL)
+        return -1;
+
+    tup_message_clear(setup->msg);
+    tup_message_init_get_input_value_simple(setup->msg, 1, input_id);
+
+    ret = tup_sim_device_handle_message(setup->dev, setup->msg, response);
+    if (ret == 0)
+        ret = tup_message_parse_resp_input(response, &slot_id, args, 1);
+
+    if (ret == 1)
+        *value = args[0].input_value;
+
+    tup_message_free(response);
+    return (ret == 1) ? 0 : -1;
+}
+
+/* a SET of the known value isn't elided while a coalesced update of the
+ * same input is pending: the device ends with the last value sent. Returns
+ * 1 on success, 0 if the update couldn't be kept pending and -1 on
+ * failure */
+static int run_pending_update(void)
+{
+    TestSetup setup;
+    int32_t value;
+    int success = -1;
+    int ret;
+
+    if (!setup_init(&setup))
+        goto done;
+
+    tup_message_clear(setup.msg);
+    tup_message_init_load(setup.msg, 1, 0);
+    ret = tup_context_send(setup.host, setup.msg);
+    if (ret == 0)
+        ret = send_input(&setup, 0, 5);
+
+    if (ret == 0)
+        ret = pump(&setup);
+
+    if (ret < 0) {
+        fprintf(stderr, "failed to set the known value: %d\n", ret);
+        goto done;
+    }
+
+    ret = tup_context_enable_coalescing(setup.host, true);
+    if (ret < 0) {
+        fprintf(stderr, "failed to enable coalescing: %d\n", ret);
+        goto done;
+    }
+
+    /* the first update keeps the line busy, the next one stays pending */
+    ret = send_input(&setup, 1, 0);
+    if (ret == 0)
+        ret = send_input(&setup, 0, 7);
+
+    if (ret < 0) {
+        fprintf(stderr, "failed to send the updates: %d\n", ret);
+        goto done;
+    }
+
+    if (tup_context_get_n_pending_updates(setup.host) != 1) {
+        success = 0;
+        goto done;
+    }
+
+    ret = send_input(&setup, 0, 5);
+    if (ret < 0) {
+        fprintf(stderr, "failed to send the known value: %d\n", ret);
+        goto done;
+    }
+
+    /* write what's left */
+    ret = tup_context_enable_coalescing(setup.host, false);
+    if (ret == 0)
+        ret = pump(&setup);
+
+    if (ret < 0) {
+        fprintf(stderr, "failed to write the pending updates: %d\n", ret);
+        goto done;
+    }
+
+    if (get_device_input(&setup, 0, &value) < 0) {
+        fprintf(stderr, "failed to read the device input\n");
+        goto done;
+    }
+
+    if (value != 5) {
+        fprintf(stderr, "pending update: device input is %d, expected 5\n",
+                value);
+        goto done;
+    }
+
+    success = 1;
+
+done:
+    setup_clear(&setup);
+    return success;
+}
+
+static bool test_pending_update(void)
+{
+    int ret = 0;
+    int i;
+
+    for (i = 0; i < TEST_N_ATTEMPTS && ret == 0; i++)
+        ret = run_pending_update();
+
+    if (ret == 0)
+        fprintf(stderr, "pending update: the update was never kept pending\n");
+
+    return ret == 1;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!test_pending_update())
+        return 1;
+
+    printf("shadow keeps pending updates in order\n");
+    return 0;
+}
@@ -0,0 +1,389 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <libtup.h>
+#include <libtupsim.h>
+
+#define N_ELEMENTS(arr) (sizeof((arr)) / sizeof((arr)[0]))
+
+#define TEST_N_DEVICES 64
+#define TEST_N_ITERATIONS 64
+
+typedef struct
+{
+    TupMessageType cmd;
+    TupMessageType expected_response;
+} TestCommand;
+
+/* build the command, on slot 1 or actuator 1 when needed */
+static int init_command(TupMessage *msg, TupMessageType cmd)
+{
+    float a[5] = { 1.0f, 0.5f, 0.25f, 0.0f, 0.0f };
+    float b[5] = { 0.5f, 0.0f, 0.0f, 0.0f, 0.0f };
+
+    tup_message_clear(msg);
+
+    switch (cmd) {
+        case TUP_MESSAGE_CMD_LOAD:
+            tup_message_init_load(msg, 1, 0);
+            return 0;
+        case TUP_MESSAGE_CMD_PLAY:
+            tup_message_init_play(msg, 1);
+            return 0;
+        case TUP_MESSAGE_CMD_STOP:
+            tup_message_init_stop(msg, 1);
+            return 0;
+        case TUP_MESSAGE_CMD_GET_VERSION:
+            tup_message_init_get_version(msg);
+            return 0;
+        case TUP_MESSAGE_CMD_GET_PARAMETER:
+            tup_message_init_get_parameter_simple(msg, 1, 2);
+            return 0;
+        case TUP_MESSAGE_CMD_SET_PARAMETER:
+            tup_message_init_set_parameter_simple(msg, 1, 2, 42);
+            return 0;
+        case TUP_MESSAGE_CMD_BIND_EFFECT:
+            tup_message_init_bind_effect(msg, 1, 0x1);
+            return 0;
+        case TUP_MESSAGE_CMD_GET_SENSOR_VALUE:
+            tup_message_init_get_sensor_value_simple(msg, 0);
+            return 0;
+        case TUP_MESSAGE_CMD_SET_SENSOR_VALUE:
+            tup_message_init_set_sensor_value_simple(msg, 0, 7);
+            return 0;
+        case TUP_MESSAGE_CMD_GET_BUILDINFO:
+            tup_message_init_get_buildinfo(msg);
+            return 0;
+        case TUP_MESSAGE_CMD_ACTIVATE_INTERNAL_SENSORS:
+            tup_message_init_activate_internal_sensors(msg, 1);
+            return 0;
+        case TUP_MESSAGE_CMD_GET_INPUT_VALUE:
+            tup_message_init_get_input_value_simple(msg, 1, 0);
+            return 0;
+        case TUP_MESSAGE_CMD_SET_INPUT_VALUE:
+            tup_message_init_set_input_value_simple(msg, 1, 0, -3);
+            return 0;
+        case TUP_MESSAGE_CMD_FILTER_GET_ACTIVE:
+            return tup_message_init_filter_get_active(msg,
+                    TUP_FILTER_ID_BAND_NORM, 1);
+        case TUP_MESSAGE_CMD_FILTER_SET_ACTIVE:
+            return tup_message_init_filter_set_active(msg,
+                    TUP_FILTER_ID_BAND_NORM, 1, true);
+        case TUP_MESSAGE_CMD_CONFIG_WRITE:
+            tup_message_init_config_write(msg);
+            return 0;
+        case TUP_MESSAGE_CMD_CONFIG_BAND_NORM_GET_COEFFS:
+            return tup_message_init_config_band_norm_get_coeffs(msg, 1);
+        case TUP_MESSAGE_CMD_CONFIG_BAND_NORM_SET_COEFFS:
+            return tup_message_init_config_band_norm_set_coeffs(msg, 1, a, b);
+        case TUP_MESSAGE_CMD_DEBUG_GET_SYSTEM_STATUS:
+            tup_message_init_cmd_debug_get_system_status(msg);
+            return 0;
+        default:
+            return SMP_ERROR_INVALID_PARAM;
+    }
+}
+
+/* every command is answered with the response documented in
+ * docs/messages.txt, in an order where each one succeeds */
+static bool test_commands(TupSimDevice *dev, TupMessage *msg,
+        TupMessage *response)
+{
+    static const TestCommand commands[] = {
+        { TUP_MESSAGE_CMD_LOAD, TUP_MESSAGE_ACK },
+        { TUP_MESSAGE_CMD_PLAY, TUP_MESSAGE_ACK },
+        { TUP_MESSAGE_CMD_STOP, TUP_MESSAGE_ACK },
+        { TUP_MESSAGE_CMD_GET_VERSION, TUP_MESSAGE_RESP_VERSION },
+        { TUP_MESSAGE_CMD_SET_PARAMETER, TUP_MESSAGE_RESP_SET_PARAMETER },
+        { TUP_MESSAGE_CMD_GET_PARAMETER, TUP_MESSAGE_RESP_PARAMETER },
+        { TUP_MESSAGE_CMD_BIND_EFFECT, TUP_MESSAGE_ACK },
+        { TUP_MESSAGE_CMD_SET_SENSOR_VALUE, TUP_MESSAGE_ACK },
+        { TUP_MESSAGE_CMD_GET_SENSOR_VALUE, TUP_MESSAGE_RESP_SENSOR },
+        { TUP_MESSAGE_CMD_GET_BUILDINFO, TUP_MESSAGE_RESP_BUILDINFO },
+        { TUP_MESSAGE_CMD_ACTIVATE_INTERNAL_SENSORS, TUP_MESSAGE_ACK },
+        { TUP_MESSAGE_CMD_SET_INPUT_VALUE, TUP_MESSAGE_ACK },
+        { TUP_MESSAGE_CMD_GET_INPUT_VALUE, TUP_MESSAGE_RESP_INPUT },
+        { TUP_MESSAGE_CMD_FILTER_SET_ACTIVE, TUP_MESSAGE_RESP_FILTER_ACTIVE },
+        { TUP_MESSAGE_CMD_FILTER_GET_ACTIVE, TUP_MESSAGE_RESP_FILTER_ACTIVE },
+        { TUP_MESSAGE_CMD_CONFIG_WRITE, TUP_MESSAGE_ACK },
+        { TUP_MESSAGE_CMD_CONFIG_BAND_NORM_SET_COEFFS,
+            TUP_MESSAGE_RESP_BAND_NORM_COEFFS },
+        { TUP_MESSAGE_CMD_CONFIG_BAND_NORM_GET_COEFFS,
+            TUP_MESSAGE_RESP_BAND_NORM_COEFFS },
+        { TUP_MESSAGE_CMD_DEBUG_GET_SYSTEM_STATUS,
+            TUP_MESSAGE_RESP_DEBUG_SYSTEM_STATUS },
+    };
+    TupSimDeviceStats stats;
+    size_t i;
+    int ret;
+
+    for (i = 0; i < N_ELEMENTS(commands); i++) {
+        ret = init_command(msg, commands[i].cmd);
+        if (ret == 0)
+            ret = tup_sim_device_handle_message(dev, msg, response);
+
+        if (ret < 0) {
+            fprintf(stderr, "commands: failed to handle %d: %d\n",
+                    commands[i].cmd, ret);
+            return false;
+        }
+
+        if (tup_message_get_type(response) != commands[i].expected_response) {
+            fprintf(stderr, "commands: %d answered with %d, expected %d\n",
+                    commands[i].cmd, tup_message_get_type(response),
+                    commands[i].expected_response);
+            return false;
+        }
+    }
+
+    tup_sim_device_get_stats(dev, &stats);
+    if (stats.n_commands != N_ELEMENTS(commands) || stats.n_errors != 0
+            || stats.n_config_writes != 1) {
+        fprintf(stderr, "commands: %lu commands, %lu errors and %lu config "
+                "writes, expected %zu, 0 and 1\n",
+                (unsigned long) stats.n_commands,
+                (unsigned long) stats.n_errors,
+                (unsigned long) stats.n_config_writes, N_ELEMENTS(commands));
+        return false;
+    }
+
+    return true;
+}
+
+/* values set by the commands are kept by the device */
+static bool test_state(TupSimDevice *dev, TupMessage *msg,
+        TupMessage *response)
+{
+    TupParameterArgs params[1];
+    TupInputValueArgs inputs[1];
+    uint8_t actuator_id;
+    uint8_t slot_id;
+    float a[5];
+    float b[5];
+    int ret;
+
+    init_command(msg, TUP_MESSAGE_CMD_GET_PARAMETER);
+    ret = tup_sim_device_handle_message(dev, msg, response);
+    if (ret < 0 || tup_message_parse_resp_parameter(response, &slot_id,
+                params, 1) != 1 || params[0].parameter_value != 42) {
+        fprintf(stderr, "state: parameter isn't kept\n");
+        return false;
+    }
+
+    init_command(msg, TUP_MESSAGE_CMD_GET_INPUT_VALUE);
+    ret = tup_sim_device_handle_message(dev, msg, response);
+    if (ret < 0 || tup_message_parse_resp_input(response, &slot_id, inputs,
+                1) != 1 || inputs[0].input_value != -3) {
+        fprintf(stderr, "state: input isn't kept\n");
+        return false;
+    }
+
+    init_command(msg, TUP_MESSAGE_CMD_CONFIG_BAND_NORM_GET_COEFFS);
+    ret = tup_sim_device_handle_message(dev, msg, response);
+    if (ret < 0 || tup_message_parse_resp_band_norm_coeffs(response,
+                &actuator_id, a, b) < 0 || a[1] != 0.5f || b[0] != 0.5f) {
+        fprintf(stderr, "state: band norm coefficients aren't kept\n");
+        return false;
+    }
+
+    return true;
+}
+
+/* invalid commands are answered with an ERROR naming the command */
+static bool test_errors(TupSimDevice *dev, TupMessage *msg,
+        TupMessage *response)
+{
+    TupMessageType cmd;
+    uint32_t error;
+    uint32_t arg1;
+    int ret;
+
+    tup_message_clear(msg);
+    tup_message_init_play(msg, 200);
+
+    ret = tup_sim_device_handle_message(dev, msg, response);
+    if (ret < 0 || tup_message_parse_error_full(response, &cmd, &error,
+                &arg1) < 0) {
+        fprintf(stderr, "errors: invalid slot isn't answered with an "
+                "ERROR\n");
+        return false;
+    }
+
+    if (cmd != TUP_MESSAGE_CMD_PLAY || error != TUP_SIM_ERROR_INVALID_SLOT
+            || arg1 != 200) {
+        fprintf(stderr, "errors: got command %d, error %u and argument %u\n",
+                cmd, error, arg1);
+        return false;
+    }
+
+    tup_message_clear(msg);
+    tup_message_init_get_input_value_simple(msg, 3, 0);
+
+    ret = tup_sim_device_handle_message(dev, msg, response);
+    if (ret < 0 || tup_message_parse_error_full(response, &cmd, &error,
+                &arg1) < 0 || error != TUP_SIM_ERROR_EMPTY_SLOT) {
+        fprintf(stderr, "errors: empty slot isn't answered with an "
+                "ERROR\n");
+        return false;
+    }
+
+    return true;
+}
+
+static void on_request_done(TupContext *ctx, TupMessageType cmd,
+        TupRequestStatus status, TupMessage *response, void *userdata)
+{
+    unsigned int *n_ok = userdata;
+
+    if (status == TUP_REQUEST_STATUS_OK)
+        (*n_ok)++;
+}
+
+/* a single simulator serves many devices */
+static bool test_simulator(TupMessage *msg)
+{
+    TupTransport *device_transport;
+    TupContext *hosts[TEST_N_DEVICES];
+    TupTransport *host_transport;
+    TupSimulator *sim;
+    TupSimDevice *dev;
+    unsigned int n_ok = 0;
+    bool success = false;
+    int ret = 0;
+    int i;
+    int j;
+
+    memset(hosts, 0, sizeof(hosts));
+
+    sim = tup_simulator_new();
+    if (sim == NULL) {
+        fprintf(stderr, "simulator: failed to create the simulator\n");
+        return false;
+    }
+
+    for (i = 0; i < TEST_N_DEVICES; i++) {
+        ret = tup_transport_new_socketpair(&host_transport,
+                &device_transport);
+        if (ret < 0)
+            break;
+
+        hosts[i] = tup_context_new_with_transport(host_transport, NULL, NULL);
+        dev = tup_sim_device_new(device_transport, NULL);
+        if (hosts[i] == NULL || dev == NULL) {
+            ret = SMP_ERROR_NO_MEM;
+            break;
+        }
+
+        ret = tup_sim_device_open(dev, NULL);
+        if (ret == 0)
+            ret = tup_simulator_add_device(sim, dev);
+
+        if (ret < 0) {
+            tup_sim_device_free(dev);
+            break;
+        }
+
+        tup_message_clear(msg);
+        tup_message_init_get_version(msg);
+        ret = tup_context_send_request(hosts[i], msg, on_request_done, &n_ok);
+        if (ret < 0)
+            break;
+    }
+
+    if (ret < 0) {
+        fprintf(stderr, "simulator: failed to add device %d: %d\n", i, ret);
+        goto done;
+    }
+
+    if (tup_simulator_get_n_devices(sim) != TEST_N_DEVICES) {
+        fprintf(stderr, "simulator: serving %zu devices, expected %d\n",
+                tup_simulator_get_n_devices(sim), TEST_N_DEVICES);
+        goto done;
+    }
+
+    for (i = 0; i < TEST_N_ITERATIONS && n_ok < TEST_N_DEVICES; i++) {
+        ret = tup_simulator_iterate(sim, 10);
+        for (j = 0; j < TEST_N_DEVICES && ret == 0; j++)
+            ret = tup_context_process_fd(hosts[j]);
+
+        if (ret < 0) {
+            fprintf(stderr, "simulator: failed to iterate: %d\n", ret);
+            goto done;
+        }
+    }
+
+    if (n_ok != TEST_N_DEVICES) {
+        fprintf(stderr, "simulator: %u devices answered, expected %d\n",
+                n_ok, TEST_N_DEVICES);
+        goto done;
+    }
+
+    success = true;
+
+done:
+    tup_simulator_free(sim);
+
+    for (i = 0; i < TEST_N_DEVICES; i++) {
+        if (hosts[i] != NULL)
+            tup_context_free(hosts[i]);
+    }
+
+    return success;
+}
+
+int main(int argc, char *argv[])
+{
+    TupTransport *host_transport;
+    TupTransport *device_transport;
+    TupMessage *msg;
+    TupMessage *response;
+    TupSimDevice *dev = NULL;
+    bool success = false;
+
+    msg = tup_message_new();
+    response = tup_message_new();
+    if (msg == NULL || response == NULL) {
+        fprintf(stderr, "failed to create the messages\n");
+        goto done;
+    }
+
+    /* commands are handled directly, the transport is unused */
+    if (tup_transport_new_loopback(&host_transport, &device_transport,
+                0) < 0) {
+        fprintf(stderr, "failed to create loopback transports\n");
+        goto done;
+    }
+
+    tup_transport_free(host_transport);
+
+    dev = tup_sim_device_new(device_transport, NULL);
+    if (dev == NULL) {
+        fprintf(stderr, "failed to create the device\n");
+        tup_transport_free(device_transport);
+        goto done;
+    }
+
+    if (!test_commands(dev, msg, response) || !test_state(dev, msg, response)
+            || !test_errors(dev, msg, response) || !test_simulator(msg))
+        goto done;
+
+    printf("simulator answers every command\n");
+    success = true;
+
+done:
+    if (dev != NULL)
+        tup_sim_device_free(dev);
+
+    if (response != NULL)
+        tup_message_free(response);
+
+    if (msg != NULL)
+        tup_message_free(msg);
+
+    return success ? 0 : 1;
+}
@@ -0,0 +1,286 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <libtup.h>
+#include <libtupsim.h>
+
+#define TEST_N_PUMPS 16
+
+/* enough for an escaped ack */
+#define TEST_FRAME_SIZE 32
+
+typedef struct
+{
+    int sv[2];
+    TupContext *host;
+    TupSimDevice *dev;
+    TupMessage *msg;
+} TestSetup;
+
+/* percentiles are the upper bound of their bucket, known within 1/16 */
+static bool check_percentile(const TupLatencyHistogram *histogram,
+        double percentile, uint32_t expected)
+{
+    uint32_t value;
+
+    value = tup_latency_histogram_get_percentile(histogram, percentile);
+    if (value < expected || value > expected + expected / 16) {
+        fprintf(stderr, "histogram: p%g is %u, expected %u\n", percentile,
+                value, expected);
+        return false;
+    }
+
+    return true;
+}
+
+static bool test_histogram(void)
+{
+    TupLatencyHistogram histogram;
+    uint32_t i;
+
+    memset(&histogram, 0, sizeof(histogram));
+
+    if (tup_latency_histogram_get_percentile(&histogram, 50.0) != 0) {
+        fprintf(stderr, "histogram: empty histogram has a percentile\n");
+        return false;
+    }
+
+    for (i = 1; i <= 1000; i++)
+        tup_latency_histogram_add(&histogram, i * 10);
+
+    if (histogram.count != 1000 || histogram.min_us != 10
+            || histogram.max_us != 10000
+            || histogram.sum_us != 10ULL * 1000 * 1001 / 2) {
+        fprintf(stderr, "histogram: count %lu, min %u, max %u, sum %lu\n",
+                (unsigned long) histogram.count, histogram.min_us,
+                histogram.max_us, (unsigned long) histogram.sum_us);
+        return false;
+    }
+
+    return check_percentile(&histogram, 0.0, 10)
+        && check_percentile(&histogram, 50.0, 5000)
+        && check_percentile(&histogram, 99.0, 9900)
+        && check_percentile(&histogram, 100.0, 10000);
+}
+
+/* the host and the device talk through a raw socketpair so that bytes can be
+ * injected on the link */
+static bool setup_init(TestSetup *setup)
+{
+    TupTransport *transport;
+
+    setup->sv[0] = -1;
+    setup->sv[1] = -1;
+    setup->host = NULL;
+    setup->dev = NULL;
+
+    setup->msg = tup_message_new();
+    if (setup->msg == NULL) {
+        fprintf(stderr, "failed to create the message\n");
+        return false;
+    }
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, setup->sv) < 0) {
+        fprintf(stderr, "failed to create a socketpair\n");
+        return false;
+    }
+
+    transport = tup_transport_new_fd(setup->sv[0], setup->sv[0]);
+    if (transport == NULL)
+        return false;
+
+    setup->host = tup_context_new_with_transport(transport, NULL, NULL);
+    if (setup->host == NULL) {
+        tup_transport_free(transport);
+        setup->sv[0] = -1;
+        return false;
+    }
+
+    transport = tup_transport_new_fd(setup->sv[1], setup->sv[1]);
+    if (transport == NULL)
+        return false;
+
+    setup->dev = tup_sim_device_new(transport, NULL);
+    if (setup->dev == NULL) {
+        tup_transport_free(transport);
+        setup->sv[1] = -1;
+        return false;
+    }
+
+    return tup_sim_device_open(setup->dev, NULL) == 0;
+}
+
+static void setup_clear(TestSetup *setup)
+{
+    if (setup->dev != NULL)
+        tup_sim_device_free(setup->dev);
+    else if (setup->sv[1] >= 0)
+        close(setup->sv[1]);
+
+    if (setup->host != NULL)
+        tup_context_free(setup->host);
+    else if (setup->sv[0] >= 0)
+        close(setup->sv[0]);
+
+    if (setup->msg != NULL)
+        tup_message_free(setup->msg);
+}
+
+static int pump_device(TestSetup *setup)
+{
+    TupContext *device = tup_sim_device_get_context(setup->dev);
+    int ret;
+    int i;
+
+    for (i = 0; i < TEST_N_PUMPS; i++) {
+        ret = tup_context_process_fd(device);
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+static bool check_latency_count(TestSetup *setup, TupMessageType cmd,
+        uint64_t expected)
+{
+    TupLatencyHistogram histogram;
+    int ret;
+
+    ret = tup_context_get_latency_histogram(setup->host, cmd, &histogram);
+    if (ret < 0) {
+        fprintf(stderr, "context: failed to get the latencies of %d: %d\n",
+                cmd, ret);
+        return false;
+    }
+
+    if (histogram.count != expected) {
+        fprintf(stderr, "context: %lu latencies of %d, expected %lu\n",
+                (unsigned long) histogram.count, cmd,
+                (unsigned long) expected);
+        return false;
+    }
+
+    return true;
+}
+
+/* frames are counted in both directions, responses feed the histogram of
+ * their command and decoding errors are counted by code */
+static bool test_context(void)
+{
+    TupContextStats stats;
+    uint8_t frame[TEST_FRAME_SIZE];
+    TestSetup setup;
+    bool success = false;
+    int size;
+    int ret;
+
+    if (!setup_init(&setup)) {
+        fprintf(stderr, "context: failed to create the host and the "
+                "device\n");
+        goto done;
+    }
+
+    ret = tup_context_get_stats(setup.host, &stats);
+    if (ret != SMP_ERROR_NOT_FOUND) {
+        fprintf(stderr, "context: stats available while disabled: %d\n",
+                ret);
+        goto done;
+    }
+
+    ret = tup_context_enable_stats(setup.host, true);
+    if (ret == 0) {
+        tup_message_init_load(setup.msg, 1, 0);
+        ret = tup_context_send(setup.host, setup.msg);
+    }
+
+    if (ret == 0) {
+        tup_message_clear(setup.msg);
+        tup_message_init_get_version(setup.msg);
+        ret = tup_context_send(setup.host, setup.msg);
+    }
+
+    if (ret == 0)
+        ret = pump_device(&setup);
+
+    if (ret < 0) {
+        fprintf(stderr, "context: failed to send: %d\n", ret);
+        goto done;
+    }
+
+    /* an ack answering nothing, then a corrupted frame */
+    size = tup_encode_ack_full(frame, sizeof(frame), TUP_MESSAGE_CMD_PLAY, 1);
+    if (size < 0 || write(setup.sv[1], frame, size) != size) {
+        fprintf(stderr, "context: failed to write the ack\n");
+        goto done;
+    }
+
+    frame[1] ^= 0x01;
+    if (write(setup.sv[1], frame, size) != size) {
+        fprintf(stderr, "context: failed to write the corrupted frame\n");
+        goto done;
+    }
+
+    ret = tup_context_process_fd(setup.host);
+    if (ret == 0)
+        ret = tup_context_get_stats(setup.host, &stats);
+
+    if (ret < 0) {
+        fprintf(stderr, "context: failed to get the stats: %d\n", ret);
+        goto done;
+    }
+
+    if (stats.n_frames_tx != 2 || stats.n_frames_rx != 3
+            || stats.n_bytes_tx == 0 || stats.n_bytes_rx == 0
+            || stats.n_unmatched != 1 || stats.n_unanswered != 0) {
+        fprintf(stderr, "context: %lu frames sent, %lu received, %lu "
+                "unmatched and %lu unanswered, expected 2, 3, 1 and 0\n",
+                (unsigned long) stats.n_frames_tx,
+                (unsigned long) stats.n_frames_rx,
+                (unsigned long) stats.n_unmatched,
+                (unsigned long) stats.n_unanswered);
+        goto done;
+    }
+
+    if (stats.n_errors[-SMP_ERROR_BAD_MESSAGE] != 1) {
+        fprintf(stderr, "context: %lu bad messages, expected 1\n",
+                (unsigned long) stats.n_errors[-SMP_ERROR_BAD_MESSAGE]);
+        goto done;
+    }
+
+    if (!check_latency_count(&setup, TUP_MESSAGE_CMD_LOAD, 1)
+            || !check_latency_count(&setup, TUP_MESSAGE_CMD_GET_VERSION, 1)
+            || !check_latency_count(&setup, TUP_MESSAGE_CMD_PLAY, 0))
+        goto done;
+
+    tup_context_reset_stats(setup.host);
+
+    ret = tup_context_get_stats(setup.host, &stats);
+    if (ret < 0 || stats.n_frames_tx != 0 || stats.n_frames_rx != 0
+            || !check_latency_count(&setup, TUP_MESSAGE_CMD_LOAD, 0)) {
+        fprintf(stderr, "context: stats aren't reset\n");
+        goto done;
+    }
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    return success;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!test_histogram() || !test_context())
+        return 1;
+
+    printf("stats count the traffic and its latency\n");
+    return 0;
+}
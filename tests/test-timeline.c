@@ -0,0 +1,331 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <libtup.h>
+#include <libtupsim.h>
+
+#define N_ELEMENTS(arr) (sizeof((arr)) / sizeof((arr)[0]))
+
+#define TEST_N_PUMPS 16
+#define TEST_LOOKAHEAD_US 2000
+
+typedef struct
+{
+    uint64_t time_us;
+    int32_t value;
+
+    int id;
+    uint64_t sent_us;
+} TestEvent;
+
+typedef struct
+{
+    TupTransport *transports[2];
+    TupContext *host;
+    TupSimDevice *dev;
+    TupTimeline *timeline;
+    TupMessage *msg;
+
+    uint64_t start_us;
+    TestEvent *events;
+    size_t n_events;
+
+    /* index in events of the sent commands, in sending order */
+    size_t sent[8];
+    size_t n_sent;
+} TestSetup;
+
+static uint64_t get_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void on_event_sent(TupTimeline *timeline, int event_id,
+        uint32_t lateness_us, void *userdata)
+{
+    TestSetup *setup = userdata;
+    size_t i;
+
+    for (i = 0; i < setup->n_events; i++) {
+        if (setup->events[i].id == event_id)
+            break;
+    }
+
+    if (i == setup->n_events || setup->n_sent == N_ELEMENTS(setup->sent))
+        return;
+
+    setup->events[i].sent_us = get_time_us() - setup->start_us;
+    setup->sent[setup->n_sent++] = i;
+}
+
+static bool setup_init(TestSetup *setup)
+{
+    int ret;
+
+    memset(setup, 0, sizeof(*setup));
+
+    setup->msg = tup_message_new();
+    if (setup->msg == NULL) {
+        fprintf(stderr, "failed to create the message\n");
+        return false;
+    }
+
+    ret = tup_transport_new_socketpair(&setup->transports[0],
+            &setup->transports[1]);
+    if (ret < 0) {
+        fprintf(stderr, "failed to create socketpair transports: %d\n", ret);
+        return false;
+    }
+
+    setup->host = tup_context_new_with_transport(setup->transports[0], NULL,
+            NULL);
+    setup->dev = tup_sim_device_new(setup->transports[1], NULL);
+    if (setup->host == NULL || setup->dev == NULL
+            || tup_sim_device_open(setup->dev, NULL) < 0) {
+        fprintf(stderr, "failed to create the host and the device\n");
+        return false;
+    }
+
+    setup->timeline = tup_timeline_new(setup->host);
+    if (setup->timeline == NULL) {
+        fprintf(stderr, "failed to create the timeline\n");
+        return false;
+    }
+
+    tup_timeline_set_callback(setup->timeline, on_event_sent, setup);
+    return true;
+}
+
+static void setup_clear(TestSetup *setup)
+{
+    if (setup->timeline != NULL)
+        tup_timeline_free(setup->timeline);
+
+    if (setup->dev != NULL)
+        tup_sim_device_free(setup->dev);
+    else if (setup->transports[1] != NULL)
+        tup_transport_free(setup->transports[1]);
+
+    if (setup->host != NULL)
+        tup_context_free(setup->host);
+    else if (setup->transports[0] != NULL)
+        tup_transport_free(setup->transports[0]);
+
+    if (setup->msg != NULL)
+        tup_message_free(setup->msg);
+}
+
+/* let the device execute what has been sent and read one of its inputs */
+static int get_device_input(TestSetup *setup, uint8_t input_id,
+        int32_t *value)
+{
+    TupContext *device = tup_sim_device_get_context(setup->dev);
+    TupInputValueArgs args[1];
+    TupMessage *response;
+    uint8_t slot_id;
+    int ret = 0;
+    int i;
+
+    for (i = 0; i < TEST_N_PUMPS && ret == 0; i++)
+        ret = tup_context_process_fd(device);
+
+    if (ret < 0)
+        return ret;
+
+    response = tup_message_new();
+    if (response == NULL)
+        return SMP_ERROR_NO_MEM;
+
+    tup_message_clear(setup->msg);
+    tup_message_init_get_input_value_simple(setup->msg, 1, input_id);
+
+    ret = tup_sim_device_handle_message(setup->dev, setup->msg, response);
+    if (ret == 0)
+        ret = tup_message_parse_resp_input(response, &slot_id, args, 1);
+
+    if (ret == 1)
+        *value = args[0].input_value;
+
+    tup_message_free(response);
+    return (ret == 1) ? 0 : SMP_ERROR_BAD_MESSAGE;
+}
+
+/* commands are sent in deadline order, not before their time minus the
+ * lookahead, ties in scheduling order */
+static bool test_order(void)
+{
+    TestEvent events[] = {
+        { 0, 0, 0, 0 },
+        { 30000, 3, 0, 0 },
+        { 10000, 1, 0, 0 },
+        { 20000, 20, 0, 0 },
+        { 20000, 21, 0, 0 },
+    };
+    const size_t expected[] = { 0, 2, 3, 4, 1 };
+    TupTimelineStats stats;
+    TestSetup setup;
+    int32_t value = 0;
+    bool success = false;
+    size_t i;
+    int ret;
+
+    if (!setup_init(&setup))
+        goto done;
+
+    setup.events = events;
+    setup.n_events = N_ELEMENTS(events);
+
+    tup_timeline_set_lookahead(setup.timeline, TEST_LOOKAHEAD_US);
+
+    for (i = 0; i < N_ELEMENTS(events); i++) {
+        tup_message_clear(setup.msg);
+
+        if (i == 0)
+            tup_message_init_load(setup.msg, 1, 0);
+        else
+            tup_message_init_set_input_value_simple(setup.msg, 1, 0,
+                    events[i].value);
+
+        ret = tup_timeline_schedule(setup.timeline, events[i].time_us,
+                setup.msg);
+        if (ret <= 0) {
+            fprintf(stderr, "order: failed to schedule %zu: %d\n", i, ret);
+            goto done;
+        }
+
+        events[i].id = ret;
+    }
+
+    /* the message is encoded when scheduled */
+    tup_message_clear(setup.msg);
+    tup_message_init_set_input_value_simple(setup.msg, 1, 0, 99);
+
+    if (tup_timeline_get_n_pending(setup.timeline) != N_ELEMENTS(events)) {
+        fprintf(stderr, "order: %zu pending commands, expected %zu\n",
+                tup_timeline_get_n_pending(setup.timeline),
+                N_ELEMENTS(events));
+        goto done;
+    }
+
+    setup.start_us = get_time_us();
+
+    ret = tup_timeline_start(setup.timeline);
+    if (ret == 0)
+        ret = tup_timeline_run(setup.timeline);
+
+    if (ret < 0) {
+        fprintf(stderr, "order: failed to run the timeline: %d\n", ret);
+        goto done;
+    }
+
+    if (setup.n_sent != N_ELEMENTS(expected)) {
+        fprintf(stderr, "order: %zu commands sent, expected %zu\n",
+                setup.n_sent, N_ELEMENTS(expected));
+        goto done;
+    }
+
+    for (i = 0; i < N_ELEMENTS(expected); i++) {
+        const TestEvent *event = &events[setup.sent[i]];
+
+        if (setup.sent[i] != expected[i]) {
+            fprintf(stderr, "order: command %zu sent at position %zu\n",
+                    setup.sent[i], i);
+            goto done;
+        }
+
+        if (event->sent_us + TEST_LOOKAHEAD_US < event->time_us) {
+            fprintf(stderr, "order: command %zu due at %lu us sent at %lu "
+                    "us\n", setup.sent[i], (unsigned long) event->time_us,
+                    (unsigned long) event->sent_us);
+            goto done;
+        }
+    }
+
+    tup_timeline_get_stats(setup.timeline, &stats);
+    if (stats.n_sent != N_ELEMENTS(events) || stats.n_errors != 0
+            || stats.lateness.count != N_ELEMENTS(events)
+            || tup_timeline_get_n_pending(setup.timeline) != 0) {
+        fprintf(stderr, "order: %lu sent, %lu errors and %lu lateness "
+                "samples\n", (unsigned long) stats.n_sent,
+                (unsigned long) stats.n_errors,
+                (unsigned long) stats.lateness.count);
+        goto done;
+    }
+
+    ret = get_device_input(&setup, 0, &value);
+    if (ret < 0 || value != 3) {
+        fprintf(stderr, "order: device input is %d, expected 3\n", value);
+        goto done;
+    }
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    return success;
+}
+
+/* cleared commands are never sent */
+static bool test_clear(void)
+{
+    TupTimelineStats stats;
+    TestSetup setup;
+    bool success = false;
+    int ret;
+
+    if (!setup_init(&setup))
+        goto done;
+
+    tup_message_init_get_version(setup.msg);
+
+    ret = tup_timeline_schedule(setup.timeline, 0, setup.msg);
+    if (ret > 0)
+        ret = tup_timeline_schedule(setup.timeline, 1000, setup.msg);
+
+    if (ret < 0) {
+        fprintf(stderr, "clear: failed to schedule: %d\n", ret);
+        goto done;
+    }
+
+    tup_timeline_clear(setup.timeline);
+
+    ret = tup_timeline_start(setup.timeline);
+    if (ret == 0)
+        ret = tup_timeline_dispatch(setup.timeline);
+
+    if (ret != 0) {
+        fprintf(stderr, "clear: dispatch returned %d\n", ret);
+        goto done;
+    }
+
+    tup_timeline_get_stats(setup.timeline, &stats);
+    if (stats.n_sent != 0 || setup.n_sent != 0
+            || tup_timeline_get_n_pending(setup.timeline) != 0) {
+        fprintf(stderr, "clear: cleared commands were sent\n");
+        goto done;
+    }
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    return success;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!test_order() || !test_clear())
+        return 1;
+
+    printf("timeline sends commands on time and in order\n");
+    return 0;
+}
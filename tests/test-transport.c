@@ -0,0 +1,373 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <libtup.h>
+#include <libtupsim.h>
+
+#define TEST_N_PUMPS 64
+
+/* enough for an escaped ack */
+#define TEST_FRAME_SIZE 32
+
+/* every framing byte, which have to be escaped on the wire */
+#define TEST_PARAMETER_VALUE 0x10ff1b10
+
+typedef struct
+{
+    TupTransport *transports[2];
+    TupContext *host;
+    TupSimDevice *dev;
+    TupMessage *msg;
+
+    unsigned int n_ok;
+    uint32_t value;
+
+    unsigned long n_received;
+    unsigned long n_errors;
+    TupMessage *last;
+} TestSetup;
+
+static void on_request_done(TupContext *ctx, TupMessageType cmd,
+        TupRequestStatus status, TupMessage *response, void *userdata)
+{
+    TestSetup *setup = userdata;
+    TupParameterArgs args[1];
+    uint8_t effect_id;
+
+    if (status != TUP_REQUEST_STATUS_OK) {
+        fprintf(stderr, "request %d completed with status %d\n", cmd, status);
+        return;
+    }
+
+    setup->n_ok++;
+
+    if (cmd == TUP_MESSAGE_CMD_GET_PARAMETER
+            && tup_message_parse_resp_parameter(response, &effect_id, args,
+                1) == 1)
+        setup->value = args[0].parameter_value;
+}
+
+static void on_host_message(TupContext *ctx, TupMessage *msg, void *userdata)
+{
+    TestSetup *setup = userdata;
+    TupMessageType cmd;
+    uint32_t arg1;
+
+    setup->n_received++;
+
+    /* keep what's needed of the last message */
+    tup_message_clear(setup->last);
+    if (tup_message_parse_ack_full(msg, &cmd, &arg1) == 0)
+        tup_message_init_ack_full(setup->last, cmd, arg1);
+}
+
+static void on_host_error(TupContext *ctx, SmpError error, void *userdata)
+{
+    TestSetup *setup = userdata;
+
+    setup->n_errors++;
+}
+
+static void setup_reset(TestSetup *setup)
+{
+    memset(setup, 0, sizeof(*setup));
+}
+
+/* the device end is only given to the simulated device when not NULL, the
+ * host opens its pty when open_pty is set */
+static bool setup_init(TestSetup *setup, bool open_pty)
+{
+    TupCallbacks cbs = {
+        .new_message_cb = on_host_message,
+        .error_cb = on_host_error,
+    };
+    int ret;
+
+    setup->msg = tup_message_new();
+    setup->last = tup_message_new();
+    if (setup->msg == NULL || setup->last == NULL) {
+        fprintf(stderr, "failed to create the messages\n");
+        return false;
+    }
+
+    /* the pty is allocated when the device is opened */
+    if (setup->transports[1] != NULL) {
+        setup->dev = tup_sim_device_new(setup->transports[1], NULL);
+        if (setup->dev == NULL
+                || tup_sim_device_open(setup->dev, NULL) < 0) {
+            fprintf(stderr, "failed to create the device\n");
+            return false;
+        }
+    }
+
+    setup->host = tup_context_new_with_transport(setup->transports[0], &cbs,
+            setup);
+    if (setup->host == NULL) {
+        fprintf(stderr, "failed to create the host\n");
+        return false;
+    }
+
+    ret = tup_context_open(setup->host,
+            open_pty ? tup_transport_get_pty_name(setup->transports[1]) : NULL);
+    if (ret < 0) {
+        fprintf(stderr, "failed to open the host: %d\n", ret);
+        return false;
+    }
+
+    return true;
+}
+
+static void setup_clear(TestSetup *setup)
+{
+    if (setup->dev != NULL)
+        tup_sim_device_free(setup->dev);
+    else if (setup->transports[1] != NULL)
+        tup_transport_free(setup->transports[1]);
+
+    if (setup->host != NULL)
+        tup_context_free(setup->host);
+    else if (setup->transports[0] != NULL)
+        tup_transport_free(setup->transports[0]);
+
+    if (setup->msg != NULL)
+        tup_message_free(setup->msg);
+
+    if (setup->last != NULL)
+        tup_message_free(setup->last);
+}
+
+/* let the device answer everything written so far, data may take a little
+ * while to go through a pty */
+static int pump(TestSetup *setup)
+{
+    TupContext *device = tup_sim_device_get_context(setup->dev);
+    int ret;
+    int i;
+
+    for (i = 0; i < TEST_N_PUMPS && setup->n_ok < 3; i++) {
+        ret = tup_context_process_fd(device);
+        if (ret < 0)
+            return ret;
+
+        ret = tup_context_process_fd(setup->host);
+        if (ret < 0)
+            return ret;
+
+        usleep(1000);
+    }
+
+    return 0;
+}
+
+/* a parameter made of framing bytes is set and read back through the
+ * transports */
+static bool run_round_trip(const char *name, TestSetup *setup,
+        bool open_pty)
+{
+    bool success = false;
+    int ret;
+
+    if (!setup_init(setup, open_pty))
+        goto done;
+
+    tup_message_init_load(setup->msg, 1, 0);
+    ret = tup_context_send_request(setup->host, setup->msg, on_request_done,
+            setup);
+
+    if (ret == 0) {
+        tup_message_clear(setup->msg);
+        tup_message_init_set_parameter_simple(setup->msg, 1, 3,
+                TEST_PARAMETER_VALUE);
+        ret = tup_context_send_request(setup->host, setup->msg,
+                on_request_done, setup);
+    }
+
+    if (ret == 0) {
+        tup_message_clear(setup->msg);
+        tup_message_init_get_parameter_simple(setup->msg, 1, 3);
+        ret = tup_context_send_request(setup->host, setup->msg,
+                on_request_done, setup);
+    }
+
+    if (ret == 0)
+        ret = pump(setup);
+
+    if (ret < 0) {
+        fprintf(stderr, "%s: failed to exchange messages: %d\n", name, ret);
+        goto done;
+    }
+
+    if (setup->n_ok != 3 || setup->value != TEST_PARAMETER_VALUE) {
+        fprintf(stderr, "%s: %u requests ok and value 0x%08x, expected 3 "
+                "and 0x%08x\n", name, setup->n_ok, setup->value,
+                TEST_PARAMETER_VALUE);
+        goto done;
+    }
+
+    success = true;
+
+done:
+    setup_clear(setup);
+    return success;
+}
+
+static bool test_loopback(void)
+{
+    TestSetup setup;
+    int ret;
+
+    setup_reset(&setup);
+
+    ret = tup_transport_new_loopback(&setup.transports[0],
+            &setup.transports[1], 0);
+    if (ret < 0) {
+        fprintf(stderr, "failed to create loopback transports: %d\n", ret);
+        return false;
+    }
+
+    return run_round_trip("loopback", &setup, false);
+}
+
+static bool test_socketpair(void)
+{
+    TestSetup setup;
+    int ret;
+
+    setup_reset(&setup);
+
+    ret = tup_transport_new_socketpair(&setup.transports[0],
+            &setup.transports[1]);
+    if (ret < 0) {
+        fprintf(stderr, "failed to create socketpair transports: %d\n", ret);
+        return false;
+    }
+
+    return run_round_trip("socketpair", &setup, false);
+}
+
+/* the host opens and configures the pty like a serial device */
+static bool test_pty(void)
+{
+    TestSetup setup;
+
+    setup_reset(&setup);
+
+    setup.transports[1] = tup_transport_new_pty();
+    if (setup.transports[1] == NULL) {
+        fprintf(stderr, "failed to create a pty\n");
+        return false;
+    }
+
+    setup.transports[0] = tup_transport_new_serial();
+    if (setup.transports[0] == NULL) {
+        fprintf(stderr, "failed to create a serial transport\n");
+        tup_transport_free(setup.transports[1]);
+        return false;
+    }
+
+    return run_round_trip("pty", &setup, true);
+}
+
+static int feed(TestSetup *setup, int fd, const uint8_t *data, size_t size)
+{
+    if (write(fd, data, size) != (ssize_t) size)
+        return SMP_ERROR_IO;
+
+    return tup_context_process_fd(setup->host);
+}
+
+/* the decoder skips bytes out of frames, reassembles split frames and drops
+ * corrupted ones */
+static bool test_decoder(void)
+{
+    static const uint8_t garbage[] = { 0x00, 0x42, 0xff };
+    uint8_t frame[TEST_FRAME_SIZE];
+    uint8_t corrupted[TEST_FRAME_SIZE];
+    TupMessageType cmd;
+    TestSetup setup;
+    uint32_t arg1;
+    bool success = false;
+    int sv[2] = { -1, -1 };
+    int size;
+    int ret;
+
+    setup_reset(&setup);
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        fprintf(stderr, "decoder: failed to create a socketpair\n");
+        return false;
+    }
+
+    setup.transports[0] = tup_transport_new_fd(sv[0], sv[0]);
+    if (setup.transports[0] == NULL) {
+        fprintf(stderr, "decoder: failed to create the transport\n");
+        close(sv[0]);
+        goto done;
+    }
+
+    if (!setup_init(&setup, false))
+        goto done;
+
+    /* the argument has to be escaped */
+    size = tup_encode_ack_full(frame, sizeof(frame), TUP_MESSAGE_CMD_LOAD,
+            0x10);
+    if (size < 0) {
+        fprintf(stderr, "decoder: failed to encode: %d\n", size);
+        goto done;
+    }
+
+    /* flip a bit of the command id, which is not a framing byte */
+    memcpy(corrupted, frame, size);
+    corrupted[1] ^= 0x01;
+
+    ret = feed(&setup, sv[1], garbage, sizeof(garbage));
+    if (ret == 0)
+        ret = feed(&setup, sv[1], corrupted, size);
+
+    if (ret == 0)
+        ret = feed(&setup, sv[1], frame, size / 2);
+
+    if (ret == 0)
+        ret = feed(&setup, sv[1], frame + size / 2, size - size / 2);
+
+    if (ret < 0) {
+        fprintf(stderr, "decoder: failed to feed the host: %d\n", ret);
+        goto done;
+    }
+
+    if (setup.n_received != 1 || setup.n_errors != 1) {
+        fprintf(stderr, "decoder: %lu messages and %lu errors, expected 1 "
+                "and 1\n", setup.n_received, setup.n_errors);
+        goto done;
+    }
+
+    if (tup_message_parse_ack_full(setup.last, &cmd, &arg1) < 0
+            || cmd != TUP_MESSAGE_CMD_LOAD || arg1 != 0x10) {
+        fprintf(stderr, "decoder: the message isn't decoded as sent\n");
+        goto done;
+    }
+
+    success = true;
+
+done:
+    setup_clear(&setup);
+    close(sv[1]);
+    return success;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!test_loopback() || !test_socketpair() || !test_pty()
+            || !test_decoder())
+        return 1;
+
+    printf("messages go through every transport\n");
+    return 0;
+}
@@ -123,27 +123,36 @@ static void sort_task_by_id(TupDebugTaskStatus *in, TupDebugTaskStatus *out,
     }
 }
 
-static void handle_debug_system_status_response(SmpMessage *message)
-{
-    TupDebugSystemStatus status;
-    TupDebugTaskStatus unsorted_tasks[16];
-    TupDebugTaskStatus tasks[16];
-    int n_tasks;
+static void on_debug_system_status(TupContext *ctx,
+        const TupDebugSystemStatus *system_status,
+        const TupDebugTaskStatus *system_tasks, size_t n_system_tasks,
+        void *userdata)
+{
+    TupDebugSystemStatus status = *system_status;
+    TupDebugTaskStatus *unsorted_tasks;
+    TupDebugTaskStatus *tasks;
+    unsigned int n_tasks;
     struct {
         unsigned int running;
         unsigned int ready;
         unsigned int waiting;
         unsigned int stopped;
     } tasks_stats = { 0, 0, 0, 0};
-    int i;
+    unsigned int i;
 
-    n_tasks = tup_message_parse_resp_debug_system_status(message, &status,
-            unsorted_tasks, N_ELEMENTS(unsorted_tasks));
-    if (n_tasks < 0) {
-        fprintf(stderr, "failed to parse system status response\n");
+    response_recv = 1;
+
+    n_tasks = n_system_tasks;
+    /* both lists in one block, never empty */
+    unsorted_tasks = malloc(2 * n_tasks * sizeof(*system_tasks) + 1);
+    if (unsorted_tasks == NULL) {
+        printf("failed to allocate tasks\n");
         return;
     }
 
+    tasks = unsorted_tasks + n_tasks;
+    memcpy(unsorted_tasks, system_tasks, n_tasks * sizeof(*system_tasks));
+
     sort_task_by_id(unsorted_tasks, tasks, n_tasks);
 
     for (i = 0; i < n_tasks; i++) {
@@ -205,6 +214,8 @@ static void handle_debug_system_status_response(SmpMessage *message)
                 tasks[i].id, c, tasks[i].priority, tasks[i].rem_stack,
                 TIME_ARGS(tasks[i].time), tasks[i].name);
     }
+
+    free(unsorted_tasks);
 }
 
 static TupFilterId tup_filter_id_from_name(const char *name)
@@ -228,99 +239,100 @@ static const char *tup_filter_id_to_str(TupFilterId id)
 }
 
 /* RX message handling */
-static void on_tup_message(TupContext *ctx, TupMessage *message, void *userdata)
+static void on_ack(TupContext *ctx, TupMessageType cmd, uint32_t data,
+        void *userdata)
 {
-    switch (TUP_MESSAGE_TYPE(message)) {
-        case TUP_MESSAGE_ACK:
-            printf("done\n");
-            break;
-        case TUP_MESSAGE_ERROR: {
-            TupMessageType cmd;
-            uint32_t error;
+    printf("done\n");
+    response_recv = 1;
+}
 
-            tup_message_parse_error(message, &cmd, &error);
-            printf("error: 0x%08x\n", error);
-            break;
-        }
-        case TUP_MESSAGE_RESP_VERSION: {
-            const char *version;
+static void on_error(TupContext *ctx, TupMessageType cmd, uint32_t error,
+        uint32_t data, void *userdata)
+{
+    printf("error: 0x%08x\n", error);
+    response_recv = 1;
+}
 
-            tup_message_parse_resp_version(message, &version);
-            printf("tactronik version: %s\n", version);
-            break;
-        }
-        case TUP_MESSAGE_RESP_PARAMETER: {
-            uint8_t id;
-            TupParameterArgs args[1];
-
-            tup_message_parse_resp_parameter(message, &id, args,
-                    N_ELEMENTS(args));
-            printf("effect %d parameter %d value is %d\n", id,
-                    args[0].parameter_id, args[0].parameter_value);
-            break;
-        }
-        case TUP_MESSAGE_RESP_SENSOR: {
-            TupSensorValueArgs args[1];
+static void on_version(TupContext *ctx, const char *version, void *userdata)
+{
+    printf("tactronik version: %s\n", version);
+    response_recv = 1;
+}
 
-            tup_message_parse_resp_sensor(message, args, N_ELEMENTS(args));
-            printf("sensor %d value is %d\n", args[0].sensor_id,
-                    args[0].sensor_value);
-            break;
-        }
-        case TUP_MESSAGE_RESP_INPUT: {
-            uint8_t effect_slot_id;
-            TupInputValueArgs args[1];
-
-            tup_message_parse_resp_input(message, &effect_slot_id, args,
-                    N_ELEMENTS(args));
-            printf("input %d of effect %d have value %d\n", args[0].input_id,
-                    effect_slot_id, args[0].input_value);
-            break;
-        }
-        case TUP_MESSAGE_RESP_BUILDINFO: {
-            const char *buildinfo;
+static void on_buildinfo(TupContext *ctx, const char *buildinfo,
+        void *userdata)
+{
+    printf("build information:\n%s", buildinfo);
+    response_recv = 1;
+}
 
-            tup_message_parse_resp_buildinfo(message, &buildinfo);
-            printf("build information:\n%s", buildinfo);
-            break;
-        }
-        case TUP_MESSAGE_RESP_FILTER_ACTIVE: {
-            TupFilterId filter;
-            uint8_t actuator_id;
-            bool active;
-
-            tup_message_parse_resp_filter_active(message, &filter, &actuator_id,
-                    &active);
-            printf("filter '%s' for actuator %u is %s\n",
-                    tup_filter_id_to_str(filter), actuator_id,
-                    active ? "enabled" : "disabled");
-            break;
-        }
-        case TUP_MESSAGE_RESP_BAND_NORM_COEFFS: {
-            uint8_t actuator_id;
-            float a[5], b[5];
-
-            tup_message_parse_resp_band_norm_coeffs(message, &actuator_id, a,
-                    b);
-            printf("band normalizer coefficients for actuator %u:\n"
-                    "a: %f %f %f %f %f\n"
-                    "b: %f %f %f %f %f\n",
-                    actuator_id,
-                    a[0], a[1], a[2], a[3], a[4],
-                    b[0], b[1], b[2], b[3], b[4]);
-            break;
-        }
-        case TUP_MESSAGE_RESP_DEBUG_SYSTEM_STATUS:
-            handle_debug_system_status_response(message);
-            break;
-        default:
-            printf("Unhandled message id %d\n", TUP_MESSAGE_TYPE(message));
-            break;
+static void on_parameter(TupContext *ctx, uint8_t effect_id,
+        const TupParameterArgs *args, size_t n_args, void *userdata)
+{
+    size_t i;
+
+    for (i = 0; i < n_args; i++) {
+        printf("effect %d parameter %d value is %d\n", effect_id,
+                args[i].parameter_id, args[i].parameter_value);
+    }
+
+    response_recv = 1;
+}
+
+static void on_sensor(TupContext *ctx, const TupSensorValueArgs *args,
+        size_t n_args, void *userdata)
+{
+    size_t i;
+
+    for (i = 0; i < n_args; i++) {
+        printf("sensor %d value is %d\n", args[i].sensor_id,
+                args[i].sensor_value);
     }
 
     response_recv = 1;
 }
 
+static void on_input(TupContext *ctx, uint8_t effect_slot_id,
+        const TupInputValueArgs *args, size_t n_args, void *userdata)
+{
+    size_t i;
+
+    for (i = 0; i < n_args; i++) {
+        printf("input %d of effect %d have value %d\n", args[i].input_id,
+                effect_slot_id, args[i].input_value);
+    }
+
+    response_recv = 1;
+}
+
+static void on_filter_active(TupContext *ctx, TupFilterId filter,
+        uint8_t actuator_id, bool active, void *userdata)
+{
+    printf("filter '%s' for actuator %u is %s\n",
+            tup_filter_id_to_str(filter), actuator_id,
+            active ? "enabled" : "disabled");
+    response_recv = 1;
+}
+
+static void on_band_norm_coeffs(TupContext *ctx, uint8_t actuator_id,
+        const float a[5], const float b[5], void *userdata)
+{
+    printf("band normalizer coefficients for actuator %u:\n"
+            "a: %f %f %f %f %f\n"
+            "b: %f %f %f %f %f\n",
+            actuator_id,
+            a[0], a[1], a[2], a[3], a[4],
+            b[0], b[1], b[2], b[3], b[4]);
+    response_recv = 1;
+}
+
+/* messages without handler */
+static void on_tup_message(TupContext *ctx, TupMessage *message, void *userdata)
+{
+    printf("Unhandled message id %d\n", TUP_MESSAGE_TYPE(message));
+    response_recv = 1;
+}
+
 static void on_tup_error(TupContext *ctx, SmpError error, void *userdata)
 {
     fprintf(stderr, "Tup error: %d", error);
@@ -896,6 +908,19 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    tup_context_set_ack_handler(tup_ctx, on_ack, NULL);
+    tup_context_set_error_handler(tup_ctx, on_error, NULL);
+    tup_context_set_version_handler(tup_ctx, on_version, NULL);
+    tup_context_set_buildinfo_handler(tup_ctx, on_buildinfo, NULL);
+    tup_context_set_parameter_handler(tup_ctx, on_parameter, NULL);
+    tup_context_set_sensor_handler(tup_ctx, on_sensor, NULL);
+    tup_context_set_input_handler(tup_ctx, on_input, NULL);
+    tup_context_set_filter_active_handler(tup_ctx, on_filter_active, NULL);
+    tup_context_set_band_norm_coeffs_handler(tup_ctx, on_band_norm_coeffs,
+            NULL);
+    tup_context_set_debug_system_status_handler(tup_ctx,
+            on_debug_system_status, NULL);
+
     ret = tup_context_open(tup_ctx, device);
     if (ret < 0) {
         fprintf(stderr, "error while initializing tup context: %d", ret);
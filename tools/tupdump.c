@@ -0,0 +1,677 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <libtup.h>
+
+#define N_ELEMENTS(arr) (sizeof((arr)) / sizeof((arr)[0]))
+
+/* message ids fit in a byte, others are counted as unknown */
+#define DUMP_N_TYPES 256
+#define DUMP_UNKNOWN_TYPE 0
+
+/* commands awaiting a response, by command */
+#define DUMP_MAX_PENDING 64
+
+/* a message has at most one value per two bytes */
+#define DUMP_MAX_VALUES 512
+
+#define DUMP_DEFAULT_BAUDRATE 115200
+
+typedef struct
+{
+    uint64_t time_ns;
+    int slot;
+} DumpPending;
+
+typedef struct
+{
+    DumpPending entries[DUMP_MAX_PENDING];
+    unsigned int head;
+    unsigned int count;
+} DumpPendingQueue;
+
+typedef struct
+{
+    uint64_t n_frames;
+    uint64_t n_bytes;
+    uint64_t n_malformed;
+    uint64_t last_ns;
+    TupLatencyHistogram gaps;
+} DumpDirection;
+
+typedef struct
+{
+    /* options */
+    bool types[DUMP_N_TYPES];
+    bool filter_types;
+    int slot;
+    int direction;
+    uint64_t from_ns;
+    uint64_t to_ns;
+    unsigned long baudrate;
+    bool quiet;
+
+    /* frame being decoded */
+    TupMessage *msg;
+    uint8_t buf[2 * 1024];
+    SmpValue values[DUMP_MAX_VALUES];
+
+    /* statistics of the selected frames */
+    uint64_t first_ns;
+    uint64_t last_ns;
+    uint64_t n_frames;
+    uint64_t n_messages[DUMP_N_TYPES][2];
+    DumpDirection directions[2];
+
+    /* statistics of the commands, by command */
+    DumpPendingQueue pending[DUMP_N_TYPES];
+    TupLatencyHistogram latencies[DUMP_N_TYPES];
+    uint64_t n_errors[DUMP_N_TYPES];
+    uint64_t n_unanswered[DUMP_N_TYPES];
+} Dump;
+
+static const char *dump_type_name(unsigned int type)
+{
+    TupMessageInfo info;
+
+    if (type == DUMP_UNKNOWN_TYPE || tup_message_type_get_info(type, &info) < 0)
+        return "UNKNOWN";
+
+    return info.name;
+}
+
+static int dump_type_parse(const char *name, size_t len)
+{
+    char *end;
+    unsigned long id;
+    unsigned int i;
+
+    id = strtoul(name, &end, 0);
+    if (end == name + len)
+        return (id > DUMP_UNKNOWN_TYPE && id < DUMP_N_TYPES) ? (int) id : -1;
+
+    for (i = 1; i < DUMP_N_TYPES; i++) {
+        const char *type_name = dump_type_name(i);
+
+        if (strlen(type_name) == len && strncasecmp(type_name, name, len) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+static int dump_types_parse(Dump *dump, const char *list)
+{
+    const char *end;
+    int type;
+
+    while (*list != '\0') {
+        end = strchr(list, ',');
+        if (end == NULL)
+            end = list + strlen(list);
+
+        type = dump_type_parse(list, end - list);
+        if (type < 0)
+            return -1;
+
+        dump->types[type] = true;
+        list = (*end == ',') ? end + 1 : end;
+    }
+
+    dump->filter_types = true;
+    return 0;
+}
+
+static int dump_range_parse(Dump *dump, const char *range)
+{
+    char *end;
+    double from = 0;
+    double to = -1;
+
+    if (*range != ':') {
+        from = strtod(range, &end);
+        if (end == range || from < 0)
+            return -1;
+
+        range = end;
+    }
+
+    if (*range == ':' && *++range != '\0') {
+        to = strtod(range, &end);
+        if (end == range || to < from)
+            return -1;
+
+        range = end;
+    }
+
+    if (*range != '\0')
+        return -1;
+
+    dump->from_ns = from * 1e9;
+    dump->to_ns = (to >= 0) ? (uint64_t) (to * 1e9) : UINT64_MAX;
+    return 0;
+}
+
+/* the slot a message is about, for the ones which have one */
+static int dump_get_slot(TupMessageType type, const SmpValue *values, int n)
+{
+    switch (type) {
+        case TUP_MESSAGE_CMD_LOAD:
+        case TUP_MESSAGE_CMD_PLAY:
+        case TUP_MESSAGE_CMD_STOP:
+        case TUP_MESSAGE_CMD_GET_PARAMETER:
+        case TUP_MESSAGE_CMD_SET_PARAMETER:
+        case TUP_MESSAGE_CMD_BIND_EFFECT:
+        case TUP_MESSAGE_CMD_GET_INPUT_VALUE:
+        case TUP_MESSAGE_CMD_SET_INPUT_VALUE:
+        case TUP_MESSAGE_RESP_PARAMETER:
+        case TUP_MESSAGE_RESP_INPUT:
+        case TUP_MESSAGE_RESP_SET_PARAMETER:
+            return (n > 0) ? values[0].value.u8 : -1;
+        default:
+            return -1;
+    }
+}
+
+/* the commands a response answers, as the request API matches them */
+static int dump_get_commands(TupMessageType type, const SmpValue *values,
+        int n, unsigned int commands[2])
+{
+    switch (type) {
+        case TUP_MESSAGE_ACK:
+        case TUP_MESSAGE_ERROR:
+            if (n < 1 || values[0].value.u32 >= DUMP_N_TYPES)
+                return 0;
+
+            commands[0] = values[0].value.u32;
+            return 1;
+        case TUP_MESSAGE_RESP_VERSION:
+            commands[0] = TUP_MESSAGE_CMD_GET_VERSION;
+            return 1;
+        case TUP_MESSAGE_RESP_PARAMETER:
+            commands[0] = TUP_MESSAGE_CMD_GET_PARAMETER;
+            return 1;
+        case TUP_MESSAGE_RESP_SENSOR:
+            commands[0] = TUP_MESSAGE_CMD_GET_SENSOR_VALUE;
+            return 1;
+        case TUP_MESSAGE_RESP_BUILDINFO:
+            commands[0] = TUP_MESSAGE_CMD_GET_BUILDINFO;
+            return 1;
+        case TUP_MESSAGE_RESP_INPUT:
+            commands[0] = TUP_MESSAGE_CMD_GET_INPUT_VALUE;
+            return 1;
+        case TUP_MESSAGE_RESP_SET_PARAMETER:
+            commands[0] = TUP_MESSAGE_CMD_SET_PARAMETER;
+            return 1;
+        case TUP_MESSAGE_RESP_FILTER_ACTIVE:
+            commands[0] = TUP_MESSAGE_CMD_FILTER_GET_ACTIVE;
+            commands[1] = TUP_MESSAGE_CMD_FILTER_SET_ACTIVE;
+            return 2;
+        case TUP_MESSAGE_RESP_BAND_NORM_COEFFS:
+            commands[0] = TUP_MESSAGE_CMD_CONFIG_BAND_NORM_GET_COEFFS;
+            commands[1] = TUP_MESSAGE_CMD_CONFIG_BAND_NORM_SET_COEFFS;
+            return 2;
+        case TUP_MESSAGE_RESP_DEBUG_SYSTEM_STATUS:
+            commands[0] = TUP_MESSAGE_CMD_DEBUG_GET_SYSTEM_STATUS;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static bool dump_is_command(unsigned int type)
+{
+    return (type >= TUP_MESSAGE_CMD_LOAD && type < TUP_MESSAGE_RESP_VERSION)
+        || type == TUP_MESSAGE_CMD_DEBUG_GET_SYSTEM_STATUS;
+}
+
+static void dump_push_command(Dump *dump, unsigned int type, uint64_t time_ns,
+        int slot)
+{
+    DumpPendingQueue *queue = &dump->pending[type];
+    DumpPending *pending;
+
+    /* the oldest command is given up on */
+    if (queue->count == DUMP_MAX_PENDING) {
+        queue->head = (queue->head + 1) % DUMP_MAX_PENDING;
+        queue->count--;
+        dump->n_unanswered[type]++;
+    }
+
+    pending = &queue->entries[(queue->head + queue->count) % DUMP_MAX_PENDING];
+    pending->time_ns = time_ns;
+    pending->slot = slot;
+    queue->count++;
+}
+
+/* match a response to the oldest command it answers, return the command or
+ * -1 if there is none */
+static int dump_pop_command(Dump *dump, TupMessageType type,
+        const SmpValue *values, int n, DumpPending *pending)
+{
+    DumpPendingQueue *queue;
+    unsigned int commands[2];
+    int n_commands;
+    int command = -1;
+    int i;
+
+    n_commands = dump_get_commands(type, values, n, commands);
+    for (i = 0; i < n_commands; i++) {
+        queue = &dump->pending[commands[i]];
+        if (queue->count > 0 && (command < 0
+                    || queue->entries[queue->head].time_ns
+                    < dump->pending[command].entries[
+                        dump->pending[command].head].time_ns))
+            command = commands[i];
+    }
+
+    if (command < 0)
+        return -1;
+
+    queue = &dump->pending[command];
+    *pending = queue->entries[queue->head];
+    queue->head = (queue->head + 1) % DUMP_MAX_PENDING;
+    queue->count--;
+    return command;
+}
+
+static bool dump_is_selected(Dump *dump, const TupCaptureFrame *frame,
+        unsigned int type, int slot)
+{
+    if (frame->time_ns < dump->from_ns || frame->time_ns > dump->to_ns)
+        return false;
+
+    if (dump->direction >= 0 && frame->direction != (unsigned) dump->direction)
+        return false;
+
+    if (dump->filter_types && !dump->types[type])
+        return false;
+
+    if (dump->slot >= 0 && slot != dump->slot)
+        return false;
+
+    return true;
+}
+
+static void dump_print_value(const SmpValue *value)
+{
+    size_t i;
+
+    switch (value->type) {
+        case SMP_TYPE_UINT8:
+            printf(" %u", value->value.u8);
+            break;
+        case SMP_TYPE_INT8:
+            printf(" %d", value->value.i8);
+            break;
+        case SMP_TYPE_UINT16:
+            printf(" %u", value->value.u16);
+            break;
+        case SMP_TYPE_INT16:
+            printf(" %d", value->value.i16);
+            break;
+        case SMP_TYPE_UINT32:
+            printf(" %u", value->value.u32);
+            break;
+        case SMP_TYPE_INT32:
+            printf(" %d", value->value.i32);
+            break;
+        case SMP_TYPE_UINT64:
+            printf(" %llu", (unsigned long long) value->value.u64);
+            break;
+        case SMP_TYPE_INT64:
+            printf(" %lld", (long long) value->value.i64);
+            break;
+        case SMP_TYPE_F32:
+            printf(" %g", value->value.f32);
+            break;
+        case SMP_TYPE_F64:
+            printf(" %g", value->value.f64);
+            break;
+        case SMP_TYPE_STRING:
+            printf(" \"%s\"", value->value.cstring);
+            break;
+        case SMP_TYPE_RAW:
+            printf(" ");
+            for (i = 0; i < value->value.craw_size; i++)
+                printf("%02x", value->value.craw[i]);
+            break;
+        default:
+            printf(" ?");
+            break;
+    }
+}
+
+static void dump_print_frame(const TupCaptureFrame *frame, unsigned int type,
+        const SmpValue *values, int n)
+{
+    int i;
+
+    printf("%14.6f %s ", frame->time_ns / 1e9,
+            (frame->direction == TUP_CAPTURE_TX) ? "TX" : "RX");
+
+    if (n < 0) {
+        printf("malformed frame of %zu bytes\n", frame->size);
+        return;
+    }
+
+    if (type == TUP_MESSAGE_ACK || type == TUP_MESSAGE_ERROR) {
+        printf("%s %s", dump_type_name(type),
+                dump_type_name(values[0].value.u32 < DUMP_N_TYPES
+                    ? values[0].value.u32 : DUMP_UNKNOWN_TYPE));
+        values++;
+        n--;
+    } else if (type == DUMP_UNKNOWN_TYPE) {
+        printf("UNKNOWN");
+    } else {
+        printf("%s", dump_type_name(type));
+    }
+
+    for (i = 0; i < n; i++)
+        dump_print_value(&values[i]);
+
+    printf("\n");
+}
+
+static void dump_frame(Dump *dump, const TupCaptureFrame *frame)
+{
+    DumpDirection *dir;
+    DumpPending pending = { 0, -1 };
+    unsigned int type = DUMP_UNKNOWN_TYPE;
+    TupMessageType msg_type;
+    int command = -1;
+    int slot = -1;
+    int n;
+
+    if (frame->direction > TUP_CAPTURE_RX)
+        return;
+
+    n = tup_capture_frame_decode(frame, dump->msg, dump->buf,
+            sizeof(dump->buf));
+    if (n == 0) {
+        /* check the message against its schema */
+        n = tup_message_parse_values(dump->msg, dump->values,
+                N_ELEMENTS(dump->values));
+    }
+
+    if (n >= 0) {
+        msg_type = tup_message_get_type(dump->msg);
+        if (msg_type < DUMP_N_TYPES)
+            type = msg_type;
+
+        slot = dump_get_slot(type, dump->values, n);
+
+        /* pair commands with their response on every frame, whatever
+         * side the capture was made on */
+        if (dump_is_command(type)) {
+            dump_push_command(dump, type, frame->time_ns, slot);
+        } else {
+            command = dump_pop_command(dump, type, dump->values, n,
+                    &pending);
+            if (command >= 0)
+                slot = pending.slot;
+        }
+    }
+
+    if (!dump_is_selected(dump, frame, type, slot))
+        return;
+
+    if (!dump->quiet)
+        dump_print_frame(frame, type, dump->values, n);
+
+    if (dump->n_frames++ == 0)
+        dump->first_ns = frame->time_ns;
+
+    if (frame->time_ns > dump->last_ns)
+        dump->last_ns = frame->time_ns;
+
+    dir = &dump->directions[frame->direction];
+    if (dir->n_frames > 0) {
+        tup_latency_histogram_add(&dir->gaps, (frame->time_ns > dir->last_ns)
+                ? (frame->time_ns - dir->last_ns) / 1000 : 0);
+    }
+
+    dir->n_frames++;
+    dir->n_bytes += frame->size;
+    dir->last_ns = frame->time_ns;
+
+    if (n < 0) {
+        dir->n_malformed++;
+        return;
+    }
+
+    dump->n_messages[type][frame->direction]++;
+
+    if (command >= 0) {
+        tup_latency_histogram_add(&dump->latencies[command],
+                (frame->time_ns > pending.time_ns)
+                ? (frame->time_ns - pending.time_ns) / 1000 : 0);
+
+        if (type == TUP_MESSAGE_ERROR)
+            dump->n_errors[command]++;
+    }
+}
+
+static void dump_print_histogram(const char *name,
+        const TupLatencyHistogram *histogram, uint64_t n_errors,
+        uint64_t n_unanswered)
+{
+    printf("  %-36s %9llu %9u %9u %9u %9u %7llu %7llu\n", name,
+            (unsigned long long) histogram->count,
+            tup_latency_histogram_get_percentile(histogram, 50),
+            tup_latency_histogram_get_percentile(histogram, 90),
+            tup_latency_histogram_get_percentile(histogram, 99),
+            histogram->max_us,
+            (unsigned long long) n_errors,
+            (unsigned long long) n_unanswered);
+}
+
+static void dump_print_stats(Dump *dump)
+{
+    static const char *const direction_names[] = { "TX", "RX" };
+    double duration;
+    unsigned int i;
+    int d;
+
+    duration = (dump->last_ns - dump->first_ns) / 1e9;
+
+    printf("\n%llu frames over %.6f s\n", (unsigned long long) dump->n_frames,
+            duration);
+    if (dump->n_frames == 0)
+        return;
+
+    printf("\nMessages:\n");
+    printf("  %-36s %3s %12s %12s\n", "type", "dir", "count", "msgs/s");
+    for (i = 0; i < DUMP_N_TYPES; i++) {
+        for (d = 0; d < 2; d++) {
+            if (dump->n_messages[i][d] == 0)
+                continue;
+
+            printf("  %-36s %3s %12llu %12.1f\n", dump_type_name(i),
+                    direction_names[d],
+                    (unsigned long long) dump->n_messages[i][d],
+                    (duration > 0) ? dump->n_messages[i][d] / duration : 0);
+        }
+    }
+
+    printf("\nLink at %lu baud (10 bits per byte):\n", dump->baudrate);
+    printf("  %3s %12s %12s %12s %10s\n", "dir", "frames", "bytes",
+            "bytes/s", "usage (%)");
+    for (d = 0; d < 2; d++) {
+        const DumpDirection *dir = &dump->directions[d];
+        double rate = (duration > 0) ? dir->n_bytes / duration : 0;
+
+        printf("  %3s %12llu %12llu %12.1f %10.2f\n", direction_names[d],
+                (unsigned long long) dir->n_frames,
+                (unsigned long long) dir->n_bytes, rate,
+                rate * 10 * 100 / dump->baudrate);
+
+        if (dir->n_malformed > 0) {
+            printf("      %llu malformed frames\n",
+                    (unsigned long long) dir->n_malformed);
+        }
+    }
+
+    printf("\nInter-frame gaps (us):\n");
+    printf("  %-36s %9s %9s %9s %9s %9s\n", "dir", "count", "p50", "p90",
+            "p99", "max");
+    for (d = 0; d < 2; d++) {
+        const TupLatencyHistogram *gaps = &dump->directions[d].gaps;
+
+        if (gaps->count == 0)
+            continue;
+
+        printf("  %-36s %9llu %9u %9u %9u %9u\n", direction_names[d],
+                (unsigned long long) gaps->count,
+                tup_latency_histogram_get_percentile(gaps, 50),
+                tup_latency_histogram_get_percentile(gaps, 90),
+                tup_latency_histogram_get_percentile(gaps, 99),
+                gaps->max_us);
+    }
+
+    printf("\nCommand to response latency (us):\n");
+    printf("  %-36s %9s %9s %9s %9s %9s %7s %7s\n", "command", "count", "p50",
+            "p90", "p99", "max", "errors", "lost");
+    for (i = 0; i < DUMP_N_TYPES; i++) {
+        uint64_t n_unanswered = dump->n_unanswered[i] + dump->pending[i].count;
+
+        if (dump->latencies[i].count == 0 && n_unanswered == 0)
+            continue;
+
+        dump_print_histogram(dump_type_name(i), &dump->latencies[i],
+                dump->n_errors[i], n_unanswered);
+    }
+}
+
+/* to stdout when asked for, stderr on a usage error */
+static void usage(FILE *out, const char *pname)
+{
+    fprintf(out, "Usage: %s [--help] [-q] [-t type,...] [-s slot] "
+            "[-d tx|rx] [-r from:to] [-b baudrate] capture\n", pname);
+    fprintf(out, "\nDecode the frames of a capture written by "
+            "tup_context_start_capture() and\nprint them with statistics "
+            "on the traffic.\n");
+    fprintf(out, "\nOptions:\n"
+            "  -q              only print the statistics\n"
+            "  -t types        comma separated message names or ids\n"
+            "  -s slot         messages about an effect slot\n"
+            "  -d direction    tx or rx frames\n"
+            "  -r from:to      time range in seconds, either bound can be "
+            "omitted\n"
+            "  -b baudrate     baudrate of the link (default %d)\n",
+            DUMP_DEFAULT_BAUDRATE);
+    fprintf(out, "\nStatistics are computed on the selected frames, "
+            "commands are paired with their\nresponse on every frame, "
+            "latencies are counted on the selected responses.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    TupCaptureFile *file;
+    TupCaptureFrame frame;
+    const char *path = NULL;
+    Dump *dump;
+    char date[64];
+    struct tm tm;
+    time_t start;
+    uint64_t start_ns;
+    int ret = 1;
+    int i;
+
+    dump = calloc(1, sizeof(*dump));
+    if (dump == NULL) {
+        fprintf(stderr, "failed to allocate memory\n");
+        return 1;
+    }
+
+    dump->slot = -1;
+    dump->direction = -1;
+    dump->to_ns = UINT64_MAX;
+    dump->baudrate = DUMP_DEFAULT_BAUDRATE;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            usage(stdout, argv[0]);
+            ret = 0;
+            goto done;
+        } else if (strcmp(argv[i], "-q") == 0) {
+            dump->quiet = true;
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            if (dump_types_parse(dump, argv[++i]) < 0) {
+                fprintf(stderr, "invalid types: %s\n", argv[i]);
+                goto done;
+            }
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            dump->slot = strtol(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            i++;
+            if (strcasecmp(argv[i], "tx") == 0) {
+                dump->direction = TUP_CAPTURE_TX;
+            } else if (strcasecmp(argv[i], "rx") == 0) {
+                dump->direction = TUP_CAPTURE_RX;
+            } else {
+                fprintf(stderr, "invalid direction: %s\n", argv[i]);
+                goto done;
+            }
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            if (dump_range_parse(dump, argv[++i]) < 0) {
+                fprintf(stderr, "invalid range: %s\n", argv[i]);
+                goto done;
+            }
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            dump->baudrate = strtoul(argv[++i], NULL, 0);
+        } else if (argv[i][0] != '-' && path == NULL) {
+            path = argv[i];
+        } else {
+            usage(stderr, argv[0]);
+            goto done;
+        }
+    }
+
+    if (path == NULL || dump->baudrate == 0) {
+        usage(stderr, argv[0]);
+        goto done;
+    }
+
+    dump->msg = tup_message_new();
+    if (dump->msg == NULL) {
+        fprintf(stderr, "failed to allocate memory\n");
+        goto done;
+    }
+
+    file = tup_capture_file_open(path);
+    if (file == NULL) {
+        fprintf(stderr, "failed to open capture %s\n", path);
+        goto done;
+    }
+
+    start_ns = tup_capture_file_get_start_time(file);
+    start = start_ns / 1000000000;
+    localtime_r(&start, &tm);
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+    printf("capture %s started on %s.%06u\n\n", path, date,
+            (unsigned int) (start_ns % 1000000000 / 1000));
+
+    while (tup_capture_file_next(file, &frame) > 0)
+        dump_frame(dump, &frame);
+
+    dump_print_stats(dump);
+
+    tup_capture_file_close(file);
+    ret = 0;
+
+done:
+    if (dump->msg != NULL)
+        tup_message_free(dump->msg);
+
+    free(dump);
+    return ret;
+}
@@ -0,0 +1,104 @@
+/* libtup
+ * Copyright (C) 2017 Actronika SAS
+ *     Author: Aurélien Zanelli <aurelien.zanelli@actronika.com>
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <libtupsim.h>
+
+static TupSimulator *simulator;
+
+static void on_signal(int signum)
+{
+    tup_simulator_quit(simulator);
+}
+
+static void usage(const char *pname)
+{
+    printf("Usage: %s [--help] [n_devices] [version]\n", pname);
+    printf("\nSimulate n_devices Tactronik modules (1 by default), each one "
+            "on its own pty.\nThe path of each pty is printed on startup, "
+            "use it as the device of tupctl.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    TupSimConfig config;
+    long n_devices = 1;
+    long i;
+    int ret;
+
+    if (argc > 1 && (strcmp(argv[1], "-h") == 0
+                || strcmp(argv[1], "--help") == 0)) {
+        usage(argv[0]);
+        return 0;
+    }
+
+    if (argc > 1) {
+        n_devices = strtol(argv[1], NULL, 0);
+        if (n_devices <= 0) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    tup_sim_config_init(&config);
+    if (argc > 2)
+        config.version = argv[2];
+
+    simulator = tup_simulator_new();
+    if (simulator == NULL) {
+        fprintf(stderr, "failed to create the simulator\n");
+        return 1;
+    }
+
+    for (i = 0; i < n_devices; i++) {
+        TupTransport *transport;
+        TupSimDevice *dev;
+
+        transport = tup_transport_new_pty();
+        if (transport == NULL) {
+            fprintf(stderr, "failed to create a pty transport\n");
+            ret = 1;
+            goto done;
+        }
+
+        dev = tup_sim_device_new(transport, &config);
+        if (dev == NULL) {
+            fprintf(stderr, "failed to create device %ld\n", i);
+            tup_transport_free(transport);
+            ret = 1;
+            goto done;
+        }
+
+        ret = tup_sim_device_open(dev, NULL);
+        if (ret == 0)
+            ret = tup_simulator_add_device(simulator, dev);
+
+        if (ret < 0) {
+            fprintf(stderr, "failed to start device %ld: %d\n", i, ret);
+            tup_sim_device_free(dev);
+            ret = 1;
+            goto done;
+        }
+
+        printf("device %ld: %s\n", i, tup_transport_get_pty_name(transport));
+    }
+
+    fflush(stdout);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    ret = tup_simulator_run(simulator);
+    if (ret < 0)
+        fprintf(stderr, "simulator stopped with error %d\n", ret);
+
+done:
+    tup_simulator_free(simulator);
+
+    return ret < 0 ? 1 : ret;
+}